@@ -0,0 +1,1426 @@
+#include "User/Capture_feed.h"
+#include "User/Client_swarm.h"
+#include "User/Ssl/Ssl_client.h"
+#include "User/Ssl/Ssl_server.h"
+#include "User/Traffic_replay.h"
+#include "Utility/Allocation_tracker.h"
+#include "Utility/Latency_histogram.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/**
+ *   Echo benchmark of the framework. Clients send messages with their send time to the server, the server sends
+ *   them back and the clients measure the round trips.
+ *
+ *   With the --rate the clients send open loop on a fixed schedule, a message that could not be sent on time
+ *   because the earlier echoes were late is still measured from the time it should have been sent. Without this
+ *   a stall would delay the sends after it and hide their wait, the coordinated omission. Both the corrected and
+ *   the round trips from the actual send are reported. With --window 1 the clients ping-pong one request at a time.
+ *   Run with and without the --ssl and with different --threads to compare the transports and the threading.
+ *
+ *   Network_benchmark [local|server|client] [options]
+ *   local runs the server and the clients in this process, server and client run only one side so the sides
+ *   can be on different hosts.
+ *
+ *   --host <address>     address of the server for the client mode, 127.0.0.1 by default
+ *   --port <port>        port of the server, 1235 by default
+ *   --clients <count>    amount of clients, 4 by default
+ *   --size <bytes>       body size of the messages, atleast 16, 64 by default
+ *   --rate <count>       messages per second of each client, 0 sends as fast as the window allows. With a rate the
+ *                        clients poll instead of waiting for the echoes so they don't oversleep the schedule.
+ *   --window <count>     max messages waiting for the echo of each client, 64 by default
+ *   --seconds <count>    how long the messages are sent, 10 by default
+ *   --threads <count>    asio threads of the server and of each client, 1 by default
+ *   --ssl                uses the Ssl_server and Ssl_client, the certificate is server.crt and key server.key
+ *   --release-tls-buffers the ssl connections of the server and the clients free their tls buffers while they are
+ *                        idle, compare the memory per connection of the --idle mode with and without this
+ *   --memory             connects the clients of the local mode through the in-memory sockets instead of tcp, so
+ *                        the results show the cost of the framework without the network stack. There is no tls
+ *                        in memory.
+ *   --local <path>       server listens also the unix domain socket at the path and the clients connect to it, for
+ *                        the sides on the same host. There is no tls on the unix domain sockets.
+ *   --shared-memory <path> like the --local but the data goes through the shared memory and the unix domain socket
+ *                        only wakes up the sides.
+ *
+ *   --idle <count>       opens the amount of idle connections instead of the echo clients and reports the memory
+ *                        per connection and the accept and handshake rates. The server mode prints the memory
+ *                        when enter is pressed, so the connections can be opened from other hosts. With the
+ *                        NET_TRACK_ALLOCATIONS the local mode fails if the server allocated more for each
+ *                        connection than its budget.
+ *   --source-ip <ip>     first local address the idle connections are bound to, not bound by default
+ *   --source-ips <count> amount of consecutive local addresses the idle connections are spread over, one address
+ *                        has only about 60k ports for the connections to the same server. On linux every address
+ *                        of 127.0.0.0/8 can be used without setting them up.
+ *
+ *   --fanout <count>     opens the amount of receiving connections in the local mode and broadcasts bodies of
+ *                        32 B to 64 KB to all of them with send_message_to_all_clients. Reports the time and the
+ *                        allocations of the broadcasts, the cost per recipient and how long it took until the last
+ *                        recipient had the message. The source ip options spread these connections too.
+ *   --broadcasts <count> broadcasts of each body size, 20 by default
+ *
+ *   --capture <path>     server captures its traffic to the segments of the directory
+ *   --replay <path>      replays the captured traffic of the directory instead of the echo clients, every captured
+ *                        client by its own client. Reports the messages, the replies and how late the messages
+ *                        were sent compared to the capture.
+ *   --speed <factor>     speed of the replay, 1 keeps the captured timing and 0 sends as fast as possible, 1 by
+ *                        default
+ *   --feed <path>        feeds the captured messages of the directory straight to the in queue of a server that
+ *                        is not started and echoes them, over and over for the --seconds. Reports the messages
+ *                        per second and the cpu per message of the update and the handlers without the sockets.
+ *
+ *   --swarm <count>      drives the amount of clients from a few asio threads with the Client_swarm instead of the
+ *                        echo clients. Each client sends echo requests of the --size at the --rate, 10 per second
+ *                        by default, with random intervals for the --seconds. Reports the throughput, the echoes
+ *                        and how late the sends were.
+ *
+ *   --handshakes         clients connect, send one message, wait for its echo and disconnect over and over instead
+ *                        of the echo clients. Reports the connections per second, the cpu per connection, the time
+ *                        from the connect to the first echo and how many tls handshakes were resumed. The client
+ *                        mode shows only the cpu of the clients.
+ *   --no-resumption      server and the clients do not resume the tls sessions, so every handshake is full
+ *   --certificate <file> certificate chain of the server, server.crt by default. Compare the handshakes of rsa and
+ *                        ecdsa certificates by running with each.
+ *   --key <file>         private key of the certificate, server.key by default
+ */
+enum class Message_id : uint8_t
+{
+    echo_request,
+    echo_reply,
+    broadcast
+};
+
+struct Benchmark_settings
+{
+    std::string m_mode = "local";
+    std::string m_host = "127.0.0.1";
+    uint16_t m_port = 1235;
+    size_t m_clients = 4;
+    size_t m_message_size = 64;
+    uint64_t m_rate = 0;
+    size_t m_window = 64;
+    std::chrono::seconds m_duration = std::chrono::seconds(10);
+    size_t m_asio_threads = 1;
+    bool m_use_ssl = false;
+    bool m_release_tls_buffers = false;
+    bool m_use_memory = false;
+    std::string m_local_path = "";
+    std::string m_shared_memory_path = "";
+    std::string m_certificate_file = "server.crt";
+    std::string m_private_key_file = "server.key";
+
+    size_t m_idle_connections = 0;
+    std::string m_source_ip = "";
+    size_t m_source_ip_count = 1;
+
+    size_t m_fanout_recipients = 0;
+    size_t m_broadcasts = 20;
+
+    std::string m_capture_directory = "";
+    std::string m_replay_directory = "";
+    double m_replay_speed = 1.0;
+    std::string m_feed_directory = "";
+
+    size_t m_swarm_clients = 0;
+
+    bool m_measure_handshakes = false;
+    bool m_use_session_resumption = true;
+};
+
+// Opens the in-memory connection to the server for the client that runs on the executor
+using Memory_connector = std::function<std::unique_ptr<Net::Socket_interface>(const asio::any_io_executor&)>;
+
+// Counters of all the clients
+struct Benchmark_results
+{
+    std::atomic<uint64_t> m_messages_sent = 0;
+    std::atomic<uint64_t> m_echoes_received = 0;
+    std::atomic<size_t> m_failed_clients = 0;
+    Net::Latency_histogram m_round_trip;
+
+    // Round trips from the time the message should have been sent, differs from the m_round_trip only with a rate
+    Net::Latency_histogram m_corrected_round_trip;
+};
+
+// Every allocation of the process is counted, so the broadcasts can report how many allocations they took
+std::atomic<uint64_t> allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef NET_TRACK_ALLOCATIONS
+    Net::Allocation_tracker::on_allocation(size);
+#endif
+
+    if (void* pointer = std::malloc(size > 0 ? size : 1))
+        return pointer;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+// @return the cpu time used by all the threads of the process
+[[nodiscard]] std::chrono::nanoseconds get_process_cpu_time()
+{
+#ifdef _WIN32
+    FILETIME creation_time = {};
+    FILETIME exit_time = {};
+    FILETIME kernel_time = {};
+    FILETIME user_time = {};
+
+    if (!::GetProcessTimes(::GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+        return std::chrono::nanoseconds(0);
+
+    auto to_ticks = [](const FILETIME& time) {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+
+    // File times are in 100 nanosecond ticks
+    return std::chrono::nanoseconds((to_ticks(kernel_time) + to_ticks(user_time)) * 100);
+#else
+    return std::chrono::nanoseconds(
+        static_cast<int64_t>(static_cast<double>(std::clock()) / CLOCKS_PER_SEC * 1'000'000'000));
+#endif
+}
+
+// @return the resident memory of the process in bytes, 0 if it is not known on this platform
+[[nodiscard]] size_t get_resident_memory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters = {};
+
+    if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+
+    return counters.WorkingSetSize;
+#elif defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    statm >> total_pages >> resident_pages;
+
+    return resident_pages * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+// Every connection takes a file descriptor, so the soft limit is raised to the hard limit
+void raise_open_file_limit()
+{
+#ifndef _WIN32
+    rlimit limit = {};
+
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+[[nodiscard]] std::string_view get_transport_name(const Benchmark_settings& settings)
+{
+    if (settings.m_use_memory && settings.m_mode == "local")
+        return "memory";
+
+    if (!settings.m_shared_memory_path.empty())
+        return "shared memory";
+
+    if (!settings.m_local_path.empty())
+        return "unix domain socket";
+
+    return settings.m_use_ssl ? "ssl" : "plain";
+}
+
+[[nodiscard]] uint64_t now_in_nanoseconds()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+[[nodiscard]] Benchmark_settings parse_settings(int argc, char* argv[])
+{
+    Benchmark_settings settings;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view argument = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (argument == "local" || argument == "server" || argument == "client")
+            settings.m_mode = argument;
+        else if (argument == "--ssl")
+            settings.m_use_ssl = true;
+        else if (argument == "--release-tls-buffers")
+            settings.m_release_tls_buffers = true;
+        else if (argument == "--memory")
+            settings.m_use_memory = true;
+        else if (argument == "--local" && has_value)
+            settings.m_local_path = argv[++i];
+        else if (argument == "--shared-memory" && has_value)
+            settings.m_shared_memory_path = argv[++i];
+        else if (argument == "--host" && has_value)
+            settings.m_host = argv[++i];
+        else if (argument == "--port" && has_value)
+            settings.m_port = static_cast<uint16_t>(std::stoul(argv[++i]));
+        else if (argument == "--clients" && has_value)
+            settings.m_clients = std::max<size_t>(std::stoull(argv[++i]), 1);
+        else if (argument == "--size" && has_value)
+            settings.m_message_size = std::max<size_t>(std::stoull(argv[++i]), 2 * sizeof(uint64_t));
+        else if (argument == "--rate" && has_value)
+            settings.m_rate = std::stoull(argv[++i]);
+        else if (argument == "--window" && has_value)
+            settings.m_window = std::max<size_t>(std::stoull(argv[++i]), 1);
+        else if (argument == "--seconds" && has_value)
+            settings.m_duration = std::chrono::seconds(std::stoll(argv[++i]));
+        else if (argument == "--threads" && has_value)
+            settings.m_asio_threads = std::max<size_t>(std::stoull(argv[++i]), 1);
+        else if (argument == "--idle" && has_value)
+            settings.m_idle_connections = std::stoull(argv[++i]);
+        else if (argument == "--source-ip" && has_value)
+            settings.m_source_ip = argv[++i];
+        else if (argument == "--source-ips" && has_value)
+            settings.m_source_ip_count = std::max<size_t>(std::stoull(argv[++i]), 1);
+        else if (argument == "--fanout" && has_value)
+            settings.m_fanout_recipients = std::stoull(argv[++i]);
+        else if (argument == "--broadcasts" && has_value)
+            settings.m_broadcasts = std::max<size_t>(std::stoull(argv[++i]), 1);
+        else if (argument == "--capture" && has_value)
+            settings.m_capture_directory = argv[++i];
+        else if (argument == "--replay" && has_value)
+            settings.m_replay_directory = argv[++i];
+        else if (argument == "--speed" && has_value)
+            settings.m_replay_speed = std::max(std::stod(argv[++i]), 0.0);
+        else if (argument == "--feed" && has_value)
+            settings.m_feed_directory = argv[++i];
+        else if (argument == "--swarm" && has_value)
+            settings.m_swarm_clients = std::stoull(argv[++i]);
+        else if (argument == "--handshakes")
+            settings.m_measure_handshakes = true;
+        else if (argument == "--no-resumption")
+            settings.m_use_session_resumption = false;
+        else if (argument == "--certificate" && has_value)
+            settings.m_certificate_file = argv[++i];
+        else if (argument == "--key" && has_value)
+            settings.m_private_key_file = argv[++i];
+        else
+            std::cout << "Unknown argument " << argument << "\n";
+    }
+
+    return settings;
+}
+
+// Sends every received request back to its sender until the stop flag is set
+template <typename Server_type>
+void run_server(Server_type& server, const std::atomic<bool>& stop_flag)
+{
+    while (!stop_flag)
+    {
+        for (Net::Owned_message<Message_id>& owned_message : server.update_batch(Net::SIZE_T_MAX, true))
+        {
+            if (owned_message.m_message.get_id() != Message_id::echo_request)
+                continue;
+
+            owned_message.m_message.set_id(Message_id::echo_reply);
+            server.send_message_to_client(owned_message.m_client_information.m_id, std::move(owned_message.m_message));
+        }
+    }
+}
+
+// Connects the client to the server with the transport of the settings and waits until it is connected or failed
+template <typename Client_type>
+void connect_client(
+    Client_type& client, const Benchmark_settings& settings, const Memory_connector& open_memory_connection)
+{
+    bool is_connecting = false;
+
+    if (open_memory_connection)
+        is_connecting = client.connect(open_memory_connection(client.get_executor()));
+    else if (!settings.m_shared_memory_path.empty())
+        is_connecting = client.connect_shared_memory(settings.m_shared_memory_path);
+    else if (!settings.m_local_path.empty())
+        is_connecting = client.connect_local(settings.m_local_path);
+    else
+        is_connecting = client.connect(settings.m_host, std::to_string(settings.m_port));
+
+    while (is_connecting && client.is_connecting())
+        client.update(Net::SIZE_T_MAX, true);
+}
+
+template <typename Client_type>
+void run_client(
+    Client_type& client, const Benchmark_settings& settings, Benchmark_results& results, std::latch& latch,
+    const Memory_connector& open_memory_connection)
+{
+    client.add_accepted_message(Message_id::echo_reply);
+    connect_client(client, settings, open_memory_connection);
+
+    const bool is_connected = client.is_connected();
+
+    if (!is_connected)
+        ++results.m_failed_clients;
+
+    // Every client starts sending at the same time so the duration is the same for all of them
+    latch.arrive_and_wait();
+
+    if (!is_connected)
+        return;
+
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto end_time = start_time + settings.m_duration;
+    const auto send_interval = settings.m_rate > 0 ? std::chrono::nanoseconds(1'000'000'000 / settings.m_rate)
+                                                   : std::chrono::nanoseconds(0);
+
+    auto next_send_time = start_time;
+    size_t messages_in_flight = 0;
+
+    auto handle_echoes = [&](std::span<Net::Owned_message<Message_id>> echoes) {
+        const uint64_t received_time = now_in_nanoseconds();
+
+        for (Net::Owned_message<Message_id>& echo : echoes)
+        {
+            Net::Message_reader reader(echo.m_message);
+            const uint64_t scheduled_time = reader.template read<uint64_t>();
+            const uint64_t send_time = reader.template read<uint64_t>();
+            results.m_round_trip.record(std::chrono::nanoseconds(received_time - send_time));
+            results.m_corrected_round_trip.record(std::chrono::nanoseconds(received_time - scheduled_time));
+        }
+
+        messages_in_flight -= std::min(messages_in_flight, echoes.size());
+        results.m_echoes_received += echoes.size();
+    };
+
+    while (client.is_connected() && std::chrono::steady_clock::now() < end_time)
+    {
+        const auto now = std::chrono::steady_clock::now();
+
+        if (messages_in_flight < settings.m_window && now >= next_send_time)
+        {
+            // Without a rate the message is scheduled when it is sent
+            const auto scheduled_time = settings.m_rate > 0 ? next_send_time : now;
+
+            Net::Message<Message_id> message;
+            message.set_id(Message_id::echo_request);
+            Net::Message_writer writer(message);
+            writer << static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(scheduled_time.time_since_epoch()).count());
+            writer << now_in_nanoseconds();
+            message.resize_body(settings.m_message_size);
+
+            client.send_message(std::move(message));
+            ++messages_in_flight;
+            ++results.m_messages_sent;
+
+            // Schedule is kept even when behind it, the late messages are sent back to back to catch up
+            next_send_time = settings.m_rate > 0 ? next_send_time + send_interval : now;
+
+            handle_echoes(client.update_batch(Net::SIZE_T_MAX, false));
+        }
+        else if (messages_in_flight > 0)
+            handle_echoes(client.update_batch(Net::SIZE_T_MAX, settings.m_rate == 0));
+        else
+            std::this_thread::sleep_until(next_send_time);
+    }
+
+    // Echoes of the last messages are waited for a moment so they are not counted as lost
+    const auto drain_end_time = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    while (client.is_connected() && messages_in_flight > 0 && std::chrono::steady_clock::now() < drain_end_time)
+        handle_echoes(client.update_batch(Net::SIZE_T_MAX, false));
+
+    client.disconnect();
+}
+
+void print_results(
+    const Benchmark_settings& settings, const Benchmark_results& results, std::chrono::nanoseconds wall_time,
+    std::chrono::nanoseconds cpu_time)
+{
+    const double seconds = std::chrono::duration<double>(wall_time).count();
+    const uint64_t echoes = results.m_echoes_received;
+    const Net::Latency_percentiles round_trip = results.m_round_trip.get_percentiles();
+
+    auto to_microseconds = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    std::cout << std::format(
+        "{} clients, {} byte bodies, {}, {} asio threads{}\n", settings.m_clients - results.m_failed_clients,
+        settings.m_message_size, get_transport_name(settings), settings.m_asio_threads,
+        settings.m_rate > 0 ? std::format(", {} messages per second per client", settings.m_rate) : "");
+    std::cout << std::format("Sent {} messages, received {} echoes in {:.2f} s\n", results.m_messages_sent.load(),
+                             echoes, seconds);
+    std::cout << std::format(
+        "Throughput {:.0f} echoes/s, {:.2f} MB/s each way\n", echoes / seconds,
+        echoes * (settings.m_message_size + sizeof(Net::Message_header<Message_id>)) / seconds / 1'000'000);
+
+    if (echoes > 0)
+        std::cout << std::format("Cpu {:.2f} us per echo\n", to_microseconds(cpu_time) / echoes);
+
+    std::cout << std::format(
+        "Round trip p50 {:.1f} us, p99 {:.1f} us, p999 {:.1f} us, max {:.1f} us\n", to_microseconds(round_trip.m_p50),
+        to_microseconds(round_trip.m_p99), to_microseconds(round_trip.m_p999), to_microseconds(round_trip.m_max));
+
+    if (settings.m_rate == 0)
+        return;
+
+    const Net::Latency_percentiles corrected = results.m_corrected_round_trip.get_percentiles();
+
+    std::cout << std::format(
+        "Corrected p50 {:.1f} us, p99 {:.1f} us, p999 {:.1f} us, max {:.1f} us\n", to_microseconds(corrected.m_p50),
+        to_microseconds(corrected.m_p99), to_microseconds(corrected.m_p999), to_microseconds(corrected.m_max));
+}
+
+template <typename Client_type>
+void run_clients(const Benchmark_settings& settings, const Memory_connector& open_memory_connection = {})
+{
+    Benchmark_results results;
+    std::latch latch(static_cast<std::ptrdiff_t>(settings.m_clients + 1));
+    std::vector<std::unique_ptr<Client_type>> clients;
+    std::vector<std::thread> client_threads;
+
+    for (size_t i = 0; i < settings.m_clients; ++i)
+    {
+        clients.push_back(std::make_unique<Client_type>());
+        clients.back()->set_asio_threads(settings.m_asio_threads);
+
+        if constexpr (std::is_same_v<Client_type, Net::Ssl_client<Message_id>>)
+        {
+            clients.back()->set_ssl_verify_file(settings.m_certificate_file);
+            clients.back()->set_idle_buffer_release(settings.m_release_tls_buffers);
+        }
+
+        client_threads.emplace_back([&settings, &results, &latch, &open_memory_connection, &client = *clients.back()] {
+            run_client(client, settings, results, latch, open_memory_connection);
+        });
+    }
+
+    latch.arrive_and_wait();
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_cpu_time = get_process_cpu_time();
+
+    for (std::thread& thread : client_threads)
+        thread.join();
+
+    print_results(
+        settings, results, std::chrono::steady_clock::now() - start_time, get_process_cpu_time() - start_cpu_time);
+}
+
+/**
+ *   Opens the connections with bare asio sockets, so the client side takes only the sockets and in the local
+ *   mode the memory of the process grows mostly by the connections of the server. The connections stay idle
+ *   unless they are started reading.
+ */
+class Bare_connections
+{
+public:
+    // Called on the reading threads for every user message, the body has been read past already
+    using Message_handler = std::function<void(const Net::Message_header<Message_id>&)>;
+
+    Bare_connections(const Benchmark_settings& settings, size_t count)
+        : m_settings(settings), m_count(count), m_ssl_context(asio::ssl::context::tls_client)
+    {
+        m_ssl_context.set_verify_mode(asio::ssl::verify_none);
+    }
+
+    Bare_connections(const Bare_connections&) = delete;
+    Bare_connections(Bare_connections&&) = delete;
+
+    ~Bare_connections()
+    {
+        stop_reading();
+    }
+
+    Bare_connections& operator=(const Bare_connections&) = delete;
+    Bare_connections& operator=(Bare_connections&&) = delete;
+
+    // @return the amount of connections that were opened
+    size_t open()
+    {
+        Net::Protocol::resolver resolver(m_context);
+        m_server_endpoint = *resolver.resolve(m_settings.m_host, std::to_string(m_settings.m_port)).begin();
+
+        const size_t workers = std::min(m_count, MAX_CONNECTS_IN_FLIGHT);
+
+        for (size_t worker = 0; worker < workers; ++worker)
+            asio::co_spawn(m_context, open_connections(worker, workers), asio::detached);
+
+        // Tls handshakes take cpu on this side too, so they are done on many threads
+        const size_t thread_count = m_settings.m_use_ssl ? std::max(std::thread::hardware_concurrency() / 2, 1u) : 1;
+        std::vector<std::thread> threads;
+
+        for (size_t i = 1; i < thread_count; ++i)
+            threads.emplace_back([this] { m_context.run(); });
+
+        m_context.run();
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        return m_plain_sockets.size() + m_ssl_sockets.size();
+    }
+
+    // Reads the messages of the opened connections on the threads until stop_reading is called
+    void start_reading(Message_handler message_handler, size_t thread_count)
+    {
+        m_message_handler = std::move(message_handler);
+
+        for (Net::Protocol::socket& socket : m_plain_sockets)
+            asio::co_spawn(m_context, read_messages(socket), asio::detached);
+
+        for (std::unique_ptr<Net::Ssl_socket>& ssl_socket : m_ssl_sockets)
+            asio::co_spawn(m_context, read_messages(*ssl_socket), asio::detached);
+
+        // Context ran out of work when the connections were opened
+        m_context.restart();
+
+        for (size_t i = 0; i < thread_count; ++i)
+            m_reading_threads.emplace_back([this] { m_context.run(); });
+    }
+
+    void stop_reading()
+    {
+        m_context.stop();
+
+        for (std::thread& thread : m_reading_threads)
+            thread.join();
+
+        m_reading_threads.clear();
+    }
+
+    [[nodiscard]] size_t get_failed_count() const noexcept
+    {
+        return m_failed_count;
+    }
+
+    [[nodiscard]] const asio::error_code& get_first_error() const noexcept
+    {
+        return m_first_error;
+    }
+
+private:
+    static constexpr size_t MAX_CONNECTS_IN_FLIGHT = 256;
+
+    // Bodies are read past in chunks, a buffer of the whole body for every connection would not fit in the memory
+    static constexpr size_t DISCARD_BUFFER_SIZE = 4096;
+
+    // Opens every step:th connection starting from the first index
+    asio::awaitable<void> open_connections(size_t first_index, size_t step)
+    {
+        for (size_t index = first_index; index < m_count; index += step)
+        {
+            asio::error_code error;
+            Net::Protocol::socket socket(m_context);
+            socket.open(m_server_endpoint.protocol(), error);
+
+            if (!error && !m_settings.m_source_ip.empty())
+                socket.bind(Net::Protocol::endpoint(get_source_address(index), 0), error);
+
+            if (!error)
+                co_await socket.async_connect(m_server_endpoint, asio::redirect_error(asio::use_awaitable, error));
+
+            if (error)
+            {
+                add_failure(error);
+                continue;
+            }
+
+            if (!m_settings.m_use_ssl)
+            {
+                std::scoped_lock lock(m_mutex);
+                m_plain_sockets.push_back(std::move(socket));
+                continue;
+            }
+
+            auto ssl_socket = std::make_unique<Net::Ssl_socket>(std::move(socket), m_ssl_context);
+            co_await ssl_socket->async_handshake(
+                asio::ssl::stream_base::client, asio::redirect_error(asio::use_awaitable, error));
+
+            if (error)
+            {
+                add_failure(error);
+                continue;
+            }
+
+            std::scoped_lock lock(m_mutex);
+            m_ssl_sockets.push_back(std::move(ssl_socket));
+        }
+    }
+
+    // Reads the messages in the standard header format until the connection is closed, internal ones are skipped
+    template <typename Stream_type>
+    asio::awaitable<void> read_messages(Stream_type& stream)
+    {
+        Net::Message_header<Message_id> header;
+        std::array<char, DISCARD_BUFFER_SIZE> discard_buffer;
+        asio::error_code error;
+
+        while (!error)
+        {
+            co_await asio::async_read(
+                stream, asio::buffer(&header, sizeof(header)), asio::redirect_error(asio::use_awaitable, error));
+
+            for (Net::Header_size_type remaining = header.m_size; remaining > 0 && !error;)
+            {
+                const auto chunk_size =
+                    static_cast<size_t>(std::min<Net::Header_size_type>(remaining, DISCARD_BUFFER_SIZE));
+                co_await asio::async_read(
+                    stream, asio::buffer(discard_buffer.data(), chunk_size),
+                    asio::redirect_error(asio::use_awaitable, error));
+                remaining -= chunk_size;
+            }
+
+            if (!error && header.m_internal_id == Net::Internal_id::not_internal)
+                m_message_handler(header);
+        }
+    }
+
+    // Connections are spread over the consecutive addresses starting from the source ip
+    [[nodiscard]] asio::ip::address get_source_address(size_t index) const
+    {
+        const asio::ip::address_v4 first_address = asio::ip::make_address_v4(m_settings.m_source_ip);
+        const auto offset = static_cast<asio::ip::address_v4::uint_type>(index % m_settings.m_source_ip_count);
+
+        return asio::ip::address_v4(first_address.to_uint() + offset);
+    }
+
+    void add_failure(const asio::error_code& error)
+    {
+        std::scoped_lock lock(m_mutex);
+
+        if (m_failed_count++ == 0)
+            m_first_error = error;
+    }
+
+    const Benchmark_settings& m_settings;
+    size_t m_count = 0;
+    asio::io_context m_context;
+    asio::ssl::context m_ssl_context;
+    Net::Protocol::endpoint m_server_endpoint;
+
+    std::mutex m_mutex;
+    std::vector<Net::Protocol::socket> m_plain_sockets;
+    std::vector<std::unique_ptr<Net::Ssl_socket>> m_ssl_sockets;
+    size_t m_failed_count = 0;
+    asio::error_code m_first_error;
+
+    Message_handler m_message_handler;
+    std::vector<std::thread> m_reading_threads;
+};
+
+// Idle connections are multiplied by these, so they are kept under the budgets. With the libstdc++ release build
+// the connection was 3760 bytes and the server took 10.3 allocations of 7.8 KB to accept and set it up when the
+// budgets were set.
+constexpr size_t MAX_CONNECTION_SIZE = 4096;
+constexpr double MAX_IDLE_CONNECTION_ALLOCATIONS = 16;
+constexpr double MAX_IDLE_CONNECTION_BYTES = 10 * 1024;
+
+// Checked iterators of the debug builds make the containers larger
+#ifdef NDEBUG
+static_assert(sizeof(Net::Connection<Message_id>) <= MAX_CONNECTION_SIZE, "Connection grew over its budget");
+#endif
+
+void print_connection_sizes()
+{
+    std::cout << std::format(
+        "Connection {} bytes, plain socket {} bytes, ssl socket {} bytes, message {} bytes\n",
+        sizeof(Net::Connection<Message_id>), sizeof(Net::Template_socket<Net::Protocol::socket>),
+        sizeof(Net::Template_socket<Net::Ssl_socket>), sizeof(Net::Message<Message_id>));
+}
+
+/**
+ *   Reports the allocations of the server to accept the connections and do their handshakes, when the framework
+ *   is built with the NET_TRACK_ALLOCATIONS
+ *
+ *   @param the connections that were opened since the Allocation_tracker was reset
+ *   @throws if a connection took more allocations or bytes than its budget
+ */
+void check_idle_allocations(size_t connections)
+{
+#ifdef NET_TRACK_ALLOCATIONS
+    if (connections == 0)
+        return;
+
+    const Net::Allocation_stats accept = Net::Allocation_tracker::get_stats(Net::Allocation_stage::accept);
+    const Net::Allocation_stats handshake = Net::Allocation_tracker::get_stats(Net::Allocation_stage::handshake);
+    const double allocations = static_cast<double>(accept.m_allocations + handshake.m_allocations) / connections;
+    const double bytes = static_cast<double>(accept.m_bytes + handshake.m_bytes) / connections;
+
+    std::cout << std::format(
+        "Server took {:.1f} allocations and {:.0f} bytes to accept and set up each connection\n", allocations, bytes);
+
+    if (allocations > MAX_IDLE_CONNECTION_ALLOCATIONS || bytes > MAX_IDLE_CONNECTION_BYTES)
+        throw std::runtime_error(std::format(
+            "Connection is over the budget of {} allocations and {} bytes", MAX_IDLE_CONNECTION_ALLOCATIONS,
+            MAX_IDLE_CONNECTION_BYTES));
+#else
+    static_cast<void>(connections);
+#endif
+}
+
+// Prints the memory per connection of the server, the memory before the server was created is the baseline
+template <typename Server_type>
+void print_server_memory(Server_type& server, size_t baseline_memory)
+{
+    const size_t connections = server.get_metrics().m_connections;
+    const size_t memory = get_resident_memory();
+    const size_t grown_memory = memory > baseline_memory ? memory - baseline_memory : 0;
+
+    std::cout << std::format(
+        "{} connections, resident memory {:.1f} MB, {:.0f} bytes per connection\n", connections,
+        memory / 1'000'000.0, connections > 0 ? static_cast<double>(grown_memory) / connections : 0.0);
+}
+
+/**
+ *   Opens the idle connections and reports how fast they were opened. In the local mode the server is given and
+ *   its accept and handshake rates and the memory per connection are reported too.
+ */
+template <typename Server_type>
+void run_idle_connections(const Benchmark_settings& settings, Server_type* server)
+{
+    const size_t memory_before = get_resident_memory();
+    const auto accepted_before = server ? server->get_accept_counters().m_accepted_connections : 0;
+    const auto handshakes_before = server ? server->get_metrics().m_handshakes : 0;
+    const auto start_time = std::chrono::steady_clock::now();
+
+#ifdef NET_TRACK_ALLOCATIONS
+    Net::Allocation_tracker::reset();
+#endif
+
+    Bare_connections connections(settings, settings.m_idle_connections);
+    const size_t opened = connections.open();
+    const double open_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    std::cout << std::format(
+        "Opened {} of {} {} connections in {:.2f} s, {:.0f} connections/s\n", opened, settings.m_idle_connections,
+        settings.m_use_ssl ? "ssl" : "plain", open_seconds, opened / open_seconds);
+
+    if (connections.get_failed_count() > 0)
+        std::cout << std::format(
+            "{} connections failed, first because {}\n", connections.get_failed_count(),
+            connections.get_first_error().message());
+
+    if (server == nullptr)
+    {
+        std::cout << "Press enter to close the connections\n";
+        std::cin.get();
+        return;
+    }
+
+    // Server has the connections only after its update has handled them
+    const auto wait_end_time = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+    while (server->get_metrics().m_connections < opened && std::chrono::steady_clock::now() < wait_end_time)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const double server_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const auto accepted = server->get_accept_counters().m_accepted_connections - accepted_before;
+    const auto handshakes = server->get_metrics().m_handshakes - handshakes_before;
+
+    std::cout << std::format(
+        "Server accepted {:.0f} connections/s and finished {:.0f} handshakes/s\n", accepted / server_seconds,
+        handshakes / server_seconds);
+
+    const size_t memory_after = get_resident_memory();
+    const size_t grown_memory = memory_after > memory_before ? memory_after - memory_before : 0;
+
+    std::cout << std::format(
+        "Resident memory grew {:.1f} MB, {:.0f} bytes per connection with the client sockets of this process\n",
+        grown_memory / 1'000'000.0, opened > 0 ? static_cast<double>(grown_memory) / opened : 0.0);
+    print_connection_sizes();
+    check_idle_allocations(handshakes);
+}
+
+// Body sizes of the broadcasts
+constexpr std::array<size_t, 4> FANOUT_MESSAGE_SIZES = {32, 1024, 16 * 1024, 64 * 1024};
+
+// Deliveries of the broadcast that is in flight, the receivers update them on the reading threads
+struct Fanout_results
+{
+    std::atomic<uint64_t> m_send_time = 0;
+    std::atomic<uint64_t> m_received_count = 0;
+    std::atomic<uint64_t> m_last_received_time = 0;
+    std::array<Net::Latency_histogram, FANOUT_MESSAGE_SIZES.size()> m_delivery;
+    std::atomic<size_t> m_size_index = 0;
+};
+
+/**
+ *   Broadcasts the messages one at a time to the bare receiving connections and waits until every receiver has
+ *   the message before the next one, so the time of the last recipient is not mixed with the previous broadcast.
+ *   The first broadcast of every size is not measured so the buffers have grown for the size.
+ */
+template <typename Server_type>
+void run_fanout(const Benchmark_settings& settings, Server_type* server)
+{
+    if (server == nullptr)
+    {
+        std::cout << "Fan-out sends from the server of this process, use the local mode\n";
+        return;
+    }
+
+    Bare_connections connections(settings, settings.m_fanout_recipients);
+    const size_t recipients = connections.open();
+
+    if (connections.get_failed_count() > 0)
+        std::cout << std::format(
+            "{} connections failed, first because {}\n", connections.get_failed_count(),
+            connections.get_first_error().message());
+
+    const auto wait_end_time = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+    while (server->get_metrics().m_connections < recipients && std::chrono::steady_clock::now() < wait_end_time)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    Fanout_results results;
+
+    connections.start_reading(
+        [&results](const Net::Message_header<Message_id>& header) {
+            if (header.m_id != Message_id::broadcast)
+                return;
+
+            const uint64_t received_time = now_in_nanoseconds();
+            const uint64_t send_time = results.m_send_time.load(std::memory_order_relaxed);
+            results.m_delivery[results.m_size_index].record(std::chrono::nanoseconds(received_time - send_time));
+
+            uint64_t last_received_time = results.m_last_received_time.load(std::memory_order_relaxed);
+
+            while (last_received_time < received_time &&
+                   !results.m_last_received_time.compare_exchange_weak(last_received_time, received_time))
+            {
+            }
+
+            results.m_received_count.fetch_add(1, std::memory_order_release);
+        },
+        std::max(std::thread::hardware_concurrency() / 2, 1u));
+
+    auto to_microseconds = [](auto duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    std::cout << std::format(
+        "Broadcasting {} times to {} {} recipients, allocations are counted in the whole process\n",
+        settings.m_broadcasts, recipients, settings.m_use_ssl ? "ssl" : "plain");
+    std::cout << std::format(
+        "{:>8} {:>12} {:>14} {:>12} {:>14} {:>12} {:>12} {:>14} {:>14} {:>14}\n", "Bytes", "Call us",
+        "Call ns/recip", "Allocations", "Allocs/recip", "Deliver p50", "Deliver p99", "Last avg us", "Last max us",
+        "Cpu ns/recip");
+
+    for (size_t size_index = 0; size_index < FANOUT_MESSAGE_SIZES.size(); ++size_index)
+    {
+        results.m_size_index = size_index;
+
+        std::chrono::nanoseconds call_time(0);
+        std::chrono::nanoseconds cpu_time(0);
+        std::chrono::nanoseconds last_delivery_sum(0);
+        std::chrono::nanoseconds last_delivery_max(0);
+        uint64_t allocations = 0;
+        size_t measured_broadcasts = 0;
+        bool is_lost = false;
+
+        for (size_t broadcast = 0; broadcast <= settings.m_broadcasts && !is_lost; ++broadcast)
+        {
+            Net::Message<Message_id> message;
+            message.set_id(Message_id::broadcast);
+            message.resize_body(FANOUT_MESSAGE_SIZES[size_index]);
+
+            results.m_received_count = 0;
+            results.m_last_received_time = 0;
+
+            const uint64_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+            const auto cpu_time_before = get_process_cpu_time();
+            const uint64_t send_time = now_in_nanoseconds();
+            results.m_send_time = send_time;
+
+            server->send_message_to_all_clients(message);
+            const auto broadcast_call_time = std::chrono::nanoseconds(now_in_nanoseconds() - send_time);
+
+            const auto delivery_end_time = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+            while (results.m_received_count.load(std::memory_order_acquire) < recipients)
+            {
+                if (std::chrono::steady_clock::now() > delivery_end_time)
+                {
+                    is_lost = true;
+                    break;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            // Warm up broadcast only grows the buffers
+            if (broadcast == 0 || is_lost)
+                continue;
+
+            const auto last_delivery = std::chrono::nanoseconds(results.m_last_received_time - send_time);
+            call_time += broadcast_call_time;
+            cpu_time += get_process_cpu_time() - cpu_time_before;
+            last_delivery_sum += last_delivery;
+            last_delivery_max = std::max(last_delivery_max, last_delivery);
+            allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+            ++measured_broadcasts;
+        }
+
+        if (is_lost)
+        {
+            std::cout << std::format(
+                "{:>8} only {} of {} recipients received the broadcast\n", FANOUT_MESSAGE_SIZES[size_index],
+                results.m_received_count.load(), recipients);
+            continue;
+        }
+
+        const double broadcasts = static_cast<double>(measured_broadcasts);
+        const double deliveries = broadcasts * std::max<size_t>(recipients, 1);
+
+        // Warm up deliveries are in the histogram too, they don't move the percentiles much
+        const Net::Latency_percentiles delivery = results.m_delivery[size_index].get_percentiles();
+
+        std::cout << std::format(
+            "{:>8} {:>12.1f} {:>14.1f} {:>12.1f} {:>14.3f} {:>12.1f} {:>12.1f} {:>14.1f} {:>14.1f} {:>14.1f}\n",
+            FANOUT_MESSAGE_SIZES[size_index], to_microseconds(call_time) / broadcasts,
+            static_cast<double>(call_time.count()) / deliveries, allocations / broadcasts, allocations / deliveries,
+            to_microseconds(delivery.m_p50), to_microseconds(delivery.m_p99),
+            to_microseconds(last_delivery_sum) / broadcasts, to_microseconds(last_delivery_max),
+            static_cast<double>(cpu_time.count()) / deliveries);
+    }
+
+    std::cout << "Call is the send_message_to_all_clients, deliver and last are from the call to the receivers and "
+                 "the cpu includes the receivers of this process\n";
+}
+
+// Connects every captured client of the directory the same way as the echo clients and replays its messages
+template <typename Client_type>
+void run_replay(const Benchmark_settings& settings, const Memory_connector& open_memory_connection = {})
+{
+    Net::Traffic_replay<Message_id, Client_type> replay(
+        {.m_directory = settings.m_replay_directory,
+         .m_speed = settings.m_replay_speed,
+         .m_io_threads = std::max(std::thread::hardware_concurrency() / 2, 1u)});
+
+    if constexpr (std::is_same_v<Client_type, Net::Ssl_client<Message_id>>)
+    {
+        replay.set_client_setup([&settings](Client_type& client) {
+            client.set_ssl_verify_file(settings.m_certificate_file);
+            client.set_idle_buffer_release(settings.m_release_tls_buffers);
+        });
+    }
+
+    const Net::Traffic_replay_results results = replay.run([&settings, &open_memory_connection](Client_type& client) {
+        if (open_memory_connection)
+            return client.connect(open_memory_connection(client.get_executor()));
+
+        if (!settings.m_shared_memory_path.empty())
+            return client.connect_shared_memory(settings.m_shared_memory_path);
+
+        if (!settings.m_local_path.empty())
+            return client.connect_local(settings.m_local_path);
+
+        return client.connect(settings.m_host, std::to_string(settings.m_port));
+    });
+
+    auto to_microseconds = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    const double seconds = std::chrono::duration<double>(results.m_replay_duration).count();
+
+    std::cout << std::format(
+        "Replayed {} of {} clients, {}, speed {}\n", results.m_clients - results.m_failed_clients, results.m_clients,
+        get_transport_name(settings), settings.m_replay_speed > 0.0 ? std::format("{}x", settings.m_replay_speed)
+                                                                     : std::string("max"));
+    std::cout << std::format(
+        "Sent {} messages, {:.2f} MB in {:.2f} s of {:.2f} s captured, received {} replies, skipped {} frames\n",
+        results.m_sent_messages, results.m_sent_bytes / 1'000'000.0, seconds,
+        std::chrono::duration<double>(results.m_captured_duration).count(), results.m_received_messages,
+        results.m_skipped_frames);
+
+    if (seconds > 0.0)
+        std::cout << std::format("Throughput {:.0f} messages/s\n", results.m_sent_messages / seconds);
+
+    if (settings.m_replay_speed > 0.0)
+        std::cout << std::format(
+            "Send lag p50 {:.1f} us, p99 {:.1f} us, max {:.1f} us\n", to_microseconds(results.m_send_lag.m_p50),
+            to_microseconds(results.m_send_lag.m_p99), to_microseconds(results.m_send_lag.m_max));
+}
+
+// Feeds the capture to a server without connections and echoes the messages, the replies are dropped
+template <typename Server_type>
+void run_feed(const Benchmark_settings& settings)
+{
+    Server_type server(settings.m_port);
+    Net::Capture_feed<Message_id> feed(settings.m_feed_directory);
+
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_cpu_time = get_process_cpu_time();
+    const auto end_time = start_time + settings.m_duration;
+    uint64_t handled_messages = 0;
+    uint64_t captures = 0;
+
+    do
+    {
+        feed.rewind();
+        ++captures;
+
+        while (!feed.is_done())
+        {
+            static_cast<void>(feed.feed(server));
+
+            for (Net::Owned_message<Message_id>& owned_message : server.update_batch())
+            {
+                ++handled_messages;
+
+                if (owned_message.m_message.get_id() != Message_id::echo_request)
+                    continue;
+
+                owned_message.m_message.set_id(Message_id::echo_reply);
+                server.send_message_to_client(
+                    owned_message.m_client_information.m_id, std::move(owned_message.m_message));
+            }
+        }
+    } while (std::chrono::steady_clock::now() < end_time && handled_messages > 0);
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const auto cpu_time = get_process_cpu_time() - start_cpu_time;
+
+    std::cout << std::format(
+        "Fed the capture {} times, {} messages in {:.2f} s, skipped {} frames\n", captures, handled_messages, seconds,
+        feed.get_skipped_frames());
+
+    if (handled_messages > 0)
+        std::cout << std::format(
+            "Throughput {:.0f} messages/s, cpu {:.3f} us per message\n", handled_messages / seconds,
+            std::chrono::duration<double, std::micro>(cpu_time).count() / handled_messages);
+}
+
+// Connects the swarm of clients the same way as the echo clients and sends echo requests from all of them
+template <typename Client_type>
+void run_swarm(const Benchmark_settings& settings, const Memory_connector& open_memory_connection = {})
+{
+    const double rate = settings.m_rate > 0 ? static_cast<double>(settings.m_rate) : 10.0;
+
+    Net::Client_swarm<Message_id, Client_type> swarm(
+        {.m_clients = settings.m_swarm_clients,
+         .m_io_threads = std::max(std::thread::hardware_concurrency() / 2, 1u),
+         .m_messages_per_second = rate,
+         .m_messages = {{.m_id = Message_id::echo_request,
+                         .m_min_size = settings.m_message_size,
+                         .m_max_size = settings.m_message_size}},
+         .m_reply_ids = {Message_id::echo_reply},
+         .m_duration = settings.m_duration});
+
+    if constexpr (std::is_same_v<Client_type, Net::Ssl_client<Message_id>>)
+    {
+        swarm.set_client_setup([&settings](Client_type& client) {
+            client.set_ssl_verify_file(settings.m_certificate_file);
+            client.set_idle_buffer_release(settings.m_release_tls_buffers);
+        });
+    }
+
+    const Net::Client_swarm_results results = swarm.run([&settings, &open_memory_connection](Client_type& client) {
+        if (open_memory_connection)
+            return client.connect(open_memory_connection(client.get_executor()));
+
+        if (!settings.m_shared_memory_path.empty())
+            return client.connect_shared_memory(settings.m_shared_memory_path);
+
+        if (!settings.m_local_path.empty())
+            return client.connect_local(settings.m_local_path);
+
+        return client.connect(settings.m_host, std::to_string(settings.m_port));
+    });
+
+    auto to_microseconds = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    const double seconds = std::chrono::duration<double>(results.m_duration).count();
+
+    std::cout << std::format(
+        "Swarm of {} clients, {} failed to connect and {} lost, {}, {} messages/s each\n", results.m_clients,
+        results.m_failed_clients, results.m_lost_clients, get_transport_name(settings), rate);
+    std::cout << std::format(
+        "Sent {} messages, {:.2f} MB in {:.2f} s, received {} echoes\n", results.m_sent_messages,
+        results.m_sent_bytes / 1'000'000.0, seconds, results.m_received_messages);
+
+    if (seconds > 0.0)
+        std::cout << std::format("Throughput {:.0f} messages/s\n", results.m_sent_messages / seconds);
+
+    std::cout << std::format(
+        "Send lag p50 {:.1f} us, p99 {:.1f} us, max {:.1f} us\n", to_microseconds(results.m_send_lag.m_p50),
+        to_microseconds(results.m_send_lag.m_p99), to_microseconds(results.m_send_lag.m_max));
+
+    if (results.m_round_trip_times.m_count > 0)
+        std::cout << std::format(
+            "Heartbeat round trip p50 {:.1f} us, p99 {:.1f} us over {} clients\n",
+            to_microseconds(results.m_round_trip_times.m_p50), to_microseconds(results.m_round_trip_times.m_p99),
+            results.m_round_trip_times.m_count);
+}
+
+// Counters of all the reconnecting clients
+struct Handshake_results
+{
+    std::atomic<uint64_t> m_connections = 0;
+    std::atomic<uint64_t> m_failed_connections = 0;
+    std::atomic<uint64_t> m_full_handshakes = 0;
+    std::atomic<uint64_t> m_resumed_handshakes = 0;
+
+    // From the start of the connect until the echo of the first message was received
+    Net::Latency_histogram m_first_message;
+};
+
+// Connects, sends one message and waits for its echo, then disconnects, until the duration has passed
+template <typename Client_type>
+void run_reconnecting_client(
+    Client_type& client, const Benchmark_settings& settings, Handshake_results& results, std::latch& latch)
+{
+    client.add_accepted_message(Message_id::echo_reply);
+    latch.arrive_and_wait();
+
+    const auto end_time = std::chrono::steady_clock::now() + settings.m_duration;
+
+    while (std::chrono::steady_clock::now() < end_time)
+    {
+        const auto connect_time = std::chrono::steady_clock::now();
+        connect_client(client, settings, {});
+
+        if (!client.is_connected())
+        {
+            ++results.m_failed_connections;
+            client.disconnect();
+            continue;
+        }
+
+        Net::Message<Message_id> message;
+        message.set_id(Message_id::echo_request);
+        message.resize_body(settings.m_message_size);
+        client.send_message(std::move(message));
+
+        bool has_echo = false;
+
+        while (!has_echo && client.is_connected())
+            has_echo = !client.update_batch(Net::SIZE_T_MAX, true).empty();
+
+        if (has_echo)
+        {
+            results.m_first_message.record(std::chrono::steady_clock::now() - connect_time);
+            ++results.m_connections;
+        }
+        else
+            ++results.m_failed_connections;
+
+        client.disconnect();
+    }
+
+    if constexpr (std::is_same_v<Client_type, Net::Ssl_client<Message_id>>)
+    {
+        const Net::Tls_handshake_counters counters = client.get_handshake_counters();
+        results.m_full_handshakes += counters.m_full_handshakes;
+        results.m_resumed_handshakes += counters.m_resumed_handshakes;
+    }
+}
+
+// Measures how fast the clients connect and get their first message through, mostly the cost of the tls handshakes
+template <typename Client_type>
+void run_handshakes(const Benchmark_settings& settings)
+{
+    Handshake_results results;
+    std::latch latch(static_cast<std::ptrdiff_t>(settings.m_clients + 1));
+    std::vector<std::unique_ptr<Client_type>> clients;
+    std::vector<std::thread> client_threads;
+
+    for (size_t i = 0; i < settings.m_clients; ++i)
+    {
+        clients.push_back(std::make_unique<Client_type>());
+        clients.back()->set_asio_threads(settings.m_asio_threads);
+
+        if constexpr (std::is_same_v<Client_type, Net::Ssl_client<Message_id>>)
+        {
+            clients.back()->set_ssl_verify_file(settings.m_certificate_file);
+            clients.back()->set_session_reuse(settings.m_use_session_resumption);
+        }
+
+        client_threads.emplace_back([&settings, &results, &latch, &client = *clients.back()] {
+            run_reconnecting_client(client, settings, results, latch);
+        });
+    }
+
+    latch.arrive_and_wait();
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_cpu_time = get_process_cpu_time();
+
+    for (std::thread& thread : client_threads)
+        thread.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const auto cpu_time = get_process_cpu_time() - start_cpu_time;
+    const uint64_t connections = results.m_connections;
+    const Net::Latency_percentiles first_message = results.m_first_message.get_percentiles();
+
+    auto to_microseconds = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    std::cout << std::format(
+        "{} reconnecting clients, {}, certificate {}, {}\n", settings.m_clients, get_transport_name(settings),
+        settings.m_certificate_file, settings.m_use_session_resumption ? "resumption" : "no resumption");
+    std::cout << std::format(
+        "{} connections, {} failed in {:.2f} s, {:.0f} connections/s\n", connections,
+        results.m_failed_connections.load(), seconds, connections / seconds);
+
+    if (settings.m_use_ssl)
+        std::cout << std::format(
+            "Client handshakes {} full, {} resumed\n", results.m_full_handshakes.load(),
+            results.m_resumed_handshakes.load());
+
+    if (connections > 0)
+        std::cout << std::format("Cpu {:.1f} us per connection\n", to_microseconds(cpu_time) / connections);
+
+    std::cout << std::format(
+        "First message p50 {:.1f} us, p99 {:.1f} us, p999 {:.1f} us, max {:.1f} us\n",
+        to_microseconds(first_message.m_p50), to_microseconds(first_message.m_p99),
+        to_microseconds(first_message.m_p999), to_microseconds(first_message.m_max));
+}
+
+template <typename Server_type, typename Client_type>
+void run_benchmark(const Benchmark_settings& settings)
+{
+    const size_t baseline_memory = get_resident_memory();
+    std::unique_ptr<Server_type> server;
+    std::atomic<bool> server_stop_flag = false;
+    std::thread server_thread;
+
+    if (!settings.m_feed_directory.empty())
+    {
+        run_feed<Server_type>(settings);
+        return;
+    }
+
+    if (settings.m_mode != "client")
+    {
+        server = std::make_unique<Server_type>(settings.m_port);
+        server->add_accepted_message(Message_id::echo_request);
+        server->set_asio_threads(settings.m_asio_threads);
+
+        if (!settings.m_local_path.empty())
+            server->set_local_path(settings.m_local_path);
+
+        if (!settings.m_shared_memory_path.empty())
+            server->set_shared_memory_path(settings.m_shared_memory_path);
+
+        if (!settings.m_capture_directory.empty())
+            server->set_traffic_capture(Net::Traffic_capture_settings{.m_directory = settings.m_capture_directory});
+
+        if constexpr (std::is_same_v<Server_type, Net::Ssl_server<Message_id>>)
+        {
+            server->set_ssl_certificate_chain_file(settings.m_certificate_file);
+            server->set_ssl_private_key_file(settings.m_private_key_file);
+            server->set_idle_buffer_release(settings.m_release_tls_buffers);
+
+            if (!settings.m_use_session_resumption)
+                server->set_session_resumption(Net::Tls_session_settings{.m_is_enabled = false});
+        }
+
+        if (!server->start())
+        {
+            std::cout << "Could not start the server\n";
+            return;
+        }
+
+        server_thread = std::thread([&server = *server, &server_stop_flag] { run_server(server, server_stop_flag); });
+    }
+
+    if (settings.m_mode == "server")
+    {
+        std::cout << "Echo server is running on port " << settings.m_port
+                  << ", press enter to print the memory per connection or write q to stop\n";
+        print_connection_sizes();
+
+        for (std::string line; std::getline(std::cin, line) && line != "q";)
+            print_server_memory(*server, baseline_memory);
+    }
+    else if (settings.m_idle_connections > 0)
+        run_idle_connections(settings, server.get());
+    else if (settings.m_fanout_recipients > 0)
+        run_fanout(settings, server.get());
+    else if (settings.m_measure_handshakes)
+        run_handshakes<Client_type>(settings);
+    else if (!settings.m_replay_directory.empty() && settings.m_use_memory && server)
+        run_replay<Client_type>(settings, [&server = *server](const asio::any_io_executor& executor) {
+            return server.open_memory_connection(executor);
+        });
+    else if (!settings.m_replay_directory.empty())
+        run_replay<Client_type>(settings);
+    else if (settings.m_swarm_clients > 0 && settings.m_use_memory && server)
+        run_swarm<Client_type>(settings, [&server = *server](const asio::any_io_executor& executor) {
+            return server.open_memory_connection(executor);
+        });
+    else if (settings.m_swarm_clients > 0)
+        run_swarm<Client_type>(settings);
+    else if (settings.m_use_memory && server)
+        run_clients<Client_type>(settings, [&server = *server](const asio::any_io_executor& executor) {
+            return server.open_memory_connection(executor);
+        });
+    else
+        run_clients<Client_type>(settings);
+
+    if (server)
+    {
+        server_stop_flag = true;
+        server->stop();
+        server_thread.join();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const Benchmark_settings settings = parse_settings(argc, argv);
+        raise_open_file_limit();
+
+        if (settings.m_use_ssl)
+            run_benchmark<Net::Ssl_server<Message_id>, Net::Ssl_client<Message_id>>(settings);
+        else
+            run_benchmark<Net::Server<Message_id>, Net::Client<Message_id>>(settings);
+    }
+    catch (const std::exception& exception)
+    {
+        std::cout << "Exception: " << exception.what() << "\n";
+        return 1;
+    }
+}
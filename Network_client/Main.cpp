@@ -1,4 +1,5 @@
 #include "User/Ssl/Ssl_client.h"
+#include <atomic>
 #include <iostream>
 #include <string>
 
@@ -13,10 +14,7 @@ enum class Message_id : uint8_t
     server_message
 };
 
-bool send_thread_exit_flag = false;
-
-// Messages to be send
-Net::Thread_safe_deque<Net::Message<Message_id>> messages;
+std::atomic<bool> send_thread_exit_flag = false;
 
 // Client object that handles the client networking
 Net::Ssl_client<Message_id> client;
@@ -30,20 +28,11 @@ void client_notification(std::string_view notification, Net::Severity severity)
     std::cout << notification << "\n";
 }
 
-// Event when received the message
-void client_on_message(Net::Message<Message_id> message)
+// Event when received the message from the server
+void on_server_message(Net::Message<Message_id> message)
 {
-    switch (message.get_id())
-    {
-    case Message_id::server_message: {
-        const std::string chat_message = message.extract<std::string>();
-        std::cout << chat_message << "\n";
-        break;
-    }
-    default:
-        client.disconnect();
-        break;
-    }
+    Net::Message_reader reader(message);
+    std::cout << reader.read_string_view() << "\n";
 }
 
 // Sends user selected name to the server
@@ -55,7 +44,8 @@ void send_name()
 
     Net::Message<Message_id> message;
     message.set_id(Message_id::client_set_name);
-    message << username;
+    Net::Message_writer writer(message);
+    writer << username;
 
     client.send_message(message);
 }
@@ -75,30 +65,27 @@ void send_thread()
 
         Net::Message<Message_id> net_message;
         net_message.set_id(Message_id::client_message);
-        net_message << message;
+        Net::Message_writer writer(net_message);
+        writer << message;
 
-        messages.push_back(net_message);
+        // Client can be used from this thread, the message is queued on the asio thread
+        client.send_message(std::move(net_message));
     }
 }
 
 // Event_when connected to server
 void on_connected()
 {
-    // Starts new thread for reading inputs from the user
-    thread = std::thread(send_thread);  
+    // Starts new thread for reading inputs from the user, a reconnect keeps the thread that is already running
+    if (!thread.joinable())
+        thread = std::thread(send_thread);
 }
 
-// Main logic loop for client
+// Main logic loop for client, the update sleeps until there is something to handle
 void main_loop()
 {
-    while (true)
-    {
-        client.update();
-
-        // Sends message to server
-        if (!messages.empty())
-            client.send_message(messages.pop_front());
-    }
+    while (client.is_connecting() || client.is_connected())
+        client.update(Net::SIZE_T_MAX, true);
 }
 
 void start_client()
@@ -113,13 +100,16 @@ void start_client()
 
     // Setups client accepted messages and callbacks
     client.add_accepted_message(Message_id::server_message);
-    client.m_on_message.set_callback(client_on_message);
+    client.register_handler(Message_id::server_message, on_server_message);
     client.m_on_notification.set_callback(client_notification);
     client.m_on_connected.set_callback(on_connected);
 
     // Setup ssl stuff
     client.set_ssl_verify_file("server.crt");
 
+    // Reconnects after the connection is lost and sends again the messages that the server missed
+    client.set_reconnect(Net::Reconnect_settings{.m_resend_capacity = 64});
+
     // Attempts to connect to the server
     client.connect(server_ip, server_port);
 
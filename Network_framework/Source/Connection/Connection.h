@@ -1,37 +1,292 @@
 #pragma once
 
 #include "../Events/Delegate.h"
+#include "../Message/Accepted_messages.h"
+#include "../Message/Cluster_message.h"
+#include "../Message/Compact_header.h"
+#include "../Message/Compression.h"
+#include "../Message/Frame_scanner.h"
+#include "../Message/Message_bundle.h"
+#include "../Message/Message_converter.h"
+#include "../Message/Message_fragment.h"
+#include "../Message/Multicast_message.h"
 #include "../Message/Owned_message.h"
+#include "../Message/Rpc_message.h"
+#include "../Message/Shared_message.h"
+#include "../Message/Stream_chunk.h"
+#include "../Message/Stream_compression.h"
 #include "../Sockets/Socket_interface.h"
+#include "../Utility/Chunked_queue.h"
+#include "../Utility/Allocation_tracker.h"
 #include "../Utility/Common.h"
-#include "../Utility/Thread_safe_deque.h"
+#include "../Utility/Crc32c.h"
+#include "../Utility/Detached_coroutine.h"
+#include "../Utility/Instrumented_mutex.h"
+#include "../Utility/Latency_histogram.h"
+#include "../Utility/Linked_mpsc_queue.h"
+#include "../Utility/Metrics.h"
+#include "../Utility/Notification.h"
+#include "../Utility/Timer_wheel.h"
+#include "../Utility/Token_bucket.h"
+#include "../Utility/Trace.h"
+#include "../Utility/Traffic_capture.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace Net
 {
-    struct Message_limits
+    // What is done to a received message that goes over the rate limit
+    enum class Rate_limit_policy : uint8_t
     {
-        uint32_t m_min = 0, m_max = 0;
+        // Reading from the peer stops until the message fits in the limit, so the tcp slows the peer down
+        pause_reading,
+
+        // Message is read and thrown away without allocating its body
+        drop,
+
+        disconnect
+    };
+
+    /**
+     *   How the connection reads messages from the socket.
+     *   exact reads the header and the body of every message with their own reads.
+     *   buffered reads as much as is available into a receive buffer and parses every complete message from it.
+     *   on_demand is buffered but an idle connection holds no receive buffer, it waits for the socket to become
+     *   readable and takes the buffer only then. This saves the memory of the idle connections for an extra wait
+     *   on every read. Sockets that can't wait for readability without reading use the buffered mode.
+     */
+    enum class Read_mode : uint8_t
+    {
+        exact,
+        buffered,
+        on_demand
+    };
+
+    /**
+     *   Limits for how many queued messages the connection writes with one gather write.
+     *   The first message of a batch is always written even if it alone exceeds m_max_bytes.
+     */
+    struct Write_batch_limits
+    {
+        size_t m_max_messages = 1;
+        size_t m_max_bytes = std::numeric_limits<size_t>::max();
+    };
+
+    /**
+     *   Holds the messages for a moment when they are sent fast, so they leave in fuller batches without delaying
+     *   the lone messages. Messages that come further apart than the m_max_delay are written right away, the
+     *   others are held for the time the m_max_bytes takes to come at the measured send rate but atmost for the
+     *   m_max_delay. The batches are still limited by the Write_batch_limits.
+     */
+    struct Adaptive_batching
+    {
+        std::chrono::microseconds m_max_delay = std::chrono::microseconds(200);
+        size_t m_max_bytes = 64 * 1024;
+    };
+
+    // What is done to a message that would take the write queue over its high watermark
+    enum class Overflow_policy : uint8_t
+    {
+        // Oldest queued messages are dropped until the new one fits
+        drop_oldest,
+
+        // New message is dropped
+        drop_newest,
+
+        // New message replaces the queued message with the same id, for messages where only the latest state
+        // matters. Oldest messages are dropped if there is no message with the same id.
+        coalesce,
+
+        // Slow peer is disconnected
+        disconnect
+    };
+
+    /**
+     *   Limits for the messages waiting in the write queue, the messages being written are not counted.
+     *   Queue becomes congested when a message does not fit under the high watermarks and writable again
+     *   when it has drained under both low watermarks. Internal messages and streams are never dropped.
+     */
+    struct Write_queue_limits
+    {
+        size_t m_high_bytes = std::numeric_limits<size_t>::max();
+        size_t m_high_messages = std::numeric_limits<size_t>::max();
+        size_t m_low_bytes = 0;
+        size_t m_low_messages = 0;
+        Overflow_policy m_policy = Overflow_policy::disconnect;
+    };
+
+    /**
+     *   Lanes of the write queue, messages of one lane are written in the order they were sent.
+     *   Internal messages of the framework are always in the control lane.
+     */
+    enum class Message_priority : uint8_t
+    {
+        control,
+        realtime,
+        normal,
+        bulk
+    };
+
+    // How the connection takes turns between the realtime, normal and bulk lanes, control lane is always first
+    enum class Priority_scheduling : uint8_t
+    {
+        // Lane is written only when the higher lanes are empty
+        strict,
+
+        // Every lane writes its weight of messages per round so the lower lanes can't starve
+        weighted
+    };
+
+    struct Priority_settings
+    {
+        Priority_scheduling m_scheduling = Priority_scheduling::strict;
+
+        // Messages or frames written from the lanes per round in the weighted scheduling, atleast one
+        uint32_t m_realtime_weight = 8;
+        uint32_t m_normal_weight = 4;
+        uint32_t m_bulk_weight = 1;
+
+        // Bulk messages with larger bodies are sent in frames of this size so the other lanes are written between
+        // them. Frames are not compressed and they are limited to the Message_fragment::MAX_DATA_SIZE.
+        size_t m_bulk_frame_size = 16 * 1024;
     };
 
-    // Class that repesents remote net connection
+    // How the message is queued to the connection
+    struct Send_options
+    {
+        Message_priority m_priority = Message_priority::normal;
+
+        // If given, the message replaces a queued message that has the same id and key and has not been written yet
+        std::optional<uint64_t> m_conflation_key = std::nullopt;
+
+        // Logical stream that the message is sent in, 0 uses the lanes. Messages of the other streams are sent in
+        // frames interleaved with the other streams and each stream has its own window of unreceived bytes.
+        uint32_t m_stream_id = 0;
+    };
+
+    // Memory that the body of a received message is read to, see the Body_sink
+    struct Body_destination
+    {
+        // Keeps the memory alive until the message that refers to it is destroyed
+        std::shared_ptr<const void> m_owner;
+        std::span<char> m_bytes;
+    };
+
+    /**
+     *   Gives the memory for the body of the received message before it is read, so the socket reads straight
+     *   to where the body goes, for example to a staging buffer or a mapped region of a file. The delivered
+     *   message refers to the memory, the body is copied only if the message grows. This is called on the asio
+     *   thread of the connection and only in the exact read mode for the uncompressed messages.
+     *
+     *   @param the validated header, m_size is the size of the body
+     *   @param the sender of the message
+     *   @return the memory of exactly m_size bytes or nothing if the body is read to the message as usual
+     */
     template <Id_concept Id_type>
-    class Connection
+    using Body_sink =
+        std::function<std::optional<Body_destination>(const Message_header<Id_type>&, const Client_information&)>;
+
+    /**
+     *   Notices the peers that have gone away without closing the connection. The durations that are not given
+     *   are not used, and the timeouts are checked with the precision of the heartbeat timer.
+     */
+    struct Heartbeat_settings
+    {
+        // Disconnects if the handshake has not finished in this time
+        std::optional<std::chrono::milliseconds> m_handshake_timeout = std::nullopt;
+
+        // How often a ping is sent, the pong of the peer also measures the round trip time
+        std::optional<std::chrono::milliseconds> m_ping_interval = std::nullopt;
+
+        // Disconnects if nothing has been received for this long, pings and pongs count too
+        std::optional<std::chrono::milliseconds> m_read_timeout = std::nullopt;
+
+        // Disconnects if a write has not finished in this time
+        std::optional<std::chrono::milliseconds> m_write_timeout = std::nullopt;
+
+        /**
+         *   How often the TCP_INFO of the socket is sampled to the Connection_metrics. The first sample of each
+         *   connection is at its own point of the interval so the samples of the connections are spread over the
+         *   ticks of the timer wheel instead of all of them running on the same one.
+         */
+        std::optional<std::chrono::milliseconds> m_tcp_info_interval = std::nullopt;
+
+        // @return true if something is checked after the handshake
+        [[nodiscard]] bool has_heartbeat() const noexcept
+        {
+            return m_ping_interval || m_read_timeout || m_write_timeout;
+        }
+    };
+
+    /**
+     *   Socket of the plain tcp connection and the state it continues with in another process, see the
+     *   Connection::hand_off. Unread bytes are the start of the next message that was read before the hand off.
+     */
+    struct Connection_hand_off
+    {
+        Protocol::socket::native_handle_type m_handle = {};
+        Header_format m_write_header_format = Header_format::standard;
+        Compression_codec m_write_compression_codec = Compression_codec::none;
+        uint64_t m_agreed_capabilities = 0;
+        uint64_t m_received_user_messages = 0;
+        std::vector<char> m_unread_bytes;
+    };
+
+    // The socket types the connection can use, either the Socket_interface or one of the final sockets
+    template <typename T>
+    concept Socket_concept = std::derived_from<T, Socket_interface>;
+
+    /**
+     *   Class that repesents remote net connection.
+     *   Everything that touches the socket runs on the strand of the socket so the public methods can be called from
+     *   any thread. Connection has to be owned by shared_ptr because pending operations keep it alive.
+     *   Socket type can be one of the final sockets instead of the Socket_interface when the socket is known at
+     *   compile time, then the calls to the socket are not virtual and the compiler can inline them.
+     */
+    template <Id_concept Id_type, Socket_concept Socket_type = Socket_interface>
+    class Connection : public std::enable_shared_from_this<Connection<Id_type, Socket_type>>
     {
     public:
-        using Accepted_messages_ptr = std::shared_ptr<const std::unordered_map<Id_type, Message_limits>>;
+        using Accepted_messages_ptr = std::shared_ptr<const Accepted_messages<Id_type>>;
         using End_points = Protocol::resolver::results_type;
+        using Header_size_type = typename Message_header<Id_type>::Size_type;
 
-        Connection(std::unique_ptr<Socket_interface> socket, uint32_t connection_id)
-            : m_id(connection_id), m_socket(std::move(socket))
+        Connection(std::unique_ptr<Socket_type> socket, uint32_t connection_id)
+            : m_id(connection_id), m_socket(std::move(socket)), m_is_connected(m_socket->is_open()),
+              m_entry_executor(m_socket->get_executor()), m_socket_executor(m_entry_executor)
         {
+            m_socket_buffer_bytes = m_socket->get_buffer_bytes();
         }
 
         Connection(const Connection&) = delete;
         Connection(Connection&&) = delete;
 
-        ~Connection() = default;
+        ~Connection()
+        {
+            // Write coroutine is left suspended only if the asio dropped the handler of its write without calling it
+            if (m_write_coroutine)
+                m_write_coroutine.destroy();
+        }
 
         Connection& operator=(const Connection&) = delete;
         Connection& operator=(Connection&&) = delete;
@@ -41,26 +296,45 @@ namespace Net
         {
             if (is_connected())
             {
-                setup_callbacks_on_socket();
+                m_start_time = std::chrono::steady_clock::now();
+                m_counters.set_connect_time();
                 update_ip();
-                m_socket->async_handshake(handshake_type);
+                m_socket->set_lifetime_owner(this->weak_from_this());
+                setup_callbacks_on_socket();
+
+                dispatch_on_strand([self = this->shared_from_this(), handshake_type] {
+                    NET_ALLOCATION_SCOPE(handshake);
+
+                    if (self->m_heartbeat_settings.m_handshake_timeout)
+                        self->m_handshake_timer = self->schedule_on_strand(
+                            *self->m_heartbeat_settings.m_handshake_timeout, &Connection::on_handshake_timeout);
+
+                    NET_TRACE_BEGIN("handshake", self->m_id);
+                    self->m_is_handshake_pending = true;
+                    self->m_socket->async_handshake(handshake_type);
+                });
             }
         }
 
-        void disconnect(const std::string& reason = "", bool is_error = false)
+        // Disconnects on the strand of the connection
+        void disconnect()
         {
-            if (is_connected())
-            {
-                if (!reason.empty())
-                    m_on_notification.broadcast(reason, is_error ? Severity::error : Severity::notification);
+            dispatch_on_strand([self = this->shared_from_this()] {
+                self->disconnect_on_strand(std::nullopt);
+            });
+        }
 
-                m_socket->disconnect();
-            }
+        // Closes the socket right away, this is only safe when no Asio thread is running the connection
+        void close()
+        {
+            m_is_connected.store(false, std::memory_order_release);
+            m_socket->disconnect();
         }
 
-        [[nodiscard]] bool is_connected() const
+        // Socket is closed only on the strand so the other threads see its state through the flag
+        [[nodiscard]] bool is_connected() const noexcept
         {
-            return m_socket->is_open();
+            return m_is_connected.load(std::memory_order_acquire);
         }
 
         [[nodiscard]] uint32_t get_id() const noexcept
@@ -70,193 +344,3946 @@ namespace Net
 
         [[nodiscard]] std::string_view get_ip() const noexcept
         {
-            return m_ip;
+            return *m_ip;
         }
 
-        // This should always be called from the Asio thread
-        void send_message(Message<Id_type> message)
+        // @return the id and the ip text of the peer, the text is shared so this does not allocate
+        [[nodiscard]] Client_information get_client_information() const noexcept
         {
-            m_out_queue.push_back(std::move(message));
-            start_writing_message();
+            return Client_information(get_id(), m_ip);
         }
 
-        void set_accepted_messages(Accepted_messages_ptr accepted_messages) noexcept
+        // @return the capabilities both peers have, empty until the hello of the peer or if the peer sent none
+        [[nodiscard]] Capability_set get_agreed_capabilities() const noexcept
         {
-            m_accepted_messages = accepted_messages;
+            return Capability_set(m_agreed_capabilities.load(std::memory_order_relaxed));
         }
 
-        Delegate<const std::string&, Severity> m_on_notification;
-        Delegate<Owned_message<Id_type>> m_on_message;
+        void set_agreed_capabilities(Capability_set capabilities) noexcept
+        {
+            m_agreed_capabilities.store(capabilities.get_bits(), std::memory_order_relaxed);
+        }
 
-    private:
-        void setup_callbacks_on_socket()
+        // @return the address of the peer, the unspecified address if the peer has no ip address
+        [[nodiscard]] const asio::ip::address& get_address() const noexcept
         {
-            m_socket->m_handshake_finished.set_callback(this, &Connection<Id_type>::async_handshake_finished);
-            m_socket->m_read_header_finished.set_callback(this, &Connection<Id_type>::async_read_header_finished);
-            m_socket->m_read_body_finished.set_callback(this, &Connection<Id_type>::async_read_body_finished);
-            m_socket->m_write_header_finished.set_callback(this, &Connection<Id_type>::async_write_header_finished);
-            m_socket->m_write_body_finished.set_callback(this, &Connection<Id_type>::async_write_body_finished);
+            return m_address;
         }
 
-        // Updates m_ip member with the current remote ip
-        void update_ip()
+        /**
+         *   Queues the message on the strand of the connection
+         *
+         *   @param the message
+         *   @param the lane of the message, its conflation key and its logical stream. Conflated message replaces
+         *          the queued one so a peer that lags behind gets only the latest value, for example of an entity.
+         *          Logical streams are sent in frames that take turns and each has its own window of unread bytes.
+         */
+        void send_message(Outgoing_message<Id_type> message, Send_options options = {})
         {
-            if (is_connected())
-                m_ip = m_socket->get_ip();
+            // Timed here so the time to the strand is part of the latency
+            const auto queued_time =
+                is_latency_timed() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+            const bool is_first =
+                m_sent_messages.push({.m_message = std::move(message), .m_options = options, .m_time = queued_time});
+
+            // Messages sent while the strand has not taken the earlier ones yet go with them
+            if (is_first)
+                dispatch_on_strand([self = this->shared_from_this()] { self->queue_sent_messages(); });
+
+            m_has_unflushed_sends.store(true, std::memory_order_relaxed);
         }
 
-        // Events when handshake is finished
-        void async_handshake_finished(asio::error_code error)
+        /**
+         *   Holds the sent messages in the out queue until the flush or the last uncork, so the messages of a tick
+         *   leave in one gather write instead of a small write each. Corks nest, internal messages like the
+         *   heartbeats are held too so a corked connection must be flushed regularly.
+         */
+        void cork()
         {
-            if (!error)
-            {
-                m_has_done_handshake = true;
+            dispatch_on_strand([self = this->shared_from_this()] { ++self->m_cork_depth; });
+        }
 
-                m_on_notification.broadcast(
-                    std::format("Succesfull handshake with {}", get_ip()), Severity::notification);
+        // Removes a cork, the held messages are written when the last one is removed
+        void uncork()
+        {
+            dispatch_on_strand([self = this->shared_from_this()] {
+                if (self->m_cork_depth == 0 || --self->m_cork_depth != 0)
+                    return;
 
-                // Starts to wait messages
-                m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+                self->m_is_flush_requested = true;
+                self->start_writing_message();
+            });
+        }
 
-                // If received any messages to be sent during the handshake, we send them now
-                start_writing_message();
-            }
-            else
-                disconnect(std::format("Error on handshake because {}", error.message()), true);
+        /**
+         *   Writes the held messages even though the connection is corked. The messages that do not fit in one
+         *   batch are written with the kernel cork on, so the flush leaves in full segments. Does nothing if
+         *   nothing has been sent since the last flush, so flushing every connection each tick is cheap.
+         */
+        void flush()
+        {
+            if (!m_has_unflushed_sends.exchange(false, std::memory_order_relaxed))
+                return;
+
+            dispatch_on_strand([self = this->shared_from_this()] {
+                self->m_is_flush_requested = true;
+                self->start_writing_message();
+            });
         }
 
-        // Checks if the header is in valid format
-        [[nodiscard]] bool validate_header(Message_header<Id_type> header) const
+        /**
+         *   Disconnects when the queued messages have been written, they are written even if the connection is
+         *   corked. Connection is disconnected with the write_timeout if the peer does not read them in time.
+         *
+         *   @param how long the writes are waited
+         */
+        void disconnect_after_flush(std::chrono::milliseconds timeout)
+        {
+            dispatch_on_strand([self = this->shared_from_this(), timeout] {
+                if (self->m_is_draining || !self->is_connected())
+                    return;
+
+                self->m_is_draining = true;
+                self->m_drain_timer = self->schedule_on_strand(timeout, &Connection::on_drain_timeout);
+                self->start_writing_message();
+                self->disconnect_when_flushed();
+            });
+        }
+
+        /**
+         *   Sends the body in chunks that are read from the source only when the connection has room to write them.
+         *   Streams are sent one after another and the messages sent meanwhile are written between the chunks.
+         *
+         *   @param the id of the streamed message
+         *   @param the source of the body, it must not throw
+         */
+        void send_stream(Id_type id, Stream_source source)
+        {
+            dispatch_on_strand(
+                [self = this->shared_from_this(), id, source = std::move(source)]() mutable {
+                    self->m_out_streams.push_back({.m_id = id, .m_source = std::move(source)});
+                    self->start_writing_message();
+                });
+
+            m_has_unflushed_sends.store(true, std::memory_order_relaxed);
+        }
+
+        /**
+         *   Sends part of the file as a stream, the receiver gets it the same way as the send_stream.
+         *   Plain tcp sockets send the file with sendfile or TransmitFile without copying it through the
+         *   user space, other sockets read it in chunks. The file is kept open until it has been sent.
+         *
+         *   @param the id of the streamed message
+         *   @param the file
+         *   @param where in the file the sending starts
+         *   @param number of bytes sent, rest of the file if not given
+         *   @return false if the file could not be opened or the range is outside of the file
+         */
+        [[nodiscard]] bool send_file(
+            Id_type id, const std::filesystem::path& path, uint64_t offset = 0,
+            std::optional<uint64_t> length = std::nullopt)
         {
-            if (!header.is_validation_key_correct())
+            std::shared_ptr<const Native_file> file = Native_file::open(path);
+
+            if (file == nullptr || offset > file->size())
                 return false;
 
-            if (header.m_internal_id != Internal_id::not_internal)
-                return true; // todo add spesific validation for internal messages
+            const uint64_t send_length = length.value_or(file->size() - offset);
 
-            if (m_accepted_messages != nullptr)
-            {
-                const auto found_limits = m_accepted_messages->find(header.m_id);
+            if (send_length > file->size() - offset)
+                return false;
 
-                if (found_limits == m_accepted_messages->end())
-                    return false;
+            dispatch_on_strand(
+                [self = this->shared_from_this(), id, file = std::move(file), offset, send_length]() mutable {
+                    self->m_out_streams.push_back(
+                        {.m_id = id,
+                         .m_source = nullptr,
+                         .m_file = std::move(file),
+                         .m_file_offset = offset,
+                         .m_file_remaining = send_length});
+                    self->start_writing_message();
+                });
 
-                if (header.m_size < found_limits->second.m_min || header.m_size > found_limits->second.m_max)
-                    return false;
-            }
+            m_has_unflushed_sends.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         *   Moves the connection and its socket to the strand, for example to a strand of another io_context so the
+         *   clients that talk to each other are run by the same thread. Socket moves when its current read and write
+         *   have finished, so a connection that receives nothing moves with the next message or heartbeat it gets.
+         *   Calls that were queued on the old strand are passed on to the new one in the order they were made.
+         *
+         *   @param the strand that runs the connection from now on
+         *   @return false if the socket cannot be moved, only the plain tcp and unix domain sockets can
+         */
+        bool move_to_executor(asio::any_io_executor executor)
+        {
+            if (!m_socket->can_move_executor())
+                return false;
+
+            dispatch_on_strand([self = this->shared_from_this(), executor = std::move(executor)]() mutable {
+                self->m_next_executor = std::move(executor);
+                self->move_when_quiet();
+            });
 
             return true;
         }
 
-        // Event when read header is finished
-        void async_read_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        // @return the strand of the socket, it changes when the connection is moved
+        [[nodiscard]] asio::any_io_executor get_executor() const
         {
-            if (!error)
-            {
-                if (!validate_header(m_received_message.get_header()))
-                {
-                    disconnect("Header validation failed", true);
-                    return;
-                }
+            std::scoped_lock lock(m_strand_mutex);
+            return m_socket_executor;
+        }
 
-                // Don't read body if size of message is 0
-                if (m_received_message.get_header().m_size == 0)
-                {
-                    on_message_received();
-                    m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
-                    return;
-                }
+        /**
+         *   Hands the socket over to another process, see the Server::set_hot_restart_path. Reading stops at the
+         *   start of the next message and the queued messages are written first, then the m_on_hand_off gets the
+         *   socket and the connection is disconnected without a notification. Only plain tcp connections without
+         *   stream compression or unfinished streams can be handed over, the others are disconnected and the
+         *   m_on_hand_off gets nothing.
+         */
+        void hand_off()
+        {
+            dispatch_on_strand([self = this->shared_from_this()] { self->start_hand_off(); });
+        }
 
-                m_received_message.resize_body(m_received_message.get_header().m_size);
-                m_socket->async_read_body(m_received_message.body_data(), m_received_message.body_size());
-            }
-            else
-                disconnect(std::format("Read header failed because {}", error.message()), true);
+        /**
+         *   Continues the connection that another process handed over, the handshake and the hello were done
+         *   there. This should be called before the start and the socket has to be the handed over one.
+         *
+         *   @param the state from the other process
+         */
+        void continue_hand_off(const Connection_hand_off& hand_off)
+        {
+            set_write_header_format(hand_off.m_write_header_format);
+            set_write_compression(hand_off.m_write_compression_codec, Compression_mode::per_message);
+            set_agreed_capabilities(Capability_set(hand_off.m_agreed_capabilities));
+            m_counters.add_received_user_message(hand_off.m_received_user_messages);
+
+            if (hand_off.m_unread_bytes.empty())
+                return;
+
+            // Exact mode cannot start in the middle of a message so the rest is read in buffered mode
+            if (m_read_mode == Read_mode::exact)
+                set_read_mode(Read_mode::buffered);
+
+            m_receive_buffer.resize(std::max(m_receive_buffer_size, hand_off.m_unread_bytes.size()));
+            std::ranges::copy(hand_off.m_unread_bytes, m_receive_buffer.begin());
+            m_receive_end = hand_off.m_unread_bytes.size();
         }
 
-        // Event when read body is finished
-        void async_read_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        /**
+         *   Continues reading after the user could not take a received message, the held message is given to the
+         *   user again first. Does nothing if the reading was not paused by the user.
+         */
+        void resume_reading()
         {
-            if (!error)
-            {
-                on_message_received();
-                m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
-            }
-            else
-                disconnect(std::format("Read body failed because {}", error.message()), true);
+            dispatch_on_strand([self = this->shared_from_this()] {
+                self->resume_reading_on_strand();
+            });
         }
 
-        const Message<Id_type>& out_message() noexcept
+        // Sets the options of the socket on the strand of the connection, failures are reported as notifications
+        void set_socket_options(const Socket_options& options)
         {
-            return m_out_queue.front();
+            dispatch_on_strand([self = this->shared_from_this(), options] {
+                const std::string failed_options = self->m_socket->set_socket_options(options);
+                self->m_zero_copy_threshold = options.m_zero_copy_threshold;
+
+                if (!failed_options.empty())
+                    self->notify(Notification_code::socket_options_failed, Severity::error, {}, failed_options);
+            });
         }
 
-        // Starts writing message if possible otherwise does nothing
-        void start_writing_message()
+        // Sets the ids that are delta encoded when the peer agreed to it, this should be called before the start
+        void set_delta_encoded_messages(std::shared_ptr<const std::unordered_set<Id_type>> delta_encoded_messages)
         {
-            if (!m_out_queue.empty() && !m_is_writing_message && m_has_done_handshake)
-            {
-                m_is_writing_message = true;
-                m_socket->async_write_header(out_message().header_data(), out_message().header_size());
-            }
+            m_delta_encoded_messages = std::move(delta_encoded_messages);
         }
 
-        // Event when write header is finished
-        void async_write_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        /**
+         *   Rejects every received frame with a larger body when its header is validated, before anything is
+         *   allocated for it. Meant for the peers that receive to the Fixed_message, this should be called before
+         *   the start
+         */
+        void set_max_message_size(size_t max_message_size) noexcept
         {
-            if (!error)
-            {
-                if (out_message().get_header().m_size > 0)
-                    m_socket->async_write_body(out_message().body_data(), out_message().body_size());
+            m_max_message_size = max_message_size;
+        }
 
-                else
-                {
-                    m_out_queue.pop_front();
+        // Rejects the received replication updates with larger bodies, this should be called before the start
+        void set_max_replication_update_size(size_t max_size) noexcept
+        {
+            m_max_replication_update_size = max_size;
+        }
 
-                    if (!m_out_queue.empty())
-                        m_socket->async_write_header(out_message().header_data(), out_message().header_size());
-                    else
-                        m_is_writing_message = false;
-                }
-            }
-            else
-                disconnect(std::format("Write header failed because {}", error.message()), true);
+        // Sets the sinks that give the memory for the bodies of their ids, this should be called before the start
+        void set_body_sinks(std::shared_ptr<const std::unordered_map<Id_type, Body_sink<Id_type>>> body_sinks)
+        {
+            m_body_sinks = std::move(body_sinks);
         }
 
-        // Event when writing to body is finished
-        void async_write_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        void set_accepted_messages(Accepted_messages_ptr accepted_messages)
         {
-            if (!error)
-            {
-                m_out_queue.pop_front();
+            m_accepted_messages = accepted_messages;
+            m_has_message_rate_limits =
+                m_accepted_messages != nullptr &&
+                m_accepted_messages->any_of([](const Message_limits& limits) {
+                    return limits.m_rate_limit.has_value();
+                });
+        }
 
-                if (!m_out_queue.empty())
-                    m_socket->async_write_header(out_message().header_data(), out_message().header_size());
-                else
-                    m_is_writing_message = false;
-            }
-            else
-                disconnect(std::format("Write body failed because {}", error.message()), true);
+        // Sets the counters of the user that this connection also counts to, this should be called before the start
+        void set_metrics_counters(std::shared_ptr<Metrics_counters<Id_type>> counters) noexcept
+        {
+            m_metrics_counters = std::move(counters);
         }
 
-        // Triggers on_message callback on current reveived_message
-        void on_message_received()
+        /**
+         *   Sets the flag of the user that pauses the reading of the bulk connections while it is set, see the
+         *   set_bulk. This should be called before the start.
+         */
+        void set_bulk_pause_flag(std::shared_ptr<const std::atomic<bool>> flag) noexcept
         {
-            auto owned_message =
-                Owned_message<Id_type>(std::move(m_received_message), Client_information(get_id(), get_ip()));
-            m_on_message.broadcast(std::move(owned_message));
-            m_received_message = Message<Id_type>();
+            m_bulk_pause_flag = std::move(flag);
         }
 
-        const uint32_t m_id = 0;
-        std::string m_ip = "0.0.0.0";
+        /**
+         *   Bulk connection stops reading while the user sheds the load and reads atmost the bulk read budget at a
+         *   time, this can be called from any thread
+         */
+        void set_bulk(bool is_bulk) noexcept
+        {
+            m_is_bulk.store(is_bulk, std::memory_order_relaxed);
+        }
 
-        std::unique_ptr<Socket_interface> m_socket;
-        bool m_has_done_handshake = false;
+        /**
+         *   Sets the bytes a bulk connection reads in one turn of its Asio thread in the buffered read modes. Each
+         *   read is handled as its own turn, so the smaller reads of the bulk connections let the latency
+         *   sensitive connections on the same thread be read and handled between them instead of waiting for a
+         *   whole receive buffer of bulk messages. The exact mode reads every message whole.
+         */
+        void set_bulk_read_budget(size_t bytes) noexcept
+        {
+            m_bulk_read_budget = std::max<size_t>(bytes, 1);
+        }
 
-        bool m_is_writing_message = false;
-        Message<Id_type> m_received_message;
-        Thread_safe_deque<Message<Id_type>> m_out_queue;
-        Accepted_messages_ptr m_accepted_messages = nullptr;
+        /**
+         *   Sets the histograms the latencies of the messages are recorded to, nothing is timed without them.
+         *   This should be called before the start.
+         */
+        void set_latency_histograms(std::shared_ptr<Latency_histograms> histograms) noexcept
+        {
+            m_latency_histograms = std::move(histograms);
+        }
+
+        /**
+         *   Sets the capture the received and the sent messages are copied to, nothing is captured without it.
+         *   This should be called before the start.
+         */
+        void set_traffic_capture(std::shared_ptr<Traffic_capture> capture) noexcept
+        {
+            m_traffic_capture = std::move(capture);
+        }
+
+        // @return the counters of this connection, this can be called from any thread
+        [[nodiscard]] Connection_metrics get_metrics() const noexcept
+        {
+            Connection_metrics metrics = m_counters.get(get_dropped_message_count());
+            metrics.m_strand_lock = m_strand_mutex.get_metrics();
+
+            return metrics;
+        }
+
+        /**
+         *   @param the time of the snapshot, see the Connection_snapshot::m_last_activity
+         *   @return the state of this connection, this can be called from any thread
+         */
+        [[nodiscard]] Connection_snapshot get_snapshot(std::chrono::steady_clock::time_point now) const noexcept
+        {
+            return {
+                .m_client = get_client_information(),
+                .m_connect_time = m_counters.get_connect_time(),
+                .m_last_activity = m_counters.get_last_activity(now),
+                .m_round_trip_time = get_round_trip_time(),
+                .m_metrics = get_metrics()};
+        }
+
+        /**
+         *   Memory of the write queue and the buffers of the socket, see the Memory_budget. The write queue is
+         *   counted as it was after the last queued message or write. This can be called from any thread.
+         */
+        [[nodiscard]] size_t get_memory_usage() const noexcept
+        {
+            return m_counters.get_out_queue_bytes() + m_socket_buffer_bytes;
+        }
+
+        /**
+         *   Drops the older queued messages of each id so only the newest one is written, for example when the
+         *   server is running out of memory. Messages with a conflation key already replace each other and the
+         *   internal messages are kept.
+         */
+        void conflate_write_queue()
+        {
+            dispatch_on_strand([self = this->shared_from_this()] { self->conflate_write_queue_on_strand(); });
+        }
+
+        /**
+         *   Holds the reading at the start of the next message until this is called with false, for example when
+         *   the server is running out of memory. Unlike the pauses of the in queue the user is not told about this.
+         */
+        void set_reading_held(bool is_held)
+        {
+            dispatch_on_strand([self = this->shared_from_this(), is_held] {
+                self->m_is_reading_held = is_held;
+
+                if (!is_held)
+                    self->resume_reading_on_strand();
+            });
+        }
+
+        /**
+         *   Sets the rate limit of all the messages from the peer and what is done to the messages that go over it
+         *   or the limits of their ids. This should be called before the start.
+         */
+        void set_rate_limit(const Rate_limit& limit, Rate_limit_policy policy) noexcept
+        {
+            m_peer_rate_buckets = Rate_buckets(limit);
+            m_rate_limit_policy = policy;
+        }
+
+        void set_write_batch_limits(Write_batch_limits limits) noexcept
+        {
+            // Batch with no room would never take a message
+            m_write_batch_limits = {
+                .m_max_messages = std::max<size_t>(limits.m_max_messages, 1),
+                .m_max_bytes = std::max<size_t>(limits.m_max_bytes, 1)};
+        }
+
+        // Sets the holding of the messages when they are sent fast, this should be called before the start
+        void set_adaptive_batching(std::optional<Adaptive_batching> batching) noexcept
+        {
+            m_adaptive_batching = batching;
+
+            // Starts as if the messages came apart so the first ones are not held
+            if (batching)
+                m_last_send_gap = m_average_send_gap = 2.0 * static_cast<double>(batching->m_max_delay.count());
+        }
+
+        /**
+         *   Sets the size from which the batches are written without copying them to the kernel, see the
+         *   Socket_options::m_zero_copy_threshold. This should be called before the start.
+         */
+        void set_zero_copy_threshold(std::optional<size_t> threshold) noexcept
+        {
+            m_zero_copy_threshold = threshold;
+        }
+
+        // Sets the watermarks and the overflow policy of the write queue, this should be called before the start
+        void set_write_queue_limits(Write_queue_limits limits) noexcept
+        {
+            m_write_queue_limits = limits;
+        }
+
+        // Sets how the lanes of the write queue take turns, this should be called before the start
+        void set_priority_settings(const Priority_settings& settings) noexcept
+        {
+            m_priority_settings = settings;
+            m_bulk_frame_size =
+                std::clamp<size_t>(settings.m_bulk_frame_size, 1, Message_fragment<Id_type>::MAX_DATA_SIZE);
+        }
+
+        // @return how many messages the overflow policy has dropped or replaced
+        [[nodiscard]] uint64_t get_dropped_message_count() const noexcept
+        {
+            return m_dropped_message_count.load(std::memory_order_relaxed);
+        }
+
+        /**
+         *   Sets the pings and the timeouts, this should be called before the start
+         *
+         *   @param the settings
+         *   @param the wheel that times the heartbeats, it is not kept alive by the connection
+         */
+        void set_heartbeat(const Heartbeat_settings& settings, std::weak_ptr<Timer_wheel> timer_wheel) noexcept
+        {
+            m_heartbeat_settings = settings;
+            m_timer_wheel = std::move(timer_wheel);
+        }
+
+        // @return the time between the latest ping and its pong or nothing if no pong has been received
+        [[nodiscard]] std::optional<std::chrono::microseconds> get_round_trip_time() const noexcept
+        {
+            const int64_t round_trip_time = m_round_trip_time.load(std::memory_order_relaxed);
+
+            if (round_trip_time < 0)
+                return std::nullopt;
+
+            return std::chrono::microseconds(round_trip_time);
+        }
+
+        /**
+         *   Selects how messages are read. This should be called before the start
+         *
+         *   @param the read mode
+         *   @param initial size of the receive buffer in buffered mode, grows if a message does not fit
+         */
+        void set_read_mode(Read_mode read_mode, size_t receive_buffer_size = DEFAULT_RECEIVE_BUFFER_SIZE)
+        {
+            m_read_mode = read_mode;
+            m_receive_buffer_size = std::max(receive_buffer_size, sizeof(Message_header<Id_type>));
+
+            if (m_read_mode == Read_mode::buffered)
+                m_receive_buffer.resize(m_receive_buffer_size);
+        }
+
+        /**
+         *   Lets the received user messages refer to their bytes in the receive buffer of the buffered read modes
+         *   instead of copying them. The buffer is kept until all the messages that refer to it are destroyed and
+         *   the connection reads on to a new buffer, so the large inbound streams are never copied after the
+         *   socket read. Bodies that fit inside the message are still copied. This should be called before the start
+         */
+        void set_zero_copy_receive(bool is_enabled) noexcept
+        {
+            m_is_zero_copy_receive = is_enabled;
+        }
+
+        /**
+         *   Allows the peer to send compact headers to this connection, checked allows both compact and checked
+         *   headers. This should be called before the start. Standard headers are always accepted.
+         */
+        void set_header_format(Header_format header_format) noexcept
+        {
+            m_header_format = header_format;
+        }
+
+        // Sets the format the headers are written in, this should be compact or checked only when the peer agreed to it
+        void set_write_header_format(Header_format header_format) noexcept
+        {
+            m_write_header_format = header_format;
+        }
+
+        /**
+         *   Sets the threshold and level used when this connection compresses bodies. This should be called before
+         *   the start. Nothing is compressed until the codec has been agreed with set_write_compression.
+         *   Stream compressed messages are accepted from the peer only if the settings have the stream mode.
+         */
+        void set_compression_settings(const Compression_settings& settings) noexcept
+        {
+            m_compression_settings = settings;
+        }
+
+        /**
+         *   Sets the codec used for writing, this should only be set to a codec that the peer has agreed to
+         *
+         *   @param the codec
+         *   @param should the messages be compressed as one stream, the peer has to have agreed to this too
+         */
+        void set_write_compression(Compression_codec codec, Compression_mode mode) noexcept
+        {
+            // Mode is set first because it is read only after the codec
+            m_write_compression_mode = mode;
+            m_write_compression_codec = codec;
+        }
+
+        static constexpr size_t DEFAULT_RECEIVE_BUFFER_SIZE = 64 * 1024;
+        static constexpr size_t DEFAULT_BULK_READ_BUDGET = 16 * 1024;
+        static constexpr size_t DEFAULT_MAX_REPLICATION_UPDATE_SIZE = 16 * 1024 * 1024;
+
+        Delegate<const Notification&> m_on_notification;
+        /**
+         *   Called on the strand with every received message. The message is moved from only if the user sets the
+         *   flag to true, otherwise the connection holds the message and stops reading until the resume_reading.
+         */
+        Delegate<Owned_message<Id_type>&, bool&> m_on_message;
+
+        /**
+         *   Called on the strand with the messages parsed from one buffered read, instead of the m_on_message for
+         *   each of them. The user sets the count to how many messages from the start it took and moved from, the
+         *   connection holds the rest and stops reading like with the m_on_message.
+         */
+        Delegate<std::span<Owned_message<Id_type>>, size_t&> m_on_messages;
+
+        // Called on the strand when the reading stops because the user did not take the message
+        Delegate<std::weak_ptr<Connection>> m_on_read_paused;
+
+        // Called once on the strand when the connection disconnects for any reason, with the id of the connection
+        Delegate<uint32_t> m_on_disconnect;
+
+        // Called on the strand with true when the write queue becomes congested and with false when it is writable
+        Delegate<const Client_information&, bool> m_on_write_pressure;
+
+        // Called once on the strand after the hand_off, with nothing if the connection could not be handed over
+        Delegate<std::optional<Connection_hand_off>&> m_on_hand_off;
+
+    private:
+        // Id of the message and the key given by the user, queued messages with the same ones replace each other
+        struct Conflation_key
+        {
+            Id_type m_id = {};
+            uint64_t m_key = 0;
+
+            bool operator==(const Conflation_key&) const = default;
+        };
+
+        struct Conflation_key_hash
+        {
+            [[nodiscard]] size_t operator()(const Conflation_key& key) const noexcept
+            {
+                return std::hash<uint64_t>()(key.m_key * 31 + static_cast<uint64_t>(key.m_id));
+            }
+        };
+
+        struct Queued_message
+        {
+            Outgoing_message<Id_type> m_message;
+            std::optional<Conflation_key> m_conflation_key = std::nullopt;
+            std::chrono::steady_clock::time_point m_queued_time = {};
+        };
+
+        // Chunks of the queues come from the pool of the message bodies and an empty queue holds none
+        using Message_queue = Chunked_queue<Queued_message>;
+
+        // Message that is sent from any thread and waits for the strand to queue it
+        struct Sent_message
+        {
+            Outgoing_message<Id_type> m_message;
+            Send_options m_options;
+            std::chrono::steady_clock::time_point m_time = {};
+        };
+
+        // Bytes of a logical stream that can be sent before the receiver grants more
+        static constexpr size_t STREAM_WINDOW_SIZE = 256 * 1024;
+        static constexpr size_t MAX_LOGICAL_STREAMS = 256;
+
+        // Messages of one logical stream, the front one is moved out to be sent in frames as the credit allows
+        struct Logical_stream
+        {
+            Message_queue m_queue{get_message_memory_resource()};
+            std::optional<Outgoing_message<Id_type>> m_message = std::nullopt;
+            size_t m_offset = 0;
+            size_t m_credit = STREAM_WINDOW_SIZE;
+        };
+
+        // Message that the received fragments of a stream are put together to, its whole size and the received
+        // bytes that have not yet been granted back to the sender
+        struct Fragment_assembly
+        {
+            Message<Id_type> m_message;
+            std::optional<uint64_t> m_size = std::nullopt;
+            size_t m_ungranted_bytes = 0;
+        };
+
+        struct Write_result
+        {
+            asio::error_code m_error;
+            size_t m_bytes = 0;
+        };
+
+        // Awaits the write of the next batch, the write is started only after the write loop has suspended
+        struct Batch_write
+        {
+            Connection& m_connection;
+
+            [[nodiscard]] bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> coroutine)
+            {
+                m_connection.m_write_coroutine = coroutine;
+
+                try
+                {
+                    m_connection.write_out_messages();
+                }
+                catch (...)
+                {
+                    // Coroutine is resumed with the exception so it must not be resumed again by the write
+                    m_connection.m_write_coroutine = nullptr;
+                    throw;
+                }
+            }
+
+            [[nodiscard]] Write_result await_resume() const noexcept
+            {
+                return m_connection.m_write_result;
+            }
+        };
+
+        // Buckets of one rate limit
+        struct Rate_buckets
+        {
+            Token_bucket m_messages;
+            Token_bucket m_bytes;
+
+            Rate_buckets() = default;
+
+            explicit Rate_buckets(const Rate_limit& limit)
+                : m_messages(limit.m_messages_per_second, limit.m_burst_messages),
+                  m_bytes(limit.m_bytes_per_second, limit.m_burst_bytes)
+            {
+            }
+
+            [[nodiscard]] bool is_limited() const noexcept
+            {
+                return m_messages.is_limited() || m_bytes.is_limited();
+            }
+
+            [[nodiscard]] Token_bucket::Clock::duration wait_time(uint64_t bytes)
+            {
+                return std::max(m_messages.wait_time(1), m_bytes.wait_time(static_cast<double>(bytes)));
+            }
+
+            void take(uint64_t bytes) noexcept
+            {
+                m_messages.take(1);
+                m_bytes.take(static_cast<double>(bytes));
+            }
+        };
+
+        // What is done to the received message after the rate limits
+        enum class Rate_decision : uint8_t
+        {
+            receive,
+            drop,
+            pause,
+            disconnect
+        };
+
+        // Streams waiting to be sent, only the first one is being sent. File streams are read from the file
+        struct Outgoing_stream
+        {
+            Id_type m_id = {};
+            Stream_source m_source;
+            std::shared_ptr<const Native_file> m_file = nullptr;
+            uint64_t m_file_offset = 0;
+            uint64_t m_file_remaining = 0;
+            uint32_t m_stream_id = 0;
+            bool m_is_first = true;
+        };
+
+        /**
+         *   Runs the handler on the strand of the socket. Handler that was queued on a strand that the socket has
+         *   moved away from is passed on to the new strand, and until the handlers queued before the move have run
+         *   the new handlers go through the old strand too so they stay in order.
+         *
+         *   @param the handler, it has to keep the connection alive
+         *   @param true if the handler must not run inside the caller, for example inside the timer wheel
+         */
+        template <typename Handler_type>
+        void dispatch_on_strand(Handler_type handler, bool is_posted = false)
+        {
+            asio::any_io_executor executor;
+
+            {
+                std::scoped_lock lock(m_strand_mutex);
+                executor = m_entry_executor;
+                ++m_queued_handlers;
+            }
+
+            auto checked_handler = [this, executor, handler = std::move(handler)]() mutable {
+                run_queued_handler(executor, std::move(handler));
+            };
+
+            if (is_posted)
+                asio::post(executor, std::move(checked_handler));
+            else
+                asio::dispatch(executor, std::move(checked_handler));
+        }
+
+        // @param the strand that is running the handler
+        template <typename Handler_type>
+        void run_queued_handler(const asio::any_io_executor& executor, Handler_type handler)
+        {
+            asio::any_io_executor socket_executor;
+            bool has_moved = false;
+
+            {
+                std::scoped_lock lock(m_strand_mutex);
+
+                if (executor != m_socket_executor)
+                    socket_executor = m_socket_executor;
+                else if (--m_queued_handlers == 0 && m_is_moving)
+                {
+                    // Old strand has nothing queued anymore so the new handlers can go straight to the socket
+                    m_entry_executor = m_socket_executor;
+                    m_is_moving = false;
+                    has_moved = true;
+                }
+            }
+
+            if (socket_executor)
+            {
+                asio::dispatch(
+                    socket_executor, [this, socket_executor, handler = std::move(handler)]() mutable {
+                        run_queued_handler(socket_executor, std::move(handler));
+                    });
+                return;
+            }
+
+            handler();
+
+            // Next move waited for this one to finish so the handlers are never passed on past a strand
+            if (has_moved)
+                move_when_quiet();
+        }
+
+        /**
+         *   Moves the socket to the next executor when nothing is being read or written. Reading waits for the move
+         *   at the start of the next message and writing after the batch being written. The earlier move has to
+         *   finish first, m_is_moving is only changed on the strand of the socket so it is read here without the lock.
+         *   Moving the socket would cancel its handshake, so a move asked during the handshake is made when it ends.
+         */
+        void move_when_quiet()
+        {
+            if (!m_next_executor || m_is_writing_message || m_is_moving || m_is_handshake_pending)
+                return;
+
+            if (m_has_done_handshake && !m_is_read_parked && !m_is_read_paused)
+                return;
+
+            const asio::any_io_executor executor = std::move(*m_next_executor);
+            m_next_executor.reset();
+
+            if (is_connected())
+            {
+                const asio::error_code error = m_socket->move_to_executor(executor);
+
+                if (!error)
+                {
+                    std::scoped_lock lock(m_strand_mutex);
+                    m_socket_executor = m_socket->get_executor();
+                    m_is_moving = true;
+                }
+                else
+                    notify(Notification_code::connection_move_failed, Severity::error, error);
+            }
+
+            // Nothing is started on the socket before this runs on its strand
+            m_is_resuming_after_move = true;
+            dispatch_on_strand([self = this->shared_from_this()] { self->resume_after_move(); });
+        }
+
+        void resume_after_move()
+        {
+            m_is_resuming_after_move = false;
+
+            if (std::exchange(m_is_read_parked, false) && is_connected())
+                start_reading();
+
+            start_writing_message();
+            hand_off_when_quiet();
+        }
+
+        // @return true if the next read waits for the connection to move or to be handed off
+        bool park_read_for_move()
+        {
+            // Reading stops at the start of the next message when the socket is handed off
+            if (m_is_handing_off)
+            {
+                m_is_read_parked = true;
+                hand_off_when_quiet();
+                return true;
+            }
+
+            if ((!m_next_executor || m_is_moving) && !m_is_resuming_after_move)
+                return false;
+
+            m_is_read_parked = true;
+            move_when_quiet();
+            return true;
+        }
+
+        // @return true if the write loop stops after its batch so the connection can move
+        [[nodiscard]] bool is_move_waiting_for_write() const noexcept
+        {
+            return m_next_executor && !m_is_moving && m_has_done_handshake && (m_is_read_parked || m_is_read_paused);
+        }
+
+        void start_hand_off()
+        {
+            if (m_is_handing_off)
+                return;
+
+            const bool can_hand_off =
+                is_connected() && m_has_done_handshake &&
+                m_write_compression_mode.load(std::memory_order_relaxed) != Compression_mode::stream &&
+                m_stream_decompressor == nullptr && m_fragment_assemblies.empty() && m_open_streams.empty() &&
+                m_logical_streams.empty() && !m_held_message && m_write_delta_bases.empty() &&
+                m_read_delta_bases.empty();
+
+            m_is_handing_off = true;
+
+            if (!can_hand_off)
+            {
+                finish_hand_off(std::nullopt);
+                return;
+            }
+
+            // Queued messages are written even if the connection is corked
+            m_is_flush_requested = true;
+            start_writing_message();
+            hand_off_when_quiet();
+        }
+
+        /**
+         *   Releases the socket when the queued messages have been written and the reading waits for the next message.
+         *   The pending read of the header or of the receive buffer is cancelled by the release and its handler
+         *   finishes the hand off with the bytes it got, the body of a message is read to the end first.
+         */
+        void hand_off_when_quiet()
+        {
+            if (!m_is_handing_off || m_released_handle || !is_connected())
+                return;
+
+            if (m_is_writing_message || has_messages_to_write() || m_is_moving || m_next_executor)
+                return;
+
+            if (!m_is_read_parked && !m_is_read_paused && !m_is_read_cancellable)
+                return;
+
+            // Message the user has not taken would be lost with the socket
+            if (m_held_message)
+            {
+                finish_hand_off(std::nullopt);
+                return;
+            }
+
+            m_released_handle = m_socket->release_handle();
+
+            if (!m_released_handle)
+            {
+                finish_hand_off(std::nullopt);
+                return;
+            }
+
+            cancel_timer(m_heartbeat_timer);
+            cancel_timer(m_tcp_info_timer);
+            cancel_timer(m_rate_limit_timer);
+
+            if (m_is_read_cancellable)
+                return;
+
+            // Header of the message that the rate limits paused has been read already in exact mode
+            size_t header_bytes = 0;
+
+            if (m_is_read_paused)
+            {
+                header_bytes =
+                    m_header_format != Header_format::standard ? m_header_bytes : sizeof(Message_header<Id_type>);
+            }
+
+            finish_hand_off(get_unread_bytes(header_bytes));
+        }
+
+        // @param the unread bytes, nothing if the socket could not be handed off
+        void finish_hand_off(std::optional<std::vector<char>> unread_bytes)
+        {
+            std::optional<Connection_hand_off> hand_off = std::nullopt;
+
+            if (unread_bytes && m_released_handle)
+            {
+                hand_off = Connection_hand_off{
+                    .m_handle = *m_released_handle,
+                    .m_write_header_format = m_write_header_format.load(std::memory_order_relaxed),
+                    .m_write_compression_codec = m_write_compression_codec.load(std::memory_order_relaxed),
+                    .m_agreed_capabilities = m_agreed_capabilities.load(std::memory_order_relaxed),
+                    .m_received_user_messages = get_metrics().m_user_messages_received,
+                    .m_unread_bytes = std::move(*unread_bytes)};
+            }
+
+            m_is_handing_off = false;
+            disconnect_on_strand(std::nullopt);
+            m_on_hand_off.broadcast(hand_off);
+        }
+
+        /**
+         *   @param number of header bytes read in exact mode, the buffered modes have their bytes in the receive buffer
+         *   @return the bytes that have been read from the socket but not handled
+         */
+        [[nodiscard]] std::vector<char> get_unread_bytes(size_t header_bytes)
+        {
+            if (m_read_mode != Read_mode::exact)
+                return {m_receive_buffer.begin() + m_receive_begin, m_receive_buffer.begin() + m_receive_end};
+
+            const char* header = m_header_format != Header_format::standard
+                                     ? m_header_buffer.data()
+                                     : reinterpret_cast<const char*>(m_received_message.header_data());
+            return {header, header + header_bytes};
+        }
+
+        void setup_callbacks_on_socket()
+        {
+            m_socket->m_handshake_finished.set_callback(this, &Connection::async_handshake_finished);
+            m_socket->m_read_header_finished.set_callback(this, &Connection::async_read_header_finished);
+            m_socket->m_read_body_finished.set_callback(this, &Connection::async_read_body_finished);
+            m_socket->m_read_some_finished.set_callback(this, &Connection::async_read_some_finished);
+            m_socket->m_wait_readable_finished.set_callback(this, &Connection::async_wait_readable_finished);
+            m_socket->m_write_finished.set_callback(this, &Connection::async_write_finished);
+        }
+
+        // Notification about this connection, only the rare ones have a text
+        void notify(
+            Notification_code code, Severity severity, asio::error_code error = {}, std::string text = "") const
+        {
+            if (!IS_NOTIFICATIONS_ENABLED || !m_on_notification.has_been_set())
+                return;
+
+            m_on_notification.broadcast(Notification{
+                .m_code = code,
+                .m_severity = severity,
+                .m_client_id = m_id,
+                .m_address = m_address,
+                .m_error = error,
+                .m_text = std::move(text)});
+        }
+
+        // @param the reason that is notified as an error or nothing if the disconnect is not notified
+        void disconnect_on_strand(std::optional<Notification_code> reason, asio::error_code error = {})
+        {
+            if (m_is_connected.exchange(false, std::memory_order_acq_rel))
+            {
+                NET_TRACE_INSTANT("disconnect", m_id);
+
+                if (reason.has_value())
+                    notify(reason.value(), Severity::error, error);
+
+                if (m_metrics_counters)
+                    m_metrics_counters->add_disconnect(reason.value_or(Notification_code::disconnected));
+
+                m_socket->disconnect();
+                cancel_timer(m_handshake_timer);
+                cancel_timer(m_heartbeat_timer);
+                cancel_timer(m_tcp_info_timer);
+                cancel_timer(m_rate_limit_timer);
+                cancel_timer(m_drain_timer);
+                m_on_disconnect.broadcast(m_id);
+
+                // Released socket is handed off when its read has finished, otherwise the hand off ends here
+                if (m_is_handing_off && !m_released_handle)
+                {
+                    m_is_handing_off = false;
+                    std::optional<Connection_hand_off> no_hand_off = std::nullopt;
+                    m_on_hand_off.broadcast(no_hand_off);
+                }
+            }
+        }
+
+        // Updates the address of the peer, the ip text is formatted here once for the messages of the connection
+        void update_ip()
+        {
+            if (!is_connected())
+                return;
+
+            if (const std::optional<asio::ip::address> address = m_socket->get_address())
+            {
+                m_address = *address;
+                m_ip = std::make_shared<const std::string>(address->to_string());
+            }
+            else
+                m_ip = std::make_shared<const std::string>(m_socket->get_ip());
+        }
+
+        // Events when handshake is finished
+        void async_handshake_finished(asio::error_code error)
+        {
+            NET_TRACE_END("handshake", m_id);
+            NET_ALLOCATION_SCOPE(handshake);
+            NET_COUNT_ALLOCATION_MESSAGES(handshake, 1);
+            cancel_timer(m_handshake_timer);
+            m_is_handshake_pending = false;
+
+            if (!error)
+            {
+                m_has_done_handshake = true;
+
+                const auto handshake_duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - m_start_time);
+                m_counters.set_handshake_duration(handshake_duration);
+
+                if (m_metrics_counters)
+                    m_metrics_counters->add_handshake(handshake_duration);
+
+                notify(Notification_code::handshake_succeeded, Severity::notification);
+
+                // Move that was asked during the handshake is made before the first read, which starts after it
+                if (m_next_executor)
+                {
+                    m_is_read_parked = true;
+                    move_when_quiet();
+                }
+                else
+                    start_reading();
+
+                start_heartbeat();
+                start_tcp_info_sampling();
+
+                // If received any messages to be sent during the handshake, we send them now
+                start_writing_message();
+            }
+            else
+                disconnect_on_strand(Notification_code::handshake_failed, error);
+        }
+
+        // Starts reading messages with the selected read mode
+        void start_reading()
+        {
+            if (m_read_mode == Read_mode::exact)
+                read_header();
+            else if (m_receive_end > 0)
+            {
+                // Bytes that were handed off from another process are parsed before reading more
+                async_read_some_finished({}, 0);
+            }
+            else
+                read_some_to_receive_buffer();
+        }
+
+        // Starts reading the next header in the exact read mode
+        void read_header()
+        {
+            if (park_read_for_move())
+                return;
+
+            if (m_header_format != Header_format::standard)
+            {
+                // Reads only the prefix first because the header size depends on its format
+                m_header_bytes = Compact_header<Id_type>::PREFIX_SIZE;
+                m_socket->async_read_header(m_header_buffer.data(), m_header_bytes);
+            }
+            else
+                m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+
+            m_is_read_cancellable = true;
+            m_header_read_offset = 0;
+        }
+
+        // @return size of the header that starts with the prefix in either format
+        [[nodiscard]] size_t wire_header_size(const char* prefix) const noexcept
+        {
+            if (is_compact_header(prefix))
+                return Compact_header<Id_type>::encoded_size(prefix);
+
+            return sizeof(Message_header<Id_type>);
+        }
+
+        // Decodes header from the bytes received, there has to be wire_header_size bytes
+        [[nodiscard]] Message_header<Id_type> decode_wire_header(const char* data) const noexcept
+        {
+            if (is_compact_header(data))
+                return Compact_header<Id_type>::decode(data);
+
+            Message_header<Id_type> header;
+            std::memcpy(&header, data, sizeof(header));
+            return header;
+        }
+
+        // @return true if the header that starts with the prefix is in a compact format that is accepted
+        [[nodiscard]] bool is_compact_header(const char* prefix) const noexcept
+        {
+            return (m_header_format != Header_format::standard && Compact_header<Id_type>::is_compact(prefix)) ||
+                   is_checked_header(prefix);
+        }
+
+        // @return true if the header that starts with the prefix is checked and checked headers are accepted
+        [[nodiscard]] bool is_checked_header(const char* prefix) const noexcept
+        {
+            return m_header_format == Header_format::checked && Compact_header<Id_type>::is_checked(prefix);
+        }
+
+        // Checks if the header is in valid format
+        [[nodiscard]] bool validate_header(Message_header<Id_type> header) const
+        {
+            if (!header.is_validation_key_correct() || header.m_size > m_max_message_size)
+                return false;
+
+            const bool is_compressed = header.m_body_encoding != Body_encoding::raw;
+
+            if (header.m_body_encoding > Body_encoding::compressed_delta)
+                return false;
+
+            // Internal messages are never compressed because they are sent before the codec is agreed
+            // Streamed message can have any size but each chunk is limited
+            if (header.m_internal_id == Internal_id::stream_chunk)
+                return !is_compressed &&
+                       header.m_size <= Stream_chunk<Id_type>::HEADER_SIZE + Stream_chunk<Id_type>::MAX_DATA_SIZE &&
+                       (m_accepted_messages == nullptr || m_accepted_messages->contains(header.m_id));
+
+            // Whole message is validated when its first fragment is received
+            if (header.m_internal_id == Internal_id::message_fragment)
+                return !is_compressed && header.m_size >= Message_fragment<Id_type>::HEADER_SIZE &&
+                       header.m_size <=
+                           Message_fragment<Id_type>::HEADER_SIZE + Message_fragment<Id_type>::MAX_DATA_SIZE &&
+                       (m_accepted_messages == nullptr || m_accepted_messages->contains(header.m_id));
+
+            if (header.m_internal_id == Internal_id::ping || header.m_internal_id == Internal_id::pong)
+                return !is_compressed && header.m_size == sizeof(uint64_t);
+
+            if (header.m_internal_id == Internal_id::stream_window)
+                return !is_compressed && header.m_size == sizeof(uint32_t) + sizeof(uint64_t);
+
+            // Body of the call is limited like the message of its id, an empty response is allowed for the ids
+            // that are not accepted so the peer can tell that it has no handler for them
+            if (header.m_internal_id == Internal_id::rpc_request || header.m_internal_id == Internal_id::rpc_response)
+            {
+                const size_t trailer_size = header.m_internal_id == Internal_id::rpc_request
+                                                ? Rpc_message<Id_type>::REQUEST_TRAILER_SIZE
+                                                : Rpc_message<Id_type>::RESPONSE_TRAILER_SIZE;
+
+                if (is_compressed || header.m_size < trailer_size)
+                    return false;
+
+                if (m_accepted_messages == nullptr)
+                    return true;
+
+                const Message_limits* limits = m_accepted_messages->find(header.m_id);
+                const size_t body_size = header.m_size - trailer_size;
+
+                return limits != nullptr ? body_size <= limits->m_max
+                                         : header.m_internal_id == Internal_id::rpc_response && body_size == 0;
+            }
+
+            if (header.m_internal_id == Internal_id::multicast_join)
+                return !is_compressed && (header.m_size == 0 || header.m_size == Multicast_message<Id_type>::JOIN_SIZE);
+
+            if (header.m_internal_id == Internal_id::multicast_leave)
+                return !is_compressed && header.m_size == Multicast_message<Id_type>::LEAVE_SIZE;
+
+            if (header.m_internal_id == Internal_id::multicast_nak)
+                return !is_compressed && header.m_size == Multicast_message<Id_type>::NAK_SIZE;
+
+            if (header.m_internal_id == Internal_id::multicast_skip)
+                return !is_compressed && header.m_size == Multicast_message<Id_type>::SKIP_SIZE;
+
+            // Repaired message is limited like the message of its id
+            if (header.m_internal_id == Internal_id::multicast_repair)
+            {
+                if (is_compressed || header.m_size < Multicast_message<Id_type>::REPAIR_TRAILER_SIZE)
+                    return false;
+
+                if (m_accepted_messages == nullptr)
+                    return true;
+
+                const Message_limits* limits = m_accepted_messages->find(header.m_id);
+                return limits != nullptr &&
+                       header.m_size - Multicast_message<Id_type>::REPAIR_TRAILER_SIZE <= limits->m_max;
+            }
+
+            // Messages of the bundle are validated one by one when it is unpacked
+            if (header.m_internal_id == Internal_id::message_bundle)
+                return header.m_body_encoding != Body_encoding::compressed_delta &&
+                       header.m_size <= Message_bundle<Id_type>::MAX_SIZE;
+
+            if (header.m_internal_id == Internal_id::server_hello || header.m_internal_id == Internal_id::client_hello)
+                return !is_compressed && header.m_size <= Hello_data::MAX_SIZE;
+
+            if (header.m_internal_id == Internal_id::cluster_hello)
+                return !is_compressed && header.m_size == Cluster_message<Id_type>::HELLO_SIZE;
+
+            // Routed message is limited like the message of its id
+            if (header.m_internal_id == Internal_id::cluster_route)
+            {
+                if (is_compressed || header.m_size < Cluster_message<Id_type>::ROUTE_TRAILER_SIZE)
+                    return false;
+
+                if (m_accepted_messages == nullptr)
+                    return true;
+
+                const Message_limits* limits = m_accepted_messages->find(header.m_id);
+                return limits != nullptr &&
+                       header.m_size - Cluster_message<Id_type>::ROUTE_TRAILER_SIZE <= limits->m_max;
+            }
+
+            // Published messages are validated one by one when the batch is read, only a batch of one message that
+            // is limited like the message of its id can be larger than the max batch
+            if (header.m_internal_id == Internal_id::cluster_publish)
+            {
+                if (is_compressed)
+                    return false;
+
+                if (header.m_size <= Cluster_message<Id_type>::MAX_PUBLISH_BATCH_SIZE || m_accepted_messages == nullptr)
+                    return true;
+
+                const Message_limits* limits = m_accepted_messages->find(header.m_id);
+                return limits != nullptr &&
+                       header.m_size <= uint64_t{limits->m_max} + Cluster_message<Id_type>::MAX_PUBLISH_OVERHEAD;
+            }
+
+            if (header.m_internal_id == Internal_id::client_redirect)
+                return !is_compressed && header.m_size <= Message_converter<Id_type>::MAX_REDIRECT_SIZE;
+
+            // Shutdown has no body, it only tells that the server will disconnect
+            if (header.m_internal_id == Internal_id::server_shutdown)
+                return !is_compressed && header.m_size == 0;
+
+            // Answer to the resume is written as the struct is in memory
+            if (header.m_internal_id == Internal_id::session_resume)
+                return !is_compressed && header.m_size == sizeof(Session_resume_data);
+
+            // Update has atleast the sequence, the baseline and the end of the entries, the ack is only the sequence
+            if (header.m_internal_id == Internal_id::replication_update)
+                return !is_compressed && header.m_size >= 3 && header.m_size <= m_max_replication_update_size;
+
+            if (header.m_internal_id == Internal_id::replication_ack)
+                return !is_compressed && header.m_size >= 1 && header.m_size <= MAX_VARINT_SIZE;
+
+            if (header.m_internal_id != Internal_id::not_internal)
+                return !is_compressed; // todo add spesific validation for internal messages
+
+            // Size of the fixed size ids is known at compile time so their limits are not needed
+            const std::optional<Net::Header_size_type> fixed_size = get_fixed_message_size(header);
+
+            if (fixed_size && header.m_size != *fixed_size)
+                return false;
+
+            if (m_accepted_messages != nullptr)
+            {
+                const Message_limits* limits = m_accepted_messages->find(header.m_id);
+
+                if (limits == nullptr)
+                    return false;
+
+                // Minimum of a compressed message is checked after it has been decompressed
+                if (!fixed_size && ((!is_compressed && header.m_size < limits->m_min) || header.m_size > limits->m_max))
+                    return false;
+            }
+
+            return true;
+        }
+
+        // Event when read header is finished
+        void async_read_header_finished(asio::error_code error, size_t bytes)
+        {
+            NET_TRACE_INSTANT("read_header", m_id);
+            NET_ALLOCATION_SCOPE(read);
+            m_is_read_cancellable = false;
+
+            // Header read is cancelled by the hand off or it finished just before, either way it goes to the new owner
+            if (m_released_handle)
+            {
+                finish_hand_off(get_unread_bytes(m_header_read_offset + bytes));
+                return;
+            }
+
+            if (!error)
+            {
+                if (m_header_format != Header_format::standard)
+                {
+                    const size_t header_size = wire_header_size(m_header_buffer.data());
+
+                    // Reads the rest of the header after the prefix
+                    if (m_header_bytes < header_size)
+                    {
+                        const size_t read_bytes = m_header_bytes;
+                        m_header_bytes = header_size;
+                        m_socket->async_read_header(m_header_buffer.data() + read_bytes, header_size - read_bytes);
+                        m_is_read_cancellable = true;
+                        m_header_read_offset = read_bytes;
+                        return;
+                    }
+
+                    *m_received_message.header_data() = decode_wire_header(m_header_buffer.data());
+
+                    // Body is added to the checksum as it is read
+                    m_is_read_checked = is_checked_header(m_header_buffer.data());
+
+                    if (m_is_read_checked)
+                    {
+                        const char* header_bytes = m_header_buffer.data();
+                        m_read_checksum = Compact_header<Id_type>::compute_checksum(header_bytes, header_size, {});
+                        m_expected_checksum = Compact_header<Id_type>::read_checksum(header_bytes, header_size);
+                    }
+                }
+
+                if (!validate_header(m_received_message.get_header()))
+                {
+                    disconnect_on_strand(Notification_code::header_validation_failed);
+                    return;
+                }
+
+                handle_received_header();
+            }
+            else
+                disconnect_on_strand(Notification_code::read_header_failed, error);
+        }
+
+        // Applies the rate limits to the validated header and reads the body of the message in exact read mode
+        void handle_received_header()
+        {
+            const Message_header<Id_type>& header = m_received_message.get_header();
+
+            switch (apply_rate_limits(header, sizeof(Message_header<Id_type>) + header.m_size))
+            {
+            case Rate_decision::receive:
+                break;
+            case Rate_decision::drop:
+                m_discard_remaining = header.m_size;
+
+                if (m_discard_remaining > 0)
+                    discard_body();
+                else if (is_read_checksum_correct())
+                    read_header();
+
+                return;
+            case Rate_decision::pause:
+            case Rate_decision::disconnect:
+                return;
+            }
+
+            // Don't read body if size of message is 0
+            if (header.m_size == 0)
+            {
+                if (is_read_checksum_correct() && on_message_received())
+                    read_header();
+
+                return;
+            }
+
+            if (!borrow_body_destination(header))
+                m_received_message.resize_body(header.m_size);
+
+            m_socket->async_read_body(m_received_message.body_data(), m_received_message.body_size());
+        }
+
+        // @return true if the sink of the id gave the memory the body is read to
+        bool borrow_body_destination(const Message_header<Id_type>& header)
+        {
+            if (m_body_sinks == nullptr || header.m_internal_id != Internal_id::not_internal ||
+                header.m_body_encoding != Body_encoding::raw)
+                return false;
+
+            const auto found_sink = m_body_sinks->find(header.m_id);
+
+            if (found_sink == m_body_sinks->end())
+                return false;
+
+            std::optional<Body_destination> destination = found_sink->second(header, get_client_information());
+
+            if (!destination || destination->m_bytes.size() != header.m_size || destination->m_owner == nullptr)
+                return false;
+
+            m_received_message.borrow_body(std::move(destination->m_owner), destination->m_bytes);
+            return true;
+        }
+
+        // Reads the next part of the dropped body to the buffer that is reused for all the dropped bodies
+        void discard_body()
+        {
+            m_discard_buffer.resize(DISCARD_BUFFER_SIZE);
+
+            const size_t read_size = static_cast<size_t>(std::min<uint64_t>(m_discard_remaining, DISCARD_BUFFER_SIZE));
+            m_socket->async_read_body(m_discard_buffer.data(), read_size);
+        }
+
+        // Event when read body is finished
+        void async_read_body_finished(asio::error_code error, size_t bytes)
+        {
+            NET_TRACE_INSTANT("read_body", m_id);
+            NET_ALLOCATION_SCOPE(read);
+
+            if (!error)
+            {
+                if (m_discard_remaining > 0)
+                {
+                    m_discard_remaining -= bytes;
+
+                    if (m_is_read_checked)
+                        m_read_checksum = Crc32c::extend(m_read_checksum, {m_discard_buffer.data(), bytes});
+
+                    if (m_discard_remaining > 0)
+                        discard_body();
+                    else if (is_read_checksum_correct())
+                        read_header();
+
+                    return;
+                }
+
+                if (m_is_read_checked)
+                    m_read_checksum = Crc32c::extend(
+                        m_read_checksum, {m_received_message.body_data(), m_received_message.body_size()});
+
+                if (is_read_checksum_correct() && on_message_received())
+                    read_header();
+            }
+            else
+                disconnect_on_strand(Notification_code::read_body_failed, error);
+        }
+
+        // @return false if the checksum of the message read in exact mode did not match and it was disconnected
+        bool is_read_checksum_correct()
+        {
+            if (!m_is_read_checked || m_read_checksum == m_expected_checksum)
+                return true;
+
+            disconnect_on_strand(Notification_code::checksum_mismatch);
+            return false;
+        }
+
+        // Internal messages that carry the data of the user are limited too
+        [[nodiscard]] static bool is_rate_limited(const Message_header<Id_type>& header) noexcept
+        {
+            return header.m_internal_id == Internal_id::not_internal ||
+                   header.m_internal_id == Internal_id::stream_chunk ||
+                   header.m_internal_id == Internal_id::message_fragment ||
+                   header.m_internal_id == Internal_id::message_bundle;
+        }
+
+        // @return the buckets of the id or nullptr if the id has no rate limit
+        [[nodiscard]] Rate_buckets* find_message_rate_buckets(Id_type id)
+        {
+            auto found_buckets = m_message_rate_buckets.find(id);
+
+            // Ids without a limit get unlimited buckets so the accepted messages are searched only once per id
+            if (found_buckets == m_message_rate_buckets.end())
+            {
+                const Message_limits* limits = m_accepted_messages->find(id);
+                Rate_buckets buckets;
+
+                if (limits != nullptr && limits->m_rate_limit)
+                    buckets = Rate_buckets(*limits->m_rate_limit);
+
+                found_buckets = m_message_rate_buckets.emplace(id, buckets).first;
+            }
+
+            return found_buckets->second.is_limited() ? &found_buckets->second : nullptr;
+        }
+
+        /**
+         *   Takes the message from the rate limits of the peer and its id. This is checked before the body is
+         *   allocated, the message is paused, dropped or disconnected by the policy if it does not fit.
+         *
+         *   @param the validated header
+         *   @param size of the message on the wire
+         */
+        Rate_decision apply_rate_limits(const Message_header<Id_type>& header, uint64_t message_bytes)
+        {
+            if ((!m_peer_rate_buckets.is_limited() && !m_has_message_rate_limits) || !is_rate_limited(header))
+                return Rate_decision::receive;
+
+            // Bundle has many ids so only the limit of the peer applies to it
+            const bool has_message_buckets =
+                m_has_message_rate_limits && header.m_internal_id != Internal_id::message_bundle;
+            Rate_buckets* message_buckets = has_message_buckets ? find_message_rate_buckets(header.m_id) : nullptr;
+            Token_bucket::Clock::duration wait_time = m_peer_rate_buckets.wait_time(message_bytes);
+
+            if (message_buckets != nullptr)
+                wait_time = std::max(wait_time, message_buckets->wait_time(message_bytes));
+
+            if (wait_time == Token_bucket::Clock::duration::zero())
+            {
+                m_peer_rate_buckets.take(message_bytes);
+
+                if (message_buckets != nullptr)
+                    message_buckets->take(message_bytes);
+
+                return Rate_decision::receive;
+            }
+
+            switch (m_rate_limit_policy)
+            {
+            case Rate_limit_policy::pause_reading:
+                // Message is checked again when the buckets should have refilled
+                m_is_read_paused = true;
+                m_rate_limit_timer = schedule_on_strand(
+                    std::chrono::ceil<std::chrono::milliseconds>(wait_time), &Connection::on_rate_limit_resume);
+                return Rate_decision::pause;
+            case Rate_limit_policy::drop:
+                return Rate_decision::drop;
+            case Rate_limit_policy::disconnect:
+                break;
+            }
+
+            disconnect_on_strand(Notification_code::rate_limit_exceeded);
+            return Rate_decision::disconnect;
+        }
+
+        // Continues reading from the message that was paused by the rate limits
+        void on_rate_limit_resume()
+        {
+            m_rate_limit_timer = 0;
+            m_is_read_paused = false;
+
+            if (!is_connected())
+                return;
+
+            if (m_read_mode == Read_mode::exact)
+                handle_received_header();
+            else
+                continue_reading();
+        }
+
+        // Reads whatever is available to the free space at the end of the receive buffer
+        void read_some_to_receive_buffer()
+        {
+            if (park_read_for_move())
+                return;
+
+            // Idle connection gives its buffer back, there is no partial message in it to keep
+            if (m_read_mode == Read_mode::on_demand && m_receive_end == 0 && m_socket->can_wait_readable())
+            {
+                m_receive_buffer.clear();
+                m_receive_buffer.shrink_to_fit();
+                m_delivery_batch.shrink_to_fit();
+                m_socket->async_wait_readable();
+                m_is_read_cancellable = true;
+                return;
+            }
+
+            read_to_receive_buffer();
+        }
+
+        void read_to_receive_buffer()
+        {
+            if (m_receive_buffer.size() < m_receive_buffer_size)
+                m_receive_buffer.resize(m_receive_buffer_size);
+
+            size_t read_size = m_receive_buffer.size() - m_receive_end;
+
+            // Bulk connection yields its thread to the other connections after each budget
+            if (m_is_bulk.load(std::memory_order_relaxed))
+                read_size = std::min(read_size, m_bulk_read_budget);
+
+            m_socket->async_read_some(m_receive_buffer.data() + m_receive_end, read_size);
+            m_is_read_cancellable = true;
+        }
+
+        // Event when the socket of the idle on demand connection has data to read
+        void async_wait_readable_finished(asio::error_code error)
+        {
+            m_is_read_cancellable = false;
+
+            if (m_released_handle)
+                finish_hand_off(get_unread_bytes(0));
+            else if (!error)
+                read_to_receive_buffer();
+            else
+                disconnect_on_strand(Notification_code::read_failed, error);
+        }
+
+        // Event when buffered read is finished
+        void async_read_some_finished(asio::error_code error, size_t bytes)
+        {
+            NET_TRACE_INSTANT("read", m_id);
+            NET_ALLOCATION_SCOPE(read);
+            m_is_read_cancellable = false;
+
+            if (m_released_handle)
+            {
+                m_receive_end += bytes;
+                finish_hand_off(get_unread_bytes(0));
+            }
+            else if (!error)
+            {
+                m_receive_end += bytes;
+
+                // Reading continues after the pause
+                if (!parse_receive_buffer() || m_is_read_paused)
+                    return;
+
+                read_some_to_receive_buffer();
+            }
+            else
+                disconnect_on_strand(Notification_code::read_failed, error);
+        }
+
+        /**
+         *   Dispatches every complete message in the receive buffer and makes room for the next read.
+         *   Parsing stops when the reading is paused by the rate limits or the user.
+         *
+         *   @return false if a header was invalid and the connection was disconnected
+         */
+        bool parse_receive_buffer()
+        {
+            size_t required_size = 0;
+
+            m_is_batching_deliveries = m_on_messages.has_been_set();
+            const bool is_parsed = parse_received_frames(required_size);
+            m_is_batching_deliveries = false;
+
+            // Messages before a failed frame are delivered like they were before the batching
+            deliver_message_batch();
+
+            // Buffer that messages refer to is given to them even when the connection is lost, so it is done always
+            compact_receive_buffer(required_size);
+            return is_parsed;
+        }
+
+        /**
+         *   Handles the complete messages in the receive buffer
+         *
+         *   @param set to the amount of bytes the next message needs in the buffer
+         *   @return false if the connection was lost
+         */
+        bool parse_received_frames(size_t& required_size)
+        {
+            const size_t prefix_size = m_header_format != Header_format::standard ? Compact_header<Id_type>::PREFIX_SIZE
+                                                                                   : sizeof(Message_header<Id_type>);
+            required_size = prefix_size;
+
+            // Frames that the scanner has already found complete and valid
+            typename Frame_scanner<Id_type>::Batch scanned_frames;
+            size_t scanned_count = 0;
+            size_t scanned_index = 0;
+
+            while (m_receive_end - m_receive_begin >= prefix_size)
+            {
+                const char* frame = m_receive_buffer.data() + m_receive_begin;
+
+                if (scanned_index == scanned_count)
+                {
+                    scanned_count = scan_received_frames(scanned_frames);
+                    scanned_index = 0;
+                }
+
+                size_t header_size = 0;
+                Message_header<Id_type> header;
+
+                if (scanned_index < scanned_count)
+                {
+                    header = scanned_frames[scanned_index].m_header;
+                    header_size = scanned_frames[scanned_index++].m_header_size;
+                }
+                else
+                {
+                    header_size = wire_header_size(frame);
+
+                    if (m_receive_end - m_receive_begin < header_size)
+                    {
+                        required_size = header_size;
+                        break;
+                    }
+
+                    header = decode_wire_header(frame);
+
+                    if (!validate_header(header) || header.m_size > std::numeric_limits<size_t>::max() - header_size)
+                    {
+                        disconnect_on_strand(Notification_code::header_validation_failed);
+                        return false;
+                    }
+
+                    if (m_receive_end - m_receive_begin < header_size + header.m_size)
+                    {
+                        required_size = header_size + header.m_size;
+                        break;
+                    }
+                }
+
+                const size_t frame_size = header_size + header.m_size;
+
+                const std::span<const char> body(frame + header_size, frame_size - header_size);
+
+                if (is_checked_header(frame) && Compact_header<Id_type>::compute_checksum(frame, header_size, {body}) !=
+                                                    Compact_header<Id_type>::read_checksum(frame, header_size))
+                {
+                    disconnect_on_strand(Notification_code::checksum_mismatch);
+                    return false;
+                }
+
+                const Rate_decision rate_decision = apply_rate_limits(header, frame_size);
+
+                if (rate_decision == Rate_decision::disconnect)
+                    return false;
+
+                if (rate_decision == Rate_decision::pause)
+                    break;
+
+                if (rate_decision == Rate_decision::drop)
+                {
+                    m_receive_begin += frame_size;
+                    continue;
+                }
+
+                *m_received_message.header_data() = header;
+
+                if (can_borrow_body(header))
+                {
+                    char* const body_data = m_receive_buffer.data() + m_receive_begin + header_size;
+                    m_received_message.borrow_body(get_lent_receive_buffer(), {body_data, body.size()});
+                }
+                else
+                {
+                    m_received_message.resize_body(header.m_size);
+
+                    if (header.m_size > 0)
+                        std::memcpy(m_received_message.body_data(), frame + header_size, header.m_size);
+                }
+
+                m_receive_begin += frame_size;
+
+                // Rest of the buffer is parsed when the reading is resumed
+                if (!on_message_received())
+                {
+                    if (!is_connected())
+                        return false;
+
+                    break;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         *   Scans the frames from the start of the unparsed data, only the compact headers of the accepted ids with
+         *   a one byte id are scanned
+         *
+         *   @return the amount of complete frames with valid headers
+         */
+        [[nodiscard]] size_t scan_received_frames(typename Frame_scanner<Id_type>::Batch& output) const noexcept
+        {
+            if constexpr (Accepted_messages<Id_type>::IS_DENSE)
+            {
+                if (m_header_format == Header_format::standard || m_accepted_messages == nullptr)
+                    return 0;
+
+                return Frame_scanner<Id_type>::scan(
+                    {m_receive_buffer.data() + m_receive_begin, m_receive_end - m_receive_begin},
+                    *m_accepted_messages, m_max_message_size, m_header_format == Header_format::checked, output);
+            }
+            else
+                return 0;
+        }
+
+        // Moves the incomplete message to the start of the buffer, or to a new buffer if the old one was lent
+        void compact_receive_buffer(size_t required_size)
+        {
+            const size_t unparsed_size = m_receive_end - m_receive_begin;
+
+            if (m_lent_receive_buffer)
+            {
+                // Swapped vector keeps its memory so the messages still refer to valid bytes
+                m_lent_receive_buffer->m_buffer.swap(m_receive_buffer);
+                m_receive_buffer.resize(std::max({m_receive_buffer_size, required_size, unparsed_size}));
+
+                if (unparsed_size > 0)
+                    std::memcpy(
+                        m_receive_buffer.data(), m_lent_receive_buffer->m_buffer.data() + m_receive_begin,
+                        unparsed_size);
+
+                m_lent_receive_buffer.reset();
+            }
+            else if (unparsed_size > 0 && m_receive_begin > 0)
+                std::memmove(m_receive_buffer.data(), m_receive_buffer.data() + m_receive_begin, unparsed_size);
+
+            m_receive_begin = 0;
+            m_receive_end = unparsed_size;
+
+            if (required_size > m_receive_buffer.size())
+                m_receive_buffer.resize(required_size);
+        }
+
+        // Only the raw user messages are kept as they are received, the small ones are cheaper to copy
+        [[nodiscard]] bool can_borrow_body(const Message_header<Id_type>& header) const noexcept
+        {
+            return m_is_zero_copy_receive && header.m_internal_id == Internal_id::not_internal &&
+                   header.m_body_encoding == Body_encoding::raw && header.m_size > Message<Id_type>::INLINE_BODY_SIZE;
+        }
+
+        // @return the owner of the receive buffer for the messages that refer to it, it is lent when parsing ends
+        [[nodiscard]] std::shared_ptr<const void> get_lent_receive_buffer()
+        {
+            if (!m_lent_receive_buffer)
+                m_lent_receive_buffer = std::make_shared<Lent_receive_buffer>(
+                    m_receive_memory, std::pmr::vector<char>(m_receive_buffer.get_allocator()));
+
+            return m_lent_receive_buffer;
+        }
+
+        [[nodiscard]] static size_t queued_size(const Outgoing_message<Id_type>& message) noexcept
+        {
+            return message.get().header_size() + message.get().body_size();
+        }
+
+        [[nodiscard]] static bool is_internal(const Queued_message& queued) noexcept
+        {
+            return queued.m_message.get().get_internal_id() != Internal_id::not_internal;
+        }
+
+        // Bundle carries the messages of the user so it is queued like them, but it is never dropped or replaced
+        [[nodiscard]] static bool is_control(const Queued_message& queued) noexcept
+        {
+            return is_internal(queued) && queued.m_message.get().get_internal_id() != Internal_id::message_bundle;
+        }
+
+        template <size_t... Indexes>
+        [[nodiscard]] static auto make_out_queues(std::index_sequence<Indexes...>)
+        {
+            return std::array{(static_cast<void>(Indexes), Message_queue(get_message_memory_resource()))...};
+        }
+
+        [[nodiscard]] Message_queue& get_lane(Message_priority priority) noexcept
+        {
+            return m_out_queues[static_cast<size_t>(priority)];
+        }
+
+        [[nodiscard]] bool is_over_high_watermark(size_t message_bytes) const noexcept
+        {
+            return m_queued_message_count >= m_write_queue_limits.m_high_messages ||
+                   m_queued_bytes + message_bytes > m_write_queue_limits.m_high_bytes;
+        }
+
+        /**
+         *   Adds the message to the write queue, the overflow policy is used if it does not fit
+         *
+         *   @param the message
+         *   @param the lane or the logical stream of the message and the key that replaces the queued message with
+         *   the same id and key
+         *   @param when the message was sent, only used by the latency tracking
+         */
+        void queue_message(
+            Outgoing_message<Id_type> message, Send_options options = {},
+            std::chrono::steady_clock::time_point queued_time = {})
+        {
+            // Frames of the logical streams are cut from the whole body
+            if (options.m_stream_id != 0)
+                message.flatten_patch();
+
+            if (message.get().get_internal_id() == Internal_id::message_bundle)
+            {
+                // Messages of the bundle have many ids so there is no single id to conflate
+                options.m_conflation_key.reset();
+
+                if (!get_agreed_capabilities().has(Capability::message_bundle))
+                {
+                    queue_unbundled_messages(message.get(), options, queued_time);
+                    return;
+                }
+            }
+
+            Queued_message queued{.m_message = std::move(message), .m_queued_time = queued_time};
+            const size_t message_bytes = queued_size(queued.m_message);
+
+            if (options.m_conflation_key)
+            {
+                queued.m_conflation_key =
+                    Conflation_key{.m_id = queued.m_message.get().get_id(), .m_key = *options.m_conflation_key};
+
+                if (replace_conflated_message(queued, message_bytes))
+                    return;
+            }
+
+            const Message_priority priority = is_control(queued) ? Message_priority::control : options.m_priority;
+            Logical_stream* logical_stream = nullptr;
+
+            if (options.m_stream_id != 0 && !is_control(queued))
+            {
+                logical_stream = get_logical_stream(options.m_stream_id);
+
+                if (logical_stream == nullptr)
+                {
+                    m_dropped_message_count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+
+            Message_queue& queue =
+                logical_stream != nullptr ? logical_stream->m_queue : get_lane(priority);
+
+            if (!is_control(queued) && is_over_high_watermark(message_bytes))
+            {
+                set_congested(true);
+
+                switch (m_write_queue_limits.m_policy)
+                {
+                case Overflow_policy::disconnect:
+                    disconnect_on_strand(Notification_code::write_queue_full);
+                    return;
+                case Overflow_policy::drop_newest:
+                    m_dropped_message_count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                case Overflow_policy::coalesce:
+                    if (replace_queued_message(queue, queued, message_bytes))
+                        return;
+
+                    drop_oldest_messages(message_bytes);
+                    break;
+                case Overflow_policy::drop_oldest:
+                    drop_oldest_messages(message_bytes);
+                    break;
+                }
+            }
+
+            m_queued_bytes += message_bytes;
+            ++m_queued_message_count;
+            queue.push_back(std::move(queued));
+
+            if (queue.back().m_conflation_key)
+                m_conflated_messages.emplace(*queue.back().m_conflation_key, &queue.back());
+
+            m_counters.set_out_queue(m_queued_message_count, m_queued_bytes);
+
+            if (m_adaptive_batching)
+                measure_send_rate(message_bytes);
+
+            start_writing_message();
+        }
+
+        void queue_sent_messages()
+        {
+            NET_ALLOCATION_SCOPE(send);
+
+            while (std::optional<Sent_message> sent = m_sent_messages.try_pop())
+                queue_message(std::move(sent->m_message), sent->m_options, sent->m_time);
+        }
+
+        // Peer that does not know the bundles gets its messages one by one
+        void queue_unbundled_messages(
+            const Message<Id_type>& bundle, Send_options options, std::chrono::steady_clock::time_point queued_time)
+        {
+            Message_bundle<Id_type>::for_each_message(
+                {bundle.body_data(), bundle.body_size()}, [&](Id_type id, std::span<const char> body) {
+                    Message<Id_type> message;
+                    message.set_id(id);
+                    message.push_back_buffer(body.data(), body.size());
+                    queue_message(std::move(message), options, queued_time);
+                });
+        }
+
+        // @return the stream or nullptr if the stream is new and there are already MAX_LOGICAL_STREAMS streams
+        [[nodiscard]] Logical_stream* get_logical_stream(uint32_t stream_id)
+        {
+            if (const auto found_stream = m_logical_streams.find(stream_id); found_stream != m_logical_streams.end())
+                return &found_stream->second;
+
+            if (m_logical_streams.size() >= MAX_LOGICAL_STREAMS)
+                return nullptr;
+
+            return &m_logical_streams[stream_id];
+        }
+
+        // @return false if there was no queued message with the same conflation key
+        bool replace_conflated_message(Queued_message& queued, size_t message_bytes)
+        {
+            const auto found_message = m_conflated_messages.find(*queued.m_conflation_key);
+
+            if (found_message == m_conflated_messages.end())
+                return false;
+
+            // Replaced in place so the newest value is sent as soon as the stale one would have been
+            m_queued_bytes = m_queued_bytes - queued_size(found_message->second->m_message) + message_bytes;
+            found_message->second->m_message = std::move(queued.m_message);
+
+            return true;
+        }
+
+        // @return false if no queued message in the lane or the logical stream had the same id
+        bool replace_queued_message(Message_queue& queue, Queued_message& queued, size_t message_bytes)
+        {
+            const Id_type id = queued.m_message.get().get_id();
+
+            // Latest message with the id is replaced so the order of the different ids stays the same
+            const auto found_message = std::find_if(queue.rbegin(), queue.rend(), [id](const auto& other) {
+                return !is_internal(other) && other.m_message.get().get_id() == id;
+            });
+
+            if (found_message == queue.rend())
+                return false;
+
+            if (found_message->m_conflation_key)
+                m_conflated_messages.erase(*found_message->m_conflation_key);
+
+            m_queued_bytes = m_queued_bytes - queued_size(found_message->m_message) + message_bytes;
+            *found_message = std::move(queued);
+            m_dropped_message_count.fetch_add(1, std::memory_order_relaxed);
+
+            if (found_message->m_conflation_key)
+                m_conflated_messages.emplace(*found_message->m_conflation_key, &*found_message);
+
+            return true;
+        }
+
+        /**
+         *   Drops the oldest messages of the logical streams and then of the lowest lanes until the new one fits,
+         *   internal messages are kept
+         */
+        void drop_oldest_messages(size_t message_bytes)
+        {
+            bool has_dropped = false;
+
+            for (auto& [stream_id, logical_stream] : m_logical_streams)
+                has_dropped = drop_oldest_messages(logical_stream.m_queue, message_bytes) || has_dropped;
+
+            for (auto lane = m_out_queues.rbegin(); lane != m_out_queues.rend(); ++lane)
+                has_dropped = drop_oldest_messages(*lane, message_bytes) || has_dropped;
+
+            if (has_dropped)
+                find_conflated_messages();
+        }
+
+        void conflate_write_queue_on_strand()
+        {
+            bool has_dropped = false;
+
+            for (auto& [stream_id, logical_stream] : m_logical_streams)
+                has_dropped = conflate_queue(logical_stream.m_queue) || has_dropped;
+
+            for (Message_queue& lane : m_out_queues)
+                has_dropped = conflate_queue(lane) || has_dropped;
+
+            if (!has_dropped)
+                return;
+
+            find_conflated_messages();
+            m_counters.set_out_queue(m_queued_message_count, m_queued_bytes);
+
+            if (m_is_congested && m_queued_bytes <= m_write_queue_limits.m_low_bytes &&
+                m_queued_message_count <= m_write_queue_limits.m_low_messages)
+                set_congested(false);
+        }
+
+        // @return true if any message was dropped from the queue
+        bool conflate_queue(Message_queue& queue)
+        {
+            const auto is_conflated = [](const Queued_message& queued) {
+                return !is_internal(queued) && !queued.m_conflation_key;
+            };
+
+            // Messages of each id are counted first so the ones before the last are dropped in one pass
+            std::unordered_map<Id_type, size_t> id_counts;
+
+            for (const Queued_message& queued : queue)
+                if (is_conflated(queued))
+                    ++id_counts[queued.m_message.get().get_id()];
+
+            bool has_dropped = false;
+            auto queued = queue.begin();
+
+            while (queued != queue.end())
+            {
+                if (!is_conflated(*queued) || --id_counts[queued->m_message.get().get_id()] == 0)
+                {
+                    ++queued;
+                    continue;
+                }
+
+                m_queued_bytes -= queued_size(queued->m_message);
+                --m_queued_message_count;
+                queued = queue.erase(queued);
+                m_dropped_message_count.fetch_add(1, std::memory_order_relaxed);
+                has_dropped = true;
+            }
+
+            return has_dropped;
+        }
+
+        // Erasing from the middle of a queue moves the messages so their places are found again
+        void find_conflated_messages()
+        {
+            if (m_conflated_messages.empty())
+                return;
+
+            m_conflated_messages.clear();
+
+            for (Message_queue& lane : m_out_queues)
+                add_conflated_messages(lane);
+
+            for (auto& [stream_id, logical_stream] : m_logical_streams)
+                add_conflated_messages(logical_stream.m_queue);
+        }
+
+        // @return true if any message was dropped from the queue
+        bool drop_oldest_messages(Message_queue& queue, size_t message_bytes)
+        {
+            bool has_dropped = false;
+            auto queued = queue.begin();
+
+            while (queued != queue.end() && is_over_high_watermark(message_bytes))
+            {
+                if (is_internal(*queued))
+                {
+                    ++queued;
+                    continue;
+                }
+
+                m_queued_bytes -= queued_size(queued->m_message);
+                --m_queued_message_count;
+                queued = queue.erase(queued);
+                m_dropped_message_count.fetch_add(1, std::memory_order_relaxed);
+                has_dropped = true;
+            }
+
+            return has_dropped;
+        }
+
+        void add_conflated_messages(Message_queue& queue)
+        {
+            for (Queued_message& queued : queue)
+                if (queued.m_conflation_key)
+                    m_conflated_messages.emplace(*queued.m_conflation_key, &queued);
+        }
+
+        void set_congested(bool is_congested)
+        {
+            if (m_is_congested != is_congested)
+            {
+                m_is_congested = is_congested;
+                m_on_write_pressure.broadcast(get_client_information(), is_congested);
+            }
+        }
+
+        [[nodiscard]] bool has_fragment_to_write() const noexcept
+        {
+            return m_fragmented_message && m_fragment_offset < m_fragmented_message->get().body_size();
+        }
+
+        // Messages of the logical streams that are waiting for credit are not counted
+        [[nodiscard]] bool has_messages_to_write() const noexcept
+        {
+            const bool has_lane_message = std::ranges::any_of(m_out_queues, [](const auto& lane) {
+                return !lane.empty();
+            });
+
+            return has_lane_message || has_fragment_to_write() || !m_out_streams.empty() || has_stream_frame_to_write();
+        }
+
+        [[nodiscard]] bool has_stream_frame_to_write() const noexcept
+        {
+            return std::ranges::any_of(m_logical_streams, [](const auto& stream) {
+                return is_stream_ready(stream.second);
+            });
+        }
+
+        // @return true if the stream has a message and credit for its next frame, empty messages need no credit
+        [[nodiscard]] static bool is_stream_ready(const Logical_stream& logical_stream) noexcept
+        {
+            size_t remaining_bytes = 0;
+
+            if (logical_stream.m_message)
+                remaining_bytes = logical_stream.m_message->get().body_size() - logical_stream.m_offset;
+            else if (!logical_stream.m_queue.empty())
+                remaining_bytes = logical_stream.m_queue.front().m_message.get().body_size();
+            else
+                return false;
+
+            return remaining_bytes == 0 || logical_stream.m_credit > 0;
+        }
+
+        [[nodiscard]] bool has_lane_messages(Message_priority priority) const noexcept
+        {
+            return !m_out_queues[static_cast<size_t>(priority)].empty() ||
+                   (priority == Message_priority::bulk && has_fragment_to_write());
+        }
+
+        /**
+         *   Control lane is always written first. Weighted scheduling gives the other lanes turns by their weights
+         *   and starts the next round when every lane with messages has used its turn.
+         *
+         *   @return the lane that is written next or nothing if all of them are empty
+         */
+        [[nodiscard]] std::optional<Message_priority> next_priority()
+        {
+            constexpr std::array scheduled_priorities = {
+                Message_priority::realtime, Message_priority::normal, Message_priority::bulk};
+
+            if (has_lane_messages(Message_priority::control))
+                return Message_priority::control;
+
+            const bool is_weighted = m_priority_settings.m_scheduling == Priority_scheduling::weighted;
+
+            for (int round = 0; round < 2; ++round)
+            {
+                for (const Message_priority priority : scheduled_priorities)
+                    if (has_lane_messages(priority) && (!is_weighted || m_priority_turns[priority_index(priority)] > 0))
+                        return priority;
+
+                if (!is_weighted)
+                    break;
+
+                m_priority_turns[priority_index(Message_priority::realtime)] =
+                    std::max<uint32_t>(m_priority_settings.m_realtime_weight, 1);
+                m_priority_turns[priority_index(Message_priority::normal)] =
+                    std::max<uint32_t>(m_priority_settings.m_normal_weight, 1);
+                m_priority_turns[priority_index(Message_priority::bulk)] =
+                    std::max<uint32_t>(m_priority_settings.m_bulk_weight, 1);
+            }
+
+            return std::nullopt;
+        }
+
+        [[nodiscard]] static size_t priority_index(Message_priority priority) noexcept
+        {
+            return static_cast<size_t>(priority);
+        }
+
+        void use_priority_turn(Message_priority priority) noexcept
+        {
+            uint32_t& turns = m_priority_turns[priority_index(priority)];
+
+            if (turns > 0)
+                --turns;
+        }
+
+        // Starts writing message if possible otherwise does nothing
+        void start_writing_message()
+        {
+            if (has_messages_to_write() && !m_is_writing_message && m_has_done_handshake && !m_is_resuming_after_move &&
+                !m_released_handle &&
+                (m_cork_depth == 0 || m_is_flush_requested || m_is_handing_off || m_is_draining) && !hold_batch())
+            {
+                m_is_writing_message = true;
+                write_loop();
+            }
+        }
+
+        // Writes the batches until the out queue is empty
+        Detached_coroutine write_loop()
+        {
+            while (has_messages_to_write() && !is_move_waiting_for_write())
+            {
+                NET_TRACE_BEGIN("write", m_id);
+                const Write_result result = co_await Batch_write{*this};
+                NET_TRACE_END("write", m_id);
+
+                if (result.m_error)
+                {
+                    disconnect_on_strand(Notification_code::write_failed, result.m_error);
+                    co_return;
+                }
+
+                if constexpr (IS_METRICS_ENABLED)
+                    m_counters.add_sent(m_messages_being_written.size(), result.m_bytes);
+
+                NET_COUNT_ALLOCATION_MESSAGES(send, m_messages_being_written.size());
+
+                if (IS_METRICS_ENABLED && m_metrics_counters)
+                    m_metrics_counters->add_sent(m_messages_being_written.size(), result.m_bytes);
+
+                if (is_latency_timed())
+                {
+                    const auto written_time = std::chrono::steady_clock::now();
+
+                    for (const auto queued_time : m_queued_times_being_written)
+                        m_latency_histograms->m_send_to_wire.record(written_time - queued_time);
+
+                    m_queued_times_being_written.clear();
+                }
+
+                if (m_traffic_capture)
+                    capture_written_messages();
+
+                if (m_zero_copy_batch)
+                    hand_over_zero_copy_batch();
+
+                m_messages_being_written.clear();
+                m_write_buffers.clear();
+
+                // Fragmented message is kept until its last frame has been written
+                if (m_fragmented_message && !has_fragment_to_write())
+                    m_fragmented_message.reset();
+
+                for (const Stream_frame& frame : m_stream_frames)
+                    if (frame.m_stream->m_offset == frame.m_stream->m_message->get().body_size())
+                        frame.m_stream->m_message.reset();
+
+                m_stream_frames.clear();
+
+                // Flush that needs more than one batch is held in the kernel until its last write
+                if (m_is_flush_requested && !m_is_socket_corked && has_messages_to_write())
+                {
+                    m_socket->set_corked(true);
+                    m_is_socket_corked = true;
+                }
+            }
+
+            if (m_is_socket_corked)
+            {
+                m_socket->set_corked(false);
+                m_is_socket_corked = false;
+            }
+
+            m_is_flush_requested = false;
+            m_is_writing_message = false;
+            move_when_quiet();
+            hand_off_when_quiet();
+            disconnect_when_flushed();
+        }
+
+        // Averages of the time between the queued messages and their size, the recent ones weigh more
+        void measure_send_rate(size_t message_bytes)
+        {
+            constexpr double weight = 1.0 / 8.0;
+            const auto now = std::chrono::steady_clock::now();
+
+            // Gaps are capped so a long pause does not take long to forget when the messages come fast again
+            const double max_gap = 2.0 * static_cast<double>(m_adaptive_batching->m_max_delay.count());
+            m_last_send_gap = std::min(
+                std::chrono::duration<double, std::micro>(now - m_last_queued_time).count(), max_gap);
+            m_last_queued_time = now;
+
+            m_average_send_gap += (m_last_send_gap - m_average_send_gap) * weight;
+            m_average_message_bytes += (static_cast<double>(message_bytes) - m_average_message_bytes) * weight;
+        }
+
+        /**
+         *   Starts holding the queued messages or keeps holding them until the timer releases them
+         *
+         *   @return true if the messages are held and the write waits for the timer
+         */
+        bool hold_batch()
+        {
+            if (!m_adaptive_batching || m_is_flush_requested || m_is_handing_off || m_is_draining ||
+                std::exchange(m_is_batch_released, false))
+                return false;
+
+            const Adaptive_batching& batching = *m_adaptive_batching;
+            const auto max_delay = static_cast<double>(batching.m_max_delay.count());
+
+            // Batch that is full or a message that came alone is written now
+            if (m_queued_bytes >= batching.m_max_bytes || m_last_send_gap >= max_delay ||
+                m_average_send_gap >= max_delay)
+            {
+                if (m_is_batch_held)
+                {
+                    m_is_batch_held = false;
+                    ++m_batch_timer_generation;
+                    m_batch_timer->cancel();
+                }
+
+                return false;
+            }
+
+            if (m_is_batch_held)
+                return true;
+
+            // Time the rest of the batch takes to come at the measured rate
+            const double bytes_per_microsecond = m_average_message_bytes / std::max(m_average_send_gap, 1.0);
+            const double fill_time =
+                static_cast<double>(batching.m_max_bytes - m_queued_bytes) / std::max(bytes_per_microsecond, 1e-9);
+            const auto delay = std::chrono::microseconds(static_cast<int64_t>(std::min(fill_time, max_delay)));
+
+            if (delay.count() <= 0)
+                return false;
+
+            if (!m_batch_timer)
+                m_batch_timer.emplace(m_socket->get_executor());
+
+            m_is_batch_held = true;
+            m_batch_timer->expires_after(delay);
+            m_batch_timer->async_wait(
+                [weak_self = this->weak_from_this(), generation = m_batch_timer_generation](asio::error_code error) {
+                    const auto self = weak_self.lock();
+
+                    if (error || self == nullptr)
+                        return;
+
+                    // Timer may run on the strand the socket moved away from
+                    self->dispatch_on_strand([self, generation] { self->release_batch(generation); });
+                });
+
+            return true;
+        }
+
+        void release_batch(uint64_t generation)
+        {
+            if (generation != m_batch_timer_generation || !m_is_batch_held)
+                return;
+
+            m_is_batch_held = false;
+            ++m_batch_timer_generation;
+            m_is_batch_released = true;
+            start_writing_message();
+        }
+
+        // Disconnects the draining connection when nothing is left to write
+        void disconnect_when_flushed()
+        {
+            if (m_is_draining && !m_is_writing_message && !has_messages_to_write())
+                disconnect_on_strand(std::nullopt);
+        }
+
+        /**
+         *   Moves the next batch of messages from the lanes of the out queue and writes them with one gather write.
+         *   Batch has atmost one frame of a fragmented bulk message so the other lanes are written between them,
+         *   and atmost one frame of each logical stream.
+         */
+        void write_out_messages()
+        {
+            size_t batch_bytes = 0;
+            bool has_fragment = false;
+
+            if (m_heartbeat_settings.m_write_timeout)
+                m_write_start_time = std::chrono::steady_clock::now();
+
+            while (m_messages_being_written.size() < m_write_batch_limits.m_max_messages)
+            {
+                const std::optional<Message_priority> priority = next_priority();
+
+                if (!priority)
+                    break;
+
+                Message_queue& lane = get_lane(*priority);
+
+                if (*priority == Message_priority::bulk &&
+                    (has_fragment_to_write() || lane.front().m_message.get().body_size() > m_bulk_frame_size))
+                {
+                    const size_t fragment_bytes = sizeof(Message_header<Id_type>) + m_bulk_frame_size;
+
+                    if (!m_messages_being_written.empty() &&
+                        batch_bytes + fragment_bytes > m_write_batch_limits.m_max_bytes)
+                        break;
+
+                    if (!has_fragment_to_write())
+                        start_fragmenting(lane);
+
+                    use_priority_turn(*priority);
+                    has_fragment = true;
+                    break;
+                }
+
+                Queued_message& next_message = lane.front();
+                const size_t message_bytes = queued_size(next_message.m_message);
+
+                if (!m_messages_being_written.empty() && batch_bytes + message_bytes > m_write_batch_limits.m_max_bytes)
+                    break;
+
+                if (next_message.m_conflation_key)
+                    m_conflated_messages.erase(*next_message.m_conflation_key);
+
+                use_priority_turn(*priority);
+                batch_bytes += message_bytes;
+                m_queued_bytes -= message_bytes;
+                --m_queued_message_count;
+                m_messages_being_written.push_back(std::move(next_message.m_message));
+
+                // Internal messages are not sent by the user and have no time
+                if (is_latency_timed() && next_message.m_queued_time != std::chrono::steady_clock::time_point())
+                    m_queued_times_being_written.push_back(next_message.m_queued_time);
+
+                lane.pop_front();
+            }
+
+            select_stream_frames(batch_bytes, m_messages_being_written.size() + (has_fragment ? 1 : 0));
+
+            if (m_is_congested && m_queued_bytes <= m_write_queue_limits.m_low_bytes &&
+                m_queued_message_count <= m_write_queue_limits.m_low_messages)
+                set_congested(false);
+
+            m_counters.set_out_queue(m_queued_message_count, m_queued_bytes);
+
+            // One chunk for each batch so the stream can't block the other messages
+            const size_t batch_messages =
+                m_messages_being_written.size() + (has_fragment ? 1 : 0) + m_stream_frames.size();
+            const bool has_room_for_chunk =
+                !m_out_streams.empty() && batch_messages < m_write_batch_limits.m_max_messages;
+            const Header_format write_format = m_write_header_format;
+            const bool is_compact = write_format != Header_format::standard;
+
+            // Checksum needs the data in memory so checked chunks are read from the file
+            const bool is_writing_file = has_room_for_chunk && write_format != Header_format::checked &&
+                                         can_write_file_directly(m_out_streams.front());
+
+            if (has_room_for_chunk && !is_writing_file)
+                m_messages_being_written.push_back(read_stream_chunk());
+
+            const size_t batch_size = m_messages_being_written.size();
+
+            const Compression_codec compression_codec = m_write_compression_codec;
+            const Compression_mode compression_mode = m_write_compression_mode;
+
+            if (is_compact || compression_codec != Compression_codec::none)
+                m_write_header_bytes.resize(batch_size * HEADER_BUFFER_SIZE);
+
+            if (m_compressed_bodies.size() < batch_size)
+                m_compressed_bodies.resize(batch_size);
+
+            // Stream compression already refers to the earlier bodies
+            const bool can_delta_encode = m_delta_encoded_messages != nullptr &&
+                                          compression_codec != Compression_codec::none &&
+                                          compression_mode == Compression_mode::per_message &&
+                                          get_agreed_capabilities().has(Capability::delta_encoding);
+
+            // Buffers are created only after the batch is complete so the vector will not reallocate under them
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                const Outgoing_message<Id_type>& outgoing_message = m_messages_being_written[i];
+                const Message<Id_type>& message = outgoing_message.get();
+                const std::span<const char> prepared_header = outgoing_message.prepared_header_bytes(write_format);
+                char* header_bytes = m_write_header_bytes.data() + i * HEADER_BUFFER_SIZE;
+
+                if (const Patched_message<Id_type>* patched = outgoing_message.get_patched())
+                {
+                    write_patched_message(*patched, write_format, header_bytes);
+                    continue;
+                }
+
+                std::span<const char> body(message.body_data(), message.body_size());
+
+                const bool is_user_message = message.get_internal_id() == Internal_id::not_internal;
+                // Compressed body can be larger than the original, it must still fit to the size of the header
+                const bool is_compressible =
+                    (is_user_message || message.get_internal_id() == Internal_id::message_bundle) &&
+                    Compression::PREFIX_SIZE + Compression::compress_bound(compression_codec, body.size()) <=
+                        std::numeric_limits<Header_size_type>::max();
+                Body_encoding body_encoding = Body_encoding::raw;
+
+                if (is_user_message && can_delta_encode && m_delta_encoded_messages->contains(message.get_id()))
+                    body_encoding = compress_delta(compression_codec, message.get_id(), body, m_compressed_bodies[i]);
+
+                if (is_compressible && body_encoding == Body_encoding::raw)
+                    body_encoding = compress_body(compression_codec, compression_mode, body, m_compressed_bodies[i]);
+
+                if (body_encoding != Body_encoding::raw)
+                {
+                    // Compressed message has its own header so the prepared header can't be used
+                    Message_header<Id_type> header = message.get_header();
+                    header.m_size = static_cast<Header_size_type>(m_compressed_bodies[i].size());
+                    header.m_body_encoding = body_encoding;
+                    body = m_compressed_bodies[i];
+
+                    const size_t header_size = encode_wire_header(header, write_format, header_bytes, {body});
+                    m_write_buffers.push_back(asio::buffer(header_bytes, header_size));
+                }
+                else if (!prepared_header.empty())
+                    m_write_buffers.push_back(asio::buffer(prepared_header.data(), prepared_header.size()));
+
+                else if (is_compact)
+                {
+                    const size_t header_size =
+                        encode_wire_header(message.get_header(), write_format, header_bytes, {body});
+                    m_write_buffers.push_back(asio::buffer(header_bytes, header_size));
+                }
+                else
+                    m_write_buffers.push_back(asio::buffer(message.header_data(), message.header_size()));
+
+                if (!body.empty())
+                    m_write_buffers.push_back(asio::buffer(body.data(), body.size()));
+            }
+
+            if (has_fragment)
+                write_fragment(write_format);
+
+            for (Stream_frame& frame : m_stream_frames)
+                write_frame(frame.m_stream->m_message->get(), frame.m_offset, frame.m_size, frame.m_stream_id,
+                            frame.m_fragment, frame.m_header, write_format);
+
+            if (is_writing_file)
+                write_file_chunk(write_format);
+            else if (can_write_zero_copy(has_fragment))
+            {
+                m_zero_copy_batch = std::make_shared<Zero_copy_batch>();
+                m_socket->async_write_zero_copy(m_write_buffers, m_zero_copy_batch);
+            }
+            else
+                m_socket->async_write(m_write_buffers);
+        }
+
+        /**
+         *   Zero copy is used only for the batches of whole messages because the frames of the fragments and the
+         *   streams point to the memory that is reused for the next frames
+         */
+        [[nodiscard]] bool can_write_zero_copy(bool has_fragment) const
+        {
+            if (!m_zero_copy_threshold || has_fragment || !m_stream_frames.empty() || !m_socket->can_write_zero_copy())
+                return false;
+
+            size_t batch_bytes = 0;
+
+            for (const asio::const_buffer& buffer : m_write_buffers)
+                batch_bytes += buffer.size();
+
+            return batch_bytes >= *m_zero_copy_threshold;
+        }
+
+        // Stream chunks are captured as the messages they were sent in, not as the frames of the file
+        void capture_written_messages()
+        {
+            for (const Outgoing_message<Id_type>& outgoing_message : m_messages_being_written)
+            {
+                const Patched_message<Id_type>* patched = outgoing_message.get_patched();
+                const Message<Id_type> patched_message = patched ? patched->to_message() : Message<Id_type>();
+                const Message<Id_type>& message = patched ? patched_message : outgoing_message.get();
+                m_traffic_capture->capture(
+                    Capture_direction::sent, m_id,
+                    {reinterpret_cast<const char*>(message.header_data()), message.header_size()},
+                    {reinterpret_cast<const char*>(message.body_data()), message.body_size()});
+            }
+        }
+
+        /**
+         *   Moves the memory of the written batch to the batch the socket holds until the kernel has sent it.
+         *   Moving the vectors keeps their memory in place so the buffers the kernel reads stay valid, the
+         *   connection allocates new ones for the next batches.
+         */
+        void hand_over_zero_copy_batch()
+        {
+            m_zero_copy_batch->m_messages = std::move(m_messages_being_written);
+            m_zero_copy_batch->m_header_bytes = std::move(m_write_header_bytes);
+            m_zero_copy_batch->m_compressed_bodies = std::move(m_compressed_bodies);
+            m_zero_copy_batch.reset();
+
+            m_messages_being_written.clear();
+            m_write_header_bytes.clear();
+            m_compressed_bodies.clear();
+        }
+
+        /**
+         *   Writes the shared pieces of the template body with the fields of this connection between them
+         *
+         *   @param the message in the batch, the buffers view its patch
+         *   @param the format to write the header in
+         *   @param buffer with atleast HEADER_BUFFER_SIZE bytes for the checked header
+         */
+        void write_patched_message(const Patched_message<Id_type>& message, Header_format write_format, char* output)
+        {
+            const Message_template<Id_type>& message_template = message.get_template();
+
+            if (write_format == Header_format::checked)
+            {
+                const size_t header_size = message_template.encode_checked_header(message.get_patch(), output);
+                m_write_buffers.push_back(asio::buffer(output, header_size));
+            }
+            else
+            {
+                const std::span<const char> header = message_template.header_bytes(write_format);
+                m_write_buffers.push_back(asio::buffer(header.data(), header.size()));
+            }
+
+            message_template.for_each_piece(message.get_patch(), [this](std::span<const char> piece) {
+                m_write_buffers.push_back(asio::buffer(piece.data(), piece.size()));
+            });
+        }
+
+        [[nodiscard]] bool can_write_file_directly(const Outgoing_stream& stream) const
+        {
+            return stream.m_file != nullptr && stream.m_file_remaining > 0 && m_socket->can_write_file();
+        }
+
+        // Writes the headers of the chunk after the other buffers and lets the socket send the data from the file
+        void write_file_chunk(Header_format write_format)
+        {
+            Outgoing_stream& stream = m_out_streams.front();
+            const bool is_first = stream.m_is_first;
+
+            if (is_first)
+                stream.m_stream_id = m_next_stream_id++;
+
+            const size_t data_size =
+                static_cast<size_t>(std::min<uint64_t>(stream.m_file_remaining, Stream_chunk<Id_type>::MAX_DATA_SIZE));
+
+            m_file_chunk = Stream_chunk<Id_type>::create_message(stream.m_id, stream.m_stream_id, is_first, false, {});
+
+            // Header tells the size with the data that is sent from the file
+            Message_header<Id_type> header = m_file_chunk.get_header();
+            header.m_size += data_size;
+
+            // Files are never written directly with the checked format so the header needs no checksum
+            const size_t header_size = encode_wire_header(header, write_format, m_file_chunk_header.data(), {});
+            m_write_buffers.push_back(asio::buffer(m_file_chunk_header.data(), header_size));
+            m_write_buffers.push_back(asio::buffer(m_file_chunk.body_data(), m_file_chunk.body_size()));
+
+            const uint64_t file_offset = stream.m_file_offset;
+            stream.m_file_offset += data_size;
+            stream.m_file_remaining -= data_size;
+            stream.m_is_first = false;
+
+            m_socket->async_write_file(m_write_buffers, stream.m_file, file_offset, data_size);
+        }
+
+        // Removes the first message from the queue to be sent in frames
+        Outgoing_message<Id_type> take_queued_message(Message_queue& queue)
+        {
+            Queued_message& queued = queue.front();
+
+            if (queued.m_conflation_key)
+                m_conflated_messages.erase(*queued.m_conflation_key);
+
+            m_queued_bytes -= queued_size(queued.m_message);
+            --m_queued_message_count;
+            Outgoing_message<Id_type> message = std::move(queued.m_message);
+            queue.pop_front();
+
+            return message;
+        }
+
+        // Moves the first bulk message from the lane to be sent in frames
+        void start_fragmenting(Message_queue& lane)
+        {
+            m_fragmented_message = take_queued_message(lane);
+            m_fragmented_message->flatten_patch();
+            m_fragment_offset = 0;
+        }
+
+        // Writes the next frame of the fragmented bulk message
+        void write_fragment(Header_format write_format)
+        {
+            const Message<Id_type>& message = m_fragmented_message->get();
+            const size_t data_size = std::min(message.body_size() - m_fragment_offset, m_bulk_frame_size);
+
+            write_frame(message, m_fragment_offset, data_size, 0, m_fragment, m_fragment_header, write_format);
+            m_fragment_offset += data_size;
+        }
+
+        /**
+         *   Takes one frame from each logical stream that is ready, starting after the stream that was written last
+         *   so the streams get their turns. Atleast one frame is taken so the lanes can't starve the streams.
+         *
+         *   @param bytes and messages that are already in the batch
+         */
+        void select_stream_frames(size_t batch_bytes, size_t batch_messages)
+        {
+            auto stream = m_logical_streams.upper_bound(m_last_stream_id);
+
+            for (size_t i = 0; i < m_logical_streams.size(); ++i, ++stream)
+            {
+                if (stream == m_logical_streams.end())
+                    stream = m_logical_streams.begin();
+
+                Logical_stream& logical_stream = stream->second;
+
+                if (!is_stream_ready(logical_stream))
+                    continue;
+
+                const size_t frame_bytes =
+                    sizeof(Message_header<Id_type>) + Message_fragment<Id_type>::HEADER_SIZE + m_bulk_frame_size;
+
+                if (!m_stream_frames.empty() &&
+                    (batch_messages + m_stream_frames.size() >= m_write_batch_limits.m_max_messages ||
+                     batch_bytes + frame_bytes > m_write_batch_limits.m_max_bytes))
+                    break;
+
+                if (!logical_stream.m_message)
+                {
+                    logical_stream.m_message = take_queued_message(logical_stream.m_queue);
+                    logical_stream.m_offset = 0;
+                }
+
+                const size_t remaining_bytes = logical_stream.m_message->get().body_size() - logical_stream.m_offset;
+                const size_t data_size = std::min({remaining_bytes, m_bulk_frame_size, logical_stream.m_credit});
+
+                m_stream_frames.push_back(
+                    {.m_stream = &logical_stream,
+                     .m_stream_id = stream->first,
+                     .m_offset = logical_stream.m_offset,
+                     .m_size = data_size});
+
+                logical_stream.m_offset += data_size;
+                logical_stream.m_credit -= data_size;
+                batch_bytes += frame_bytes;
+                m_last_stream_id = stream->first;
+            }
+        }
+
+        /**
+         *   Writes the header and the body of the fragment and its data straight from the message
+         *
+         *   @param the message that is sent in frames and the part of its body in this frame
+         *   @param the logical stream of the message
+         *   @param fragment and the header buffer that are kept until the write has finished
+         */
+        void write_frame(
+            const Message<Id_type>& message, size_t offset, size_t data_size, uint32_t stream_id,
+            Message<Id_type>& fragment, std::span<char> header_buffer, Header_format write_format)
+        {
+            fragment = Message_fragment<Id_type>::create_message(message.get_id(), message.body_size(), stream_id);
+
+            // Header tells the size with the data that is written from the message
+            Message_header<Id_type> header = fragment.get_header();
+            header.m_size += data_size;
+
+            const std::span<const char> fragment_body(fragment.body_data(), fragment.body_size());
+            const std::span<const char> data(message.body_data() + offset, data_size);
+
+            const size_t header_size =
+                encode_wire_header(header, write_format, header_buffer.data(), {fragment_body, data});
+            m_write_buffers.push_back(asio::buffer(header_buffer.data(), header_size));
+            m_write_buffers.push_back(asio::buffer(fragment_body.data(), fragment_body.size()));
+
+            if (!data.empty())
+                m_write_buffers.push_back(asio::buffer(data.data(), data.size()));
+        }
+
+        // Reads the next chunk from the first stream and removes the stream after its last chunk
+        Message<Id_type> read_stream_chunk()
+        {
+            Outgoing_stream& stream = m_out_streams.front();
+            const bool is_first = stream.m_is_first;
+
+            if (is_first)
+                stream.m_stream_id = m_next_stream_id++;
+
+            m_stream_buffer.resize(Stream_chunk<Id_type>::MAX_DATA_SIZE);
+            const size_t data_size = stream.m_file != nullptr
+                                         ? read_file_part(stream)
+                                         : std::min(stream.m_source(m_stream_buffer), m_stream_buffer.size());
+
+            // Empty read ends the stream so the last chunk is always empty
+            const bool is_last = data_size == 0;
+
+            Message<Id_type> chunk = Stream_chunk<Id_type>::create_message(
+                stream.m_id, stream.m_stream_id, is_first, is_last, {m_stream_buffer.data(), data_size});
+
+            stream.m_is_first = false;
+
+            if (is_last)
+                m_out_streams.pop_front();
+
+            return chunk;
+        }
+
+        // Reads the next part of the file stream to the stream buffer
+        size_t read_file_part(Outgoing_stream& stream)
+        {
+            const size_t size =
+                static_cast<size_t>(std::min<uint64_t>(stream.m_file_remaining, m_stream_buffer.size()));
+
+            if (size == 0)
+                return 0;
+
+            const size_t bytes_read = stream.m_file->read(stream.m_file_offset, {m_stream_buffer.data(), size});
+
+            // File became shorter after it was opened so the stream ends early
+            if (bytes_read == 0)
+            {
+                notify(Notification_code::file_ended_early, Severity::error);
+                stream.m_file_remaining = 0;
+                return 0;
+            }
+
+            stream.m_file_offset += bytes_read;
+            stream.m_file_remaining -= bytes_read;
+            return bytes_read;
+        }
+
+        /**
+         *   @param the codec agreed with the peer
+         *   @param the mode agreed with the peer
+         *   @param the body to compress
+         *   @param where the compressed body is written
+         *   @return how the body should be sent, raw if it was not compressed
+         */
+        Body_encoding compress_body(
+            Compression_codec codec, Compression_mode mode, std::span<const char> body, std::vector<char>& output)
+        {
+            if (codec == Compression_codec::none)
+                return Body_encoding::raw;
+
+            if (mode == Compression_mode::per_message)
+            {
+                Compression_settings settings = m_compression_settings;
+                settings.m_codec = codec;
+
+                return Compression::compress(settings, body, output) ? Body_encoding::compressed : Body_encoding::raw;
+            }
+
+            if (body.size() < m_compression_settings.m_min_size)
+                return Body_encoding::raw;
+
+            if (m_stream_compressor == nullptr)
+            {
+                Compression_settings settings = m_compression_settings;
+                settings.m_codec = codec;
+                m_stream_compressor = std::make_unique<Stream_compressor>(settings);
+            }
+
+            return m_stream_compressor->compress(body, output) ? Body_encoding::compressed_stream : Body_encoding::raw;
+        }
+
+        /**
+         *   Compresses the xor of the body and the previous delta encoded body of the id, so the bytes that did
+         *   not change compress to almost nothing. The previous body is replaced only when this was compressed
+         *   because the peer replaces its own only with the compressed_delta messages.
+         *
+         *   @param the codec agreed with the peer
+         *   @param the id of the message
+         *   @param the body to compress
+         *   @param where the compressed body is written
+         *   @return compressed_delta or raw if the xor did not compress
+         */
+        Body_encoding compress_delta(
+            Compression_codec codec, Id_type id, std::span<const char> body, std::vector<char>& output)
+        {
+            Compression_settings settings = m_compression_settings;
+            settings.m_codec = codec;
+
+            if (body.size() < settings.m_min_size)
+                return Body_encoding::raw;
+
+            std::vector<char>& previous_body = m_write_delta_bases[id];
+            m_delta_buffer.assign(body.begin(), body.end());
+            xor_previous_body(m_delta_buffer, previous_body);
+
+            if (!Compression::compress(settings, m_delta_buffer, output))
+                return Body_encoding::raw;
+
+            previous_body.assign(body.begin(), body.end());
+            return Body_encoding::compressed_delta;
+        }
+
+        // Xors the data with the start of the previous body, the rest of the longer one is left as it is
+        static void xor_previous_body(std::span<char> data, std::span<const char> previous_body) noexcept
+        {
+            const size_t size = std::min(data.size(), previous_body.size());
+
+            for (size_t i = 0; i < size; ++i)
+                data[i] = static_cast<char>(data[i] ^ previous_body[i]);
+        }
+
+        /**
+         *   @param the header to encode
+         *   @param the format to encode in
+         *   @param buffer with atleast HEADER_BUFFER_SIZE bytes
+         *   @param the parts of the body in the order they are written, used for the checksum of the checked format
+         *   @return number of bytes written
+         */
+        static size_t encode_wire_header(
+            const Message_header<Id_type>& header, Header_format format, char* output,
+            std::initializer_list<std::span<const char>> body_parts)
+        {
+            if (format != Header_format::standard)
+                return Compact_header<Id_type>::encode(header, output, format == Header_format::checked, body_parts);
+
+            std::memcpy(output, &header, sizeof(header));
+            return sizeof(header);
+        }
+
+        // Event when writing the batch of messages is finished, continues the write loop
+        void async_write_finished(asio::error_code error, size_t bytes)
+        {
+            NET_ALLOCATION_SCOPE(send);
+            m_write_result = {.m_error = error, .m_bytes = bytes};
+
+            if (m_write_coroutine)
+                std::exchange(m_write_coroutine, nullptr).resume();
+        }
+
+        /**
+         *   Triggers on_message callback on current reveived_message
+         *
+         *   @return false if the message could not be decompressed and the connection was disconnected or if the
+         *           user could not take the message and the reading was paused
+         */
+        bool on_message_received()
+        {
+            const bool is_compressed = m_received_message.get_header().m_body_encoding != Body_encoding::raw;
+
+            if (is_compressed && !decompress_received_message())
+            {
+                disconnect_on_strand(Notification_code::invalid_compressed_message);
+                return false;
+            }
+
+            // Captured after the decompression so the received and the sent messages are captured alike
+            if (m_traffic_capture)
+            {
+                m_traffic_capture->capture(
+                    Capture_direction::received, m_id,
+                    {reinterpret_cast<const char*>(m_received_message.header_data()), m_received_message.header_size()},
+                    {reinterpret_cast<const char*>(m_received_message.body_data()), m_received_message.body_size()});
+            }
+
+            if (m_received_message.get_internal_id() == Internal_id::stream_chunk && !track_received_stream())
+            {
+                disconnect_on_strand(Notification_code::invalid_stream_chunk);
+                return false;
+            }
+
+            m_has_read_since_heartbeat = true;
+
+            if (m_received_message.get_internal_id() == Internal_id::message_fragment)
+            {
+                bool is_complete = false;
+
+                if (!assemble_fragment(is_complete))
+                {
+                    disconnect_on_strand(Notification_code::invalid_message_fragment);
+                    return false;
+                }
+
+                // Rest of the body comes in the next fragments
+                if (!is_complete)
+                {
+                    m_received_message = Message<Id_type>();
+                    return true;
+                }
+            }
+
+            if (m_received_message.get_internal_id() == Internal_id::stream_window)
+            {
+                if (!add_stream_credit())
+                {
+                    disconnect_on_strand(Notification_code::invalid_message_fragment);
+                    return false;
+                }
+
+                m_received_message = Message<Id_type>();
+                return true;
+            }
+
+            // Heartbeats are answered here so they are not delayed by the user handling the messages
+            if (m_received_message.get_internal_id() == Internal_id::ping ||
+                m_received_message.get_internal_id() == Internal_id::pong)
+            {
+                handle_heartbeat_message();
+                m_received_message = Message<Id_type>();
+                return true;
+            }
+
+            NET_COUNT_ALLOCATION_MESSAGES(read, 1);
+
+            if constexpr (IS_METRICS_ENABLED)
+            {
+                const size_t received_bytes = m_received_message.header_size() + m_received_message.body_size();
+                m_counters.add_received(received_bytes);
+
+                if (m_metrics_counters)
+                {
+                    const bool is_internal_message =
+                        m_received_message.get_internal_id() != Internal_id::not_internal;
+                    m_metrics_counters->add_received(
+                        received_bytes,
+                        is_internal_message ? std::nullopt : std::optional(m_received_message.get_id()));
+                }
+            }
+
+            // Server tells the resuming client from this how many of its messages arrived, the bundle was sent as one
+            if (m_received_message.get_internal_id() == Internal_id::not_internal ||
+                m_received_message.get_internal_id() == Internal_id::message_bundle)
+                m_counters.add_received_user_message();
+
+            if (m_received_message.get_internal_id() == Internal_id::message_bundle)
+                return on_bundle_received();
+
+            auto owned_message = Owned_message<Id_type>(std::move(m_received_message), get_client_information());
+            m_received_message = Message<Id_type>();
+
+            if (is_latency_timed())
+            {
+                owned_message.m_received_time = std::chrono::steady_clock::now();
+
+                if (const auto wire_time = m_socket->get_receive_time())
+                    owned_message.m_wire_time = *wire_time;
+            }
+
+            return deliver_message(owned_message);
+        }
+
+        // @return false if the bundle was not valid or the user could not take all of its messages
+        bool on_bundle_received()
+        {
+            const Message<Id_type> bundle = std::move(m_received_message);
+            m_received_message = Message<Id_type>();
+
+            const Client_information client_information = get_client_information();
+            std::chrono::steady_clock::time_point received_time = {};
+            std::chrono::system_clock::time_point wire_time = {};
+
+            if (is_latency_timed())
+            {
+                received_time = std::chrono::steady_clock::now();
+                wire_time = m_socket->get_receive_time().value_or(wire_time);
+            }
+
+            bool are_messages_valid = true;
+
+            const bool is_valid = Message_bundle<Id_type>::for_each_message(
+                {bundle.body_data(), bundle.body_size()}, [&](Id_type id, std::span<const char> body) {
+                    // Each message must pass the same checks as if it was sent alone
+                    are_messages_valid = are_messages_valid &&
+                                         body.size() <= std::numeric_limits<Header_size_type>::max() &&
+                                         validate_header(Message_header<Id_type>{
+                                             .m_id = id, .m_size = static_cast<Header_size_type>(body.size())});
+
+                    if (!are_messages_valid)
+                        return;
+
+                    Message<Id_type> message;
+                    message.set_id(id);
+                    message.push_back_buffer(body.data(), body.size());
+
+                    Owned_message<Id_type>& owned_message =
+                        m_unbundled_messages.emplace_back(std::move(message), client_information);
+                    owned_message.m_received_time = received_time;
+                    owned_message.m_wire_time = wire_time;
+                });
+
+            if (!is_valid || !are_messages_valid)
+            {
+                m_unbundled_messages.clear();
+                disconnect_on_strand(Notification_code::invalid_message_bundle);
+                return false;
+            }
+
+            return deliver_unbundled_messages();
+        }
+
+        // @return false if the user could not take a message, the rest wait for the held message to be taken
+        bool deliver_unbundled_messages()
+        {
+            while (!m_unbundled_messages.empty())
+            {
+                Owned_message<Id_type> owned_message = std::move(m_unbundled_messages.front());
+                m_unbundled_messages.pop_front();
+
+                if (!deliver_message(owned_message))
+                    return false;
+            }
+
+            return true;
+        }
+
+        // @return false if the user could not take the message, it is held and the reading is paused then
+        bool deliver_message(Owned_message<Id_type>& owned_message)
+        {
+            // Paused bulk connection is resumed with the other paused connections
+            bool is_taken = !is_bulk_paused() && !m_is_reading_held;
+
+            // Messages of one read are handed over together, a full batch is handed over before parsing on
+            if (is_taken && m_is_batching_deliveries)
+            {
+                m_delivery_batch.push_back(std::move(owned_message));
+                return m_delivery_batch.size() < DELIVERY_BATCH_SIZE || deliver_message_batch();
+            }
+
+            const size_t unbundled_count = m_unbundled_messages.size();
+
+            // Message stays after the batched ones that were not taken
+            if (!deliver_message_batch())
+            {
+                m_unbundled_messages.insert(
+                    m_unbundled_messages.begin() + (m_unbundled_messages.size() - unbundled_count),
+                    std::move(owned_message));
+                return false;
+            }
+
+            if (is_taken)
+                m_on_message.broadcast(owned_message, is_taken);
+
+            if (is_taken)
+                return true;
+
+            m_held_message = std::move(owned_message);
+            m_is_read_paused = true;
+
+            // Held reading continues with the set_reading_held
+            if (!m_is_reading_held)
+                m_on_read_paused.broadcast(this->weak_from_this());
+
+            return false;
+        }
+
+        /**
+         *   Hands the batched messages to the user with one call, the first one it did not take is held and the
+         *   rest are put before the unbundled messages
+         *
+         *   @return false if the user did not take all of them and the reading was paused
+         */
+        bool deliver_message_batch()
+        {
+            if (m_delivery_batch.empty())
+                return true;
+
+            size_t taken_count = 0;
+            m_on_messages.broadcast(std::span(m_delivery_batch), taken_count);
+
+            if (taken_count < m_delivery_batch.size())
+            {
+                m_held_message = std::move(m_delivery_batch[taken_count]);
+                m_unbundled_messages.insert(
+                    m_unbundled_messages.begin(), std::make_move_iterator(m_delivery_batch.begin() + taken_count + 1),
+                    std::make_move_iterator(m_delivery_batch.end()));
+            }
+
+            m_delivery_batch.clear();
+
+            if (!m_held_message)
+                return true;
+
+            m_is_read_paused = true;
+
+            if (!m_is_reading_held)
+                m_on_read_paused.broadcast(this->weak_from_this());
+
+            return false;
+        }
+
+        // @return true if the latencies of the messages are recorded, never when the metrics are compiled out
+        [[nodiscard]] bool is_latency_timed() const noexcept
+        {
+            return IS_METRICS_ENABLED && m_latency_histograms != nullptr;
+        }
+
+        [[nodiscard]] bool is_bulk_paused() const noexcept
+        {
+            return m_is_bulk.load(std::memory_order_relaxed) && m_bulk_pause_flag &&
+                   m_bulk_pause_flag->load(std::memory_order_relaxed);
+        }
+
+        void resume_reading_on_strand()
+        {
+            if (!m_held_message || !is_connected())
+                return;
+
+            m_is_read_paused = false;
+
+            Owned_message<Id_type> held_message = std::move(*m_held_message);
+            m_held_message.reset();
+
+            if (deliver_message(held_message) && deliver_unbundled_messages())
+                continue_reading();
+        }
+
+        // Reads the next message after the received one has been handled
+        void continue_reading()
+        {
+            if (m_read_mode == Read_mode::exact)
+                read_header();
+            else if (parse_receive_buffer() && !m_is_read_paused)
+                read_some_to_receive_buffer();
+        }
+
+        /**
+         *   Adds the data of the received fragment to the message being put together in its logical stream.
+         *   The received message is replaced with the whole message after its last fragment.
+         *
+         *   @param set to true when the fragment was the last one of its message
+         *   @return false if the fragment does not continue the message, the message is not valid or the stream
+         *   has sent more than its window
+         */
+        bool assemble_fragment(bool& is_complete)
+        {
+            const uint64_t total_size = Message_fragment<Id_type>::read_total_size(m_received_message.body_data());
+            const uint32_t stream_id = Message_fragment<Id_type>::read_stream_id(m_received_message.body_data());
+            const std::span<const char> data = Message_fragment<Id_type>::data(m_received_message);
+
+            auto found_assembly = m_fragment_assemblies.find(stream_id);
+
+            if (found_assembly == m_fragment_assemblies.end())
+            {
+                // Bulk lane uses the stream 0 in addition to the logical streams
+                if (m_fragment_assemblies.size() > MAX_LOGICAL_STREAMS)
+                    return false;
+
+                found_assembly = m_fragment_assemblies.emplace(stream_id, Fragment_assembly()).first;
+            }
+
+            Fragment_assembly& assembly = found_assembly->second;
+
+            if (stream_id != 0 && data.size() > STREAM_WINDOW_SIZE - assembly.m_ungranted_bytes)
+                return false;
+
+            if (!assembly.m_size.has_value())
+            {
+                // Whole message is validated before its body is allocated
+                if ((total_size == 0 && stream_id == 0) || total_size > std::numeric_limits<size_t>::max() ||
+                    total_size > std::numeric_limits<Header_size_type>::max())
+                    return false;
+
+                Message_header<Id_type> header;
+                header.m_id = m_received_message.get_id();
+                header.m_size = static_cast<Header_size_type>(total_size);
+
+                // Only the logical streams send the empty messages in a fragment
+                if (!validate_header(header))
+                    return false;
+
+                assembly.m_message = Message<Id_type>();
+                assembly.m_message.set_id(header.m_id);
+                assembly.m_message.reserve(static_cast<size_t>(total_size));
+                assembly.m_size = total_size;
+            }
+            else if (m_received_message.get_id() != assembly.m_message.get_id() || total_size != *assembly.m_size)
+                return false;
+
+            if (data.size() > *assembly.m_size - assembly.m_message.body_size())
+                return false;
+
+            assembly.m_message.push_back_buffer(data.data(), data.size());
+
+            if (stream_id != 0)
+                grant_stream_credit(stream_id, assembly, data.size());
+
+            is_complete = assembly.m_message.body_size() == *assembly.m_size;
+
+            if (is_complete)
+            {
+                m_received_message = std::move(assembly.m_message);
+                assembly.m_message = Message<Id_type>();
+                assembly.m_size.reset();
+            }
+
+            return true;
+        }
+
+        // Gives the received bytes back to the sender of the logical stream after a quarter of its window
+        void grant_stream_credit(uint32_t stream_id, Fragment_assembly& assembly, size_t received_bytes)
+        {
+            assembly.m_ungranted_bytes += received_bytes;
+
+            if (assembly.m_ungranted_bytes < STREAM_WINDOW_SIZE / 4)
+                return;
+
+            Message<Id_type> window;
+            window.set_internal_id(Internal_id::stream_window);
+            window << stream_id << static_cast<uint64_t>(assembly.m_ungranted_bytes);
+            assembly.m_ungranted_bytes = 0;
+
+            queue_message(std::move(window));
+        }
+
+        /**
+         *   Adds the credit that the peer granted to the logical stream and writes the frames waiting for it
+         *
+         *   @return false if the stream is not known or the credit would be larger than the window
+         */
+        bool add_stream_credit()
+        {
+            uint32_t stream_id = 0;
+            uint64_t granted_bytes = 0;
+            m_received_message >> granted_bytes >> stream_id;
+
+            const auto found_stream = m_logical_streams.find(stream_id);
+
+            if (found_stream == m_logical_streams.end() ||
+                granted_bytes > STREAM_WINDOW_SIZE - found_stream->second.m_credit)
+                return false;
+
+            found_stream->second.m_credit += static_cast<size_t>(granted_bytes);
+            start_writing_message();
+
+            return true;
+        }
+
+        // Answers the ping with a pong that has the same time or measures the round trip time from the pong
+        void handle_heartbeat_message()
+        {
+            uint64_t ping_time = 0;
+            m_received_message >> ping_time;
+
+            if (m_received_message.get_internal_id() == Internal_id::ping)
+            {
+                Message<Id_type> pong;
+                pong.set_internal_id(Internal_id::pong);
+                pong << ping_time;
+
+                queue_message(std::move(pong));
+            }
+            else
+            {
+                const int64_t round_trip_time = get_heartbeat_time() - static_cast<int64_t>(ping_time);
+                m_round_trip_time.store(std::max<int64_t>(round_trip_time, 0), std::memory_order_relaxed);
+            }
+        }
+
+        // @return microseconds of the steady clock, pings carry it so the pong tells when its ping was sent
+        [[nodiscard]] static int64_t get_heartbeat_time() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        /**
+         *   Calls the method on the strand after the delay, the connection is not kept alive by the timer
+         *
+         *   @return id of the timer or 0 if the timer wheel is gone
+         */
+        Timer_wheel::Timer_id schedule_on_strand(std::chrono::milliseconds delay, void (Connection::*method)())
+        {
+            const std::shared_ptr<Timer_wheel> timer_wheel = m_timer_wheel.lock();
+
+            if (timer_wheel == nullptr)
+                return 0;
+
+            // Wheel calls this on its own thread so the call is moved to the strand
+            return timer_wheel->schedule(delay, [weak_self = this->weak_from_this(), method] {
+                if (auto self = weak_self.lock())
+                    self->dispatch_on_strand([self, method] { ((*self).*method)(); }, true);
+            });
+        }
+
+        void cancel_timer(Timer_wheel::Timer_id& timer_id)
+        {
+            if (timer_id == 0)
+                return;
+
+            if (const std::shared_ptr<Timer_wheel> timer_wheel = m_timer_wheel.lock())
+                timer_wheel->cancel(timer_id);
+
+            timer_id = 0;
+        }
+
+        void on_handshake_timeout()
+        {
+            m_handshake_timer = 0;
+
+            if (!m_has_done_handshake)
+                disconnect_on_strand(Notification_code::handshake_timeout);
+        }
+
+        void on_drain_timeout()
+        {
+            m_drain_timer = 0;
+            disconnect_on_strand(Notification_code::write_timeout);
+        }
+
+        void start_heartbeat()
+        {
+            if (!m_heartbeat_settings.has_heartbeat())
+                return;
+
+            const auto now = std::chrono::steady_clock::now();
+            m_last_read_time = now;
+            m_last_ping_time = now;
+
+            schedule_heartbeat();
+        }
+
+        // Heartbeat runs often enough that the timeouts are noticed at most half of the timeout late
+        void schedule_heartbeat()
+        {
+            std::chrono::milliseconds period = std::chrono::milliseconds::max();
+
+            if (m_heartbeat_settings.m_ping_interval)
+                period = std::min(period, *m_heartbeat_settings.m_ping_interval);
+
+            if (m_heartbeat_settings.m_read_timeout)
+                period = std::min(period, *m_heartbeat_settings.m_read_timeout / 2);
+
+            if (m_heartbeat_settings.m_write_timeout)
+                period = std::min(period, *m_heartbeat_settings.m_write_timeout / 2);
+
+            m_heartbeat_timer = schedule_on_strand(period, &Connection::on_heartbeat);
+        }
+
+        // Checks the timeouts and sends the ping when it is time for it
+        void on_heartbeat()
+        {
+            m_heartbeat_timer = 0;
+
+            if (!is_connected())
+                return;
+
+            const auto now = std::chrono::steady_clock::now();
+
+            // Reads only set the flag so the clock is not read for every message. Peer is not silent when this
+            // side has paused the reading.
+            if (m_has_read_since_heartbeat || m_is_read_paused)
+            {
+                m_last_read_time = now;
+                m_has_read_since_heartbeat = false;
+            }
+
+            if (m_heartbeat_settings.m_read_timeout && now - m_last_read_time > *m_heartbeat_settings.m_read_timeout)
+            {
+                disconnect_on_strand(Notification_code::read_timeout);
+                return;
+            }
+
+            if (m_heartbeat_settings.m_write_timeout && m_is_writing_message &&
+                now - m_write_start_time > *m_heartbeat_settings.m_write_timeout)
+            {
+                disconnect_on_strand(Notification_code::write_timeout);
+                return;
+            }
+
+            if (m_heartbeat_settings.m_ping_interval && now - m_last_ping_time >= *m_heartbeat_settings.m_ping_interval)
+            {
+                m_last_ping_time = now;
+
+                Message<Id_type> ping;
+                ping.set_internal_id(Internal_id::ping);
+                ping << static_cast<uint64_t>(get_heartbeat_time());
+
+                queue_message(std::move(ping));
+            }
+
+            schedule_heartbeat();
+        }
+
+        // First samples are spread by the id, the consecutive ids land on the different ticks of the wheel
+        void start_tcp_info_sampling()
+        {
+            if (!m_heartbeat_settings.m_tcp_info_interval)
+                return;
+
+            const uint64_t interval = std::max<int64_t>(m_heartbeat_settings.m_tcp_info_interval->count(), 1);
+            const uint64_t spread = static_cast<uint64_t>(m_id) * 2654435761u;
+
+            m_tcp_info_timer =
+                schedule_on_strand(std::chrono::milliseconds(spread % interval), &Connection::on_tcp_info_sample);
+        }
+
+        // Socket without the tcp state is not sampled again
+        void on_tcp_info_sample()
+        {
+            m_tcp_info_timer = 0;
+
+            if (!is_connected())
+                return;
+
+            const std::optional<Tcp_info> info = m_socket->get_tcp_info();
+
+            if (!info)
+                return;
+
+            m_counters.set_tcp_info(*info);
+            m_tcp_info_timer = schedule_on_strand(
+                std::max(*m_heartbeat_settings.m_tcp_info_interval, std::chrono::milliseconds(1)),
+                &Connection::on_tcp_info_sample);
+        }
+
+        // Replaces the received message with the decompressed one, the original size is validated before allocating
+        bool decompress_received_message()
+        {
+            const std::span<const char> compressed(m_received_message.body_data(), m_received_message.body_size());
+            const std::optional<size_t> original_size = Compression::decompressed_size(compressed);
+
+            if (!original_size.has_value() || *original_size > std::numeric_limits<Header_size_type>::max())
+                return false;
+
+            Message_header<Id_type> header = m_received_message.get_header();
+            header.m_size = static_cast<Header_size_type>(original_size.value());
+            header.m_body_encoding = Body_encoding::raw;
+
+            if (!validate_header(header))
+                return false;
+
+            Message<Id_type> decompressed;
+            *decompressed.header_data() = header;
+            decompressed.resize_body(original_size.value());
+
+            const std::span<char> output(decompressed.body_data(), decompressed.body_size());
+
+            if (m_received_message.get_header().m_body_encoding == Body_encoding::compressed_stream)
+            {
+                if (!decompress_stream(compressed, output))
+                    return false;
+            }
+            else if (!Compression::decompress(compressed, output))
+                return false;
+
+            if (m_received_message.get_header().m_body_encoding == Body_encoding::compressed_delta &&
+                !apply_received_delta(header.m_id, output))
+                return false;
+
+            m_received_message = std::move(decompressed);
+            return true;
+        }
+
+        // Restores the body from the xor against the previous delta encoded body of the id and keeps it for the next
+        bool apply_received_delta(Id_type id, std::span<char> body)
+        {
+            auto previous_body = m_read_delta_bases.find(id);
+
+            if (previous_body == m_read_delta_bases.end())
+            {
+                if (m_read_delta_bases.size() >= MAX_DELTA_ENCODED_IDS)
+                    return false;
+
+                previous_body = m_read_delta_bases.try_emplace(id).first;
+            }
+
+            xor_previous_body(body, previous_body->second);
+            previous_body->second.assign(body.begin(), body.end());
+            return true;
+        }
+
+        // Checks the received chunk continues a stream that is open or starts a new one
+        bool track_received_stream()
+        {
+            const char* body = m_received_message.body_data();
+
+            if (m_received_message.body_size() < Stream_chunk<Id_type>::HEADER_SIZE)
+                return false;
+
+            const uint32_t stream_id = Stream_chunk<Id_type>::read_stream_id(body);
+            const uint8_t flags = Stream_chunk<Id_type>::read_flags(body);
+            const bool is_first = (flags & Stream_chunk<Id_type>::FIRST_FLAG) != 0;
+            const bool is_last = (flags & Stream_chunk<Id_type>::LAST_FLAG) != 0;
+
+            if ((flags & ~(Stream_chunk<Id_type>::FIRST_FLAG | Stream_chunk<Id_type>::LAST_FLAG)) != 0)
+                return false;
+
+            if (is_first)
+            {
+                if (m_open_streams.size() >= MAX_OPEN_STREAMS || !m_open_streams.insert(stream_id).second)
+                    return false;
+            }
+            else if (!m_open_streams.contains(stream_id))
+                return false;
+
+            if (is_last)
+                m_open_streams.erase(stream_id);
+
+            return true;
+        }
+
+        // Stream is accepted only if this side allows it and with the same codec that this side uses
+        bool decompress_stream(std::span<const char> compressed, std::span<char> output)
+        {
+            if (m_compression_settings.m_mode != Compression_mode::stream ||
+                m_compression_settings.m_codec == Compression_codec::none)
+                return false;
+
+            if (m_stream_decompressor == nullptr)
+                m_stream_decompressor = std::make_unique<Stream_decompressor>(
+                    m_compression_settings.m_codec, m_compression_settings.m_dictionary);
+
+            return m_stream_decompressor->decompress(compressed, output);
+        }
+
+        const uint32_t m_id = 0;
+        asio::ip::address m_address;
+        std::shared_ptr<const std::string> m_ip = std::make_shared<const std::string>("0.0.0.0");
+
+        std::unique_ptr<Socket_type> m_socket;
+        std::atomic<bool> m_is_connected = false;
+        bool m_has_done_handshake = false;
+        bool m_is_handshake_pending = false;
+
+        bool m_is_writing_message = false;
+
+        // Corked connection writes only when flushed, the socket is corked while a flush writes many batches
+        uint32_t m_cork_depth = 0;
+        bool m_is_flush_requested = false;
+        bool m_is_socket_corked = false;
+        std::atomic<bool> m_has_unflushed_sends = false;
+
+        std::atomic<uint64_t> m_agreed_capabilities = 0;
+        Message<Id_type> m_received_message;
+
+        // Write loop waiting for its batch to be written and the result of the write
+        std::coroutine_handle<> m_write_coroutine = nullptr;
+        Write_result m_write_result;
+
+        static_assert(sizeof(Message_header<Id_type>) >= Compact_header<Id_type>::PREFIX_SIZE);
+        static constexpr size_t HEADER_BUFFER_SIZE =
+            std::max(sizeof(Message_header<Id_type>), Compact_header<Id_type>::MAX_SIZE);
+
+        // Header formats that can be read and the buffer where the header is read before decoding in exact mode
+        Header_format m_header_format = Header_format::standard;
+        std::array<char, HEADER_BUFFER_SIZE> m_header_buffer = {};
+        size_t m_header_bytes = 0;
+
+        // Checksum of the checked message being read in exact mode, the body is added to it as it is read
+        bool m_is_read_checked = false;
+        uint32_t m_read_checksum = 0;
+        uint32_t m_expected_checksum = 0;
+
+        // Receive buffer for the buffered read mode, the unparsed data is between begin and end
+        Read_mode m_read_mode = Read_mode::exact;
+        // Buffers come from the pool of the message bodies unless the socket has registered buffers, so the on demand
+        // connections reuse the buffers instead of allocating them on every read
+        std::shared_ptr<std::pmr::memory_resource> m_receive_memory = m_socket->get_receive_memory();
+        std::pmr::vector<char> m_receive_buffer{
+            m_receive_memory ? m_receive_memory.get() : get_message_memory_resource()};
+        size_t m_receive_buffer_size = DEFAULT_RECEIVE_BUFFER_SIZE;
+        size_t m_bulk_read_budget = DEFAULT_BULK_READ_BUDGET;
+        size_t m_receive_begin = 0;
+        size_t m_receive_end = 0;
+
+        // Receive buffer that the messages refer to, the memory resource is kept alive with it
+        struct Lent_receive_buffer
+        {
+            std::shared_ptr<std::pmr::memory_resource> m_memory;
+            std::pmr::vector<char> m_buffer;
+        };
+
+        bool m_is_zero_copy_receive = false;
+
+        // Set while parsing if a message refers to the receive buffer
+        std::shared_ptr<Lent_receive_buffer> m_lent_receive_buffer;
+
+        static constexpr size_t PRIORITY_COUNT = static_cast<size_t>(Message_priority::bulk) + 1;
+
+        // Lanes of messages waiting to be written and the ones of them that can be replaced, only used on the strand.
+        // Queue keeps the places of the messages when the ends change so the conflated ones can be pointed to.
+        std::array<Message_queue, PRIORITY_COUNT> m_out_queues =
+            make_out_queues(std::make_index_sequence<PRIORITY_COUNT>());
+        std::unordered_map<Conflation_key, Queued_message*, Conflation_key_hash> m_conflated_messages;
+        size_t m_queued_bytes = 0;
+        size_t m_queued_message_count = 0;
+
+        // Sent messages are passed to the strand without a lock and one handler takes all that arrived before it runs
+        Linked_mpsc_queue<Sent_message> m_sent_messages{get_message_memory_resource()};
+
+        // Settings of the lanes and the turns they have left in the current round of the weighted scheduling
+        Priority_settings m_priority_settings;
+        std::array<uint32_t, PRIORITY_COUNT> m_priority_turns = {};
+
+        // Bulk message that is being sent in frames, the fragment being written and its encoded header
+        size_t m_bulk_frame_size = Priority_settings().m_bulk_frame_size;
+        std::optional<Outgoing_message<Id_type>> m_fragmented_message = std::nullopt;
+        size_t m_fragment_offset = 0;
+        Message<Id_type> m_fragment;
+        std::array<char, HEADER_BUFFER_SIZE> m_fragment_header = {};
+
+        // Frame of a logical stream in the batch being written, the fragment and its header are kept for the write
+        struct Stream_frame
+        {
+            Logical_stream* m_stream = nullptr;
+            uint32_t m_stream_id = 0;
+            size_t m_offset = 0;
+            size_t m_size = 0;
+            Message<Id_type> m_fragment;
+            std::array<char, HEADER_BUFFER_SIZE> m_header = {};
+        };
+
+        // Streams are kept for the whole connection so their credit stays in sync with the peer
+        std::map<uint32_t, Logical_stream> m_logical_streams;
+        std::vector<Stream_frame> m_stream_frames;
+        uint32_t m_last_stream_id = 0;
+        std::unordered_map<uint32_t, Fragment_assembly> m_fragment_assemblies;
+        Write_queue_limits m_write_queue_limits;
+        bool m_is_congested = false;
+        std::atomic<uint64_t> m_dropped_message_count = 0;
+
+        // Counters of this connection and the shared counters of the user
+        Connection_counters m_counters;
+        std::shared_ptr<Metrics_counters<Id_type>> m_metrics_counters;
+        std::chrono::steady_clock::time_point m_start_time;
+
+        // Null when the latency tracking is off
+        std::shared_ptr<Latency_histograms> m_latency_histograms;
+
+        // Null when the traffic is not captured
+        std::shared_ptr<Traffic_capture> m_traffic_capture;
+
+        // Reading pauses when the connection is bulk and the flag of the user is set
+        std::shared_ptr<const std::atomic<bool>> m_bulk_pause_flag;
+        std::atomic<bool> m_is_bulk = false;
+
+        // Reading that the set_reading_held holds, this is only used on the strand
+        bool m_is_reading_held = false;
+
+        // Buffers of the socket do not change so they are read once for the get_memory_usage
+        size_t m_socket_buffer_bytes = 0;
+
+        Chunked_queue<Outgoing_stream> m_out_streams{get_message_memory_resource()};
+        std::vector<char> m_stream_buffer;
+
+        // Chunk that is being sent from the file and its encoded header
+        Message<Id_type> m_file_chunk;
+        std::array<char, HEADER_BUFFER_SIZE> m_file_chunk_header = {};
+        uint32_t m_next_stream_id = 0;
+
+        // Streams the peer has started but not yet ended
+        static constexpr size_t MAX_OPEN_STREAMS = 64;
+        std::unordered_set<uint32_t> m_open_streams;
+
+        // Messages that are currently being written and the header and body buffers pointing to them
+        std::vector<Outgoing_message<Id_type>> m_messages_being_written;
+
+        // Send times of the timed messages that are being written
+        std::vector<std::chrono::steady_clock::time_point> m_queued_times_being_written;
+        std::vector<asio::const_buffer> m_write_buffers;
+        std::vector<char> m_write_header_bytes;
+        Write_batch_limits m_write_batch_limits;
+
+        // Holding of the messages that are sent fast, the averages are in microseconds and only used on the strand
+        std::optional<Adaptive_batching> m_adaptive_batching;
+        std::optional<asio::steady_timer> m_batch_timer;
+        uint64_t m_batch_timer_generation = 0;
+        bool m_is_batch_held = false;
+        bool m_is_batch_released = false;
+        std::chrono::steady_clock::time_point m_last_queued_time;
+        double m_last_send_gap = 0.0;
+        double m_average_send_gap = 0.0;
+        double m_average_message_bytes = 0.0;
+
+        // Memory of the batch the kernel sends without copying, the socket keeps it until the kernel is done
+        struct Zero_copy_batch
+        {
+            std::vector<Outgoing_message<Id_type>> m_messages;
+            std::vector<char> m_header_bytes;
+            std::vector<std::vector<char>> m_compressed_bodies;
+        };
+
+        std::optional<size_t> m_zero_copy_threshold;
+        std::shared_ptr<Zero_copy_batch> m_zero_copy_batch;
+        std::atomic<Header_format> m_write_header_format = Header_format::standard;
+
+        // Compressed bodies of the batch being written, these keep their capacity for the next batches
+        Compression_settings m_compression_settings;
+        std::atomic<Compression_codec> m_write_compression_codec = Compression_codec::none;
+        std::atomic<Compression_mode> m_write_compression_mode = Compression_mode::per_message;
+        std::vector<std::vector<char>> m_compressed_bodies;
+
+        // Created when the first stream compressed message is written or read
+        std::unique_ptr<Stream_compressor> m_stream_compressor;
+        std::unique_ptr<Stream_decompressor> m_stream_decompressor;
+
+        // Previous delta encoded bodies of the written ids, only used in the write loop
+        std::shared_ptr<const std::unordered_set<Id_type>> m_delta_encoded_messages;
+
+        size_t m_max_message_size = std::numeric_limits<size_t>::max();
+        size_t m_max_replication_update_size = DEFAULT_MAX_REPLICATION_UPDATE_SIZE;
+
+        // Ids whose bodies are read to the memory of the user, only used in the exact read mode
+        std::shared_ptr<const std::unordered_map<Id_type, Body_sink<Id_type>>> m_body_sinks;
+        std::unordered_map<Id_type, std::vector<char>> m_write_delta_bases;
+        std::vector<char> m_delta_buffer;
+
+        // Previous delta encoded bodies of the read ids, the peer chooses the ids so they are limited
+        static constexpr size_t MAX_DELTA_ENCODED_IDS = 1024;
+        std::unordered_map<Id_type, std::vector<char>> m_read_delta_bases;
+
+        Accepted_messages_ptr m_accepted_messages = nullptr;
+
+        // Rate limits of the peer and its message ids, only used on the strand
+        Rate_buckets m_peer_rate_buckets;
+        std::unordered_map<Id_type, Rate_buckets> m_message_rate_buckets;
+        bool m_has_message_rate_limits = false;
+        Rate_limit_policy m_rate_limit_policy = Rate_limit_policy::pause_reading;
+        Timer_wheel::Timer_id m_rate_limit_timer = 0;
+
+        // Reading is paused by the rate limits or by the user that could not take the held message
+        bool m_is_read_paused = false;
+        std::optional<Owned_message<Id_type>> m_held_message = std::nullopt;
+
+        // Messages of the received bundle after the held message, they are delivered before the reading continues
+        std::deque<Owned_message<Id_type>> m_unbundled_messages;
+
+        // Parsed messages that are handed to the user together, see the m_on_messages
+        static constexpr size_t DELIVERY_BATCH_SIZE = 32;
+        std::vector<Owned_message<Id_type>> m_delivery_batch;
+        bool m_is_batching_deliveries = false;
+
+        // Body of the dropped message is read in parts to this buffer
+        static constexpr size_t DISCARD_BUFFER_SIZE = 16 * 1024;
+        std::vector<char> m_discard_buffer;
+        uint64_t m_discard_remaining = 0;
+
+        // Deadline timers and the times they compare, these are only used on the strand
+        Heartbeat_settings m_heartbeat_settings;
+        std::weak_ptr<Timer_wheel> m_timer_wheel;
+        Timer_wheel::Timer_id m_handshake_timer = 0;
+        Timer_wheel::Timer_id m_heartbeat_timer = 0;
+        Timer_wheel::Timer_id m_tcp_info_timer = 0;
+        std::chrono::steady_clock::time_point m_last_read_time;
+        std::chrono::steady_clock::time_point m_last_ping_time;
+        std::chrono::steady_clock::time_point m_write_start_time;
+        bool m_has_read_since_heartbeat = false;
+
+        // Connection that disconnects when its writes have finished, see the disconnect_after_flush
+        bool m_is_draining = false;
+        Timer_wheel::Timer_id m_drain_timer = 0;
+
+        // Microseconds, negative until the first pong
+        std::atomic<int64_t> m_round_trip_time = -1;
+
+        // Handlers are queued on the entry executor, it is the strand of the socket except while moving
+        mutable Instrumented_mutex m_strand_mutex;
+        asio::any_io_executor m_entry_executor;
+        asio::any_io_executor m_socket_executor;
+        size_t m_queued_handlers = 0;
+        bool m_is_moving = false;
+
+        // Strand that the socket moves to when it is quiet, these are only used on the strand
+        std::optional<asio::any_io_executor> m_next_executor;
+        bool m_is_read_parked = false;
+        bool m_is_resuming_after_move = false;
+
+        // Socket that is being handed off and the read that its release cancels, these are only used on the strand.
+        // Header read in exact mode started after the offset bytes of the header.
+        bool m_is_handing_off = false;
+        std::optional<Protocol::socket::native_handle_type> m_released_handle = std::nullopt;
+        bool m_is_read_cancellable = false;
+        size_t m_header_read_offset = 0;
     };
 } // namespace Net
@@ -0,0 +1,460 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "../Message/Message.h"
+#include "../Sockets/Xdp_socket.h"
+#include "../Utility/Common.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+
+namespace Net
+{
+    // How the messages of an id are sent, see the User::set_delivery_mode
+    enum class Delivery_mode : uint8_t
+    {
+        // Through the tcp connection, in order and without losses
+        reliable,
+
+        // In datagrams that can be lost or reordered, so a lost packet does not hold back the later messages
+        unreliable,
+
+        // In datagrams that are sent again until they are acked, handled in the order they arrive
+        reliable_datagram,
+
+        // Same as reliable_datagram but handled in the order they were sent, among the ids of this mode
+        ordered_datagram
+    };
+
+    enum class Datagram_type : uint8_t
+    {
+        hello,
+        unreliable,
+        reliable,
+
+        // Reliable_header without a message
+        ack
+    };
+
+    // Starts every datagram, the token from the server_accept tells that it came from the peer of the connection
+    struct Datagram_prefix
+    {
+        uint64_t m_token = 0;
+        uint32_t m_connection_id = 0;
+        Datagram_type m_type = Datagram_type::hello;
+
+        // Zero, sent so the prefix has no uninitialized padding
+        std::array<uint8_t, 3> m_reserved = {};
+
+        // Same peer, the type is not compared
+        [[nodiscard]] bool is_same_peer(const Datagram_prefix& other) const noexcept
+        {
+            return m_token == other.m_token && m_connection_id == other.m_connection_id;
+        }
+    };
+
+    // Follows the prefix of the reliable datagrams and the acks, see the Reliable_datagram_session
+    struct Reliable_header
+    {
+        // Sequence of this datagram, 0 in the acks
+        uint32_t m_sequence = 0;
+
+        // Position of the ordered message from 1, 0 for the others
+        uint32_t m_order = 0;
+
+        // Latest sequence received from the peer, 0 if none, and the 64 sequences before it as bits
+        uint32_t m_ack = 0;
+        uint32_t m_reserved = 0;
+        uint64_t m_ack_bits = 0;
+    };
+
+    /**
+     *   Udp socket that sends and receives the datagram messages next to the tcp connections.
+     *   Every datagram has the prefix and the standard header and the body of one message, the reliable ones have
+     *   the Reliable_header between them. Datagram with only the prefix is a hello: the client repeats it until
+     *   the server answers, so both sides know the endpoint of the other and that the datagrams get through.
+     *   Sends are made without waiting from the calling thread and the datagrams that don't fit in the socket
+     *   buffer are dropped like the network would drop them.
+     */
+    template <Id_concept Id_type>
+    class Datagram_channel
+    {
+    public:
+        // Larger unreliable messages go through the tcp connection, so the ip does not fragment the datagrams
+        static constexpr size_t MAX_DATAGRAM_SIZE = 1200;
+
+        static constexpr size_t MAX_HELLO_ATTEMPTS = 25;
+        static constexpr std::chrono::milliseconds HELLO_INTERVAL = std::chrono::milliseconds(200);
+
+        explicit Datagram_channel(const asio::any_io_executor& executor)
+            : m_socket(asio::make_strand(executor)), m_hello_timer(m_socket.get_executor())
+        {
+        }
+
+        Datagram_channel(const Datagram_channel&) = delete;
+        Datagram_channel(Datagram_channel&&) = delete;
+        Datagram_channel& operator=(const Datagram_channel&) = delete;
+        Datagram_channel& operator=(Datagram_channel&&) = delete;
+
+        /**
+         *   Opens the socket and starts receiving
+         *
+         *   @param local endpoint, port 0 binds a free port
+         *   @return the error if the socket could not be opened
+         */
+        [[nodiscard]] asio::error_code open(const Datagram_protocol::endpoint& endpoint)
+        {
+            std::lock_guard lock(m_socket_mutex);
+            asio::error_code error;
+
+            m_socket.open(endpoint.protocol(), error);
+
+            if (!error)
+                m_socket.bind(endpoint, error);
+
+            if (!error)
+                m_socket.non_blocking(true, error);
+
+            if (error)
+            {
+                asio::error_code ignored_error;
+                m_socket.close(ignored_error);
+                return error;
+            }
+
+            receive();
+            return {};
+        }
+
+#ifdef NET_HAS_AF_XDP
+        /**
+         *   Receives and sends the datagrams of the port also through the AF_XDP, see the Xdp_socket. This has to
+         *   be called after the open and before the first send.
+         *
+         *   @param the interface and its queues
+         *   @return the error if the AF_XDP could not be set up, the channel uses only its udp socket then
+         */
+        [[nodiscard]] asio::error_code open_xdp(const Xdp_settings& settings)
+        {
+            asio::error_code error;
+            const Datagram_protocol::endpoint local_endpoint = m_socket.local_endpoint(error);
+
+            if (error)
+                return error;
+
+            // Senders have the same form as from the udp socket, which maps the ipv4 addresses when it is ipv6
+            const bool map_v4 = local_endpoint.protocol() == Datagram_protocol::v6();
+
+            auto xdp_socket = std::make_unique<Xdp_socket>(m_socket.get_executor());
+            xdp_socket->m_on_datagram.set_callback(
+                [this, map_v4](std::span<const char> datagram, const Datagram_protocol::endpoint& sender) {
+                    if (!map_v4 || !sender.address().is_v4())
+                        return handle_datagram(datagram, sender);
+
+                    const asio::ip::address_v6 address =
+                        asio::ip::make_address_v6(asio::ip::v4_mapped, sender.address().to_v4());
+                    handle_datagram(datagram, Datagram_protocol::endpoint(address, sender.port()));
+                });
+
+            if ((error = xdp_socket->open(settings, local_endpoint.port())))
+                return error;
+
+            m_xdp_socket = std::move(xdp_socket);
+            return {};
+        }
+#endif
+
+        // Pending receive and hello end with operation_aborted
+        void close()
+        {
+            {
+                std::lock_guard lock(m_socket_mutex);
+                asio::error_code ignored_error;
+                m_socket.close(ignored_error);
+            }
+
+#ifdef NET_HAS_AF_XDP
+            if (m_xdp_socket)
+                m_xdp_socket->close();
+#endif
+
+            asio::post(m_socket.get_executor(), [this] {
+                m_hello_timer.cancel();
+            });
+        }
+
+        // @return port the socket is bound to, 0 if it is not open
+        [[nodiscard]] uint16_t get_port()
+        {
+            std::lock_guard lock(m_socket_mutex);
+            asio::error_code error;
+            const Datagram_protocol::endpoint endpoint = m_socket.local_endpoint(error);
+
+            return error ? 0 : endpoint.port();
+        }
+
+        // Executor of the strand that the handlers of the channel are called from
+        [[nodiscard]] asio::any_io_executor get_executor()
+        {
+            return m_socket.get_executor();
+        }
+
+        // @return false if the message has to go through the tcp connection
+        [[nodiscard]] static bool fits(const Message<Id_type>& message, Delivery_mode mode) noexcept
+        {
+            const size_t reliable_size = mode == Delivery_mode::unreliable ? 0 : sizeof(Reliable_header);
+            return sizeof(Datagram_prefix) + reliable_size + message.header_size() + message.body_size() <=
+                   MAX_DATAGRAM_SIZE;
+        }
+
+        /**
+         *   Reads the message from the rest of the received datagram
+         *
+         *   @param the datagram
+         *   @param offset of the message header in the datagram
+         *   @param the message that is read
+         *   @return false if the rest is not one valid message
+         */
+        [[nodiscard]] static bool read_message(std::span<const char> datagram, size_t offset, Message<Id_type>& message)
+        {
+            Message_header<Id_type>& header = *message.header_data();
+            const size_t bytes = datagram.size();
+
+            if (bytes < offset + sizeof(header))
+                return false;
+
+            std::memcpy(&header, datagram.data() + offset, sizeof(header));
+            const size_t body_size = bytes - offset - sizeof(header);
+
+            // Only the user messages are sent in the datagrams and their bodies are not compressed
+            if (!header.is_validation_key_correct() || header.m_internal_id != Internal_id::not_internal ||
+                header.m_body_encoding != Body_encoding::raw || header.m_size != body_size)
+                return false;
+
+            message.resize_body(body_size);
+            std::memcpy(message.body_data(), datagram.data() + offset + sizeof(header), body_size);
+            return true;
+        }
+
+        /**
+         *   Sends the message in one datagram, this can be called from any thread.
+         *   The caller checks that the message fits, see the fits.
+         */
+        void send(
+            const Datagram_protocol::endpoint& endpoint, const Datagram_prefix& prefix, const Message<Id_type>& message)
+        {
+            const Datagram_prefix unreliable_prefix = with_type(prefix, Datagram_type::unreliable);
+            Message_header<Id_type> header = message.get_header();
+            header.m_size = static_cast<typename Message_header<Id_type>::Size_type>(message.body_size());
+
+            const std::array<asio::const_buffer, 3> buffers = {
+                asio::buffer(&unreliable_prefix, sizeof(unreliable_prefix)), asio::buffer(&header, sizeof(header)),
+                asio::buffer(message.body_data(), message.body_size())};
+
+            send_buffers(endpoint, buffers);
+        }
+
+        // Sends the reliable datagram, or the ack if there is no message
+        void send_reliable(
+            const Datagram_protocol::endpoint& endpoint, const Datagram_prefix& prefix,
+            const Reliable_header& reliable_header, const Message<Id_type>* message)
+        {
+            const Datagram_prefix reliable_prefix =
+                with_type(prefix, message != nullptr ? Datagram_type::reliable : Datagram_type::ack);
+
+            if (message == nullptr)
+            {
+                const std::array<asio::const_buffer, 2> buffers = {
+                    asio::buffer(&reliable_prefix, sizeof(reliable_prefix)),
+                    asio::buffer(&reliable_header, sizeof(reliable_header))};
+
+                send_buffers(endpoint, buffers);
+                return;
+            }
+
+            Message_header<Id_type> header = message->get_header();
+            header.m_size = static_cast<typename Message_header<Id_type>::Size_type>(message->body_size());
+
+            const std::array<asio::const_buffer, 4> buffers = {
+                asio::buffer(&reliable_prefix, sizeof(reliable_prefix)),
+                asio::buffer(&reliable_header, sizeof(reliable_header)), asio::buffer(&header, sizeof(header)),
+                asio::buffer(message->body_data(), message->body_size())};
+
+            send_buffers(endpoint, buffers);
+        }
+
+        void send_hello(const Datagram_protocol::endpoint& endpoint, const Datagram_prefix& prefix)
+        {
+            const Datagram_prefix hello_prefix = with_type(prefix, Datagram_type::hello);
+            const std::array<asio::const_buffer, 1> buffers = {asio::buffer(&hello_prefix, sizeof(hello_prefix))};
+            send_buffers(endpoint, buffers);
+        }
+
+        // Sends the hello again until the stop_hello is called or the attempts run out
+        void start_hello(const Datagram_protocol::endpoint& endpoint, const Datagram_prefix& prefix)
+        {
+            asio::post(m_socket.get_executor(), [this, endpoint, prefix] {
+                m_hello_timer.cancel();
+                send_hello_attempt(endpoint, prefix, 0);
+            });
+        }
+
+        // This should be called from the m_on_hello or the m_on_message
+        void stop_hello()
+        {
+            m_hello_timer.cancel();
+        }
+
+        // Datagrams that were not sent because the socket buffer was full or the sending failed
+        [[nodiscard]] uint64_t get_dropped_sends() const noexcept
+        {
+            return m_dropped_sends.load(std::memory_order_relaxed);
+        }
+
+        // Called from the strand of the channel with the prefix of the hello and its sender
+        Delegate<const Datagram_prefix&, const Datagram_protocol::endpoint&> m_on_hello;
+
+        // Called from the strand of the channel, the prefix and the header are checked only for their format
+        Delegate<const Datagram_prefix&, const Datagram_protocol::endpoint&, Message<Id_type>&> m_on_message;
+
+        // Called from the strand of the channel with the reliable datagram or the ack, the message is nullptr in acks
+        Delegate<const Datagram_prefix&, const Datagram_protocol::endpoint&, const Reliable_header&, Message<Id_type>*>
+            m_on_reliable;
+
+        // Receiving continues after the errors, except when the socket has been closed
+        Delegate<const asio::error_code&> m_on_error;
+
+    private:
+        [[nodiscard]] static Datagram_prefix with_type(Datagram_prefix prefix, Datagram_type type) noexcept
+        {
+            prefix.m_type = type;
+            return prefix;
+        }
+
+        template <size_t Buffer_count>
+        void send_buffers(
+            const Datagram_protocol::endpoint& endpoint, const std::array<asio::const_buffer, Buffer_count>& buffers)
+        {
+#ifdef NET_HAS_AF_XDP
+            if (m_xdp_socket && m_xdp_socket->send(endpoint, buffers))
+                return;
+#endif
+
+            asio::error_code error;
+            {
+                std::lock_guard lock(m_socket_mutex);
+                m_socket.send_to(buffers, endpoint, 0, error);
+            }
+
+            if (error)
+                m_dropped_sends.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void send_hello_attempt(
+            const Datagram_protocol::endpoint& endpoint, const Datagram_prefix& prefix, size_t attempt)
+        {
+            send_hello(endpoint, prefix);
+
+            if (attempt + 1 >= MAX_HELLO_ATTEMPTS)
+                return;
+
+            m_hello_timer.expires_after(HELLO_INTERVAL);
+            m_hello_timer.async_wait([this, endpoint, prefix, attempt](asio::error_code error) {
+                if (!error)
+                    send_hello_attempt(endpoint, prefix, attempt + 1);
+            });
+        }
+
+        // This is called with the socket mutex locked
+        void receive()
+        {
+            m_socket.async_receive_from(
+                asio::buffer(m_receive_buffer), m_sender, [this](asio::error_code error, size_t bytes) {
+                    // Channel may have been destroyed when the receive was aborted
+                    if (error == asio::error::operation_aborted)
+                        return;
+
+                    // Windows reports the icmp errors of the earlier sends on the next receive
+                    if (error)
+                        m_on_error.broadcast(error);
+                    else
+                        handle_datagram(std::span<const char>(m_receive_buffer.data(), bytes), m_sender);
+
+                    std::lock_guard lock(m_socket_mutex);
+
+                    if (m_socket.is_open())
+                        receive();
+                });
+        }
+
+        // Datagrams that are not in the format of the channel are ignored
+        void handle_datagram(std::span<const char> datagram, const Datagram_protocol::endpoint& sender)
+        {
+            const size_t bytes = datagram.size();
+
+            if (bytes < sizeof(Datagram_prefix))
+                return;
+
+            Datagram_prefix prefix;
+            std::memcpy(&prefix, datagram.data(), sizeof(prefix));
+            size_t offset = sizeof(prefix);
+
+            switch (prefix.m_type)
+            {
+            case Datagram_type::hello:
+                if (bytes == offset)
+                    m_on_hello.broadcast(prefix, sender);
+                return;
+
+            case Datagram_type::unreliable:
+                if (Message<Id_type> message; read_message(datagram, offset, message))
+                    m_on_message.broadcast(prefix, sender, message);
+                return;
+
+            case Datagram_type::reliable:
+            case Datagram_type::ack:
+                break;
+
+            default:
+                return;
+            }
+
+            Reliable_header reliable_header;
+
+            if (bytes < offset + sizeof(reliable_header))
+                return;
+
+            std::memcpy(&reliable_header, datagram.data() + offset, sizeof(reliable_header));
+            offset += sizeof(reliable_header);
+
+            if (prefix.m_type == Datagram_type::ack)
+            {
+                if (bytes == offset)
+                    m_on_reliable.broadcast(prefix, sender, reliable_header, nullptr);
+            }
+            else if (Message<Id_type> message;
+                     reliable_header.m_sequence != 0 && read_message(datagram, offset, message))
+                m_on_reliable.broadcast(prefix, sender, reliable_header, &message);
+        }
+
+        // Guards the socket, the sends come from any thread and the receives from the strand
+        std::mutex m_socket_mutex;
+        Datagram_protocol::socket m_socket;
+        asio::steady_timer m_hello_timer;
+
+        // Largest datagram that the udp can carry, so the larger datagrams of the peer are not cut silently
+        std::array<char, 65536> m_receive_buffer = {};
+        Datagram_protocol::endpoint m_sender;
+
+        std::atomic<uint64_t> m_dropped_sends = 0;
+
+#ifdef NET_HAS_AF_XDP
+        // Set before the sends start, so the sending threads read it without locking
+        std::unique_ptr<Xdp_socket> m_xdp_socket;
+#endif
+    };
+} // namespace Net
@@ -0,0 +1,604 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "../Message/Message.h"
+#include "../Utility/Common.h"
+#include "Datagram_channel.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <span>
+
+namespace Net
+{
+    // Group that the server multicasts the messages to all clients in, see the Multicast_sender
+    struct Multicast_settings
+    {
+        // Ipv4 or ipv6 multicast address, for example 239.255.0.1. The scope id of an ipv6 group picks the
+        // interface the datagrams are sent from.
+        asio::ip::address m_group;
+        uint16_t m_port = 0;
+
+        // Routers the datagrams may cross, 1 keeps them in the local network
+        int m_hops = 1;
+
+        // Messages kept for the repairs, a client that misses an older one gets the multicast_messages_lost
+        size_t m_history_size = 4096;
+
+        // Clients on the same host get the datagrams too
+        bool m_loopback = true;
+    };
+
+    enum class Multicast_type : uint8_t
+    {
+        message,
+
+        // Header without a message, its sequence is the latest sent so the receivers notice the lost last datagrams.
+        // Receivers that stop hearing them leave the group.
+        heartbeat
+    };
+
+    // Starts every multicast datagram, the standard header and the body of the message follow it
+    struct Multicast_header
+    {
+        // From the server accept, the datagrams of the other servers in the same group are ignored
+        uint64_t m_token = 0;
+        uint32_t m_sequence = 0;
+
+        // Client that the message was not sent to, 0 if none
+        uint32_t m_ignored_client = 0;
+        Multicast_type m_type = Multicast_type::message;
+
+        // Zero, sent so the header has no uninitialized padding
+        std::array<uint8_t, 7> m_reserved = {};
+    };
+
+    /**
+     *   Sends the messages to all clients of the server in one udp multicast datagram, so on a local network one
+     *   packet serves every client instead of a copy per connection. Every message has a sequence and the sent
+     *   messages are kept for a while, so the clients ask through their tcp connections for the ones they missed,
+     *   see the Multicast_message. A heartbeat with the latest sequence tells the clients about the lost
+     *   datagrams at the end and that the group still reaches them.
+     */
+    template <Id_concept Id_type>
+    class Multicast_sender
+    {
+    public:
+        static constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL = std::chrono::milliseconds(100);
+
+        // Sent message and the client it was not sent to
+        struct Sent_message
+        {
+            uint32_t m_sequence = 0;
+            uint32_t m_ignored_client = 0;
+            Message<Id_type> m_message;
+        };
+
+        explicit Multicast_sender(const asio::any_io_executor& executor)
+            : m_socket(asio::make_strand(executor)), m_heartbeat_timer(m_socket.get_executor())
+        {
+        }
+
+        Multicast_sender(const Multicast_sender&) = delete;
+        Multicast_sender(Multicast_sender&&) = delete;
+        Multicast_sender& operator=(const Multicast_sender&) = delete;
+        Multicast_sender& operator=(Multicast_sender&&) = delete;
+
+        /**
+         *   @param the group
+         *   @param the token that the datagrams carry
+         *   @return the error if the socket could not be opened or the address is not a multicast address
+         */
+        [[nodiscard]] asio::error_code open(const Multicast_settings& settings, uint64_t token)
+        {
+            if (!settings.m_group.is_multicast())
+                return asio::error::invalid_argument;
+
+            std::lock_guard lock(m_mutex);
+            asio::error_code error;
+
+            m_group = Datagram_protocol::endpoint(settings.m_group, settings.m_port);
+            m_token = token;
+            m_history_size = std::max<size_t>(settings.m_history_size, 1);
+
+            m_socket.open(m_group.protocol(), error);
+
+            if (!error)
+                m_socket.set_option(asio::ip::multicast::hops(settings.m_hops), error);
+
+            if (!error)
+                m_socket.set_option(asio::ip::multicast::enable_loopback(settings.m_loopback), error);
+
+            if (!error && settings.m_group.is_v6() && settings.m_group.to_v6().scope_id() != 0)
+                m_socket.set_option(
+                    asio::ip::multicast::outbound_interface(
+                        static_cast<unsigned int>(settings.m_group.to_v6().scope_id())),
+                    error);
+
+            if (!error)
+                m_socket.non_blocking(true, error);
+
+            if (error)
+            {
+                asio::error_code ignored_error;
+                m_socket.close(ignored_error);
+                return error;
+            }
+
+            arm_heartbeat();
+            return {};
+        }
+
+        // Pending heartbeat ends with operation_aborted
+        void close()
+        {
+            std::lock_guard lock(m_mutex);
+            asio::error_code ignored_error;
+            m_socket.close(ignored_error);
+            m_heartbeat_timer.cancel();
+        }
+
+        // @return false if the message has to go through the connections
+        [[nodiscard]] static bool fits(const Message<Id_type>& message) noexcept
+        {
+            return sizeof(Multicast_header) + message.header_size() + message.body_size() <=
+                   Datagram_channel<Id_type>::MAX_DATAGRAM_SIZE;
+        }
+
+        /**
+         *   Sends the message to the group and keeps it for the repairs, this can be called from any thread.
+         *   The caller checks that the message fits, see the fits.
+         *
+         *   @param the message
+         *   @param the client that skips the message, 0 if none
+         *   @return the sequence of the message
+         */
+        uint32_t send(const Message<Id_type>& message, uint32_t ignored_client)
+        {
+            std::lock_guard lock(m_mutex);
+            const uint32_t sequence = m_next_sequence++;
+
+            const Multicast_header multicast_header = {
+                .m_token = m_token, .m_sequence = sequence, .m_ignored_client = ignored_client};
+            Message_header<Id_type> header = message.get_header();
+            header.m_size = static_cast<typename Message_header<Id_type>::Size_type>(message.body_size());
+
+            const std::array<asio::const_buffer, 3> buffers = {
+                asio::buffer(&multicast_header, sizeof(multicast_header)), asio::buffer(&header, sizeof(header)),
+                asio::buffer(message.body_data(), message.body_size())};
+
+            // Clients repair the datagrams that were not sent like the ones that the network lost
+            asio::error_code ignored_error;
+            m_socket.send_to(buffers, m_group, 0, ignored_error);
+
+            m_history.push_back({.m_sequence = sequence, .m_ignored_client = ignored_client, .m_message = message});
+
+            if (m_history.size() > m_history_size)
+                m_history.pop_front();
+
+            return sequence;
+        }
+
+        // @return the sequence of the next message
+        [[nodiscard]] uint32_t get_next_sequence()
+        {
+            std::lock_guard lock(m_mutex);
+            return m_next_sequence;
+        }
+
+        // @return the sent message, nullopt if it is no longer kept
+        [[nodiscard]] std::optional<Sent_message> find(uint32_t sequence)
+        {
+            std::lock_guard lock(m_mutex);
+
+            if (m_history.empty())
+                return std::nullopt;
+
+            // Sequences are consecutive so the distance from the oldest is the index, also when they wrap
+            const uint32_t index = sequence - m_history.front().m_sequence;
+
+            if (index >= m_history.size())
+                return std::nullopt;
+
+            return m_history[index];
+        }
+
+        [[nodiscard]] size_t get_history_size()
+        {
+            std::lock_guard lock(m_mutex);
+            return m_history_size;
+        }
+
+    private:
+        // This is called with the mutex locked
+        void arm_heartbeat()
+        {
+            m_heartbeat_timer.expires_after(HEARTBEAT_INTERVAL);
+            m_heartbeat_timer.async_wait([this](asio::error_code error) {
+                // Sender may have been destroyed when the wait was aborted
+                if (error)
+                    return;
+
+                std::lock_guard lock(m_mutex);
+
+                if (!m_socket.is_open())
+                    return;
+
+                const Multicast_header heartbeat = {
+                    .m_token = m_token, .m_sequence = m_next_sequence - 1, .m_type = Multicast_type::heartbeat};
+
+                asio::error_code ignored_error;
+                m_socket.send_to(asio::buffer(&heartbeat, sizeof(heartbeat)), m_group, 0, ignored_error);
+
+                arm_heartbeat();
+            });
+        }
+
+        // Guards the socket and the history, the sends come from any thread and the heartbeats from the strand
+        std::mutex m_mutex;
+        Datagram_protocol::socket m_socket;
+        asio::steady_timer m_heartbeat_timer;
+        Datagram_protocol::endpoint m_group;
+        uint64_t m_token = 0;
+
+        uint32_t m_next_sequence = 1;
+        std::deque<Sent_message> m_history;
+        size_t m_history_size = 0;
+    };
+
+
+    /**
+     *   Receives the multicast of the server and hands the messages on in the order of their sequences. The
+     *   server tells through the connection the first sequence that the client gets from the group, the earlier
+     *   ones came through the connection. Missing sequences are asked again with the m_on_nak, every
+     *   NAK_INTERVAL while they are missing, and the later messages wait for them. If nothing is heard from the
+     *   group for the SILENCE_TIMEOUT the receiving stops, so the client leaves and gets the rest through the tcp.
+     */
+    template <Id_concept Id_type>
+    class Multicast_receiver
+    {
+    public:
+        // Sequences that can wait ahead of a missing one, the client that falls further behind gives up on it
+        static constexpr uint32_t MAX_PENDING = 4096;
+
+        static constexpr std::chrono::milliseconds NAK_INTERVAL = std::chrono::milliseconds(100);
+        static constexpr std::chrono::milliseconds SILENCE_TIMEOUT = std::chrono::seconds(1);
+
+        explicit Multicast_receiver(const asio::any_io_executor& executor)
+            : m_socket(asio::make_strand(executor)), m_silence_timer(m_socket.get_executor())
+        {
+        }
+
+        Multicast_receiver(const Multicast_receiver&) = delete;
+        Multicast_receiver(Multicast_receiver&&) = delete;
+        Multicast_receiver& operator=(const Multicast_receiver&) = delete;
+        Multicast_receiver& operator=(Multicast_receiver&&) = delete;
+
+        /**
+         *   Joins the group and starts receiving, the messages are handed on after the start
+         *
+         *   @param the group and its port
+         *   @param the token of the server
+         *   @param the id that the server gave to this client
+         *   @return the error if the socket could not be opened or the group joined
+         */
+        [[nodiscard]] asio::error_code open(
+            const Datagram_protocol::endpoint& group, uint64_t token, uint32_t client_id)
+        {
+            close();
+
+            {
+                std::lock_guard lock(m_state_mutex);
+                m_token = token;
+                m_client_id = client_id;
+                m_next_sequence.reset();
+                m_pending.clear();
+                m_is_receiving = true;
+                m_has_heard = false;
+            }
+
+            std::lock_guard lock(m_socket_mutex);
+            asio::error_code error;
+
+            m_socket.open(group.protocol(), error);
+
+            // Other clients on the same host listen the same port
+            if (!error)
+                m_socket.set_option(Datagram_protocol::socket::reuse_address(true), error);
+
+            if (!error)
+                m_socket.bind(Datagram_protocol::endpoint(group.protocol(), group.port()), error);
+
+            if (!error)
+                m_socket.set_option(asio::ip::multicast::join_group(group.address()), error);
+
+            if (error)
+            {
+                asio::error_code ignored_error;
+                m_socket.close(ignored_error);
+                return error;
+            }
+
+            receive();
+            arm_silence_timer();
+            return {};
+        }
+
+        // Pending receive and the silence timer end with operation_aborted, the repairs are still handled
+        void close()
+        {
+            std::lock_guard lock(m_socket_mutex);
+            asio::error_code ignored_error;
+            m_socket.close(ignored_error);
+            m_silence_timer.cancel();
+        }
+
+        /**
+         *   @param the first sequence that the server left to the multicast
+         *   @return false if the receiving already stopped because of the silence, then leave from the first
+         */
+        bool start(uint32_t first_sequence)
+        {
+            std::lock_guard lock(m_state_mutex);
+            m_next_sequence = first_sequence;
+            m_pending.clear();
+            return m_is_receiving;
+        }
+
+        // Handles the message that the server sent again through the connection
+        void repair(uint32_t sequence, Message<Id_type>& message)
+        {
+            std::lock_guard lock(m_state_mutex);
+
+            if (Slot* slot = find_slot(sequence); slot != nullptr && slot->m_state == Slot_state::missing)
+            {
+                slot->m_state = Slot_state::message;
+                slot->m_message = std::move(message);
+                deliver_ready();
+            }
+        }
+
+        // Passes the sequences that the server did not send to this client or no longer has
+        void skip(uint32_t first_sequence, uint32_t count)
+        {
+            std::lock_guard lock(m_state_mutex);
+
+            for (uint32_t i = 0; i < count; ++i)
+                if (Slot* slot = find_slot(first_sequence + i); slot != nullptr && slot->m_state == Slot_state::missing)
+                    slot->m_state = Slot_state::skipped;
+
+            deliver_ready();
+        }
+
+        // Called in the order of the sequences, from the strand of the receiver or the thread of the repairs
+        Delegate<Message<Id_type>&> m_on_message;
+
+        // Called from the strand with the first missing sequence and the amount, send these to the server
+        Delegate<uint32_t, uint32_t> m_on_nak;
+
+        // Called from the strand with the amount of the sequences given up because the client fell too far behind
+        Delegate<uint32_t> m_on_lost;
+
+        /**
+         *   Called from the strand when the receiving stopped because of the silence, with the sequence to leave
+         *   from. It is nullopt if the server has not started the receiver yet, then the start returns false.
+         */
+        Delegate<std::optional<uint32_t>> m_on_silent;
+
+        // Receiving continues after the errors, except when the socket has been closed
+        Delegate<const asio::error_code&> m_on_error;
+
+    private:
+        enum class Slot_state : uint8_t
+        {
+            missing,
+            message,
+            skipped
+        };
+
+        struct Slot
+        {
+            Slot_state m_state = Slot_state::missing;
+            Message<Id_type> m_message;
+        };
+
+        // This is called with the socket mutex locked
+        void receive()
+        {
+            m_socket.async_receive(asio::buffer(m_receive_buffer), [this](asio::error_code error, size_t bytes) {
+                // Receiver may have been destroyed when the receive was aborted
+                if (error == asio::error::operation_aborted)
+                    return;
+
+                if (error)
+                    m_on_error.broadcast(error);
+                else
+                    handle_datagram(std::span<const char>(m_receive_buffer.data(), bytes));
+
+                std::lock_guard lock(m_socket_mutex);
+
+                if (m_socket.is_open())
+                    receive();
+            });
+        }
+
+        // Checks that the group was heard since the last check, this is called with the socket mutex locked
+        void arm_silence_timer()
+        {
+            m_silence_timer.expires_after(SILENCE_TIMEOUT);
+            m_silence_timer.async_wait([this](asio::error_code error) {
+                if (error)
+                    return;
+
+                std::optional<uint32_t> next_sequence;
+                {
+                    std::lock_guard lock(m_state_mutex);
+
+                    if (std::exchange(m_has_heard, false))
+                    {
+                        std::lock_guard socket_lock(m_socket_mutex);
+                        arm_silence_timer();
+                        return;
+                    }
+
+                    m_is_receiving = false;
+                    next_sequence = m_next_sequence;
+                }
+
+                close();
+                m_on_silent.broadcast(next_sequence);
+            });
+        }
+
+        // Datagrams of the other servers and the ones that are not in the format are ignored
+        void handle_datagram(std::span<const char> datagram)
+        {
+            if (datagram.size() < sizeof(Multicast_header))
+                return;
+
+            Multicast_header header;
+            std::memcpy(&header, datagram.data(), sizeof(header));
+
+            std::lock_guard lock(m_state_mutex);
+
+            if (header.m_token != m_token || !m_is_receiving)
+                return;
+
+            m_has_heard = true;
+
+            if (!m_next_sequence)
+                return;
+
+            if (header.m_type == Multicast_type::heartbeat)
+            {
+                // Makes room up to the latest sequence, so the missing ones are asked
+                static_cast<void>(find_slot(header.m_sequence));
+            }
+            else if (header.m_type == Multicast_type::message)
+            {
+                Slot* slot = find_slot(header.m_sequence);
+
+                if (slot != nullptr && slot->m_state == Slot_state::missing)
+                {
+                    if (header.m_ignored_client == m_client_id)
+                        slot->m_state = Slot_state::skipped;
+                    else if (Datagram_channel<Id_type>::read_message(datagram, sizeof(header), slot->m_message))
+                        slot->m_state = Slot_state::message;
+                }
+            }
+
+            deliver_ready();
+            request_missing();
+        }
+
+        /**
+         *   Sequences before the next one are old duplicates, the ones too far ahead make the client give up on
+         *   the missing ones it is waiting for. This is called with the state mutex locked.
+         *
+         *   @return slot of the sequence, nullptr if it has already been handled
+         */
+        [[nodiscard]] Slot* find_slot(uint32_t sequence)
+        {
+            if (!m_next_sequence)
+                return nullptr;
+
+            uint32_t distance = sequence - *m_next_sequence;
+
+            if (distance > UINT32_MAX / 2)
+                return nullptr;
+
+            if (distance >= MAX_PENDING)
+            {
+                const uint32_t given_up = distance - MAX_PENDING + 1;
+                uint32_t lost = 0;
+
+                for (uint32_t i = 0; i < given_up; ++i)
+                {
+                    if (m_pending.empty())
+                    {
+                        lost += given_up - i;
+                        break;
+                    }
+
+                    if (m_pending.front().m_state == Slot_state::message)
+                        m_on_message.broadcast(m_pending.front().m_message);
+                    else if (m_pending.front().m_state == Slot_state::missing)
+                        ++lost;
+
+                    m_pending.pop_front();
+                }
+
+                *m_next_sequence += given_up;
+                distance -= given_up;
+                m_on_lost.broadcast(lost);
+            }
+
+            if (m_pending.size() <= distance)
+                m_pending.resize(distance + 1);
+
+            return &m_pending[distance];
+        }
+
+        // This is called with the state mutex locked
+        void deliver_ready()
+        {
+            while (!m_pending.empty() && m_pending.front().m_state != Slot_state::missing)
+            {
+                if (m_pending.front().m_state == Slot_state::message)
+                    m_on_message.broadcast(m_pending.front().m_message);
+
+                m_pending.pop_front();
+                ++*m_next_sequence;
+            }
+        }
+
+        // Asks the runs of the missing sequences, this is called with the state mutex locked
+        void request_missing()
+        {
+            const auto now = std::chrono::steady_clock::now();
+
+            if (m_pending.empty() || now - m_last_nak_time < NAK_INTERVAL)
+                return;
+
+            m_last_nak_time = now;
+
+            for (size_t i = 0; i < m_pending.size();)
+            {
+                if (m_pending[i].m_state != Slot_state::missing)
+                {
+                    ++i;
+                    continue;
+                }
+
+                const size_t first = i;
+
+                while (i < m_pending.size() && m_pending[i].m_state == Slot_state::missing)
+                    ++i;
+
+                m_on_nak.broadcast(*m_next_sequence + static_cast<uint32_t>(first), static_cast<uint32_t>(i - first));
+            }
+        }
+
+        // Guards the socket and the timer, they are closed from the thread of the client
+        std::mutex m_socket_mutex;
+        Datagram_protocol::socket m_socket;
+        asio::steady_timer m_silence_timer;
+        std::array<char, 65536> m_receive_buffer = {};
+
+        // Guards the sequences, the datagrams come from the strand and the repairs from the thread of the client
+        std::mutex m_state_mutex;
+        uint64_t m_token = 0;
+        uint32_t m_client_id = 0;
+        std::optional<uint32_t> m_next_sequence;
+        bool m_is_receiving = false;
+        bool m_has_heard = false;
+
+        // Slot i is the sequence m_next_sequence + i, so the first one is always missing
+        std::deque<Slot> m_pending;
+        std::chrono::steady_clock::time_point m_last_nak_time;
+    };
+} // namespace Net
@@ -0,0 +1,431 @@
+#pragma once
+
+#include "../Message/Message.h"
+#include "../Utility/Common.h"
+#include "Datagram_channel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Sends the reliable datagrams of one peer again until they are acked, see the Delivery_mode.
+     *   Every reliable datagram has a sequence and acks the latest sequence received from the peer with a bitfield
+     *   of the 64 sequences before it, so one ack covers the losses of a whole window. Datagram that is not acked
+     *   within the retransmission timeout, or that has three later datagrams acked, is sent again. Received
+     *   datagrams are acked right away so the sender sees the losses after one round trip.
+     *   The congestion window grows by one datagram per ack in the slow start and by one per window after it, and
+     *   it is halved once per window that had losses, so the sessions share a congested link like tcp does.
+     */
+    template <Id_concept Id_type>
+    class Reliable_datagram_session : public std::enable_shared_from_this<Reliable_datagram_session<Id_type>>
+    {
+    public:
+        // Datagrams in flight stay within the ack bitfield, so the receiver can tell the duplicates from new ones
+        static constexpr uint32_t MAX_WINDOW = 64;
+        static constexpr double INITIAL_WINDOW = 4;
+        static constexpr double MIN_WINDOW = 2;
+        static constexpr size_t FAST_RETRANSMIT_ACKS = 3;
+
+        static constexpr std::chrono::microseconds INITIAL_TIMEOUT = std::chrono::milliseconds(250);
+        static constexpr std::chrono::microseconds MIN_TIMEOUT = std::chrono::milliseconds(50);
+        static constexpr std::chrono::microseconds MAX_TIMEOUT = std::chrono::seconds(2);
+        static constexpr std::chrono::milliseconds TICK_INTERVAL = std::chrono::milliseconds(10);
+
+        /**
+         *   @param channel that sends the datagrams, it must outlive this
+         *   @param endpoint of the peer
+         *   @param prefix of the connection
+         */
+        Reliable_datagram_session(
+            Datagram_channel<Id_type>& channel, const Datagram_protocol::endpoint& endpoint,
+            const Datagram_prefix& prefix)
+            : m_channel(channel), m_endpoint(endpoint), m_prefix(prefix), m_timer(channel.get_executor())
+        {
+        }
+
+        // Peer can continue from a new address after a nat has changed its port
+        void set_endpoint(const Datagram_protocol::endpoint& endpoint)
+        {
+            std::lock_guard lock(m_mutex);
+            m_endpoint = endpoint;
+        }
+
+        /**
+         *   Sends the message or queues it until the congestion window has room, this can be called from any thread
+         *
+         *   @param the message, it must fit in a datagram
+         *   @param true if the message is handled in the order of the other ordered messages
+         */
+        void send(const Message<Id_type>& message, bool is_ordered)
+        {
+            std::lock_guard lock(m_mutex);
+
+            if (m_is_closed)
+                return;
+
+            m_waiting.push_back({.m_message = message, .m_order = is_ordered ? next_number(m_next_order) : 0});
+            send_waiting(std::chrono::steady_clock::now());
+            arm_timer();
+        }
+
+        /**
+         *   Handles the reliable datagram or the ack of the peer, this is called from the strand of the channel
+         *
+         *   @param the reliable header
+         *   @param message of the datagram, nullptr in the acks
+         *   @param messages that can be handled are moved to this, the ordered ones in their order
+         */
+        void receive(
+            const Reliable_header& header, Message<Id_type>* message, std::vector<Message<Id_type>>& delivered)
+        {
+            std::lock_guard lock(m_mutex);
+
+            if (m_is_closed)
+                return;
+
+            const auto now = std::chrono::steady_clock::now();
+            handle_ack(header, now);
+
+            if (message != nullptr)
+            {
+                const bool is_new = mark_received(header.m_sequence);
+
+                // Duplicates are acked too because the earlier ack may have been lost
+                send_ack();
+
+                if (is_new)
+                    deliver(header.m_order, std::move(*message), delivered);
+            }
+
+            send_waiting(now);
+            arm_timer();
+        }
+
+        // Drops the datagrams that are not acked yet, the timer stops on its next tick
+        void close()
+        {
+            std::lock_guard lock(m_mutex);
+            m_is_closed = true;
+            m_waiting.clear();
+            m_in_flight.clear();
+            m_out_of_order.clear();
+        }
+
+        // Datagrams sent again because they were not acked in time
+        [[nodiscard]] uint64_t get_retransmissions() const
+        {
+            std::lock_guard lock(m_mutex);
+            return m_retransmissions;
+        }
+
+    private:
+        struct Waiting_message
+        {
+            Message<Id_type> m_message;
+            uint32_t m_order = 0;
+        };
+
+        struct In_flight_datagram
+        {
+            uint32_t m_sequence = 0;
+            uint32_t m_order = 0;
+            Message<Id_type> m_message;
+            std::chrono::steady_clock::time_point m_send_time;
+            bool m_is_acked = false;
+            bool m_is_retransmitted = false;
+            bool m_is_fast_retransmitted = false;
+        };
+
+        // Sequences wrap around, 0 is skipped because it means none
+        static void advance(uint32_t& number) noexcept
+        {
+            if (++number == 0)
+                number = 1;
+        }
+
+        [[nodiscard]] static uint32_t next_number(uint32_t& number) noexcept
+        {
+            const uint32_t current = number;
+            advance(number);
+            return current;
+        }
+
+        [[nodiscard]] static bool is_newer(uint32_t first, uint32_t second) noexcept
+        {
+            return static_cast<int32_t>(first - second) > 0;
+        }
+
+        [[nodiscard]] static bool is_acked_by(const Reliable_header& header, uint32_t sequence) noexcept
+        {
+            if (header.m_ack == 0)
+                return false;
+
+            const uint32_t distance = header.m_ack - sequence;
+
+            if (distance == 0)
+                return true;
+
+            return distance <= 64 && ((header.m_ack_bits >> (distance - 1)) & 1) != 0;
+        }
+
+        // All the members are accessed with the mutex locked from here on
+
+        void handle_ack(const Reliable_header& header, std::chrono::steady_clock::time_point now)
+        {
+            for (In_flight_datagram& datagram : m_in_flight)
+            {
+                if (datagram.m_is_acked || !is_acked_by(header, datagram.m_sequence))
+                    continue;
+
+                datagram.m_is_acked = true;
+                --m_unacked_count;
+
+                // Samples of the retransmitted datagrams are skipped, the ack can be for either send
+                if (!datagram.m_is_retransmitted)
+                    update_timeout(now - datagram.m_send_time);
+
+                m_congestion_window += m_congestion_window < m_slow_start_threshold ? 1 : 1 / m_congestion_window;
+                m_congestion_window = std::min(m_congestion_window, static_cast<double>(MAX_WINDOW));
+            }
+
+            size_t later_acked = 0;
+
+            for (auto datagram = m_in_flight.rbegin(); datagram != m_in_flight.rend(); ++datagram)
+            {
+                if (datagram->m_is_acked)
+                    ++later_acked;
+                else if (later_acked >= FAST_RETRANSMIT_ACKS && !datagram->m_is_fast_retransmitted)
+                {
+                    datagram->m_is_fast_retransmitted = true;
+                    reduce_window(datagram->m_sequence, false);
+                    retransmit(*datagram, now);
+                }
+            }
+
+            while (!m_in_flight.empty() && m_in_flight.front().m_is_acked)
+                m_in_flight.pop_front();
+        }
+
+        // Smoothed round trip time and its variation like the tcp retransmission timer of RFC 6298
+        void update_timeout(std::chrono::steady_clock::duration round_trip)
+        {
+            const double sample = std::chrono::duration<double, std::micro>(round_trip).count();
+
+            if (m_smoothed_round_trip == 0)
+            {
+                m_smoothed_round_trip = sample;
+                m_round_trip_variation = sample / 2;
+            }
+            else
+            {
+                m_round_trip_variation =
+                    0.75 * m_round_trip_variation + 0.25 * std::abs(m_smoothed_round_trip - sample);
+                m_smoothed_round_trip = 0.875 * m_smoothed_round_trip + 0.125 * sample;
+            }
+
+            const auto timeout =
+                std::chrono::microseconds(static_cast<int64_t>(m_smoothed_round_trip + 4 * m_round_trip_variation));
+            m_timeout = std::clamp(timeout, MIN_TIMEOUT, MAX_TIMEOUT);
+        }
+
+        // Losses of the same window reduce it only once
+        void reduce_window(uint32_t lost_sequence, bool is_timeout)
+        {
+            if (m_has_recovery_sequence && !is_newer(lost_sequence, m_recovery_sequence))
+                return;
+
+            m_slow_start_threshold = std::max(m_congestion_window / 2, MIN_WINDOW);
+            m_congestion_window = is_timeout ? MIN_WINDOW : m_slow_start_threshold;
+            m_recovery_sequence = m_next_sequence - 1;
+            m_has_recovery_sequence = true;
+        }
+
+        // @return false if the sequence was already received
+        [[nodiscard]] bool mark_received(uint32_t sequence)
+        {
+            if (m_latest_received == 0 || is_newer(sequence, m_latest_received))
+            {
+                const uint32_t shift = sequence - m_latest_received;
+
+                if (m_latest_received == 0 || shift > 64)
+                    m_received_bits = 0;
+                else
+                    m_received_bits = (shift == 64 ? 0 : m_received_bits << shift) | (uint64_t(1) << (shift - 1));
+
+                m_latest_received = sequence;
+                return true;
+            }
+
+            // Older than the bitfield can only be a duplicate because the sender keeps its window within it
+            const uint32_t distance = m_latest_received - sequence;
+
+            if (distance == 0 || distance > 64)
+                return false;
+
+            const uint64_t bit = uint64_t(1) << (distance - 1);
+
+            if ((m_received_bits & bit) != 0)
+                return false;
+
+            m_received_bits |= bit;
+            return true;
+        }
+
+        void deliver(uint32_t order, Message<Id_type> message, std::vector<Message<Id_type>>& delivered)
+        {
+            if (order == 0)
+            {
+                delivered.push_back(std::move(message));
+                return;
+            }
+
+            if (order != m_next_delivery_order)
+            {
+                if (is_newer(order, m_next_delivery_order))
+                    m_out_of_order.emplace(order, std::move(message));
+
+                return;
+            }
+
+            delivered.push_back(std::move(message));
+            advance(m_next_delivery_order);
+
+            // Messages that arrived before their turn follow it
+            for (auto next = m_out_of_order.find(m_next_delivery_order); next != m_out_of_order.end();
+                 next = m_out_of_order.find(m_next_delivery_order))
+            {
+                delivered.push_back(std::move(next->second));
+                m_out_of_order.erase(next);
+                advance(m_next_delivery_order);
+            }
+        }
+
+        // Sends the waiting messages that fit in the congestion window
+        void send_waiting(std::chrono::steady_clock::time_point now)
+        {
+            while (!m_waiting.empty() && m_unacked_count < static_cast<size_t>(m_congestion_window))
+            {
+                if (!m_in_flight.empty() && m_next_sequence - m_in_flight.front().m_sequence >= MAX_WINDOW)
+                    return;
+
+                In_flight_datagram& datagram = m_in_flight.emplace_back(In_flight_datagram{
+                    .m_sequence = next_number(m_next_sequence),
+                    .m_order = m_waiting.front().m_order,
+                    .m_message = std::move(m_waiting.front().m_message),
+                    .m_send_time = now});
+
+                m_waiting.pop_front();
+                ++m_unacked_count;
+                send_datagram(datagram);
+            }
+        }
+
+        void send_datagram(const In_flight_datagram& datagram)
+        {
+            const Reliable_header header = {
+                .m_sequence = datagram.m_sequence,
+                .m_order = datagram.m_order,
+                .m_ack = m_latest_received,
+                .m_ack_bits = m_received_bits};
+
+            m_channel.send_reliable(m_endpoint, m_prefix, header, &datagram.m_message);
+        }
+
+        void send_ack()
+        {
+            const Reliable_header header = {.m_ack = m_latest_received, .m_ack_bits = m_received_bits};
+            m_channel.send_reliable(m_endpoint, m_prefix, header, nullptr);
+        }
+
+        void retransmit(In_flight_datagram& datagram, std::chrono::steady_clock::time_point now)
+        {
+            datagram.m_send_time = now;
+            datagram.m_is_retransmitted = true;
+            ++m_retransmissions;
+            send_datagram(datagram);
+        }
+
+        // Timer runs only while there are datagrams in flight
+        void arm_timer()
+        {
+            if (m_is_timer_armed || m_in_flight.empty())
+                return;
+
+            m_is_timer_armed = true;
+            m_timer.expires_after(TICK_INTERVAL);
+            m_timer.async_wait([self = this->shared_from_this()](asio::error_code error) {
+                self->on_tick(error);
+            });
+        }
+
+        void on_tick(asio::error_code error)
+        {
+            std::lock_guard lock(m_mutex);
+            m_is_timer_armed = false;
+
+            if (error || m_is_closed)
+                return;
+
+            const auto now = std::chrono::steady_clock::now();
+            bool has_timed_out = false;
+
+            for (In_flight_datagram& datagram : m_in_flight)
+            {
+                if (datagram.m_is_acked || now - datagram.m_send_time < m_timeout)
+                    continue;
+
+                if (!has_timed_out)
+                    reduce_window(datagram.m_sequence, true);
+
+                has_timed_out = true;
+                retransmit(datagram, now);
+            }
+
+            // Timeout is backed off until a new round trip is measured, so a dead link is not flooded
+            if (has_timed_out)
+                m_timeout = std::min(m_timeout * 2, MAX_TIMEOUT);
+
+            send_waiting(now);
+            arm_timer();
+        }
+
+        mutable std::mutex m_mutex;
+        Datagram_channel<Id_type>& m_channel;
+        Datagram_protocol::endpoint m_endpoint;
+        const Datagram_prefix m_prefix;
+        asio::steady_timer m_timer;
+        bool m_is_timer_armed = false;
+        bool m_is_closed = false;
+
+        // Sending side
+        std::deque<Waiting_message> m_waiting;
+        std::deque<In_flight_datagram> m_in_flight;
+        size_t m_unacked_count = 0;
+        uint32_t m_next_sequence = 1;
+        uint32_t m_next_order = 1;
+        uint64_t m_retransmissions = 0;
+
+        double m_congestion_window = INITIAL_WINDOW;
+        double m_slow_start_threshold = MAX_WINDOW;
+        uint32_t m_recovery_sequence = 0;
+        bool m_has_recovery_sequence = false;
+
+        double m_smoothed_round_trip = 0;
+        double m_round_trip_variation = 0;
+        std::chrono::microseconds m_timeout = INITIAL_TIMEOUT;
+
+        // Receiving side
+        uint32_t m_latest_received = 0;
+        uint64_t m_received_bits = 0;
+        uint32_t m_next_delivery_order = 1;
+        std::map<uint32_t, Message<Id_type>> m_out_of_order;
+    };
+} // namespace Net
@@ -1,17 +1,52 @@
 #pragma once
 
-#include "Callback.h"
-#include "Object_Callback.h"
-#include <memory>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace Net
 {
-    // The class that handles callbacks
+    /**
+     *   The class that handles callbacks.
+     *   Callables that fit in the inline buffer are stored in the delegate and called through one function pointer
+     *   without a virtual call, so member functions and small lambdas don't allocate. Larger ones are allocated.
+     */
     template <typename... Parameter_types>
     class Delegate
     {
     public:
-        using Callback_interface = std::unique_ptr<Callback_interface<Parameter_types...>>;
+        // Fits an object pointer with a member function pointer or a lambda that captures a few pointers
+        static constexpr size_t INLINE_SIZE = 4 * sizeof(void*);
+
+        Delegate() = default;
+
+        ~Delegate()
+        {
+            reset();
+        }
+
+        Delegate(const Delegate&) = delete;
+        Delegate& operator=(const Delegate&) = delete;
+
+        Delegate(Delegate&& other) noexcept
+        {
+            move_from(other);
+        }
+
+        Delegate& operator=(Delegate&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                move_from(other);
+            }
+
+            return *this;
+        }
 
         /**
          *   Sets the callable that gets called when this delegate is broadcasted
@@ -21,22 +56,26 @@ namespace Net
         template <typename Callable_type>
         void set_callback(Callable_type callable)
         {
-            using Callback_type = Callback<Callable_type, Parameter_types...>;
+            reset();
 
-            m_callback = std::make_unique<Callback_type>(std::forward<Callable_type>(callable));
+            if constexpr (IS_INLINE<Callable_type>)
+                new (m_storage.data()) Callable_type(std::move(callable));
+            else
+                new (m_storage.data()) Callable_type*(new Callable_type(std::move(callable)));
+
+            m_invoke = &invoke<Callable_type>;
+            m_manage = &manage<Callable_type>;
         }
 
         template <typename Obj, typename Callable_type>
         void set_callback(Obj* obj, Callable_type callable)
         {
-            using Callback_type = Object_callback<Obj, Callable_type, Parameter_types...>;
-
-            m_callback = std::make_unique<Callback_type>(obj, std::forward<Callable_type>(callable));
+            set_callback(Object_callback<Obj, Callable_type>{obj, std::move(callable)});
         }
 
         [[nodiscard]] bool has_been_set() const noexcept
         {
-            return m_callback != nullptr;
+            return m_invoke != nullptr;
         }
 
         /**
@@ -50,11 +89,96 @@ namespace Net
             if (!has_been_set())
                 return false;
 
-            m_callback->invoke(std::forward<Parameter_types>(parameters)...);
+            m_invoke(m_storage.data(), std::forward<Parameter_types>(parameters)...);
             return true;
         }
 
     private:
-        Callback_interface m_callback;
+        enum class Operation : uint8_t
+        {
+            // Moves the callable to the other storage and destroys it from this one
+            move,
+            destroy
+        };
+
+        template <typename Obj, typename Callable_type>
+        struct Object_callback
+        {
+            void operator()(Parameter_types... parameters)
+            {
+                std::invoke(m_callback, m_obj, std::forward<Parameter_types>(parameters)...);
+            }
+
+            Obj* m_obj;
+            Callable_type m_callback;
+        };
+
+        // Inline callables are moved when the delegate is moved so they can't throw
+        template <typename Callable_type>
+        static constexpr bool IS_INLINE = sizeof(Callable_type) <= INLINE_SIZE &&
+                                          alignof(Callable_type) <= alignof(std::max_align_t) &&
+                                          std::is_nothrow_move_constructible_v<Callable_type>;
+
+        template <typename Callable_type>
+        [[nodiscard]] static Callable_type& get(void* storage) noexcept
+        {
+            if constexpr (IS_INLINE<Callable_type>)
+                return *std::launder(reinterpret_cast<Callable_type*>(storage));
+            else
+                return **std::launder(reinterpret_cast<Callable_type**>(storage));
+        }
+
+        template <typename Callable_type>
+        static void invoke(void* storage, Parameter_types... parameters)
+        {
+            std::invoke(get<Callable_type>(storage), std::forward<Parameter_types>(parameters)...);
+        }
+
+        template <typename Callable_type>
+        static void manage(Operation operation, void* storage, void* other_storage) noexcept
+        {
+            if constexpr (IS_INLINE<Callable_type>)
+            {
+                Callable_type& callable = get<Callable_type>(storage);
+
+                if (operation == Operation::move)
+                    new (other_storage) Callable_type(std::move(callable));
+
+                callable.~Callable_type();
+            }
+            else
+            {
+                // Only the pointer is moved
+                Callable_type* callable = &get<Callable_type>(storage);
+
+                if (operation == Operation::move)
+                    new (other_storage) Callable_type*(callable);
+                else
+                    delete callable;
+            }
+        }
+
+        void reset() noexcept
+        {
+            if (m_manage != nullptr)
+                m_manage(Operation::destroy, m_storage.data(), nullptr);
+
+            m_invoke = nullptr;
+            m_manage = nullptr;
+        }
+
+        void move_from(Delegate& other) noexcept
+        {
+            if (other.m_manage != nullptr)
+                other.m_manage(Operation::move, other.m_storage.data(), m_storage.data());
+
+            m_invoke = std::exchange(other.m_invoke, nullptr);
+            m_manage = std::exchange(other.m_manage, nullptr);
+        }
+
+        // Callback is called from the const broadcast like the earlier delegates that held it through a pointer
+        alignas(std::max_align_t) mutable std::array<std::byte, INLINE_SIZE> m_storage = {};
+        void (*m_invoke)(void*, Parameter_types...) = nullptr;
+        void (*m_manage)(Operation, void*, void*) noexcept = nullptr;
     };
 } // namespace Net
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "../Message/Message_header.h"
+#include "Delegate.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Net
+{
+    /**
+     *   Table of the callbacks of the message ids so the received messages are dispatched straight to their handler.
+     *   Ids with a one byte underlying type are stored in an array indexed by the id, larger ids in a hash map.
+     */
+    template <Id_concept Id_type, typename... Parameter_types>
+    class Message_handlers
+    {
+    public:
+        using Handler_type = Delegate<Parameter_types...>;
+
+        static constexpr bool IS_DENSE = sizeof(Id_type) == 1;
+
+        /**
+         *   Sets the callable that gets called for the messages of the id, replaces the earlier handler
+         *
+         *   @param the message id
+         *   @param any callable with correct parameter types and void return type
+         */
+        template <typename Callable_type>
+        void set_handler(Id_type id, Callable_type callable)
+        {
+            get_or_add(id).set_callback(std::forward<Callable_type>(callable));
+        }
+
+        template <typename Obj, typename Callable_type>
+        void set_handler(Id_type id, Obj* obj, Callable_type callable)
+        {
+            get_or_add(id).set_callback(obj, std::forward<Callable_type>(callable));
+        }
+
+        void remove_handler(Id_type id)
+        {
+            if constexpr (IS_DENSE)
+                m_handlers[index(id)] = Handler_type();
+            else
+                m_handlers.erase(id);
+        }
+
+        // @return the handler of the id or nullptr if the id has no handler
+        [[nodiscard]] const Handler_type* find(Id_type id) const noexcept
+        {
+            if constexpr (IS_DENSE)
+            {
+                const Handler_type& handler = m_handlers[index(id)];
+                return handler.has_been_set() ? &handler : nullptr;
+            }
+            else
+            {
+                const auto found_handler = m_handlers.find(id);
+                return found_handler != m_handlers.end() ? &found_handler->second : nullptr;
+            }
+        }
+
+    private:
+        using Dense_container = std::array<Handler_type, std::numeric_limits<uint8_t>::max() + 1>;
+        using Sparse_container = std::unordered_map<Id_type, Handler_type>;
+
+        [[nodiscard]] static size_t index(Id_type id) noexcept
+        {
+            return static_cast<uint8_t>(id);
+        }
+
+        [[nodiscard]] Handler_type& get_or_add(Id_type id)
+        {
+            if constexpr (IS_DENSE)
+                return m_handlers[index(id)];
+            else
+                return m_handlers[id];
+        }
+
+        std::conditional_t<IS_DENSE, Dense_container, Sparse_container> m_handlers = {};
+    };
+} // namespace Net
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "Fixed_size_messages.h"
+#include "Message_header.h"
+#include "String_limits.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Net
+{
+    // Rate of the received messages, the rates that are 0 are not limited
+    struct Rate_limit
+    {
+        double m_messages_per_second = 0;
+        double m_bytes_per_second = 0;
+
+        // How much can be received at once over the rate, one second of the rate if 0
+        double m_burst_messages = 0;
+        double m_burst_bytes = 0;
+    };
+
+    /**
+     *   Where the received messages of the id are handled.
+     *   update_thread queues them for the update and io_thread gives them to the handler right away on the asio
+     *   thread that received them.
+     */
+    enum class Dispatch_policy : uint8_t
+    {
+        update_thread,
+        io_thread
+    };
+
+    struct Message_limits
+    {
+        uint32_t m_min = 0, m_max = 0;
+
+        // Limit for the messages of the id from one peer, in addition to the limit of the whole peer
+        std::optional<Rate_limit> m_rate_limit = std::nullopt;
+
+        Dispatch_policy m_dispatch_policy = Dispatch_policy::update_thread;
+
+        // Received messages of the id are dropped while the user is overloaded, see the Overload_settings
+        bool m_is_sheddable = false;
+
+        // Strings read from the messages of the id with the limits of the User::get_string_limits
+        String_limits m_string_limits;
+    };
+
+    // Body sizes that an uncompressed user message of the id may have, the min is over the max if it's not accepted
+    struct Size_bounds
+    {
+        uint64_t m_min = 1;
+        uint64_t m_max = 0;
+
+        // Compact header of the id leaves the size out, see the Fixed_size_messages
+        bool m_is_fixed = false;
+    };
+
+    /**
+     *   Limits of the accepted message ids, searched for every received message.
+     *   Ids with a one byte underlying type are stored in an array indexed by the id so the search does not hash,
+     *   larger ids are stored in a hash map.
+     */
+    template <Id_concept Id_type>
+    class Accepted_messages
+    {
+    public:
+        static constexpr bool IS_DENSE = sizeof(Id_type) == 1;
+
+        /**
+         *   @param the id to be accepted
+         *   @param the limits of the id
+         *   @return false if the id was already accepted, its limits are not changed then
+         */
+        bool emplace(Id_type id, const Message_limits& limits)
+        {
+            if constexpr (IS_DENSE)
+            {
+                std::optional<Message_limits>& slot = m_limits[index(id)];
+
+                if (slot.has_value())
+                    return false;
+
+                slot = limits;
+
+                // Fixed size is checked instead of the limits, see the Connection::validate_header
+                const std::optional<Header_size_type> fixed_size = get_fixed_message_size(id);
+                m_size_bounds[index(id)] = fixed_size ? Size_bounds{*fixed_size, *fixed_size, true}
+                                                      : Size_bounds{limits.m_min, limits.m_max, false};
+                return true;
+            }
+            else
+                return m_limits.emplace(id, limits).second;
+        }
+
+        // @return the limits of the id or nullptr if the id is not accepted
+        [[nodiscard]] auto* find(this auto& self, Id_type id) noexcept
+        {
+            if constexpr (IS_DENSE)
+            {
+                auto& slot = self.m_limits[index(id)];
+                return slot.has_value() ? &*slot : nullptr;
+            }
+            else
+            {
+                const auto found_limits = self.m_limits.find(id);
+                return found_limits != self.m_limits.end() ? &found_limits->second : nullptr;
+            }
+        }
+
+        /**
+         *   Sizes of the ids are in one flat table so a run of received headers is checked without the optionals
+         *
+         *   @return the body sizes of the uncompressed user messages of the id
+         */
+        [[nodiscard]] const Size_bounds& get_size_bounds(Id_type id) const noexcept
+            requires IS_DENSE
+        {
+            return m_size_bounds[index(id)];
+        }
+
+        [[nodiscard]] bool contains(Id_type id) const noexcept
+        {
+            return find(id) != nullptr;
+        }
+
+        // @return true if the predicate is true for the limits of any accepted id
+        template <typename Predicate_type>
+        [[nodiscard]] bool any_of(Predicate_type predicate) const
+        {
+            if constexpr (IS_DENSE)
+                return std::ranges::any_of(
+                    m_limits, [&predicate](const auto& slot) { return slot.has_value() && predicate(*slot); });
+            else
+                return std::ranges::any_of(
+                    m_limits, [&predicate](const auto& limits) { return predicate(limits.second); });
+        }
+
+    private:
+        using Dense_container = std::array<std::optional<Message_limits>, std::numeric_limits<uint8_t>::max() + 1>;
+        using Sparse_container = std::unordered_map<Id_type, Message_limits>;
+
+        [[nodiscard]] static size_t index(Id_type id) noexcept
+        {
+            return static_cast<uint8_t>(id);
+        }
+
+        std::conditional_t<IS_DENSE, Dense_container, Sparse_container> m_limits = {};
+
+        // Ids that are not accepted keep the rejecting default, only used for the dense ids
+        std::array<Size_bounds, IS_DENSE ? std::numeric_limits<uint8_t>::max() + 1 : 0> m_size_bounds = {};
+    };
+} // namespace Net
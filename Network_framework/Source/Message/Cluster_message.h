@@ -0,0 +1,144 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include "Message_reader.h"
+#include "Message_writer.h"
+#include <cstdint>
+#include <string_view>
+
+namespace Net
+{
+    // First message on the link between the cluster nodes, the server accepts the link only with the same key
+    struct Cluster_hello
+    {
+        uint32_t m_node_id = 0;
+        uint64_t m_cluster_key = 0;
+    };
+
+    /**
+     *   Messages that the cluster nodes send on their links. A routed message is the message of the user with the
+     *   id of the target client as a trailer, and a publish batch has the published messages one after another
+     *   so they are read in the order they were published.
+     */
+    template <Id_concept Id_type>
+    class Cluster_message
+    {
+    public:
+        static constexpr size_t HELLO_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+        static constexpr size_t ROUTE_TRAILER_SIZE = sizeof(uint32_t);
+
+        // Batch is sent before it grows over this, only a larger message is sent alone in a larger batch
+        static constexpr size_t MAX_PUBLISH_BATCH_SIZE = 1024 * 1024;
+
+        // Topic, id and the length prefix of the body that each published message has in the batch
+        static constexpr size_t MAX_PUBLISH_OVERHEAD =
+            sizeof(uint64_t) + sizeof(Id_type) + MAX_LENGTH_PREFIX_SIZE<Id_type>;
+
+        Cluster_message() = delete;
+
+        [[nodiscard]] static Message<Id_type> create_hello(const Cluster_hello& hello)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::cluster_hello);
+
+            Message_writer<Id_type> writer(output);
+            writer.write(hello.m_node_id);
+            writer.write(hello.m_cluster_key);
+
+            return output;
+        }
+
+        // @throws if the body is too small to be a hello
+        [[nodiscard]] static Cluster_hello extract_hello(const Message<Id_type>& message)
+        {
+            Message_reader<Id_type> reader(message);
+
+            Cluster_hello hello;
+            hello.m_node_id = reader.template read<uint32_t>();
+            hello.m_cluster_key = reader.template read<uint64_t>();
+
+            return hello;
+        }
+
+        /**
+         *   @param the message of the user, it keeps its id
+         *   @param the client on the node that receives the message
+         */
+        [[nodiscard]] static Message<Id_type> create_route(Message<Id_type> message, uint32_t client_id)
+        {
+            const uint32_t little_endian_id = to_little_endian(client_id);
+
+            message.set_internal_id(Internal_id::cluster_route);
+            message.push_back_buffer(&little_endian_id, sizeof(little_endian_id));
+            return message;
+        }
+
+        /**
+         *   Removes the trailer so the message is the one that the user sent
+         *
+         *   @return the id of the target client
+         *   @throws if the message is too small to have the trailer
+         */
+        static uint32_t extract_route(Message<Id_type>& message)
+        {
+            uint32_t client_id = 0;
+            message.extract_to_buffer(&client_id, sizeof(client_id));
+            message.set_internal_id(Internal_id::not_internal);
+
+            return from_little_endian(client_id);
+        }
+
+        // @return the bytes that the message takes in the publish batch
+        [[nodiscard]] static size_t get_publish_size(const Message<Id_type>& message) noexcept
+        {
+            const size_t length_size = Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint
+                                           ? varint_size(message.body_size())
+                                           : sizeof(Length_type<Id_type>);
+
+            return sizeof(uint64_t) + sizeof(Id_type) + length_size + message.body_size();
+        }
+
+        /**
+         *   Adds the published message to the end of the batch. The batch has the id of its first message, so a
+         *   batch of one large message is validated with the limits of its id.
+         */
+        static void append_publish(Message<Id_type>& batch, uint64_t topic, const Message<Id_type>& message)
+        {
+            if (batch.body_size() == 0)
+                batch.set_id(message.get_id());
+
+            batch.set_internal_id(Internal_id::cluster_publish);
+
+            Message_writer<Id_type> writer(batch);
+            writer.write(topic);
+            writer.write(message.get_id());
+            writer.write(std::string_view(message.body_data(), message.body_size()));
+        }
+
+        /**
+         *   Calls the callable with every published message of the batch in order
+         *
+         *   @param callable that takes uint64_t topic and Message<Id_type>&
+         *   @throws if the batch is malformed, the messages before the malformed one have been given already
+         */
+        template <typename Callable_type>
+        static void for_each_publish(const Message<Id_type>& batch, Callable_type&& callable)
+        {
+            Message_reader<Id_type> reader(batch);
+
+            while (!reader.is_at_end())
+            {
+                const uint64_t topic = reader.template read<uint64_t>();
+                const Id_type id = reader.template read<Id_type>();
+                const std::string_view body = reader.read_string_view();
+
+                Message<Id_type> message;
+                message.set_id(id);
+                message.push_back_buffer(body.data(), body.size());
+
+                callable(topic, message);
+            }
+        }
+    };
+} // namespace Net
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "../Utility/Crc32c.h"
+#include "Fixed_size_messages.h"
+#include "Message_header.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <span>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Packed wire format for the Message_header.
+     *   The first byte is a magic value and the second has the internal id in the high four bits, the body encoding
+     *   in the next two bits and the width code of the size in the low two bits. After them comes the id and then
+     *   the size which takes 1, 2, 4 or 8 bytes depending on how large it is. Both are in little endian.
+     *   Internal id that does not fit the four bits has all of them set and follows the size in its own byte.
+     *   Uncompressed user messages of the Fixed_size_messages have no size, the width code 0 means that for
+     *   them and the messages of another size use atleast the two byte width.
+     *   Checked header has its own magic value and ends with the crc32c of the header before it and the body.
+     */
+    template <Id_concept Id_type>
+    class Compact_header
+    {
+    public:
+        Compact_header() = delete;
+
+        // Bytes needed to know the size of the whole header
+        static constexpr size_t PREFIX_SIZE = 2 + sizeof(Id_type);
+
+        static constexpr size_t CHECKSUM_SIZE = sizeof(uint32_t);
+
+        static constexpr size_t MAX_SIZE = PREFIX_SIZE + sizeof(Header_size_type) + 1 + CHECKSUM_SIZE;
+
+        // Never the same as the first byte of the standard header so the formats can be told apart
+        static constexpr uint8_t MAGIC = 0xC5;
+        static constexpr uint8_t CHECKED_MAGIC = 0xC6;
+
+        // @param atleast PREFIX_SIZE bytes of the header
+        [[nodiscard]] static bool is_compact(const char* prefix) noexcept
+        {
+            return static_cast<uint8_t>(prefix[0]) == MAGIC;
+        }
+
+        // @param atleast PREFIX_SIZE bytes of the header
+        [[nodiscard]] static bool is_checked(const char* prefix) noexcept
+        {
+            return static_cast<uint8_t>(prefix[0]) == CHECKED_MAGIC;
+        }
+
+        /**
+         *   @param atleast PREFIX_SIZE bytes of the header
+         *   @return the size of the whole header
+         */
+        [[nodiscard]] static size_t encoded_size(const char* prefix) noexcept
+        {
+            const uint8_t flags = static_cast<uint8_t>(prefix[1]);
+
+            return PREFIX_SIZE + size_field_width(prefix) + (is_internal_id_extended(flags) ? 1 : 0) +
+                   (is_checked(prefix) ? CHECKSUM_SIZE : 0);
+        }
+
+        /**
+         *   @param the header to encode
+         *   @param buffer with atleast MAX_SIZE bytes
+         *   @param the parts of the body in the order they are sent if the header is checked
+         *   @return number of bytes written
+         */
+        static size_t encode(
+            const Message_header<Id_type>& header, char* output, bool is_checked_header = false,
+            std::initializer_list<std::span<const char>> body_parts = {}) noexcept
+        {
+            const std::optional<Header_size_type> fixed_size = get_fixed_message_size(header);
+            const bool is_size_implicit = fixed_size && header.m_size == *fixed_size;
+            uint8_t size_code = is_size_implicit ? IMPLICIT_SIZE_CODE : size_code_for(header.m_size);
+
+            // Fixed size id of another size can't use the code that leaves the size out
+            if (fixed_size && !is_size_implicit && size_code == IMPLICIT_SIZE_CODE)
+                size_code = 1;
+
+            const size_t size_width = is_size_implicit ? 0 : size_field_width(size_code);
+            const uint8_t internal_id = static_cast<uint8_t>(header.m_internal_id);
+            const bool is_extended = internal_id >= EXTENDED_INTERNAL_ID;
+            const uint8_t body_encoding = static_cast<uint8_t>(header.m_body_encoding);
+
+            output[0] = static_cast<char>(is_checked_header ? CHECKED_MAGIC : MAGIC);
+            output[1] = static_cast<char>(
+                ((is_extended ? EXTENDED_INTERNAL_ID : internal_id) << INTERNAL_ID_SHIFT) |
+                (body_encoding << BODY_ENCODING_SHIFT) | size_code);
+
+            write_little_endian(static_cast<Id_bits>(header.m_id), output + 2, sizeof(Id_type));
+            write_little_endian(header.m_size, output + PREFIX_SIZE, size_width);
+
+            size_t checksum_offset = PREFIX_SIZE + size_width;
+
+            if (is_extended)
+                output[checksum_offset++] = static_cast<char>(internal_id);
+
+            if (!is_checked_header)
+                return checksum_offset;
+
+            const size_t header_size = checksum_offset + CHECKSUM_SIZE;
+            const uint32_t checksum = compute_checksum(output, header_size, body_parts);
+            write_little_endian(checksum, output + checksum_offset, CHECKSUM_SIZE);
+
+            return header_size;
+        }
+
+        /**
+         *   @param checked header with its encoded_size bytes
+         *   @param size of the header
+         *   @param the parts of the body in the order they were received
+         *   @return crc32c of the header before the checksum and the body
+         */
+        [[nodiscard]] static uint32_t compute_checksum(
+            const char* header, size_t header_size, std::initializer_list<std::span<const char>> body_parts) noexcept
+        {
+            uint32_t checksum = Crc32c::extend(0, {header, header_size - CHECKSUM_SIZE});
+
+            for (const std::span<const char> part : body_parts)
+                checksum = Crc32c::extend(checksum, part);
+
+            return checksum;
+        }
+
+        // @return the checksum that was sent in the checked header
+        [[nodiscard]] static uint32_t read_checksum(const char* header, size_t header_size) noexcept
+        {
+            return static_cast<uint32_t>(read_little_endian(header + header_size - CHECKSUM_SIZE, CHECKSUM_SIZE));
+        }
+
+        // @param buffer with atleast encoded_size bytes
+        [[nodiscard]] static Message_header<Id_type> decode(const char* input) noexcept
+        {
+            const uint8_t flags = static_cast<uint8_t>(input[1]);
+
+            Message_header<Id_type> header;
+            header.m_internal_id = static_cast<Internal_id>(flags >> INTERNAL_ID_SHIFT);
+            header.m_body_encoding = static_cast<Body_encoding>((flags >> BODY_ENCODING_SHIFT) & BODY_ENCODING_MASK);
+            header.m_id = static_cast<Id_type>(static_cast<Id_bits>(read_little_endian(input + 2, sizeof(Id_type))));
+
+            // Size is left out only from the messages of the fixed size ids. Sizes wider than the header of the id
+            // saturate so the size limits reject them.
+            const size_t size_width = size_field_width(input);
+            const uint64_t size = size_width == 0 ? *get_fixed_message_size(header)
+                                                  : read_little_endian(input + PREFIX_SIZE, size_width);
+            header.m_size = static_cast<typename Message_header<Id_type>::Size_type>(
+                std::min<uint64_t>(size, std::numeric_limits<typename Message_header<Id_type>::Size_type>::max()));
+
+            if (is_internal_id_extended(flags))
+                header.m_internal_id = static_cast<Internal_id>(input[PREFIX_SIZE + size_width]);
+
+            return header;
+        }
+
+    private:
+        using Id_bits = std::make_unsigned_t<std::underlying_type_t<Id_type>>;
+
+        static constexpr uint8_t SIZE_CODE_MASK = 0b11;
+        static constexpr uint8_t BODY_ENCODING_SHIFT = 2;
+        static constexpr uint8_t BODY_ENCODING_MASK = 0b11;
+        static constexpr uint8_t INTERNAL_ID_SHIFT = 4;
+
+        // Width code of the size that is left out of the messages of the fixed size ids
+        static constexpr uint8_t IMPLICIT_SIZE_CODE = 0;
+
+        // Internal ids from this on are written in the byte after the size
+        static constexpr uint8_t EXTENDED_INTERNAL_ID = 0xF;
+
+        [[nodiscard]] static constexpr bool is_internal_id_extended(uint8_t flags) noexcept
+        {
+            return (flags >> INTERNAL_ID_SHIFT) == EXTENDED_INTERNAL_ID;
+        }
+
+        [[nodiscard]] static constexpr size_t size_field_width(uint8_t size_code) noexcept
+        {
+            return size_t{1} << size_code;
+        }
+
+        // @return the width of the size of the header that starts with the prefix, 0 if the size is left out
+        [[nodiscard]] static size_t size_field_width(const char* prefix) noexcept
+        {
+            const uint8_t flags = static_cast<uint8_t>(prefix[1]);
+            const uint8_t size_code = flags & SIZE_CODE_MASK;
+
+            if (size_code == IMPLICIT_SIZE_CODE && (flags >> INTERNAL_ID_SHIFT) == 0 &&
+                ((flags >> BODY_ENCODING_SHIFT) & BODY_ENCODING_MASK) == 0 &&
+                get_fixed_message_size(
+                    static_cast<Id_type>(static_cast<Id_bits>(read_little_endian(prefix + 2, sizeof(Id_type))))))
+                return 0;
+
+            return size_field_width(size_code);
+        }
+
+        [[nodiscard]] static constexpr uint8_t size_code_for(Header_size_type size) noexcept
+        {
+            if (size <= UINT8_MAX)
+                return 0;
+
+            if (size <= UINT16_MAX)
+                return 1;
+
+            if (size <= UINT32_MAX)
+                return 2;
+
+            return 3;
+        }
+
+        static void write_little_endian(uint64_t value, char* output, size_t bytes) noexcept
+        {
+            for (size_t i = 0; i < bytes; ++i)
+                output[i] = static_cast<char>((value >> (i * 8)) & 0xFF);
+        }
+
+        [[nodiscard]] static uint64_t read_little_endian(const char* input, size_t bytes) noexcept
+        {
+            uint64_t value = 0;
+
+            for (size_t i = 0; i < bytes; ++i)
+                value |= static_cast<uint64_t>(static_cast<uint8_t>(input[i])) << (i * 8);
+
+            return value;
+        }
+    };
+} // namespace Net
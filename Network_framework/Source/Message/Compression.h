@@ -0,0 +1,281 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+/**
+ *   The codecs are only available when the library is found at build time.
+ *   Define NET_USE_LZ4 and link lz4 or define NET_USE_ZSTD and link zstd to enable them.
+ */
+#ifdef NET_USE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef NET_USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace Net
+{
+    enum class Compression_codec : uint8_t
+    {
+        none,
+
+        // Fast compression for latency
+        lz4,
+
+        // Slower but better compression ratio
+        zstd
+    };
+
+    enum class Compression_mode : uint8_t
+    {
+        // Every message is compressed on its own
+        per_message,
+
+        // Connection keeps the compression history so the messages can refer to the earlier messages
+        stream
+    };
+
+    /**
+     *   Data that both sides have before the connection, the stream compression starts with it as the history
+     *   so even the first small messages compress well. The hash is used to check both sides have the same data.
+     */
+    struct Compression_dictionary
+    {
+        std::vector<char> m_data;
+        uint64_t m_hash = 0;
+    };
+
+    // FNV-1a hash of the dictionary data
+    [[nodiscard]] inline uint64_t compression_dictionary_hash(std::span<const char> data) noexcept
+    {
+        uint64_t hash = 0xCBF29CE484222325;
+
+        for (const char byte : data)
+        {
+            hash ^= static_cast<uint8_t>(byte);
+            hash *= 0x100000001B3;
+        }
+
+        return hash;
+    }
+
+    [[nodiscard]] inline std::shared_ptr<const Compression_dictionary> make_compression_dictionary(
+        std::vector<char> data)
+    {
+        const uint64_t hash = compression_dictionary_hash(data);
+        return std::make_shared<const Compression_dictionary>(std::move(data), hash);
+    }
+
+    /**
+     *   Reads the whole file as the dictionary, for examble one trained with zstd --train
+     *
+     *   @throws if the file can't be read
+     */
+    [[nodiscard]] inline std::shared_ptr<const Compression_dictionary> load_compression_dictionary(
+        const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file)
+            throw std::runtime_error("Failed to open the compression dictionary " + path.string());
+
+        std::vector<char> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+        if (file.bad())
+            throw std::runtime_error("Failed to read the compression dictionary " + path.string());
+
+        return make_compression_dictionary(std::move(data));
+    }
+
+    /**
+     *   How the connection compresses message bodies.
+     *   Only bodies with atleast m_min_size bytes are compressed. In per message mode they are sent compressed
+     *   only if that made them smaller, in stream mode they are always sent compressed because the history of
+     *   both sides has to stay the same. The level is passed to zstd and ignored by lz4.
+     *   Stream mode and the dictionary are used only if both sides have them.
+     */
+    struct Compression_settings
+    {
+        Compression_codec m_codec = Compression_codec::none;
+        size_t m_min_size = 1024;
+        int m_level = 1;
+        Compression_mode m_mode = Compression_mode::per_message;
+        std::shared_ptr<const Compression_dictionary> m_dictionary = nullptr;
+
+        // @return hash of the dictionary or 0 if there is none
+        [[nodiscard]] uint64_t dictionary_hash() const noexcept
+        {
+            return m_dictionary != nullptr ? m_dictionary->m_hash : 0;
+        }
+    };
+
+    /**
+     *   Compresses and decompresses message bodies. Compressed body starts with the codec and
+     *   the original size in little endian so the receiver can check the size before decompressing.
+     */
+    class Compression
+    {
+    public:
+        Compression() = delete;
+
+        static constexpr size_t PREFIX_SIZE = sizeof(Compression_codec) + sizeof(uint64_t);
+
+        // Writes the codec and the original size to the start of the compressed body
+        static void write_prefix(Compression_codec codec, size_t original_size, char* output) noexcept
+        {
+            const uint64_t little_endian_size = to_little_endian(static_cast<uint64_t>(original_size));
+            output[0] = static_cast<char>(codec);
+            std::memcpy(output + sizeof(Compression_codec), &little_endian_size, sizeof(little_endian_size));
+        }
+
+        [[nodiscard]] static constexpr bool is_available(Compression_codec codec) noexcept
+        {
+            switch (codec)
+            {
+            case Compression_codec::none:
+                return true;
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4:
+                return true;
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd:
+                return true;
+#endif
+            default:
+                return false;
+            }
+        }
+
+        /**
+         *   @param the settings to use
+         *   @param the body to compress
+         *   @param where the compressed body is written
+         *   @return false if the body was not compressed because it would not become smaller
+         */
+        static bool compress(
+            const Compression_settings& settings, std::span<const char> body, std::vector<char>& output)
+        {
+            if (settings.m_codec == Compression_codec::none || body.size() < settings.m_min_size)
+                return false;
+
+            output.resize(PREFIX_SIZE + compress_bound(settings.m_codec, body.size()));
+
+            const size_t compressed_size = compress_data(settings, body, std::span(output).subspan(PREFIX_SIZE));
+
+            if (compressed_size == 0 || PREFIX_SIZE + compressed_size >= body.size())
+                return false;
+
+            write_prefix(settings.m_codec, body.size(), output.data());
+            output.resize(PREFIX_SIZE + compressed_size);
+            return true;
+        }
+
+        // @return the original size of the compressed body or nothing if the prefix is invalid
+        [[nodiscard]] static std::optional<size_t> decompressed_size(std::span<const char> compressed) noexcept
+        {
+            if (compressed.size() < PREFIX_SIZE || !is_available(static_cast<Compression_codec>(compressed[0])))
+                return std::nullopt;
+
+            uint64_t original_size = 0;
+            std::memcpy(&original_size, compressed.data() + sizeof(Compression_codec), sizeof(original_size));
+            original_size = from_little_endian(original_size);
+
+            if (original_size > SIZE_MAX)
+                return std::nullopt;
+
+            return static_cast<size_t>(original_size);
+        }
+
+        /**
+         *   @param the compressed body
+         *   @param where the body is decompressed, it has to be exactly decompressed_size bytes
+         *   @return false if the data was invalid
+         */
+        [[nodiscard]] static bool decompress(
+            std::span<const char> compressed, [[maybe_unused]] std::span<char> output) noexcept
+        {
+            const auto codec = static_cast<Compression_codec>(compressed[0]);
+            [[maybe_unused]] const std::span<const char> data = compressed.subspan(PREFIX_SIZE);
+
+            switch (codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4: {
+                const int size = LZ4_decompress_safe(
+                    data.data(), output.data(), static_cast<int>(data.size()), static_cast<int>(output.size()));
+                return size >= 0 && static_cast<size_t>(size) == output.size();
+            }
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd: {
+                const size_t size = ZSTD_decompress(output.data(), output.size(), data.data(), data.size());
+                return !ZSTD_isError(size) && size == output.size();
+            }
+#endif
+            default:
+                return false;
+            }
+        }
+
+        // @return the largest size the data can have after compressing, without the prefix
+        [[nodiscard]] static size_t compress_bound(Compression_codec codec, [[maybe_unused]] size_t size) noexcept
+        {
+            switch (codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4:
+                return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd:
+                return ZSTD_compressBound(size);
+#endif
+            default:
+                return 0;
+            }
+        }
+
+    private:
+        // @return size of the compressed data or 0 on failure
+        [[nodiscard]] static size_t compress_data(
+            const Compression_settings& settings, [[maybe_unused]] std::span<const char> body,
+            [[maybe_unused]] std::span<char> output) noexcept
+        {
+            switch (settings.m_codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4: {
+                if (body.size() > LZ4_MAX_INPUT_SIZE)
+                    return 0;
+
+                const int size = LZ4_compress_default(
+                    body.data(), output.data(), static_cast<int>(body.size()), static_cast<int>(output.size()));
+                return size > 0 ? static_cast<size_t>(size) : 0;
+            }
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd: {
+                const size_t size =
+                    ZSTD_compress(output.data(), output.size(), body.data(), body.size(), settings.m_level);
+                return ZSTD_isError(size) ? 0 : size;
+            }
+#endif
+            default:
+                return 0;
+            }
+        }
+    };
+} // namespace Net
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "Message.h"
+#include "String_limits.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Message with the body stored inside the object up to the compile time capacity, it never allocates.
+     *   Data is pushed and extracted like with the Message and in the same format, so the Message on the other
+     *   side reads it as usual. Converting to the Message for the sending does not allocate either when the
+     *   capacity is atmost the Message::INLINE_BODY_SIZE, raise the NET_MESSAGE_INLINE_BODY_SIZE to cover it.
+     *   On the receiving side the User::set_max_message_size rejects the larger frames when their header is
+     *   validated, so every received message fits:
+     *
+     *   client.set_max_message_size(Fixed_message<Message_id, 128>::CAPACITY);
+     */
+    template <Id_concept Id_type, size_t Capacity>
+    class Fixed_message
+    {
+    public:
+        using Size_type = typename Message<Id_type>::Size_type;
+        using Header_size_type = typename Message_header<Id_type>::Size_type;
+
+        static constexpr size_t CAPACITY = Capacity;
+
+        static_assert(CAPACITY <= std::numeric_limits<Header_size_type>::max(), "Capacity does not fit to the header");
+
+        Fixed_message() noexcept = default;
+
+        explicit Fixed_message(Id_type id) noexcept
+        {
+            m_header.m_id = id;
+        }
+
+        // @return nothing if the body of the message does not fit
+        [[nodiscard]] static std::optional<Fixed_message> from_message(const Message<Id_type>& message) noexcept
+        {
+            if (message.body_size() > CAPACITY)
+                return std::nullopt;
+
+            Fixed_message output;
+            output.m_header = message.get_header();
+            output.m_header.m_size = static_cast<Header_size_type>(message.body_size());
+
+            if (message.body_size() > 0)
+                std::memcpy(output.m_body.data(), message.body_data(), message.body_size());
+
+            return output;
+        }
+
+        // @return the message for the send functions, its body stays inside it when the capacity fits there
+        [[nodiscard]] Message<Id_type> to_message() const
+        {
+            Message<Id_type> output;
+            output.reserve(body_size());
+            output.set_id(m_header.m_id);
+            output.push_back_buffer(m_body.data(), body_size());
+
+            return output;
+        }
+
+        /**
+         *   Copies the buffer to the end of the body
+         *
+         *   @throws std::length_error if the body would grow over the capacity
+         */
+        void push_back_buffer(const void* buffer, size_t buffer_size)
+        {
+            if (buffer_size > CAPACITY - body_size())
+                throw std::length_error("Storing too much data to fixed message");
+
+            if (buffer_size > 0)
+                std::memcpy(m_body.data() + body_size(), buffer, buffer_size);
+
+            m_header.m_size += static_cast<Header_size_type>(buffer_size);
+        }
+
+        /**
+         *   Pushes the data or the string followed by its size to the end of the body
+         *
+         *   @throws std::length_error if the body would grow over the capacity
+         */
+        template <typename Data_type>
+        void push_back(const Data_type& data)
+        {
+            if constexpr (std::is_same_v<Data_type, std::string> || std::is_same_v<Data_type, std::string_view>)
+            {
+                if (data.size() > MAX_PREFIXED_LENGTH<Id_type>)
+                    throw std::length_error("Length does not fit to the length prefix");
+
+                std::array<char, MAX_VARINT_SIZE> length;
+                size_t length_size = sizeof(Size_type);
+
+                if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+                    length_size = encode_reversed_varint(data.size(), length.data());
+                else
+                {
+                    const auto fixed_length = static_cast<Size_type>(data.size());
+                    std::memcpy(length.data(), &fixed_length, length_size);
+                }
+
+                if (data.size() > CAPACITY - body_size() || CAPACITY - body_size() - data.size() < length_size)
+                    throw std::length_error("Storing too much data to fixed message");
+
+                push_back_buffer(data.data(), data.size());
+                push_back_buffer(length.data(), length_size);
+            }
+            else
+            {
+                static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+                push_back_buffer(&data, sizeof(data));
+            }
+        }
+
+        /**
+         *   Extracts to the buffer from the end of the body
+         *
+         *   @throws std::length_error if there is not enough data
+         */
+        void extract_to_buffer(void* buffer, size_t buffer_size)
+        {
+            if (buffer_size > body_size())
+                throw std::length_error("Not enough data to extract");
+
+            m_header.m_size -= static_cast<Header_size_type>(buffer_size);
+
+            if (buffer_size > 0)
+                std::memcpy(buffer, m_body.data() + body_size(), buffer_size);
+        }
+
+        /**
+         *   Extracts the data from the end of the body
+         *
+         *   @throws std::length_error if there is not enough data
+         */
+        template <typename Data_type>
+        [[nodiscard]] Data_type extract()
+        {
+            static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+
+            Data_type output;
+            extract_to_buffer(&output, sizeof(output));
+            return output;
+        }
+
+        /**
+         *   Views the string at the end of the body and removes it, nothing is allocated
+         *
+         *   @param the limits of the string, see the User::get_string_limits
+         *   @return view to the body, valid until the body is pushed to again
+         *   @throws if there is not enough data, the string is too long or it is not valid UTF-8 when required
+         */
+        [[nodiscard]] std::string_view extract_string_view(const String_limits& limits = {})
+        {
+            uint64_t size = 0;
+
+            if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+            {
+                const size_t length_size = decode_reversed_varint({m_body.data(), body_size()}, size);
+
+                if (length_size == 0)
+                    throw std::length_error("Not enough data to extract");
+
+                m_header.m_size -= static_cast<Header_size_type>(length_size);
+            }
+            else
+            {
+                size = extract<Size_type>();
+            }
+
+            if (size > body_size())
+                throw std::length_error("Not enough data to extract");
+
+            m_header.m_size -= static_cast<Header_size_type>(size);
+
+            const std::string_view output(m_body.data() + body_size(), static_cast<size_t>(size));
+            check_string(output, limits);
+            return output;
+        }
+
+        [[nodiscard]] Id_type get_id() const noexcept
+        {
+            return m_header.m_id;
+        }
+
+        void set_id(Id_type new_id) noexcept
+        {
+            m_header.m_id = new_id;
+        }
+
+        [[nodiscard]] const Message_header<Id_type>& get_header() const noexcept
+        {
+            return m_header;
+        }
+
+        [[nodiscard]] size_t body_size() const noexcept
+        {
+            return static_cast<size_t>(m_header.m_size);
+        }
+
+        [[nodiscard]] auto* body_data(this auto& self) noexcept
+        {
+            return self.m_body.data();
+        }
+
+        [[nodiscard]] bool is_empty() const noexcept
+        {
+            return m_header.m_size == 0;
+        }
+
+        void clear() noexcept
+        {
+            m_header.m_size = 0;
+        }
+
+    private:
+        Message_header<Id_type> m_header;
+
+        // Left uninitialized because only the first m_header.m_size bytes are ever read
+        std::array<char, Capacity> m_body;
+    };
+} // namespace Net
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Message_header.h"
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Declares the message ids whose bodies always have the same size. The compact headers of their
+     *   uncompressed messages leave the size out and the received messages of another size are rejected without
+     *   looking at the Message_limits. Specialize this next to the id type so the server and the client share it:
+     *
+     *   template <>
+     *   struct Net::Fixed_size_messages<Message_id>
+     *   {
+     *       static constexpr std::optional<Header_size_type> get_size(Message_id id) noexcept
+     *       {
+     *           return id == Message_id::position ? std::optional<Header_size_type>(12) : std::nullopt;
+     *       }
+     *   };
+     */
+    template <Id_concept Id_type>
+    struct Fixed_size_messages
+    {
+        // @return the size of the body of the id if it is always the same
+        static constexpr std::optional<Header_size_type> get_size(Id_type) noexcept
+        {
+            return std::nullopt;
+        }
+    };
+
+    // Sizes of the ids with a one byte underlying type by the id
+    template <Id_concept Id_type>
+    inline constexpr std::array<std::optional<Header_size_type>, 256> FIXED_MESSAGE_SIZES = [] {
+        std::array<std::optional<Header_size_type>, 256> sizes = {};
+
+        for (size_t i = 0; i < sizes.size(); ++i)
+            sizes[i] = Fixed_size_messages<Id_type>::get_size(static_cast<Id_type>(i));
+
+        return sizes;
+    }();
+
+    /**
+     *   Ids with a one byte underlying type are looked up from a table built at compile time, the larger ids
+     *   call the get_size of the Fixed_size_messages
+     *
+     *   @param the id of the user message
+     *   @return the size of the body of the id if it is always the same
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] constexpr std::optional<Header_size_type> get_fixed_message_size(Id_type id) noexcept
+    {
+        if constexpr (sizeof(Id_type) == 1)
+            return FIXED_MESSAGE_SIZES<Id_type>[static_cast<uint8_t>(id)];
+        else
+            return Fixed_size_messages<Id_type>::get_size(id);
+    }
+
+    /**
+     *   @param the header of the message
+     *   @return the size of the body if the message is an uncompressed user message of a fixed size id
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] constexpr std::optional<Header_size_type> get_fixed_message_size(
+        const Message_header<Id_type>& header) noexcept
+    {
+        if (header.m_internal_id != Internal_id::not_internal || header.m_body_encoding != Body_encoding::raw)
+            return std::nullopt;
+
+        return get_fixed_message_size(header.m_id);
+    }
+} // namespace Net
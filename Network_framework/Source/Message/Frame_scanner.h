@@ -0,0 +1,115 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Accepted_messages.h"
+#include "Compact_header.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <type_traits>
+
+namespace Net
+{
+    template <Id_concept Id_type>
+    struct Scanned_frame
+    {
+        Message_header<Id_type> m_header;
+        size_t m_header_size = 0;
+    };
+
+    /**
+     *   Decodes and validates the headers of a run of received frames in one pass, for the buffered reads that
+     *   bring hundreds of small messages at once. Only the compact headers of the uncompressed user messages are
+     *   scanned, their prefix and size are read with one load and the size is checked against the flat
+     *   Size_bounds table of the accepted ids. Scanning stops at the first frame that is incomplete, is of
+     *   another kind or fails the checks, the caller handles that frame with the full validation.
+     *
+     *   Frames are variable sized so the position of each header depends on the size in the previous one, which
+     *   is why the headers are scanned one after another instead of many at once with vector instructions.
+     *   Only the ids with a one byte underlying type can be scanned.
+     */
+    template <Id_concept Id_type>
+    class Frame_scanner
+    {
+    public:
+        static constexpr size_t BATCH_SIZE = 32;
+
+        using Batch = std::array<Scanned_frame<Id_type>, BATCH_SIZE>;
+
+        Frame_scanner() = delete;
+
+        /**
+         *   @param the received bytes that start with a frame
+         *   @param the accepted ids
+         *   @param the max body size of the connection
+         *   @param true if the checked headers are accepted, their checksums are not verified here
+         *   @param where the frames are written
+         *   @return the amount of complete and valid frames at the start of the data
+         */
+        [[nodiscard]] static size_t scan(
+            std::span<const char> data, const Accepted_messages<Id_type>& accepted_messages, uint64_t max_body_size,
+            bool is_checked_accepted, Batch& output) noexcept
+        {
+            using Header_type = Compact_header<Id_type>;
+            using Id_bits = std::make_unsigned_t<std::underlying_type_t<Id_type>>;
+            using Size_type = typename Message_header<Id_type>::Size_type;
+
+            // Prefix and the widest size are loaded at once, the frames closer to the end are left to the caller
+            constexpr size_t LOAD_SIZE = Header_type::PREFIX_SIZE + sizeof(uint64_t);
+            constexpr uint8_t SIZE_CODE_MASK = 0b11;
+
+            size_t offset = 0;
+            size_t count = 0;
+
+            while (count < output.size() && data.size() - offset >= LOAD_SIZE)
+            {
+                const char* frame = data.data() + offset;
+                const auto magic = static_cast<uint8_t>(frame[0]);
+                const auto flags = static_cast<uint8_t>(frame[1]);
+                const bool is_checked = magic == Header_type::CHECKED_MAGIC;
+
+                // Internal messages and the compressed bodies have other bits set in the flags
+                if ((magic != Header_type::MAGIC && !(is_checked && is_checked_accepted)) ||
+                    (flags & ~SIZE_CODE_MASK) != 0)
+                    break;
+
+                Id_bits id_bits;
+                std::memcpy(&id_bits, frame + 2, sizeof(id_bits));
+                const auto id = static_cast<Id_type>(from_little_endian(id_bits));
+                const Size_bounds& bounds = accepted_messages.get_size_bounds(id);
+
+                const uint8_t size_code = flags & SIZE_CODE_MASK;
+                const size_t size_width = size_code == 0 && bounds.m_is_fixed ? 0 : size_t{1} << size_code;
+
+                uint64_t size = 0;
+                std::memcpy(&size, frame + Header_type::PREFIX_SIZE, sizeof(size));
+                size = from_little_endian(size);
+
+                if (size_width == 0)
+                    size = bounds.m_min;
+                else if (size_width < sizeof(size))
+                    size &= (uint64_t{1} << (size_width * 8)) - 1;
+
+                const size_t header_size =
+                    Header_type::PREFIX_SIZE + size_width + (is_checked ? Header_type::CHECKSUM_SIZE : 0);
+
+                if (size < bounds.m_min || size > bounds.m_max || size > max_body_size ||
+                    size > std::numeric_limits<Size_type>::max() || header_size > data.size() - offset ||
+                    size > data.size() - offset - header_size)
+                    break;
+
+                Scanned_frame<Id_type>& scanned = output[count++];
+                scanned.m_header = Message_header<Id_type>();
+                scanned.m_header.m_id = id;
+                scanned.m_header.m_size = static_cast<Size_type>(size);
+                scanned.m_header_size = header_size;
+
+                offset += header_size + static_cast<size_t>(size);
+            }
+
+            return count;
+        }
+    };
+} // namespace Net
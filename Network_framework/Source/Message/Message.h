@@ -1,8 +1,15 @@
 #pragma once
 
 #include "../Utility/Common.h"
+#include "../Utility/Small_buffer.h"
+#include "../Utility/Varint.h"
 #include "Message_header.h"
+#include "Message_memory.h"
+#include "String_limits.h"
+#include <memory>
+#include <memory_resource>
 #include <ostream>
+#include <ranges>
 #include <span>
 #include <stdexcept>
 #include <string>
@@ -10,15 +17,44 @@
 #include <type_traits>
 #include <vector>
 
+// Bodies up to this size are stored inside the message without allocating
+#ifndef NET_MESSAGE_INLINE_BODY_SIZE
+#define NET_MESSAGE_INLINE_BODY_SIZE 64
+#endif
+
 namespace Net
 {
+    // @return the amount of bytes needed after the offset to reach the next multiple of alignment
+    [[nodiscard]] constexpr size_t alignment_padding(size_t offset, size_t alignment) noexcept
+    {
+        return (alignment - offset % alignment) % alignment;
+    }
+
     // This class is used to store messages that are sent over internet
     template <Id_concept Id_type>
     class Message
     {
     public:
-        // Type used to store container sizes in the message body
-        using Size_type = uint64_t;
+        // Type used to store container sizes in the message body, see the Message_size_policy
+        using Size_type = Length_type<Id_type>;
+
+        // Type of the body size in the header
+        using Header_size_type = typename Message_header<Id_type>::Size_type;
+
+        static constexpr size_t INLINE_BODY_SIZE = NET_MESSAGE_INLINE_BODY_SIZE;
+
+        // Larger bodies are allocated from the current message memory resource
+        Message() : m_body(get_message_memory_resource())
+        {
+        }
+
+        Message(const Message&) = default;
+        Message(Message&&) noexcept = default;
+
+        ~Message() = default;
+
+        Message& operator=(const Message&) = default;
+        Message& operator=(Message&&) noexcept = default;
 
         // Print operator
         friend std::ostream& operator<<(std::ostream& stream, const Message& message)
@@ -37,11 +73,7 @@ namespace Net
             if (new_size > std::numeric_limits<Header_size_type>::max())
                 throw std::length_error("Storing too much data to message");
 
-            resize_body(new_size);
-
-            // Copying the data to the end of the body
-            std::memcpy(&m_body.at(size), buffer, buffer_size);
-
+            m_body.append(buffer, buffer_size);
             m_header.m_size = checked_cast<Header_size_type>(m_body.size());
         }
 
@@ -58,11 +90,30 @@ namespace Net
             push_back_buffer(&data, sizeof(data));
         }
 
+        /**
+         *   Pushes contiguous range like vector, array or span with one copy followed by the amount of elements
+         *
+         *   @param range to be pushed
+         *   @throws if the size of data is larger than the max value that the Header_size_type can hold
+         */
+        template <std::ranges::contiguous_range Range_type>
+        void push_range(const Range_type& range)
+        {
+            using Value_type = std::ranges::range_value_t<Range_type>;
+            static_assert(std::is_trivially_copyable_v<Value_type>);
+
+            const size_t count = std::ranges::size(range);
+            check_length(count);
+            push_back_buffer(std::ranges::data(range), count * sizeof(Value_type));
+            push_length(count);
+        }
+
         template <>
         void push_back<std::string_view>(const std::string_view& string)
         {
+            check_length(string.size());
             push_back_buffer(string.data(), string.size());
-            push_back(static_cast<Size_type>(string.size()));
+            push_length(string.size());
         }
 
         template <>
@@ -80,7 +131,8 @@ namespace Net
             const size_t new_size = m_body.size() - buffer_size;
 
             // Copying to the buffer from the end of the body
-            std::memcpy(buffer, &m_body.at(new_size), buffer_size);
+            if (buffer_size > 0)
+                std::memcpy(buffer, m_body.data() + new_size, buffer_size);
 
             resize_body(new_size);
             m_header.m_size = checked_cast<Header_size_type>(m_body.size());
@@ -103,11 +155,50 @@ namespace Net
             return *reinterpret_cast<Data_type*>(buffer.data());
         }
 
+        /**
+         *   Extracts range that was pushed with push_range
+         *
+         *   @return the elements in the order they were pushed
+         *   @throws if there is not enough data to be extracted
+         */
+        template <typename Value_type>
+        std::vector<Value_type> extract_range()
+        {
+            static_assert(std::is_trivially_copyable_v<Value_type>);
+
+            const uint64_t count = extract_length();
+
+            if (count > m_body.size() / sizeof(Value_type))
+                throw std::length_error("Not enough data to extract");
+
+            std::vector<Value_type> output(static_cast<size_t>(count));
+            extract_to_buffer(output.data(), output.size() * sizeof(Value_type));
+            return output;
+        }
+
         template <>
         std::string extract<std::string>()
         {
+            return extract_string({});
+        }
+
+        /**
+         *   Extracts string that was pushed with push_back, it is checked before it is copied
+         *
+         *   @param the limits of the string, see the User::get_string_limits
+         *   @throws if there is not enough data, the string is too long or it is not valid UTF-8 when required
+         */
+        std::string extract_string(const String_limits& limits)
+        {
+            const uint64_t size = extract_length();
+
+            if (size > m_body.size())
+                throw std::length_error("Not enough data to extract");
+
+            check_string({m_body.data() + m_body.size() - size, static_cast<size_t>(size)}, limits);
+
             std::string output;
-            output.resize(extract<Size_type>());
+            output.resize(static_cast<size_t>(size));
             extract_to_buffer(output.data(), output.size());
             return output;
         }
@@ -169,6 +260,13 @@ namespace Net
             m_header.m_size = 0;
         }
 
+        // Empties the message for reuse, the body keeps its memory so the next content needs no allocation
+        void reset() noexcept
+        {
+            m_body.clear();
+            m_header = Message_header<Id_type>();
+        }
+
         [[nodiscard]] bool is_empty() const noexcept
         {
             return m_body.empty();
@@ -199,12 +297,107 @@ namespace Net
             return self.m_body.data();
         }
 
+        [[nodiscard]] size_t body_capacity() const noexcept
+        {
+            return m_body.capacity();
+        }
+
+        // @return the resource the body is allocated from when it does not fit inside the message
+        [[nodiscard]] std::pmr::memory_resource* get_body_memory_resource() const noexcept
+        {
+            return m_body.get_resource();
+        }
+
         void resize_body(size_t new_size)
         {
             m_body.resize(new_size);
         }
 
+        /**
+         *   Grows the body and returns the new bytes so they can be written in place
+         *
+         *   @param the amount of bytes added to the end of the body
+         *   @return the added bytes, valid until the body changes again
+         *   @throws if the message would become larger than the header can describe
+         */
+        [[nodiscard]] std::span<char> append_body(size_t size)
+        {
+            const size_t old_size = m_body.size();
+
+            if (size > std::numeric_limits<Header_size_type>::max() - old_size)
+                throw std::length_error("Storing too much data to message");
+
+            m_body.resize(old_size + size);
+            m_header.m_size = checked_cast<Header_size_type>(m_body.size());
+
+            return {m_body.data() + old_size, size};
+        }
+
+        // Allocates room for the body up front so building the message does not need to grow it
+        void reserve(size_t body_capacity)
+        {
+            m_body.reserve(body_capacity);
+        }
+
+        /**
+         *   Uses the bytes that the owner keeps alive as the body without copying them, for example a slice of
+         *   the receive buffer. The body is copied to the own memory of the message only if it grows.
+         *
+         *   @param keeps the bytes alive until the message is destroyed or its body released
+         *   @param the bytes of the body, no other message may refer to them
+         */
+        void borrow_body(std::shared_ptr<const void> owner, std::span<char> body)
+        {
+            m_body.borrow(std::move(owner), body.data(), body.size());
+            m_header.m_size = checked_cast<Header_size_type>(body.size());
+        }
+
+        [[nodiscard]] bool is_body_borrowed() const noexcept
+        {
+            return m_body.is_borrowed();
+        }
+
     private:
+        static void check_length(size_t length)
+        {
+            if (length > MAX_PREFIXED_LENGTH<Id_type>)
+                throw std::length_error("Length does not fit to the length prefix");
+        }
+
+        // Pushes the length in the encoding of the policy after the data it describes
+        void push_length(size_t length)
+        {
+            if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+            {
+                std::array<char, MAX_VARINT_SIZE> buffer;
+                push_back_buffer(buffer.data(), encode_reversed_varint(length, buffer.data()));
+            }
+            else
+            {
+                push_back(static_cast<Size_type>(length));
+            }
+        }
+
+        [[nodiscard]] uint64_t extract_length()
+        {
+            if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+            {
+                uint64_t length = 0;
+                const size_t size = decode_reversed_varint({m_body.data(), m_body.size()}, length);
+
+                if (size == 0)
+                    throw std::length_error("Not enough data to extract");
+
+                resize_body(m_body.size() - size);
+                m_header.m_size = checked_cast<Header_size_type>(m_body.size());
+                return length;
+            }
+            else
+            {
+                return extract<Size_type>();
+            }
+        }
+
         // Simple integral cast with check that the value has not changes after cast
         template <std::integral Cast_to, std::integral Cast_from>
         static Cast_to checked_cast(Cast_from value)
@@ -219,7 +412,7 @@ namespace Net
 
         Message_header<Id_type> m_header;
 
-        // The message body in bytes
-        std::vector<char> m_body = {};
+        // The message body in bytes, small bodies are stored inline
+        Small_buffer<INLINE_BODY_SIZE> m_body;
     };
 } // namespace Net
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../Utility/Varint.h"
+#include "Message.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Packs many small messages behind one header so they share the framing, the receiving connection
+     *   unpacks them and handles each like it was sent alone. Every message is validated against the accepted
+     *   messages of the receiver, the bundle as a whole counts against the rate limit of the peer.
+     *   Peers that did not agree on the Capability::message_bundle get the messages one by one.
+     *
+     *   Message_bundle<Message_id> bundle;
+     *   bundle.add(position_message);
+     *   bundle.add(Message_id::input, input_bytes);
+     *   client.send_message(bundle.create_message());
+     *
+     *   body: entries until the end of the body
+     *   entry: varint id, varint size, bytes
+     */
+    template <Id_concept Id_type>
+    class Message_bundle
+    {
+    public:
+        // Largest body of a bundle, receiver rejects larger bundles
+        static constexpr size_t MAX_SIZE = 256 * 1024;
+
+        // Largest amount of messages in one bundle, so empty messages can't flood the receiver
+        static constexpr size_t MAX_MESSAGES = 4096;
+
+        /**
+         *   @param the id of the message
+         *   @param the body of the message
+         *   @return false if the message does not fit in the bundle, the bundle is not changed then
+         */
+        bool add(Id_type id, std::span<const char> body)
+        {
+            std::array<char, MAX_VARINT_SIZE * 2> prefix;
+            size_t prefix_size = encode_varint(static_cast<Unsigned_id_type>(id), prefix.data());
+            prefix_size += encode_varint(body.size(), prefix.data() + prefix_size);
+
+            if (m_message_count == MAX_MESSAGES || m_bundle.body_size() + prefix_size + body.size() > MAX_SIZE)
+                return false;
+
+            m_bundle.push_back_buffer(prefix.data(), prefix_size);
+            m_bundle.push_back_buffer(body.data(), body.size());
+            ++m_message_count;
+            return true;
+        }
+
+        // @return false if the message does not fit in the bundle
+        bool add(const Message<Id_type>& message)
+        {
+            return add(message.get_id(), {message.body_data(), message.body_size()});
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_message_count == 0;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_message_count;
+        }
+
+        // @return size of the body the bundle would be sent with
+        [[nodiscard]] size_t body_size() const noexcept
+        {
+            return m_bundle.body_size();
+        }
+
+        // @return the message that carries the bundle, the bundle is left empty
+        [[nodiscard]] Message<Id_type> create_message()
+        {
+            Message<Id_type> output = std::move(m_bundle);
+            output.set_internal_id(Internal_id::message_bundle);
+
+            m_bundle = Message<Id_type>();
+            m_message_count = 0;
+            return output;
+        }
+
+        /**
+         *   Goes through the messages of the received bundle in the order they were added
+         *
+         *   @param body of the bundle
+         *   @param called with the Id_type id and the std::span<const char> body of each message, the body is
+         *          valid as long as the bundle is
+         *   @return false if the body is not valid bundle, the messages before the invalid one have been passed
+         */
+        template <typename Callable_type>
+        static bool for_each_message(std::span<const char> body, Callable_type&& callable)
+        {
+            if (body.size() > MAX_SIZE)
+                return false;
+
+            size_t position = 0;
+            size_t message_count = 0;
+
+            while (position < body.size())
+            {
+                uint64_t id = 0;
+                uint64_t size = 0;
+                const size_t id_size = decode_varint(body.subspan(position), id);
+
+                if (id_size == 0 || id > std::numeric_limits<Unsigned_id_type>::max())
+                    return false;
+
+                position += id_size;
+                const size_t size_size = decode_varint(body.subspan(position), size);
+
+                if (size_size == 0 || size > body.size() - position - size_size || ++message_count > MAX_MESSAGES)
+                    return false;
+
+                position += size_size;
+                callable(static_cast<Id_type>(id), body.subspan(position, size));
+                position += size;
+            }
+
+            return true;
+        }
+
+    private:
+        using Unsigned_id_type = std::make_unsigned_t<std::underlying_type_t<Id_type>>;
+
+        Message<Id_type> m_bundle;
+        size_t m_message_count = 0;
+    };
+} // namespace Net
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Fixed_size_messages.h"
+#include "Owned_message.h"
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Decodes the fields of many messages of one fixed size id into a column for each field, so the code that
+     *   aggregates them runs over contiguous arrays instead of extracting message by message. The fields are
+     *   given in the order they were pushed to the message, the body has them back to back without padding.
+     *   Each column is filled in its own loop that copies from the same offset of every body, which the compiler
+     *   can vectorize. The columns are reused between the decodes so the steady state does not allocate.
+     *
+     *   Message_columns<Message_id, float, float, uint16_t> positions(Message_id::position);
+     *   positions.decode(server.pop_received_batch(1024));
+     *
+     *   for (float x : positions.get_column<0>())
+     *       ...
+     */
+    template <Id_concept Id_type, typename... Field_types>
+    class Message_columns
+    {
+    public:
+        static_assert(sizeof...(Field_types) > 0);
+        static_assert((std::is_trivially_copyable_v<Field_types> && ...));
+
+        // Size of the body of every decoded message
+        static constexpr size_t MESSAGE_SIZE = (sizeof(Field_types) + ...);
+
+        /**
+         *   @param the id of the decoded messages
+         *   @throws std::invalid_argument if the id is declared with another size in the Fixed_size_messages
+         */
+        explicit Message_columns(Id_type id) : m_id(id)
+        {
+            const std::optional<Header_size_type> fixed_size = get_fixed_message_size(id);
+
+            if (fixed_size && *fixed_size != MESSAGE_SIZE)
+                throw std::invalid_argument("Fields do not match the fixed size of the message");
+        }
+
+        /**
+         *   Replaces the columns with the fields of the messages of the id, the other messages are left out
+         *
+         *   @param the received messages, for example the batch of the pop_received_batch
+         *   @return the amount of messages of the id that had another size and were left out
+         */
+        size_t decode(std::span<const Owned_message<Id_type>> messages)
+        {
+            m_bodies.clear();
+            m_client_ids.clear();
+            size_t skipped_messages = 0;
+
+            for (const Owned_message<Id_type>& owned_message : messages)
+            {
+                const Message<Id_type>& message = owned_message.m_message;
+
+                if (message.get_internal_id() != Internal_id::not_internal || message.get_id() != m_id)
+                    continue;
+
+                if (message.body_size() != MESSAGE_SIZE)
+                {
+                    ++skipped_messages;
+                    continue;
+                }
+
+                m_bodies.push_back(message.body_data());
+                m_client_ids.push_back(owned_message.m_client_information.m_id);
+            }
+
+            decode_columns(std::index_sequence_for<Field_types...>());
+            return skipped_messages;
+        }
+
+        // @return the field of the index of every decoded message in the order the messages were given
+        template <size_t Index>
+        [[nodiscard]] std::span<const std::tuple_element_t<Index, std::tuple<Field_types...>>> get_column()
+            const noexcept
+        {
+            return std::get<Index>(m_columns);
+        }
+
+        // @return the client that sent each decoded message
+        [[nodiscard]] std::span<const uint32_t> get_client_ids() const noexcept
+        {
+            return m_client_ids;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_client_ids.size();
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_client_ids.empty();
+        }
+
+    private:
+        // Offset of the field of the index in the body
+        template <size_t Index>
+        static constexpr size_t FIELD_OFFSET = [] {
+            constexpr size_t sizes[] = {sizeof(Field_types)...};
+            size_t offset = 0;
+
+            for (size_t i = 0; i < Index; ++i)
+                offset += sizes[i];
+
+            return offset;
+        }();
+
+        template <size_t... Indexes>
+        void decode_columns(std::index_sequence<Indexes...>)
+        {
+            (decode_column<Indexes>(), ...);
+        }
+
+        template <size_t Index>
+        void decode_column()
+        {
+            auto& column = std::get<Index>(m_columns);
+            using Field_type = typename std::remove_reference_t<decltype(column)>::value_type;
+
+            column.resize(m_bodies.size());
+            Field_type* output = column.data();
+            const char* const* bodies = m_bodies.data();
+
+            for (size_t i = 0; i < m_bodies.size(); ++i)
+                std::memcpy(output + i, bodies[i] + FIELD_OFFSET<Index>, sizeof(Field_type));
+        }
+
+        Id_type m_id;
+        std::vector<const char*> m_bodies;
+        std::vector<uint32_t> m_client_ids;
+        std::tuple<std::vector<Field_types>...> m_columns;
+    };
+} // namespace Net
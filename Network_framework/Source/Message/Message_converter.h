@@ -1,12 +1,188 @@
 #pragma once
 
+#include "../Utility/Server_address.h"
+#include "Compression.h"
 #include "Message.h"
+#include "Message_reader.h"
+#include "Message_writer.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace Net
 {
+    // Version of the hello, raised when the meaning of the existing capabilities or parameters changes
+    inline constexpr uint32_t HANDSHAKE_VERSION = 1;
+
+    // Features the peers agree on in the hello, the value is the index of the bit in the Capability_set
+    enum class Capability : uint8_t
+    {
+        compact_header,
+        checked_header,
+        compression,
+        stream_compression,
+        datagram_channel,
+        session_resume,
+        heartbeat,
+        state_replication,
+        delta_encoding,
+        message_bundle
+    };
+
+    // Set of the capabilities, the bits that this version does not know are kept so they can be passed on
+    class Capability_set
+    {
+    public:
+        constexpr Capability_set() noexcept = default;
+
+        explicit constexpr Capability_set(uint64_t bits) noexcept : m_bits(bits)
+        {
+        }
+
+        constexpr void add(Capability capability) noexcept
+        {
+            m_bits |= get_bit(capability);
+        }
+
+        [[nodiscard]] constexpr bool has(Capability capability) const noexcept
+        {
+            return (m_bits & get_bit(capability)) != 0;
+        }
+
+        // @return the capabilities that both sets have, the ones that the peers agree on
+        [[nodiscard]] constexpr Capability_set intersect(Capability_set other) const noexcept
+        {
+            return Capability_set(m_bits & other.m_bits);
+        }
+
+        [[nodiscard]] constexpr uint64_t get_bits() const noexcept
+        {
+            return m_bits;
+        }
+
+        [[nodiscard]] constexpr bool operator==(const Capability_set&) const noexcept = default;
+
+    private:
+        [[nodiscard]] static constexpr uint64_t get_bit(Capability capability) noexcept
+        {
+            return uint64_t(1) << static_cast<uint8_t>(capability);
+        }
+
+        uint64_t m_bits = 0;
+    };
+
+    // Keys of the parameters in the hello, a peer skips the keys it does not know
+    enum class Hello_parameter : uint16_t
+    {
+        // Milliseconds of the ping interval and the read timeout of the sender, missing if it has none
+        ping_interval,
+        read_timeout,
+
+        // Most messages and bytes the sender writes with one gather write
+        write_batch_messages,
+        write_batch_bytes
+    };
+
+    /**
+     *   Hello of the handshake. The body is written with varints and a peer reads only the fields it knows, so the
+     *   new capabilities and parameters can be added without breaking the peers of the earlier versions.
+     */
+    struct Hello_data
+    {
+        // Most parameters read from a hello, more is treated as an invalid message
+        static constexpr size_t MAX_PARAMETERS = 256;
+
+        // Longest body of a hello with the most parameters, the fields of the later versions have to fit in it too
+        static constexpr size_t MAX_SIZE =
+            varint_size(std::numeric_limits<uint32_t>::max()) + varint_size(std::numeric_limits<uint64_t>::max()) +
+            varint_size(MAX_PARAMETERS) +
+            MAX_PARAMETERS *
+                (varint_size(std::numeric_limits<uint16_t>::max()) + varint_size(std::numeric_limits<uint64_t>::max()));
+
+        uint32_t m_version = HANDSHAKE_VERSION;
+        Capability_set m_capabilities;
+        std::vector<std::pair<Hello_parameter, uint64_t>> m_parameters;
+
+        void set_parameter(Hello_parameter key, uint64_t value)
+        {
+            for (auto& [parameter_key, parameter_value] : m_parameters)
+            {
+                if (parameter_key == key)
+                {
+                    parameter_value = value;
+                    return;
+                }
+            }
+
+            m_parameters.emplace_back(key, value);
+        }
+
+        [[nodiscard]] std::optional<uint64_t> find_parameter(Hello_parameter key) const noexcept
+        {
+            for (const auto& [parameter_key, parameter_value] : m_parameters)
+                if (parameter_key == key)
+                    return parameter_value;
+
+            return std::nullopt;
+        }
+    };
+
     struct Server_data
     {
         uint32_t m_client_id = 0;
+
+        // Header format the server offers for the connection
+        Header_format m_header_format = Header_format::standard;
+
+        // Codec the server offers for compressing the bodies, none if the server doesn't compress
+        Compression_codec m_compression_codec = Compression_codec::none;
+
+        // Stream mode is agreed only if both sides have the same dictionary
+        Compression_mode m_compression_mode = Compression_mode::per_message;
+        uint64_t m_dictionary_hash = 0;
+
+        // Udp port of the datagram channel and the token that the datagrams of this client carry, 0 if none
+        uint16_t m_datagram_port = 0;
+        uint64_t m_datagram_token = 0;
+
+        // Client gives this back after reconnecting to continue the session, 0 if the server does not keep them
+        uint64_t m_session_token = 0;
+
+        // Group that the server multicasts to as an ipv6 address, the ipv4 groups are mapped. Port is 0 if none.
+        std::array<uint8_t, 16> m_multicast_group = {};
+        uint16_t m_multicast_port = 0;
+        uint64_t m_multicast_token = 0;
+    };
+
+    struct Client_accept_data
+    {
+        // Header format the client agreed to use, both sides write with this after the client accept
+        Header_format m_header_format = Header_format::standard;
+
+        // Codec the client agreed to use, none if the client doesn't support the offered codec
+        Compression_codec m_compression_codec = Compression_codec::none;
+        Compression_mode m_compression_mode = Compression_mode::per_message;
+
+        // Session token of the earlier connection that the client continues, 0 for a new session
+        uint64_t m_resume_token = 0;
+    };
+
+    // Answer to the client that tried to continue its session
+    struct Session_resume_data
+    {
+        // False if the session had expired or it was not known, the client starts a new one then
+        bool m_is_resumed = false;
+
+        // Id the client had in the session
+        uint32_t m_previous_client_id = 0;
+
+        // Messages of the user that the server received from the client in the session
+        uint64_t m_received_messages = 0;
     };
 
     // Static class that is used internally by the framework
@@ -14,6 +190,9 @@ namespace Net
     class Message_converter
     {
     public:
+        static constexpr size_t MAX_REDIRECT_SIZE =
+            2 * MAX_LENGTH_PREFIX_SIZE<Id_type> + Server_address::MAX_HOST_SIZE + Server_address::MAX_PORT_SIZE;
+
         Message_converter() = delete;
 
         // Creates message for server_data
@@ -39,5 +218,149 @@ namespace Net
             in_message >> output;
             return output;
         }
+
+        // Creates message for client_accept_data
+        static Message<Id_type> create_client_accept(const Client_accept_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::client_accept);
+            output << data;
+            return output;
+        }
+
+        /**
+         *	@param	the message that was created with the create_client_accept method
+         *	@throws if the message internal id is not the client_accept
+         *	@return data from the message in the Client_accept_data struct
+         */
+        static Client_accept_data extract_client_accept(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::client_accept)
+                throw std::invalid_argument("Message has wrong id");
+
+            Client_accept_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_session_resume(const Session_resume_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::session_resume);
+            output << data;
+            return output;
+        }
+
+        /**
+         *	@param	the message that was created with the create_session_resume method
+         *	@throws if the message internal id is not the session_resume
+         *	@return data from the message in the Session_resume_data struct
+         */
+        static Session_resume_data extract_session_resume(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::session_resume)
+                throw std::invalid_argument("Message has wrong id");
+
+            Session_resume_data output;
+            in_message >> output;
+            return output;
+        }
+
+        /**
+         *	@param	the server_hello or the client_hello
+         *	@param	the hello
+         *	@throws if the hello has more than the Hello_data::MAX_PARAMETERS
+         *	@return the message with the hello
+         */
+        static Message<Id_type> create_hello(Internal_id internal_id, const Hello_data& data)
+        {
+            if (data.m_parameters.size() > Hello_data::MAX_PARAMETERS)
+                throw std::length_error("Too many parameters in the hello");
+
+            Message<Id_type> output;
+            output.set_internal_id(internal_id);
+
+            Message_writer<Id_type> writer(output);
+            writer.write_varint(data.m_version);
+            writer.write_varint(data.m_capabilities.get_bits());
+            writer.write_varint(static_cast<uint64_t>(data.m_parameters.size()));
+
+            for (const auto& [key, value] : data.m_parameters)
+            {
+                writer.write_varint(static_cast<uint16_t>(key));
+                writer.write_varint(value);
+            }
+
+            return output;
+        }
+
+        /**
+         *	@param	the message that was created with the create_hello method
+         *	@throws if the message is not a hello or its body is invalid
+         *	@return the hello, the data after the fields of this version is ignored
+         */
+        static Hello_data extract_hello(const Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::server_hello &&
+                in_message.get_internal_id() != Internal_id::client_hello)
+                throw std::invalid_argument("Message has wrong id");
+
+            Message_reader<Id_type> reader(in_message);
+
+            Hello_data output;
+            output.m_version = reader.template read_varint<uint32_t>();
+            output.m_capabilities = Capability_set(reader.template read_varint<uint64_t>());
+
+            const uint64_t parameter_count = reader.template read_varint<uint64_t>();
+
+            if (parameter_count > Hello_data::MAX_PARAMETERS)
+                throw std::length_error("Too many parameters in the hello");
+
+            for (uint64_t i = 0; i < parameter_count; ++i)
+            {
+                const auto key = static_cast<Hello_parameter>(reader.template read_varint<uint16_t>());
+                output.m_parameters.emplace_back(key, reader.template read_varint<uint64_t>());
+            }
+
+            return output;
+        }
+
+        /**
+         *	@param	the address that the client should connect to
+         *	@throws if the host or the port is longer than the Server_address allows
+         *	@return the message that tells the client to connect to the address instead
+         */
+        static Message<Id_type> create_redirect(const Server_address& address)
+        {
+            if (address.m_host.size() > Server_address::MAX_HOST_SIZE ||
+                address.m_port.size() > Server_address::MAX_PORT_SIZE)
+                throw std::length_error("Address is too long for a redirect");
+
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::client_redirect);
+
+            Message_writer<Id_type> writer(output);
+            writer.write(address.m_host);
+            writer.write(address.m_port);
+            return output;
+        }
+
+        /**
+         *	@param	the message that was created with the create_redirect method
+         *	@throws if the message internal id is not the client_redirect or the body is too small
+         *	@return the address that the client should connect to
+         */
+        static Server_address extract_redirect(const Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::client_redirect)
+                throw std::invalid_argument("Message has wrong id");
+
+            Message_reader<Id_type> reader(in_message);
+
+            Server_address output;
+            output.m_host = reader.template read<std::string>();
+            output.m_port = reader.template read<std::string>();
+            return output;
+        }
     };
 } // namespace Net
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace Net
+{
+    /**
+     *   Part of a large message that is sent in frames so the messages of the higher priorities can be written
+     *   between them. Every fragment starts with the size of the whole body, the fragments of one message are
+     *   sent one after another and the receiver puts the body together before handling the message.
+     *   Fragments of the different logical streams can be interleaved, stream 0 is the bulk lane.
+     */
+    template <Id_concept Id_type>
+    class Message_fragment
+    {
+    public:
+        // Size of the whole body and the id of the logical stream are before the data
+        static constexpr size_t HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+        // Largest amount of data in one fragment, receiver rejects larger fragments
+        static constexpr size_t MAX_DATA_SIZE = 64 * 1024;
+
+        // @param body of the fragment message that has atleast HEADER_SIZE bytes
+        [[nodiscard]] static uint64_t read_total_size(const char* body) noexcept
+        {
+            uint64_t total_size = 0;
+            std::memcpy(&total_size, body, sizeof(total_size));
+            return from_little_endian(total_size);
+        }
+
+        // @param body of the fragment message that has atleast HEADER_SIZE bytes
+        [[nodiscard]] static uint32_t read_stream_id(const char* body) noexcept
+        {
+            uint32_t stream_id = 0;
+            std::memcpy(&stream_id, body + sizeof(uint64_t), sizeof(stream_id));
+            return from_little_endian(stream_id);
+        }
+
+        /**
+         *   Creates the fragment without its data, the data is written from the original message
+         *   after the body of the fragment and the size in its header does not include it
+         *
+         *   @param the id of the fragmented message
+         *   @param the size of the whole body
+         *   @param the logical stream that the message is sent in
+         */
+        [[nodiscard]] static Message<Id_type> create_message(Id_type id, uint64_t total_size, uint32_t stream_id = 0)
+        {
+            std::array<char, HEADER_SIZE> header;
+            const uint64_t little_endian_size = to_little_endian(total_size);
+            const uint32_t little_endian_stream_id = to_little_endian(stream_id);
+            std::memcpy(header.data(), &little_endian_size, sizeof(little_endian_size));
+            std::memcpy(header.data() + sizeof(uint64_t), &little_endian_stream_id, sizeof(little_endian_stream_id));
+
+            Message<Id_type> output;
+            output.set_id(id);
+            output.set_internal_id(Internal_id::message_fragment);
+            output.push_back_buffer(header.data(), header.size());
+
+            return output;
+        }
+
+        // @return the data of the received fragment that has atleast HEADER_SIZE bytes in its body
+        [[nodiscard]] static std::span<const char> data(const Message<Id_type>& fragment) noexcept
+        {
+            return {fragment.body_data() + HEADER_SIZE, fragment.body_size() - HEADER_SIZE};
+        }
+    };
+} // namespace Net
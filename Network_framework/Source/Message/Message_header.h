@@ -1,6 +1,8 @@
 #pragma once
 
+#include "../Utility/Varint.h"
 #include <cstdint>
+#include <limits>
 #include <type_traits>
 
 namespace Net
@@ -9,21 +11,154 @@ namespace Net
     enum class Internal_id : uint8_t
     {
         not_internal,
-        server_accept
+        server_accept,
+        client_accept,
+
+        // Part of a body sent with send_stream, see the Stream_chunk
+        stream_chunk,
+
+        // Heartbeat that the peer answers with the pong, both have the send time of the ping as the body
+        ping,
+        pong,
+
+        // Part of a large message that is sent in frames, see the Message_fragment
+        message_fragment,
+
+        // Credit for the frames of a logical stream, the body has the id of the stream and the granted bytes
+        stream_window,
+
+        // Call and its answer, the body of the user has the trailer of the Rpc_message
+        rpc_request,
+        rpc_response,
+
+        // Messages between the cluster nodes, see the Cluster_message
+        cluster_hello,
+        cluster_route,
+        cluster_publish,
+
+        // Server tells the client to connect to another server, the body has the Server_address
+        client_redirect,
+
+        // Server answers the client that reconnected to its earlier session, the body has the Session_resume_data
+        session_resume,
+
+        // Capabilities and parameters of the peer, see the Hello_data. Server sends its hello before the
+        // server_accept and the client answers only to the server that sent one, so the older peers never get it
+        server_hello,
+        client_hello,
+
+        // Keep the multicast of the client in order, see the Multicast_message
+        multicast_join,
+        multicast_nak,
+        multicast_repair,
+        multicast_skip,
+        multicast_leave,
+
+        // Server is shutting down and disconnects the client soon, see the Server::drain
+        server_shutdown,
+
+        // Server sends the replicated states against the baseline the client acknowledged, see the State_replicator
+        replication_update,
+        replication_ack,
+
+        // Many small user messages behind one header, see the Message_bundle
+        message_bundle
+    };
+
+    // Formats that the message headers can be sent in
+    enum class Header_format : uint8_t
+    {
+        // The Message_header as it is in memory
+        standard,
+
+        // Packed header encoded with the Compact_header
+        compact,
+
+        // Compact header with the crc32c of the frame, for plain links where the tls does not detect corruption
+        checked
     };
 
-    // Type that is used to indicate how large the message is in the header
+    // How the body of the message is encoded on the wire
+    enum class Body_encoding : uint8_t
+    {
+        raw,
+
+        // Body starts with the Compression prefix followed by the compressed data
+        compressed,
+
+        // Same as compressed but the data continues the compression stream of the connection
+        compressed_stream,
+
+        // Same as compressed but the decompressed data is the xor of the body and the previous compressed_delta
+        // body of the same id on the connection, the bytes past the end of the previous body are as they are
+        compressed_delta
+    };
+
+    // Type that is used to indicate how large the message is in the header, unless the policy of the id changes it
     using Header_size_type = uint64_t;
 
+    // How the lengths of the strings and the arrays are encoded in the body
+    enum class Length_encoding : uint8_t
+    {
+        fixed16,
+        fixed32,
+        fixed64,
+
+        // Seven bits in each byte, lengths under 128 take one byte
+        varint
+    };
+
     // The concept for the message id type
     template <typename T>
     concept Id_concept = std::is_enum_v<T>;
 
+    /**
+     *   Widths of the size fields of the messages of the id type. Specialize this for your id when your messages
+     *   are never as large as the defaults allow, so the headers and the strings carry smaller sizes:
+     *
+     *   template <>
+     *   struct Net::Message_size_policy<Message_id>
+     *   {
+     *       using Header_size_type = uint32_t;
+     *       static constexpr Length_encoding LENGTH_ENCODING = Length_encoding::fixed16;
+     *   };
+     *
+     *   Both peers must use the same policy because it changes the wire format. Pushing a body or a string over
+     *   the sizes of the policy throws, and the accepted limits are clamped to them.
+     */
+    template <Id_concept Id_type>
+    struct Message_size_policy
+    {
+        using Header_size_type = Net::Header_size_type;
+        static constexpr Length_encoding LENGTH_ENCODING = Length_encoding::fixed64;
+    };
+
+    // Type of the length prefixes of the policy, the varint lengths are decoded to uint64_t
+    template <Id_concept Id_type>
+    using Length_type = std::conditional_t<
+        Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::fixed16, uint16_t,
+        std::conditional_t<
+            Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::fixed32, uint32_t, uint64_t>>;
+
+    // Longest string or array that the length prefixes of the policy can describe
+    template <Id_concept Id_type>
+    inline constexpr uint64_t MAX_PREFIXED_LENGTH = std::numeric_limits<Length_type<Id_type>>::max();
+
+    // Most bytes that a length prefix of the policy takes
+    template <Id_concept Id_type>
+    inline constexpr size_t MAX_LENGTH_PREFIX_SIZE =
+        Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint ? MAX_VARINT_SIZE
+                                                                                 : sizeof(Length_type<Id_type>);
+
     // The message header is for identifying what type of message has been received
     template <Id_concept Id_type>
     class Message_header
     {
     public:
+        using Size_type = typename Message_size_policy<Id_type>::Header_size_type;
+
+        static_assert(std::is_unsigned_v<Size_type> && sizeof(Size_type) >= sizeof(uint16_t));
+
         // Key used to validate the message
         uint64_t m_validation_key = CONSTANT_VALIDATION_KEY;
 
@@ -33,8 +168,11 @@ namespace Net
         // Id used to recognize what type of message this is
         Id_type m_id = {};
 
+        // Fits in the padding before the size so the header does not grow with ids smaller than eight bytes
+        Body_encoding m_body_encoding = Body_encoding::raw;
+
         // Size of the message
-        Header_size_type m_size = 0;
+        Size_type m_size = 0;
 
         [[nodiscard]] bool is_validation_key_correct() const noexcept
         {
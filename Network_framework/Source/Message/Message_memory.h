@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../Utility/Size_class_pool.h"
+#include "../Utility/Thread_local_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+
+namespace Net
+{
+    namespace Message_memory_detail
+    {
+        [[nodiscard]] inline std::atomic<std::pmr::memory_resource*>& current_resource() noexcept
+        {
+            // The default pool is never destroyed so messages in static objects can still free their bodies
+            static Size_class_pool* const default_pool = new Size_class_pool();
+            static std::atomic<std::pmr::memory_resource*> resource = default_pool;
+
+            return resource;
+        }
+
+        [[nodiscard]] inline std::pmr::memory_resource*& thread_resource() noexcept
+        {
+            static thread_local std::pmr::memory_resource* resource = nullptr;
+            return resource;
+        }
+    } // namespace Message_memory_detail
+
+    // Nodes above this share the pool of the last node
+    inline constexpr uint32_t MAX_NUMA_NODES = 64;
+
+    // @return the memory resource where the new message bodies are allocated from on the calling thread
+    [[nodiscard]] inline std::pmr::memory_resource* get_message_memory_resource() noexcept
+    {
+        if (std::pmr::memory_resource* resource = Message_memory_detail::thread_resource())
+            return resource;
+
+        return Message_memory_detail::current_resource().load(std::memory_order_acquire);
+    }
+
+    /**
+     *   Sets the memory resource for the bodies of the messages created after this call.
+     *   By default the bodies come from the framework Size_class_pool.
+     *
+     *   @param the resource which has to outlive every message that was created with it
+     */
+    inline void set_message_memory_resource(std::pmr::memory_resource* resource) noexcept
+    {
+        Message_memory_detail::current_resource().store(resource, std::memory_order_release);
+    }
+
+    /**
+     *   Sets the memory resource for the bodies of the messages that the calling thread creates, it is used
+     *   instead of the one from the set_message_memory_resource
+     *
+     *   @param the resource which has to outlive every message that was created with it, nullptr to use the
+     *          resource of the process again
+     */
+    inline void set_thread_message_memory_resource(std::pmr::memory_resource* resource) noexcept
+    {
+        Message_memory_detail::thread_resource() = resource;
+    }
+
+    /**
+     *   Makes the messages that the calling thread creates take their bodies from the Thread_local_pool of the
+     *   thread. Bodies freed on the other threads go back to it in batches, so a thread that allocates the
+     *   messages that another thread frees does not contend on a shared pool. The resource that the thread used
+     *   so far becomes the upstream of the pool when it is created.
+     */
+    inline void use_thread_local_message_pool()
+    {
+        set_thread_message_memory_resource(&Thread_local_pool::get_for_thread(get_message_memory_resource()));
+    }
+
+    /**
+     *   Pool for the threads of the NUMA node. Its blocks are first touched by the threads of the node so the
+     *   pages land on the memory of that node, and a freed block goes back to the pool it came from so it is
+     *   reused on the same node. Like the default pool this is never destroyed.
+     */
+    [[nodiscard]] inline Size_class_pool& get_numa_node_pool(uint32_t node)
+    {
+        static std::array<std::atomic<Size_class_pool*>, MAX_NUMA_NODES> pools = {};
+        std::atomic<Size_class_pool*>& slot = pools[std::min(node, MAX_NUMA_NODES - 1)];
+
+        if (Size_class_pool* pool = slot.load(std::memory_order_acquire))
+            return *pool;
+
+        Size_class_pool* created_pool = new Size_class_pool();
+        Size_class_pool* expected = nullptr;
+
+        if (slot.compare_exchange_strong(expected, created_pool, std::memory_order_acq_rel))
+            return *created_pool;
+
+        delete created_pool;
+        return *expected;
+    }
+} // namespace Net
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "../Utility/Varint.h"
+#include "Message.h"
+#include "String_limits.h"
+#include <cstdint>
+#include <concepts>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Reads the message body from front to back without changing the message.
+     *   The same message can be read any amount of times, reset starts from the beginning again.
+     *   The message has to outlive the reader and it has to be written with the Message_writer.
+     */
+    template <Id_concept Id_type>
+    class Message_reader
+    {
+    public:
+        using Size_type = typename Message<Id_type>::Size_type;
+
+        /**
+         *   @param the message that is read
+         *   @param limits the read strings are checked against before they are copied or viewed, see the
+         *          User::get_string_limits
+         */
+        explicit Message_reader(const Message<Id_type>& message, const String_limits& string_limits = {}) noexcept
+            : m_message(message), m_string_limits(string_limits)
+        {
+        }
+
+        /**
+         *   Copies the next bytes of the body to the buffer
+         *
+         *   @throws if there is not enough data left
+         */
+        void read_to_buffer(void* buffer, size_t buffer_size)
+        {
+            if (buffer_size > remaining())
+                throw std::length_error("Not enough data to read");
+
+            if (buffer_size > 0)
+                std::memcpy(buffer, m_message.body_data() + m_position, buffer_size);
+
+            m_position += buffer_size;
+        }
+
+        /**
+         *   Reads the next data from the message
+         *
+         *   @return the data that was read
+         *   @throws if there is not enough data left
+         */
+        template <typename Data_type>
+        [[nodiscard]] Data_type read()
+        {
+            if constexpr (std::is_same_v<Data_type, std::string>)
+                return std::string(read_string_view());
+            else
+            {
+                static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+
+                Data_type output;
+                read_to_buffer(&output, sizeof(output));
+
+                if constexpr (Byte_order_concept<Data_type>)
+                    return from_little_endian(output);
+                else
+                    return output;
+            }
+        }
+
+        /**
+         *   Reads string without copying it
+         *
+         *   @return view to the body of the message, this is valid as long as the message body is not changed
+         *   @throws if there is not enough data left, the string is too long or it is not valid UTF-8 when required
+         */
+        [[nodiscard]] std::string_view read_string_view()
+        {
+            const size_t size = read_size();
+            const std::string_view output(m_message.body_data() + m_position, size);
+            check_string(output, m_string_limits);
+
+            m_position += size;
+            return output;
+        }
+
+        /**
+         *   Reads array that was written with Message_writer::write_span without copying it
+         *
+         *   @return view to the body of the message, this is valid as long as the message body is not changed
+         *   @throws if there is not enough data left or the data is not aligned for the type
+         */
+        template <typename Data_type>
+        [[nodiscard]] std::span<const Data_type> read_span()
+        {
+            static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+            static_assert(
+                std::endian::native == std::endian::little || !Byte_order_concept<Data_type> || sizeof(Data_type) == 1,
+                "Little endian numbers can't be viewed in place on this host");
+
+            const uint64_t count = read_length();
+            const size_t padding = alignment_padding(m_position, alignof(Data_type));
+
+            if (padding > remaining())
+                throw std::length_error("Not enough data to read");
+
+            m_position += padding;
+
+            if (count > remaining() / sizeof(Data_type))
+                throw std::length_error("Not enough data to read");
+
+            const char* data = m_message.body_data() + m_position;
+
+            if (reinterpret_cast<uintptr_t>(data) % alignof(Data_type) != 0)
+                throw std::runtime_error("Data is not aligned for the type");
+
+            const size_t size = static_cast<size_t>(count);
+            m_position += size * sizeof(Data_type);
+
+            return {reinterpret_cast<const Data_type*>(data), size};
+        }
+
+        /**
+         *   Reads length that was written with Message_writer::write_length
+         *
+         *   @throws if there is not enough data or the varint of the length is invalid
+         */
+        [[nodiscard]] uint64_t read_length()
+        {
+            if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+                return read_varint<uint64_t>();
+            else
+                return read<Size_type>();
+        }
+
+        /**
+         *   Reads value that was written with Message_writer::write_varint
+         *
+         *   @throws if there is not enough data, the varint is invalid or the value does not fit to the type
+         */
+        template <std::unsigned_integral Data_type>
+        [[nodiscard]] Data_type read_varint()
+        {
+            uint64_t value = 0;
+            const size_t size = decode_varint(remaining_data(), value);
+
+            if (size == 0)
+                throw std::length_error("Invalid varint");
+
+            m_position += size;
+            return checked_narrow<Data_type>(value);
+        }
+
+        // @throws if there is not enough data, the varint is invalid or the value does not fit to the type
+        template <std::signed_integral Data_type>
+        [[nodiscard]] Data_type read_zigzag()
+        {
+            const int64_t value = zigzag_decode(read_varint<uint64_t>());
+
+            if (value < std::numeric_limits<Data_type>::min() || value > std::numeric_limits<Data_type>::max())
+                throw std::range_error("Value does not fit to the type");
+
+            return static_cast<Data_type>(value);
+        }
+
+        /**
+         *   Reads value that was written with Message_writer::write_delta
+         *
+         *   @param the previous value of the field which is updated to the read value
+         *   @throws if there is not enough data or the varint is invalid
+         */
+        template <std::integral Data_type>
+        Data_type read_delta(Data_type& previous)
+        {
+            const auto difference = static_cast<uint64_t>(zigzag_decode(read_varint<uint64_t>()));
+            previous = static_cast<Data_type>(static_cast<uint64_t>(previous) + difference);
+            return previous;
+        }
+
+        /**
+         *   Reads values that were written with Message_writer::write_varint_range.
+         *   Runs of single byte values are decoded eight at a time.
+         *
+         *   @throws if there is not enough data, any varint is invalid or a value does not fit to the type
+         */
+        template <std::unsigned_integral Data_type>
+        [[nodiscard]] std::vector<Data_type> read_varint_range()
+        {
+            const auto count = read_varint<uint64_t>();
+
+            // Every value takes atleast one byte
+            if (count > remaining())
+                throw std::length_error("Not enough data to read");
+
+            std::vector<uint64_t> values(static_cast<size_t>(count));
+            size_t bytes_read = 0;
+
+            if (!decode_varints(remaining_data(), values, bytes_read))
+                throw std::length_error("Invalid varint");
+
+            m_position += bytes_read;
+
+            if constexpr (std::is_same_v<Data_type, uint64_t>)
+                return values;
+            else
+            {
+                std::vector<Data_type> output;
+                output.reserve(values.size());
+
+                for (const uint64_t value : values)
+                    output.push_back(checked_narrow<Data_type>(value));
+
+                return output;
+            }
+        }
+
+        template <typename Data_type>
+        Message_reader& operator>>(Data_type& data)
+        {
+            data = read<Data_type>();
+            return *this;
+        }
+
+        // Moves the read position back to the start of the body
+        void reset() noexcept
+        {
+            m_position = 0;
+        }
+
+        /**
+         *   Moves the read position to the offset from the start of the body
+         *
+         *   @throws if the offset is past the end of the body
+         */
+        void seek(size_t position)
+        {
+            if (position > m_message.body_size())
+                throw std::length_error("Not enough data to read");
+
+            m_position = position;
+        }
+
+        // @throws if there is not enough data left
+        void skip(size_t size)
+        {
+            if (size > remaining())
+                throw std::length_error("Not enough data to read");
+
+            m_position += size;
+        }
+
+        [[nodiscard]] size_t position() const noexcept
+        {
+            return m_position;
+        }
+
+        [[nodiscard]] size_t remaining() const noexcept
+        {
+            return m_message.body_size() - m_position;
+        }
+
+        [[nodiscard]] bool is_at_end() const noexcept
+        {
+            return remaining() == 0;
+        }
+
+    private:
+        [[nodiscard]] std::span<const char> remaining_data() const noexcept
+        {
+            return {m_message.body_data() + m_position, remaining()};
+        }
+
+        template <std::unsigned_integral Data_type>
+        [[nodiscard]] static Data_type checked_narrow(uint64_t value)
+        {
+            if (value > std::numeric_limits<Data_type>::max())
+                throw std::range_error("Value does not fit to the type");
+
+            return static_cast<Data_type>(value);
+        }
+
+        // Reads size written by the Message_writer and checks that there is that much data left
+        size_t read_size()
+        {
+            const uint64_t size = read_length();
+
+            if (size > remaining())
+                throw std::length_error("Not enough data to read");
+
+            return static_cast<size_t>(size);
+        }
+
+        const Message<Id_type>& m_message;
+        size_t m_position = 0;
+        String_limits m_string_limits;
+    };
+} // namespace Net
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Message.h"
+#include "Message_memory.h"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Free list of the messages of one thread. A recycled message keeps its body so the next acquired message is
+     *   written to memory that is already allocated and warm in the cache of the thread. Only the bodies from the
+     *   message memory of the thread are kept, so the list does not hold the memory of the other NUMA nodes or of
+     *   the registered receive buffers.
+     */
+    template <Id_concept Id_type>
+    class Message_recycler
+    {
+    public:
+        static constexpr size_t MAX_MESSAGES = 64;
+
+        // Larger bodies are given back to the memory so a few snapshots do not pin it
+        static constexpr size_t MAX_BODY_CAPACITY = 64 * 1024;
+
+        Message_recycler(const Message_recycler&) = delete;
+        Message_recycler(Message_recycler&&) = delete;
+
+        Message_recycler& operator=(const Message_recycler&) = delete;
+        Message_recycler& operator=(Message_recycler&&) = delete;
+
+        [[nodiscard]] static Message_recycler& get_thread_recycler()
+        {
+            thread_local Message_recycler recycler;
+            return recycler;
+        }
+
+        // Keeps the body of the message if the list has room and the body is worth keeping
+        void recycle(Message<Id_type>&& message) noexcept
+        {
+            const size_t capacity = message.body_capacity();
+
+            if (m_messages.size() == MAX_MESSAGES || capacity <= Message<Id_type>::INLINE_BODY_SIZE ||
+                capacity > MAX_BODY_CAPACITY || message.get_body_memory_resource() != get_message_memory_resource() ||
+                message.is_body_borrowed())
+                return;
+
+            message.reset();
+            m_messages.push_back(std::move(message));
+        }
+
+        // @return an empty message with the id, its body has the capacity of a recycled message if there is one
+        [[nodiscard]] Message<Id_type> acquire(Id_type id)
+        {
+            Message<Id_type> message;
+
+            if (!m_messages.empty())
+            {
+                message = std::move(m_messages.back());
+                m_messages.pop_back();
+            }
+
+            message.set_id(id);
+            return message;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_messages.size();
+        }
+
+    private:
+        // Room for the whole list is reserved so recycling never allocates
+        Message_recycler()
+        {
+            m_messages.reserve(MAX_MESSAGES);
+        }
+
+        std::vector<Message<Id_type>> m_messages;
+    };
+
+    /**
+     *   Gives the message to the free list of the calling thread, for example after a received message has been
+     *   handled. The message can be acquired again only on the same thread.
+     *
+     *   @param the message, its content is discarded
+     */
+    template <Id_concept Id_type>
+    void recycle_message(Message<Id_type>&& message) noexcept
+    {
+        Message_recycler<Id_type>::get_thread_recycler().recycle(std::move(message));
+    }
+
+    /**
+     *   @param id of the message
+     *   @return an empty message that reuses the body of a message recycled on the calling thread if there is one
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] Message<Id_type> acquire_message(Id_type id)
+    {
+        return Message_recycler<Id_type>::get_thread_recycler().acquire(id);
+    }
+} // namespace Net
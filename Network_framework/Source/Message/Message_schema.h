@@ -0,0 +1,254 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include "Message_reader.h"
+#include "Message_writer.h"
+#include <array>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Describes the fields of the struct that is sent as message. Specialize this for your struct
+     *   and list the member pointers in the order they are written, for examble:
+     *
+     *   template <>
+     *   struct Net::Message_schema<Position>
+     *   {
+     *       static constexpr auto fields = std::tuple(&Position::x, &Position::y);
+     *   };
+     *
+     *   Fields can be trivially copyable types, std::string or other structs with a schema.
+     *   Numbers and enums are encoded in little endian, use fixed width types like uint32_t for them.
+     */
+    template <typename Schema_type>
+    struct Message_schema;
+
+    template <typename Schema_type>
+    concept Schema_concept = requires { Message_schema<Schema_type>::fields; };
+
+    // Smallest and largest encoded size of a schema. Sizes are equal if the schema has only fixed size fields
+    struct Schema_sizes
+    {
+        size_t m_min = 0;
+        size_t m_max = 0;
+
+        [[nodiscard]] constexpr bool is_fixed() const noexcept
+        {
+            return m_min == m_max;
+        }
+
+        [[nodiscard]] constexpr Schema_sizes operator+(const Schema_sizes& other) const noexcept
+        {
+            const bool max_overflows = m_max > SIZE_T_MAX - other.m_max;
+            return {.m_min = m_min + other.m_min, .m_max = max_overflows ? SIZE_T_MAX : m_max + other.m_max};
+        }
+    };
+
+    template <Schema_concept Schema_type, Id_concept Id_type>
+    [[nodiscard]] constexpr Schema_sizes schema_sizes() noexcept;
+
+    namespace Schema_detail
+    {
+        template <typename Member_pointer>
+        struct Member_traits;
+
+        template <typename Class_type, typename Field_type>
+        struct Member_traits<Field_type Class_type::*>
+        {
+            using Type = Field_type;
+        };
+
+        // The strings are atleast their length prefix, which is one byte when it is a varint
+        template <typename Field_type, Id_concept Id_type>
+        [[nodiscard]] constexpr Schema_sizes field_sizes() noexcept
+        {
+            constexpr size_t MIN_LENGTH_SIZE = Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint
+                                                   ? 1
+                                                   : sizeof(Length_type<Id_type>);
+
+            if constexpr (Schema_concept<Field_type>)
+                return schema_sizes<Field_type, Id_type>();
+            else if constexpr (std::is_same_v<Field_type, std::string>)
+                return {.m_min = MIN_LENGTH_SIZE, .m_max = SIZE_T_MAX};
+            else
+            {
+                static_assert(std::is_trivially_copyable_v<Field_type>, "Field type is not supported by the schema");
+                return {.m_min = sizeof(Field_type), .m_max = sizeof(Field_type)};
+            }
+        }
+
+        // Copies the fields of the fixed size schema to the buffer in the schema order
+        template <Schema_concept Schema_type>
+        void encode_fixed(char* buffer, size_t& offset, const Schema_type& data) noexcept
+        {
+            std::apply(
+                [&](auto... members) {
+                    auto encode_field = [&](const auto& field) {
+                        using Field_type = std::remove_cvref_t<decltype(field)>;
+
+                        if constexpr (Schema_concept<Field_type>)
+                            encode_fixed(buffer, offset, field);
+                        else if constexpr (Byte_order_concept<Field_type>)
+                        {
+                            const Field_type little_endian = to_little_endian(field);
+                            std::memcpy(buffer + offset, &little_endian, sizeof(little_endian));
+                            offset += sizeof(little_endian);
+                        }
+                        else
+                        {
+                            std::memcpy(buffer + offset, &field, sizeof(field));
+                            offset += sizeof(field);
+                        }
+                    };
+
+                    (encode_field(data.*members), ...);
+                },
+                Message_schema<Schema_type>::fields);
+        }
+
+        template <Schema_concept Schema_type>
+        void decode_fixed(const char* buffer, size_t& offset, Schema_type& data) noexcept
+        {
+            std::apply(
+                [&](auto... members) {
+                    auto decode_field = [&](auto& field) {
+                        using Field_type = std::remove_cvref_t<decltype(field)>;
+
+                        if constexpr (Schema_concept<Field_type>)
+                            decode_fixed(buffer, offset, field);
+                        else
+                        {
+                            std::memcpy(&field, buffer + offset, sizeof(field));
+                            offset += sizeof(field);
+
+                            if constexpr (Byte_order_concept<Field_type>)
+                                field = from_little_endian(field);
+                        }
+                    };
+
+                    (decode_field(data.*members), ...);
+                },
+                Message_schema<Schema_type>::fields);
+        }
+    } // namespace Schema_detail
+
+    // @return the encoded size limits of the schema with the length prefixes of the id, known at compile time
+    template <Schema_concept Schema_type, Id_concept Id_type>
+    [[nodiscard]] constexpr Schema_sizes schema_sizes() noexcept
+    {
+        return std::apply(
+            [](auto... members) {
+                return (Schema_sizes() + ... +
+                        Schema_detail::field_sizes<
+                            typename Schema_detail::Member_traits<decltype(members)>::Type, Id_type>());
+            },
+            Message_schema<Schema_type>::fields);
+    }
+
+    /**
+     *   Writes the struct with the writer. Schemas with only fixed size fields are copied to a buffer
+     *   and written with one write.
+     *
+     *   @throws if the message would become larger than the header can describe
+     */
+    template <Id_concept Id_type, Schema_concept Schema_type>
+    void write_schema(Message_writer<Id_type>& writer, const Schema_type& data)
+    {
+        constexpr Schema_sizes sizes = schema_sizes<Schema_type, Id_type>();
+
+        if constexpr (sizes.is_fixed())
+        {
+            std::array<char, sizes.m_min> buffer;
+            size_t offset = 0;
+
+            Schema_detail::encode_fixed(buffer.data(), offset, data);
+            writer.write_buffer(buffer.data(), buffer.size());
+        }
+        else
+        {
+            std::apply(
+                [&](auto... members) {
+                    auto write_field = [&](const auto& field) {
+                        if constexpr (Schema_concept<std::remove_cvref_t<decltype(field)>>)
+                            write_schema(writer, field);
+                        else
+                            writer.write(field);
+                    };
+
+                    (write_field(data.*members), ...);
+                },
+                Message_schema<Schema_type>::fields);
+        }
+    }
+
+    /**
+     *   Reads the struct that was written with the write_schema
+     *
+     *   @throws if there is not enough data left
+     */
+    template <Schema_concept Schema_type, Id_concept Id_type>
+    [[nodiscard]] Schema_type read_schema(Message_reader<Id_type>& reader)
+    {
+        constexpr Schema_sizes sizes = schema_sizes<Schema_type, Id_type>();
+        Schema_type output{};
+
+        if constexpr (sizes.is_fixed())
+        {
+            std::array<char, sizes.m_min> buffer;
+            size_t offset = 0;
+
+            reader.read_to_buffer(buffer.data(), buffer.size());
+            Schema_detail::decode_fixed(buffer.data(), offset, output);
+        }
+        else
+        {
+            std::apply(
+                [&](auto... members) {
+                    auto read_field = [&](auto& field) {
+                        using Field_type = std::remove_cvref_t<decltype(field)>;
+
+                        if constexpr (Schema_concept<Field_type>)
+                            field = read_schema<Field_type>(reader);
+                        else
+                            field = reader.template read<Field_type>();
+                    };
+
+                    (read_field(output.*members), ...);
+                },
+                Message_schema<Schema_type>::fields);
+        }
+
+        return output;
+    }
+
+    // Creates message that has only the struct in its body
+    template <Id_concept Id_type, Schema_concept Schema_type>
+    [[nodiscard]] Message<Id_type> make_schema_message(Id_type id, const Schema_type& data)
+    {
+        constexpr Schema_sizes sizes = schema_sizes<Schema_type, Id_type>();
+
+        Message<Id_type> output;
+        output.set_id(id);
+        output.reserve(sizes.m_min);
+
+        Message_writer<Id_type> writer(output);
+        write_schema(writer, data);
+
+        return output;
+    }
+
+    // @throws if the message does not have enough data for the struct or a string is not within the limits
+    template <Schema_concept Schema_type, Id_concept Id_type>
+    [[nodiscard]] Schema_type read_schema_message(
+        const Message<Id_type>& message, const String_limits& string_limits = {})
+    {
+        Message_reader<Id_type> reader(message, string_limits);
+        return read_schema<Schema_type>(reader);
+    }
+} // namespace Net
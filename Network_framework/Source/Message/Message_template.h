@@ -0,0 +1,269 @@
+#pragma once
+
+#include "../Utility/Crc32c.h"
+#include "Compact_header.h"
+#include "Prepared_message.h"
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+namespace Net
+{
+    // Bytes of the template body that every recipient gets its own value for
+    struct Patch_field
+    {
+        size_t m_offset = 0;
+        size_t m_size = 0;
+    };
+
+    /**
+     *   Message whose body is shared by every recipient except for the fields that are patched for each of them,
+     *   like the id of the recipient or its own position in a broadcast state. Each recipient gets a
+     *   Patched_message with its field values and the connection writes the shared pieces of the body between
+     *   the fields straight from the template, so a broadcast costs about the same as with a prepared message.
+     *   The headers are encoded once, only the checked header has its checksum continued from the first field for
+     *   each recipient. Patched bodies are sent uncompressed because the shared pieces are written as they are.
+     */
+    template <Id_concept Id_type>
+    class Message_template
+    {
+    public:
+        static constexpr size_t MAX_FIELDS = 8;
+
+        // Field bytes of one recipient, they are stored in the queued message
+        static constexpr size_t MAX_PATCH_SIZE = 48;
+
+        /**
+         *   @param the message with the shared body, the bytes of the fields in it are the default values
+         *   @param the fields in the order of their offsets, atmost MAX_FIELDS and MAX_PATCH_SIZE bytes in total
+         *   @throws std::invalid_argument if the fields overlap, are out of order or outside of the body or if
+         *   there are too many of them
+         */
+        Message_template(Message<Id_type> message, std::span<const Patch_field> fields)
+            : m_prepared(std::move(message))
+        {
+            if (fields.size() > MAX_FIELDS)
+                throw std::invalid_argument("Too many patch fields");
+
+            const Message<Id_type>& prepared = m_prepared.get();
+            size_t end_offset = 0;
+
+            for (const Patch_field& field : fields)
+            {
+                if (field.m_size == 0 || field.m_offset < end_offset || field.m_offset > prepared.body_size() ||
+                    field.m_size > prepared.body_size() - field.m_offset ||
+                    field.m_size > MAX_PATCH_SIZE - m_patch_size)
+                    throw std::invalid_argument("Invalid patch field");
+
+                m_patch_offsets[m_field_count] = m_patch_size;
+                m_fields[m_field_count++] = field;
+                m_patch_size += field.m_size;
+                end_offset = field.m_offset + field.m_size;
+            }
+
+            // Header and the body before the first field are the same for every recipient
+            const std::span<const char> checked_header = m_prepared.header_bytes(Header_format::checked);
+            const size_t shared_prefix = m_field_count > 0 ? m_fields[0].m_offset : prepared.body_size();
+
+            m_checksum_prefix = Crc32c::extend(
+                Crc32c::extend(0, checked_header.first(checked_header.size() - Compact_header<Id_type>::CHECKSUM_SIZE)),
+                {prepared.body_data(), shared_prefix});
+        }
+
+        // @return the message with the default values in the fields
+        [[nodiscard]] const Message<Id_type>& get() const noexcept
+        {
+            return m_prepared.get();
+        }
+
+        // @return the encoded header bytes for the format, the checked header is right only for the default values
+        [[nodiscard]] std::span<const char> header_bytes(Header_format format) const noexcept
+        {
+            return m_prepared.header_bytes(format);
+        }
+
+        [[nodiscard]] std::span<const Patch_field> get_fields() const noexcept
+        {
+            return {m_fields.data(), m_field_count};
+        }
+
+        // @return where the field starts in the patch bytes of the recipient
+        [[nodiscard]] size_t get_patch_offset(size_t field_index) const noexcept
+        {
+            return m_patch_offsets[field_index];
+        }
+
+        // @return bytes of all the fields
+        [[nodiscard]] size_t get_patch_size() const noexcept
+        {
+            return m_patch_size;
+        }
+
+        /**
+         *   Calls the callable with the pieces of the patched body in the order they are sent, the shared pieces
+         *   view the template and the fields view the patch. Empty pieces are skipped.
+         *
+         *   @param the field bytes of the recipient
+         *   @param the callable taking std::span<const char>
+         */
+        template <typename Callable_type>
+        void for_each_piece(std::span<const char> patch, Callable_type&& callable) const
+        {
+            const Message<Id_type>& message = m_prepared.get();
+            size_t offset = 0;
+
+            for (size_t i = 0; i < m_field_count; ++i)
+            {
+                if (m_fields[i].m_offset > offset)
+                    callable(std::span<const char>(message.body_data() + offset, m_fields[i].m_offset - offset));
+
+                callable(patch.subspan(m_patch_offsets[i], m_fields[i].m_size));
+                offset = m_fields[i].m_offset + m_fields[i].m_size;
+            }
+
+            if (message.body_size() > offset)
+                callable(std::span<const char>(message.body_data() + offset, message.body_size() - offset));
+        }
+
+        /**
+         *   Encodes the checked header of the patched body, only the body from the first field on is checksummed
+         *
+         *   @param the field bytes of the recipient
+         *   @param buffer with atleast Compact_header::MAX_SIZE bytes
+         *   @return number of bytes written
+         */
+        size_t encode_checked_header(std::span<const char> patch, char* output) const noexcept
+        {
+            const std::span<const char> checked_header = m_prepared.header_bytes(Header_format::checked);
+            const Message<Id_type>& message = m_prepared.get();
+            uint32_t checksum = m_checksum_prefix;
+            size_t offset = m_field_count > 0 ? m_fields[0].m_offset : message.body_size();
+
+            for (size_t i = 0; i < m_field_count; ++i)
+            {
+                checksum = Crc32c::extend(checksum, {message.body_data() + offset, m_fields[i].m_offset - offset});
+                checksum = Crc32c::extend(checksum, patch.subspan(m_patch_offsets[i], m_fields[i].m_size));
+                offset = m_fields[i].m_offset + m_fields[i].m_size;
+            }
+
+            checksum = Crc32c::extend(checksum, {message.body_data() + offset, message.body_size() - offset});
+
+            // Checksum is the little endian tail of the header
+            std::memcpy(output, checked_header.data(), checked_header.size());
+            char* checksum_bytes = output + checked_header.size() - Compact_header<Id_type>::CHECKSUM_SIZE;
+
+            for (size_t i = 0; i < Compact_header<Id_type>::CHECKSUM_SIZE; ++i)
+                checksum_bytes[i] = static_cast<char>((checksum >> (8 * i)) & 0xFF);
+
+            return checked_header.size();
+        }
+
+    private:
+        Prepared_message<Id_type> m_prepared;
+        std::array<Patch_field, MAX_FIELDS> m_fields = {};
+        std::array<size_t, MAX_FIELDS> m_patch_offsets = {};
+        size_t m_field_count = 0;
+        size_t m_patch_size = 0;
+
+        // Crc of the checked header before the checksum and the body before the first field
+        uint32_t m_checksum_prefix = 0;
+    };
+
+    template <Id_concept Id_type>
+    using Shared_message_template = std::shared_ptr<const Message_template<Id_type>>;
+
+    /**
+     *   @param the message with the shared body
+     *   @param the fields that are patched for each recipient
+     *   @throws std::invalid_argument if the fields are not valid, see the Message_template
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] Shared_message_template<Id_type> make_message_template(
+        Message<Id_type> message, std::span<const Patch_field> fields)
+    {
+        return std::make_shared<const Message_template<Id_type>>(std::move(message), fields);
+    }
+
+    /**
+     *   Template with the field values of one recipient. It holds only a pointer to the template and the field
+     *   bytes, so queuing it to each client copies no more than a few cache lines.
+     */
+    template <Id_concept Id_type>
+    class Patched_message
+    {
+    public:
+        // Starts with the default values of the fields
+        explicit Patched_message(Shared_message_template<Id_type> message_template)
+            : m_template(std::move(message_template))
+        {
+            const Message<Id_type>& message = m_template->get();
+            const std::span<const Patch_field> fields = m_template->get_fields();
+
+            for (size_t i = 0; i < fields.size(); ++i)
+                std::memcpy(
+                    m_patch.data() + m_template->get_patch_offset(i), message.body_data() + fields[i].m_offset,
+                    fields[i].m_size);
+        }
+
+        /**
+         *   Sets the bytes of the field
+         *
+         *   @throws std::out_of_range if there is no such field
+         *   @throws std::invalid_argument if the size of the bytes is not the size of the field
+         */
+        void set_bytes(size_t field_index, std::span<const char> bytes)
+        {
+            const std::span<const Patch_field> fields = m_template->get_fields();
+
+            if (field_index >= fields.size())
+                throw std::out_of_range("No such patch field");
+
+            if (bytes.size() != fields[field_index].m_size)
+                throw std::invalid_argument("Patch does not match the size of the field");
+
+            std::memcpy(m_patch.data() + m_template->get_patch_offset(field_index), bytes.data(), bytes.size());
+        }
+
+        // Sets the field to the data, in the format the Message pushes it in
+        template <typename Data_type>
+        void set(size_t field_index, const Data_type& data)
+        {
+            static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+            set_bytes(field_index, {reinterpret_cast<const char*>(&data), sizeof(data)});
+        }
+
+        [[nodiscard]] const Message_template<Id_type>& get_template() const noexcept
+        {
+            return *m_template;
+        }
+
+        [[nodiscard]] std::span<const char> get_patch() const noexcept
+        {
+            return {m_patch.data(), m_template->get_patch_size()};
+        }
+
+        // @return copy of the patched message for the paths that need the whole body in one place
+        [[nodiscard]] Message<Id_type> to_message() const
+        {
+            const Message<Id_type>& message = m_template->get();
+
+            Message<Id_type> output;
+            output.reserve(message.body_size());
+            output.set_id(message.get_id());
+            m_template->for_each_piece(get_patch(), [&output](std::span<const char> piece) {
+                output.push_back_buffer(piece.data(), piece.size());
+            });
+
+            return output;
+        }
+
+    private:
+        Shared_message_template<Id_type> m_template;
+
+        // Left uninitialized past the patch size of the template
+        std::array<char, Message_template<Id_type>::MAX_PATCH_SIZE> m_patch;
+    };
+} // namespace Net
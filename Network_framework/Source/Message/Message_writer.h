@@ -0,0 +1,201 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "../Utility/Varint.h"
+#include "Message.h"
+#include <array>
+#include <concepts>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Writes data to the end of the message body in the order it is given.
+     *   Strings are written as their size followed by the characters so they can be read front to back
+     *   with the Message_reader. This format is not compatible with the Message::extract.
+     *   Numbers and enums are always written in little endian so hosts with different byte orders can talk.
+     */
+    template <Id_concept Id_type>
+    class Message_writer
+    {
+    public:
+        using Size_type = typename Message<Id_type>::Size_type;
+
+        explicit Message_writer(Message<Id_type>& message) noexcept : m_message(message)
+        {
+        }
+
+        // Copies the buffer to the end of the message
+        void write_buffer(const void* buffer, size_t buffer_size)
+        {
+            m_message.push_back_buffer(buffer, buffer_size);
+        }
+
+        /**
+         *   Adds the bytes to the end of the message for the caller to fill, so a serializer can encode straight
+         *   into the body instead of into its own buffer that is then copied
+         *
+         *   @param the amount of bytes
+         *   @return the bytes, valid until the next write
+         *   @throws if the message would become larger than the header can describe
+         */
+        [[nodiscard]] std::span<char> write_in_place(size_t size)
+        {
+            return m_message.append_body(size);
+        }
+
+        /**
+         *   Writes the data to the end of the message
+         *
+         *   @param data to be written, anything convertible to std::string_view is written as string
+         *   @throws if the message would become larger than the header can describe
+         */
+        template <typename Data_type>
+        void write(const Data_type& data)
+        {
+            if constexpr (std::convertible_to<const Data_type&, std::string_view>)
+            {
+                const std::string_view string = data;
+                write_length(string.size());
+                write_buffer(string.data(), string.size());
+            }
+            else if constexpr (Byte_order_concept<Data_type>)
+            {
+                const Data_type little_endian = to_little_endian(data);
+                write_buffer(&little_endian, sizeof(little_endian));
+            }
+            else
+            {
+                // Other types are written as they are in memory
+                static_assert(std::is_standard_layout_v<Data_type>);
+                write_buffer(&data, sizeof(data));
+            }
+        }
+
+        /**
+         *   Writes the amount of elements followed by the elements, this can be read with Message_reader::read_span.
+         *   Elements are padded to their alignment from the start of the body so the reader can view them in place.
+         *
+         *   @param the elements to be written
+         *   @throws if the message would become larger than the header can describe
+         */
+        template <typename Data_type>
+        void write_span(std::span<const Data_type> data)
+        {
+            static_assert(std::is_standard_layout_v<Data_type> && std::is_trivially_copyable_v<Data_type>);
+
+            write_length(data.size());
+
+            const size_t padding = alignment_padding(m_message.body_size(), alignof(Data_type));
+            m_message.resize_body(m_message.body_size() + padding);
+
+            if constexpr (std::endian::native != std::endian::little && Byte_order_concept<Data_type>)
+            {
+                for (const Data_type& element : data)
+                {
+                    const Data_type little_endian = to_little_endian(element);
+                    write_buffer(&little_endian, sizeof(little_endian));
+                }
+            }
+            else
+                write_buffer(data.data(), data.size_bytes());
+        }
+
+        // Writes contiguous range like vector or array the same way as write_span
+        template <std::ranges::contiguous_range Range_type>
+        void write_range(const Range_type& range)
+        {
+            using Value_type = std::ranges::range_value_t<Range_type>;
+            write_span(std::span<const Value_type>(std::ranges::data(range), std::ranges::size(range)));
+        }
+
+        /**
+         *   Writes the length of a string or an array in the encoding of the Message_size_policy
+         *
+         *   @throws if the length does not fit to the length prefix
+         */
+        void write_length(size_t length)
+        {
+            if (length > MAX_PREFIXED_LENGTH<Id_type>)
+                throw std::length_error("Length does not fit to the length prefix");
+
+            if constexpr (Message_size_policy<Id_type>::LENGTH_ENCODING == Length_encoding::varint)
+                write_varint(length);
+            else
+                write(static_cast<Size_type>(length));
+        }
+
+        // Writes the value as LEB128 varint so small values take less bytes
+        template <std::unsigned_integral Data_type>
+        void write_varint(Data_type value)
+        {
+            std::array<char, MAX_VARINT_SIZE> buffer;
+            write_buffer(buffer.data(), encode_varint(value, buffer.data()));
+        }
+
+        // Writes the value as zigzag varint so small negative values are short too
+        template <std::signed_integral Data_type>
+        void write_zigzag(Data_type value)
+        {
+            write_varint(zigzag_encode(value));
+        }
+
+        /**
+         *   Writes only the difference to the previous value as zigzag varint, this is short for values
+         *   that change slowly. Reader has to start from the same previous value.
+         *
+         *   @param the value to be written
+         *   @param the previous value of the field which is updated to the value
+         */
+        template <std::integral Data_type>
+        void write_delta(Data_type value, Data_type& previous)
+        {
+            const uint64_t difference = static_cast<uint64_t>(value) - static_cast<uint64_t>(previous);
+            write_varint(zigzag_encode(static_cast<int64_t>(difference)));
+            previous = value;
+        }
+
+        // Writes the amount of values followed by every value as varint
+        template <std::ranges::contiguous_range Range_type>
+            requires std::unsigned_integral<std::ranges::range_value_t<Range_type>>
+        void write_varint_range(const Range_type& range)
+        {
+            constexpr size_t CHUNK_SIZE = 32;
+
+            write_varint(static_cast<uint64_t>(std::ranges::size(range)));
+
+            // Values are encoded in chunks so the message grows only once for each chunk
+            std::array<char, CHUNK_SIZE * MAX_VARINT_SIZE> buffer;
+            size_t buffer_size = 0;
+            size_t chunk_values = 0;
+
+            for (const auto value : range)
+            {
+                buffer_size += encode_varint(value, buffer.data() + buffer_size);
+
+                if (++chunk_values == CHUNK_SIZE)
+                {
+                    write_buffer(buffer.data(), buffer_size);
+                    buffer_size = 0;
+                    chunk_values = 0;
+                }
+            }
+
+            write_buffer(buffer.data(), buffer_size);
+        }
+
+        template <typename Data_type>
+        Message_writer& operator<<(const Data_type& data)
+        {
+            write(data);
+            return *this;
+        }
+
+    private:
+        Message<Id_type>& m_message;
+    };
+} // namespace Net
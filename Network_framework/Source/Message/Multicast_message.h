@@ -0,0 +1,151 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+namespace Net
+{
+    // Why the server skips the multicast sequences of a client instead of repairing them
+    enum class Multicast_skip_reason : uint8_t
+    {
+        // Message was sent to everyone except the client
+        ignored,
+
+        // Message is no longer in the history of the server
+        lost
+    };
+
+    /**
+     *   Messages of the tcp connection that keep the multicast of the client in order, see the Multicast_sender.
+     *   The client asks to join with an empty multicast_join and the server answers with the first sequence that
+     *   it leaves to the multicast. The client asks for the missing sequences with the multicast_nak and the
+     *   server answers each with the multicast_repair that has the message, or with the multicast_skip. Client
+     *   that stops hearing the group leaves with its next sequence and the server repairs the rest through the tcp.
+     *   The fields are little endian like the trailer of the Rpc_message.
+     */
+    template <Id_concept Id_type>
+    class Multicast_message
+    {
+    public:
+        static constexpr size_t JOIN_SIZE = sizeof(uint32_t);
+        static constexpr size_t LEAVE_SIZE = sizeof(uint32_t);
+        static constexpr size_t NAK_SIZE = 2 * sizeof(uint32_t);
+        static constexpr size_t SKIP_SIZE = 2 * sizeof(uint32_t) + sizeof(uint8_t);
+        static constexpr size_t REPAIR_TRAILER_SIZE = sizeof(uint32_t);
+
+        [[nodiscard]] static Message<Id_type> create_join_request()
+        {
+            Message<Id_type> message;
+            message.set_internal_id(Internal_id::multicast_join);
+            return message;
+        }
+
+        // @param the first sequence of the group that the client handles, the earlier ones came through the tcp
+        [[nodiscard]] static Message<Id_type> create_join(uint32_t first_sequence)
+        {
+            Message<Id_type> message;
+            message.set_internal_id(Internal_id::multicast_join);
+            push_u32(message, first_sequence);
+            return message;
+        }
+
+        // @param the first sequence that the client has not handled, the server sends it and the later through the tcp
+        [[nodiscard]] static Message<Id_type> create_leave(uint32_t next_sequence)
+        {
+            Message<Id_type> message;
+            message.set_internal_id(Internal_id::multicast_leave);
+            push_u32(message, next_sequence);
+            return message;
+        }
+
+        [[nodiscard]] static Message<Id_type> create_nak(uint32_t first_sequence, uint32_t count)
+        {
+            Message<Id_type> message;
+            message.set_internal_id(Internal_id::multicast_nak);
+            push_u32(message, first_sequence);
+            push_u32(message, count);
+            return message;
+        }
+
+        [[nodiscard]] static Message<Id_type> create_skip(
+            uint32_t first_sequence, uint32_t count, Multicast_skip_reason reason)
+        {
+            Message<Id_type> message;
+            message.set_internal_id(Internal_id::multicast_skip);
+            push_u32(message, first_sequence);
+            push_u32(message, count);
+
+            const auto reason_byte = static_cast<uint8_t>(reason);
+            message.push_back_buffer(&reason_byte, sizeof(reason_byte));
+            return message;
+        }
+
+        // @param copy of the message that was sent to the group
+        [[nodiscard]] static Message<Id_type> create_repair(Message<Id_type> message, uint32_t sequence)
+        {
+            message.set_internal_id(Internal_id::multicast_repair);
+            push_u32(message, sequence);
+            return message;
+        }
+
+        // @return the first sequence, nullopt for the request of the client
+        [[nodiscard]] static std::optional<uint32_t> extract_join(Message<Id_type>& message)
+        {
+            if (message.body_size() != JOIN_SIZE)
+                return std::nullopt;
+
+            return extract_u32(message);
+        }
+
+        [[nodiscard]] static uint32_t extract_leave(Message<Id_type>& message)
+        {
+            return extract_u32(message);
+        }
+
+        static void extract_nak(Message<Id_type>& message, uint32_t& first_sequence, uint32_t& count)
+        {
+            count = extract_u32(message);
+            first_sequence = extract_u32(message);
+        }
+
+        static Multicast_skip_reason extract_skip(Message<Id_type>& message, uint32_t& first_sequence, uint32_t& count)
+        {
+            uint8_t reason = 0;
+            message.extract_to_buffer(&reason, sizeof(reason));
+            count = extract_u32(message);
+            first_sequence = extract_u32(message);
+
+            return reason == static_cast<uint8_t>(Multicast_skip_reason::ignored) ? Multicast_skip_reason::ignored
+                                                                                   : Multicast_skip_reason::lost;
+        }
+
+        /**
+         *   Removes the trailer so the repair is the message that was sent to the group
+         *
+         *   @return the sequence of the message
+         */
+        static uint32_t extract_repair(Message<Id_type>& message)
+        {
+            const uint32_t sequence = extract_u32(message);
+            message.set_internal_id(Internal_id::not_internal);
+            return sequence;
+        }
+
+    private:
+        static void push_u32(Message<Id_type>& message, uint32_t value)
+        {
+            const uint32_t little_endian_value = to_little_endian(value);
+            message.push_back_buffer(&little_endian_value, sizeof(little_endian_value));
+        }
+
+        static uint32_t extract_u32(Message<Id_type>& message)
+        {
+            uint32_t value = 0;
+            message.extract_to_buffer(&value, sizeof(value));
+            return from_little_endian(value);
+        }
+    };
+} // namespace Net
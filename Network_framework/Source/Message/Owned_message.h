@@ -2,6 +2,7 @@
 
 #include "../Utility/Client_information.h"
 #include "Message.h"
+#include <chrono>
 
 namespace Net
 {
@@ -32,6 +33,15 @@ namespace Net
         }
 
         Message<Id_type> m_message;
-        const Client_information m_client_information;
+        Client_information m_client_information;
+
+        // When the message was received, set only when the latency tracking is on
+        std::chrono::steady_clock::time_point m_received_time = {};
+
+        /**
+         *   When the kernel received the last bytes of the message, set only when the latency tracking is on and
+         *   the socket stamps its reads, see the Socket_options::m_receive_timestamps
+         */
+        std::chrono::system_clock::time_point m_wire_time = {};
     };
 } // namespace Net
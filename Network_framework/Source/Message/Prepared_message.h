@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Compact_header.h"
+#include "Message.h"
+#include <array>
+#include <memory>
+#include <span>
+
+namespace Net
+{
+    /**
+     *   Message that has its wire headers encoded once when it is created.
+     *   Sending it to any amount of clients only queues a pointer and writes the same bytes to each of them.
+     */
+    template <Id_concept Id_type>
+    class Prepared_message
+    {
+    public:
+        explicit Prepared_message(Message<Id_type> message) : m_message(std::move(message))
+        {
+            m_compact_header_size = Compact_header<Id_type>::encode(m_message.get_header(), m_compact_header.data());
+            m_checked_header_size = Compact_header<Id_type>::encode(
+                m_message.get_header(), m_checked_header.data(), true,
+                {{m_message.body_data(), m_message.body_size()}});
+        }
+
+        [[nodiscard]] const Message<Id_type>& get() const noexcept
+        {
+            return m_message;
+        }
+
+        // @return the encoded header bytes for the format
+        [[nodiscard]] std::span<const char> header_bytes(Header_format format) const noexcept
+        {
+            if (format == Header_format::compact)
+                return {m_compact_header.data(), m_compact_header_size};
+
+            if (format == Header_format::checked)
+                return {m_checked_header.data(), m_checked_header_size};
+
+            return {reinterpret_cast<const char*>(m_message.header_data()), m_message.header_size()};
+        }
+
+    private:
+        Message<Id_type> m_message;
+        std::array<char, Compact_header<Id_type>::MAX_SIZE> m_compact_header = {};
+        size_t m_compact_header_size = 0;
+        std::array<char, Compact_header<Id_type>::MAX_SIZE> m_checked_header = {};
+        size_t m_checked_header_size = 0;
+    };
+
+    template <Id_concept Id_type>
+    using Shared_prepared_message = std::shared_ptr<const Prepared_message<Id_type>>;
+
+    template <Id_concept Id_type>
+    [[nodiscard]] Shared_prepared_message<Id_type> make_prepared_message(Message<Id_type> message)
+    {
+        return std::make_shared<const Prepared_message<Id_type>>(std::move(message));
+    }
+} // namespace Net
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "Prepared_message.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Net
+{
+    struct Response_cache_settings
+    {
+        // Bytes of the cached requests and responses, the least recently used are evicted over this
+        size_t m_max_bytes = 16 * 1024 * 1024;
+
+        // How long a response is sent from the cache before the handler makes it again
+        std::chrono::milliseconds m_time_to_live = std::chrono::seconds(10);
+    };
+
+    struct Response_cache_stats
+    {
+        uint64_t m_hits = 0;
+        uint64_t m_misses = 0;
+
+        // Evicted because the cache was full, the expired responses are not counted
+        uint64_t m_evictions = 0;
+
+        size_t m_entries = 0;
+        size_t m_bytes = 0;
+    };
+
+    /**
+     *   Prepared responses by the id and the body of the request, so a request that many clients send gets the
+     *   same shared response without running its handler again, see the Server::register_cached_handler.
+     *   The whole body of the request is the key, so the requests with equal bodies never get another response.
+     *   This is thread safe because the handlers can run on the handler pool.
+     */
+    template <Id_concept Id_type>
+    class Response_cache
+    {
+    public:
+        // Forgets the cached responses
+        void set_settings(const Response_cache_settings& settings)
+        {
+            std::lock_guard lock(m_mutex);
+            m_settings = settings;
+            clear_locked();
+        }
+
+        /**
+         *   @param the id of the request
+         *   @param the body of the request
+         *   @return the cached response or nullptr if there is none or it has expired
+         */
+        [[nodiscard]] Shared_prepared_message<Id_type> find(Id_type id, std::span<const char> body)
+        {
+            const std::string key = make_key(id, body);
+            std::lock_guard lock(m_mutex);
+
+            const auto found = m_entries.find(key);
+
+            if (found == m_entries.end() || std::chrono::steady_clock::now() >= found->second->m_expiry)
+            {
+                ++m_stats.m_misses;
+                return nullptr;
+            }
+
+            // Front of the list is the most recently used
+            m_lru.splice(m_lru.begin(), m_lru, found->second);
+            ++m_stats.m_hits;
+            return found->second->m_response;
+        }
+
+        /**
+         *   Caches the response of the request, replacing the earlier one. Responses larger than the whole cache
+         *   are not cached.
+         *
+         *   @param the id of the request
+         *   @param the body of the request
+         *   @param the response
+         */
+        void insert(Id_type id, std::span<const char> body, Shared_prepared_message<Id_type> response)
+        {
+            std::string key = make_key(id, body);
+
+            // Key is both in the list and in the map
+            const size_t bytes = 2 * key.size() + response->get().header_size() + response->get().body_size();
+            std::lock_guard lock(m_mutex);
+
+            if (const auto found = m_entries.find(key); found != m_entries.end())
+                erase(found->second);
+
+            if (bytes > m_settings.m_max_bytes)
+                return;
+
+            while (m_stats.m_bytes + bytes > m_settings.m_max_bytes)
+            {
+                erase(std::prev(m_lru.end()));
+                ++m_stats.m_evictions;
+            }
+
+            m_lru.push_front(
+                {.m_key = key,
+                 .m_response = std::move(response),
+                 .m_expiry = std::chrono::steady_clock::now() + m_settings.m_time_to_live,
+                 .m_bytes = bytes});
+            m_entries.emplace(std::move(key), m_lru.begin());
+            m_stats.m_bytes += bytes;
+        }
+
+        // Forgets the responses of the id, for example when the data they were made from has changed
+        void invalidate(Id_type id)
+        {
+            std::lock_guard lock(m_mutex);
+
+            for (auto entry = m_lru.begin(); entry != m_lru.end();)
+            {
+                const auto next = std::next(entry);
+
+                if (get_key_id(entry->m_key) == id)
+                    erase(entry);
+
+                entry = next;
+            }
+        }
+
+        void clear()
+        {
+            std::lock_guard lock(m_mutex);
+            clear_locked();
+        }
+
+        [[nodiscard]] Response_cache_stats get_stats() const
+        {
+            std::lock_guard lock(m_mutex);
+
+            Response_cache_stats stats = m_stats;
+            stats.m_entries = m_entries.size();
+            return stats;
+        }
+
+    private:
+        struct Entry
+        {
+            std::string m_key;
+            Shared_prepared_message<Id_type> m_response;
+            std::chrono::steady_clock::time_point m_expiry;
+            size_t m_bytes = 0;
+        };
+
+        using Entry_iterator = typename std::list<Entry>::iterator;
+
+        // Id followed by the body
+        [[nodiscard]] static std::string make_key(Id_type id, std::span<const char> body)
+        {
+            std::string key(sizeof(id) + body.size(), '\0');
+            std::memcpy(key.data(), &id, sizeof(id));
+
+            if (!body.empty())
+                std::memcpy(key.data() + sizeof(id), body.data(), body.size());
+
+            return key;
+        }
+
+        [[nodiscard]] static Id_type get_key_id(std::string_view key) noexcept
+        {
+            Id_type id;
+            std::memcpy(&id, key.data(), sizeof(id));
+            return id;
+        }
+
+        void erase(Entry_iterator entry)
+        {
+            m_stats.m_bytes -= entry->m_bytes;
+            m_entries.erase(entry->m_key);
+            m_lru.erase(entry);
+        }
+
+        void clear_locked()
+        {
+            m_entries.clear();
+            m_lru.clear();
+            m_stats.m_bytes = 0;
+        }
+
+        mutable std::mutex m_mutex;
+        Response_cache_settings m_settings;
+        std::list<Entry> m_lru;
+        std::unordered_map<std::string, Entry_iterator> m_entries;
+        Response_cache_stats m_stats;
+    };
+} // namespace Net
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include <cstdint>
+#include <cstring>
+
+namespace Net
+{
+    // Result of the rpc call that is given to its callback
+    enum class Rpc_status : uint8_t
+    {
+        ok,
+
+        // Peer has no rpc handler for the id of the request
+        no_handler,
+
+        // Response did not arrive before the deadline of the call
+        timed_out,
+
+        // Connection was lost before the response arrived or there was no connection
+        disconnected
+    };
+
+    /**
+     *   Request and response of the rpc calls are the messages of the user with a trailer after the body.
+     *   The correlation id that pairs the response with its request is the last field so it can be read without
+     *   touching the body, and the response has its status before it.
+     */
+    template <Id_concept Id_type>
+    class Rpc_message
+    {
+    public:
+        static constexpr size_t REQUEST_TRAILER_SIZE = sizeof(uint64_t);
+        static constexpr size_t RESPONSE_TRAILER_SIZE = sizeof(uint8_t) + sizeof(uint64_t);
+
+        /**
+         *   @param the message of the user that the handler of its id on the peer answers
+         *   @param the id that the response carries back
+         */
+        [[nodiscard]] static Message<Id_type> create_request(Message<Id_type> message, uint64_t correlation_id)
+        {
+            message.set_internal_id(Internal_id::rpc_request);
+            push_correlation_id(message, correlation_id);
+            return message;
+        }
+
+        [[nodiscard]] static Message<Id_type> create_response(
+            Message<Id_type> message, uint64_t correlation_id, Rpc_status status)
+        {
+            const auto status_byte = static_cast<uint8_t>(status);
+
+            message.set_internal_id(Internal_id::rpc_response);
+            message.push_back_buffer(&status_byte, sizeof(status_byte));
+            push_correlation_id(message, correlation_id);
+            return message;
+        }
+
+        // @param request or response that has atleast its trailer in the body
+        [[nodiscard]] static uint64_t read_correlation_id(const Message<Id_type>& message) noexcept
+        {
+            uint64_t correlation_id = 0;
+            std::memcpy(
+                &correlation_id, message.body_data() + message.body_size() - sizeof(correlation_id),
+                sizeof(correlation_id));
+            return from_little_endian(correlation_id);
+        }
+
+        /**
+         *   Removes the trailer so the request is the message that the user sent
+         *
+         *   @return the correlation id
+         */
+        static uint64_t extract_request(Message<Id_type>& message)
+        {
+            const uint64_t correlation_id = extract_correlation_id(message);
+            message.set_internal_id(Internal_id::not_internal);
+            return correlation_id;
+        }
+
+        /**
+         *   Removes the trailer so the response is the message that the handler of the peer wrote
+         *
+         *   @param set to the correlation id of the response
+         *   @return the status, the statuses that are only used locally are read as the no_handler
+         */
+        static Rpc_status extract_response(Message<Id_type>& message, uint64_t& correlation_id)
+        {
+            correlation_id = extract_correlation_id(message);
+
+            uint8_t status = 0;
+            message.extract_to_buffer(&status, sizeof(status));
+            message.set_internal_id(Internal_id::not_internal);
+
+            return status == static_cast<uint8_t>(Rpc_status::ok) ? Rpc_status::ok : Rpc_status::no_handler;
+        }
+
+    private:
+        static void push_correlation_id(Message<Id_type>& message, uint64_t correlation_id)
+        {
+            const uint64_t little_endian_id = to_little_endian(correlation_id);
+            message.push_back_buffer(&little_endian_id, sizeof(little_endian_id));
+        }
+
+        static uint64_t extract_correlation_id(Message<Id_type>& message)
+        {
+            uint64_t correlation_id = 0;
+            message.extract_to_buffer(&correlation_id, sizeof(correlation_id));
+            return from_little_endian(correlation_id);
+        }
+    };
+} // namespace Net
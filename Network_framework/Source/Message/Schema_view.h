@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Message_schema.h"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace Net
+{
+    /**
+     *   Reads single fields of a schema message in place without decoding the whole struct, for example a
+     *   router that looks only at the first field before sending the message on. The offset of a field is
+     *   found on its first access by skipping the fields before it, and the found offsets are kept for the
+     *   later accesses. Offsets of the fixed size fields before the first string are known at compile time.
+     *   The view never changes the message, so it can be sent on as it is without writing it again:
+     *
+     *   Schema_view<Route, Message_id> view(message);
+     *   const uint32_t target = view.get<0>();
+     *   server.forward_message_to_client(target, std::move(message));
+     *
+     *   The message has to outlive the view.
+     */
+    template <Schema_concept Schema_type, Id_concept Id_type>
+    class Schema_view
+    {
+    public:
+        static constexpr size_t FIELD_COUNT =
+            std::tuple_size_v<std::remove_cvref_t<decltype(Message_schema<Schema_type>::fields)>>;
+
+        template <size_t Index>
+        using Field_type = typename Schema_detail::Member_traits<
+            std::remove_cvref_t<decltype(std::get<Index>(Message_schema<Schema_type>::fields))>>::Type;
+
+        /**
+         *   @param the message that was made with the make_schema_message
+         *   @param limits the viewed strings are checked against, see the User::get_string_limits
+         */
+        explicit Schema_view(const Message<Id_type>& message, const String_limits& string_limits = {}) noexcept
+            : m_reader(message, string_limits)
+        {
+        }
+
+        /**
+         *   Reads the field, the strings are viewed in the body and the fields with a schema are read whole
+         *
+         *   @return the field or std::string_view for the string fields
+         *   @throws if the message does not have enough data for the field or the fields before it
+         */
+        template <size_t Index>
+        [[nodiscard]] auto get()
+        {
+            static_assert(Index < FIELD_COUNT, "Schema has no such field");
+            using Type = Field_type<Index>;
+
+            m_reader.seek(offset_of(Index));
+
+            if constexpr (std::is_same_v<Type, std::string>)
+                return m_reader.read_string_view();
+            else if constexpr (Schema_concept<Type>)
+                return read_schema<Type>(m_reader);
+            else
+                return m_reader.template read<Type>();
+        }
+
+    private:
+        struct Fixed_offsets
+        {
+            std::array<size_t, FIELD_COUNT> m_offsets = {};
+            size_t m_count = 1;
+        };
+
+        // Offsets up to the first field after a variable size field
+        [[nodiscard]] static constexpr Fixed_offsets make_fixed_offsets() noexcept
+        {
+            Fixed_offsets output;
+
+            [&]<size_t... Indices>(std::index_sequence<Indices...>) {
+                auto add_offset = [&](size_t index, Schema_sizes sizes) {
+                    if (output.m_count != index + 1 || !sizes.is_fixed() || index + 1 == FIELD_COUNT)
+                        return;
+
+                    output.m_offsets[index + 1] = output.m_offsets[index] + sizes.m_min;
+                    ++output.m_count;
+                };
+
+                (add_offset(Indices, Schema_detail::field_sizes<Field_type<Indices>, Id_type>()), ...);
+            }(std::make_index_sequence<FIELD_COUNT>());
+
+            return output;
+        }
+
+        static constexpr Fixed_offsets FIXED_OFFSETS = make_fixed_offsets();
+
+        [[nodiscard]] size_t offset_of(size_t index)
+        {
+            while (m_known_offsets <= index)
+            {
+                m_reader.seek(m_offsets[m_known_offsets - 1]);
+                skip_field(m_known_offsets - 1);
+                m_offsets[m_known_offsets++] = m_reader.position();
+            }
+
+            return m_offsets[index];
+        }
+
+        // Reads past the field of the index that is known only at run time
+        void skip_field(size_t index)
+        {
+            [&]<size_t... Indices>(std::index_sequence<Indices...>) {
+                ((Indices == index ? skip<Field_type<Indices>>() : void()), ...);
+            }(std::make_index_sequence<FIELD_COUNT>());
+        }
+
+        template <typename Type>
+        void skip()
+        {
+            constexpr Schema_sizes sizes = Schema_detail::field_sizes<Type, Id_type>();
+
+            if constexpr (sizes.is_fixed())
+                m_reader.skip(sizes.m_min);
+            else if constexpr (std::is_same_v<Type, std::string>)
+                (void)m_reader.read_string_view();
+            else
+                (void)read_schema<Type>(m_reader);
+        }
+
+        Message_reader<Id_type> m_reader;
+        std::array<size_t, FIELD_COUNT> m_offsets = FIXED_OFFSETS.m_offsets;
+        size_t m_known_offsets = FIXED_OFFSETS.m_count;
+    };
+} // namespace Net
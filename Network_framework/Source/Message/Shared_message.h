@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Message.h"
+#include "Message_template.h"
+#include "Prepared_message.h"
+#include <memory>
+#include <span>
+#include <variant>
+
+namespace Net
+{
+    // Immutable message that can be queued to many connections without copying the body
+    template <Id_concept Id_type>
+    using Shared_message = std::shared_ptr<const Message<Id_type>>;
+
+    template <Id_concept Id_type>
+    [[nodiscard]] Shared_message<Id_type> make_shared_message(Message<Id_type> message)
+    {
+        return std::make_shared<const Message<Id_type>>(std::move(message));
+    }
+
+    /**
+     *   Message in the out queue of the connection.
+     *   It is either owned by the connection or shared with other connections as plain or prepared message, or
+     *   a template shared with other connections with the fields of this connection patched in.
+     */
+    template <Id_concept Id_type>
+    class Outgoing_message
+    {
+    public:
+        Outgoing_message(Message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        Outgoing_message(Shared_message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        Outgoing_message(Shared_prepared_message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        Outgoing_message(Patched_message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        // @return the message, the patched message is returned with the default values in its fields
+        [[nodiscard]] const Message<Id_type>& get() const noexcept
+        {
+            if (const auto* shared = std::get_if<Shared_message<Id_type>>(&m_message))
+                return **shared;
+
+            if (const auto* prepared = std::get_if<Shared_prepared_message<Id_type>>(&m_message))
+                return (*prepared)->get();
+
+            if (const auto* patched = std::get_if<Patched_message<Id_type>>(&m_message))
+                return patched->get_template().get();
+
+            return std::get<Message<Id_type>>(m_message);
+        }
+
+        // @return the already encoded header bytes or empty span if the message was not prepared
+        [[nodiscard]] std::span<const char> prepared_header_bytes(Header_format format) const noexcept
+        {
+            if (const auto* prepared = std::get_if<Shared_prepared_message<Id_type>>(&m_message))
+                return (*prepared)->header_bytes(format);
+
+            // Checksum of the checked header depends on the patch
+            if (const auto* patched = std::get_if<Patched_message<Id_type>>(&m_message);
+                patched != nullptr && format != Header_format::checked)
+                return patched->get_template().header_bytes(format);
+
+            return {};
+        }
+
+        // @return the patched message or nullptr if this is not one
+        [[nodiscard]] const Patched_message<Id_type>* get_patched() const noexcept
+        {
+            return std::get_if<Patched_message<Id_type>>(&m_message);
+        }
+
+        // Copies the patched message to a plain message, for the paths that need the whole body in one place
+        void flatten_patch()
+        {
+            if (const auto* patched = get_patched())
+                m_message = patched->to_message();
+        }
+
+    private:
+        std::variant<
+            Message<Id_type>, Shared_message<Id_type>, Shared_prepared_message<Id_type>, Patched_message<Id_type>>
+            m_message;
+    };
+} // namespace Net
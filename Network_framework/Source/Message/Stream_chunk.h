@@ -0,0 +1,125 @@
+#pragma once
+
+#include "../Utility/Endian.h"
+#include "Message.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <span>
+
+namespace Net
+{
+    /**
+     *   Gives the next part of the streamed body. It is called from the asio thread of the connection
+     *   when there is room for the next chunk so the whole body never has to be in the memory.
+     *
+     *   @param buffer where the data is written
+     *   @return number of bytes written, 0 ends the stream
+     */
+    using Stream_source = std::function<size_t(std::span<char>)>;
+
+    /**
+     *   One part of a body that is sent with send_stream. Chunks of the same stream are received in
+     *   the order they were sent, the first and the last chunk are marked so the receiver knows where
+     *   the body starts and ends. Data of the chunk is valid as long as the chunk is alive.
+     */
+    template <Id_concept Id_type>
+    class Stream_chunk
+    {
+    public:
+        // Stream id and the flags are before the data
+        static constexpr size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+
+        // Largest amount of data in one chunk, receiver rejects larger chunks
+        static constexpr size_t MAX_DATA_SIZE = 64 * 1024;
+
+        static constexpr uint8_t FIRST_FLAG = 1 << 0;
+        static constexpr uint8_t LAST_FLAG = 1 << 1;
+
+        // @param body of the chunk message that has atleast HEADER_SIZE bytes
+        [[nodiscard]] static uint32_t read_stream_id(const char* body) noexcept
+        {
+            uint32_t stream_id = 0;
+            std::memcpy(&stream_id, body, sizeof(stream_id));
+            return from_little_endian(stream_id);
+        }
+
+        // @param body of the chunk message that has atleast HEADER_SIZE bytes
+        [[nodiscard]] static uint8_t read_flags(const char* body) noexcept
+        {
+            return static_cast<uint8_t>(body[sizeof(uint32_t)]);
+        }
+
+        /**
+         *   @param the id of the streamed message
+         *   @param the stream the chunk belongs to
+         *   @param is this the first chunk of the stream
+         *   @param is this the last chunk of the stream
+         *   @param the data of the chunk, atmost MAX_DATA_SIZE bytes
+         */
+        [[nodiscard]] static Message<Id_type> create_message(
+            Id_type id, uint32_t stream_id, bool is_first, bool is_last, std::span<const char> data)
+        {
+            std::array<char, HEADER_SIZE> header;
+            const uint32_t little_endian_id = to_little_endian(stream_id);
+            std::memcpy(header.data(), &little_endian_id, sizeof(little_endian_id));
+            header[sizeof(uint32_t)] = static_cast<char>((is_first ? FIRST_FLAG : 0) | (is_last ? LAST_FLAG : 0));
+
+            Message<Id_type> output;
+            output.set_id(id);
+            output.set_internal_id(Internal_id::stream_chunk);
+            output.reserve(HEADER_SIZE + data.size());
+            output.push_back_buffer(header.data(), header.size());
+            output.push_back_buffer(data.data(), data.size());
+
+            return output;
+        }
+
+        // @return nothing if the message is not valid chunk
+        [[nodiscard]] static std::optional<Stream_chunk> from_message(Message<Id_type> message)
+        {
+            if (message.get_internal_id() != Internal_id::stream_chunk || message.body_size() < HEADER_SIZE ||
+                message.body_size() - HEADER_SIZE > MAX_DATA_SIZE)
+                return std::nullopt;
+
+            if ((read_flags(message.body_data()) & ~(FIRST_FLAG | LAST_FLAG)) != 0)
+                return std::nullopt;
+
+            return Stream_chunk(std::move(message));
+        }
+
+        [[nodiscard]] Id_type get_id() const noexcept
+        {
+            return m_message.get_id();
+        }
+
+        [[nodiscard]] uint32_t get_stream_id() const noexcept
+        {
+            return read_stream_id(m_message.body_data());
+        }
+
+        [[nodiscard]] bool is_first() const noexcept
+        {
+            return (read_flags(m_message.body_data()) & FIRST_FLAG) != 0;
+        }
+
+        [[nodiscard]] bool is_last() const noexcept
+        {
+            return (read_flags(m_message.body_data()) & LAST_FLAG) != 0;
+        }
+
+        [[nodiscard]] std::span<const char> data() const noexcept
+        {
+            return {m_message.body_data() + HEADER_SIZE, m_message.body_size() - HEADER_SIZE};
+        }
+
+    private:
+        explicit Stream_chunk(Message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        Message<Id_type> m_message;
+    };
+} // namespace Net
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "Compression.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Compresses the messages of one connection as a single stream so each message can refer to the data
+     *   of the earlier messages and the dictionary. Every message given to this has to be sent in the same
+     *   order because the Stream_decompressor of the other side has to see the same history.
+     */
+    class Stream_compressor
+    {
+    public:
+        // @throws if the compression context could not be allocated
+        explicit Stream_compressor(const Compression_settings& settings)
+            : m_codec(settings.m_codec), m_dictionary(settings.m_dictionary)
+        {
+            const std::span<const char> dictionary = dictionary_data();
+
+            switch (m_codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4:
+                m_lz4_stream = LZ4_createStream();
+
+                if (m_lz4_stream == nullptr)
+                    throw std::bad_alloc();
+
+                m_history.resize(LZ4_HISTORY_SIZE);
+                LZ4_loadDict(m_lz4_stream, dictionary.data(), static_cast<int>(dictionary.size()));
+                break;
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd:
+                m_zstd_context = ZSTD_createCCtx();
+
+                if (m_zstd_context == nullptr)
+                    throw std::bad_alloc();
+
+                ZSTD_CCtx_setParameter(m_zstd_context, ZSTD_c_compressionLevel, settings.m_level);
+
+                if (!dictionary.empty())
+                    ZSTD_CCtx_loadDictionary(m_zstd_context, dictionary.data(), dictionary.size());
+                break;
+#endif
+            default:
+                m_has_failed = true;
+                break;
+            }
+        }
+
+        Stream_compressor(const Stream_compressor&) = delete;
+        Stream_compressor(Stream_compressor&&) = delete;
+
+        ~Stream_compressor()
+        {
+#ifdef NET_USE_LZ4
+            if (m_lz4_stream != nullptr)
+                LZ4_freeStream(m_lz4_stream);
+#endif
+#ifdef NET_USE_ZSTD
+            if (m_zstd_context != nullptr)
+                ZSTD_freeCCtx(m_zstd_context);
+#endif
+        }
+
+        Stream_compressor& operator=(const Stream_compressor&) = delete;
+        Stream_compressor& operator=(Stream_compressor&&) = delete;
+
+        /**
+         *   Compressed body has the same prefix as the one made by the Compression::compress.
+         *   History of a failed stream can't be trusted so after a failure every call returns false and
+         *   the messages have to be sent uncompressed.
+         *
+         *   @param the body to compress
+         *   @param where the compressed body is written
+         *   @return false if the body was not added to the stream
+         */
+        [[nodiscard]] bool compress(std::span<const char> body, std::vector<char>& output)
+        {
+            if (m_has_failed || !can_compress(body.size()))
+                return false;
+
+            output.resize(Compression::PREFIX_SIZE + Compression::compress_bound(m_codec, body.size()));
+
+            const size_t compressed_size = compress_data(body, output);
+
+            if (compressed_size == 0)
+            {
+                m_has_failed = true;
+                return false;
+            }
+
+            Compression::write_prefix(m_codec, body.size(), output.data());
+            output.resize(Compression::PREFIX_SIZE + compressed_size);
+            return true;
+        }
+
+    private:
+        // LZ4 refers only to the last 64 KB
+        static constexpr size_t LZ4_HISTORY_SIZE = 64 * 1024;
+
+        [[nodiscard]] std::span<const char> dictionary_data() const noexcept
+        {
+            if (m_dictionary == nullptr)
+                return {};
+
+            return m_dictionary->m_data;
+        }
+
+        // Too large bodies are left out of the stream so they don't break it
+        [[nodiscard]] bool can_compress([[maybe_unused]] size_t size) const noexcept
+        {
+#ifdef NET_USE_LZ4
+            if (m_codec == Compression_codec::lz4)
+                return size <= LZ4_MAX_INPUT_SIZE;
+#endif
+            return true;
+        }
+
+        // @return size of the compressed data after the prefix or 0 on failure
+        [[nodiscard]] size_t compress_data(std::span<const char> body, std::vector<char>& output)
+        {
+            switch (m_codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4: {
+                char* destination = output.data() + Compression::PREFIX_SIZE;
+                const int capacity = static_cast<int>(output.size() - Compression::PREFIX_SIZE);
+
+                const int size = LZ4_compress_fast_continue(
+                    m_lz4_stream, body.data(), destination, static_cast<int>(body.size()), capacity, 1);
+
+                // Copies the history so the body does not have to stay alive until the next message
+                LZ4_saveDict(m_lz4_stream, m_history.data(), static_cast<int>(m_history.size()));
+
+                return size > 0 ? static_cast<size_t>(size) : 0;
+            }
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd: {
+                ZSTD_inBuffer input = {body.data(), body.size(), 0};
+                ZSTD_outBuffer compressed = {output.data(), output.size(), Compression::PREFIX_SIZE};
+
+                // Flushing ends the block so the receiver can decompress the whole message right away
+                while (true)
+                {
+                    const size_t remaining = ZSTD_compressStream2(m_zstd_context, &compressed, &input, ZSTD_e_flush);
+
+                    if (ZSTD_isError(remaining))
+                        return 0;
+
+                    if (remaining == 0)
+                        break;
+
+                    output.resize(output.size() * 2);
+                    compressed.dst = output.data();
+                    compressed.size = output.size();
+                }
+
+                return compressed.pos - Compression::PREFIX_SIZE;
+            }
+#endif
+            default:
+                return 0;
+            }
+        }
+
+        const Compression_codec m_codec;
+        const std::shared_ptr<const Compression_dictionary> m_dictionary;
+        bool m_has_failed = false;
+
+#ifdef NET_USE_LZ4
+        LZ4_stream_t* m_lz4_stream = nullptr;
+        std::vector<char> m_history;
+#endif
+#ifdef NET_USE_ZSTD
+        ZSTD_CCtx* m_zstd_context = nullptr;
+#endif
+    };
+
+    // Decompresses the messages compressed with the Stream_compressor of the other side in the order they were sent
+    class Stream_decompressor
+    {
+    public:
+        /**
+         *   @param the codec the other side is compressing with
+         *   @param the same dictionary the other side has
+         *   @throws if the decompression context could not be allocated
+         */
+        Stream_decompressor(Compression_codec codec, std::shared_ptr<const Compression_dictionary> dictionary)
+            : m_codec(codec)
+        {
+            const std::span<const char> dictionary_data =
+                dictionary != nullptr ? std::span<const char>(dictionary->m_data) : std::span<const char>();
+
+            switch (m_codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4:
+                m_history.reserve(LZ4_HISTORY_SIZE);
+                append_history(dictionary_data);
+                break;
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd:
+                m_zstd_context = ZSTD_createDCtx();
+
+                if (m_zstd_context == nullptr)
+                    throw std::bad_alloc();
+
+                if (!dictionary_data.empty())
+                    ZSTD_DCtx_loadDictionary(m_zstd_context, dictionary_data.data(), dictionary_data.size());
+                break;
+#endif
+            default:
+                break;
+            }
+        }
+
+        Stream_decompressor(const Stream_decompressor&) = delete;
+        Stream_decompressor(Stream_decompressor&&) = delete;
+
+        ~Stream_decompressor()
+        {
+#ifdef NET_USE_ZSTD
+            if (m_zstd_context != nullptr)
+                ZSTD_freeDCtx(m_zstd_context);
+#endif
+        }
+
+        Stream_decompressor& operator=(const Stream_decompressor&) = delete;
+        Stream_decompressor& operator=(Stream_decompressor&&) = delete;
+
+        /**
+         *   @param the compressed body with the prefix
+         *   @param where the body is decompressed, it has to be exactly decompressed_size bytes
+         *   @return false if the data was invalid, the stream can't be used after that
+         */
+        [[nodiscard]] bool decompress(std::span<const char> compressed, std::span<char> output)
+        {
+            if (compressed.size() < Compression::PREFIX_SIZE)
+                return false;
+
+            if (static_cast<Compression_codec>(compressed[0]) != m_codec)
+                return false;
+
+            const std::span<const char> data = compressed.subspan(Compression::PREFIX_SIZE);
+
+            switch (m_codec)
+            {
+#ifdef NET_USE_LZ4
+            case Compression_codec::lz4: {
+                const int size = LZ4_decompress_safe_usingDict(
+                    data.data(), output.data(), static_cast<int>(data.size()), static_cast<int>(output.size()),
+                    m_history.data(), static_cast<int>(m_history.size()));
+
+                if (size < 0 || static_cast<size_t>(size) != output.size())
+                    return false;
+
+                append_history(output);
+                return true;
+            }
+#endif
+#ifdef NET_USE_ZSTD
+            case Compression_codec::zstd: {
+                ZSTD_inBuffer input = {data.data(), data.size(), 0};
+                ZSTD_outBuffer decompressed = {output.data(), output.size(), 0};
+
+                while (input.pos < input.size)
+                {
+                    const size_t previous_input = input.pos;
+                    const size_t previous_output = decompressed.pos;
+
+                    if (ZSTD_isError(ZSTD_decompressStream(m_zstd_context, &decompressed, &input)))
+                        return false;
+
+                    if (input.pos == previous_input && decompressed.pos == previous_output)
+                        return false;
+                }
+
+                return decompressed.pos == decompressed.size;
+            }
+#endif
+            default:
+                return false;
+            }
+        }
+
+    private:
+        static constexpr size_t LZ4_HISTORY_SIZE = 64 * 1024;
+
+        // Keeps the last LZ4_HISTORY_SIZE bytes of the decompressed stream
+        void append_history(std::span<const char> data)
+        {
+            if (data.size() >= LZ4_HISTORY_SIZE)
+            {
+                m_history.assign(data.end() - LZ4_HISTORY_SIZE, data.end());
+                return;
+            }
+
+            const size_t kept_size = std::min(m_history.size(), LZ4_HISTORY_SIZE - data.size());
+            m_history.erase(m_history.begin(), m_history.end() - kept_size);
+            m_history.insert(m_history.end(), data.begin(), data.end());
+        }
+
+        const Compression_codec m_codec;
+        std::vector<char> m_history;
+
+#ifdef NET_USE_ZSTD
+        ZSTD_DCtx* m_zstd_context = nullptr;
+#endif
+    };
+} // namespace Net
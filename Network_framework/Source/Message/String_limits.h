@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../Utility/Utf8.h"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+namespace Net
+{
+    // Limits for the strings read from the received messages, see the User::set_string_limits
+    struct String_limits
+    {
+        // Longest string in bytes
+        uint32_t m_max_size = std::numeric_limits<uint32_t>::max();
+
+        // Strings have to be valid UTF-8
+        bool m_is_utf8 = false;
+    };
+
+    /**
+     *   @param size of the string that is checked before it is copied
+     *   @param the limits
+     *   @throws std::length_error if the string is too long
+     */
+    inline void check_string_size(uint64_t size, const String_limits& limits)
+    {
+        if (size > limits.m_max_size)
+            throw std::length_error("String is longer than its limit");
+    }
+
+    /**
+     *   @param the string that is checked
+     *   @param the limits
+     *   @throws std::length_error if the string is too long or std::invalid_argument if it is not valid UTF-8
+     */
+    inline void check_string(std::string_view string, const String_limits& limits)
+    {
+        check_string_size(string.size(), limits);
+
+        if (limits.m_is_utf8 && !is_valid_utf8(string))
+            throw std::invalid_argument("String is not valid UTF-8");
+    }
+} // namespace Net
@@ -0,0 +1,700 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    enum class Aead_cipher : uint8_t
+    {
+        // Fastest on the cpus with the aes instructions, OpenSSL uses them when the cpu has them
+        aes_256_gcm,
+
+        // Fastest on the cpus without the aes instructions
+        chacha20_poly1305
+    };
+
+    // Key and cipher of the Aead_socket, both sides need the same ones
+    struct Aead_settings
+    {
+        // Secret that only the trusted hosts have, atleast MIN_KEY_SIZE random bytes
+        std::vector<uint8_t> m_pre_shared_key;
+        Aead_cipher m_cipher = Aead_cipher::aes_256_gcm;
+
+        static constexpr size_t MIN_KEY_SIZE = 16;
+    };
+
+    /**
+     *   Encrypted tcp socket for the links between the trusted hosts that share a key, a lighter alternative to
+     *   the tls. The handshake is like the NNpsk0 of the Noise: both sides send an ephemeral X25519 key and the
+     *   keys of the directions are derived from the shared secret with the pre shared key as the salt, so only
+     *   the holders of the key get the same keys and the recorded traffic can't be read later with the key alone.
+     *   Both sides prove that they have the keys with an empty frame before the handshake finishes.
+     *
+     *   Every write is sealed to frames of the length, the data and the tag, so a batch of messages costs 20 bytes
+     *   instead of the headers of many tls records. The state is two cipher contexts and the buffers of the frames
+     *   in progress, there are no certificates, sessions or records to buffer.
+     */
+    class Aead_socket final : public Socket_interface
+    {
+    public:
+        /**
+         *   @param the connected socket
+         *   @param the key and the cipher, shared by the sockets of the user
+         *   @throws if the cipher contexts could not be created
+         */
+        Aead_socket(Protocol::socket socket, std::shared_ptr<const Aead_settings> settings)
+            : m_socket(std::move(socket)), m_settings(std::move(settings))
+        {
+        }
+
+        Aead_socket(const Aead_socket&) = delete;
+        Aead_socket(Aead_socket&&) = delete;
+
+        ~Aead_socket() override = default;
+
+        Aead_socket& operator=(const Aead_socket&) = delete;
+        Aead_socket& operator=(Aead_socket&&) = delete;
+
+        /**
+         *   Client sends its key first and finishes when it has checked the key and the proof of the server and
+         *   sent its own proof, the server finishes when it has checked the proof of the client
+         */
+        void async_handshake(Handshake_type type) override
+        {
+            m_is_client = type == Handshake_type::client;
+
+            if (!generate_key_pair())
+            {
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    m_handshake_finished.broadcast(get_crypto_error());
+                });
+                return;
+            }
+
+            if (!m_is_client)
+            {
+                read_peer_key(lock_lifetime_owner());
+                return;
+            }
+
+            m_write_data.assign(m_public_key.begin(), m_public_key.end());
+
+            asio::async_write(
+                m_socket, asio::buffer(m_write_data),
+                [this, owner = lock_lifetime_owner()](asio::error_code error, size_t) mutable {
+                    if (error)
+                        finish_handshake(error);
+                    else
+                        read_peer_key(std::move(owner));
+                });
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            read_plain(buffer, size, size, m_read_header_finished);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            read_plain(buffer, size, size, m_read_body_finished);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            read_plain(buffer, size, std::min<size_t>(size, 1), m_read_some_finished);
+        }
+
+        // Buffers are sealed straight to the write data, the bytes of a write are never copied as plain text
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            const size_t size = asio::buffer_size(buffers);
+            m_write_data.clear();
+
+            if (!seal_frames(buffers, size))
+            {
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    m_write_finished.broadcast(get_crypto_error(), 0);
+                });
+                return;
+            }
+
+            asio::async_write(
+                m_socket, asio::buffer(m_write_data),
+                [this, owner = lock_lifetime_owner(), size](asio::error_code error, size_t) {
+                    release_large_buffer(m_write_data);
+                    m_write_finished.broadcast(error, size);
+                });
+        }
+
+        // Files are encrypted in the user space so they can't be sent without copying
+        bool can_write_file() const override
+        {
+            return false;
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+            m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_socket.get_executor();
+        }
+
+        void set_corked(bool is_corked) override
+        {
+            set_tcp_cork(m_socket, is_corked);
+        }
+
+        std::string set_socket_options(const Socket_options& options) override
+        {
+            return apply_socket_options(m_socket, options);
+        }
+
+        bool is_open() const override
+        {
+            return m_socket.is_open();
+        }
+
+        std::optional<Tcp_info> get_tcp_info() override
+        {
+            return m_socket.is_open() ? read_tcp_info(m_socket.native_handle()) : std::nullopt;
+        }
+
+        std::string get_ip() const override
+        {
+            return get_address()->to_string();
+        }
+
+        std::optional<asio::ip::address> get_address() const override
+        {
+            asio::error_code error;
+
+            if (is_open())
+            {
+                const auto endpoint = m_socket.remote_endpoint(error);
+
+                if (!error)
+                    return endpoint.address();
+            }
+
+            return asio::ip::address_v4::any();
+        }
+
+        void disconnect() override
+        {
+            if (is_open())
+            {
+                // Errors are ignored because the peer could have already closed the connection
+                asio::error_code ignored_error;
+                m_socket.shutdown(asio::socket_base::shutdown_both, ignored_error);
+                m_socket.close(ignored_error);
+            }
+        }
+
+    private:
+        static constexpr size_t PUBLIC_KEY_SIZE = 32;
+        static constexpr size_t KEY_SIZE = 32;
+        static constexpr size_t NONCE_SIZE = 12;
+        static constexpr size_t TAG_SIZE = 16;
+
+        // Frame starts with the length of its data in little endian, it is authenticated with the data
+        static constexpr size_t FRAME_HEADER_SIZE = 4;
+        static constexpr size_t FRAME_OVERHEAD = FRAME_HEADER_SIZE + TAG_SIZE;
+
+        // Whole frame is read before any of it is used, so this is also the largest read buffer
+        static constexpr size_t MAX_FRAME_SIZE = 64 * 1024;
+
+        // Buffers of the small frames are kept, the larger ones are released so the idle connections stay small
+        static constexpr size_t MAX_KEPT_BUFFER = 16 * 1024;
+
+        // Binds the derived keys to this protocol
+        static constexpr std::string_view KEY_LABEL = "Net aead socket 1";
+
+        using Frame_header = std::array<uint8_t, FRAME_HEADER_SIZE>;
+
+        template <typename T, void (*Free_function)(T*)>
+        struct Openssl_deleter
+        {
+            void operator()(T* pointer) const noexcept
+            {
+                Free_function(pointer);
+            }
+        };
+
+        using Key_pointer = std::unique_ptr<EVP_PKEY, Openssl_deleter<EVP_PKEY, EVP_PKEY_free>>;
+        using Key_context_pointer = std::unique_ptr<EVP_PKEY_CTX, Openssl_deleter<EVP_PKEY_CTX, EVP_PKEY_CTX_free>>;
+
+        /**
+         *   Cipher of one direction. The key is set once and every frame only sets the nonce, which is the count of
+         *   the earlier frames, so a nonce is never used twice with a key.
+         */
+        class Frame_cipher
+        {
+        public:
+            Frame_cipher() : m_context(EVP_CIPHER_CTX_new())
+            {
+                if (m_context == nullptr)
+                    throw std::bad_alloc();
+            }
+
+            Frame_cipher(const Frame_cipher&) = delete;
+            Frame_cipher(Frame_cipher&&) = delete;
+
+            ~Frame_cipher()
+            {
+                EVP_CIPHER_CTX_free(m_context);
+            }
+
+            Frame_cipher& operator=(const Frame_cipher&) = delete;
+            Frame_cipher& operator=(Frame_cipher&&) = delete;
+
+            [[nodiscard]] bool set_key(Aead_cipher cipher, const uint8_t* key, bool is_encrypting) noexcept
+            {
+                const EVP_CIPHER* evp_cipher =
+                    cipher == Aead_cipher::chacha20_poly1305 ? EVP_chacha20_poly1305() : EVP_aes_256_gcm();
+
+                return EVP_CipherInit_ex(m_context, evp_cipher, nullptr, key, nullptr, is_encrypting ? 1 : 0) == 1;
+            }
+
+            // Starts the next frame and authenticates its header
+            [[nodiscard]] bool begin(const Frame_header& header) noexcept
+            {
+                std::array<uint8_t, NONCE_SIZE> nonce = {};
+
+                for (size_t i = 0; i < sizeof(m_frame_count); ++i)
+                    nonce[NONCE_SIZE - 1 - i] = static_cast<uint8_t>(m_frame_count >> (i * 8));
+
+                ++m_frame_count;
+                int unused = 0;
+
+                return EVP_CipherInit_ex(m_context, nullptr, nullptr, nullptr, nonce.data(), -1) == 1 &&
+                       EVP_CipherUpdate(
+                           m_context, nullptr, &unused, header.data(), static_cast<int>(header.size())) == 1;
+            }
+
+            // Output can be the input, frames are smaller than the int sizes of OpenSSL
+            [[nodiscard]] bool update(const uint8_t* input, uint8_t* output, size_t size) noexcept
+            {
+                int output_size = 0;
+                return size == 0 || EVP_CipherUpdate(m_context, output, &output_size, input, static_cast<int>(size)) == 1;
+            }
+
+            [[nodiscard]] bool seal(uint8_t* tag) noexcept
+            {
+                int unused = 0;
+
+                return EVP_CipherFinal_ex(m_context, tag, &unused) == 1 &&
+                       EVP_CIPHER_CTX_ctrl(m_context, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(TAG_SIZE), tag) == 1;
+            }
+
+            // @return false if the frame was not sealed with the same key, its data must not be used then
+            [[nodiscard]] bool open(uint8_t* tag) noexcept
+            {
+                int unused = 0;
+
+                return EVP_CIPHER_CTX_ctrl(m_context, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(TAG_SIZE), tag) == 1 &&
+                       EVP_CipherFinal_ex(m_context, tag, &unused) == 1;
+            }
+
+        private:
+            EVP_CIPHER_CTX* m_context;
+            uint64_t m_frame_count = 0;
+        };
+
+        // Read that is in progress, only one read can be in progress at a time
+        struct Plain_read
+        {
+            uint8_t* m_buffer = nullptr;
+            size_t m_size = 0;
+            size_t m_min_size = 0;
+            size_t m_bytes_read = 0;
+            Delegate<asio::error_code, size_t>* m_finished_event = nullptr;
+        };
+
+        [[nodiscard]] static asio::error_code get_crypto_error() noexcept
+        {
+            return asio::error_code(static_cast<int>(ERR_get_error()), asio::error::get_ssl_category());
+        }
+
+        static void release_large_buffer(std::vector<uint8_t>& buffer) noexcept
+        {
+            if (buffer.capacity() > MAX_KEPT_BUFFER)
+                std::vector<uint8_t>().swap(buffer);
+        }
+
+        [[nodiscard]] bool generate_key_pair()
+        {
+            const Key_context_pointer context(EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr));
+            EVP_PKEY* private_key = nullptr;
+
+            if (context == nullptr || EVP_PKEY_keygen_init(context.get()) != 1 ||
+                EVP_PKEY_keygen(context.get(), &private_key) != 1)
+                return false;
+
+            m_private_key.reset(private_key);
+            size_t size = m_public_key.size();
+
+            return EVP_PKEY_get_raw_public_key(m_private_key.get(), m_public_key.data(), &size) == 1 &&
+                   size == PUBLIC_KEY_SIZE;
+        }
+
+        /**
+         *   Derives the keys of both directions from the shared secret with the HKDF. The info has the cipher and
+         *   both public keys, so the sides only agree if they have the same cipher and saw the same keys.
+         */
+        [[nodiscard]] bool derive_keys()
+        {
+            const Key_pointer peer_key(
+                EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, m_peer_public_key.data(), PUBLIC_KEY_SIZE));
+            const Key_context_pointer exchange(EVP_PKEY_CTX_new(m_private_key.get(), nullptr));
+
+            std::array<uint8_t, KEY_SIZE> shared_secret = {};
+            size_t shared_secret_size = shared_secret.size();
+
+            const bool has_secret = peer_key != nullptr && exchange != nullptr &&
+                                    EVP_PKEY_derive_init(exchange.get()) == 1 &&
+                                    EVP_PKEY_derive_set_peer(exchange.get(), peer_key.get()) == 1 &&
+                                    EVP_PKEY_derive(exchange.get(), shared_secret.data(), &shared_secret_size) == 1;
+
+            // Ephemeral key is not needed anymore, without it the traffic can't be decrypted later
+            m_private_key.reset();
+
+            if (!has_secret)
+                return false;
+
+            const std::array<uint8_t, PUBLIC_KEY_SIZE>& client_key = m_is_client ? m_public_key : m_peer_public_key;
+            const std::array<uint8_t, PUBLIC_KEY_SIZE>& server_key = m_is_client ? m_peer_public_key : m_public_key;
+
+            std::vector<uint8_t> info(KEY_LABEL.begin(), KEY_LABEL.end());
+            info.push_back(static_cast<uint8_t>(m_settings->m_cipher));
+            info.insert(info.end(), client_key.begin(), client_key.end());
+            info.insert(info.end(), server_key.begin(), server_key.end());
+
+            // Client to server key is first and the server to client key after it
+            std::array<uint8_t, KEY_SIZE * 2> keys = {};
+            size_t keys_size = keys.size();
+
+            const std::vector<uint8_t>& pre_shared_key = m_settings->m_pre_shared_key;
+            const Key_context_pointer hkdf(EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr));
+
+            const bool has_keys =
+                hkdf != nullptr && EVP_PKEY_derive_init(hkdf.get()) == 1 &&
+                EVP_PKEY_CTX_set_hkdf_md(hkdf.get(), EVP_sha256()) == 1 &&
+                EVP_PKEY_CTX_set1_hkdf_salt(
+                    hkdf.get(), pre_shared_key.data(), static_cast<int>(pre_shared_key.size())) == 1 &&
+                EVP_PKEY_CTX_set1_hkdf_key(hkdf.get(), shared_secret.data(), static_cast<int>(shared_secret_size)) ==
+                    1 &&
+                EVP_PKEY_CTX_add1_hkdf_info(hkdf.get(), info.data(), static_cast<int>(info.size())) == 1 &&
+                EVP_PKEY_derive(hkdf.get(), keys.data(), &keys_size) == 1;
+
+            const uint8_t* write_key = keys.data() + (m_is_client ? 0 : KEY_SIZE);
+            const uint8_t* read_key = keys.data() + (m_is_client ? KEY_SIZE : 0);
+
+            const bool has_ciphers = has_keys && m_write_cipher.set_key(m_settings->m_cipher, write_key, true) &&
+                                     m_read_cipher.set_key(m_settings->m_cipher, read_key, false);
+
+            OPENSSL_cleanse(shared_secret.data(), shared_secret.size());
+            OPENSSL_cleanse(keys.data(), keys.size());
+
+            return has_ciphers;
+        }
+
+        void read_peer_key(std::shared_ptr<void> owner)
+        {
+            asio::async_read(
+                m_socket, asio::buffer(m_peer_public_key),
+                [this, owner = std::move(owner)](asio::error_code error, size_t) mutable {
+                    if (error)
+                        finish_handshake(error);
+                    else if (!derive_keys())
+                        finish_handshake(get_crypto_error());
+                    else if (m_is_client)
+                        read_peer_proof(std::move(owner));
+                    else
+                        write_server_key_and_proof(std::move(owner));
+                });
+        }
+
+        // Server sends its key and its proof together, the client can check both after one round trip
+        void write_server_key_and_proof(std::shared_ptr<void> owner)
+        {
+            m_write_data.assign(m_public_key.begin(), m_public_key.end());
+
+            if (!seal_frames({}, 0))
+            {
+                finish_handshake(get_crypto_error());
+                return;
+            }
+
+            asio::async_write(
+                m_socket, asio::buffer(m_write_data),
+                [this, owner = std::move(owner)](asio::error_code error, size_t) mutable {
+                    if (error)
+                        finish_handshake(error);
+                    else
+                        read_peer_proof(std::move(owner));
+                });
+        }
+
+        // Proof is an empty frame, it opens only if the peer has derived the same keys
+        void read_peer_proof(std::shared_ptr<void> owner)
+        {
+            read_frame(owner, [this, owner](asio::error_code error) mutable {
+                if (!error && m_plain_size != 0)
+                    error = asio::error::access_denied;
+
+                if (error || !m_is_client)
+                {
+                    finish_handshake(error);
+                    return;
+                }
+
+                m_write_data.clear();
+
+                if (!seal_frames({}, 0))
+                {
+                    finish_handshake(get_crypto_error());
+                    return;
+                }
+
+                asio::async_write(
+                    m_socket, asio::buffer(m_write_data),
+                    [this, owner = std::move(owner)](asio::error_code error, size_t) { finish_handshake(error); });
+            });
+        }
+
+        void finish_handshake(asio::error_code error)
+        {
+            m_private_key.reset();
+            m_write_data.clear();
+            m_handshake_finished.broadcast(error);
+        }
+
+        /**
+         *   Seals the buffers to the end of the write data as frames of atmost MAX_FRAME_SIZE bytes, an empty
+         *   write is one empty frame
+         *
+         *   @return false if OpenSSL failed to encrypt
+         */
+        [[nodiscard]] bool seal_frames(std::span<const asio::const_buffer> buffers, size_t size)
+        {
+            const size_t frame_count = std::max<size_t>((size + MAX_FRAME_SIZE - 1) / MAX_FRAME_SIZE, 1);
+            const size_t start = m_write_data.size();
+
+            m_write_data.resize(start + size + frame_count * FRAME_OVERHEAD);
+            uint8_t* output = m_write_data.data() + start;
+
+            size_t buffer_index = 0;
+            size_t buffer_offset = 0;
+
+            for (size_t frame = 0, remaining = size; frame < frame_count; ++frame)
+            {
+                const size_t frame_size = std::min(remaining, MAX_FRAME_SIZE);
+                const Frame_header header = encode_frame_header(frame_size);
+
+                std::memcpy(output, header.data(), header.size());
+                output += header.size();
+
+                if (!m_write_cipher.begin(header))
+                    return false;
+
+                for (size_t sealed = 0; sealed < frame_size;)
+                {
+                    while (buffer_offset == buffers[buffer_index].size())
+                    {
+                        ++buffer_index;
+                        buffer_offset = 0;
+                    }
+
+                    const asio::const_buffer& buffer = buffers[buffer_index];
+                    const size_t part_size = std::min(buffer.size() - buffer_offset, frame_size - sealed);
+
+                    if (!m_write_cipher.update(
+                            static_cast<const uint8_t*>(buffer.data()) + buffer_offset, output, part_size))
+                        return false;
+
+                    output += part_size;
+                    sealed += part_size;
+                    buffer_offset += part_size;
+                }
+
+                if (!m_write_cipher.seal(output))
+                    return false;
+
+                output += TAG_SIZE;
+                remaining -= frame_size;
+            }
+
+            return true;
+        }
+
+        [[nodiscard]] static Frame_header encode_frame_header(size_t frame_size) noexcept
+        {
+            Frame_header header = {};
+
+            for (size_t i = 0; i < header.size(); ++i)
+                header[i] = static_cast<uint8_t>(frame_size >> (i * 8));
+
+            return header;
+        }
+
+        [[nodiscard]] static size_t decode_frame_header(const Frame_header& header) noexcept
+        {
+            size_t frame_size = 0;
+
+            for (size_t i = 0; i < header.size(); ++i)
+                frame_size |= static_cast<size_t>(header[i]) << (i * 8);
+
+            return frame_size;
+        }
+
+        /**
+         *   Reads the next frame and opens it in place, its data is then the plain text
+         *
+         *   @param called with the error, access_denied if the frame was not sealed with the key of the peer
+         */
+        template <typename Handler_type>
+        void read_frame(std::shared_ptr<void> owner, Handler_type handler)
+        {
+            asio::async_read(
+                m_socket, asio::buffer(m_read_frame_header),
+                [this, owner = std::move(owner), handler = std::move(handler)](asio::error_code error, size_t) mutable {
+                    const size_t frame_size = decode_frame_header(m_read_frame_header);
+
+                    if (!error && frame_size > MAX_FRAME_SIZE)
+                        error = asio::error::message_size;
+
+                    if (error)
+                    {
+                        handler(error);
+                        return;
+                    }
+
+                    m_read_data.resize(frame_size + TAG_SIZE);
+
+                    asio::async_read(
+                        m_socket, asio::buffer(m_read_data),
+                        [this, owner = std::move(owner), handler = std::move(handler),
+                         frame_size](asio::error_code error, size_t) mutable {
+                            if (!error && !open_frame(frame_size))
+                                error = asio::error::access_denied;
+
+                            handler(error);
+                        });
+                });
+        }
+
+        [[nodiscard]] bool open_frame(size_t frame_size) noexcept
+        {
+            uint8_t* data = m_read_data.data();
+
+            if (!m_read_cipher.begin(m_read_frame_header) || !m_read_cipher.update(data, data, frame_size) ||
+                !m_read_cipher.open(data + frame_size))
+                return false;
+
+            m_plain_offset = 0;
+            m_plain_size = frame_size;
+            return true;
+        }
+
+        // Reads from the opened frame and reads more frames until the read has atleast its minimum size
+        void read_plain(void* buffer, size_t size, size_t min_size, Delegate<asio::error_code, size_t>& finished_event)
+        {
+            m_plain_read = {
+                .m_buffer = static_cast<uint8_t*>(buffer),
+                .m_size = size,
+                .m_min_size = min_size,
+                .m_finished_event = &finished_event};
+
+            if (take_plain())
+            {
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    finish_plain_read(asio::error_code());
+                });
+                return;
+            }
+
+            continue_plain_read(lock_lifetime_owner());
+        }
+
+        void continue_plain_read(std::shared_ptr<void> owner)
+        {
+            read_frame(owner, [this, owner](asio::error_code error) mutable {
+                if (error || take_plain())
+                    finish_plain_read(error);
+                else
+                    continue_plain_read(std::move(owner));
+            });
+        }
+
+        // @return true if the read has atleast its minimum size
+        bool take_plain() noexcept
+        {
+            const size_t part_size =
+                std::min(m_plain_size - m_plain_offset, m_plain_read.m_size - m_plain_read.m_bytes_read);
+
+            if (part_size > 0)
+            {
+                std::memcpy(
+                    m_plain_read.m_buffer + m_plain_read.m_bytes_read, m_read_data.data() + m_plain_offset, part_size);
+
+                m_plain_read.m_bytes_read += part_size;
+                m_plain_offset += part_size;
+            }
+
+            if (m_plain_offset == m_plain_size)
+                release_large_buffer(m_read_data);
+
+            return m_plain_read.m_bytes_read >= m_plain_read.m_min_size;
+        }
+
+        void finish_plain_read(asio::error_code error)
+        {
+            const Plain_read plain_read = std::exchange(m_plain_read, Plain_read());
+            plain_read.m_finished_event->broadcast(error, plain_read.m_bytes_read);
+        }
+
+        Protocol::socket m_socket;
+        std::shared_ptr<const Aead_settings> m_settings;
+        bool m_is_client = false;
+
+        // Ephemeral key pair, it is freed as soon as the keys have been derived
+        Key_pointer m_private_key;
+        std::array<uint8_t, PUBLIC_KEY_SIZE> m_public_key = {};
+        std::array<uint8_t, PUBLIC_KEY_SIZE> m_peer_public_key = {};
+
+        Frame_cipher m_write_cipher;
+        Frame_cipher m_read_cipher;
+
+        // Sealed frames of the write that is in progress
+        std::vector<uint8_t> m_write_data;
+
+        // Frame that is read and opened, its plain text is taken by the reads from the plain offset
+        Frame_header m_read_frame_header = {};
+        std::vector<uint8_t> m_read_data;
+        size_t m_plain_offset = 0;
+        size_t m_plain_size = 0;
+        Plain_read m_plain_read;
+    };
+} // namespace Net
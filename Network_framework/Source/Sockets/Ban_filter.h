@@ -0,0 +1,207 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "../Utility/Ip_prefix_set.h"
+#include "Socket_options.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <sys/socket.h>
+#define NET_HAS_BAN_FILTER
+#endif
+
+namespace Net
+{
+#ifdef NET_HAS_BAN_FILTER
+    /**
+     *   Classic bpf program for the SO_ATTACH_FILTER of a listening socket. Kernel runs it on the syn before it
+     *   answers, so the connections from the banned ranges are dropped without a handshake or an accept. It
+     *   reads the source address from the ip header of the packet and checks the ranges one after another, so
+     *   the cost grows with the amount of the ranges. The accepted sockets inherit the filter of the listener.
+     */
+    class Ban_filter
+    {
+    public:
+        /**
+         *   @param the banned ranges
+         *   @return nullopt if the ranges need more instructions than the kernel allows, about a thousand ipv4
+         *           ranges or a few hundred ipv6 ranges
+         */
+        [[nodiscard]] static std::optional<Ban_filter> create(const Ip_prefix_set& banned_ips)
+        {
+            std::vector<Ip_prefix> v4_prefixes;
+            std::vector<Ip_prefix> v6_prefixes;
+
+            banned_ips.for_each([&](const Ip_prefix& prefix) {
+                (prefix.m_address.is_v4() ? v4_prefixes : v6_prefixes).push_back(prefix);
+            });
+
+            Ban_filter filter;
+            std::vector<sock_filter>& program = filter.m_program;
+
+            // Version is the high half of the first byte of the ip header
+            program.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, get_network_offset(0)));
+            program.push_back(BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4));
+
+            // Checks of a version may be longer than the 8 bit jumps reach, so the jumps to them are unconditional
+            program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 1));
+            const size_t v4_jump = program.size();
+            program.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+            program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 1));
+            const size_t v6_jump = program.size();
+            program.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+            program.push_back(BPF_STMT(BPF_RET | BPF_K, ACCEPT));
+
+            program[v4_jump].k = static_cast<uint32_t>(program.size() - v4_jump - 1);
+            add_v4_checks(program, v4_prefixes);
+
+            program[v6_jump].k = static_cast<uint32_t>(program.size() - v6_jump - 1);
+            add_v6_checks(program, v6_prefixes);
+
+            if (program.size() > BPF_MAXINSNS)
+                return std::nullopt;
+
+            return filter;
+        }
+
+        /**
+         *   Replaces the filter of the socket, the kernel swaps it without a moment of no filter
+         *
+         *   @param the listening socket
+         *   @param set if the kernel refused the filter
+         */
+        void attach(Protocol::acceptor& acceptor, asio::error_code& error) const
+        {
+            const sock_fprog program = {
+                .len = static_cast<unsigned short>(m_program.size()),
+                .filter = const_cast<sock_filter*>(m_program.data())};
+
+            error.clear();
+
+            if (setsockopt(acceptor.native_handle(), SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0)
+                error = asio::error_code(errno, asio::error::get_system_category());
+        }
+
+        /**
+         *   Removes the filter of the socket if it has one, the accepted sockets are detached so only the syns
+         *   to the listener pay for the checks
+         *
+         *   @param the acceptor or the socket
+         */
+        template <typename Socket_type>
+        static void detach(Socket_type& socket) noexcept
+        {
+            const int unused = 0;
+            setsockopt(socket.native_handle(), SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+        }
+
+        [[nodiscard]] size_t get_instruction_count() const noexcept
+        {
+            return m_program.size();
+        }
+
+    private:
+        // Return value of the program is how many bytes of the packet are kept, zero drops it
+        static constexpr uint32_t ACCEPT = 0xffffffff;
+        static constexpr uint32_t DROP = 0;
+
+        // Offsets of the source address in the ipv4 and the ipv6 headers
+        static constexpr int32_t V4_SOURCE_OFFSET = 12;
+        static constexpr int32_t V6_SOURCE_OFFSET = 8;
+
+        // @return the offset from the start of the ip header for the loads, these are negative so they are cast
+        [[nodiscard]] static constexpr uint32_t get_network_offset(int32_t offset) noexcept
+        {
+            return static_cast<uint32_t>(SKF_NET_OFF + offset);
+        }
+
+        Ban_filter() = default;
+
+        // Every range is its own block that drops the packet when it matches and falls to the next one otherwise
+        static void add_v4_checks(std::vector<sock_filter>& program, const std::vector<Ip_prefix>& prefixes)
+        {
+            program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, get_network_offset(V4_SOURCE_OFFSET)));
+            program.push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+
+            for (const Ip_prefix& prefix : prefixes)
+            {
+                if (prefix.m_length == 0)
+                {
+                    program.push_back(BPF_STMT(BPF_RET | BPF_K, DROP));
+                    return;
+                }
+
+                const uint32_t mask = get_mask(prefix.m_length);
+                const uint32_t network = prefix.m_address.to_v4().to_uint() & mask;
+
+                program.push_back(BPF_STMT(BPF_MISC | BPF_TXA, 0));
+
+                if (mask != 0xffffffff)
+                    program.push_back(BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask));
+
+                program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, network, 0, 1));
+                program.push_back(BPF_STMT(BPF_RET | BPF_K, DROP));
+            }
+
+            program.push_back(BPF_STMT(BPF_RET | BPF_K, ACCEPT));
+        }
+
+        // Address is compared a 32 bit word at a time, a mismatch skips the rest of the block of the range
+        static void add_v6_checks(std::vector<sock_filter>& program, const std::vector<Ip_prefix>& prefixes)
+        {
+            for (const Ip_prefix& prefix : prefixes)
+            {
+                if (prefix.m_length == 0)
+                {
+                    program.push_back(BPF_STMT(BPF_RET | BPF_K, DROP));
+                    return;
+                }
+
+                const std::array<uint8_t, 16> bytes = prefix.m_address.to_v6().to_bytes();
+                const size_t word_count = (prefix.m_length + 31) / 32;
+                std::vector<size_t> mismatch_jumps;
+
+                for (size_t i = 0; i < word_count; ++i)
+                {
+                    const uint32_t mask =
+                        get_mask(static_cast<uint8_t>(std::min<size_t>(prefix.m_length - i * 32, 32)));
+                    const uint32_t word = (static_cast<uint32_t>(bytes[i * 4]) << 24) |
+                                          (static_cast<uint32_t>(bytes[i * 4 + 1]) << 16) |
+                                          (static_cast<uint32_t>(bytes[i * 4 + 2]) << 8) | bytes[i * 4 + 3];
+
+                    program.push_back(BPF_STMT(
+                        BPF_LD | BPF_W | BPF_ABS,
+                        get_network_offset(V6_SOURCE_OFFSET + static_cast<int32_t>(i * 4))));
+
+                    if (mask != 0xffffffff)
+                        program.push_back(BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask));
+
+                    mismatch_jumps.push_back(program.size());
+                    program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, word & mask, 0, 0));
+                }
+
+                program.push_back(BPF_STMT(BPF_RET | BPF_K, DROP));
+
+                // Block is at most 13 instructions so its jumps fit in the 8 bits
+                for (const size_t jump : mismatch_jumps)
+                    program[jump].jf = static_cast<uint8_t>(program.size() - jump - 1);
+            }
+
+            program.push_back(BPF_STMT(BPF_RET | BPF_K, ACCEPT));
+        }
+
+        [[nodiscard]] static uint32_t get_mask(uint8_t length) noexcept
+        {
+            return length == 0 ? 0 : 0xffffffff << (32 - length);
+        }
+
+        std::vector<sock_filter> m_program;
+    };
+#endif
+} // namespace Net
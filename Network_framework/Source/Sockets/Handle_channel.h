@@ -0,0 +1,201 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <unistd.h>
+#define NET_HAS_HOT_RESTART
+#endif
+
+namespace Net
+{
+#ifdef NET_HAS_HOT_RESTART
+    /**
+     *   Blocking channel over a unix domain socket that passes the native handles to another process with the
+     *   SCM_RIGHTS, see the Server::set_hot_restart_path. Each frame is a small header that carries the handles,
+     *   then its body. The receiver gets its own copies of the handles, the sender still has to close its own.
+     */
+    class Handle_channel
+    {
+    public:
+        using Handle = Protocol::socket::native_handle_type;
+
+        static constexpr size_t MAX_HANDLES = 64;
+        static constexpr uint32_t MAX_BODY_SIZE = 16 * 1024 * 1024;
+
+        explicit Handle_channel(Local_protocol::socket socket) : m_socket(std::move(socket))
+        {
+            // Socket of an asio accept may have been left in the non blocking mode
+            m_socket.native_non_blocking(false);
+        }
+
+        /**
+         *   @param the body of the frame
+         *   @param the handles, atmost MAX_HANDLES
+         *   @throws std::system_error if the frame could not be sent
+         */
+        void send(std::span<const char> body, std::span<const Handle> handles = {})
+        {
+            if (handles.size() > MAX_HANDLES || body.size() > MAX_BODY_SIZE)
+                throw std::invalid_argument("Frame of the handle channel is too large");
+
+            const Frame_header header = {
+                .m_body_size = static_cast<uint32_t>(body.size()),
+                .m_handle_count = static_cast<uint32_t>(handles.size())};
+
+            iovec header_vector = {.iov_base = const_cast<Frame_header*>(&header), .iov_len = sizeof(header)};
+            Control_buffer control;
+
+            msghdr message = {};
+            message.msg_iov = &header_vector;
+            message.msg_iovlen = 1;
+
+            if (!handles.empty())
+            {
+                message.msg_control = control.m_data.data();
+                message.msg_controllen = CMSG_SPACE(sizeof(Handle) * handles.size());
+
+                cmsghdr* control_header = CMSG_FIRSTHDR(&message);
+                control_header->cmsg_level = SOL_SOCKET;
+                control_header->cmsg_type = SCM_RIGHTS;
+                control_header->cmsg_len = CMSG_LEN(sizeof(Handle) * handles.size());
+                std::memcpy(CMSG_DATA(control_header), handles.data(), sizeof(Handle) * handles.size());
+            }
+
+            const ssize_t sent = ::sendmsg(m_socket.native_handle(), &message, SEND_FLAGS);
+
+            if (sent < 0)
+                throw std::system_error(errno, std::system_category(), "Handle channel send");
+
+            // Handles went with the first byte, the rest of the header is written like the body
+            const auto* header_bytes = reinterpret_cast<const char*>(&header);
+            asio::write(
+                m_socket, std::array{
+                              asio::buffer(header_bytes + sent, sizeof(header) - static_cast<size_t>(sent)),
+                              asio::buffer(body.data(), body.size())});
+        }
+
+        /**
+         *   Waits for the next frame
+         *
+         *   @param set to the body of the frame
+         *   @return the handles of the frame, the caller owns them
+         *   @throws std::system_error if the frame could not be received or it was not valid, its handles are
+         *           closed then
+         */
+        [[nodiscard]] std::vector<Handle> receive(std::vector<char>& body)
+        {
+            Frame_header header;
+            iovec header_vector = {.iov_base = &header, .iov_len = sizeof(header)};
+            Control_buffer control;
+
+            msghdr message = {};
+            message.msg_iov = &header_vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control.m_data.data();
+            message.msg_controllen = control.m_data.size();
+
+            const ssize_t received = ::recvmsg(m_socket.native_handle(), &message, RECEIVE_FLAGS);
+
+            if (received < 0)
+                throw std::system_error(errno, std::system_category(), "Handle channel receive");
+
+            if (received == 0)
+                throw std::system_error(asio::error::eof, "Handle channel receive");
+
+            std::vector<Handle> handles;
+
+            for (cmsghdr* control_header = CMSG_FIRSTHDR(&message); control_header != nullptr;
+                 control_header = CMSG_NXTHDR(&message, control_header))
+            {
+                if (control_header->cmsg_level != SOL_SOCKET || control_header->cmsg_type != SCM_RIGHTS)
+                    continue;
+
+                const size_t count = (control_header->cmsg_len - CMSG_LEN(0)) / sizeof(Handle);
+                const size_t first = handles.size();
+                handles.resize(first + count);
+                std::memcpy(handles.data() + first, CMSG_DATA(control_header), count * sizeof(Handle));
+            }
+
+            asio::error_code error;
+            auto* header_bytes = reinterpret_cast<char*>(&header);
+            asio::read(
+                m_socket, asio::buffer(header_bytes + received, sizeof(header) - static_cast<size_t>(received)),
+                error);
+
+            if (!error && ((message.msg_flags & MSG_CTRUNC) != 0 || handles.size() != header.m_handle_count ||
+                           header.m_body_size > MAX_BODY_SIZE))
+                error = asio::error::invalid_argument;
+
+            if (!error)
+            {
+                body.resize(header.m_body_size);
+                asio::read(m_socket, asio::buffer(body), error);
+            }
+
+            if (error)
+            {
+                close_handles(handles);
+                throw std::system_error(error, "Handle channel receive");
+            }
+
+            return handles;
+        }
+
+        // @return the protocol of the tcp socket, the handles lose it when they are passed
+        [[nodiscard]] static Protocol get_protocol(Handle handle)
+        {
+            sockaddr_storage address = {};
+            socklen_t address_size = sizeof(address);
+
+            if (::getsockname(handle, reinterpret_cast<sockaddr*>(&address), &address_size) != 0)
+                throw std::system_error(errno, std::system_category(), "Handle channel socket");
+
+            return address.ss_family == AF_INET6 ? Protocol::v6() : Protocol::v4();
+        }
+
+        static void close_handles(std::span<const Handle> handles) noexcept
+        {
+            for (const Handle handle : handles)
+                ::close(handle);
+        }
+
+    private:
+        struct Frame_header
+        {
+            uint32_t m_body_size = 0;
+            uint32_t m_handle_count = 0;
+        };
+
+        // Control messages have to be aligned like their header
+        struct Control_buffer
+        {
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(Handle) * MAX_HANDLES)> m_data = {};
+        };
+
+#ifdef MSG_NOSIGNAL
+        static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+        static constexpr int SEND_FLAGS = 0;
+#endif
+
+        // Received handles are not inherited by the processes this one starts
+#ifdef MSG_CMSG_CLOEXEC
+        static constexpr int RECEIVE_FLAGS = MSG_CMSG_CLOEXEC;
+#else
+        static constexpr int RECEIVE_FLAGS = 0;
+#endif
+
+        Local_protocol::socket m_socket;
+    };
+#endif
+} // namespace Net
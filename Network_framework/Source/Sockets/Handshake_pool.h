@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace Net
+{
+    /**
+     *   Threads that run the cpu heavy part of the tls handshakes so the asio threads can keep serving the
+     *   connections that are already established. Only a limited amount of handshakes can be in progress,
+     *   the rest wait in the order they arrived.
+     */
+    class Handshake_pool
+    {
+    public:
+        /**
+         *   @param the amount of threads, atleast one thread is always used
+         *   @param how many handshakes can be in progress at the same time, atleast one
+         */
+        Handshake_pool(size_t thread_count, size_t max_concurrent_handshakes)
+            : m_thread_pool(std::max<size_t>(thread_count, 1)),
+              m_max_concurrent_handshakes(std::max<size_t>(max_concurrent_handshakes, 1))
+        {
+        }
+
+        Handshake_pool(const Handshake_pool&) = delete;
+        Handshake_pool(Handshake_pool&&) = delete;
+
+        ~Handshake_pool()
+        {
+            m_thread_pool.join();
+        }
+
+        Handshake_pool& operator=(const Handshake_pool&) = delete;
+        Handshake_pool& operator=(Handshake_pool&&) = delete;
+
+        /**
+         *   Calls the start right away if there is room for a new handshake, otherwise when an earlier one
+         *   has finished. Every started handshake has to call finish_handshake once.
+         */
+        void start_handshake(std::function<void()> start)
+        {
+            {
+                std::scoped_lock lock(m_mutex);
+
+                if (m_handshakes_in_progress >= m_max_concurrent_handshakes)
+                {
+                    m_waiting_handshakes.push_back(std::move(start));
+                    return;
+                }
+
+                ++m_handshakes_in_progress;
+            }
+
+            start();
+        }
+
+        // Gives the room of the handshake to the next waiting one
+        void finish_handshake()
+        {
+            std::function<void()> next_start;
+
+            {
+                std::scoped_lock lock(m_mutex);
+
+                if (m_waiting_handshakes.empty())
+                {
+                    --m_handshakes_in_progress;
+                    return;
+                }
+
+                next_start = std::move(m_waiting_handshakes.front());
+                m_waiting_handshakes.pop_front();
+            }
+
+            next_start();
+        }
+
+        // Executor that runs the handshake steps
+        [[nodiscard]] asio::thread_pool::executor_type get_executor() noexcept
+        {
+            return m_thread_pool.get_executor();
+        }
+
+    private:
+        asio::thread_pool m_thread_pool;
+        const size_t m_max_concurrent_handshakes;
+
+        std::mutex m_mutex;
+        size_t m_handshakes_in_progress = 0;
+        std::deque<std::function<void()>> m_waiting_handshakes;
+    };
+} // namespace Net
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Connects to the first endpoint that answers like the happy eyeballs of RFC 8305. The ipv6 and the ipv4
+     *   endpoints are tried in turns and a new attempt is started when the earlier ones have not connected in
+     *   the attempt delay or one of them fails, so a broken address family costs only the delay instead of the
+     *   whole connect timeout. The attempts run on the executor, it should be a strand if many threads run it.
+     */
+    class Happy_eyeballs : public std::enable_shared_from_this<Happy_eyeballs>
+    {
+    public:
+        using Handler = std::function<void(asio::error_code, Protocol::socket)>;
+
+        // Delay recommended by the RFC 8305
+        static constexpr std::chrono::milliseconds DEFAULT_ATTEMPT_DELAY = std::chrono::milliseconds(250);
+
+        explicit Happy_eyeballs(
+            asio::any_io_executor executor, std::chrono::milliseconds attempt_delay = DEFAULT_ATTEMPT_DELAY)
+            : m_executor(std::move(executor)), m_timer(m_executor), m_attempt_delay(attempt_delay)
+        {
+        }
+
+        /**
+         *   Starts the attempts, the handler gets the connected socket or the error of the last failed attempt
+         *
+         *   @param the resolved endpoints in the order of the preference
+         *   @param the handler, called once on the executor
+         */
+        void start(const Protocol::resolver::results_type& results, Handler handler)
+        {
+            m_endpoints = interleave_families(results);
+            m_handler = std::move(handler);
+
+            asio::dispatch(m_executor, [self = shared_from_this()] { self->start_next_attempt(); });
+        }
+
+        /**
+         *   Closes the attempts without calling the handler. Call this from the executor or when nothing runs it,
+         *   for example after the asio threads have been stopped.
+         */
+        void cancel()
+        {
+            m_is_finished = true;
+            m_handler = nullptr;
+            close_attempts();
+        }
+
+    private:
+        // Families take turns starting from the family of the most preferred endpoint, see the RFC 8305 section 4
+        [[nodiscard]] static std::vector<Protocol::endpoint> interleave_families(
+            const Protocol::resolver::results_type& results)
+        {
+            std::vector<Protocol::endpoint> preferred;
+            std::vector<Protocol::endpoint> other;
+
+            for (const auto& result : results)
+            {
+                const Protocol::endpoint endpoint = result.endpoint();
+
+                if (preferred.empty() || endpoint.protocol() == preferred.front().protocol())
+                    preferred.push_back(endpoint);
+                else
+                    other.push_back(endpoint);
+            }
+
+            std::vector<Protocol::endpoint> endpoints;
+            endpoints.reserve(preferred.size() + other.size());
+
+            for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+            {
+                if (i < preferred.size())
+                    endpoints.push_back(preferred[i]);
+
+                if (i < other.size())
+                    endpoints.push_back(other[i]);
+            }
+
+            return endpoints;
+        }
+
+        void start_next_attempt()
+        {
+            if (m_is_finished)
+                return;
+
+            if (m_next_endpoint == m_endpoints.size())
+            {
+                if (m_pending_attempts == 0)
+                    finish(m_last_error, Protocol::socket(m_executor));
+
+                return;
+            }
+
+            // List keeps the sockets in place for the pending connects
+            Protocol::socket& socket = m_attempts.emplace_back(m_executor);
+            const size_t attempt = m_next_endpoint++;
+            ++m_pending_attempts;
+
+            socket.async_connect(m_endpoints[attempt], [self = shared_from_this(), &socket](asio::error_code error) {
+                self->handle_attempt(error, socket);
+            });
+
+            m_timer.expires_after(m_attempt_delay);
+            m_timer.async_wait([self = shared_from_this(), attempt](asio::error_code error) {
+                // Timer of an older attempt can complete after a failure already started the next one
+                if (!error && attempt + 1 == self->m_next_endpoint)
+                    self->start_next_attempt();
+            });
+        }
+
+        void handle_attempt(asio::error_code error, Protocol::socket& socket)
+        {
+            --m_pending_attempts;
+
+            if (m_is_finished)
+                return;
+
+            if (!error)
+            {
+                finish(error, std::move(socket));
+                return;
+            }
+
+            m_last_error = error;
+
+            asio::error_code ignored_error;
+            socket.close(ignored_error);
+
+            // Failure does not wait for the delay
+            start_next_attempt();
+        }
+
+        void finish(asio::error_code error, Protocol::socket socket)
+        {
+            m_is_finished = true;
+            close_attempts();
+
+            const Handler handler = std::move(m_handler);
+            m_handler = nullptr;
+
+            if (handler)
+                handler(error, std::move(socket));
+        }
+
+        // Closing cancels the pending connects, their handlers still hold this object until they have run
+        void close_attempts()
+        {
+            asio::error_code ignored_error;
+            m_timer.cancel();
+
+            for (Protocol::socket& attempt : m_attempts)
+                attempt.close(ignored_error);
+        }
+
+        asio::any_io_executor m_executor;
+        asio::steady_timer m_timer;
+        std::chrono::milliseconds m_attempt_delay;
+
+        std::vector<Protocol::endpoint> m_endpoints;
+        size_t m_next_endpoint = 0;
+        std::list<Protocol::socket> m_attempts;
+        size_t m_pending_attempts = 0;
+
+        // Error of the latest failed attempt, the resolve had no endpoints if none has failed
+        asio::error_code m_last_error = asio::error::host_not_found;
+        bool m_is_finished = false;
+
+        Handler m_handler;
+    };
+} // namespace Net
@@ -0,0 +1,462 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    // Side of the memory pipe that waits for the other side, it is woken under the lock of the pipe
+    class Memory_pipe_waiter
+    {
+    public:
+        Memory_pipe_waiter() = default;
+        virtual ~Memory_pipe_waiter() = default;
+
+        Memory_pipe_waiter(const Memory_pipe_waiter&) = delete;
+        Memory_pipe_waiter(Memory_pipe_waiter&&) = delete;
+        Memory_pipe_waiter& operator=(const Memory_pipe_waiter&) = delete;
+        Memory_pipe_waiter& operator=(Memory_pipe_waiter&&) = delete;
+
+        // Should only post the continuation because the lock of the pipe is held
+        virtual void on_pipe_ready() = 0;
+    };
+
+    /**
+     *   One direction of the in-memory connection. The writer appends to the buffer until the capacity is full and
+     *   the reader takes from the front. The side that could not make progress waits until the other side has.
+     *   The buffer grows only as far as it is used, so idle pipes take no memory.
+     */
+    class Memory_pipe
+    {
+    public:
+        struct Transfer_result
+        {
+            size_t m_bytes = 0;
+
+            // Set when the pipe is closed and the transfer can't continue
+            bool m_is_closed = false;
+        };
+
+        // Next byte of the buffers given to the write
+        struct Buffer_position
+        {
+            size_t m_index = 0;
+            size_t m_offset = 0;
+        };
+
+        explicit Memory_pipe(size_t capacity) noexcept : m_capacity(std::max<size_t>(capacity, 1))
+        {
+        }
+
+        /**
+         *   Copies the buffered bytes from the front
+         *
+         *   @param the buffer
+         *   @param size of the buffer
+         *   @param the reader waits if less than this amount could be copied
+         *   @param the reader
+         */
+        Transfer_result read(char* buffer, size_t size, size_t min_bytes, Memory_pipe_waiter& reader)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const size_t bytes = std::min(size, m_data.size() - m_read_offset);
+
+            if (bytes > 0)
+            {
+                std::memcpy(buffer, m_data.data() + m_read_offset, bytes);
+                m_read_offset += bytes;
+
+                // Keeps the capacity of the vector so the steady traffic does not allocate
+                if (m_read_offset == m_data.size())
+                {
+                    m_data.clear();
+                    m_read_offset = 0;
+                }
+
+                wake(m_writer);
+            }
+
+            if (bytes >= min_bytes)
+                return {bytes, false};
+
+            if (m_is_closed)
+                return {bytes, true};
+
+            m_reader = &reader;
+            return {bytes, false};
+        }
+
+        /**
+         *   Copies the buffers from the position as far as they fit in the capacity
+         *
+         *   @param the buffers
+         *   @param position in the buffers, it is moved past the copied bytes
+         *   @param the writer waits if all of the buffers did not fit
+         */
+        Transfer_result write(
+            std::span<const asio::const_buffer> buffers, Buffer_position& position, Memory_pipe_waiter& writer)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (m_is_closed)
+                return {0, true};
+
+            size_t bytes = 0;
+
+            for (; position.m_index < buffers.size(); ++position.m_index, position.m_offset = 0)
+            {
+                const asio::const_buffer& buffer = buffers[position.m_index];
+                const size_t room = m_capacity - (m_data.size() - m_read_offset);
+                const size_t copied = std::min(buffer.size() - position.m_offset, room);
+
+                append(static_cast<const char*>(buffer.data()) + position.m_offset, copied);
+                bytes += copied;
+                position.m_offset += copied;
+
+                if (position.m_offset < buffer.size())
+                    break;
+            }
+
+            if (bytes > 0)
+                wake(m_reader);
+
+            if (position.m_index < buffers.size())
+                m_writer = &writer;
+
+            return {bytes, false};
+        }
+
+        // Wakes both sides, the buffered bytes can still be read but the writes fail
+        void close()
+        {
+            std::scoped_lock lock(m_mutex);
+            m_is_closed = true;
+
+            wake(m_reader);
+            wake(m_writer);
+        }
+
+    private:
+        static void wake(Memory_pipe_waiter*& waiter)
+        {
+            if (waiter != nullptr)
+                std::exchange(waiter, nullptr)->on_pipe_ready();
+        }
+
+        void append(const char* data, size_t size)
+        {
+            // Moves the unread bytes to the front instead of growing when the read bytes make the room
+            if (m_read_offset > 0 && m_data.size() + size > m_data.capacity())
+            {
+                m_data.erase(m_data.begin(), m_data.begin() + static_cast<std::ptrdiff_t>(m_read_offset));
+                m_read_offset = 0;
+            }
+
+            m_data.insert(m_data.end(), data, data + size);
+        }
+
+        std::mutex m_mutex;
+        std::vector<char> m_data;
+        size_t m_read_offset = 0;
+        const size_t m_capacity;
+        bool m_is_closed = false;
+
+        Memory_pipe_waiter* m_reader = nullptr;
+        Memory_pipe_waiter* m_writer = nullptr;
+    };
+
+    /**
+     *   Socket that is connected to its pair in the same process through two memory pipes, so the framework can be
+     *   tested and benchmarked without the network stack. The handlers run on the strand of the socket like with
+     *   the asio sockets, and a pending operation keeps the lifetime owner alive until it completes or the socket
+     *   is disconnected. The peer wakes the socket only through the lifetime owner, which the Connection sets.
+     *   Create the pair with the create_memory_socket_pair or use the Server::open_memory_connection.
+     */
+    class Memory_socket final : public Socket_interface, private Memory_pipe_waiter
+    {
+    public:
+        // Bytes buffered in each direction before the writer has to wait, about the same as a loopback socket
+        static constexpr size_t DEFAULT_PIPE_CAPACITY = 256 * 1024;
+
+        /**
+         *   @param executor that the strand of the socket is made on
+         *   @param the pipe this reads from
+         *   @param the pipe this writes to
+         */
+        Memory_socket(
+            const asio::any_io_executor& executor, std::shared_ptr<Memory_pipe> in_pipe,
+            std::shared_ptr<Memory_pipe> out_pipe)
+            : m_strand(asio::make_strand(executor)), m_in_pipe(std::move(in_pipe)), m_out_pipe(std::move(out_pipe))
+        {
+        }
+
+        ~Memory_socket() override
+        {
+            disconnect();
+        }
+
+        Memory_socket(const Memory_socket&) = delete;
+        Memory_socket(Memory_socket&&) = delete;
+        Memory_socket& operator=(const Memory_socket&) = delete;
+        Memory_socket& operator=(Memory_socket&&) = delete;
+
+        // There is no tls in memory
+        void async_handshake([[maybe_unused]] Handshake_type type) override
+        {
+            m_handshake_finished.broadcast(asio::error_code());
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(Read_type::header, buffer, size);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(Read_type::body, buffer, size);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            start_read(Read_type::some, buffer, size);
+        }
+
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            m_write_buffers.assign(buffers.begin(), buffers.end());
+            m_write_position = {};
+            m_write_transferred = 0;
+            m_is_writing = true;
+            m_write_owner = lock_lifetime_owner();
+
+            continue_write(true);
+        }
+
+        bool can_write_file() const override
+        {
+            return false;
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+            asio::post(m_strand, [this, owner = lock_lifetime_owner()] {
+                m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+            });
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_strand;
+        }
+
+        // The options are for the kernel sockets so there is nothing to set
+        std::string set_socket_options([[maybe_unused]] const Socket_options& options) override
+        {
+            return "";
+        }
+
+        bool is_open() const override
+        {
+            return m_is_open;
+        }
+
+        // Pair is always in the same process
+        std::string get_ip() const override
+        {
+            return "127.0.0.1";
+        }
+
+        // Closes both directions like a shutdown, the peer reads the bytes that were already written before the eof
+        void disconnect() override
+        {
+            if (!m_is_open)
+                return;
+
+            m_is_open = false;
+            m_in_pipe->close();
+            m_out_pipe->close();
+
+            // Pending operations are cancelled like the asio cancels them when the socket is closed
+            if (m_read_type != Read_type::none)
+                finish_read(asio::error::operation_aborted, true);
+
+            if (m_is_writing)
+                finish_write(asio::error::operation_aborted, true);
+        }
+
+    private:
+        enum class Read_type : uint8_t
+        {
+            none,
+            header,
+            body,
+            some
+        };
+
+        void start_read(Read_type type, void* buffer, size_t size)
+        {
+            m_read_type = type;
+            m_read_buffer = static_cast<char*>(buffer);
+            m_read_size = size;
+            m_read_transferred = 0;
+            m_read_owner = lock_lifetime_owner();
+
+            continue_read(true);
+        }
+
+        /**
+         *   Reads from the pipe until the read is complete or it has to wait for the peer
+         *
+         *   @param true when called from the initiating function, the handler is then posted instead of called
+         */
+        void continue_read(bool is_initiating)
+        {
+            if (m_read_type == Read_type::none)
+                return;
+
+            if (!m_is_open)
+            {
+                finish_read(asio::error::operation_aborted, is_initiating);
+                return;
+            }
+
+            // Read some completes with any bytes, the others need the whole buffer
+            const size_t remaining = m_read_size - m_read_transferred;
+            const size_t min_bytes = m_read_type == Read_type::some ? std::min<size_t>(remaining, 1) : remaining;
+
+            const Memory_pipe::Transfer_result result =
+                m_in_pipe->read(m_read_buffer + m_read_transferred, remaining, min_bytes, *this);
+            m_read_transferred += result.m_bytes;
+
+            if (result.m_bytes >= min_bytes)
+                finish_read(asio::error_code(), is_initiating);
+            else if (result.m_is_closed)
+                finish_read(asio::error::eof, is_initiating);
+        }
+
+        void continue_write(bool is_initiating)
+        {
+            if (!m_is_writing)
+                return;
+
+            if (!m_is_open)
+            {
+                finish_write(asio::error::operation_aborted, is_initiating);
+                return;
+            }
+
+            const Memory_pipe::Transfer_result result = m_out_pipe->write(m_write_buffers, m_write_position, *this);
+            m_write_transferred += result.m_bytes;
+
+            if (result.m_is_closed)
+                finish_write(asio::error::broken_pipe, is_initiating);
+            else if (m_write_position.m_index == m_write_buffers.size())
+                finish_write(asio::error_code(), is_initiating);
+        }
+
+        // Clears the read before the handler so the handler can start the next read
+        void finish_read(asio::error_code error, bool should_post)
+        {
+            const Read_type type = std::exchange(m_read_type, Read_type::none);
+            std::shared_ptr<void> owner = std::move(m_read_owner);
+            const size_t bytes = m_read_transferred;
+
+            auto complete = [this, type, error, bytes] {
+                switch (type)
+                {
+                case Read_type::header:
+                    m_read_header_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::body:
+                    m_read_body_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::some:
+                    m_read_some_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::none:
+                    break;
+                }
+            };
+
+            if (should_post)
+                asio::post(m_strand, [complete, owner = std::move(owner)] { complete(); });
+            else
+                complete();
+        }
+
+        void finish_write(asio::error_code error, bool should_post)
+        {
+            m_is_writing = false;
+            std::shared_ptr<void> owner = std::move(m_write_owner);
+            const size_t bytes = m_write_transferred;
+
+            if (should_post)
+                asio::post(m_strand, [this, error, bytes, owner = std::move(owner)] {
+                    m_write_finished.broadcast(error, bytes);
+                });
+            else
+                m_write_finished.broadcast(error, bytes);
+        }
+
+        // The peer made progress, the pending operations continue on the strand
+        void on_pipe_ready() override
+        {
+            if (std::shared_ptr<void> owner = lock_lifetime_owner())
+                asio::post(m_strand, [this, owner = std::move(owner)] {
+                    continue_read(false);
+                    continue_write(false);
+                });
+        }
+
+        asio::strand<asio::any_io_executor> m_strand;
+        std::shared_ptr<Memory_pipe> m_in_pipe;
+        std::shared_ptr<Memory_pipe> m_out_pipe;
+        std::atomic<bool> m_is_open = true;
+
+        Read_type m_read_type = Read_type::none;
+        char* m_read_buffer = nullptr;
+        size_t m_read_size = 0;
+        size_t m_read_transferred = 0;
+        std::shared_ptr<void> m_read_owner;
+
+        // Descriptors are copied because the span of the caller does not have to outlive the call
+        std::vector<asio::const_buffer> m_write_buffers;
+        Memory_pipe::Buffer_position m_write_position;
+        size_t m_write_transferred = 0;
+        bool m_is_writing = false;
+        std::shared_ptr<void> m_write_owner;
+    };
+
+    /**
+     *   Creates two sockets that are connected to each other in memory
+     *
+     *   @param executor of the first socket
+     *   @param executor of the second socket
+     *   @param bytes buffered in each direction
+     *   @return the sockets
+     */
+    [[nodiscard]] inline std::pair<std::unique_ptr<Memory_socket>, std::unique_ptr<Memory_socket>>
+    create_memory_socket_pair(
+        const asio::any_io_executor& first_executor, const asio::any_io_executor& second_executor,
+        size_t pipe_capacity = Memory_socket::DEFAULT_PIPE_CAPACITY)
+    {
+        auto first_to_second = std::make_shared<Memory_pipe>(pipe_capacity);
+        auto second_to_first = std::make_shared<Memory_pipe>(pipe_capacity);
+
+        return {
+            std::make_unique<Memory_socket>(first_executor, second_to_first, first_to_second),
+            std::make_unique<Memory_socket>(second_executor, first_to_second, second_to_first)};
+    }
+} // namespace Net
@@ -0,0 +1,618 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Handshake_pool.h"
+#include "Socket_interface.h"
+#include "Tls_record_sizer.h"
+#include "Tls_session.h"
+#include <cerrno>
+#include <memory>
+#include <new>
+#include <optional>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <span>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(SSL_OP_ENABLE_KTLS)
+#define NET_HAS_KERNEL_TLS
+#endif
+
+#if defined(SSL_MODE_ASYNC) && defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+#define NET_HAS_ASYNC_TLS
+#endif
+
+namespace Net
+{
+    /**
+     *   Tls socket where OpenSSL works straight on the socket instead of the memory buffers of the asio ssl stream.
+     *   This lets OpenSSL move the record encryption to the kernel after the handshake and the handshake steps
+     *   can be run on other threads because the socket does not have to be touched by them.
+     *   Operations are retried when the socket is ready so nothing blocks the asio thread. If the context has the
+     *   SSL_MODE_ASYNC, the crypto of an asynchronous provider is waited from its fd like the socket is waited.
+     */
+    class Openssl_socket final : public Socket_interface
+    {
+    public:
+        /**
+         *   @param the connected socket
+         *   @param the context with the certificates
+         *   @param should the kernel encrypt the records if it supports the negotiated cipher
+         *   @param where the handshake steps are run, the asio thread runs them if there is no pool
+         *   @throws if the ssl object could not be created
+         */
+        Openssl_socket(
+            Protocol::socket socket, asio::ssl::context& context, [[maybe_unused]] bool use_kernel_tls,
+            std::weak_ptr<Handshake_pool> handshake_pool)
+            : m_socket(std::move(socket)), m_ssl(SSL_new(context.native_handle())),
+              m_handshake_pool(std::move(handshake_pool))
+        {
+            if (m_ssl == nullptr)
+                throw std::bad_alloc();
+
+#ifdef NET_HAS_KERNEL_TLS
+            if (use_kernel_tls)
+                SSL_set_options(m_ssl, SSL_OP_ENABLE_KTLS);
+#endif
+            // OpenSSL frees its record buffers while they are empty, so the idle connections don't hold them
+            SSL_set_mode(m_ssl, SSL_MODE_RELEASE_BUFFERS);
+            SSL_set_fd(m_ssl, static_cast<int>(m_socket.native_handle()));
+
+            asio::error_code ignored_error;
+            m_socket.native_non_blocking(true, ignored_error);
+        }
+
+        Openssl_socket(const Openssl_socket&) = delete;
+        Openssl_socket(Openssl_socket&&) = delete;
+
+        // Socket is closed by the asio socket after the ssl object is freed
+        ~Openssl_socket() override
+        {
+#ifdef NET_HAS_ASYNC_TLS
+            release_async_descriptors();
+#endif
+            SSL_free(m_ssl);
+        }
+
+        Openssl_socket& operator=(const Openssl_socket&) = delete;
+        Openssl_socket& operator=(Openssl_socket&&) = delete;
+
+        void async_handshake(Handshake_type type) override
+        {
+            if (type == Handshake_type::client)
+                SSL_set_connect_state(m_ssl);
+            else
+                SSL_set_accept_state(m_ssl);
+
+            const std::shared_ptr<Handshake_pool> handshake_pool = m_handshake_pool.lock();
+
+            if (handshake_pool == nullptr)
+            {
+                start_steps(
+                    [this](asio::error_code& error) { return handshake_step(error); },
+                    [this](asio::error_code error) { finish_handshake(error); });
+                return;
+            }
+
+            // Pool calls this when there is room for the handshake
+            handshake_pool->start_handshake([this, owner = lock_lifetime_owner()]() mutable {
+                asio::post(m_socket.get_executor(), [this, owner = std::move(owner)]() mutable {
+                    run_handshake_on_pool(std::move(owner));
+                });
+            });
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            read_exactly(buffer, size, m_read_header_finished);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            read_exactly(buffer, size, m_read_body_finished);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            auto bytes_read = std::make_shared<size_t>(0);
+
+            start_steps(
+                [this, buffer, size, bytes_read](asio::error_code& error) {
+                    ERR_clear_error();
+                    const int result = SSL_read_ex(m_ssl, buffer, size, bytes_read.get());
+                    return result == 1 ? Step_result::finished : step_result_of(result, error);
+                },
+                [this, bytes_read](asio::error_code error) { m_read_some_finished.broadcast(error, *bytes_read); });
+        }
+
+        bool can_wait_readable() const override
+        {
+            return true;
+        }
+
+        // Records that OpenSSL has already read from the socket are handled right away
+        void async_wait_readable() override
+        {
+            if (SSL_has_pending(m_ssl) == 1)
+            {
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    m_wait_readable_finished.broadcast(asio::error_code());
+                });
+                return;
+            }
+
+            m_socket.async_wait(
+                Protocol::socket::wait_read, [this, owner = lock_lifetime_owner()](asio::error_code error) {
+                    m_wait_readable_finished.broadcast(error);
+                });
+        }
+
+        // Buffers are copied together so a header and its body can share a record
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            copy_to_write_data(buffers);
+
+            start_steps(
+                [this](asio::error_code& error) { return write_data_step(error); },
+                [this](asio::error_code error) {
+                    const size_t bytes_written = m_write_data.size();
+                    m_record_sizer.finish_write();
+                    release_large_write_data();
+                    m_write_finished.broadcast(error, bytes_written);
+                });
+        }
+
+        // Files can be sent without copying only when the kernel encrypts the sent records
+        bool can_write_file() const override
+        {
+#ifdef NET_HAS_KERNEL_TLS
+            return BIO_get_ktls_send(SSL_get_wbio(m_ssl)) != 0;
+#else
+            return false;
+#endif
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+#ifdef NET_HAS_KERNEL_TLS
+            copy_to_write_data(buffers);
+            auto file_bytes_sent = std::make_shared<size_t>(0);
+
+            start_steps(
+                [this, file, offset, size, file_bytes_sent](asio::error_code& error) {
+                    if (m_write_data_sent < m_write_data.size())
+                    {
+                        const Step_result result = write_data_step(error);
+
+                        if (result != Step_result::finished)
+                            return result;
+                    }
+
+                    while (*file_bytes_sent < size)
+                    {
+                        ERR_clear_error();
+                        const ossl_ssize_t sent = SSL_sendfile(
+                            m_ssl, file->native_handle(), static_cast<off_t>(offset + *file_bytes_sent),
+                            size - *file_bytes_sent, 0);
+
+                        if (sent <= 0)
+                            return step_result_of(static_cast<int>(sent), error);
+
+                        *file_bytes_sent += static_cast<size_t>(sent);
+                    }
+
+                    return Step_result::finished;
+                },
+                [this, file_bytes_sent](asio::error_code error) {
+                    const size_t bytes_written = m_write_data.size() + *file_bytes_sent;
+                    m_record_sizer.finish_write();
+                    release_large_write_data();
+                    m_write_finished.broadcast(error, bytes_written);
+                });
+#endif
+        }
+
+        // Ssl object can be configured before the handshake
+        [[nodiscard]] SSL* native_handle() noexcept
+        {
+            return m_ssl;
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_socket.get_executor();
+        }
+
+        void set_corked(bool is_corked) override
+        {
+            set_tcp_cork(m_socket, is_corked);
+        }
+
+        std::string set_socket_options(const Socket_options& options) override
+        {
+            return apply_socket_options(m_socket, options);
+        }
+
+        bool is_open() const override
+        {
+            return m_socket.is_open();
+        }
+
+        std::optional<Tcp_info> get_tcp_info() override
+        {
+            return m_socket.is_open() ? read_tcp_info(m_socket.native_handle()) : std::nullopt;
+        }
+
+        std::string get_ip() const override
+        {
+            return get_address()->to_string();
+        }
+
+        std::optional<asio::ip::address> get_address() const override
+        {
+            asio::error_code error;
+
+            if (is_open())
+            {
+                const auto endpoint = m_socket.remote_endpoint(error);
+
+                if (!error)
+                    return endpoint.address();
+            }
+
+            return asio::ip::address_v4::any();
+        }
+
+        void disconnect() override
+        {
+            if (is_open())
+            {
+                // OpenSSL stops the session from being resumed if it is freed without being shut down
+                if (m_has_finished_handshake)
+                    SSL_set_shutdown(m_ssl, SSL_SENT_SHUTDOWN);
+
+                // Errors are ignored because the peer could have already closed the connection
+                asio::error_code ignored_error;
+                m_socket.shutdown(asio::socket_base::shutdown_both, ignored_error);
+
+                // Handshake step on the pool could use the number of the socket after it has been reused
+                if (m_is_handshake_on_pool)
+                    m_is_close_pending = true;
+                else
+                    m_socket.close(ignored_error);
+            }
+        }
+
+    private:
+        enum class Step_result : uint8_t
+        {
+            finished,
+            want_read,
+            want_write,
+            want_async,
+            failed
+        };
+
+        // @return what the OpenSSL call needs to continue, error is set if it failed
+        [[nodiscard]] Step_result step_result_of(int result, asio::error_code& error) const
+        {
+            switch (SSL_get_error(m_ssl, result))
+            {
+            case SSL_ERROR_WANT_READ:
+                return Step_result::want_read;
+            case SSL_ERROR_WANT_WRITE:
+                return Step_result::want_write;
+#ifdef NET_HAS_ASYNC_TLS
+            case SSL_ERROR_WANT_ASYNC:
+            case SSL_ERROR_WANT_ASYNC_JOB:
+                return Step_result::want_async;
+#endif
+            case SSL_ERROR_ZERO_RETURN:
+                error = asio::error::eof;
+                return Step_result::failed;
+            case SSL_ERROR_SYSCALL: {
+#ifdef _WIN32
+                const int system_error = ::WSAGetLastError();
+#else
+                const int system_error = errno;
+#endif
+                if (system_error != 0)
+                    error = asio::error_code(system_error, asio::error::get_system_category());
+                else
+                    error = asio::ssl::error::stream_truncated;
+                return Step_result::failed;
+            }
+            default:
+                error = asio::error_code(static_cast<int>(ERR_get_error()), asio::error::get_ssl_category());
+                return Step_result::failed;
+            }
+        }
+
+        /**
+         *   Runs the step on the strand until it is finished, waits for the socket when OpenSSL needs it.
+         *   The first step is posted so the finish is never called inside the call that started the operation.
+         *
+         *   @param function that continues the operation and returns if it is finished
+         *   @param function called with the result when the operation is finished
+         */
+        template <typename Step_function, typename Finish_function>
+        void start_steps(Step_function step, Finish_function finish)
+        {
+            asio::post(
+                m_socket.get_executor(), [this, owner = lock_lifetime_owner(), step = std::move(step),
+                                          finish = std::move(finish)]() mutable {
+                    run_steps(std::move(owner), std::move(step), std::move(finish));
+                });
+        }
+
+        template <typename Step_function, typename Finish_function>
+        void run_steps(std::shared_ptr<void> owner, Step_function step, Finish_function finish)
+        {
+            asio::error_code error;
+            const Step_result result = step(error);
+
+            if (result == Step_result::finished || result == Step_result::failed)
+            {
+                finish(error);
+                return;
+            }
+
+#ifdef NET_HAS_ASYNC_TLS
+            if (result == Step_result::want_async)
+            {
+                wait_async_job(
+                    [this, owner = std::move(owner), step = std::move(step),
+                     finish = std::move(finish)](asio::error_code wait_error) mutable {
+                        if (wait_error)
+                            finish(wait_error);
+                        else
+                            run_steps(std::move(owner), std::move(step), std::move(finish));
+                    });
+                return;
+            }
+#endif
+
+            const auto wait_type =
+                result == Step_result::want_read ? Protocol::socket::wait_read : Protocol::socket::wait_write;
+
+            m_socket.async_wait(
+                wait_type, [this, owner = std::move(owner), step = std::move(step),
+                            finish = std::move(finish)](asio::error_code wait_error) mutable {
+                    if (wait_error)
+                        finish(wait_error);
+                    else
+                        run_steps(std::move(owner), std::move(step), std::move(finish));
+                });
+        }
+
+#ifdef NET_HAS_ASYNC_TLS
+        /**
+         *   Waits until the provider has finished the crypto of the paused job. Job that could not be started
+         *   because the pool of the jobs was empty, or a provider without the fds, is retried on the next turn.
+         *
+         *   @param function called once when the job can be continued
+         */
+        template <typename Handler_type>
+        void wait_async_job(Handler_type handler)
+        {
+            size_t fd_count = 0;
+            SSL_get_all_async_fds(m_ssl, nullptr, &fd_count);
+
+            std::vector<OSSL_ASYNC_FD> fds(fd_count);
+            SSL_get_all_async_fds(m_ssl, fds.data(), &fd_count);
+
+            if (fds.empty())
+            {
+                asio::post(m_socket.get_executor(), [handler = std::move(handler)]() mutable {
+                    handler(asio::error_code());
+                });
+                return;
+            }
+
+            release_async_descriptors();
+
+            // First of the fds that becomes readable continues the job, the waits of the rest are cancelled
+            auto shared_handler = std::make_shared<std::optional<Handler_type>>(std::move(handler));
+
+            for (const OSSL_ASYNC_FD fd : fds)
+            {
+                asio::posix::stream_descriptor& descriptor = m_async_descriptors.emplace_back(m_socket.get_executor());
+                descriptor.assign(fd);
+
+                descriptor.async_wait(
+                    asio::posix::stream_descriptor::wait_read, [this, shared_handler](asio::error_code error) {
+                        if (!shared_handler->has_value())
+                            return;
+
+                        Handler_type continue_job = std::move(**shared_handler);
+                        shared_handler->reset();
+                        release_async_descriptors();
+                        continue_job(error);
+                    });
+            }
+        }
+
+        // Fds belong to the provider so they are released instead of closed
+        void release_async_descriptors() noexcept
+        {
+            for (asio::posix::stream_descriptor& descriptor : m_async_descriptors)
+                if (descriptor.is_open())
+                    descriptor.release();
+
+            m_async_descriptors.clear();
+        }
+#endif
+
+        [[nodiscard]] Step_result handshake_step(asio::error_code& error)
+        {
+            ERR_clear_error();
+            const int result = SSL_do_handshake(m_ssl);
+            return result == 1 ? Step_result::finished : step_result_of(result, error);
+        }
+
+        void finish_handshake(asio::error_code error)
+        {
+            if (!error)
+            {
+                m_has_finished_handshake = true;
+                Tls_session_state::on_handshake_finished(m_ssl);
+            }
+
+            m_handshake_finished.broadcast(error);
+        }
+
+        // Runs the next handshake step on the pool, the waiting for the socket is done on the strand
+        void run_handshake_on_pool(std::shared_ptr<void> owner)
+        {
+            const std::shared_ptr<Handshake_pool> handshake_pool = m_handshake_pool.lock();
+
+            if (handshake_pool == nullptr || !is_open())
+            {
+                finish_handshake_on_pool(asio::error::operation_aborted);
+                return;
+            }
+
+            m_is_handshake_on_pool = true;
+
+            asio::post(handshake_pool->get_executor(), [this, owner = std::move(owner)]() mutable {
+                asio::error_code error;
+                const Step_result result = handshake_step(error);
+
+                asio::post(
+                    m_socket.get_executor(), [this, owner = std::move(owner), result, error]() mutable {
+                        continue_handshake_on_pool(std::move(owner), result, error);
+                    });
+            });
+        }
+
+        void continue_handshake_on_pool(std::shared_ptr<void> owner, Step_result result, asio::error_code error)
+        {
+            m_is_handshake_on_pool = false;
+
+            if (m_is_close_pending)
+            {
+                asio::error_code ignored_error;
+                m_socket.close(ignored_error);
+                finish_handshake_on_pool(asio::error::operation_aborted);
+                return;
+            }
+
+            if (result == Step_result::finished || result == Step_result::failed)
+            {
+                finish_handshake_on_pool(error);
+                return;
+            }
+
+            const auto wait_type =
+                result == Step_result::want_read ? Protocol::socket::wait_read : Protocol::socket::wait_write;
+
+            m_socket.async_wait(wait_type, [this, owner = std::move(owner)](asio::error_code wait_error) mutable {
+                if (wait_error)
+                    finish_handshake_on_pool(wait_error);
+                else
+                    run_handshake_on_pool(std::move(owner));
+            });
+        }
+
+        void finish_handshake_on_pool(asio::error_code error)
+        {
+            if (const std::shared_ptr<Handshake_pool> handshake_pool = m_handshake_pool.lock())
+                handshake_pool->finish_handshake();
+
+            finish_handshake(error);
+        }
+
+        void read_exactly(void* buffer, size_t size, Delegate<asio::error_code, size_t>& finished_event)
+        {
+            auto bytes_read = std::make_shared<size_t>(0);
+
+            start_steps(
+                [this, buffer, size, bytes_read](asio::error_code& error) {
+                    while (*bytes_read < size)
+                    {
+                        size_t read_now = 0;
+                        ERR_clear_error();
+                        const int result =
+                            SSL_read_ex(m_ssl, static_cast<char*>(buffer) + *bytes_read, size - *bytes_read, &read_now);
+
+                        if (result != 1)
+                            return step_result_of(result, error);
+
+                        *bytes_read += read_now;
+                    }
+
+                    return Step_result::finished;
+                },
+                [&finished_event, bytes_read](asio::error_code error) {
+                    finished_event.broadcast(error, *bytes_read);
+                });
+        }
+
+        void copy_to_write_data(std::span<const asio::const_buffer> buffers)
+        {
+            m_write_data.clear();
+            m_write_data_sent = 0;
+            m_record_sizer.start_write();
+
+            for (const asio::const_buffer& buffer : buffers)
+            {
+                const char* data = static_cast<const char*>(buffer.data());
+                m_write_data.insert(m_write_data.end(), data, data + buffer.size());
+            }
+        }
+
+        // Finished write of a large batch would otherwise keep its copy for the rest of the connection
+        void release_large_write_data() noexcept
+        {
+            if (m_write_data.capacity() > MAX_KEPT_WRITE_DATA)
+                std::vector<char>().swap(m_write_data);
+        }
+
+        // SSL_write has to be retried with the same arguments until it succeeds
+        Step_result write_data_step(asio::error_code& error)
+        {
+            while (m_write_data_sent < m_write_data.size())
+            {
+                size_t written = 0;
+                ERR_clear_error();
+                const int result = SSL_write_ex(
+                    m_ssl, m_write_data.data() + m_write_data_sent,
+                    m_record_sizer.get_record_size(m_write_data.size() - m_write_data_sent), &written);
+
+                if (result != 1)
+                    return step_result_of(result, error);
+
+                m_write_data_sent += written;
+                m_record_sizer.add_written(written);
+            }
+
+            return Step_result::finished;
+        }
+
+        // One full tls record, the small writes reuse the buffer and the larger ones allocate it again
+        static constexpr size_t MAX_KEPT_WRITE_DATA = 16 * 1024;
+
+        Protocol::socket m_socket;
+        SSL* m_ssl;
+
+        // Server owns the pool so the handshakes are aborted if it is gone
+        const std::weak_ptr<Handshake_pool> m_handshake_pool;
+        bool m_is_handshake_on_pool = false;
+        bool m_is_close_pending = false;
+        bool m_has_finished_handshake = false;
+
+        // Data of the write that is in progress, only one write can be in progress at a time
+        std::vector<char> m_write_data;
+        size_t m_write_data_sent = 0;
+        Tls_record_sizer m_record_sizer;
+
+#ifdef NET_HAS_ASYNC_TLS
+        // Fds of the provider that the paused job is waiting for
+        std::vector<asio::posix::stream_descriptor> m_async_descriptors;
+#endif
+    };
+} // namespace Net
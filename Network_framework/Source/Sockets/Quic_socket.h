@@ -0,0 +1,940 @@
+#pragma once
+
+/**
+ *   QUIC transport on msquic. It is compiled in only when NET_ENABLE_QUIC is defined, the msquic headers and the
+ *   library have to be available then. See the Server::set_quic_port and the Client::connect_quic.
+ *
+ *   The connection carries the messages in one bidirectional stream, so the applications see the same bytes as
+ *   with tcp. The gain is in the connection itself: the handshake takes one round trip, the resumed connections
+ *   send their first data in the 0-RTT, and the connection survives the address changes of the client because it
+ *   is found by its connection id instead of the addresses.
+ */
+
+#ifdef NET_ENABLE_QUIC
+
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+#include <msquic.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    struct Quic_settings
+    {
+        // Application protocol of the handshake, the server and the client must use the same
+        std::string m_alpn = "net";
+
+        // Connection is closed when nothing has been received for this long
+        std::chrono::milliseconds m_idle_timeout = std::chrono::seconds(30);
+
+        // Keeps the nat mappings open when there is no traffic, zero disables the keep alives
+        std::chrono::milliseconds m_keep_alive_interval = std::chrono::milliseconds(0);
+
+        // Server gives resumption tickets and the client sends its first data in the 0-RTT when it connects again
+        bool m_is_zero_rtt_enabled = true;
+
+        // Certificate chain and private key files in .pem format, only the server needs them
+        std::string m_certificate_file;
+        std::string m_private_key_file;
+
+        // Turn this off only for the tests that use self signed certificates
+        bool m_verify_server_certificate = true;
+
+        bool operator==(const Quic_settings& other) const = default;
+    };
+
+    // The status of msquic differs between the platforms, so only the ones the handlers can act on are mapped
+    [[nodiscard]] inline asio::error_code make_quic_error(QUIC_STATUS status) noexcept
+    {
+        if (QUIC_SUCCEEDED(status))
+            return {};
+
+        switch (status)
+        {
+        case QUIC_STATUS_CONNECTION_IDLE:
+        case QUIC_STATUS_CONNECTION_TIMEOUT:
+            return asio::error::timed_out;
+        case QUIC_STATUS_CONNECTION_REFUSED:
+            return asio::error::connection_refused;
+        case QUIC_STATUS_UNREACHABLE:
+            return asio::error::host_unreachable;
+        case QUIC_STATUS_ABORTED:
+            return asio::error::connection_aborted;
+        default:
+            return asio::error::connection_reset;
+        }
+    }
+
+    [[nodiscard]] inline Protocol::endpoint to_endpoint(const QUIC_ADDR& address)
+    {
+        if (QuicAddrGetFamily(&address) == QUIC_ADDRESS_FAMILY_INET6)
+        {
+            asio::ip::address_v6::bytes_type bytes;
+            std::memcpy(bytes.data(), &address.Ipv6.sin6_addr, bytes.size());
+            return {asio::ip::address_v6(bytes), QuicAddrGetPort(&address)};
+        }
+
+        asio::ip::address_v4::bytes_type bytes;
+        std::memcpy(bytes.data(), &address.Ipv4.sin_addr, bytes.size());
+        return {asio::ip::address_v4(bytes), QuicAddrGetPort(&address)};
+    }
+
+    /**
+     *   Function table and registration of msquic. They are shared by all the users of the process and closed with
+     *   the last of them, the registration waits until its connections and listeners are closed.
+     */
+    class Quic_library
+    {
+    public:
+        Quic_library()
+        {
+            if (const QUIC_STATUS status = MsQuicOpen2(&m_api); QUIC_FAILED(status))
+                throw std::runtime_error(std::format("Could not open msquic, status {}", static_cast<int64_t>(status)));
+
+            const QUIC_REGISTRATION_CONFIG config = {"Network_framework", QUIC_EXECUTION_PROFILE_LOW_LATENCY};
+
+            if (const QUIC_STATUS status = m_api->RegistrationOpen(&config, &m_registration); QUIC_FAILED(status))
+            {
+                MsQuicClose(m_api);
+                throw std::runtime_error(
+                    std::format("Could not open the msquic registration, status {}", static_cast<int64_t>(status)));
+            }
+        }
+
+        ~Quic_library()
+        {
+            m_api->RegistrationClose(m_registration);
+            MsQuicClose(m_api);
+        }
+
+        Quic_library(const Quic_library&) = delete;
+        Quic_library(Quic_library&&) = delete;
+        Quic_library& operator=(const Quic_library&) = delete;
+        Quic_library& operator=(Quic_library&&) = delete;
+
+        // @throws if msquic could not be opened
+        [[nodiscard]] static std::shared_ptr<Quic_library> get()
+        {
+            static std::mutex mutex;
+            static std::weak_ptr<Quic_library> instance;
+
+            std::lock_guard lock(mutex);
+
+            if (auto library = instance.lock())
+                return library;
+
+            auto library = std::make_shared<Quic_library>();
+            instance = library;
+            return library;
+        }
+
+        [[nodiscard]] const QUIC_API_TABLE& get_api() const noexcept
+        {
+            return *m_api;
+        }
+
+        [[nodiscard]] HQUIC get_registration() const noexcept
+        {
+            return m_registration;
+        }
+
+    private:
+        const QUIC_API_TABLE* m_api = nullptr;
+        HQUIC m_registration = nullptr;
+    };
+
+    /**
+     *   Settings and credentials of the connections of one side. The client keeps the latest resumption ticket of
+     *   the server here, so the next connection that uses the same configuration can resume in the 0-RTT.
+     */
+    class Quic_configuration
+    {
+    public:
+        /**
+         *   @param the settings
+         *   @param the side, the server loads its certificate
+         *   @throws if msquic could not be opened or the credentials could not be loaded
+         */
+        Quic_configuration(const Quic_settings& settings, Handshake_type type)
+            : m_library(Quic_library::get()), m_alpn(settings.m_alpn)
+        {
+            QUIC_SETTINGS quic_settings{};
+            quic_settings.IdleTimeoutMs = static_cast<uint64_t>(settings.m_idle_timeout.count());
+            quic_settings.IsSet.IdleTimeoutMs = TRUE;
+
+            if (settings.m_keep_alive_interval.count() > 0)
+            {
+                quic_settings.KeepAliveIntervalMs = static_cast<uint32_t>(settings.m_keep_alive_interval.count());
+                quic_settings.IsSet.KeepAliveIntervalMs = TRUE;
+            }
+
+            // Client opens the only stream of the connection
+            if (type == Handshake_type::server)
+            {
+                quic_settings.PeerBidiStreamCount = 1;
+                quic_settings.IsSet.PeerBidiStreamCount = TRUE;
+
+                if (settings.m_is_zero_rtt_enabled)
+                {
+                    quic_settings.ServerResumptionLevel = QUIC_SERVER_RESUME_AND_ZERORTT;
+                    quic_settings.IsSet.ServerResumptionLevel = TRUE;
+                }
+            }
+
+            const QUIC_API_TABLE& api = m_library->get_api();
+            const QUIC_BUFFER alpn = get_alpn();
+
+            QUIC_STATUS status = api.ConfigurationOpen(
+                m_library->get_registration(), &alpn, 1, &quic_settings, sizeof(quic_settings), nullptr,
+                &m_configuration);
+
+            if (QUIC_FAILED(status))
+                throw std::runtime_error(
+                    std::format("Could not open the quic configuration, status {}", static_cast<int64_t>(status)));
+
+            QUIC_CERTIFICATE_FILE certificate{};
+            QUIC_CREDENTIAL_CONFIG credential{};
+
+            if (type == Handshake_type::server)
+            {
+                certificate.CertificateFile = settings.m_certificate_file.c_str();
+                certificate.PrivateKeyFile = settings.m_private_key_file.c_str();
+                credential.Type = QUIC_CREDENTIAL_TYPE_CERTIFICATE_FILE;
+                credential.CertificateFile = &certificate;
+            }
+            else
+            {
+                credential.Type = QUIC_CREDENTIAL_TYPE_NONE;
+                credential.Flags = QUIC_CREDENTIAL_FLAG_CLIENT;
+
+                if (!settings.m_verify_server_certificate)
+                    credential.Flags |= QUIC_CREDENTIAL_FLAG_NO_CERTIFICATE_VALIDATION;
+            }
+
+            status = api.ConfigurationLoadCredential(m_configuration, &credential);
+
+            if (QUIC_FAILED(status))
+            {
+                api.ConfigurationClose(m_configuration);
+                throw std::runtime_error(
+                    std::format("Could not load the quic credentials, status {}", static_cast<int64_t>(status)));
+            }
+        }
+
+        ~Quic_configuration()
+        {
+            m_library->get_api().ConfigurationClose(m_configuration);
+        }
+
+        Quic_configuration(const Quic_configuration&) = delete;
+        Quic_configuration(Quic_configuration&&) = delete;
+        Quic_configuration& operator=(const Quic_configuration&) = delete;
+        Quic_configuration& operator=(Quic_configuration&&) = delete;
+
+        [[nodiscard]] const QUIC_API_TABLE& get_api() const noexcept
+        {
+            return m_library->get_api();
+        }
+
+        [[nodiscard]] HQUIC get_registration() const noexcept
+        {
+            return m_library->get_registration();
+        }
+
+        [[nodiscard]] HQUIC get_handle() const noexcept
+        {
+            return m_configuration;
+        }
+
+        // msquic takes the alpn as a mutable buffer but does not change it
+        [[nodiscard]] QUIC_BUFFER get_alpn() const noexcept
+        {
+            return {static_cast<uint32_t>(m_alpn.size()), reinterpret_cast<uint8_t*>(const_cast<char*>(m_alpn.data()))};
+        }
+
+        void set_resumption_ticket(std::span<const uint8_t> ticket)
+        {
+            std::lock_guard lock(m_ticket_mutex);
+            m_resumption_ticket.assign(ticket.begin(), ticket.end());
+        }
+
+        [[nodiscard]] std::vector<uint8_t> get_resumption_ticket() const
+        {
+            std::lock_guard lock(m_ticket_mutex);
+            return m_resumption_ticket;
+        }
+
+    private:
+        std::shared_ptr<Quic_library> m_library;
+        std::string m_alpn;
+        HQUIC m_configuration = nullptr;
+
+        mutable std::mutex m_ticket_mutex;
+        std::vector<uint8_t> m_resumption_ticket;
+    };
+
+    /**
+     *   Socket on one quic connection and its stream. msquic calls the handlers from its own threads, they only
+     *   buffer the data and post the continuations to the strand, so the handlers of the socket run on the strand
+     *   like with the asio sockets. A pending operation keeps the lifetime owner alive until it completes.
+     *   The received data is copied to a buffer, the stream stops receiving while the buffer is full so the flow
+     *   control of quic slows the peer down.
+     */
+    class Quic_socket final : public Socket_interface
+    {
+    public:
+        static constexpr size_t MAX_RECEIVE_BUFFER = 1024 * 1024;
+
+        /**
+         *   Client side, the connecting starts in the async_handshake
+         *
+         *   @param executor that the strand of the socket is made on
+         *   @param configuration of the client
+         *   @param host name or ip of the server, it is also checked against the certificate
+         *   @param udp port of the server
+         *   @throws if the connection could not be opened
+         */
+        Quic_socket(
+            const asio::any_io_executor& executor, std::shared_ptr<Quic_configuration> configuration,
+            std::string host, uint16_t port)
+            : m_strand(asio::make_strand(executor)), m_configuration(std::move(configuration)),
+              m_api(m_configuration->get_api()), m_host(std::move(host)), m_port(port), m_ip(m_host)
+        {
+            const QUIC_STATUS status = m_api.ConnectionOpen(
+                m_configuration->get_registration(), &Quic_socket::on_connection_event, this, &m_connection);
+
+            if (QUIC_FAILED(status))
+                throw std::runtime_error(
+                    std::format("Could not open the quic connection, status {}", static_cast<int64_t>(status)));
+        }
+
+        /**
+         *   Server side, takes the connection of the Quic_listener. This has to be created in the new connection
+         *   handler of the listener, before msquic can call the handlers of the connection.
+         *
+         *   @param executor that the strand of the socket is made on
+         *   @param configuration of the server
+         *   @param the new connection
+         *   @param endpoint of the client
+         */
+        Quic_socket(
+            const asio::any_io_executor& executor, std::shared_ptr<Quic_configuration> configuration,
+            HQUIC connection, const Protocol::endpoint& endpoint)
+            : m_strand(asio::make_strand(executor)), m_configuration(std::move(configuration)),
+              m_api(m_configuration->get_api()), m_connection(connection), m_ip(endpoint.address().to_string())
+        {
+            m_api.SetCallbackHandler(m_connection, reinterpret_cast<void*>(&Quic_socket::on_connection_event), this);
+        }
+
+        // Closing waits for the handlers that are running, none of them is called after it
+        ~Quic_socket() override
+        {
+            HQUIC stream = nullptr;
+            {
+                std::lock_guard lock(m_mutex);
+                m_is_closing = true;
+                stream = std::exchange(m_stream, nullptr);
+            }
+
+            if (stream != nullptr)
+                m_api.StreamClose(stream);
+
+            m_api.ConnectionClose(m_connection);
+        }
+
+        Quic_socket(const Quic_socket&) = delete;
+        Quic_socket(Quic_socket&&) = delete;
+        Quic_socket& operator=(const Quic_socket&) = delete;
+        Quic_socket& operator=(Quic_socket&&) = delete;
+
+        /**
+         *   Client completes the handshake right after starting the connection, so the first writes go in the 0-RTT
+         *   when the configuration has a resumption ticket, otherwise msquic holds them until the handshake is done.
+         *   Server completes it when the client has opened the stream.
+         */
+        void async_handshake(Handshake_type type) override
+        {
+            if (type == Handshake_type::server)
+            {
+                std::unique_lock lock(m_mutex);
+                m_handshake_owner = lock_lifetime_owner();
+                m_is_handshake_pending = true;
+
+                if (m_stream != nullptr || m_error)
+                {
+                    lock.unlock();
+                    finish_handshake();
+                }
+
+                return;
+            }
+
+            QUIC_STATUS status = QUIC_STATUS_SUCCESS;
+
+            if (const std::vector<uint8_t> ticket = m_configuration->get_resumption_ticket(); !ticket.empty())
+                status = m_api.SetParam(
+                    m_connection, QUIC_PARAM_CONN_RESUMPTION_TICKET, static_cast<uint32_t>(ticket.size()),
+                    ticket.data());
+
+            // Server may have forgotten the ticket, the connection then has the full handshake
+            if (QUIC_FAILED(status))
+                m_configuration->set_resumption_ticket({});
+
+            status = m_api.ConnectionStart(
+                m_connection, m_configuration->get_handle(), QUIC_ADDRESS_FAMILY_UNSPEC, m_host.c_str(), m_port);
+
+            HQUIC stream = nullptr;
+
+            if (QUIC_SUCCEEDED(status))
+                status = m_api.StreamOpen(
+                    m_connection, QUIC_STREAM_OPEN_FLAG_NONE, &Quic_socket::on_stream_event, this, &stream);
+
+            if (QUIC_SUCCEEDED(status))
+            {
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_stream = stream;
+                }
+
+                status = m_api.StreamStart(stream, QUIC_STREAM_START_FLAG_IMMEDIATE);
+            }
+
+            asio::post(m_strand, [this, error = make_quic_error(status), owner = lock_lifetime_owner()] {
+                m_handshake_finished.broadcast(error);
+            });
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(Read_type::header, buffer, size);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(Read_type::body, buffer, size);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            start_read(Read_type::some, buffer, size);
+        }
+
+        // msquic sends from the buffers of the caller, they stay valid until the m_write_finished
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            std::unique_lock lock(m_mutex);
+
+            m_send_buffers.clear();
+            m_write_size = 0;
+
+            for (const asio::const_buffer& buffer : buffers)
+            {
+                m_send_buffers.push_back(
+                    {static_cast<uint32_t>(buffer.size()),
+                     static_cast<uint8_t*>(const_cast<void*>(buffer.data()))});
+                m_write_size += buffer.size();
+            }
+
+            m_is_writing = true;
+            m_write_owner = lock_lifetime_owner();
+
+            const HQUIC stream = m_stream;
+            lock.unlock();
+
+            if (stream == nullptr || !m_is_open)
+            {
+                finish_write(asio::error::not_connected);
+                return;
+            }
+
+            const QUIC_STATUS status = m_api.StreamSend(
+                stream, m_send_buffers.data(), static_cast<uint32_t>(m_send_buffers.size()),
+                QUIC_SEND_FLAG_ALLOW_0_RTT, this);
+
+            if (QUIC_FAILED(status))
+                finish_write(make_quic_error(status));
+        }
+
+        bool can_write_file() const override
+        {
+            return false;
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+            asio::post(m_strand, [this, owner = lock_lifetime_owner()] {
+                m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+            });
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_strand;
+        }
+
+        // msquic owns the udp sockets, the options of the tcp sockets don't apply to them
+        std::string set_socket_options([[maybe_unused]] const Socket_options& options) override
+        {
+            return "";
+        }
+
+        bool is_open() const override
+        {
+            return m_is_open;
+        }
+
+        // The address changes when the client moves to another network
+        std::string get_ip() const override
+        {
+            std::lock_guard lock(m_mutex);
+            return m_ip;
+        }
+
+        // Closes the connection gracefully, the pending send completes when msquic has cancelled it
+        void disconnect() override
+        {
+            if (!m_is_open.exchange(false))
+                return;
+
+            m_api.ConnectionShutdown(m_connection, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
+
+            std::unique_lock lock(m_mutex);
+
+            if (m_read_type != Read_type::none)
+                finish_read(lock, asio::error::operation_aborted, true);
+        }
+
+    private:
+        enum class Read_type : uint8_t
+        {
+            none,
+            header,
+            body,
+            some
+        };
+
+        static QUIC_STATUS QUIC_API on_connection_event(
+            [[maybe_unused]] HQUIC connection, void* context, QUIC_CONNECTION_EVENT* event)
+        {
+            return static_cast<Quic_socket*>(context)->handle_connection_event(*event);
+        }
+
+        static QUIC_STATUS QUIC_API on_stream_event(
+            [[maybe_unused]] HQUIC stream, void* context, QUIC_STREAM_EVENT* event)
+        {
+            return static_cast<Quic_socket*>(context)->handle_stream_event(*event);
+        }
+
+        QUIC_STATUS handle_connection_event(QUIC_CONNECTION_EVENT& event)
+        {
+            switch (event.Type)
+            {
+            case QUIC_CONNECTION_EVENT_CONNECTED:
+                update_ip();
+                break;
+            case QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED:
+            {
+                const std::string ip = to_endpoint(*event.PEER_ADDRESS_CHANGED.Address).address().to_string();
+                std::lock_guard lock(m_mutex);
+                m_ip = ip;
+                break;
+            }
+            case QUIC_CONNECTION_EVENT_RESUMPTION_TICKET_RECEIVED:
+                m_configuration->set_resumption_ticket(
+                    {event.RESUMPTION_TICKET_RECEIVED.ResumptionTicket,
+                     event.RESUMPTION_TICKET_RECEIVED.ResumptionTicketLength});
+                break;
+            case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED:
+                return handle_peer_stream(event.PEER_STREAM_STARTED.Stream);
+            case QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT:
+                fail(make_quic_error(event.SHUTDOWN_INITIATED_BY_TRANSPORT.Status));
+                break;
+            case QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_PEER:
+                fail(asio::error::connection_reset);
+                break;
+            case QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE:
+                m_is_open = false;
+                fail(asio::error::connection_aborted);
+                break;
+            default:
+                break;
+            }
+
+            return QUIC_STATUS_SUCCESS;
+        }
+
+        // Server gets the stream that the client opened, it is the only one the settings allow
+        QUIC_STATUS handle_peer_stream(HQUIC stream)
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (m_stream != nullptr || m_is_closing)
+            {
+                lock.unlock();
+                m_api.StreamClose(stream);
+                return QUIC_STATUS_SUCCESS;
+            }
+
+            m_stream = stream;
+            m_api.SetCallbackHandler(stream, reinterpret_cast<void*>(&Quic_socket::on_stream_event), this);
+
+            if (m_is_handshake_pending)
+            {
+                lock.unlock();
+                finish_handshake();
+            }
+
+            return QUIC_STATUS_SUCCESS;
+        }
+
+        QUIC_STATUS handle_stream_event(QUIC_STREAM_EVENT& event)
+        {
+            switch (event.Type)
+            {
+            case QUIC_STREAM_EVENT_RECEIVE:
+                receive(std::span(event.RECEIVE.Buffers, event.RECEIVE.BufferCount));
+                break;
+            case QUIC_STREAM_EVENT_SEND_COMPLETE:
+                finish_write(event.SEND_COMPLETE.Canceled ? asio::error::operation_aborted : asio::error_code());
+                break;
+            case QUIC_STREAM_EVENT_PEER_SEND_SHUTDOWN:
+                fail(asio::error::eof);
+                break;
+            case QUIC_STREAM_EVENT_PEER_SEND_ABORTED:
+                fail(asio::error::connection_reset);
+                break;
+            default:
+                break;
+            }
+
+            return QUIC_STATUS_SUCCESS;
+        }
+
+        void update_ip()
+        {
+            QUIC_ADDR address{};
+            uint32_t size = sizeof(address);
+
+            if (QUIC_FAILED(m_api.GetParam(m_connection, QUIC_PARAM_CONN_REMOTE_ADDRESS, &size, &address)))
+                return;
+
+            const std::string ip = to_endpoint(address).address().to_string();
+            std::lock_guard lock(m_mutex);
+            m_ip = ip;
+        }
+
+        // Called from msquic, the stream stops receiving when the buffer is full until the reads have drained it
+        void receive(std::span<const QUIC_BUFFER> buffers)
+        {
+            std::unique_lock lock(m_mutex);
+
+            for (const QUIC_BUFFER& buffer : buffers)
+            {
+                // Moves the unread bytes to the front instead of growing when the read bytes make the room
+                if (m_read_offset > 0 && m_received.size() + buffer.Length > m_received.capacity())
+                {
+                    m_received.erase(
+                        m_received.begin(), m_received.begin() + static_cast<std::ptrdiff_t>(m_read_offset));
+                    m_read_offset = 0;
+                }
+
+                m_received.insert(m_received.end(), buffer.Buffer, buffer.Buffer + buffer.Length);
+            }
+
+            if (m_received.size() - m_read_offset >= MAX_RECEIVE_BUFFER && !m_is_receive_paused)
+            {
+                m_is_receive_paused = true;
+                m_api.StreamReceiveSetEnabled(m_stream, FALSE);
+            }
+
+            wake_reader(lock);
+        }
+
+        // Ends the reads after the buffered bytes and fails the handshake that is still pending
+        void fail(asio::error_code error)
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (!m_error)
+                m_error = error;
+
+            const bool is_handshake_pending = m_is_handshake_pending;
+            wake_reader(lock);
+
+            if (lock.owns_lock())
+                lock.unlock();
+
+            if (is_handshake_pending)
+                finish_handshake();
+        }
+
+        void finish_handshake()
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (!m_is_handshake_pending)
+                return;
+
+            m_is_handshake_pending = false;
+            const asio::error_code error = m_stream != nullptr ? asio::error_code() : m_error;
+            std::shared_ptr<void> owner = std::move(m_handshake_owner);
+            lock.unlock();
+
+            asio::post(m_strand, [this, error, owner = std::move(owner)] { m_handshake_finished.broadcast(error); });
+        }
+
+        void start_read(Read_type type, void* buffer, size_t size)
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_read_type = type;
+                m_read_buffer = static_cast<char*>(buffer);
+                m_read_size = size;
+                m_read_transferred = 0;
+                m_read_owner = lock_lifetime_owner();
+            }
+
+            continue_read(true);
+        }
+
+        /**
+         *   Copies the buffered bytes until the read is complete or it has to wait for more
+         *
+         *   @param true when called from the initiating function, the handler is then posted instead of called
+         */
+        void continue_read(bool is_initiating)
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (m_read_type == Read_type::none)
+                return;
+
+            const size_t bytes = std::min(m_read_size - m_read_transferred, m_received.size() - m_read_offset);
+            std::memcpy(m_read_buffer + m_read_transferred, m_received.data() + m_read_offset, bytes);
+            m_read_offset += bytes;
+            m_read_transferred += bytes;
+
+            // Keeps the capacity of the vector so the steady traffic does not allocate
+            if (m_read_offset == m_received.size())
+            {
+                m_received.clear();
+                m_read_offset = 0;
+            }
+
+            if (m_is_receive_paused && m_received.size() - m_read_offset <= MAX_RECEIVE_BUFFER / 2)
+            {
+                m_is_receive_paused = false;
+                m_api.StreamReceiveSetEnabled(m_stream, TRUE);
+            }
+
+            // Read some completes with any bytes, the others need the whole buffer
+            const bool is_complete = m_read_type == Read_type::some ? m_read_transferred > 0 || m_read_size == 0
+                                                                     : m_read_transferred == m_read_size;
+
+            if (is_complete)
+                finish_read(lock, asio::error_code(), is_initiating);
+            else if (m_error)
+                finish_read(lock, m_error, is_initiating);
+            else if (!m_is_open)
+                finish_read(lock, asio::error::operation_aborted, is_initiating);
+        }
+
+        // Continues the pending read on the strand
+        void wake_reader(std::unique_lock<std::mutex>& lock)
+        {
+            if (m_read_type == Read_type::none)
+                return;
+
+            std::shared_ptr<void> owner = m_read_owner;
+            lock.unlock();
+
+            asio::post(m_strand, [this, owner = std::move(owner)] { continue_read(false); });
+        }
+
+        // Clears the read before the handler so the handler can start the next read
+        void finish_read(std::unique_lock<std::mutex>& lock, asio::error_code error, bool should_post)
+        {
+            const Read_type type = std::exchange(m_read_type, Read_type::none);
+            std::shared_ptr<void> owner = std::move(m_read_owner);
+            const size_t bytes = m_read_transferred;
+            lock.unlock();
+
+            auto complete = [this, type, error, bytes] {
+                switch (type)
+                {
+                case Read_type::header:
+                    m_read_header_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::body:
+                    m_read_body_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::some:
+                    m_read_some_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::none:
+                    break;
+                }
+            };
+
+            if (should_post)
+                asio::post(m_strand, [complete, owner = std::move(owner)] { complete(); });
+            else
+                complete();
+        }
+
+        // Sends complete from msquic or from a failed send, either way the handler is posted to the strand
+        void finish_write(asio::error_code error)
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (!m_is_writing)
+                return;
+
+            m_is_writing = false;
+            std::shared_ptr<void> owner = std::move(m_write_owner);
+            const size_t bytes = error ? 0 : m_write_size;
+            lock.unlock();
+
+            asio::post(m_strand, [this, error, bytes, owner = std::move(owner)] {
+                m_write_finished.broadcast(error, bytes);
+            });
+        }
+
+        asio::strand<asio::any_io_executor> m_strand;
+        std::shared_ptr<Quic_configuration> m_configuration;
+        const QUIC_API_TABLE& m_api;
+        HQUIC m_connection = nullptr;
+        std::string m_host;
+        uint16_t m_port = 0;
+        std::atomic<bool> m_is_open = true;
+
+        // Guards the rest, msquic calls the handlers from its own threads
+        mutable std::mutex m_mutex;
+        HQUIC m_stream = nullptr;
+        std::string m_ip;
+        asio::error_code m_error;
+        bool m_is_closing = false;
+        bool m_is_handshake_pending = false;
+        std::shared_ptr<void> m_handshake_owner;
+
+        std::vector<char> m_received;
+        size_t m_read_offset = 0;
+        bool m_is_receive_paused = false;
+
+        Read_type m_read_type = Read_type::none;
+        char* m_read_buffer = nullptr;
+        size_t m_read_size = 0;
+        size_t m_read_transferred = 0;
+        std::shared_ptr<void> m_read_owner;
+
+        // msquic reads the descriptors until the send completes
+        std::vector<QUIC_BUFFER> m_send_buffers;
+        size_t m_write_size = 0;
+        bool m_is_writing = false;
+        std::shared_ptr<void> m_write_owner;
+    };
+
+    /**
+     *   Listens the udp port for the quic connections. The m_on_new_connection is called from the threads of
+     *   msquic, it decides whether the connection is accepted and creates the Quic_socket for it.
+     */
+    class Quic_listener
+    {
+    public:
+        explicit Quic_listener(std::shared_ptr<Quic_configuration> configuration)
+            : m_configuration(std::move(configuration)), m_api(m_configuration->get_api())
+        {
+        }
+
+        // Closing waits for the handler that is running, none is called after it
+        ~Quic_listener()
+        {
+            if (m_listener != nullptr)
+                m_api.ListenerClose(m_listener);
+        }
+
+        Quic_listener(const Quic_listener&) = delete;
+        Quic_listener(Quic_listener&&) = delete;
+        Quic_listener& operator=(const Quic_listener&) = delete;
+        Quic_listener& operator=(Quic_listener&&) = delete;
+
+        /**
+         *   Starts listening the port on all the addresses, set the m_on_new_connection before this
+         *
+         *   @throws if the port could not be listened
+         */
+        void start(uint16_t port)
+        {
+            QUIC_STATUS status =
+                m_api.ListenerOpen(m_configuration->get_registration(), &Quic_listener::on_event, this, &m_listener);
+
+            if (QUIC_SUCCEEDED(status))
+            {
+                QUIC_ADDR address{};
+                QuicAddrSetFamily(&address, QUIC_ADDRESS_FAMILY_UNSPEC);
+                QuicAddrSetPort(&address, port);
+
+                const QUIC_BUFFER alpn = m_configuration->get_alpn();
+                status = m_api.ListenerStart(m_listener, &alpn, 1, &address);
+            }
+
+            if (QUIC_FAILED(status))
+                throw std::runtime_error(
+                    std::format("Could not listen the quic port {}, status {}", port, static_cast<int64_t>(status)));
+        }
+
+        /**
+         *   Called for every new connection
+         *
+         *   @param the connection, it is given to the Quic_socket when accepted
+         *   @param endpoint of the client
+         *   @param set to false to refuse the connection
+         */
+        Delegate<HQUIC, const Protocol::endpoint&, bool&> m_on_new_connection;
+
+    private:
+        static QUIC_STATUS QUIC_API on_event([[maybe_unused]] HQUIC listener, void* context, QUIC_LISTENER_EVENT* event)
+        {
+            return static_cast<Quic_listener*>(context)->handle_event(*event);
+        }
+
+        // Configuration is set before the handler so a refused connection is only closed by msquic
+        QUIC_STATUS handle_event(QUIC_LISTENER_EVENT& event)
+        {
+            if (event.Type != QUIC_LISTENER_EVENT_NEW_CONNECTION)
+                return QUIC_STATUS_SUCCESS;
+
+            const HQUIC connection = event.NEW_CONNECTION.Connection;
+            const QUIC_STATUS status = m_api.ConnectionSetConfiguration(connection, m_configuration->get_handle());
+
+            if (QUIC_FAILED(status))
+                return status;
+
+            bool is_accepted = false;
+            m_on_new_connection.broadcast(
+                connection, to_endpoint(*event.NEW_CONNECTION.Info->RemoteAddress), is_accepted);
+
+            return is_accepted ? QUIC_STATUS_SUCCESS : QUIC_STATUS_CONNECTION_REFUSED;
+        }
+
+        std::shared_ptr<Quic_configuration> m_configuration;
+        const QUIC_API_TABLE& m_api;
+        HQUIC m_listener = nullptr;
+    };
+} // namespace Net
+
+#endif
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Receive buffers of the connections on one io_context that are registered with its io_uring, so the kernel
+     *   does not have to map the pages of the buffer on every read. This is a service of the io_context, see the
+     *   Asio_base::set_registered_receive_buffers.
+     *
+     *   Connections allocate their buffered mode receive buffer from the get_memory and the socket reads with the
+     *   registered buffer when the buffer it reads to is inside the registered memory. Buffer that grows over the
+     *   slot size is allocated from the heap and read the normal way.
+     */
+    class Registered_receive_buffers final : public asio::execution_context::service
+    {
+    public:
+        static inline asio::execution_context::id id;
+
+        explicit Registered_receive_buffers(asio::execution_context& context)
+            : asio::execution_context::service(context)
+        {
+        }
+
+        /**
+         *   Allocates the slots and registers them with the io_context, nothing is done if already registered
+         *
+         *   @param the io_context of this service
+         *   @param the amount of slots, one for each connection
+         *   @param size of a slot
+         */
+        void register_buffers(asio::io_context& context, size_t slot_count, size_t slot_size)
+        {
+            if (m_memory || slot_count == 0 || slot_size == 0)
+                return;
+
+            m_memory = std::make_shared<Slots>(slot_count, slot_size);
+            m_registration.emplace(asio::register_buffers(context, m_memory->get_buffer()));
+        }
+
+        // @return the memory of the receive buffers or nullptr if nothing is registered
+        [[nodiscard]] std::shared_ptr<std::pmr::memory_resource> get_memory() const noexcept
+        {
+            return m_memory;
+        }
+
+        /**
+         *   @param start of the buffer
+         *   @param size of the buffer
+         *   @return the registered buffer if the whole buffer is inside the registered memory
+         */
+        [[nodiscard]] std::optional<asio::mutable_registered_buffer> find(void* data, size_t size) const noexcept
+        {
+            if (!m_registration || !m_memory->contains(data, size))
+                return std::nullopt;
+
+            return asio::buffer(*m_registration->begin() + m_memory->get_offset(data), size);
+        }
+
+    private:
+        // Fixed size slots in one block of memory, the allocations that don't fit go to the heap
+        class Slots final : public std::pmr::memory_resource
+        {
+        public:
+            Slots(size_t slot_count, size_t slot_size)
+                : m_slot_size(slot_size), m_size(slot_count * slot_size), m_block(std::make_unique<char[]>(m_size))
+            {
+                m_free_slots.reserve(slot_count);
+
+                for (size_t i = slot_count; i > 0; --i)
+                    m_free_slots.push_back(i - 1);
+            }
+
+            [[nodiscard]] asio::mutable_buffer get_buffer() const noexcept
+            {
+                return asio::buffer(m_block.get(), m_size);
+            }
+
+            [[nodiscard]] bool contains(const void* data, size_t size) const noexcept
+            {
+                const char* begin = static_cast<const char*>(data);
+                return begin >= m_block.get() && begin + size <= m_block.get() + m_size;
+            }
+
+            [[nodiscard]] size_t get_offset(const void* data) const noexcept
+            {
+                return static_cast<size_t>(static_cast<const char*>(data) - m_block.get());
+            }
+
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override
+            {
+                if (bytes <= m_slot_size && alignment <= alignof(std::max_align_t))
+                {
+                    std::scoped_lock lock(m_mutex);
+
+                    if (!m_free_slots.empty())
+                    {
+                        const size_t slot = m_free_slots.back();
+                        m_free_slots.pop_back();
+                        return m_block.get() + slot * m_slot_size;
+                    }
+                }
+
+                return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            }
+
+            void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+            {
+                if (!contains(pointer, 1))
+                {
+                    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+                    return;
+                }
+
+                std::scoped_lock lock(m_mutex);
+                m_free_slots.push_back(get_offset(pointer) / m_slot_size);
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+            {
+                return this == &other;
+            }
+
+            const size_t m_slot_size;
+            const size_t m_size;
+            const std::unique_ptr<char[]> m_block;
+
+            std::mutex m_mutex;
+            std::vector<size_t> m_free_slots;
+        };
+
+        // Registration is released before the services of the io_context are destroyed
+        void shutdown() override
+        {
+            m_registration.reset();
+        }
+
+        // Connections share the memory so their buffers stay valid even if they outlive the io_context
+        std::shared_ptr<Slots> m_memory;
+        std::optional<asio::buffer_registration<asio::mutable_buffer>> m_registration;
+    };
+} // namespace Net
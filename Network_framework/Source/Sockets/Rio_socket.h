@@ -0,0 +1,723 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+
+#if defined(_WIN32) && defined(ASIO_HAS_WINDOWS_OBJECT_HANDLE)
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <mswsock.h>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#define NET_HAS_RIO
+#endif
+
+namespace Net
+{
+#ifdef NET_HAS_RIO
+    /**
+     *   Operation of a Rio_socket that is in the completion queue, the request context of the RIO points to it.
+     *   The socket keeps the operation until it has completed.
+     */
+    struct Rio_operation
+    {
+        void (*m_on_complete)(Rio_operation& operation, LONG status, ULONG bytes) = nullptr;
+    };
+
+    /**
+     *   Completion queue and the registered buffers of the Registered I/O sockets of one io_context. The buffers
+     *   are registered once, so the kernel does not have to lock their pages on every send and receive like it
+     *   does with the overlapped operations. The sockets share this with the Rio_service and keep it alive.
+     */
+    class Rio_completion_queue
+    {
+    public:
+        /**
+         *   @param the function table of the RIO
+         *   @param the event the queue signals when it has completions
+         *   @param the amount of the buffers
+         *   @param size of a buffer
+         *   @throws if the queue could not be created or the buffers registered
+         */
+        Rio_completion_queue(
+            const RIO_EXTENSION_FUNCTION_TABLE& functions, HANDLE event, size_t buffer_count, size_t buffer_size)
+            : m_functions(functions), m_buffer_size(static_cast<ULONG>(buffer_size))
+        {
+            RIO_NOTIFICATION_COMPLETION notification = {};
+            notification.Type = RIO_EVENT_COMPLETION;
+            notification.Event.EventHandle = event;
+            notification.Event.NotifyReset = TRUE;
+
+            m_queue = m_functions.RIOCreateCompletionQueue(static_cast<DWORD>(m_queue_size), &notification);
+
+            if (m_queue == RIO_INVALID_CQ)
+                throw std::runtime_error("RIO completion queue could not be created");
+
+            // Pages of their own, the registration locks them for the lifetime of the queue
+            const size_t memory_size = buffer_count * buffer_size;
+            m_memory = static_cast<char*>(
+                VirtualAlloc(nullptr, memory_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+
+            if (m_memory != nullptr)
+                m_buffer_id = m_functions.RIORegisterBuffer(m_memory, static_cast<DWORD>(memory_size));
+
+            if (m_buffer_id == RIO_INVALID_BUFFERID)
+            {
+                release();
+                throw std::runtime_error("RIO buffers could not be registered");
+            }
+
+            m_free_buffers.reserve(buffer_count);
+
+            for (size_t i = buffer_count; i > 0; --i)
+                m_free_buffers.push_back(static_cast<ULONG>((i - 1) * buffer_size));
+        }
+
+        Rio_completion_queue(const Rio_completion_queue&) = delete;
+        Rio_completion_queue(Rio_completion_queue&&) = delete;
+
+        ~Rio_completion_queue()
+        {
+            release();
+        }
+
+        Rio_completion_queue& operator=(const Rio_completion_queue&) = delete;
+        Rio_completion_queue& operator=(Rio_completion_queue&&) = delete;
+
+        // @return a free buffer or nullopt if all of them are in use
+        [[nodiscard]] std::optional<RIO_BUF> allocate_buffer()
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (m_free_buffers.empty())
+                return std::nullopt;
+
+            RIO_BUF buffer = {};
+            buffer.BufferId = m_buffer_id;
+            buffer.Offset = m_free_buffers.back();
+            buffer.Length = m_buffer_size;
+
+            m_free_buffers.pop_back();
+            return buffer;
+        }
+
+        void release_buffer(const RIO_BUF& buffer)
+        {
+            std::scoped_lock lock(m_mutex);
+            m_free_buffers.push_back(buffer.Offset);
+        }
+
+        [[nodiscard]] char* get_data(const RIO_BUF& buffer) const noexcept
+        {
+            return m_memory + buffer.Offset;
+        }
+
+        /**
+         *   Creates the request queue of the socket, it is freed when the socket is closed. Every socket has
+         *   atmost one send and one receive in progress, the completion queue grows to fit them.
+         *
+         *   @return RIO_INVALID_RQ if the socket was not created with the WSA_FLAG_REGISTERED_IO
+         */
+        [[nodiscard]] RIO_RQ create_request_queue(SOCKET socket)
+        {
+            std::scoped_lock lock(m_mutex);
+            const size_t needed_size = (m_request_queue_count + 1) * 2;
+
+            if (needed_size > m_queue_size)
+            {
+                const size_t new_size = std::max(needed_size, m_queue_size * 2);
+
+                if (!m_functions.RIOResizeCompletionQueue(m_queue, static_cast<DWORD>(new_size)))
+                    return RIO_INVALID_RQ;
+
+                m_queue_size = new_size;
+            }
+
+            const RIO_RQ request_queue =
+                m_functions.RIOCreateRequestQueue(socket, 1, 1, 1, 1, m_queue, m_queue, nullptr);
+
+            if (request_queue != RIO_INVALID_RQ)
+                ++m_request_queue_count;
+
+            return request_queue;
+        }
+
+        // Called when the socket of a request queue has been closed, its room in the completion queue is not needed
+        void remove_request_queue()
+        {
+            std::scoped_lock lock(m_mutex);
+            --m_request_queue_count;
+        }
+
+        // Request and completion queues are not thread safe, so the operations are serialized with the dequeue
+        [[nodiscard]] bool receive(RIO_RQ request_queue, RIO_BUF& buffer, Rio_operation& operation)
+        {
+            std::scoped_lock lock(m_mutex);
+            return m_functions.RIOReceive(request_queue, &buffer, 1, 0, &operation) != FALSE;
+        }
+
+        [[nodiscard]] bool send(RIO_RQ request_queue, RIO_BUF& buffer, Rio_operation& operation)
+        {
+            std::scoped_lock lock(m_mutex);
+            return m_functions.RIOSend(request_queue, &buffer, 1, 0, &operation) != FALSE;
+        }
+
+        // Completes the finished operations and asks the queue to signal the event for the next ones
+        void dequeue_completions()
+        {
+            std::array<RIORESULT, DEQUEUE_SIZE> results;
+            std::unique_lock lock(m_mutex);
+
+            while (true)
+            {
+                const ULONG count = m_functions.RIODequeueCompletion(m_queue, results.data(), DEQUEUE_SIZE);
+
+                if (count == 0 || count == RIO_CORRUPT_CQ)
+                    break;
+
+                // Operations post their completions to the strands of the sockets, so they don't need the lock
+                lock.unlock();
+
+                for (ULONG i = 0; i < count; ++i)
+                {
+                    auto& operation = *reinterpret_cast<Rio_operation*>(results[i].RequestContext);
+                    operation.m_on_complete(operation, results[i].Status, results[i].BytesTransferred);
+                }
+
+                lock.lock();
+            }
+
+            m_functions.RIONotify(m_queue);
+        }
+
+    private:
+        static constexpr size_t INITIAL_QUEUE_SIZE = 1024;
+        static constexpr ULONG DEQUEUE_SIZE = 128;
+
+        void release() noexcept
+        {
+            if (m_buffer_id != RIO_INVALID_BUFFERID)
+                m_functions.RIODeregisterBuffer(m_buffer_id);
+
+            if (m_memory != nullptr)
+                VirtualFree(m_memory, 0, MEM_RELEASE);
+
+            if (m_queue != RIO_INVALID_CQ)
+                m_functions.RIOCloseCompletionQueue(m_queue);
+        }
+
+        const RIO_EXTENSION_FUNCTION_TABLE m_functions;
+        const ULONG m_buffer_size;
+
+        std::mutex m_mutex;
+        RIO_CQ m_queue = RIO_INVALID_CQ;
+        size_t m_queue_size = INITIAL_QUEUE_SIZE;
+        size_t m_request_queue_count = 0;
+
+        char* m_memory = nullptr;
+        RIO_BUFFERID m_buffer_id = RIO_INVALID_BUFFERID;
+        std::vector<ULONG> m_free_buffers;
+    };
+
+    /**
+     *   Registered I/O of the io_context, see the Asio_base::set_registered_io. The completion queue signals an
+     *   event that is waited like any other asio operation, so the completions are handled on the threads of the
+     *   io_context next to its IOCP.
+     */
+    class Rio_service final : public asio::execution_context::service
+    {
+    public:
+        static inline asio::execution_context::id id;
+
+        explicit Rio_service(asio::execution_context& context) : asio::execution_context::service(context)
+        {
+        }
+
+        /**
+         *   Loads the RIO, creates the completion queue and registers the buffers. Nothing is done if already
+         *   started.
+         *
+         *   @param the io_context of this service
+         *   @param the amount of buffers, every socket takes two
+         *   @param size of a buffer, the largest send and receive of a socket
+         *   @return false if the RIO is not available or the buffers could not be registered
+         */
+        bool start(asio::io_context& context, size_t buffer_count, size_t buffer_size)
+        {
+            if (m_queue)
+                return true;
+
+            RIO_EXTENSION_FUNCTION_TABLE functions = {};
+
+            if (buffer_count == 0 || buffer_size == 0 || !load_functions(functions))
+                return false;
+
+            HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+            if (event == nullptr)
+                return false;
+
+            // Object handle owns the event and closes it
+            m_event.emplace(context, event);
+
+            try
+            {
+                m_queue = std::make_shared<Rio_completion_queue>(functions, event, buffer_count, buffer_size);
+            }
+            catch (const std::runtime_error&)
+            {
+                m_event.reset();
+                return false;
+            }
+
+            m_queue->dequeue_completions();
+            wait_completions();
+            return true;
+        }
+
+        // @return the completion queue or nullptr if the RIO was not started
+        [[nodiscard]] std::shared_ptr<Rio_completion_queue> get_queue() const noexcept
+        {
+            return m_queue;
+        }
+
+    private:
+        [[nodiscard]] static bool load_functions(RIO_EXTENSION_FUNCTION_TABLE& functions)
+        {
+            const SOCKET socket =
+                WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+
+            if (socket == INVALID_SOCKET)
+                return false;
+
+            GUID function_table_id = WSAID_MULTIPLE_RIO;
+            DWORD bytes = 0;
+            functions.cbSize = sizeof(functions);
+
+            const int result = WSAIoctl(
+                socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &function_table_id, sizeof(function_table_id),
+                &functions, sizeof(functions), &bytes, nullptr, nullptr);
+
+            closesocket(socket);
+            return result == 0;
+        }
+
+        void wait_completions()
+        {
+            m_event->async_wait([this](asio::error_code error) {
+                if (error)
+                    return;
+
+                m_queue->dequeue_completions();
+                wait_completions();
+            });
+        }
+
+        // Wait of the event is cancelled before the services of the io_context are destroyed
+        void shutdown() override
+        {
+            m_event.reset();
+        }
+
+        std::optional<asio::windows::object_handle> m_event;
+        std::shared_ptr<Rio_completion_queue> m_queue;
+    };
+
+    /**
+     *   Tcp socket that sends and receives with the Registered I/O instead of the overlapped operations. Data is
+     *   copied between the registered buffers of the socket and the buffers of the connection, which costs less
+     *   than the locking of the pages of every operation for the small messages. The socket has to be created
+     *   with the WSA_FLAG_REGISTERED_IO, see the open_registered_io_acceptor.
+     */
+    class Rio_socket final : public Socket_interface
+    {
+    public:
+        /**
+         *   @param the connected socket, it is moved only if this returns a socket
+         *   @return nullptr if the io_context of the socket has no RIO, its buffers are all in use or the socket was
+         *           not created for the RIO, the socket should be used the normal way then
+         */
+        [[nodiscard]] static std::unique_ptr<Rio_socket> create(Protocol::socket& socket)
+        {
+            asio::execution_context& context = asio::query(socket.get_executor(), asio::execution::context);
+
+            if (!asio::has_service<Rio_service>(context))
+                return nullptr;
+
+            std::shared_ptr<Rio_completion_queue> queue = asio::use_service<Rio_service>(context).get_queue();
+
+            if (queue == nullptr)
+                return nullptr;
+
+            const std::optional<RIO_BUF> receive_buffer = queue->allocate_buffer();
+            const std::optional<RIO_BUF> send_buffer = receive_buffer ? queue->allocate_buffer() : std::nullopt;
+            const RIO_RQ request_queue =
+                send_buffer ? queue->create_request_queue(socket.native_handle()) : RIO_INVALID_RQ;
+
+            if (request_queue == RIO_INVALID_RQ)
+            {
+                if (receive_buffer)
+                    queue->release_buffer(*receive_buffer);
+
+                if (send_buffer)
+                    queue->release_buffer(*send_buffer);
+
+                return nullptr;
+            }
+
+            return std::unique_ptr<Rio_socket>(new Rio_socket(
+                std::move(socket), std::move(queue), request_queue, *receive_buffer, *send_buffer));
+        }
+
+        Rio_socket(const Rio_socket&) = delete;
+        Rio_socket(Rio_socket&&) = delete;
+
+        ~Rio_socket() override
+        {
+            asio::error_code ignored_error;
+            m_socket.close(ignored_error);
+
+            m_queue->remove_request_queue();
+            m_queue->release_buffer(m_receive_buffer);
+            m_queue->release_buffer(m_send_buffer);
+        }
+
+        Rio_socket& operator=(const Rio_socket&) = delete;
+        Rio_socket& operator=(Rio_socket&&) = delete;
+
+        void async_handshake([[maybe_unused]] Handshake_type type) override
+        {
+            asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                m_handshake_finished.broadcast(asio::error_code());
+            });
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, size, m_read_header_finished);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, size, m_read_body_finished);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, std::min<size_t>(size, 1), m_read_some_finished);
+        }
+
+        // Buffers are copied to the registered send buffer and sent a buffer full at a time
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            m_write_buffers = buffers;
+            m_write_index = 0;
+            m_write_offset = 0;
+            m_bytes_written = 0;
+
+            send_next(lock_lifetime_owner());
+        }
+
+        bool can_write_file() const override
+        {
+            return false;
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+            m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_socket.get_executor();
+        }
+
+        std::string set_socket_options(const Socket_options& options) override
+        {
+            return apply_socket_options(m_socket, options);
+        }
+
+        bool is_open() const override
+        {
+            return m_socket.is_open();
+        }
+
+        std::optional<Tcp_info> get_tcp_info() override
+        {
+            return m_socket.is_open() ? read_tcp_info(m_socket.native_handle()) : std::nullopt;
+        }
+
+        std::string get_ip() const override
+        {
+            return get_address()->to_string();
+        }
+
+        std::optional<asio::ip::address> get_address() const override
+        {
+            asio::error_code error;
+
+            if (is_open())
+            {
+                const auto endpoint = m_socket.remote_endpoint(error);
+
+                if (!error)
+                    return endpoint.address();
+            }
+
+            return asio::ip::address_v4::any();
+        }
+
+        // Closing the socket completes the operations in the queue with an error
+        void disconnect() override
+        {
+            if (is_open())
+            {
+                // Errors are ignored because the peer could have already closed the connection
+                asio::error_code ignored_error;
+                m_socket.shutdown(asio::socket_base::shutdown_both, ignored_error);
+                m_socket.close(ignored_error);
+            }
+        }
+
+    private:
+        // Operation keeps the owner of the socket alive until the completion queue has returned it
+        struct Socket_operation : Rio_operation
+        {
+            Rio_socket* m_socket = nullptr;
+            std::shared_ptr<void> m_owner;
+        };
+
+        // Read that is in progress, only one read can be in progress at a time
+        struct Pending_read
+        {
+            char* m_buffer = nullptr;
+            size_t m_size = 0;
+            size_t m_min_size = 0;
+            size_t m_bytes_read = 0;
+            Delegate<asio::error_code, size_t>* m_finished_event = nullptr;
+        };
+
+        Rio_socket(
+            Protocol::socket socket, std::shared_ptr<Rio_completion_queue> queue, RIO_RQ request_queue,
+            RIO_BUF receive_buffer, RIO_BUF send_buffer)
+            : m_socket(std::move(socket)), m_queue(std::move(queue)), m_request_queue(request_queue),
+              m_receive_buffer(receive_buffer), m_send_buffer(send_buffer)
+        {
+            m_receive_operation.m_socket = this;
+            m_receive_operation.m_on_complete = [](Rio_operation& operation, LONG status, ULONG bytes) {
+                post_completion(static_cast<Socket_operation&>(operation), status, bytes, &Rio_socket::on_received);
+            };
+
+            m_send_operation.m_socket = this;
+            m_send_operation.m_on_complete = [](Rio_operation& operation, LONG status, ULONG bytes) {
+                post_completion(static_cast<Socket_operation&>(operation), status, bytes, &Rio_socket::on_sent);
+            };
+        }
+
+        // Completion queue is dequeued on any thread of the io_context, the socket is used only on its strand
+        static void post_completion(
+            Socket_operation& operation, LONG status, ULONG bytes,
+            void (Rio_socket::*on_complete)(std::shared_ptr<void>, asio::error_code, size_t))
+        {
+            Rio_socket& socket = *operation.m_socket;
+            const asio::error_code error =
+                status != 0 ? asio::error_code(status, asio::error::get_system_category()) : asio::error_code();
+
+            asio::post(
+                socket.m_socket.get_executor(),
+                [&socket, owner = std::move(operation.m_owner), on_complete, error, bytes]() mutable {
+                    (socket.*on_complete)(std::move(owner), error, bytes);
+                });
+        }
+
+        void start_read(void* buffer, size_t size, size_t min_size, Delegate<asio::error_code, size_t>& finished_event)
+        {
+            m_pending_read = {
+                .m_buffer = static_cast<char*>(buffer),
+                .m_size = size,
+                .m_min_size = min_size,
+                .m_finished_event = &finished_event};
+
+            if (take_received())
+            {
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    finish_read(asio::error_code());
+                });
+                return;
+            }
+
+            receive_next(lock_lifetime_owner());
+        }
+
+        void receive_next(std::shared_ptr<void> owner)
+        {
+            m_receive_operation.m_owner = std::move(owner);
+
+            if (!m_queue->receive(m_request_queue, m_receive_buffer, m_receive_operation))
+            {
+                m_receive_operation.m_owner = nullptr;
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    finish_read(asio::error_code(WSAGetLastError(), asio::error::get_system_category()));
+                });
+            }
+        }
+
+        void on_received(std::shared_ptr<void> owner, asio::error_code error, size_t bytes)
+        {
+            if (!error && bytes == 0)
+                error = asio::error::eof;
+
+            if (error)
+            {
+                finish_read(error);
+                return;
+            }
+
+            m_received_offset = 0;
+            m_received_size = bytes;
+
+            if (take_received())
+                finish_read(error);
+            else
+                receive_next(std::move(owner));
+        }
+
+        // @return true if the read has atleast its minimum size
+        bool take_received() noexcept
+        {
+            const size_t part_size =
+                std::min(m_received_size - m_received_offset, m_pending_read.m_size - m_pending_read.m_bytes_read);
+
+            if (part_size > 0)
+            {
+                std::memcpy(
+                    m_pending_read.m_buffer + m_pending_read.m_bytes_read,
+                    m_queue->get_data(m_receive_buffer) + m_received_offset, part_size);
+
+                m_pending_read.m_bytes_read += part_size;
+                m_received_offset += part_size;
+            }
+
+            return m_pending_read.m_bytes_read >= m_pending_read.m_min_size;
+        }
+
+        void finish_read(asio::error_code error)
+        {
+            const Pending_read pending_read = std::exchange(m_pending_read, Pending_read());
+            pending_read.m_finished_event->broadcast(error, pending_read.m_bytes_read);
+        }
+
+        // Copies the next part of the write to the send buffer, the write is finished when nothing is left
+        void send_next(std::shared_ptr<void> owner)
+        {
+            char* data = m_queue->get_data(m_send_buffer);
+            ULONG size = 0;
+
+            while (m_write_index < m_write_buffers.size() && size < m_send_buffer_capacity)
+            {
+                const asio::const_buffer& buffer = m_write_buffers[m_write_index];
+                const size_t part_size =
+                    std::min(buffer.size() - m_write_offset, size_t{m_send_buffer_capacity - size});
+
+                std::memcpy(data + size, static_cast<const char*>(buffer.data()) + m_write_offset, part_size);
+                size += static_cast<ULONG>(part_size);
+                m_write_offset += part_size;
+
+                if (m_write_offset == buffer.size())
+                {
+                    ++m_write_index;
+                    m_write_offset = 0;
+                }
+            }
+
+            if (size == 0)
+            {
+                asio::post(m_socket.get_executor(), [this, owner = std::move(owner)] {
+                    m_write_finished.broadcast(asio::error_code(), m_bytes_written);
+                });
+                return;
+            }
+
+            RIO_BUF send_buffer = m_send_buffer;
+            send_buffer.Length = size;
+            m_send_operation.m_owner = std::move(owner);
+
+            if (!m_queue->send(m_request_queue, send_buffer, m_send_operation))
+            {
+                m_send_operation.m_owner = nullptr;
+                asio::post(m_socket.get_executor(), [this, owner = lock_lifetime_owner()] {
+                    m_write_finished.broadcast(
+                        asio::error_code(WSAGetLastError(), asio::error::get_system_category()), m_bytes_written);
+                });
+            }
+        }
+
+        void on_sent(std::shared_ptr<void> owner, asio::error_code error, size_t bytes)
+        {
+            m_bytes_written += bytes;
+
+            if (error)
+                m_write_finished.broadcast(error, m_bytes_written);
+            else
+                send_next(std::move(owner));
+        }
+
+        Protocol::socket m_socket;
+        std::shared_ptr<Rio_completion_queue> m_queue;
+        RIO_RQ m_request_queue;
+
+        RIO_BUF m_receive_buffer;
+        Socket_operation m_receive_operation;
+        size_t m_received_offset = 0;
+        size_t m_received_size = 0;
+        Pending_read m_pending_read;
+
+        RIO_BUF m_send_buffer;
+        const ULONG m_send_buffer_capacity = m_send_buffer.Length;
+        Socket_operation m_send_operation;
+        std::span<const asio::const_buffer> m_write_buffers;
+        size_t m_write_index = 0;
+        size_t m_write_offset = 0;
+        size_t m_bytes_written = 0;
+    };
+
+    /**
+     *   Opens the acceptor with the WSA_FLAG_REGISTERED_IO, the sockets accepted with the accept inherit it and can
+     *   be used with the Rio_socket. The AcceptEx of the async_accept creates the socket without the flag.
+     *
+     *   @param the acceptor that is not open
+     *   @param the protocol of the endpoint it will listen
+     *   @throws if the socket could not be created
+     */
+    inline void open_registered_io_acceptor(Protocol::acceptor& acceptor, const Protocol& protocol)
+    {
+        const SOCKET socket = WSASocketW(
+            protocol.family(), protocol.type(), protocol.protocol(), nullptr, 0,
+            WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+
+        if (socket == INVALID_SOCKET)
+            throw std::system_error(asio::error_code(WSAGetLastError(), asio::error::get_system_category()));
+
+        asio::error_code error;
+        acceptor.assign(protocol, socket, error);
+
+        if (error)
+        {
+            closesocket(socket);
+            throw std::system_error(error);
+        }
+    }
+#endif
+} // namespace Net
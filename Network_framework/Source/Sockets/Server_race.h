@@ -0,0 +1,173 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "../Utility/Server_address.h"
+#include "Happy_eyeballs.h"
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Connects to every candidate server at the same time and keeps the connection that is made first, which
+     *   is the server with the shortest round trip when the servers are in different regions. The rest of the
+     *   attempts are closed. Each candidate is resolved and its addresses are raced with the Happy_eyeballs.
+     *   The attempts run on the executor, it should be a strand if many threads run it.
+     */
+    class Server_race : public std::enable_shared_from_this<Server_race>
+    {
+    public:
+        /**
+         *   @param the error of the last failed candidate or nothing
+         *   @param the connected socket
+         *   @param the index of the candidate that won
+         *   @param how long the winner took to connect from the end of its resolve
+         */
+        using Handler = std::function<void(asio::error_code, Protocol::socket, size_t, std::chrono::microseconds)>;
+
+        explicit Server_race(
+            asio::any_io_executor executor,
+            std::chrono::milliseconds attempt_delay = Happy_eyeballs::DEFAULT_ATTEMPT_DELAY)
+            : m_executor(std::move(executor)), m_attempt_delay(attempt_delay)
+        {
+        }
+
+        /**
+         *   Starts the race, the handler gets the first connected socket or the error when every candidate failed
+         *
+         *   @param the candidates, atleast one
+         *   @param the handler, called once on the executor
+         */
+        void start(std::vector<Server_address> candidates, Handler handler)
+        {
+            m_handler = std::move(handler);
+
+            asio::dispatch(m_executor, [self = shared_from_this(), candidates = std::move(candidates)] {
+                self->start_resolves(candidates);
+            });
+        }
+
+        /**
+         *   Closes the attempts without calling the handler. Call this from the executor or when nothing runs it,
+         *   for example after the asio threads have been stopped.
+         */
+        void cancel()
+        {
+            m_is_finished = true;
+            m_handler = nullptr;
+            close_attempts();
+        }
+
+    private:
+        struct Candidate
+        {
+            explicit Candidate(const asio::any_io_executor& executor) : m_resolver(executor)
+            {
+            }
+
+            Protocol::resolver m_resolver;
+            std::shared_ptr<Happy_eyeballs> m_connector;
+            std::chrono::steady_clock::time_point m_connect_start;
+        };
+
+        void start_resolves(const std::vector<Server_address>& candidates)
+        {
+            if (m_is_finished)
+                return;
+
+            m_pending_candidates = candidates.size();
+
+            for (size_t index = 0; index < candidates.size(); ++index)
+            {
+                Candidate& candidate = m_candidates.emplace_back(m_executor);
+
+                candidate.m_resolver.async_resolve(
+                    candidates[index].m_host, candidates[index].m_port,
+                    [self = shared_from_this(), index](
+                        asio::error_code error, Protocol::resolver::results_type results) {
+                        self->handle_resolve(index, error, results);
+                    });
+            }
+        }
+
+        void handle_resolve(size_t index, asio::error_code error, const Protocol::resolver::results_type& results)
+        {
+            if (m_is_finished)
+                return;
+
+            if (error)
+            {
+                handle_failure(error);
+                return;
+            }
+
+            Candidate& candidate = m_candidates[index];
+            candidate.m_connect_start = std::chrono::steady_clock::now();
+            candidate.m_connector = std::make_shared<Happy_eyeballs>(m_executor, m_attempt_delay);
+            candidate.m_connector->start(
+                results, [self = shared_from_this(), index](asio::error_code error, Protocol::socket socket) {
+                    self->handle_connect(index, error, std::move(socket));
+                });
+        }
+
+        void handle_connect(size_t index, asio::error_code error, Protocol::socket socket)
+        {
+            if (m_is_finished)
+                return;
+
+            if (error)
+            {
+                handle_failure(error);
+                return;
+            }
+
+            const auto connect_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_candidates[index].m_connect_start);
+
+            // Connectors of the winner and the losers are done, only the losers have attempts left to close
+            m_is_finished = true;
+            close_attempts();
+
+            if (const Handler handler = std::exchange(m_handler, nullptr))
+                handler(error, std::move(socket), index, connect_time);
+        }
+
+        void handle_failure(asio::error_code error)
+        {
+            if (--m_pending_candidates > 0)
+                return;
+
+            m_is_finished = true;
+
+            if (const Handler handler = std::exchange(m_handler, nullptr))
+                handler(error, Protocol::socket(m_executor), 0, std::chrono::microseconds(0));
+        }
+
+        void close_attempts()
+        {
+            for (Candidate& candidate : m_candidates)
+            {
+                candidate.m_resolver.cancel();
+
+                if (candidate.m_connector)
+                    candidate.m_connector->cancel();
+            }
+        }
+
+        asio::any_io_executor m_executor;
+        std::chrono::milliseconds m_attempt_delay;
+
+        // Deque keeps the resolvers in place for the pending resolves
+        std::deque<Candidate> m_candidates;
+        size_t m_pending_candidates = 0;
+        bool m_is_finished = false;
+
+        Handler m_handler;
+    };
+} // namespace Net
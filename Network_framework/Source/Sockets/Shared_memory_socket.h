@@ -0,0 +1,740 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+#include "Socket_options.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <new>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Net
+{
+    /**
+     *   Named shared memory that the server creates and the client opens. On posix the name is removed once
+     *   the client has mapped it so the memory is freed with the last mapping even if a process crashes,
+     *   on Windows it is freed when the last handle is closed.
+     */
+    class Shared_memory_segment
+    {
+    public:
+        Shared_memory_segment() = default;
+
+        ~Shared_memory_segment()
+        {
+            close();
+        }
+
+        Shared_memory_segment(const Shared_memory_segment&) = delete;
+        Shared_memory_segment(Shared_memory_segment&&) = delete;
+        Shared_memory_segment& operator=(const Shared_memory_segment&) = delete;
+        Shared_memory_segment& operator=(Shared_memory_segment&&) = delete;
+
+        // Creates the segment with a new name, the memory is zeroed
+        [[nodiscard]] asio::error_code create(size_t size)
+        {
+            m_name = create_unique_name();
+#ifdef _WIN32
+            const auto size_value = static_cast<uint64_t>(size);
+            m_mapping = ::CreateFileMappingA(
+                INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size_value >> 32),
+                static_cast<DWORD>(size_value), m_name.c_str());
+
+            if (m_mapping == nullptr)
+                return last_error();
+
+            if (::GetLastError() == ERROR_ALREADY_EXISTS)
+                return asio::error::already_open;
+
+            return map(size);
+#else
+            const int file = ::shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+
+            if (file < 0)
+                return last_error();
+
+            m_is_name_linked = true;
+            const asio::error_code error = ::ftruncate(file, static_cast<off_t>(size)) == 0 ? map(file, size)
+                                                                                              : last_error();
+            ::close(file);
+            return error;
+#endif
+        }
+
+        // Opens the segment that the peer created, it must be at least the size
+        [[nodiscard]] asio::error_code open(const std::string& name, size_t size)
+        {
+            m_name = name;
+#ifdef _WIN32
+            m_mapping = ::OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name.c_str());
+
+            if (m_mapping == nullptr)
+                return last_error();
+
+            return map(size);
+#else
+            const int file = ::shm_open(m_name.c_str(), O_RDWR, 0);
+
+            if (file < 0)
+                return last_error();
+
+            m_is_name_linked = true;
+            struct stat file_status = {};
+            asio::error_code error;
+
+            if (::fstat(file, &file_status) != 0)
+                error = last_error();
+            else if (static_cast<size_t>(file_status.st_size) < size)
+                error = asio::error::message_size;
+            else
+                error = map(file, size);
+
+            ::close(file);
+            return error;
+#endif
+        }
+
+        // Removes the name so no other process can open the segment, the mappings stay valid
+        void unlink_name() noexcept
+        {
+#ifndef _WIN32
+            if (m_is_name_linked)
+                ::shm_unlink(m_name.c_str());
+
+            m_is_name_linked = false;
+#endif
+        }
+
+        void close() noexcept
+        {
+            unlink_name();
+#ifdef _WIN32
+            if (m_data != nullptr)
+                ::UnmapViewOfFile(m_data);
+
+            if (m_mapping != nullptr)
+                ::CloseHandle(m_mapping);
+
+            m_mapping = nullptr;
+#else
+            if (m_data != nullptr)
+                ::munmap(m_data, m_size);
+#endif
+            m_data = nullptr;
+            m_size = 0;
+            m_name.clear();
+        }
+
+        [[nodiscard]] void* data() const noexcept
+        {
+            return m_data;
+        }
+
+        [[nodiscard]] const std::string& get_name() const noexcept
+        {
+            return m_name;
+        }
+
+    private:
+        [[nodiscard]] static std::string create_unique_name()
+        {
+            static std::atomic<uint64_t> next_index = 0;
+            std::random_device random_device;
+#ifdef _WIN32
+            return std::format(
+                "Local\\net_{}_{}_{:x}", ::GetCurrentProcessId(), next_index++, random_device());
+#else
+            return std::format("/net_{}_{}_{:x}", ::getpid(), next_index++, random_device());
+#endif
+        }
+
+        [[nodiscard]] static asio::error_code last_error() noexcept
+        {
+#ifdef _WIN32
+            return asio::error_code(static_cast<int>(::GetLastError()), asio::error::get_system_category());
+#else
+            return asio::error_code(errno, asio::error::get_system_category());
+#endif
+        }
+
+#ifdef _WIN32
+        [[nodiscard]] asio::error_code map(size_t size)
+        {
+            m_data = ::MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+            if (m_data == nullptr)
+                return last_error();
+
+            m_size = size;
+            return {};
+        }
+
+        HANDLE m_mapping = nullptr;
+#else
+        [[nodiscard]] asio::error_code map(int file, size_t size)
+        {
+            void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+            if (data == MAP_FAILED)
+                return last_error();
+
+            m_data = data;
+            m_size = size;
+            return {};
+        }
+
+        bool m_is_name_linked = false;
+#endif
+        void* m_data = nullptr;
+        size_t m_size = 0;
+        std::string m_name;
+    };
+
+    // Indexes of one ring in the shared memory, they are on their own cache lines so the sides don't share them
+    struct Shared_ring_control
+    {
+        alignas(64) std::atomic<uint64_t> m_write_index = 0;
+        alignas(64) std::atomic<uint64_t> m_read_index = 0;
+
+        // Set by the side that waits, the other side rings the doorbell when it clears these
+        alignas(64) std::atomic<uint32_t> m_is_reader_waiting = 0;
+        std::atomic<uint32_t> m_is_writer_waiting = 0;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+    /**
+     *   Single producer single consumer byte ring in the shared memory. The indexes only grow and the capacity is
+     *   a power of two, so the position in the data is the index masked with the capacity.
+     */
+    class Shared_ring
+    {
+    public:
+        // Next byte of the buffers given to the write
+        struct Buffer_position
+        {
+            size_t m_index = 0;
+            size_t m_offset = 0;
+        };
+
+        Shared_ring() = default;
+
+        Shared_ring(Shared_ring_control* control, char* data, size_t capacity) noexcept
+            : m_control(control), m_data(data), m_capacity(capacity)
+        {
+        }
+
+        // @return the bytes copied to the buffer, less than the size if the ring had less
+        size_t read(char* buffer, size_t size) noexcept
+        {
+            const uint64_t read_index = m_control->m_read_index.load(std::memory_order_relaxed);
+            const uint64_t write_index = m_control->m_write_index.load();
+            const size_t bytes = std::min(size, static_cast<size_t>(write_index - read_index));
+
+            const size_t offset = static_cast<size_t>(read_index) & (m_capacity - 1);
+            const size_t first_part = std::min(bytes, m_capacity - offset);
+            std::memcpy(buffer, m_data + offset, first_part);
+            std::memcpy(buffer + first_part, m_data, bytes - first_part);
+
+            m_control->m_read_index.store(read_index + bytes);
+            return bytes;
+        }
+
+        /**
+         *   Copies the buffers from the position as far as they fit
+         *
+         *   @param the buffers
+         *   @param position in the buffers, it is moved past the copied bytes
+         *   @return the bytes copied
+         */
+        size_t write(std::span<const asio::const_buffer> buffers, Buffer_position& position) noexcept
+        {
+            const uint64_t write_index = m_control->m_write_index.load(std::memory_order_relaxed);
+            const uint64_t read_index = m_control->m_read_index.load();
+            size_t room = m_capacity - static_cast<size_t>(write_index - read_index);
+            size_t bytes = 0;
+
+            for (; position.m_index < buffers.size() && room > 0; ++position.m_index, position.m_offset = 0)
+            {
+                const asio::const_buffer& buffer = buffers[position.m_index];
+                const size_t copied = std::min(buffer.size() - position.m_offset, room);
+                const char* source = static_cast<const char*>(buffer.data()) + position.m_offset;
+
+                const size_t offset = static_cast<size_t>(write_index + bytes) & (m_capacity - 1);
+                const size_t first_part = std::min(copied, m_capacity - offset);
+                std::memcpy(m_data + offset, source, first_part);
+                std::memcpy(m_data, source + first_part, copied - first_part);
+
+                bytes += copied;
+                room -= copied;
+                position.m_offset += copied;
+
+                if (position.m_offset < buffer.size())
+                    break;
+            }
+
+            // Skips the buffers that are empty or were finished by the last copy
+            while (position.m_index < buffers.size() && position.m_offset == buffers[position.m_index].size())
+            {
+                ++position.m_index;
+                position.m_offset = 0;
+            }
+
+            if (bytes > 0)
+                m_control->m_write_index.store(write_index + bytes);
+
+            return bytes;
+        }
+
+        [[nodiscard]] Shared_ring_control& control() const noexcept
+        {
+            return *m_control;
+        }
+
+    private:
+        Shared_ring_control* m_control = nullptr;
+        char* m_data = nullptr;
+        size_t m_capacity = 0;
+    };
+
+    /**
+     *   Socket that carries the bytes through two rings in shared memory, so the peers on the same host skip the
+     *   kernel for the data. The connected unix domain socket is used for the setup and as the doorbell: a side
+     *   that has to wait marks it in the ring and the other side writes a byte to the socket when it has made
+     *   progress, so the waiting works with the asio like any other socket. The server side creates the segment in
+     *   the handshake and sends its name to the client, every connection takes two rings of the capacity.
+     */
+    class Shared_memory_socket final : public Socket_interface
+    {
+    public:
+        // Bytes in each direction, the server decides it for both sides
+        static constexpr size_t DEFAULT_RING_CAPACITY = 1024 * 1024;
+
+        // Largest ring that the client accepts from the server
+        static constexpr size_t MAX_RING_CAPACITY = size_t(1) << 30;
+
+        /**
+         *   @param connected unix domain socket, the executor of the socket is used for the handlers
+         *   @param bytes in each ring, rounded up to a power of two. Used only on the server side
+         */
+        explicit Shared_memory_socket(Local_protocol::socket doorbell, size_t ring_capacity = DEFAULT_RING_CAPACITY)
+            : m_doorbell(std::move(doorbell)),
+              m_ring_capacity(std::bit_ceil(std::clamp<size_t>(ring_capacity, 4096, MAX_RING_CAPACITY)))
+        {
+        }
+
+        ~Shared_memory_socket() override
+        {
+            disconnect();
+        }
+
+        Shared_memory_socket(const Shared_memory_socket&) = delete;
+        Shared_memory_socket(Shared_memory_socket&&) = delete;
+        Shared_memory_socket& operator=(const Shared_memory_socket&) = delete;
+        Shared_memory_socket& operator=(Shared_memory_socket&&) = delete;
+
+        // Server creates the segment and sends its name, the client maps it
+        void async_handshake(Handshake_type type) override
+        {
+            if (type == Handshake_type::server)
+            {
+                const asio::error_code error = create_segment();
+
+                if (error)
+                {
+                    asio::post(m_doorbell.get_executor(), [this, error, owner = lock_lifetime_owner()] {
+                        m_handshake_finished.broadcast(error);
+                    });
+                    return;
+                }
+
+                asio::async_write(
+                    m_doorbell, asio::buffer(&m_setup, sizeof(m_setup)),
+                    [this, owner = lock_lifetime_owner()](asio::error_code write_error, size_t) {
+                        finish_handshake(write_error);
+                    });
+            }
+            else
+            {
+                asio::async_read(
+                    m_doorbell, asio::buffer(&m_setup, sizeof(m_setup)),
+                    [this, owner = lock_lifetime_owner()](asio::error_code read_error, size_t) {
+                        finish_handshake(read_error ? read_error : open_segment());
+                    });
+            }
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(Read_type::header, buffer, size);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(Read_type::body, buffer, size);
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            start_read(Read_type::some, buffer, size);
+        }
+
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            m_write_buffers.assign(buffers.begin(), buffers.end());
+            m_write_position = {};
+            m_write_transferred = 0;
+            m_is_writing = true;
+            m_write_owner = lock_lifetime_owner();
+
+            continue_write(true);
+        }
+
+        bool can_write_file() const override
+        {
+            return false;
+        }
+
+        void async_write_file(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<const Native_file> file, [[maybe_unused]] uint64_t offset,
+            [[maybe_unused]] size_t size) override
+        {
+            asio::post(m_doorbell.get_executor(), [this, owner = lock_lifetime_owner()] {
+                m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+            });
+        }
+
+        asio::any_io_executor get_executor() override
+        {
+            return m_doorbell.get_executor();
+        }
+
+        std::string set_socket_options(const Socket_options& options) override
+        {
+            return apply_socket_options(m_doorbell, options);
+        }
+
+        bool is_open() const override
+        {
+            return m_doorbell.is_open();
+        }
+
+        // Peer is always on the same host
+        std::string get_ip() const override
+        {
+            return "127.0.0.1";
+        }
+
+        // Closing the doorbell tells the peer, it reads the bytes left in the ring before the eof
+        void disconnect() override
+        {
+            if (!m_doorbell.is_open())
+                return;
+
+            asio::error_code ignored_error;
+            m_doorbell.shutdown(asio::socket_base::shutdown_both, ignored_error);
+            m_doorbell.close(ignored_error);
+
+            // Pending operations are cancelled like the asio cancels them when the socket is closed
+            if (m_read_type != Read_type::none)
+                finish_read(asio::error::operation_aborted, true);
+
+            if (m_is_writing)
+                finish_write(asio::error::operation_aborted, true);
+        }
+
+    private:
+        static constexpr uint64_t SETUP_MAGIC = 0x4E45545F53484D31; // NET_SHM1
+
+        enum class Read_type : uint8_t
+        {
+            none,
+            header,
+            body,
+            some
+        };
+
+        // Sent by the server in the handshake
+        struct Setup_message
+        {
+            uint64_t m_magic = 0;
+            uint64_t m_ring_capacity = 0;
+            std::array<char, 128> m_segment_name = {};
+        };
+
+        // Start of the segment, the data of the rings follows it
+        struct Segment_header
+        {
+            Shared_ring_control m_server_to_client;
+            Shared_ring_control m_client_to_server;
+        };
+
+        [[nodiscard]] size_t get_segment_size() const noexcept
+        {
+            return sizeof(Segment_header) + 2 * m_ring_capacity;
+        }
+
+        [[nodiscard]] asio::error_code create_segment()
+        {
+            if (const asio::error_code error = m_segment.create(get_segment_size()))
+                return error;
+
+            if (m_segment.get_name().size() >= m_setup.m_segment_name.size())
+                return asio::error::name_too_long;
+
+            auto* header = new (m_segment.data()) Segment_header();
+            char* ring_data = static_cast<char*>(m_segment.data()) + sizeof(Segment_header);
+
+            m_out_ring = Shared_ring(&header->m_server_to_client, ring_data, m_ring_capacity);
+            m_in_ring = Shared_ring(&header->m_client_to_server, ring_data + m_ring_capacity, m_ring_capacity);
+
+            m_setup.m_magic = SETUP_MAGIC;
+            m_setup.m_ring_capacity = m_ring_capacity;
+            std::memcpy(m_setup.m_segment_name.data(), m_segment.get_name().data(), m_segment.get_name().size());
+
+            return {};
+        }
+
+        [[nodiscard]] asio::error_code open_segment()
+        {
+            const bool is_name_terminated = m_setup.m_segment_name.back() == '\0';
+            const bool is_capacity_valid = m_setup.m_ring_capacity >= 4096 &&
+                                           m_setup.m_ring_capacity <= MAX_RING_CAPACITY &&
+                                           std::has_single_bit(m_setup.m_ring_capacity);
+
+            if (m_setup.m_magic != SETUP_MAGIC || !is_name_terminated || !is_capacity_valid)
+                return asio::error::invalid_argument;
+
+            m_ring_capacity = static_cast<size_t>(m_setup.m_ring_capacity);
+
+            if (const asio::error_code error = m_segment.open(m_setup.m_segment_name.data(), get_segment_size()))
+                return error;
+
+            // Both sides have it mapped now so the name is not needed anymore
+            m_segment.unlink_name();
+
+            auto* header = static_cast<Segment_header*>(m_segment.data());
+            char* ring_data = static_cast<char*>(m_segment.data()) + sizeof(Segment_header);
+
+            m_in_ring = Shared_ring(&header->m_server_to_client, ring_data, m_ring_capacity);
+            m_out_ring = Shared_ring(&header->m_client_to_server, ring_data + m_ring_capacity, m_ring_capacity);
+
+            return {};
+        }
+
+        void finish_handshake(asio::error_code error)
+        {
+            if (!error)
+            {
+                // Doorbells are written without waiting, a full socket means the peer has unread doorbells anyway
+                m_doorbell.non_blocking(true, error);
+                read_doorbell();
+            }
+
+            m_handshake_finished.broadcast(error);
+        }
+
+        // Keeps one read pending on the doorbell for the rest of the connection, it ends when the peer closes
+        void read_doorbell()
+        {
+            m_doorbell.async_read_some(
+                asio::buffer(m_doorbell_buffer), [this, owner = lock_lifetime_owner()](asio::error_code error, size_t) {
+                    if (error)
+                        m_is_peer_closed = true;
+
+                    continue_read(false);
+                    continue_write(false);
+
+                    if (!error)
+                        read_doorbell();
+                });
+        }
+
+        void ring_doorbell()
+        {
+            const char doorbell_byte = 0;
+            asio::error_code ignored_error;
+            m_doorbell.write_some(asio::buffer(&doorbell_byte, 1), ignored_error);
+        }
+
+        void start_read(Read_type type, void* buffer, size_t size)
+        {
+            m_read_type = type;
+            m_read_buffer = static_cast<char*>(buffer);
+            m_read_size = size;
+            m_read_transferred = 0;
+            m_read_owner = lock_lifetime_owner();
+
+            continue_read(true);
+        }
+
+        /**
+         *   Reads from the ring until the read is complete or it has to wait for the doorbell. The waiting is marked
+         *   again on every call and the ring is checked once more after it, so the bytes written meanwhile are not
+         *   missed.
+         *
+         *   @param true when called from the initiating function, the handler is then posted instead of called
+         */
+        void continue_read(bool is_initiating)
+        {
+            if (m_read_type == Read_type::none)
+                return;
+
+            if (!m_doorbell.is_open())
+            {
+                finish_read(asio::error::operation_aborted, is_initiating);
+                return;
+            }
+
+            for (bool is_waiting = false;; is_waiting = true)
+            {
+                const size_t remaining = m_read_size - m_read_transferred;
+                const size_t bytes = m_in_ring.read(m_read_buffer + m_read_transferred, remaining);
+                m_read_transferred += bytes;
+
+                if (bytes > 0 && m_in_ring.control().m_is_writer_waiting.exchange(0) != 0)
+                    ring_doorbell();
+
+                // Read some completes with any bytes, the others need the whole buffer
+                if (m_read_transferred == m_read_size || (m_read_type == Read_type::some && m_read_transferred > 0))
+                {
+                    finish_read(asio::error_code(), is_initiating);
+                    return;
+                }
+
+                if (m_is_peer_closed)
+                {
+                    finish_read(asio::error::eof, is_initiating);
+                    return;
+                }
+
+                if (is_waiting)
+                    return;
+
+                m_in_ring.control().m_is_reader_waiting.store(1);
+            }
+        }
+
+        void continue_write(bool is_initiating)
+        {
+            if (!m_is_writing)
+                return;
+
+            if (!m_doorbell.is_open())
+            {
+                finish_write(asio::error::operation_aborted, is_initiating);
+                return;
+            }
+
+            for (bool is_waiting = false;; is_waiting = true)
+            {
+                if (m_is_peer_closed)
+                {
+                    finish_write(asio::error::broken_pipe, is_initiating);
+                    return;
+                }
+
+                const size_t bytes = m_out_ring.write(m_write_buffers, m_write_position);
+                m_write_transferred += bytes;
+
+                if (bytes > 0 && m_out_ring.control().m_is_reader_waiting.exchange(0) != 0)
+                    ring_doorbell();
+
+                if (m_write_position.m_index == m_write_buffers.size())
+                {
+                    finish_write(asio::error_code(), is_initiating);
+                    return;
+                }
+
+                if (is_waiting)
+                    return;
+
+                m_out_ring.control().m_is_writer_waiting.store(1);
+            }
+        }
+
+        // Clears the read before the handler so the handler can start the next read
+        void finish_read(asio::error_code error, bool should_post)
+        {
+            const Read_type type = std::exchange(m_read_type, Read_type::none);
+            std::shared_ptr<void> owner = std::move(m_read_owner);
+            const size_t bytes = m_read_transferred;
+
+            auto complete = [this, type, error, bytes] {
+                switch (type)
+                {
+                case Read_type::header:
+                    m_read_header_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::body:
+                    m_read_body_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::some:
+                    m_read_some_finished.broadcast(error, bytes);
+                    break;
+                case Read_type::none:
+                    break;
+                }
+            };
+
+            if (should_post)
+                asio::post(m_doorbell.get_executor(), [complete, owner = std::move(owner)] { complete(); });
+            else
+                complete();
+        }
+
+        void finish_write(asio::error_code error, bool should_post)
+        {
+            m_is_writing = false;
+            std::shared_ptr<void> owner = std::move(m_write_owner);
+            const size_t bytes = m_write_transferred;
+
+            if (should_post)
+                asio::post(m_doorbell.get_executor(), [this, error, bytes, owner = std::move(owner)] {
+                    m_write_finished.broadcast(error, bytes);
+                });
+            else
+                m_write_finished.broadcast(error, bytes);
+        }
+
+        Local_protocol::socket m_doorbell;
+        std::array<char, 64> m_doorbell_buffer = {};
+        bool m_is_peer_closed = false;
+
+        size_t m_ring_capacity = DEFAULT_RING_CAPACITY;
+        Setup_message m_setup;
+        Shared_memory_segment m_segment;
+        Shared_ring m_in_ring;
+        Shared_ring m_out_ring;
+
+        Read_type m_read_type = Read_type::none;
+        char* m_read_buffer = nullptr;
+        size_t m_read_size = 0;
+        size_t m_read_transferred = 0;
+        std::shared_ptr<void> m_read_owner;
+
+        // Descriptors are copied because the span of the caller does not have to outlive the call
+        std::vector<asio::const_buffer> m_write_buffers;
+        Shared_ring::Buffer_position m_write_position;
+        size_t m_write_transferred = 0;
+        bool m_is_writing = false;
+        std::shared_ptr<void> m_write_owner;
+    };
+} // namespace Net
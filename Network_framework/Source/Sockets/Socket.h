@@ -1,17 +1,45 @@
 #pragma once
 
 #include "../Utility/Common.h"
+#include "../Utility/Handler_memory.h"
+#include "Registered_receive_buffers.h"
 #include "Socket_interface.h"
+#include "Tls_record_sizer.h"
+#include "Tls_session.h"
 #include <type_traits>
 
+#if defined(__linux__)
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define NET_HAS_ZERO_COPY
+#endif
+#elif defined(_WIN32) && defined(ASIO_HAS_WINDOWS_OVERLAPPED_PTR)
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <mswsock.h>
+#pragma comment(lib, "mswsock.lib")
+#endif
+
 namespace Net
 {
     template <typename Asio_socket>
-    class Template_socket : public Socket_interface
+    class Template_socket final : public Socket_interface
     {
     public:
-        Template_socket(Asio_socket socket) noexcept : m_socket(std::move(socket))
+        Template_socket(Asio_socket socket) : m_socket(std::move(socket))
         {
+            find_registered_buffers();
+            find_zero_copy();
         }
 
         void async_handshake(Handshake_type type) override
@@ -19,18 +47,21 @@ namespace Net
             // Only do handshake is we have ssl socket
             if constexpr (std::is_same_v<Asio_socket, Ssl_socket>)
             {
+                auto on_handshake = [this, owner = lock_lifetime_owner()](asio::error_code error) {
+                    if (!error)
+                        Tls_session_state::on_handshake_finished(m_socket.native_handle());
+
+                    m_handshake_finished.broadcast(error);
+                };
+
                 switch (type)
                 {
                 case Handshake_type::client:
-                    m_socket.async_handshake(asio::ssl::stream_base::client, [this](asio::error_code error) {
-                        m_handshake_finished.broadcast(error);
-                    });
+                    m_socket.async_handshake(asio::ssl::stream_base::client, std::move(on_handshake));
                     break;
 
                 case Handshake_type::server:
-                    m_socket.async_handshake(asio::ssl::stream_base::server, [this](asio::error_code error) {
-                        m_handshake_finished.broadcast(error);
-                    });
+                    m_socket.async_handshake(asio::ssl::stream_base::server, std::move(on_handshake));
                     break;
                 }
             }
@@ -40,41 +71,265 @@ namespace Net
 
         void async_read_header(void* buffer, size_t size) override
         {
-            asio::async_read(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_read_header_finished.broadcast(error, bytes);
-            });
+            if (m_is_timestamping)
+            {
+                read_timestamped(
+                    lock_lifetime_owner(), static_cast<char*>(buffer), size, 0, true, m_read_header_finished);
+                return;
+            }
+
+            asio::async_read(
+                m_socket, asio::buffer(buffer, size),
+                with_memory(m_read_memory, [this, owner = lock_lifetime_owner()](asio::error_code error, size_t bytes) {
+                    m_read_header_finished.broadcast(error, bytes);
+                }));
         };
 
         void async_read_body(void* buffer, size_t size) override
         {
-            asio::async_read(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_read_body_finished.broadcast(error, bytes);
-            });
+            if (m_is_timestamping)
+            {
+                read_timestamped(
+                    lock_lifetime_owner(), static_cast<char*>(buffer), size, 0, true, m_read_body_finished);
+                return;
+            }
+
+            asio::async_read(
+                m_socket, asio::buffer(buffer, size),
+                with_memory(m_read_memory, [this, owner = lock_lifetime_owner()](asio::error_code error, size_t bytes) {
+                    m_read_body_finished.broadcast(error, bytes);
+                }));
+        }
+
+        void async_read_some(void* buffer, size_t size) override
+        {
+            if (m_is_timestamping)
+            {
+                read_timestamped(
+                    lock_lifetime_owner(), static_cast<char*>(buffer), size, 0, false, m_read_some_finished);
+                return;
+            }
+
+            auto on_read = with_memory(
+                m_read_memory, [this, owner = lock_lifetime_owner()](asio::error_code error, size_t bytes) {
+                    m_read_some_finished.broadcast(error, bytes);
+                });
+
+            if (m_registered_buffers != nullptr)
+            {
+                if (const auto registered_buffer = m_registered_buffers->find(buffer, size))
+                {
+                    m_socket.async_read_some(*registered_buffer, std::move(on_read));
+                    return;
+                }
+            }
+
+            m_socket.async_read_some(asio::buffer(buffer, size), std::move(on_read));
+        }
+
+        bool can_wait_readable() const override
+        {
+            return !std::is_same_v<Asio_socket, Ssl_socket>;
+        }
+
+        void async_wait_readable() override
+        {
+            // Tls can have decrypted data buffered that the socket does not show as readable
+            if constexpr (std::is_same_v<Asio_socket, Ssl_socket>)
+                m_wait_readable_finished.broadcast(asio::error::operation_not_supported);
+            else
+                m_socket.async_wait(
+                    Asio_socket::wait_read,
+                    with_memory(m_read_memory, [this, owner = lock_lifetime_owner()](asio::error_code error) {
+                        m_wait_readable_finished.broadcast(error);
+                    }));
+        }
+
+        void async_write(std::span<const asio::const_buffer> buffers) override
+        {
+            if constexpr (std::is_same_v<Asio_socket, Ssl_socket>)
+            {
+                m_record_writer.start(buffers);
+                write_next_record(lock_lifetime_owner(), 0);
+                return;
+            }
+
+            asio::async_write(
+                m_socket, buffers,
+                with_memory(
+                    m_write_memory, [this, owner = lock_lifetime_owner()](asio::error_code error, size_t bytes) {
+                        m_write_finished.broadcast(error, bytes);
+                    }));
+        }
+
+        bool can_write_zero_copy() const override
+        {
+            return m_is_zero_copy_enabled;
+        }
+
+        void async_write_zero_copy(
+            std::span<const asio::const_buffer> buffers, std::shared_ptr<void> buffer_owner) override
+        {
+#ifdef NET_HAS_ZERO_COPY
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+            {
+                write_zero_copy_part(lock_lifetime_owner(), buffers, std::move(buffer_owner), 0);
+                return;
+            }
+#endif
+            m_write_finished.broadcast(asio::error::operation_not_supported, 0);
         }
 
-        void async_write_header(const void* buffer, size_t size) override
+        bool can_write_file() const override
         {
-            asio::async_write(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_write_header_finished.broadcast(error, bytes);
-            });
+#if defined(__linux__) || (defined(_WIN32) && defined(ASIO_HAS_WINDOWS_OVERLAPPED_PTR))
+            return std::is_same_v<Asio_socket, Protocol::socket>;
+#else
+            return false;
+#endif
         }
 
-        void async_write_body(const void* buffer, size_t size) override
+        void async_write_file(
+            std::span<const asio::const_buffer> buffers, std::shared_ptr<const Native_file> file, uint64_t offset,
+            size_t size) override
         {
-            asio::async_write(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_write_body_finished.broadcast(error, bytes);
-            });
+            asio::async_write(
+                m_socket, buffers,
+                with_memory(
+                    m_write_memory, [this, owner = lock_lifetime_owner(), file = std::move(file), offset, size](
+                                        asio::error_code error, size_t bytes) mutable {
+                        if (error)
+                            m_write_finished.broadcast(error, bytes);
+                        else
+                            write_file_part(std::move(owner), std::move(file), offset, size, bytes);
+                    }));
         }
 
         void disconnect() override
         {
             if (is_open())
             {
-                m_socket.lowest_layer().shutdown(asio::socket_base::shutdown_both);
-                m_socket.lowest_layer().close();
+                // OpenSSL stops the session from being resumed if it is freed without being shut down
+                if constexpr (std::is_same_v<Asio_socket, Ssl_socket>)
+                    SSL_set_shutdown(m_socket.native_handle(), SSL_SENT_SHUTDOWN);
+
+                // Errors are ignored because the peer could have already closed the connection
+                asio::error_code ignored_error;
+                m_socket.lowest_layer().shutdown(asio::socket_base::shutdown_both, ignored_error);
+
+#ifdef NET_HAS_ZERO_COPY
+                // Reset drops the data the kernel still sends from the buffers, they are released with this socket
+                if (!m_zero_copy_sends.empty())
+                    m_socket.lowest_layer().set_option(asio::socket_base::linger(true, 0), ignored_error);
+#endif
+
+                m_socket.lowest_layer().close(ignored_error);
             }
         }
 
+        asio::any_io_executor get_executor() override
+        {
+            return m_socket.get_executor();
+        }
+
+        bool can_move_executor() const override
+        {
+            return IS_MOVABLE;
+        }
+
+        asio::error_code move_to_executor(asio::any_io_executor executor) override
+        {
+            if constexpr (!IS_MOVABLE)
+                return asio::error::operation_not_supported;
+            else
+            {
+                asio::error_code error;
+                const auto protocol = m_socket.local_endpoint(error).protocol();
+
+                if (error)
+                    return error;
+
+                // Handle is taken from the reactor of the old io_context and registered with the new one
+                const auto handle = m_socket.release(error);
+
+                if (error)
+                    return error;
+
+                Asio_socket moved_socket(std::move(executor));
+                moved_socket.assign(protocol, handle, error);
+
+                if (error)
+                {
+                    asio::error_code ignored_error;
+                    m_socket.assign(protocol, handle, ignored_error);
+                    return error;
+                }
+
+                m_socket = std::move(moved_socket);
+                find_registered_buffers();
+                return error;
+            }
+        }
+
+        std::optional<Protocol::socket::native_handle_type> release_handle() override
+        {
+            if constexpr (!std::is_same_v<Asio_socket, Protocol::socket>)
+                return std::nullopt;
+            else
+            {
+                asio::error_code error;
+                const auto handle = m_socket.release(error);
+
+                if (error)
+                    return std::nullopt;
+
+                return handle;
+            }
+        }
+
+        std::shared_ptr<std::pmr::memory_resource> get_receive_memory() const override
+        {
+            return m_registered_buffers != nullptr ? m_registered_buffers->get_memory() : nullptr;
+        }
+
+        size_t get_buffer_bytes() const noexcept override
+        {
+            if constexpr (std::is_same_v<Asio_socket, Ssl_socket>)
+                return TLS_BUFFER_BYTES;
+            else
+                return 0;
+        }
+
+        void set_corked(bool is_corked) override
+        {
+            set_tcp_cork(m_socket.lowest_layer(), is_corked);
+        }
+
+        std::optional<std::chrono::system_clock::time_point> get_receive_time() const override
+        {
+            return m_receive_time;
+        }
+
+        std::optional<Tcp_info> get_tcp_info() override
+        {
+            // Unix domain sockets have no tcp state
+            if constexpr (std::is_same_v<Asio_socket, Local_protocol::socket>)
+                return std::nullopt;
+            else if (!is_open())
+                return std::nullopt;
+            else
+                return read_tcp_info(m_socket.lowest_layer().native_handle());
+        }
+
+        std::string set_socket_options(const Socket_options& options) override
+        {
+            std::string failed_options = apply_socket_options(m_socket.lowest_layer(), options);
+            find_zero_copy();
+            find_timestamping(options);
+
+            return failed_options;
+        }
+
         bool is_open() const override
         {
             return m_socket.lowest_layer().is_open();
@@ -82,13 +337,525 @@ namespace Net
 
         std::string get_ip() const override
         {
-            if (is_open())
-                return m_socket.lowest_layer().remote_endpoint().address().to_string();
+            return get_address()->to_string();
+        }
+
+        std::optional<asio::ip::address> get_address() const override
+        {
+            // Peers of the unix domain sockets are on the same host and have no address
+            if constexpr (std::is_same_v<Asio_socket, Local_protocol::socket>)
+                return asio::ip::address_v4::loopback();
             else
-                return "0.0.0.0";
+            {
+                asio::error_code error;
+
+                if (is_open())
+                {
+                    const auto endpoint = m_socket.lowest_layer().remote_endpoint(error);
+
+                    if (!error)
+                        return endpoint.address();
+                }
+
+                return asio::ip::address_v4::any();
+            }
         }
 
     private:
+        // Tls engine has an input and an output buffer of one record and the record writer copies one record
+        static constexpr size_t TLS_BUFFER_BYTES = 3 * 17 * 1024;
+
+        // Sockets whose native handle can be released from one io_context and assigned to another
+        static constexpr bool IS_MOVABLE =
+            std::is_same_v<Asio_socket, Protocol::socket> || std::is_same_v<Asio_socket, Local_protocol::socket>;
+
+        // Only the plain tcp sockets read straight to the registered buffers, tls reads through its own buffers
+        void find_registered_buffers()
+        {
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+            {
+                asio::execution_context& context = asio::query(m_socket.get_executor(), asio::execution::context);
+
+                m_registered_buffers = asio::has_service<Registered_receive_buffers>(context)
+                                           ? &asio::use_service<Registered_receive_buffers>(context)
+                                           : nullptr;
+            }
+        }
+
+        // Only the plain tcp sockets send without copying, tls encrypts the data to its own buffers
+        void find_zero_copy()
+        {
+#ifdef NET_HAS_ZERO_COPY
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+            {
+                int is_enabled = 0;
+                socklen_t size = sizeof(is_enabled);
+
+                m_is_zero_copy_enabled =
+                    m_socket.is_open() &&
+                    getsockopt(m_socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &is_enabled, &size) == 0 &&
+                    is_enabled != 0;
+            }
+#endif
+        }
+
+        // Only the plain tcp sockets read with the recvmsg, tls reads through its engine that drops the stamps
+        void find_timestamping([[maybe_unused]] const Socket_options& options)
+        {
+#ifdef NET_HAS_RECEIVE_TIMESTAMPS
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+            {
+                int flags = 0;
+                socklen_t size = sizeof(flags);
+
+                m_is_timestamping =
+                    options.m_receive_timestamps && m_socket.is_open() &&
+                    getsockopt(m_socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags, &size) == 0 &&
+                    flags != 0;
+            }
+#endif
+        }
+
+        /**
+         *   Reads with the recvmsg so the stamps of the kernel come with the data, asio reads without them.
+         *   Socket is read until it would block and then waited to be readable, like the reactor of asio does.
+         *
+         *   @param keeps the owner alive until the read is finished
+         *   @param the buffer
+         *   @param size of the buffer
+         *   @param number of bytes read so far
+         *   @param true to read until the buffer is full, false to finish after any bytes
+         *   @param the event that is broadcast when the read is finished
+         */
+        void read_timestamped(
+            std::shared_ptr<void> owner, [[maybe_unused]] char* buffer, [[maybe_unused]] size_t size,
+            size_t bytes_read, [[maybe_unused]] bool is_exact, Delegate<asio::error_code, size_t>& finished)
+        {
+            asio::error_code error;
+#ifdef NET_HAS_RECEIVE_TIMESTAMPS
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+            {
+                while (bytes_read < size)
+                {
+                    iovec data = {.iov_base = buffer + bytes_read, .iov_len = size - bytes_read};
+                    Timestamp_control control;
+
+                    msghdr message = {};
+                    message.msg_iov = &data;
+                    message.msg_iovlen = 1;
+                    message.msg_control = control.m_data.data();
+                    message.msg_controllen = control.m_data.size();
+
+                    const ssize_t received = ::recvmsg(m_socket.native_handle(), &message, MSG_DONTWAIT);
+
+                    if (received > 0)
+                    {
+                        read_receive_time(message);
+                        bytes_read += static_cast<size_t>(received);
+
+                        if (is_exact)
+                            continue;
+
+                        break;
+                    }
+
+                    if (received < 0 && errno == EINTR)
+                        continue;
+
+                    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    {
+                        m_socket.async_wait(
+                            Asio_socket::wait_read,
+                            with_memory(
+                                m_read_memory, [this, owner = std::move(owner), buffer, size, bytes_read, is_exact,
+                                                &finished](asio::error_code wait_error) mutable {
+                                    if (wait_error)
+                                        finished.broadcast(wait_error, bytes_read);
+                                    else
+                                        read_timestamped(
+                                            std::move(owner), buffer, size, bytes_read, is_exact, finished);
+                                }));
+                        return;
+                    }
+
+                    error = received == 0 ? asio::error_code(asio::error::eof)
+                                          : asio::error_code(errno, asio::error::get_system_category());
+                    break;
+                }
+            }
+            else
+                error = asio::error::operation_not_supported;
+#else
+            error = asio::error::operation_not_supported;
+#endif
+            // Read that finished without waiting is completed later like the reads of asio, not inside the call
+            asio::post(
+                m_socket.get_executor(),
+                with_memory(m_read_memory, [owner = std::move(owner), error, bytes_read, &finished] {
+                    finished.broadcast(error, bytes_read);
+                }));
+        }
+
+#ifdef NET_HAS_RECEIVE_TIMESTAMPS
+        // Stamps of the messages have to be aligned like their header
+        struct Timestamp_control
+        {
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(scm_timestamping))> m_data = {};
+        };
+
+        // Hardware stamp is the third one, the first is the stamp of the network stack
+        void read_receive_time(msghdr& message)
+        {
+            for (cmsghdr* control_header = CMSG_FIRSTHDR(&message); control_header != nullptr;
+                 control_header = CMSG_NXTHDR(&message, control_header))
+            {
+                if (control_header->cmsg_level != SOL_SOCKET || control_header->cmsg_type != SCM_TIMESTAMPING)
+                    continue;
+
+                scm_timestamping stamps;
+                std::memcpy(&stamps, CMSG_DATA(control_header), sizeof(stamps));
+
+                const timespec& stamp =
+                    stamps.ts[2].tv_sec != 0 || stamps.ts[2].tv_nsec != 0 ? stamps.ts[2] : stamps.ts[0];
+
+                if (stamp.tv_sec == 0 && stamp.tv_nsec == 0)
+                    continue;
+
+                m_receive_time = std::chrono::system_clock::time_point(
+                    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::seconds(stamp.tv_sec) + std::chrono::nanoseconds(stamp.tv_nsec)));
+            }
+        }
+#endif
+
+        // Records are written one at a time so each of them is encrypted from its own write
+        void write_next_record(std::shared_ptr<void> owner, size_t bytes_written)
+        {
+            const asio::const_buffer record = m_record_writer.next_record();
+
+            if (record.size() == 0)
+            {
+                m_record_writer.finish();
+                m_write_finished.broadcast(asio::error_code(), bytes_written);
+                return;
+            }
+
+            asio::async_write(
+                m_socket, record,
+                with_memory(
+                    m_write_memory,
+                    [this, owner = std::move(owner), bytes_written](asio::error_code error, size_t bytes) mutable {
+                        if (error)
+                        {
+                            m_record_writer.finish();
+                            m_write_finished.broadcast(error, bytes_written + bytes);
+                        }
+                        else
+                            write_next_record(std::move(owner), bytes_written + bytes);
+                    }));
+        }
+
+        // Binds the handler to the memory so the state of its operation is not allocated from the heap
+        template <typename Handler_type>
+        [[nodiscard]] static auto with_memory(Handler_memory& memory, Handler_type handler)
+        {
+            return asio::bind_allocator(Handler_allocator<std::byte>(memory), std::move(handler));
+        }
+
+        /**
+         *   Sends the rest of the file without copying it through the user space.
+         *   Sockets that don't support it never get here because the can_write_file is false for them.
+         *
+         *   @param keeps the owner alive until the write is finished
+         *   @param the file
+         *   @param offset of the next file byte to send
+         *   @param number of file bytes left
+         *   @param number of bytes written so far
+         */
+        void write_file_part(
+            std::shared_ptr<void> owner, std::shared_ptr<const Native_file> file, uint64_t offset, size_t remaining,
+            size_t bytes_written)
+        {
+            if constexpr (!std::is_same_v<Asio_socket, Protocol::socket>)
+                m_write_finished.broadcast(asio::error::operation_not_supported, bytes_written);
+#if defined(__linux__)
+            else
+            {
+                // Asio waits for the socket to become writable instead of blocking in the sendfile
+                asio::error_code error;
+                m_socket.native_non_blocking(true, error);
+
+                while (!error && remaining > 0)
+                {
+                    off_t file_offset = static_cast<off_t>(offset);
+                    const ssize_t sent =
+                        ::sendfile(m_socket.native_handle(), file->native_handle(), &file_offset, remaining);
+
+                    if (sent > 0)
+                    {
+                        offset += static_cast<uint64_t>(sent);
+                        remaining -= static_cast<size_t>(sent);
+                        bytes_written += static_cast<size_t>(sent);
+                    }
+                    else if (sent == 0)
+                        error = asio::error::eof; // File became shorter after it was opened
+                    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        m_socket.async_wait(
+                            Protocol::socket::wait_write,
+                            with_memory(
+                                m_write_memory,
+                                [this, owner = std::move(owner), file = std::move(file), offset, remaining,
+                                 bytes_written](asio::error_code wait_error) mutable {
+                                    if (wait_error)
+                                        m_write_finished.broadcast(wait_error, bytes_written);
+                                    else
+                                        write_file_part(
+                                            std::move(owner), std::move(file), offset, remaining, bytes_written);
+                                }));
+                        return;
+                    }
+                    else if (errno != EINTR)
+                        error = asio::error_code(errno, asio::error::get_system_category());
+                }
+
+                m_write_finished.broadcast(error, bytes_written);
+            }
+#elif defined(_WIN32) && defined(ASIO_HAS_WINDOWS_OVERLAPPED_PTR)
+            else if (remaining == 0)
+                m_write_finished.broadcast(asio::error_code(), bytes_written); // Zero would send the whole file
+            else
+            {
+                // TransmitFile sends atmost this many bytes in one call, the larger parts are sent in turns
+                constexpr size_t MAX_TRANSMIT_BYTES = std::numeric_limits<int32_t>::max() - 1;
+                const size_t part_size = std::min(remaining, MAX_TRANSMIT_BYTES);
+
+                asio::windows::overlapped_ptr overlapped(
+                    m_socket.get_executor(),
+                    [this, owner = std::move(owner), file, offset, remaining, bytes_written](
+                        asio::error_code error, size_t bytes) mutable {
+                        // The file became shorter after it was opened if nothing was sent without an error
+                        if (!error && bytes == 0)
+                            error = asio::error::eof;
+
+                        if (error || bytes >= remaining)
+                            m_write_finished.broadcast(error, bytes_written + bytes);
+                        else
+                            write_file_part(
+                                std::move(owner), std::move(file), offset + bytes, remaining - bytes,
+                                bytes_written + bytes);
+                    });
+
+                overlapped.get()->Offset = static_cast<DWORD>(offset);
+                overlapped.get()->OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+                const BOOL is_sent = ::TransmitFile(
+                    m_socket.native_handle(), file->native_handle(), static_cast<DWORD>(part_size), 0,
+                    overlapped.get(), nullptr, 0);
+                const DWORD last_error = ::GetLastError();
+
+                // Completion is posted by the io_context unless the call failed right away
+                if (!is_sent && last_error != ERROR_IO_PENDING)
+                    overlapped.complete(asio::error_code(last_error, asio::error::get_system_category()), 0);
+                else
+                    overlapped.release();
+            }
+#endif
+        }
+
+#ifdef NET_HAS_ZERO_COPY
+        /**
+         *   Sends the buffers from where the earlier sends stopped with the MSG_ZEROCOPY. Every successful send
+         *   gets the next id from the kernel and the buffer owner is kept until the kernel reports the id done.
+         *
+         *   @param keeps the owner alive until the write is finished
+         *   @param the buffers
+         *   @param the owner of the memory of the buffers
+         *   @param number of bytes written so far
+         */
+        void write_zero_copy_part(
+            std::shared_ptr<void> owner, std::span<const asio::const_buffer> buffers,
+            std::shared_ptr<void> buffer_owner, size_t bytes_written)
+        {
+            asio::error_code error;
+            m_socket.native_non_blocking(true, error);
+            read_zero_copy_completions();
+
+            // Kernel refuses to pin more memory when the socket is over its optmem limit, the rest is copied then
+            int flags = MSG_ZEROCOPY | MSG_NOSIGNAL;
+            size_t total_bytes = 0;
+
+            for (const asio::const_buffer& buffer : buffers)
+                total_bytes += buffer.size();
+
+            while (!error && bytes_written < total_bytes)
+            {
+                msghdr message = {};
+                message.msg_iovlen = fill_iovecs(buffers, bytes_written);
+                message.msg_iov = m_zero_copy_iovecs.data();
+
+                const ssize_t sent = ::sendmsg(m_socket.native_handle(), &message, flags);
+
+                if (sent >= 0)
+                {
+                    if (flags & MSG_ZEROCOPY)
+                        m_zero_copy_sends.push_back({.m_id = m_next_zero_copy_id++, .m_buffer_owner = buffer_owner});
+
+                    bytes_written += static_cast<size_t>(sent);
+                }
+                else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    m_socket.async_wait(
+                        Protocol::socket::wait_write,
+                        with_memory(
+                            m_write_memory,
+                            [this, owner = std::move(owner), buffers, buffer_owner = std::move(buffer_owner),
+                             bytes_written](asio::error_code wait_error) mutable {
+                                if (wait_error)
+                                    m_write_finished.broadcast(wait_error, bytes_written);
+                                else
+                                    write_zero_copy_part(
+                                        std::move(owner), buffers, std::move(buffer_owner), bytes_written);
+                            }));
+
+                    wait_zero_copy_completions();
+                    return;
+                }
+                else if (errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+                    flags &= ~MSG_ZEROCOPY;
+                else if (errno != EINTR)
+                    error = asio::error_code(errno, asio::error::get_system_category());
+            }
+
+            wait_zero_copy_completions();
+            m_write_finished.broadcast(error, bytes_written);
+        }
+
+        // @return the number of the iovecs that point to the buffers after the bytes already written
+        [[nodiscard]] size_t fill_iovecs(std::span<const asio::const_buffer> buffers, size_t bytes_written)
+        {
+            // Linux takes atmost the UIO_MAXIOV buffers in one send
+            m_zero_copy_iovecs.resize(std::min<size_t>(buffers.size(), 1024));
+            size_t count = 0;
+
+            for (const asio::const_buffer& buffer : buffers)
+            {
+                if (bytes_written >= buffer.size())
+                {
+                    bytes_written -= buffer.size();
+                    continue;
+                }
+
+                if (count == m_zero_copy_iovecs.size())
+                    break;
+
+                m_zero_copy_iovecs[count++] = {
+                    .iov_base = const_cast<char*>(static_cast<const char*>(buffer.data())) + bytes_written,
+                    .iov_len = buffer.size() - bytes_written};
+                bytes_written = 0;
+            }
+
+            return count;
+        }
+
+        // Reads the completions from the error queue of the socket and releases the owners of the finished sends
+        void read_zero_copy_completions()
+        {
+            while (!m_zero_copy_sends.empty())
+            {
+                alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(sock_extended_err)) + 64> control;
+                msghdr message = {};
+                message.msg_control = control.data();
+                message.msg_controllen = control.size();
+
+                if (::recvmsg(m_socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                    return;
+
+                for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+                     header = CMSG_NXTHDR(&message, header))
+                {
+                    if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) &&
+                        !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
+                        continue;
+
+                    sock_extended_err extended_error;
+                    std::memcpy(&extended_error, CMSG_DATA(header), sizeof(extended_error));
+
+                    if (extended_error.ee_errno != 0 || extended_error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                        continue;
+
+                    // Range of the ids wraps like the kernel counter
+                    const uint32_t first_id = extended_error.ee_info;
+                    const uint32_t range = extended_error.ee_data - first_id;
+
+                    std::erase_if(m_zero_copy_sends, [first_id, range](const Zero_copy_send& send) {
+                        return send.m_id - first_id <= range;
+                    });
+
+                    // Kernel copied the data anyway, for example to the loopback, so the pinning is only a cost
+                    if (extended_error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                        m_is_zero_copy_enabled = false;
+                }
+            }
+        }
+
+        // Error queue makes the socket report an error, the wait is started before the read so no report is missed
+        void wait_zero_copy_completions()
+        {
+            if (m_zero_copy_sends.empty() || m_is_waiting_zero_copy)
+                return;
+
+            m_is_waiting_zero_copy = true;
+
+            m_socket.async_wait(
+                Protocol::socket::wait_error, [this, owner = lock_lifetime_owner()](asio::error_code error) {
+                    m_is_waiting_zero_copy = false;
+
+                    if (error)
+                        return;
+
+                    read_zero_copy_completions();
+                    wait_zero_copy_completions();
+                });
+
+            read_zero_copy_completions();
+        }
+#endif
+
         Asio_socket m_socket;
+
+        // Service of the io_context of the socket, nullptr if the context has no registered buffers
+        Registered_receive_buffers* m_registered_buffers = nullptr;
+
+        // Reads and writes can be pending at the same time so both have their own memory
+        Handler_memory m_read_memory;
+        Handler_memory m_write_memory;
+
+        // Only the tls sockets split their writes to the records
+        struct No_record_writer
+        {
+        };
+
+        std::conditional_t<std::is_same_v<Asio_socket, Ssl_socket>, Tls_record_writer, No_record_writer>
+            m_record_writer;
+
+        bool m_is_zero_copy_enabled = false;
+
+        // Reads go through the recvmsg and keep the stamp of the latest one, see the read_timestamped
+        bool m_is_timestamping = false;
+        std::optional<std::chrono::system_clock::time_point> m_receive_time = std::nullopt;
+#ifdef NET_HAS_ZERO_COPY
+        // Sends whose buffers the kernel may still read, the ids are given by the kernel in the order of the sends
+        struct Zero_copy_send
+        {
+            uint32_t m_id = 0;
+            std::shared_ptr<void> m_buffer_owner;
+        };
+
+        std::vector<Zero_copy_send> m_zero_copy_sends;
+        uint32_t m_next_zero_copy_id = 0;
+        bool m_is_waiting_zero_copy = false;
+        std::vector<iovec> m_zero_copy_iovecs;
+#endif
     };
 } // namespace Net
@@ -2,6 +2,14 @@
 
 #include "../Events/Delegate.h"
 #include "../Utility/Common.h"
+#include "../Utility/Native_file.h"
+#include "Socket_options.h"
+#include "Tcp_info.h"
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 
 namespace Net
 {
@@ -27,19 +35,166 @@ namespace Net
 
         virtual void async_read_header(void* buffer, size_t size) = 0;
         virtual void async_read_body(void* buffer, size_t size) = 0;
-        virtual void async_write_header(const void* buffer, size_t size) = 0;
-        virtual void async_write_body(const void* buffer, size_t size) = 0;
+
+        // Reads whatever is available up to the size of the buffer
+        virtual void async_read_some(void* buffer, size_t size) = 0;
+
+        // @return true if the async_wait_readable is supported
+        [[nodiscard]] virtual bool can_wait_readable() const
+        {
+            return false;
+        }
+
+        // Waits until there is data to read without reading it, m_wait_readable_finished is called then
+        virtual void async_wait_readable()
+        {
+            m_wait_readable_finished.broadcast(asio::error::operation_not_supported);
+        }
+
+        // Writes all of the buffers with a single gather write. The buffers must stay valid until m_write_finished
+        virtual void async_write(std::span<const asio::const_buffer> buffers) = 0;
+
+        // @return true if the async_write_file is supported, it sends files without copying them through the user space
+        [[nodiscard]] virtual bool can_write_file() const = 0;
+
+        /**
+         *   Writes the buffers and then the part of the file, m_write_finished is called when all of it is written.
+         *   The buffers must stay valid until then and this can be called only if can_write_file is true.
+         *
+         *   @param the buffers written before the file
+         *   @param the file
+         *   @param offset in the file
+         *   @param number of bytes written from the file
+         */
+        virtual void async_write_file(
+            std::span<const asio::const_buffer> buffers, std::shared_ptr<const Native_file> file, uint64_t offset,
+            size_t size) = 0;
+
+        // Corks or uncorks the kernel send of the socket, see the set_tcp_cork. Does nothing if not supported
+        virtual void set_corked([[maybe_unused]] bool is_corked)
+        {
+        }
+
+        // @return true if the async_write_zero_copy is supported and the socket has the SO_ZEROCOPY on
+        [[nodiscard]] virtual bool can_write_zero_copy() const
+        {
+            return false;
+        }
+
+        /**
+         *   Writes the buffers like the async_write but the kernel sends them without copying. The kernel may still
+         *   read the buffers after the m_write_finished, so the buffer owner keeps them alive until the kernel tells
+         *   it is done with them. This can be called only if can_write_zero_copy is true.
+         *
+         *   @param the buffers
+         *   @param the owner of the memory of the buffers, released when the kernel no longer needs it
+         */
+        virtual void async_write_zero_copy(
+            [[maybe_unused]] std::span<const asio::const_buffer> buffers,
+            [[maybe_unused]] std::shared_ptr<void> buffer_owner)
+        {
+            m_write_finished.broadcast(asio::error::operation_not_supported, 0);
+        }
+
+        // Executor that runs the completion handlers of this socket, this is always a strand
+        [[nodiscard]] virtual asio::any_io_executor get_executor() = 0;
+
+        // @return true if the move_to_executor is supported, only the plain tcp and unix domain sockets support it
+        [[nodiscard]] virtual bool can_move_executor() const
+        {
+            return false;
+        }
+
+        /**
+         *   Moves the socket to the executor so its completion handlers run there, for example on the thread of
+         *   another io_context. Must be called on the current strand when no operations are pending.
+         *
+         *   @param the strand that runs the handlers from now on
+         *   @return the error if the socket could not be moved, it stays on its current executor then
+         */
+        virtual asio::error_code move_to_executor([[maybe_unused]] asio::any_io_executor executor)
+        {
+            return asio::error::operation_not_supported;
+        }
+
+        /**
+         *   Takes the native handle out of the plain tcp socket, for example to pass it to another process. The
+         *   pending operations end with operation_aborted and the socket is closed after this.
+         *
+         *   @return the handle, nullopt if the socket is not a plain tcp socket or it could not be released
+         */
+        [[nodiscard]] virtual std::optional<Protocol::socket::native_handle_type> release_handle()
+        {
+            return std::nullopt;
+        }
+
+        // @return bytes the socket keeps in buffers of its own, for example for the tls records
+        [[nodiscard]] virtual size_t get_buffer_bytes() const noexcept
+        {
+            return 0;
+        }
+
+        /**
+         *   @return when the kernel received the last bytes of the latest read, nothing if the socket does not
+         *           stamp its reads, see the Socket_options::m_receive_timestamps
+         */
+        [[nodiscard]] virtual std::optional<std::chrono::system_clock::time_point> get_receive_time() const
+        {
+            return std::nullopt;
+        }
+
+        // @return the TCP_INFO of the kernel, nothing if the socket is not a tcp socket or the system does not have it
+        [[nodiscard]] virtual std::optional<Tcp_info> get_tcp_info()
+        {
+            return std::nullopt;
+        }
+
+        // @return memory the receive buffer of the connection should be allocated from, nullptr for the heap
+        [[nodiscard]] virtual std::shared_ptr<std::pmr::memory_resource> get_receive_memory() const
+        {
+            return nullptr;
+        }
+
+        /**
+         *   Sets the object that owns this socket. Every operation keeps the owner alive until its
+         *   completion handler has run so the owner can be released while operations are pending.
+         */
+        void set_lifetime_owner(std::weak_ptr<void> owner) noexcept
+        {
+            m_lifetime_owner = std::move(owner);
+        }
+
+        // @return the options that could not be set, see the apply_socket_options
+        [[nodiscard]] virtual std::string set_socket_options(const Socket_options& options) = 0;
 
         [[nodiscard]] virtual bool is_open() const = 0;
         [[nodiscard]] virtual std::string get_ip() const = 0;
+
+        // @return the address of the peer or nullopt if the ip is not an address, for example a host name
+        [[nodiscard]] virtual std::optional<asio::ip::address> get_address() const
+        {
+            asio::error_code error;
+            const asio::ip::address address = asio::ip::make_address(get_ip(), error);
+
+            return error ? std::nullopt : std::optional(address);
+        }
+
         virtual void disconnect() = 0;
 
         Delegate<asio::error_code> m_handshake_finished;
         Delegate<asio::error_code, size_t> m_read_header_finished;
         Delegate<asio::error_code, size_t> m_read_body_finished;
-        Delegate<asio::error_code, size_t> m_write_header_finished;
-        Delegate<asio::error_code, size_t> m_write_body_finished;
+        Delegate<asio::error_code, size_t> m_read_some_finished;
+        Delegate<asio::error_code> m_wait_readable_finished;
+        Delegate<asio::error_code, size_t> m_write_finished;
+
+    protected:
+        [[nodiscard]] std::shared_ptr<void> lock_lifetime_owner() const noexcept
+        {
+            return m_lifetime_owner.lock();
+        }
 
     private:
+        std::weak_ptr<void> m_lifetime_owner;
     };
 } // namespace Net
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <optional>
+#include <string>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/net_tstamp.h>
+
+#if defined(SO_TIMESTAMPING) && defined(SCM_TIMESTAMPING)
+#define NET_HAS_RECEIVE_TIMESTAMPS
+#endif
+#endif
+
+namespace Net
+{
+    // Options of the tcp sockets, the options without a value are left to the system default
+    struct Socket_options
+    {
+        // Sends the small writes right away instead of waiting for the ack of the earlier data
+        bool m_no_delay = true;
+
+        std::optional<int> m_send_buffer_size = std::nullopt;
+        std::optional<int> m_receive_buffer_size = std::nullopt;
+
+        bool m_keep_alive = false;
+
+        // Idle time before the first keepalive probe, the interval between the probes and how many are sent
+        std::optional<std::chrono::seconds> m_keep_alive_idle = std::nullopt;
+        std::optional<std::chrono::seconds> m_keep_alive_interval = std::nullopt;
+        std::optional<int> m_keep_alive_count = std::nullopt;
+
+        // Linux only, how long the receive busy polls the device before sleeping
+        std::optional<std::chrono::microseconds> m_busy_poll = std::nullopt;
+
+        // Linux only, acks the received data right away. Kernel can turn this off again so it is a hint
+        bool m_quick_ack = false;
+
+        // IP_TOS for ipv4 and the traffic class for ipv6, for example 0x10 for low delay
+        std::optional<int> m_type_of_service = std::nullopt;
+
+        /**
+         *   Linux only, the write batches of atleast this many bytes are sent with the MSG_ZEROCOPY on the plain tcp
+         *   sockets. Kernel sends them from the memory of the messages, which pays off for the messages of hundreds
+         *   of kilobytes but costs more than the copy for the small ones.
+         */
+        std::optional<size_t> m_zero_copy_threshold = std::nullopt;
+
+        /**
+         *   Linux only, the kernel stamps the received data with the SO_TIMESTAMPING so the messages read from the
+         *   plain tcp sockets carry the time their last bytes arrived, see the Owned_message::m_wire_time. Hardware
+         *   stamps are used when the device makes them, they are in the clock of the device so it has to be synced
+         *   to the system clock, for example with the phc2sys. Otherwise the network stack stamps the data.
+         */
+        bool m_receive_timestamps = false;
+    };
+
+    // Integer option of any level and name, asio only has types for the common ones
+    class Integer_socket_option
+    {
+    public:
+        Integer_socket_option(int level, int name, int value) noexcept : m_level(level), m_name(name), m_value(value)
+        {
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] int level(const Protocol_type&) const noexcept
+        {
+            return m_level;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] int name(const Protocol_type&) const noexcept
+        {
+            return m_name;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] const int* data(const Protocol_type&) const noexcept
+        {
+            return &m_value;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] size_t size(const Protocol_type&) const noexcept
+        {
+            return sizeof(m_value);
+        }
+
+    private:
+        int m_level;
+        int m_name;
+        int m_value;
+    };
+
+    /**
+     *   Sets the options to the socket. Options that the platform does not have are skipped.
+     *
+     *   @param the connected socket
+     *   @param the options
+     *   @return the options that could not be set with the reason, empty if everything was set
+     */
+    [[nodiscard]] inline std::string apply_socket_options(
+        Protocol::socket::lowest_layer_type& socket, const Socket_options& options)
+    {
+        std::string failed_options;
+
+        const auto set = [&socket, &failed_options](const auto& option, const char* option_name) {
+            asio::error_code error;
+            socket.set_option(option, error);
+
+            if (error)
+                failed_options +=
+                    std::format("{}{} ({})", failed_options.empty() ? "" : ", ", option_name, error.message());
+        };
+
+        set(Protocol::no_delay(options.m_no_delay), "TCP_NODELAY");
+
+        if (options.m_send_buffer_size)
+            set(asio::socket_base::send_buffer_size(*options.m_send_buffer_size), "SO_SNDBUF");
+
+        if (options.m_receive_buffer_size)
+            set(asio::socket_base::receive_buffer_size(*options.m_receive_buffer_size), "SO_RCVBUF");
+
+        set(asio::socket_base::keep_alive(options.m_keep_alive), "SO_KEEPALIVE");
+
+#ifdef TCP_KEEPIDLE
+        if (options.m_keep_alive_idle)
+            set(Integer_socket_option(IPPROTO_TCP, TCP_KEEPIDLE, static_cast<int>(options.m_keep_alive_idle->count())),
+                "TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+        if (options.m_keep_alive_interval)
+            set(Integer_socket_option(
+                    IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(options.m_keep_alive_interval->count())),
+                "TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+        if (options.m_keep_alive_count)
+            set(Integer_socket_option(IPPROTO_TCP, TCP_KEEPCNT, *options.m_keep_alive_count), "TCP_KEEPCNT");
+#endif
+#ifdef SO_BUSY_POLL
+        if (options.m_busy_poll)
+            set(Integer_socket_option(SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(options.m_busy_poll->count())),
+                "SO_BUSY_POLL");
+#endif
+#ifdef TCP_QUICKACK
+        if (options.m_quick_ack)
+            set(Integer_socket_option(IPPROTO_TCP, TCP_QUICKACK, 1), "TCP_QUICKACK");
+#endif
+#ifdef SO_ZEROCOPY
+        if (options.m_zero_copy_threshold)
+            set(Integer_socket_option(SOL_SOCKET, SO_ZEROCOPY, 1), "SO_ZEROCOPY");
+#endif
+#ifdef NET_HAS_RECEIVE_TIMESTAMPS
+        if (options.m_receive_timestamps)
+            set(Integer_socket_option(
+                    SOL_SOCKET, SO_TIMESTAMPING,
+                    SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                        SOF_TIMESTAMPING_RAW_HARDWARE),
+                "SO_TIMESTAMPING");
+#endif
+
+        if (options.m_type_of_service)
+        {
+            asio::error_code error;
+            const bool is_v6 = socket.local_endpoint(error).address().is_v6();
+
+            if (is_v6)
+                set(Integer_socket_option(IPPROTO_IPV6, IPV6_TCLASS, *options.m_type_of_service), "IPV6_TCLASS");
+            else
+                set(Integer_socket_option(IPPROTO_IP, IP_TOS, *options.m_type_of_service), "IP_TOS");
+        }
+
+        return failed_options;
+    }
+
+    /**
+     *   Holds the partial segments in the kernel while corked and sends them when uncorked, so a flush that needs
+     *   many writes leaves in full segments. Errors are ignored, the writes only go out in more segments then.
+     *
+     *   @param the connected socket
+     *   @param true to cork, false to send what is held
+     */
+    inline void set_tcp_cork(
+        [[maybe_unused]] Protocol::socket::lowest_layer_type& socket, [[maybe_unused]] bool is_corked) noexcept
+    {
+#ifdef TCP_CORK
+        asio::error_code ignored_error;
+        socket.set_option(Integer_socket_option(IPPROTO_TCP, TCP_CORK, is_corked ? 1 : 0), ignored_error);
+#endif
+    }
+
+    // Unix domain sockets have no segments to hold
+    inline void set_tcp_cork(
+        [[maybe_unused]] Local_protocol::socket::lowest_layer_type& socket, [[maybe_unused]] bool is_corked) noexcept
+    {
+    }
+
+    // Unix domain sockets have only the buffer sizes of the options, the rest are for the tcp
+    [[nodiscard]] inline std::string apply_socket_options(
+        Local_protocol::socket::lowest_layer_type& socket, const Socket_options& options)
+    {
+        std::string failed_options;
+
+        const auto set = [&socket, &failed_options](const auto& option, const char* option_name) {
+            asio::error_code error;
+            socket.set_option(option, error);
+
+            if (error)
+                failed_options +=
+                    std::format("{}{} ({})", failed_options.empty() ? "" : ", ", option_name, error.message());
+        };
+
+        if (options.m_send_buffer_size)
+            set(asio::socket_base::send_buffer_size(*options.m_send_buffer_size), "SO_SNDBUF");
+
+        if (options.m_receive_buffer_size)
+            set(asio::socket_base::receive_buffer_size(*options.m_receive_buffer_size), "SO_RCVBUF");
+
+        return failed_options;
+    }
+} // namespace Net
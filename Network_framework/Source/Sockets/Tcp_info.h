@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifdef TCP_INFO
+#define NET_HAS_TCP_INFO
+#endif
+#elif defined(_WIN32)
+#include <mstcpip.h>
+
+#ifdef SIO_TCP_INFO
+#define NET_HAS_TCP_INFO
+#endif
+#endif
+
+namespace Net
+{
+    /**
+     *   State of the tcp connection as the kernel sees it, this tells whether the slow delivery is the network.
+     *   Linux counts the window and the unacked data in segments, they are converted with the segment size.
+     */
+    struct Tcp_info
+    {
+        // Smoothed round trip time of the kernel, unlike the heartbeat it does not include the queues of the peer
+        std::chrono::microseconds m_round_trip_time = std::chrono::microseconds(0);
+
+        uint64_t m_congestion_window_bytes = 0;
+
+        // Sent but not yet acknowledged
+        uint64_t m_unacked_bytes = 0;
+
+        // Total since the connection was opened, Windows only counts the bytes so they are divided by the segment
+        uint64_t m_retransmitted_segments = 0;
+    };
+
+    /**
+     *   Reads the TCP_INFO of the socket, one system call that does not block
+     *
+     *   @return the info or nothing if the system does not have it or the socket is not a connected tcp socket
+     */
+    [[nodiscard]] inline std::optional<Tcp_info> read_tcp_info(
+        [[maybe_unused]] Protocol::socket::native_handle_type handle) noexcept
+    {
+#if defined(NET_HAS_TCP_INFO) && defined(__linux__)
+        tcp_info info = {};
+        socklen_t size = sizeof(info);
+
+        if (::getsockopt(handle, IPPROTO_TCP, TCP_INFO, &info, &size) != 0)
+            return std::nullopt;
+
+        return Tcp_info{
+            .m_round_trip_time = std::chrono::microseconds(info.tcpi_rtt),
+            .m_congestion_window_bytes = static_cast<uint64_t>(info.tcpi_snd_cwnd) * info.tcpi_snd_mss,
+            .m_unacked_bytes = static_cast<uint64_t>(info.tcpi_unacked) * info.tcpi_snd_mss,
+            .m_retransmitted_segments = info.tcpi_total_retrans};
+#elif defined(NET_HAS_TCP_INFO)
+        DWORD version = 0;
+        TCP_INFO_v0 info = {};
+        DWORD size = 0;
+
+        if (::WSAIoctl(handle, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &size, nullptr, nullptr) !=
+            0)
+            return std::nullopt;
+
+        return Tcp_info{
+            .m_round_trip_time = std::chrono::microseconds(info.RttUs),
+            .m_congestion_window_bytes = info.Cwnd,
+            .m_unacked_bytes = info.BytesInFlight,
+            .m_retransmitted_segments = info.Mss != 0 ? info.BytesRetrans / info.Mss : 0};
+#else
+        return std::nullopt;
+#endif
+    }
+} // namespace Net
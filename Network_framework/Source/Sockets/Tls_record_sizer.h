@@ -0,0 +1,155 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Sizes the tls records of the writes. Every record has to arrive whole before the peer can decrypt any of
+     *   it, so a full 16 KB record that spans many tcp segments waits for the slowest of them. A new or idle
+     *   connection has a small congestion window, so it writes records that fit one segment, and after it has
+     *   written enough to have grown the window it writes the full records that cost less to encrypt and send.
+     */
+    class Tls_record_sizer
+    {
+    public:
+        // Payload that fits one tcp segment of the usual 1500 byte mtu with the ip, tcp and tls overheads
+        static constexpr size_t SMALL_RECORD_SIZE = 1400;
+
+        // Largest record payload the tls allows
+        static constexpr size_t FULL_RECORD_SIZE = 16 * 1024;
+
+        // Bytes written in the small records after the connection has started or been idle
+        static constexpr size_t SMALL_RECORD_BYTES = 1024 * 1024;
+
+        // Tcp shrinks the congestion window of a connection that has been idle about this long
+        static constexpr std::chrono::milliseconds IDLE_TIME = std::chrono::milliseconds(1000);
+
+        // Call when a write starts, the records are small again if the connection has been idle
+        void start_write() noexcept
+        {
+            if (std::chrono::steady_clock::now() - m_last_write_time >= IDLE_TIME)
+                m_bytes_since_idle = 0;
+        }
+
+        // Call when a write has finished, the idle time is counted from here
+        void finish_write() noexcept
+        {
+            m_last_write_time = std::chrono::steady_clock::now();
+        }
+
+        /**
+         *   Size stays the same until add_written is called, so a write that has to be retried with the same
+         *   arguments gets the same size
+         *
+         *   @param the bytes that are left to write
+         *   @return the size of the next record
+         */
+        [[nodiscard]] size_t get_record_size(size_t remaining) const noexcept
+        {
+            return std::min(remaining, m_bytes_since_idle < SMALL_RECORD_BYTES ? SMALL_RECORD_SIZE : FULL_RECORD_SIZE);
+        }
+
+        void add_written(size_t bytes) noexcept
+        {
+            m_bytes_since_idle += bytes;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_last_write_time;
+        size_t m_bytes_since_idle = 0;
+    };
+
+    /**
+     *   Splits the buffers of a write to the records of the Tls_record_sizer. Asio ssl stream encrypts every
+     *   buffer to its own records, so a small header before its body would be a record of its own. Parts of a
+     *   record that are in many buffers are copied together and the record that is in one buffer is written
+     *   straight from it.
+     */
+    class Tls_record_writer
+    {
+    public:
+        // Buffers have to stay alive until the write has finished
+        void start(std::span<const asio::const_buffer> buffers) noexcept
+        {
+            m_buffers = buffers;
+            m_buffer_index = 0;
+            m_buffer_offset = 0;
+            m_remaining = asio::buffer_size(buffers);
+            m_sizer.start_write();
+        }
+
+        // @return the next record, empty when everything has been written
+        [[nodiscard]] asio::const_buffer next_record()
+        {
+            const size_t record_size = m_sizer.get_record_size(m_remaining);
+            skip_empty_buffers();
+
+            if (record_size == 0)
+                return asio::const_buffer();
+
+            m_remaining -= record_size;
+            m_sizer.add_written(record_size);
+
+            const asio::const_buffer& buffer = m_buffers[m_buffer_index];
+            const char* data = static_cast<const char*>(buffer.data()) + m_buffer_offset;
+
+            if (buffer.size() - m_buffer_offset >= record_size)
+            {
+                m_buffer_offset += record_size;
+                return asio::buffer(data, record_size);
+            }
+
+            m_gathered.resize(record_size);
+
+            for (size_t gathered = 0; gathered < record_size;)
+            {
+                skip_empty_buffers();
+
+                const asio::const_buffer& part = m_buffers[m_buffer_index];
+                const size_t part_size = std::min(part.size() - m_buffer_offset, record_size - gathered);
+
+                std::memcpy(
+                    m_gathered.data() + gathered, static_cast<const char*>(part.data()) + m_buffer_offset, part_size);
+
+                gathered += part_size;
+                m_buffer_offset += part_size;
+            }
+
+            return asio::buffer(m_gathered);
+        }
+
+        // Full records of a bulk write would otherwise keep their copy while the connection is idle
+        void finish() noexcept
+        {
+            m_buffers = {};
+            m_sizer.finish_write();
+
+            if (m_gathered.capacity() > Tls_record_sizer::SMALL_RECORD_SIZE)
+                std::vector<char>().swap(m_gathered);
+        }
+
+    private:
+        void skip_empty_buffers() noexcept
+        {
+            while (m_buffer_index < m_buffers.size() && m_buffer_offset == m_buffers[m_buffer_index].size())
+            {
+                ++m_buffer_index;
+                m_buffer_offset = 0;
+            }
+        }
+
+        Tls_record_sizer m_sizer;
+        std::span<const asio::const_buffer> m_buffers;
+        size_t m_buffer_index = 0;
+        size_t m_buffer_offset = 0;
+        size_t m_remaining = 0;
+        std::vector<char> m_gathered;
+    };
+} // namespace Net
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <string>
+
+namespace Net
+{
+    struct Tls_session_settings
+    {
+        // Disables both the session tickets and the session cache
+        bool m_is_enabled = true;
+
+        // How long a session can be resumed after the full handshake
+        std::chrono::seconds m_lifetime = std::chrono::hours(2);
+
+        // How often a new ticket key is made, old keys are kept until their tickets have expired
+        std::chrono::seconds m_ticket_key_rotation = std::chrono::hours(1);
+
+        // Sessions kept on the server for the clients that don't support tickets
+        size_t m_cache_size = 20 * 1024;
+    };
+
+    struct Tls_handshake_counters
+    {
+        uint64_t m_full_handshakes = 0;
+        uint64_t m_resumed_handshakes = 0;
+    };
+
+    /**
+     *   Session resumption state of one ssl context. It is owned by the context so it stays alive as long as
+     *   any connection uses the context. Server side rotates the ticket keys and the client side keeps the
+     *   last session so the next connection to the same server can skip the full handshake.
+     */
+    class Tls_session_state
+    {
+    public:
+        Tls_session_state(const Tls_session_state&) = delete;
+        Tls_session_state(Tls_session_state&&) = delete;
+
+        ~Tls_session_state()
+        {
+            if (m_client_session != nullptr)
+                SSL_SESSION_free(m_client_session);
+        }
+
+        Tls_session_state& operator=(const Tls_session_state&) = delete;
+        Tls_session_state& operator=(Tls_session_state&&) = delete;
+
+        // @return the state of the context, it is created on the first call
+        [[nodiscard]] static Tls_session_state& attach(SSL_CTX* context)
+        {
+            Tls_session_state* state = find(context);
+
+            if (state == nullptr)
+            {
+                state = new Tls_session_state();
+                SSL_CTX_set_ex_data(context, ex_data_index(), state);
+            }
+
+            return *state;
+        }
+
+        // Counts the finished handshake to the state of the context if it has one
+        static void on_handshake_finished(SSL* ssl) noexcept
+        {
+            Tls_session_state* state = find(SSL_get_SSL_CTX(ssl));
+
+            if (state == nullptr)
+                return;
+
+            if (SSL_session_reused(ssl) != 0)
+                state->m_resumed_handshakes.fetch_add(1, std::memory_order_relaxed);
+            else
+                state->m_full_handshakes.fetch_add(1, std::memory_order_relaxed);
+
+            // Tls 1.2 session is known at the end of the handshake, the tls 1.3 tickets come after it
+            if (SSL_is_server(ssl) == 0 && SSL_version(ssl) < TLS1_3_VERSION &&
+                state->m_is_client_reuse_enabled.load(std::memory_order_relaxed))
+                state->save_client_session(SSL_get1_session(ssl));
+        }
+
+        [[nodiscard]] Tls_handshake_counters get_handshake_counters() const noexcept
+        {
+            return {
+                .m_full_handshakes = m_full_handshakes.load(std::memory_order_relaxed),
+                .m_resumed_handshakes = m_resumed_handshakes.load(std::memory_order_relaxed)};
+        }
+
+        // Sets how the server context resumes sessions, the current ticket keys are dropped
+        void configure_server(SSL_CTX* context, const Tls_session_settings& settings)
+        {
+            {
+                std::scoped_lock lock(m_mutex);
+                m_settings = settings;
+                m_ticket_keys.clear();
+            }
+
+            // Sessions are only resumed by the same server
+            static constexpr unsigned char SESSION_ID_CONTEXT[] = "Net::Ssl_server";
+            SSL_CTX_set_session_id_context(context, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+
+            if (!settings.m_is_enabled)
+            {
+                SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+                SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+                SSL_CTX_set_num_tickets(context, 0);
+                return;
+            }
+
+            SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(context, static_cast<long>(settings.m_cache_size));
+            SSL_CTX_set_timeout(context, static_cast<long>(settings.m_lifetime.count()));
+            SSL_CTX_clear_options(context, SSL_OP_NO_TICKET);
+            SSL_CTX_set_num_tickets(context, 2);
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(context, &Tls_session_state::on_ticket_key);
+        }
+
+        // Makes the client context keep the sessions the server gives so they can be reused
+        void configure_client(SSL_CTX* context, bool is_enabled)
+        {
+            m_is_client_reuse_enabled.store(is_enabled, std::memory_order_relaxed);
+
+            if (!is_enabled)
+            {
+                SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+                clear_client_session();
+                return;
+            }
+
+            // Sessions are stored here instead of the internal cache because only the newest one is needed
+            SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(context, &Tls_session_state::on_new_client_session);
+        }
+
+        /**
+         *   Offers the saved session if the last one came from the same server
+         *
+         *   @param the ssl object before the handshake
+         *   @param the address of the server
+         */
+        void prepare_client(SSL* ssl, const std::string& server)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (server != m_client_session_server && m_client_session != nullptr)
+            {
+                SSL_SESSION_free(m_client_session);
+                m_client_session = nullptr;
+            }
+
+            m_client_session_server = server;
+
+            if (m_client_session != nullptr && SSL_SESSION_is_resumable(m_client_session) != 0)
+                SSL_set_session(ssl, m_client_session);
+        }
+
+        void clear_client_session()
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (m_client_session != nullptr)
+                SSL_SESSION_free(m_client_session);
+
+            m_client_session = nullptr;
+        }
+
+    private:
+        static constexpr size_t KEY_NAME_SIZE = 16;
+        static constexpr size_t KEY_SIZE = 32;
+
+        struct Ticket_key
+        {
+            std::array<unsigned char, KEY_NAME_SIZE> m_name;
+            std::array<unsigned char, KEY_SIZE> m_cipher_key;
+            std::array<unsigned char, KEY_SIZE> m_mac_key;
+            std::chrono::steady_clock::time_point m_created;
+        };
+
+        Tls_session_state() = default;
+
+        [[nodiscard]] static int ex_data_index()
+        {
+            static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, &free_state);
+            return index;
+        }
+
+        [[nodiscard]] static Tls_session_state* find(SSL_CTX* context) noexcept
+        {
+            return static_cast<Tls_session_state*>(SSL_CTX_get_ex_data(context, ex_data_index()));
+        }
+
+        static void free_state(
+            [[maybe_unused]] void* parent, void* state, [[maybe_unused]] CRYPTO_EX_DATA* data,
+            [[maybe_unused]] int index, [[maybe_unused]] long argl, [[maybe_unused]] void* argp)
+        {
+            delete static_cast<Tls_session_state*>(state);
+        }
+
+        // Takes the ownership of the session by returning 1
+        static int on_new_client_session(SSL* ssl, SSL_SESSION* session)
+        {
+            Tls_session_state* state = find(SSL_get_SSL_CTX(ssl));
+
+            if (state == nullptr || !state->m_is_client_reuse_enabled.load(std::memory_order_relaxed))
+                return 0;
+
+            state->save_client_session(session);
+            return 1;
+        }
+
+        // Takes the ownership of the session
+        void save_client_session(SSL_SESSION* session) noexcept
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (m_client_session != nullptr)
+                SSL_SESSION_free(m_client_session);
+
+            m_client_session = session;
+        }
+
+        /**
+         *   Encrypts the new tickets with the newest key and decrypts the received tickets with any key that is
+         *   not expired. Resumed connections always get a new ticket because clients use each tls 1.3 ticket only
+         *   once and the tickets of the old keys would expire with the key.
+         */
+        static int on_ticket_key(
+            SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac,
+            int encrypt)
+        {
+            Tls_session_state* state = find(SSL_get_SSL_CTX(ssl));
+
+            if (state == nullptr)
+                return -1;
+
+            std::scoped_lock lock(state->m_mutex);
+
+            if (!state->rotate_ticket_keys())
+                return -1;
+
+            if (encrypt != 0)
+            {
+                const Ticket_key& key = state->m_ticket_keys.front();
+
+                if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+                    return -1;
+
+                std::memcpy(key_name, key.m_name.data(), KEY_NAME_SIZE);
+
+                if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.m_cipher_key.data(), iv) != 1)
+                    return -1;
+
+                return set_mac_key(mac, key) ? 1 : -1;
+            }
+
+            for (const Ticket_key& key : state->m_ticket_keys)
+            {
+                if (std::memcmp(key_name, key.m_name.data(), KEY_NAME_SIZE) != 0)
+                    continue;
+
+                if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.m_cipher_key.data(), iv) != 1)
+                    return -1;
+
+                if (!set_mac_key(mac, key))
+                    return -1;
+
+                // Returning 2 makes OpenSSL send a new ticket
+                return 2;
+            }
+
+            // Unknown or expired key makes a full handshake
+            return 0;
+        }
+
+        [[nodiscard]] static bool set_mac_key(EVP_MAC_CTX* mac, const Ticket_key& key)
+        {
+            char digest[] = "SHA256";
+
+            const OSSL_PARAM parameters[] = {
+                OSSL_PARAM_construct_octet_string(
+                    OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key.m_mac_key.data()), key.m_mac_key.size()),
+                OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0), OSSL_PARAM_construct_end()};
+
+            return EVP_MAC_CTX_set_params(mac, parameters) == 1;
+        }
+
+        // Newest key is at the front, called with the mutex locked
+        [[nodiscard]] bool rotate_ticket_keys()
+        {
+            const auto now = std::chrono::steady_clock::now();
+
+            if (m_ticket_keys.empty() || now - m_ticket_keys.front().m_created >= m_settings.m_ticket_key_rotation)
+            {
+                Ticket_key key;
+                key.m_created = now;
+
+                if (RAND_bytes(key.m_name.data(), KEY_NAME_SIZE) != 1 ||
+                    RAND_bytes(key.m_cipher_key.data(), KEY_SIZE) != 1 ||
+                    RAND_bytes(key.m_mac_key.data(), KEY_SIZE) != 1)
+                    return false;
+
+                m_ticket_keys.push_front(key);
+            }
+
+            // A key can decrypt tickets until the last ticket it encrypted has expired
+            while (m_ticket_keys.size() > 1 &&
+                   now - m_ticket_keys.back().m_created >= m_settings.m_lifetime + m_settings.m_ticket_key_rotation)
+                m_ticket_keys.pop_back();
+
+            return true;
+        }
+
+        std::atomic<uint64_t> m_full_handshakes = 0;
+        std::atomic<uint64_t> m_resumed_handshakes = 0;
+
+        std::mutex m_mutex;
+        Tls_session_settings m_settings;
+        std::deque<Ticket_key> m_ticket_keys;
+
+        std::atomic<bool> m_is_client_reuse_enabled = false;
+        SSL_SESSION* m_client_session = nullptr;
+        std::string m_client_session_server;
+    };
+} // namespace Net
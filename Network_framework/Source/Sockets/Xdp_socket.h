@@ -0,0 +1,864 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "../Utility/Common.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <memory>
+#include <mutex>
+#include <net/if.h>
+#include <span>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#if defined(AF_XDP) && defined(XDP_USE_NEED_WAKEUP) && defined(SYS_bpf) && defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+#define NET_HAS_AF_XDP
+#endif
+#endif
+
+namespace Net
+{
+    // Interface and the queues that the AF_XDP of the datagram channel is bound to, see the Xdp_socket
+    struct Xdp_settings
+    {
+        // Name of the network interface, for example eth0
+        std::string m_interface;
+
+        // Receive queues of the interface, datagrams that the nic hashes to the other queues go to the udp socket
+        std::vector<uint32_t> m_queues = {0};
+
+        // Frames of the umem of each queue, half for the receives and half for the sends. Power of two.
+        uint32_t m_frame_count = 4096;
+
+        // Fails instead of copying the frames if the driver has no zero copy
+        bool m_require_zero_copy = false;
+    };
+
+#ifdef NET_HAS_AF_XDP
+    /**
+     *   Receives and sends the udp datagrams of one port through the AF_XDP sockets of linux, so the frames
+     *   skip the network stack of the kernel. An xdp program on the interface redirects the ipv4 and ipv6
+     *   datagrams of the port from the bound queues to the sockets and passes the rest to the kernel, so the
+     *   fragments, the ip options and the vlan tags still go the normal way. Every queue has its own umem whose
+     *   frames the kernel and the nic fill without copying them through a socket buffer.
+     *
+     *   Sends go out of the queue that last received from the peer, with the mac addresses of that frame
+     *   swapped, so a peer behind a router is answered through the same router. Peers that have not been heard
+     *   through the AF_XDP are not known and their sends are left to the udp socket. Needs the CAP_NET_ADMIN
+     *   and the CAP_BPF or root, and the program stays on the interface only while this is open.
+     */
+    class Xdp_socket
+    {
+    public:
+        // Size of a umem frame, the largest frame that can be received or sent
+        static constexpr uint32_t FRAME_SIZE = 4096;
+
+        // Peers are forgotten all at once when there are this many, spoofed senders could fill it otherwise
+        static constexpr size_t MAX_PEERS = 65536;
+
+        explicit Xdp_socket(const asio::any_io_executor& executor) : m_executor(executor)
+        {
+        }
+
+        Xdp_socket(const Xdp_socket&) = delete;
+        Xdp_socket(Xdp_socket&&) = delete;
+        Xdp_socket& operator=(const Xdp_socket&) = delete;
+        Xdp_socket& operator=(Xdp_socket&&) = delete;
+
+        ~Xdp_socket()
+        {
+            close();
+        }
+
+        /**
+         *   Binds the sockets to the queues, attaches the program and starts receiving
+         *
+         *   @param the interface and the queues
+         *   @param the udp port whose datagrams are redirected
+         *   @return the error if something could not be set up, nothing is left open then
+         */
+        [[nodiscard]] asio::error_code open(const Xdp_settings& settings, uint16_t port)
+        {
+            const uint32_t frame_count = settings.m_frame_count;
+
+            if (settings.m_queues.empty() || frame_count < 2 || (frame_count & (frame_count - 1)) != 0)
+                return asio::error::invalid_argument;
+
+            const unsigned int interface_index = if_nametoindex(settings.m_interface.c_str());
+
+            if (interface_index == 0)
+                return get_last_error();
+
+            m_port = port;
+
+            const uint32_t max_queue = *std::max_element(settings.m_queues.begin(), settings.m_queues.end());
+            asio::error_code error = create_socket_map(max_queue + 1);
+
+            for (size_t i = 0; !error && i < settings.m_queues.size(); ++i)
+            {
+                m_queues.push_back(std::make_unique<Queue>(m_executor));
+                error = open_queue(*m_queues.back(), settings, interface_index, settings.m_queues[i]);
+            }
+
+            if (!error)
+                error = attach_program(interface_index);
+
+            if (error)
+            {
+                close();
+                return error;
+            }
+
+            for (size_t i = 0; i < m_queues.size(); ++i)
+                wait_receive(i);
+
+            return {};
+        }
+
+        // Detaches the program, the pending receives end with operation_aborted
+        void close()
+        {
+            m_link.reset();
+            m_program.reset();
+
+            for (const std::unique_ptr<Queue>& queue : m_queues)
+            {
+                std::lock_guard lock(queue->m_send_mutex);
+                asio::error_code ignored_error;
+                queue->m_descriptor.close(ignored_error);
+            }
+
+            m_socket_map.reset();
+        }
+
+        /**
+         *   Sends the datagram from any thread
+         *
+         *   @param the receiver
+         *   @param the udp payload
+         *   @return false if the udp socket has to send it, the peer is not known or the frames are all in use
+         */
+        bool send(const Datagram_protocol::endpoint& receiver, std::span<const asio::const_buffer> buffers)
+        {
+            // Udp socket of the ipv6 gives the ipv4 peers as mapped addresses, the frames have the ipv4 ones
+            const Datagram_protocol::endpoint endpoint =
+                receiver.address().is_v6() && receiver.address().to_v6().is_v4_mapped()
+                    ? Datagram_protocol::endpoint(
+                          asio::ip::make_address_v4(asio::ip::v4_mapped, receiver.address().to_v6()), receiver.port())
+                    : receiver;
+
+            Peer peer;
+            {
+                std::lock_guard lock(m_peers_mutex);
+                const auto found_peer = m_peers.find(endpoint);
+
+                if (found_peer == m_peers.end())
+                    return false;
+
+                peer = found_peer->second;
+            }
+
+            const bool is_v4 = endpoint.address().is_v4();
+            const size_t ip_header_size = is_v4 ? IPV4_HEADER_SIZE : IPV6_HEADER_SIZE;
+            const size_t payload_size = asio::buffer_size(buffers);
+            const size_t frame_size = ETH_HLEN + ip_header_size + UDP_HEADER_SIZE + payload_size;
+
+            if (frame_size > FRAME_SIZE || peer.m_local_address.is_v4() != is_v4)
+                return false;
+
+            Queue& queue = *m_queues[peer.m_queue_index];
+            std::lock_guard lock(queue.m_send_mutex);
+
+            if (!queue.m_descriptor.is_open())
+                return false;
+
+            queue.reclaim_sent_frames();
+
+            if (queue.m_free_frames.empty())
+                return false;
+
+            const uint64_t address = queue.m_free_frames.back();
+            queue.m_free_frames.pop_back();
+
+            uint8_t* const frame = queue.get_frame(address);
+            uint8_t* const payload = frame + ETH_HLEN + ip_header_size + UDP_HEADER_SIZE;
+            asio::buffer_copy(asio::buffer(payload, payload_size), buffers);
+
+            write_headers(frame, peer, endpoint, payload_size);
+
+            const uint32_t producer = queue.m_send.m_cached_producer++;
+            queue.m_send.m_entries[producer & queue.m_send.m_mask] = {
+                .addr = address, .len = static_cast<uint32_t>(frame_size), .options = 0};
+            queue.m_send.store_producer(queue.m_send.m_cached_producer);
+
+            // Copy mode and the drivers that sleep send only after a kick
+            if (queue.m_send.needs_wakeup())
+                sendto(queue.m_descriptor.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+
+            return true;
+        }
+
+        // Called from the executor with the udp payload of a received datagram and its sender
+        Delegate<std::span<const char>, const Datagram_protocol::endpoint&> m_on_datagram;
+
+    private:
+        static constexpr size_t IPV4_HEADER_SIZE = 20;
+        static constexpr size_t IPV6_HEADER_SIZE = 40;
+        static constexpr size_t UDP_HEADER_SIZE = 8;
+        static constexpr uint8_t UDP_PROTOCOL = 17;
+        static constexpr uint8_t TIME_TO_LIVE = 64;
+
+        // Closes the descriptor of the map, the program or the link, closing the link detaches the program
+        class Owned_descriptor
+        {
+        public:
+            Owned_descriptor() = default;
+
+            explicit Owned_descriptor(int descriptor) noexcept : m_descriptor(descriptor)
+            {
+            }
+
+            Owned_descriptor(const Owned_descriptor&) = delete;
+            Owned_descriptor& operator=(const Owned_descriptor&) = delete;
+
+            Owned_descriptor(Owned_descriptor&& other) noexcept : m_descriptor(std::exchange(other.m_descriptor, -1))
+            {
+            }
+
+            Owned_descriptor& operator=(Owned_descriptor&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset();
+                    m_descriptor = std::exchange(other.m_descriptor, -1);
+                }
+
+                return *this;
+            }
+
+            ~Owned_descriptor()
+            {
+                reset();
+            }
+
+            void reset() noexcept
+            {
+                if (m_descriptor >= 0)
+                    ::close(std::exchange(m_descriptor, -1));
+            }
+
+            [[nodiscard]] int get() const noexcept
+            {
+                return m_descriptor;
+            }
+
+        private:
+            int m_descriptor = -1;
+        };
+
+        /**
+         *   Ring that is shared with the kernel, one side moves the producer and the other the consumer. The
+         *   cached values are the own side of this process, the other side is loaded with acquire.
+         */
+        template <typename Entry>
+        struct Ring
+        {
+            [[nodiscard]] uint32_t load_producer() const noexcept
+            {
+                return std::atomic_ref<uint32_t>(*m_producer).load(std::memory_order_acquire);
+            }
+
+            [[nodiscard]] uint32_t load_consumer() const noexcept
+            {
+                return std::atomic_ref<uint32_t>(*m_consumer).load(std::memory_order_acquire);
+            }
+
+            void store_producer(uint32_t producer) noexcept
+            {
+                std::atomic_ref<uint32_t>(*m_producer).store(producer, std::memory_order_release);
+            }
+
+            void store_consumer(uint32_t consumer) noexcept
+            {
+                std::atomic_ref<uint32_t>(*m_consumer).store(consumer, std::memory_order_release);
+            }
+
+            [[nodiscard]] bool needs_wakeup() const noexcept
+            {
+                const uint32_t flags = std::atomic_ref<uint32_t>(*m_flags).load(std::memory_order_relaxed);
+                return (flags & XDP_RING_NEED_WAKEUP) != 0;
+            }
+
+            uint32_t* m_producer = nullptr;
+            uint32_t* m_consumer = nullptr;
+            uint32_t* m_flags = nullptr;
+            Entry* m_entries = nullptr;
+            uint32_t m_mask = 0;
+            uint32_t m_cached_producer = 0;
+            uint32_t m_cached_consumer = 0;
+        };
+
+        // Memory mapped from the kernel or the anonymous memory of the umem
+        struct Mapping
+        {
+            Mapping() = default;
+            Mapping(const Mapping&) = delete;
+            Mapping& operator=(const Mapping&) = delete;
+
+            ~Mapping()
+            {
+                if (m_data != MAP_FAILED)
+                    munmap(m_data, m_size);
+            }
+
+            void* m_data = MAP_FAILED;
+            size_t m_size = 0;
+        };
+
+        // Socket bound to one queue of the interface with its umem and rings
+        struct Queue
+        {
+            explicit Queue(const asio::any_io_executor& executor) : m_descriptor(executor)
+            {
+            }
+
+            [[nodiscard]] uint8_t* get_frame(uint64_t address) const noexcept
+            {
+                return static_cast<uint8_t*>(m_umem.m_data) + address;
+            }
+
+            // Frames whose sends have completed can be used again, this is called with the send mutex locked
+            void reclaim_sent_frames()
+            {
+                const uint32_t producer = m_completion.load_producer();
+
+                for (; m_completion.m_cached_consumer != producer; ++m_completion.m_cached_consumer)
+                    m_free_frames.push_back(
+                        m_completion.m_entries[m_completion.m_cached_consumer & m_completion.m_mask]);
+
+                m_completion.store_consumer(m_completion.m_cached_consumer);
+            }
+
+            Mapping m_umem;
+            Mapping m_fill_map;
+            Mapping m_completion_map;
+            Mapping m_receive_map;
+            Mapping m_send_map;
+
+            Ring<uint64_t> m_fill;
+            Ring<uint64_t> m_completion;
+            Ring<xdp_desc> m_receive;
+            Ring<xdp_desc> m_send;
+
+            // Guards the send ring, the completion ring and the free frames
+            std::mutex m_send_mutex;
+            std::vector<uint64_t> m_free_frames;
+
+            // Destroyed first so the kernel has let go of the rings before they are unmapped
+            asio::posix::stream_descriptor m_descriptor;
+        };
+
+        // How the peer was last heard, the answers are sent back the same way
+        struct Peer
+        {
+            std::array<uint8_t, ETH_ALEN> m_peer_mac = {};
+            std::array<uint8_t, ETH_ALEN> m_local_mac = {};
+            asio::ip::address m_local_address;
+            size_t m_queue_index = 0;
+        };
+
+        [[nodiscard]] static asio::error_code get_last_error() noexcept
+        {
+            return asio::error_code(errno, asio::error::get_system_category());
+        }
+
+        [[nodiscard]] static int call_bpf(bpf_cmd command, bpf_attr& attributes) noexcept
+        {
+            return static_cast<int>(syscall(SYS_bpf, command, &attributes, sizeof(attributes)));
+        }
+
+        // Xdp program finds the socket of the queue from the map
+        [[nodiscard]] asio::error_code create_socket_map(uint32_t entry_count)
+        {
+            bpf_attr attributes = {};
+            attributes.map_type = BPF_MAP_TYPE_XSKMAP;
+            attributes.key_size = sizeof(uint32_t);
+            attributes.value_size = sizeof(uint32_t);
+            attributes.max_entries = entry_count;
+
+            m_socket_map = Owned_descriptor(call_bpf(BPF_MAP_CREATE, attributes));
+            return m_socket_map.get() < 0 ? get_last_error() : asio::error_code();
+        }
+
+        [[nodiscard]] asio::error_code open_queue(
+            Queue& queue, const Xdp_settings& settings, unsigned int interface_index, uint32_t queue_id)
+        {
+            const int descriptor = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+
+            if (descriptor < 0)
+                return get_last_error();
+
+            asio::error_code error;
+            queue.m_descriptor.assign(descriptor, error);
+
+            if (error)
+            {
+                ::close(descriptor);
+                return error;
+            }
+
+            const uint32_t frame_count = settings.m_frame_count;
+            const uint32_t ring_size = frame_count / 2;
+
+            queue.m_umem.m_size = static_cast<size_t>(frame_count) * FRAME_SIZE;
+            queue.m_umem.m_data =
+                mmap(nullptr, queue.m_umem.m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (queue.m_umem.m_data == MAP_FAILED)
+                return get_last_error();
+
+            xdp_umem_reg umem = {};
+            umem.addr = reinterpret_cast<uint64_t>(queue.m_umem.m_data);
+            umem.len = queue.m_umem.m_size;
+            umem.chunk_size = FRAME_SIZE;
+
+            if (setsockopt(descriptor, SOL_XDP, XDP_UMEM_REG, &umem, sizeof(umem)) != 0 ||
+                setsockopt(descriptor, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) != 0 ||
+                setsockopt(descriptor, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) != 0 ||
+                setsockopt(descriptor, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) != 0 ||
+                setsockopt(descriptor, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) != 0)
+                return get_last_error();
+
+            xdp_mmap_offsets offsets = {};
+            socklen_t offsets_size = sizeof(offsets);
+
+            if (getsockopt(descriptor, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_size) != 0)
+                return get_last_error();
+
+            if ((error = map_ring(queue.m_fill, queue.m_fill_map, descriptor, offsets.fr, ring_size,
+                     XDP_UMEM_PGOFF_FILL_RING)) ||
+                (error = map_ring(queue.m_completion, queue.m_completion_map, descriptor, offsets.cr, ring_size,
+                     XDP_UMEM_PGOFF_COMPLETION_RING)) ||
+                (error = map_ring(queue.m_receive, queue.m_receive_map, descriptor, offsets.rx, ring_size,
+                     XDP_PGOFF_RX_RING)) ||
+                (error = map_ring(queue.m_send, queue.m_send_map, descriptor, offsets.tx, ring_size,
+                     XDP_PGOFF_TX_RING)))
+                return error;
+
+            // First half of the frames waits for the receives and the second half for the sends
+            for (uint32_t i = 0; i < ring_size; ++i)
+                queue.m_fill.m_entries[i] = static_cast<uint64_t>(i) * FRAME_SIZE;
+
+            queue.m_fill.m_cached_producer = ring_size;
+            queue.m_fill.store_producer(ring_size);
+
+            queue.m_free_frames.reserve(ring_size);
+
+            for (uint32_t i = ring_size; i < frame_count; ++i)
+                queue.m_free_frames.push_back(static_cast<uint64_t>(i) * FRAME_SIZE);
+
+            sockaddr_xdp address = {};
+            address.sxdp_family = AF_XDP;
+            address.sxdp_ifindex = interface_index;
+            address.sxdp_queue_id = queue_id;
+            address.sxdp_flags = XDP_USE_NEED_WAKEUP | (settings.m_require_zero_copy ? XDP_ZEROCOPY : 0);
+
+            if (bind(descriptor, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+                return get_last_error();
+
+            bpf_attr attributes = {};
+            attributes.map_fd = static_cast<uint32_t>(m_socket_map.get());
+            attributes.key = reinterpret_cast<uint64_t>(&queue_id);
+            attributes.value = reinterpret_cast<uint64_t>(&descriptor);
+
+            if (call_bpf(BPF_MAP_UPDATE_ELEM, attributes) != 0)
+                return get_last_error();
+
+            return {};
+        }
+
+        template <typename Entry>
+        [[nodiscard]] static asio::error_code map_ring(
+            Ring<Entry>& ring, Mapping& mapping, int descriptor, const xdp_ring_offset& offsets, uint32_t size,
+            off_t page_offset)
+        {
+            mapping.m_size = offsets.desc + size * sizeof(Entry);
+            mapping.m_data = mmap(
+                nullptr, mapping.m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, descriptor, page_offset);
+
+            if (mapping.m_data == MAP_FAILED)
+                return get_last_error();
+
+            char* const data = static_cast<char*>(mapping.m_data);
+            ring.m_producer = reinterpret_cast<uint32_t*>(data + offsets.producer);
+            ring.m_consumer = reinterpret_cast<uint32_t*>(data + offsets.consumer);
+            ring.m_flags = reinterpret_cast<uint32_t*>(data + offsets.flags);
+            ring.m_entries = reinterpret_cast<Entry*>(data + offsets.desc);
+            ring.m_mask = size - 1;
+            ring.m_cached_producer = ring.load_producer();
+            ring.m_cached_consumer = ring.load_consumer();
+            return {};
+        }
+
+        /**
+         *   Loads the program that redirects the datagrams of the port and links it to the interface, the
+         *   driver runs it natively if it can and the kernel runs it before the network stack otherwise
+         */
+        [[nodiscard]] asio::error_code attach_program(unsigned int interface_index)
+        {
+            const std::vector<bpf_insn> instructions = create_instructions();
+            static constexpr char LICENSE[] = "GPL";
+
+            bpf_attr attributes = {};
+            attributes.prog_type = BPF_PROG_TYPE_XDP;
+            attributes.insns = reinterpret_cast<uint64_t>(instructions.data());
+            attributes.insn_cnt = static_cast<uint32_t>(instructions.size());
+            attributes.license = reinterpret_cast<uint64_t>(LICENSE);
+
+            m_program = Owned_descriptor(call_bpf(BPF_PROG_LOAD, attributes));
+
+            if (m_program.get() < 0)
+                return get_last_error();
+
+            attributes = {};
+            attributes.link_create.prog_fd = static_cast<uint32_t>(m_program.get());
+            attributes.link_create.target_ifindex = interface_index;
+            attributes.link_create.attach_type = BPF_XDP;
+
+            m_link = Owned_descriptor(call_bpf(BPF_LINK_CREATE, attributes));
+            return m_link.get() < 0 ? get_last_error() : asio::error_code();
+        }
+
+        /**
+         *   Program passes everything but the udp datagrams to the port in the untagged ipv4 frames without
+         *   options or fragments and the ipv6 frames without extension headers. Redirect passes the datagram too
+         *   if the queue has no socket in the map. The byte order of the loads is the host order, so the
+         *   constants are compared in the network order.
+         */
+        [[nodiscard]] std::vector<bpf_insn> create_instructions() const
+        {
+            enum Register : uint8_t
+            {
+                r0,
+                r1,
+                r2,
+                r3,
+                r4,
+                r5,
+                r6
+            };
+
+            const auto instruction = [](uint8_t code, uint8_t destination, uint8_t source, int16_t offset,
+                                        int32_t immediate) {
+                bpf_insn result = {};
+                result.code = code;
+                result.dst_reg = destination & 0xf;
+                result.src_reg = source & 0xf;
+                result.off = offset;
+                result.imm = immediate;
+                return result;
+            };
+
+            std::vector<bpf_insn> program;
+            std::vector<size_t> pass_jumps;
+            size_t redirect_jump = 0;
+
+            const auto load = [&](uint8_t size, uint8_t destination, uint8_t source, int16_t offset) {
+                program.push_back(instruction(BPF_LDX | BPF_MEM | size, destination, source, offset, 0));
+            };
+
+            const auto jump_to_pass = [&](uint8_t code, uint8_t destination, uint8_t source, int32_t immediate) {
+                pass_jumps.push_back(program.size());
+                program.push_back(instruction(BPF_JMP | code, destination, source, 0, immediate));
+            };
+
+            // Jumps to the pass unless the frame has atleast the bytes
+            const auto check_length = [&](int32_t length) {
+                program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_X, r4, r2, 0, 0));
+                program.push_back(instruction(BPF_ALU64 | BPF_ADD | BPF_K, r4, 0, 0, length));
+                jump_to_pass(BPF_JGT | BPF_X, r4, r3, 0);
+            };
+
+            const int32_t port = htons(m_port);
+            constexpr int16_t ip_offset = ETH_HLEN;
+
+            program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_X, r6, r1, 0, 0));
+            load(BPF_W, r2, r1, offsetof(xdp_md, data));
+            load(BPF_W, r3, r1, offsetof(xdp_md, data_end));
+            check_length(ETH_HLEN);
+            load(BPF_H, r5, r2, offsetof(ethhdr, h_proto));
+            program.push_back(instruction(BPF_JMP | BPF_JEQ | BPF_K, r5, 0, 1, htons(ETH_P_IP)));
+            const size_t v6_jump = program.size();
+            program.push_back(instruction(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+
+            // Version 4 with the header of five words, no more fragments and no fragment offset
+            check_length(ETH_HLEN + IPV4_HEADER_SIZE + UDP_HEADER_SIZE);
+            load(BPF_B, r5, r2, ip_offset);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, 0x45);
+            load(BPF_H, r5, r2, ip_offset + 6);
+            program.push_back(instruction(BPF_ALU64 | BPF_AND | BPF_K, r5, 0, 0, htons(0x3fff)));
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, 0);
+            load(BPF_B, r5, r2, ip_offset + 9);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, UDP_PROTOCOL);
+            load(BPF_H, r5, r2, ip_offset + IPV4_HEADER_SIZE + 2);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, port);
+            redirect_jump = program.size();
+            program.push_back(instruction(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+
+            program[v6_jump].off = static_cast<int16_t>(program.size() - v6_jump - 1);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, htons(ETH_P_IPV6));
+            check_length(ETH_HLEN + IPV6_HEADER_SIZE + UDP_HEADER_SIZE);
+            load(BPF_B, r5, r2, ip_offset + 6);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, UDP_PROTOCOL);
+            load(BPF_H, r5, r2, ip_offset + IPV6_HEADER_SIZE + 2);
+            jump_to_pass(BPF_JNE | BPF_K, r5, 0, port);
+
+            program[redirect_jump].off = static_cast<int16_t>(program.size() - redirect_jump - 1);
+            load(BPF_W, r2, r6, offsetof(xdp_md, rx_queue_index));
+            program.push_back(instruction(BPF_LD | BPF_DW | BPF_IMM, r1, BPF_PSEUDO_MAP_FD, 0, m_socket_map.get()));
+            program.push_back(instruction(0, 0, 0, 0, 0));
+            program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, r3, 0, 0, XDP_PASS));
+            program.push_back(instruction(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+            program.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+            for (const size_t jump : pass_jumps)
+                program[jump].off = static_cast<int16_t>(program.size() - jump - 1);
+
+            program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, r0, 0, 0, XDP_PASS));
+            program.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+            return program;
+        }
+
+        void wait_receive(size_t queue_index)
+        {
+            m_queues[queue_index]->m_descriptor.async_wait(
+                asio::posix::stream_descriptor::wait_read, [this, queue_index](asio::error_code error) {
+                    // Socket may have been destroyed when the wait was aborted
+                    if (error)
+                        return;
+
+                    receive_frames(queue_index);
+                    wait_receive(queue_index);
+                });
+        }
+
+        // Hands the received frames to the handler and gives them back to the fill ring
+        void receive_frames(size_t queue_index)
+        {
+            Queue& queue = *m_queues[queue_index];
+            Ring<xdp_desc>& receive = queue.m_receive;
+            Ring<uint64_t>& fill = queue.m_fill;
+
+            const uint32_t producer = receive.load_producer();
+
+            for (; receive.m_cached_consumer != producer; ++receive.m_cached_consumer)
+            {
+                const xdp_desc& descriptor = receive.m_entries[receive.m_cached_consumer & receive.m_mask];
+                handle_frame(queue_index, queue.get_frame(descriptor.addr), descriptor.len);
+
+                // Address can point past the headroom, the frame starts at the aligned chunk
+                fill.m_entries[fill.m_cached_producer++ & fill.m_mask] = descriptor.addr & ~uint64_t(FRAME_SIZE - 1);
+            }
+
+            receive.store_consumer(receive.m_cached_consumer);
+            fill.store_producer(fill.m_cached_producer);
+
+            if (fill.needs_wakeup())
+                recvfrom(queue.m_descriptor.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+        }
+
+        // Frames that the program let through are checked again before their payload is used
+        void handle_frame(size_t queue_index, const uint8_t* frame, size_t length)
+        {
+            if (length < ETH_HLEN)
+                return;
+
+            Peer peer;
+            std::memcpy(peer.m_local_mac.data(), frame, ETH_ALEN);
+            std::memcpy(peer.m_peer_mac.data(), frame + ETH_ALEN, ETH_ALEN);
+            peer.m_queue_index = queue_index;
+
+            const uint16_t ether_type = read_u16(frame + offsetof(ethhdr, h_proto));
+            const uint8_t* const ip = frame + ETH_HLEN;
+            asio::ip::address sender_address;
+            size_t udp_offset = 0;
+
+            if (ether_type == ETH_P_IP && length >= ETH_HLEN + IPV4_HEADER_SIZE + UDP_HEADER_SIZE && ip[0] == 0x45 &&
+                ip[9] == UDP_PROTOCOL)
+            {
+                std::array<uint8_t, 4> source = {};
+                std::array<uint8_t, 4> destination = {};
+                std::memcpy(source.data(), ip + 12, source.size());
+                std::memcpy(destination.data(), ip + 16, destination.size());
+
+                sender_address = asio::ip::address_v4(source);
+                peer.m_local_address = asio::ip::address_v4(destination);
+                udp_offset = ETH_HLEN + IPV4_HEADER_SIZE;
+            }
+            else if (ether_type == ETH_P_IPV6 && length >= ETH_HLEN + IPV6_HEADER_SIZE + UDP_HEADER_SIZE &&
+                     ip[6] == UDP_PROTOCOL)
+            {
+                std::array<uint8_t, 16> source = {};
+                std::array<uint8_t, 16> destination = {};
+                std::memcpy(source.data(), ip + 8, source.size());
+                std::memcpy(destination.data(), ip + 24, destination.size());
+
+                sender_address = asio::ip::address_v6(source);
+                peer.m_local_address = asio::ip::address_v6(destination);
+                udp_offset = ETH_HLEN + IPV6_HEADER_SIZE;
+            }
+            else
+                return;
+
+            const uint8_t* const udp = frame + udp_offset;
+            const size_t udp_length = read_u16(udp + 4);
+
+            if (read_u16(udp + 2) != m_port || udp_length < UDP_HEADER_SIZE || udp_offset + udp_length > length)
+                return;
+
+            const Datagram_protocol::endpoint sender(sender_address, read_u16(udp));
+            remember_peer(sender, peer);
+
+            m_on_datagram.broadcast(
+                std::span<const char>(
+                    reinterpret_cast<const char*>(udp + UDP_HEADER_SIZE), udp_length - UDP_HEADER_SIZE),
+                sender);
+        }
+
+        void remember_peer(const Datagram_protocol::endpoint& sender, const Peer& peer)
+        {
+            std::lock_guard lock(m_peers_mutex);
+
+            if (m_peers.size() >= MAX_PEERS && !m_peers.contains(sender))
+                m_peers.clear();
+
+            m_peers[sender] = peer;
+        }
+
+        // Ipv4 datagrams are sent without the udp checksum that is optional for them, ipv6 requires it
+        void write_headers(
+            uint8_t* frame, const Peer& peer, const Datagram_protocol::endpoint& endpoint, size_t payload_size) const
+        {
+            const bool is_v4 = endpoint.address().is_v4();
+            const size_t udp_length = UDP_HEADER_SIZE + payload_size;
+
+            std::memcpy(frame, peer.m_peer_mac.data(), ETH_ALEN);
+            std::memcpy(frame + ETH_ALEN, peer.m_local_mac.data(), ETH_ALEN);
+            write_u16(frame + offsetof(ethhdr, h_proto), is_v4 ? ETH_P_IP : ETH_P_IPV6);
+
+            uint8_t* const ip = frame + ETH_HLEN;
+            uint8_t* udp = nullptr;
+
+            if (is_v4)
+            {
+                const std::array<uint8_t, 4> source = peer.m_local_address.to_v4().to_bytes();
+                const std::array<uint8_t, 4> destination = endpoint.address().to_v4().to_bytes();
+
+                ip[0] = 0x45;
+                ip[1] = 0;
+                write_u16(ip + 2, static_cast<uint16_t>(IPV4_HEADER_SIZE + udp_length));
+                write_u16(ip + 4, 0);
+
+                // Don't fragment, the datagrams are sized for the path
+                write_u16(ip + 6, 0x4000);
+                ip[8] = TIME_TO_LIVE;
+                ip[9] = UDP_PROTOCOL;
+                write_u16(ip + 10, 0);
+                std::memcpy(ip + 12, source.data(), source.size());
+                std::memcpy(ip + 16, destination.data(), destination.size());
+                write_u16(ip + 10, finish_checksum(add_checksum(0, ip, IPV4_HEADER_SIZE)));
+
+                udp = ip + IPV4_HEADER_SIZE;
+            }
+            else
+            {
+                const std::array<uint8_t, 16> source = peer.m_local_address.to_v6().to_bytes();
+                const std::array<uint8_t, 16> destination = endpoint.address().to_v6().to_bytes();
+
+                write_u16(ip, 0x6000);
+                write_u16(ip + 2, 0);
+                write_u16(ip + 4, static_cast<uint16_t>(udp_length));
+                ip[6] = UDP_PROTOCOL;
+                ip[7] = TIME_TO_LIVE;
+                std::memcpy(ip + 8, source.data(), source.size());
+                std::memcpy(ip + 24, destination.data(), destination.size());
+
+                udp = ip + IPV6_HEADER_SIZE;
+            }
+
+            write_u16(udp, m_port);
+            write_u16(udp + 2, endpoint.port());
+            write_u16(udp + 4, static_cast<uint16_t>(udp_length));
+            write_u16(udp + 6, 0);
+
+            if (!is_v4)
+            {
+                // Pseudo header has the addresses, the length and the protocol
+                uint32_t sum = add_checksum(0, ip + 8, 32);
+                sum += static_cast<uint32_t>(udp_length) + UDP_PROTOCOL;
+                const uint16_t checksum = finish_checksum(add_checksum(sum, udp, udp_length));
+
+                // Zero would tell that there is no checksum
+                write_u16(udp + 6, checksum == 0 ? 0xffff : checksum);
+            }
+        }
+
+        [[nodiscard]] static uint16_t read_u16(const uint8_t* data) noexcept
+        {
+            return static_cast<uint16_t>((data[0] << 8) | data[1]);
+        }
+
+        static void write_u16(uint8_t* data, uint16_t value) noexcept
+        {
+            data[0] = static_cast<uint8_t>(value >> 8);
+            data[1] = static_cast<uint8_t>(value);
+        }
+
+        // Sum of the big endian 16 bit words of the internet checksum
+        [[nodiscard]] static uint32_t add_checksum(uint32_t sum, const uint8_t* data, size_t size) noexcept
+        {
+            for (; size > 1; data += 2, size -= 2)
+                sum += read_u16(data);
+
+            if (size != 0)
+                sum += static_cast<uint32_t>(data[0]) << 8;
+
+            return sum;
+        }
+
+        [[nodiscard]] static uint16_t finish_checksum(uint32_t sum) noexcept
+        {
+            while ((sum >> 16) != 0)
+                sum = (sum & 0xffff) + (sum >> 16);
+
+            return static_cast<uint16_t>(~sum);
+        }
+
+        asio::any_io_executor m_executor;
+        uint16_t m_port = 0;
+
+        Owned_descriptor m_socket_map;
+        Owned_descriptor m_program;
+        Owned_descriptor m_link;
+        std::vector<std::unique_ptr<Queue>> m_queues;
+
+        std::mutex m_peers_mutex;
+        std::unordered_map<Datagram_protocol::endpoint, Peer> m_peers;
+    };
+#endif
+} // namespace Net
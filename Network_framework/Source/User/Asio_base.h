@@ -1,70 +1,645 @@
 #pragma once
 
+#include "../Message/Message_memory.h"
+#include "../Sockets/Registered_receive_buffers.h"
+#include "../Sockets/Rio_socket.h"
+#include "../Sockets/Socket_options.h"
 #include "../Utility/Common.h"
+#include "../Utility/Lag_monitor.h"
+#include "../Utility/Thread_affinity.h"
+#include "../Utility/Timer_wheel.h"
+#include "../Utility/Work_counted_executor.h"
+#include "Io_runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace Net
 {
+    /**
+     *   How the Asio threads are used when there are more than one of them.
+     *   shared_context runs every thread on one io_context, connections stay safe because each has its own strand.
+     *   context_per_thread gives every thread its own io_context and connections are assigned to them round-robin.
+     */
+    enum class Thread_pool_mode : uint8_t
+    {
+        shared_context,
+        context_per_thread
+    };
+
+    /**
+     *   How the Asio threads wait for the work.
+     *   blocking sleeps in the kernel until a socket or a timer is ready, the work guard keeps it from returning
+     *   when there is nothing to do.
+     *   busy_poll polls the io_context in a loop without sleeping, which shaves the wakeup latency at the cost
+     *   of a whole core for each thread, so the threads should be pinned with the set_thread_affinity.
+     */
+    enum class Polling_mode : uint8_t
+    {
+        blocking,
+        busy_poll
+    };
+
     // Class spesifically for handling asio
     class Asio_base
     {
+    public:
+        Asio_base() = default;
+
+        /**
+         *   Runs the Asio on a thread of the shared runtime instead of own threads. Everything of this user runs
+         *   on one strand of the runtime, and the destructor waits until the handlers of the user have finished.
+         *
+         *   @param the runtime, nullptr runs own threads
+         */
+        explicit Asio_base(std::shared_ptr<Io_runtime> runtime) : m_runtime(std::move(runtime))
+        {
+        }
+
+        /**
+         *   Sets how many threads run the Asio. This has to be called before starting.
+         *
+         *   @param the amount of threads, atleast one thread is always used
+         *   @param how the threads share the work
+         *   @throws if the Asio threads are running or the Io_runtime runs the Asio
+         */
+        void set_asio_threads(size_t thread_count, Thread_pool_mode mode = Thread_pool_mode::context_per_thread)
+        {
+            if (!m_asio_thread_handles.empty())
+                throw std::logic_error("Asio threads can't be changed while they are running");
+
+            if (m_runtime)
+                throw std::logic_error("Asio threads belong to the Io_runtime");
+
+            m_thread_count = std::max<size_t>(thread_count, 1);
+            m_thread_pool_mode = mode;
+
+            // Monitors wait on the contexts so they go first
+            m_lag_monitors.clear();
+            m_extra_contexts.clear();
+
+            if (m_thread_pool_mode == Thread_pool_mode::context_per_thread)
+                for (size_t i = 1; i < m_thread_count; ++i)
+                    m_extra_contexts.push_back(std::make_unique<asio::io_context>());
+        }
+
+        /**
+         *   Pins the Asio threads to the cpus, thread i runs on the cpus[i % size]. This has to be called before
+         *   starting.
+         *
+         *   A pinned thread allocates the bodies of the messages it creates from the pool of its NUMA node, and the
+         *   connections accepted by its reuse port acceptor are allocated on it, so their memory stays on the node
+         *   that uses it. On Linux the reuse port acceptor of a thread also asks for the connections whose packets
+         *   are handled by its cpu, so giving the cpus that the RSS queues of the NIC interrupt keeps the packets
+         *   of a connection on one core. Threads that could not be pinned run unpinned.
+         *
+         *   @param the cpus, empty leaves the threads unpinned
+         *   @throws if the Asio threads are running
+         */
+        void set_thread_affinity(std::vector<uint32_t> cpus)
+        {
+            if (!m_asio_thread_handles.empty())
+                throw std::logic_error("Thread affinity can't be changed while the Asio threads are running");
+
+            if (m_runtime)
+                throw std::logic_error("Threads of the Io_runtime are pinned by the runtime");
+
+            m_thread_cpus = std::move(cpus);
+        }
+
+        /**
+         *   Gives each Asio thread its own pool for the bodies of the messages it creates, see the
+         *   use_thread_local_message_pool. The pool of a pinned thread takes its blocks from the pool of its
+         *   NUMA node. This has to be called before starting.
+         *
+         *   @param should the threads use their own pools
+         *   @throws if the Asio threads are running or the Io_runtime runs the Asio
+         */
+        void set_thread_local_message_pools(bool is_enabled)
+        {
+            if (!m_asio_thread_handles.empty())
+                throw std::logic_error("Message pools can't be changed while the Asio threads are running");
+
+            if (m_runtime)
+                throw std::logic_error("Threads of the Io_runtime are started by the runtime");
+
+            m_use_thread_local_message_pools = is_enabled;
+        }
+
+        /**
+         *   Sets how the Asio threads wait for the work. This has to be called before starting.
+         *
+         *   @param the polling mode
+         *   @throws if the Asio threads are running or the Io_runtime runs the Asio
+         */
+        void set_polling_mode(Polling_mode mode)
+        {
+            if (!m_asio_thread_handles.empty())
+                throw std::logic_error("Polling mode can't be changed while the Asio threads are running");
+
+            if (m_runtime)
+                throw std::logic_error("Threads of the Io_runtime always block");
+
+            m_polling_mode = mode;
+        }
+
+        /**
+         *   Registers receive buffers with the io_uring of every io_context when the sockets use it, see the
+         *   NET_ENABLE_IO_URING. The buffered read mode connections take their receive buffer from these and the
+         *   reads to them skip mapping the pages of the buffer. This has to be called before starting and the
+         *   buffers are registered once for the lifetime of the io_contexts.
+         *
+         *   @param how many buffers each io_context has, the connections over this use the normal memory. In the
+         *          on_demand read mode only the connections that are reading hold a buffer
+         *   @param size of a buffer, it should be the receive buffer size of the read mode
+         *   @throws if the Asio threads are running or the Io_runtime runs the Asio
+         */
+        void set_registered_receive_buffers(size_t buffer_count, size_t buffer_size)
+        {
+            if (!m_asio_thread_handles.empty())
+                throw std::logic_error("Registered buffers can't be changed while the Asio threads are running");
+
+            if (m_runtime)
+                throw std::logic_error("Io_runtime does not register receive buffers");
+
+            m_registered_buffer_count = buffer_count;
+            m_registered_buffer_size = buffer_size;
+        }
+
+        /**
+         *   Executor of the first asio thread. Coroutines spawned on it run on the asio thread once it has been
+         *   started, so the awaitable functions can be used without a separate update thread. With the
+         *   Io_runtime this is the strand of the user, and the coroutines have to finish before it is destroyed.
+         */
+        [[nodiscard]] asio::any_io_executor get_executor() noexcept
+        {
+            if (m_runtime)
+                return m_runtime_executor;
+
+            return m_asio_context.get_executor();
+        }
+
     protected:
         [[nodiscard]] Protocol::resolver create_resolver()
         {
-            return Protocol::resolver(m_asio_context);
+            return Protocol::resolver(get_executor());
         }
 
-        [[nodiscard]] Protocol::acceptor create_acceptor(const Protocol::endpoint& endpoint)
+        /**
+         *   Opens an acceptor that listens the endpoint
+         *
+         *   @param the endpoint to listen
+         *   @param max amount of the connections waiting in the accept queue of the kernel
+         *   @param should SO_REUSEPORT be set, so many acceptors can listen to the same port and the kernel
+         *          spreads the new connections between them
+         *   @param index of the io_context the acceptor runs on, wraps around the amount of contexts
+         *   @param should an ipv6 endpoint refuse the ipv4 connections, otherwise the ipv6 wildcard address
+         *          accepts them too as the mapped addresses
+         *   @throws if the port could not be opened or the reuse port is not available on this platform
+         */
+        [[nodiscard]] Protocol::acceptor create_acceptor(
+            const Protocol::endpoint& endpoint, int backlog = Protocol::acceptor::max_listen_connections,
+            bool reuse_port = false, size_t index = 0, bool is_v6_only = false)
         {
-            return Protocol::acceptor(m_asio_context, endpoint);
+            const size_t context_index = index % get_context_count();
+            Protocol::acceptor acceptor = create_closed_acceptor(context_index);
+            open_acceptor(acceptor, endpoint.protocol());
+            acceptor.set_option(Protocol::acceptor::reuse_address(true));
+
+            // Default differs between the platforms, Windows has only ipv6 and Linux both
+            if (endpoint.address().is_v6())
+                acceptor.set_option(asio::ip::v6_only(is_v6_only));
+
+            if (reuse_port)
+            {
+#ifdef SO_REUSEPORT
+                acceptor.set_option(Integer_socket_option(SOL_SOCKET, SO_REUSEPORT, 1));
+#else
+                throw std::invalid_argument("SO_REUSEPORT is not available on this platform");
+#endif
+            }
+
+#ifdef SO_INCOMING_CPU
+            // Kernel gives the acceptor the connections whose packets arrive on the cpu of its thread
+            if (reuse_port && m_thread_pool_mode == Thread_pool_mode::context_per_thread && !m_thread_cpus.empty())
+                acceptor.set_option(Integer_socket_option(
+                    SOL_SOCKET, SO_INCOMING_CPU, static_cast<int>(get_thread_cpu(context_index))));
+#endif
+
+            acceptor.bind(endpoint);
+            acceptor.listen(backlog);
+
+            return acceptor;
+        }
+
+        /**
+         *   Takes a socket that is already listening, for example one that was handed over from another process
+         *
+         *   @param the protocol of the socket
+         *   @param the handle, the acceptor owns it after this
+         *   @param index of the io_context the acceptor runs on, wraps around the amount of contexts
+         *   @throws if the handle could not be assigned
+         */
+        [[nodiscard]] Protocol::acceptor create_acceptor(
+            const Protocol& protocol, Protocol::acceptor::native_handle_type handle, size_t index = 0)
+        {
+            Protocol::acceptor acceptor = create_closed_acceptor(index % get_context_count());
+            acceptor.assign(protocol, handle);
+
+            return acceptor;
+        }
+
+        /**
+         *   @param how many connections of each io_context use the RIO, each takes two buffers
+         *   @param size of a buffer
+         *   @return false if the RIO is not available on this platform
+         */
+        bool set_registered_io_buffers(size_t connection_count, [[maybe_unused]] size_t buffer_size) noexcept
+        {
+#ifdef NET_HAS_RIO
+            m_registered_io_connection_count = connection_count;
+            m_registered_io_buffer_size = buffer_size;
+            return true;
+#else
+            return connection_count == 0;
+#endif
+        }
+
+        [[nodiscard]] bool is_registered_io_enabled() const noexcept
+        {
+            return m_registered_io_connection_count > 0;
+        }
+
+        // @return the amount of threads that run the handlers of this user, the shared runtime runs them on a strand
+        [[nodiscard]] size_t get_handler_thread_count() const noexcept
+        {
+            return m_runtime ? 1 : m_thread_count;
+        }
+
+        // @return the amount of io_contexts, in the context_per_thread mode there is one for each thread
+        [[nodiscard]] size_t get_context_count() const noexcept
+        {
+            return m_extra_contexts.size() + 1;
+        }
+
+        [[nodiscard]] bool is_asio_thread_running() const noexcept
+        {
+            if (m_runtime)
+                return !m_asio_thread_stop_flag;
+
+            return !m_asio_thread_handles.empty();
+        }
+
+        // Wheel that times the heartbeats of the connections, it ticks while the Asio threads run
+        [[nodiscard]] std::weak_ptr<Timer_wheel> get_timer_wheel() const noexcept
+        {
+            return m_timer_wheel;
+        }
+
+        /**
+         *   How late the Asio threads run their handlers, see the Lag_monitor. This can be called from any thread.
+         *
+         *   @return the largest lag of the io_contexts, zero when the Asio threads are not running
+         */
+        [[nodiscard]] std::chrono::microseconds get_io_lag() const noexcept
+        {
+            std::chrono::microseconds lag = std::chrono::microseconds(0);
+
+            for (const std::unique_ptr<Lag_monitor>& monitor : m_lag_monitors)
+                lag = std::max(lag, monitor->get_lag());
+
+            return lag;
         }
 
         [[nodiscard]] Protocol::socket create_socket()
         {
-            return Protocol::socket(m_asio_context);
+            return Protocol::socket(next_connection_executor());
         }
 
         /**
-         *   Starts the asio thread and setups the Asio to handle async task'
+         *   Executor for new connection. Every connection gets its own strand
+         *   and in the context_per_thread mode the connections are spread over the io_contexts.
+         */
+        [[nodiscard]] asio::any_io_executor next_connection_executor()
+        {
+            return make_connection_executor(m_next_context_index.fetch_add(1, std::memory_order_relaxed));
+        }
+
+        // New strand on the io_context, the index wraps around the amount of contexts
+        [[nodiscard]] asio::any_io_executor make_connection_executor(size_t index)
+        {
+            // Connections of the user share its strand so the handlers of the user never run at the same time
+            if (m_runtime)
+                return m_runtime_executor;
+
+            const size_t context_index = index % get_context_count();
+
+            if (context_index == 0)
+                return asio::make_strand(m_asio_context);
+
+            return asio::make_strand(*m_extra_contexts[context_index - 1]);
+        }
+
+        // @return the index of the io_context that runs the executor or nothing if it runs on another context
+        [[nodiscard]] std::optional<size_t> find_context_index(const asio::any_io_executor& executor) const
+        {
+            const asio::execution_context* context = &asio::query(executor, asio::execution::context);
+
+            if (context == &m_asio_context || context == m_runtime_context)
+                return 0;
+
+            for (size_t i = 0; i < m_extra_contexts.size(); ++i)
+                if (context == m_extra_contexts[i].get())
+                    return i + 1;
+
+            return std::nullopt;
+        }
+
+        /**
+         *   Starts the asio threads and setups the Asio to handle async task'
          *
-         *   @throws if the Asio thread was already running
+         *   @throws if the Asio threads were already running
          */
         void start_asio_thread()
         {
-            if (!m_asio_thread_handle.joinable())
+            if (m_runtime)
             {
-                if (m_asio_context.stopped())
-                    m_asio_context.restart();
+                start_on_runtime();
+                return;
+            }
+
+            if (m_asio_thread_handles.empty())
+            {
+                restart_if_stopped(m_asio_context);
+
+                for (const auto& context : m_extra_contexts)
+                    restart_if_stopped(*context);
 
                 m_asio_thread_stop_flag = false;
-                m_asio_thread_handle = std::thread([this] { asio_thread(); });
+                m_timer_wheel->start();
+
+                if (m_lag_monitors.empty())
+                {
+                    m_lag_monitors.push_back(std::make_unique<Lag_monitor>(m_asio_context.get_executor()));
+
+                    for (const auto& context : m_extra_contexts)
+                        m_lag_monitors.push_back(std::make_unique<Lag_monitor>(context->get_executor()));
+                }
+
+                for (const std::unique_ptr<Lag_monitor>& monitor : m_lag_monitors)
+                    monitor->start();
+
+                if constexpr (IS_IO_URING_ENABLED)
+                {
+                    register_receive_buffers(m_asio_context);
+
+                    for (const auto& context : m_extra_contexts)
+                        register_receive_buffers(*context);
+                }
+
+#ifdef NET_HAS_RIO
+                start_registered_io(m_asio_context);
+
+                for (const auto& context : m_extra_contexts)
+                    start_registered_io(*context);
+#endif
+
+                // Io_context stops when it runs out of work, so contexts with no pending operations are kept alive
+                m_work_guards.push_back(asio::make_work_guard(m_asio_context));
+
+                for (const auto& context : m_extra_contexts)
+                    m_work_guards.push_back(asio::make_work_guard(*context));
+
+                for (size_t i = 0; i < m_thread_count; ++i)
+                {
+                    const bool runs_main_context = i == 0 || m_extra_contexts.empty();
+                    asio::io_context& context = runs_main_context ? m_asio_context : *m_extra_contexts[i - 1];
+                    m_asio_thread_handles.emplace_back([this, &context, i] { asio_thread(context, i); });
+                }
             }
             else
                 throw std::logic_error("Asio thread was already running");
         }
 
-        // Stops the Asio context and the Thread
-        void stop_asio_thread()
+        /**
+         *   Stops the Asio contexts and the threads, then calls the after_stop on this thread while nothing runs
+         *   the handlers. With the Io_runtime the threads keep running, so the handlers of this user are stopped
+         *   and the after_stop is run on its strand while the calling thread waits.
+         *
+         *   @param closes what the handlers use, the pending operations complete with an error when the handlers
+         *          run next time
+         */
+        void stop_asio_thread(const std::function<void()>& after_stop = nullptr)
         {
+            if (m_runtime)
+            {
+                stop_on_runtime(after_stop);
+                return;
+            }
+
             if (!m_asio_thread_stop_flag)
             {
                 m_asio_thread_stop_flag = true;
+                m_work_guards.clear();
                 m_asio_context.stop();
 
-                if (m_asio_thread_handle.joinable())
-                    m_asio_thread_handle.join();
+                for (const auto& context : m_extra_contexts)
+                    context->stop();
+
+                for (std::thread& thread_handle : m_asio_thread_handles)
+                    if (thread_handle.joinable())
+                        thread_handle.join();
+
+                m_asio_thread_handles.clear();
+                m_timer_wheel->stop();
+
+                for (const std::unique_ptr<Lag_monitor>& monitor : m_lag_monitors)
+                    monitor->stop();
             }
+
+            if (after_stop)
+                after_stop();
+        }
+
+        /**
+         *   With the Io_runtime waits until the handlers of this user have run, so nothing uses it after it has
+         *   been destroyed. The destructor of the most derived user calls this after the stop_asio_thread.
+         */
+        void wait_for_runtime_handlers() const noexcept
+        {
+            if (m_runtime)
+                m_runtime_work->wait_until_idle();
+        }
+
+        [[nodiscard]] bool is_asio_thread_stopping() const noexcept
+        {
+            return m_asio_thread_stop_flag;
         }
 
     private:
+        void start_on_runtime()
+        {
+            if (!m_asio_thread_stop_flag)
+                throw std::logic_error("Asio thread was already running");
+
+            m_asio_thread_stop_flag = false;
+
+            // Lag of the runtime is seen from the strand of this user
+            if (m_lag_monitors.empty())
+                m_lag_monitors.push_back(std::make_unique<Lag_monitor>(m_runtime_executor));
+
+            asio::dispatch(m_runtime_executor, [timer_wheel = m_timer_wheel, monitor = m_lag_monitors.front().get()] {
+                timer_wheel->start();
+                monitor->start();
+            });
+        }
+
+        // Handlers of the user run on its strand, so running the stop there keeps them from running at the same time
+        void stop_on_runtime(const std::function<void()>& after_stop)
+        {
+            if (m_runtime_context->get_executor().running_in_this_thread())
+                throw std::logic_error("Asio of the Io_runtime can't be stopped from its own thread");
+
+            const bool was_running = !m_asio_thread_stop_flag.exchange(true);
+            std::promise<void> stopped;
+
+            asio::post(m_runtime_executor, [&] {
+                if (was_running)
+                {
+                    m_timer_wheel->stop();
+                    m_lag_monitors.front()->stop();
+                }
+
+                if (after_stop)
+                    after_stop();
+
+                stopped.set_value();
+            });
+
+            stopped.get_future().wait();
+        }
+
+        [[nodiscard]] asio::any_io_executor make_runtime_executor()
+        {
+            if (!m_runtime)
+                return {};
+
+            return asio::make_strand(Work_counted_executor(m_runtime_context->get_executor(), m_runtime_work));
+        }
+
+        static void restart_if_stopped(asio::io_context& context)
+        {
+            if (context.stopped())
+                context.restart();
+        }
+
+        void register_receive_buffers(asio::io_context& context)
+        {
+            if (m_registered_buffer_count > 0)
+                asio::use_service<Registered_receive_buffers>(context).register_buffers(
+                    context, m_registered_buffer_count, m_registered_buffer_size);
+        }
+
+#ifdef NET_HAS_RIO
+        // Sockets fall back to the overlapped operations if the RIO could not be started
+        void start_registered_io(asio::io_context& context)
+        {
+            if (m_registered_io_connection_count > 0)
+                asio::use_service<Rio_service>(context).start(
+                    context, m_registered_io_connection_count * 2, m_registered_io_buffer_size);
+        }
+#endif
+
+        [[nodiscard]] Protocol::acceptor create_closed_acceptor(size_t context_index)
+        {
+            if (m_runtime)
+                return Protocol::acceptor(m_runtime_executor);
+
+            return Protocol::acceptor(context_index == 0 ? m_asio_context : *m_extra_contexts[context_index - 1]);
+        }
+
+        /**
+         *   Sockets accepted for the RIO inherit its flag from the acceptor, they are accepted when the acceptor
+         *   is ready so it does not block
+         */
+        void open_acceptor(Protocol::acceptor& acceptor, const Protocol& protocol) const
+        {
+#ifdef NET_HAS_RIO
+            if (m_registered_io_connection_count > 0)
+            {
+                open_registered_io_acceptor(acceptor, protocol);
+                acceptor.non_blocking(true);
+                return;
+            }
+#endif
+            acceptor.open(protocol);
+        }
+
+        [[nodiscard]] uint32_t get_thread_cpu(size_t thread_index) const noexcept
+        {
+            return m_thread_cpus[thread_index % m_thread_cpus.size()];
+        }
+
         // Seperate thread for running the Asio async
-        void asio_thread()
+        void asio_thread(asio::io_context& context, size_t thread_index)
         {
-            while (!m_asio_thread_stop_flag)
-                m_asio_context.run();
+            if (!m_thread_cpus.empty() && pin_current_thread(get_thread_cpu(thread_index)))
+                set_thread_message_memory_resource(&get_numa_node_pool(get_current_numa_node()));
+
+            if (m_use_thread_local_message_pools)
+                use_thread_local_message_pool();
+
+            // Work guard keeps the run from returning while there is nothing to do, it returns when stopped
+            if (m_polling_mode == Polling_mode::blocking)
+                while (!m_asio_thread_stop_flag)
+                    context.run();
+            else
+                while (!m_asio_thread_stop_flag)
+                    context.poll();
         }
 
+        /**
+         *   Used only in context_per_thread mode, the first thread runs the m_asio_context.
+         *   These are declared before m_asio_context so they are destroyed after it, because the pending accept
+         *   on m_asio_context holds a socket that belongs to one of these.
+         */
+        std::vector<std::unique_ptr<asio::io_context>> m_extra_contexts;
+
         asio::io_context m_asio_context;
-        std::thread m_asio_thread_handle;
-        bool m_asio_thread_stop_flag = true;
+        // Connections are also created from the threads of msquic and the threads that open memory connections
+        std::atomic<size_t> m_next_context_index = 0;
+
+        // Strand on the shared runtime, the counter tells when its pending operations and handlers have finished
+        std::shared_ptr<Io_runtime> m_runtime;
+        asio::io_context* m_runtime_context = m_runtime ? &m_runtime->next_context() : nullptr;
+        std::shared_ptr<Work_counter> m_runtime_work = std::make_shared<Work_counter>();
+        asio::any_io_executor m_runtime_executor = make_runtime_executor();
+
+        // Connections have only weak pointers to the wheel so it is never used after the Asio_base is gone
+        std::shared_ptr<Timer_wheel> m_timer_wheel = std::make_shared<Timer_wheel>(get_executor());
+
+        // One for each io_context, created at the first start
+        std::vector<std::unique_ptr<Lag_monitor>> m_lag_monitors;
+
+        size_t m_thread_count = 1;
+        Thread_pool_mode m_thread_pool_mode = Thread_pool_mode::context_per_thread;
+        Polling_mode m_polling_mode = Polling_mode::blocking;
+        std::vector<uint32_t> m_thread_cpus;
+        bool m_use_thread_local_message_pools = false;
+        size_t m_registered_buffer_count = 0;
+        size_t m_registered_buffer_size = 0;
+        size_t m_registered_io_connection_count = 0;
+        size_t m_registered_io_buffer_size = 0;
+
+        std::vector<asio::executor_work_guard<asio::io_context::executor_type>> m_work_guards;
+        std::vector<std::thread> m_asio_thread_handles;
+        std::atomic<bool> m_asio_thread_stop_flag = true;
     };
 }; // namespace Net
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "../Message/Message_recycler.h"
+#include "../Utility/Mapped_file.h"
+#include "../Utility/Traffic_capture.h"
+#include "User.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Feeds the received messages of a traffic capture straight to the in queue of a user, usually the server
+     *   the traffic was captured on, so its handlers and its update can be profiled without sockets, decoding or
+     *   the timing of the network. The segments are mapped and the captured headers are used as they are, each
+     *   message costs one copy of its body from the mapping and the bodies are reused from the handled messages.
+     *   The messages have the captured client ids, the replies to them are dropped because those clients are not
+     *   connected. Only the user messages are fed, the framework makes its own pings, streams and fragments.
+     *
+     *   Capture_feed<Id_type> feed("capture");
+     *
+     *   while (!feed.is_done())
+     *   {
+     *       feed.feed(server);
+     *       server.update();
+     *   }
+     */
+    template <Id_concept Id_type>
+    class Capture_feed
+    {
+    public:
+        // Messages made from the capture at once before they are queued
+        static constexpr size_t BATCH_SIZE = 256;
+
+        /**
+         *   @param the directory of the segments written by the Traffic_capture
+         *   @throws std::filesystem::filesystem_error if the directory could not be read
+         */
+        explicit Capture_feed(const std::filesystem::path& directory)
+            : m_segments(Traffic_capture::find_segments(directory)),
+              m_ip(std::make_shared<const std::string>("capture"))
+        {
+            m_batch.reserve(BATCH_SIZE);
+        }
+
+        Capture_feed(const Capture_feed&) = delete;
+        Capture_feed(Capture_feed&&) = delete;
+
+        ~Capture_feed() = default;
+
+        Capture_feed& operator=(const Capture_feed&) = delete;
+        Capture_feed& operator=(Capture_feed&&) = delete;
+
+        /**
+         *   Queues the next messages of the capture to the user until its in queue is full. The messages are
+         *   handled by the update of the user, from this thread or another. The bodies are reused only when the
+         *   update runs on this thread.
+         *
+         *   @param the user the messages are queued to
+         *   @param the max amount of messages queued
+         *   @return the amount of messages queued, 0 if the in queue is full or the capture has been fed
+         *   @throws std::system_error if a segment could not be mapped or it is not a segment
+         */
+        size_t feed(User<Id_type>& user, size_t max_messages = SIZE_T_MAX)
+        {
+            size_t fed_messages = 0;
+
+            while (fed_messages < max_messages)
+            {
+                if (m_batch_offset == m_batch.size() && !fill_batch())
+                    break;
+
+                const size_t count = std::min(m_batch.size() - m_batch_offset, max_messages - fed_messages);
+                const size_t queued = user.inject_received_messages(std::span(m_batch).subspan(m_batch_offset, count));
+
+                m_batch_offset += queued;
+                fed_messages += queued;
+
+                if (queued < count)
+                    break;
+            }
+
+            m_fed_messages += fed_messages;
+            return fed_messages;
+        }
+
+        // Starts feeding the capture again from its first message, the messages not yet queued are dropped
+        void rewind() noexcept
+        {
+            m_segment.close();
+            m_next_segment = 0;
+            m_offset = 0;
+            m_is_read_whole = false;
+            m_batch.clear();
+            m_batch_offset = 0;
+        }
+
+        // @return true if every message of the capture has been queued
+        [[nodiscard]] bool is_done() const noexcept
+        {
+            return m_is_read_whole && m_batch_offset == m_batch.size();
+        }
+
+        [[nodiscard]] uint64_t get_fed_messages() const noexcept
+        {
+            return m_fed_messages;
+        }
+
+        // @return the sent messages and the internal messages of the capture that were not fed
+        [[nodiscard]] uint64_t get_skipped_frames() const noexcept
+        {
+            return m_skipped_frames;
+        }
+
+    private:
+        // @return false if the capture has no more messages
+        bool fill_batch()
+        {
+            m_batch.clear();
+            m_batch_offset = 0;
+
+            const auto received_time = std::chrono::steady_clock::now();
+            Captured_frame_header frame;
+            std::span<const char> header;
+            std::span<const char> body;
+
+            while (m_batch.size() < BATCH_SIZE && read_next_frame(frame, header, body))
+            {
+                const std::optional<Message_header<Id_type>> message_header =
+                    read_captured_user_header<Id_type>(header);
+
+                if (frame.m_direction != Capture_direction::received || !message_header)
+                {
+                    ++m_skipped_frames;
+                    continue;
+                }
+
+                Message<Id_type> message = acquire_message(message_header->m_id);
+                message.resize_body(body.size());
+
+                if (!body.empty())
+                    std::memcpy(message.body_data(), body.data(), body.size());
+
+                Owned_message<Id_type>& owned_message =
+                    m_batch.emplace_back(std::move(message), Client_information(frame.m_client_id, m_ip));
+                owned_message.m_received_time = received_time;
+            }
+
+            return !m_batch.empty();
+        }
+
+        // Moves to the next segment when the current one has no more frames
+        bool read_next_frame(Captured_frame_header& frame, std::span<const char>& header, std::span<const char>& body)
+        {
+            while (!m_segment.is_open() || !Traffic_capture::read_frame(m_segment, m_offset, frame, header, body))
+            {
+                m_segment.close();
+
+                if (m_next_segment == m_segments.size())
+                {
+                    m_is_read_whole = true;
+                    return false;
+                }
+
+                Traffic_capture::open_segment(m_segments[m_next_segment++], m_segment);
+                m_offset = Traffic_capture::SEGMENT_MAGIC.size();
+            }
+
+            return true;
+        }
+
+        const std::vector<std::filesystem::path> m_segments;
+
+        // Shared by the client informations of all the fed messages
+        const std::shared_ptr<const std::string> m_ip;
+
+        Mapped_file m_segment;
+        size_t m_next_segment = 0;
+        size_t m_offset = 0;
+        bool m_is_read_whole = false;
+
+        // Messages from the m_batch_offset on are not queued yet
+        std::vector<Owned_message<Id_type>> m_batch;
+        size_t m_batch_offset = 0;
+
+        uint64_t m_fed_messages = 0;
+        uint64_t m_skipped_frames = 0;
+    };
+} // namespace Net
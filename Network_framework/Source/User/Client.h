@@ -1,26 +1,84 @@
 #pragma once
 
-#include "../Utility/Thread_safe_deque.h"
+#include "../Connection/Multicast_channel.h"
+#include "../Events/Message_handlers.h"
+#include "../Sockets/Happy_eyeballs.h"
+#include "../Sockets/Server_race.h"
+#include "State_replication.h"
 #include "User.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace Net
 {
+    /**
+     *   Reconnecting of the client after the connection is lost or the connect fails. The delay before each
+     *   attempt grows exponentially and a random part of it is taken away, so the clients that lost the same
+     *   server do not all come back at the same moment.
+     */
+    struct Reconnect_settings
+    {
+        std::chrono::milliseconds m_initial_delay = std::chrono::milliseconds(100);
+        std::chrono::milliseconds m_max_delay = std::chrono::seconds(30);
+        double m_multiplier = 2.0;
+
+        // Fraction of the delay that is random, 0.5 waits between the half and the whole delay
+        double m_jitter = 0.5;
+
+        // Failed attempts in a row before giving up, nullopt tries forever
+        std::optional<size_t> m_max_attempts = std::nullopt;
+
+        /**
+         *   Sent messages kept for sending again when the server resumes the session, see the
+         *   Server::set_session_resume. With 0 nothing is sent again but the session is still resumed.
+         */
+        size_t m_resend_capacity = 0;
+    };
+
+    // Server that the connect_fastest chose, see the Client::get_selected_server
+    struct Selected_server
+    {
+        Server_address m_address;
+
+        // From the end of the resolve of the server until the connection was made
+        std::chrono::microseconds m_connect_time = std::chrono::microseconds(0);
+    };
+
     template <Id_concept Id_type>
     class Client : public User<Id_type>
     {
     public:
         using Optional_seconds = std::optional<std::chrono::seconds>;
 
-        Client() : m_temp_socket(this->create_socket())
+        Client() = default;
+
+        /**
+         *   Runs on a thread of the shared runtime instead of own thread, so many clients can share few threads
+         *
+         *   @param the runtime, the client keeps it alive
+         */
+        explicit Client(std::shared_ptr<Io_runtime> runtime) : User<Id_type>(std::move(runtime))
         {
-            
         }
 
         ~Client() override
         {
             disconnect();
+            this->wait_for_runtime_handlers();
         }
 
         Client(const Client&) = delete;
@@ -28,23 +86,202 @@ namespace Net
         Client& operator=(const Client&) = delete;
         Client& operator=(Client&&) = delete;
 
+        /**
+         *   Starts connecting to the server, the client follows the redirects of the server to the other nodes
+         *   of its cluster. The host is resolved on the asio thread and its ipv6 and ipv4 addresses are raced,
+         *   see the Happy_eyeballs, so this does not block. Failed resolve is notified like a failed connect.
+         *
+         *   @return false if the connecting could not be started
+         */
         bool connect(std::string_view host, std::string_view port)
         {
+            m_redirect_count = 0;
+            m_reconnect_attempts = 0;
+            start_new_session();
+
+            try
+            {
+                // Handlers of the earlier connect see the new id and leave the new connect alone
+                m_connection_id.fetch_add(1, std::memory_order_relaxed);
+
+                m_reconnect_host = host;
+                m_reconnect_port = port;
+
+                m_has_received_server_data = false;
+                m_is_connection_active = true;
+                async_resolve(std::string(host), std::string(port));
+
+                this->start_asio_thread();
+            }
+            catch (const std::exception& exception)
+            {
+                m_is_connection_active = false;
+                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+                return false;
+            }
+
+            return true;
+        }
+
+        /**
+         *   Connects to every candidate at the same time and keeps the connection that is made first, the other
+         *   attempts are closed, see the Server_race. The choice is remembered for the duration set with the
+         *   set_server_selection_cache, so connecting again to the same candidates goes straight to the chosen
+         *   server without racing. Reconnects and redirects work like after the connect to the chosen server.
+         *
+         *   @param the candidate servers, for example one of each region
+         *   @return false if there are no candidates or the connecting could not be started
+         */
+        bool connect_fastest(std::vector<Server_address> candidates)
+        {
+            if (candidates.empty())
+                return false;
+
+            if (candidates.size() == 1)
+                return connect(candidates.front().m_host, candidates.front().m_port);
+
+            {
+                std::lock_guard lock(m_selection_mutex);
+
+                if (m_selected_server && m_selection_candidates == candidates &&
+                    std::chrono::steady_clock::now() < m_selection_expiry)
+                {
+                    const Server_address address = m_selected_server->m_address;
+                    return connect(address.m_host, address.m_port);
+                }
+            }
+
+            m_redirect_count = 0;
+            m_reconnect_attempts = 0;
+            start_new_session();
+
+            try
+            {
+                m_connection_id.fetch_add(1, std::memory_order_relaxed);
+
+                // Reconnects go to the chosen server once there is one
+                m_reconnect_host.clear();
+
+                m_has_received_server_data = false;
+                m_is_connection_active = true;
+                async_race(std::move(candidates));
+
+                this->start_asio_thread();
+            }
+            catch (const std::exception& exception)
+            {
+                m_is_connection_active = false;
+                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+                return false;
+            }
+
+            return true;
+        }
+
+        // @return the server that the last race chose or nothing if no race has connected yet
+        [[nodiscard]] std::optional<Selected_server> get_selected_server() const
+        {
+            std::lock_guard lock(m_selection_mutex);
+            return m_selected_server;
+        }
+
+        /**
+         *   Sets how long the connect_fastest remembers the chosen server, zero races on every connect.
+         *   The remembered choice is forgotten too.
+         */
+        void set_server_selection_cache(std::chrono::seconds duration)
+        {
+            std::lock_guard lock(m_selection_mutex);
+            m_selection_cache_duration = duration;
+            m_selected_server = std::nullopt;
+            m_selection_candidates.clear();
+        }
+
+        /**
+         *   Connects to the unix domain socket of a server on the same host, see the Server::set_local_path.
+         *   The connection has no tls even in the Ssl_client.
+         *
+         *   @return false if the connecting could not be started
+         */
+        bool connect_local(std::string_view path)
+        {
+            return connect_same_host(path, false);
+        }
+
+        /**
+         *   Connects to the shared memory path of a server on the same host, see the Server::set_shared_memory_path.
+         *   The data goes through the shared memory and the unix domain socket only wakes up the sides.
+         *
+         *   @return false if the connecting could not be started
+         */
+        bool connect_shared_memory(std::string_view path)
+        {
+            return connect_same_host(path, true);
+        }
+
+#ifdef NET_ENABLE_QUIC
+        /**
+         *   Connects to the quic port of the server, see the Server::set_quic_port. The configuration is kept between
+         *   the connects, so connecting to the same server again sends the first messages in the 0-RTT.
+         *
+         *   @param host name or ip of the server, the certificate of the server must match it
+         *   @param udp port of the server
+         *   @param the settings, changing them forgets the resumption ticket
+         *   @return false if the connecting could not be started
+         */
+        bool connect_quic(std::string_view host, uint16_t port, const Quic_settings& settings = {})
+        {
+            std::unique_ptr<Socket_interface> socket;
+
+            try
+            {
+                if (!m_quic_configuration || settings != m_quic_settings)
+                {
+                    m_quic_configuration = std::make_shared<Quic_configuration>(settings, Handshake_type::client);
+                    m_quic_settings = settings;
+                }
+
+                socket = std::make_unique<Quic_socket>(
+                    this->get_executor(), m_quic_configuration, std::string(host), port);
+            }
+            catch (const std::exception& exception)
+            {
+                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+                return false;
+            }
+
+            return connect(std::move(socket));
+        }
+#endif
+
+        /**
+         *   Connects through the given socket instead of resolving the host, for example the in-memory connection
+         *   from the Server::open_memory_connection
+         *
+         *   @return false if there is no socket or the asio thread could not be started
+         */
+        bool connect(std::unique_ptr<Socket_interface> socket)
+        {
+            if (socket == nullptr)
+                return false;
+
+            // Socket can't be opened again so these connections are not reconnected
+            m_reconnect_host.clear();
+            start_new_session();
+
             try
             {
-                /**
-                 *   Using resolver allows more than just the ip being passed to this function.
-                 *   For eexamble you can pass webpage addresses for conneting.
-                 */
                 m_has_received_server_data = false;
-                Protocol::resolver resolver = this->create_resolver();
-                auto endpoints = resolver.resolve(host, port);
-                async_connect(endpoints);
+                m_is_connection_active = true;
+                m_connection.store(
+                    this->create_connection(std::move(socket), m_connection_id, Handshake_type::client),
+                    std::memory_order_release);
 
                 this->start_asio_thread();
             }
             catch (const std::exception& exception)
             {
+                m_is_connection_active = false;
                 this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
                 return false;
             }
@@ -54,107 +291,1371 @@ namespace Net
 
         void disconnect()
         {
-            this->stop_asio_thread();
+            // Handlers of the client do not run during the closing, with the Io_runtime it runs on their strand
+            this->stop_asio_thread([this] {
+                m_resolver.cancel();
+
+                if (const auto connector = std::exchange(m_connector, nullptr))
+                    connector->cancel();
+
+                if (const auto server_race = std::exchange(m_server_race, nullptr))
+                    server_race->cancel();
+
+                m_reconnect_timer.cancel();
+
+                if (const auto connection = m_connection.exchange(nullptr); connection && connection->is_connected())
+                    connection->close();
+
+                close_datagram_channel();
+                close_multicast();
+
+                m_is_connection_active = false;
+
+                // Lets the waiting coroutines see that the client has stopped
+                this->notify_wait();
+            });
+        }
+
+        /**
+         *   Coroutine version of the connect, completes when the server has accepted the client and the messages
+         *   can be sent. The host is resolved on the asio thread like in the connect. The messages
+         *   received while waiting are handled like in the update, so this should not be mixed with updates
+         *   from another thread.
+         *
+         *   @return false if the connection could not be made or it was lost before the server accepted it
+         */
+        [[nodiscard]] asio::awaitable<bool> async_connect(std::string host, std::string port)
+        {
+            if (!connect(host, port))
+                co_return false;
+
+            while (!m_has_received_server_data && m_is_connection_active)
+            {
+                co_await this->async_wait_until_has_something_to_do();
+                update();
+            }
+
+            co_return m_has_received_server_data;
+        }
+
+        /**
+         *   Coroutine version of the update_batch, completes when there are received messages instead of polling.
+         *   This should not be mixed with updates from another thread.
+         *
+         *   @param The max items handled
+         *   @return The received messages in order, these stay valid until the next update call. Empty when the
+         *           connection has been lost
+         */
+        [[nodiscard]] asio::awaitable<std::span<Owned_message<Id_type>>> async_receive(size_t max_items = SIZE_T_MAX)
+        {
+            while (true)
+            {
+                std::span<Owned_message<Id_type>> received_messages = update_batch(max_items);
 
-            if (is_connected())
-                m_connection->disconnect();
+                if (!received_messages.empty() || !is_connected())
+                    co_return received_messages;
 
-            m_connection.reset();
+                co_await this->async_wait_until_has_something_to_do();
+            }
         }
 
         [[nodiscard]] bool is_connected() const
         {
-            if (m_connection)
-                return m_connection->is_connected();
+            const auto connection = get_connection();
+            return connection && connection->is_connected();
+        }
+
+        // @return the capabilities that the client and the server both have, empty if the server sent no hello
+        [[nodiscard]] Capability_set get_server_capabilities() const
+        {
+            const auto connection = get_connection();
+            return connection ? connection->get_agreed_capabilities() : Capability_set();
+        }
+
+        /**
+         *   Connects again after the connection is lost or the connect fails, only the connections to a host are
+         *   reconnected. The Ssl_client offers the tls session of the earlier connection so the handshake is
+         *   shorter. If the server keeps the sessions, see the Server::set_session_resume, the client continues
+         *   its session and the m_on_session_resumed is called instead of the m_on_connected. Then the messages
+         *   that the server did not receive are sent again from the resend buffer, also the ones sent while
+         *   reconnecting. With the resend buffer the conflated messages are not conflated, so the server counts
+         *   the same messages that the client sent. Streams, files and datagrams are not sent again.
+         *
+         *   @param the settings, nullopt disables reconnecting
+         */
+        void set_reconnect(std::optional<Reconnect_settings> settings)
+        {
+            std::lock_guard lock(m_session_mutex);
+
+            m_resend_capacity = settings ? settings->m_resend_capacity : 0;
+            m_reconnect_settings = std::move(settings);
+
+            while (m_resend_buffer.size() > m_resend_capacity)
+                drop_oldest_resend();
+        }
+
+        /**
+         *   Sets how long a connect attempt to one address of the host runs before the next address is tried
+         *   alongside it, see the Happy_eyeballs. Applies from the next connect.
+         */
+        void set_connection_attempt_delay(std::chrono::milliseconds delay) noexcept
+        {
+            m_connection_attempt_delay = delay;
+        }
+
+        /**
+         *   Joins the multicast group that the server offers, see the Server::set_multicast. Otherwise the server
+         *   sends everything through the connection. Applies from the next connect.
+         */
+        void set_multicast(bool is_enabled) noexcept
+        {
+            m_is_multicast_enabled = is_enabled;
+        }
+
+        // @return true from the connect until the connection is made, fails or is lost
+        [[nodiscard]] bool is_connecting() const
+        {
+            return m_is_connection_active && !is_connected();
+        }
+
+        // @return the latest round trip time measured by the heartbeat or nothing if it is not known yet
+        [[nodiscard]] std::optional<std::chrono::microseconds> get_round_trip_time() const
+        {
+            if (const auto connection = get_connection())
+                return connection->get_round_trip_time();
+
+            return std::nullopt;
+        }
 
-            return false;
+        /**
+         *   @param the replicated object, see the Server::set_replicated_state
+         *   @return the latest state of the object or null if the server has not replicated it
+         */
+        [[nodiscard]] const std::vector<char>* get_replicated_state(uint32_t object_id) const
+        {
+            return m_state_replica.get_state(object_id);
         }
 
         /**
          *   Handle everything received through internet
          *
          *   @param The max items handled
-         *   @param Should the function wait if there is no items to handle
+         *   @param Should the function wait if there is no items to handle, the wait ends when a message or
+         *          notification is received or the connection fails or is lost
          *   @param Optional interval for checking connections. If you don't give this there will be no checking
          */
         void update(
             size_t max_items = SIZE_T_MAX, bool wait = false,
             Optional_seconds check_connections_interval = Optional_seconds()) override
         {
+            NET_TRACE_SCOPE("Client::update");
             User<Id_type>::update(max_items, wait, check_connections_interval);
 
             handle_received_messages(max_items);
+            this->signal_if_has_something_to_do();
         }
 
-        // Sends the message to the server or does nothing if not connected
-        void send_message(Message<Id_type> message)
+        /**
+         *   Same as update but the received messages are returned instead of broadcasting them to m_on_message,
+         *   this allows handling the whole batch at once.
+         *
+         *   @param The max items handled
+         *   @param Should the function wait if there is no items to handle
+         *   @param Optional interval for checking connections. If you don't give this there will be no checking
+         *   @return The received messages in order, these stay valid until the next update call
+         */
+        [[nodiscard]] std::span<Owned_message<Id_type>> update_batch(
+            size_t max_items = SIZE_T_MAX, bool wait = false,
+            Optional_seconds check_connections_interval = Optional_seconds())
         {
-            if (is_connected())
-                m_connection->send_message(std::move(message));
+            NET_TRACE_SCOPE("Client::update_batch");
+            User<Id_type>::update(max_items, wait, check_connections_interval);
+
+            std::span<Owned_message<Id_type>> received_messages = this->pop_received_batch(max_items);
+            this->signal_if_has_something_to_do();
+
+            return received_messages;
         }
 
-        // You can only start sending messages to server after this event
-        Delegate<> m_on_connected;
+        /**
+         *   Sends the message to the server or does nothing if not connected. This can be called from any thread,
+         *   the message is queued on the strand of the connection.
+         *   The priority selects the lane of the write queue, see the set_priority_settings.
+         */
+        void send_message(Message<Id_type> message, Message_priority priority = Message_priority::normal)
+        {
+            NET_ALLOCATION_SCOPE(send);
 
-        Delegate<Message<Id_type>> m_on_message;
+            if (const Delivery_mode mode = this->get_delivery_mode(message.get_id());
+                mode != Delivery_mode::reliable && send_datagram(message, mode))
+                return;
 
-    private:
-        void async_connect(Protocol::resolver::results_type endpoints)
+            send_reliable(std::move(message), {.m_priority = priority});
+        }
+
+        /**
+         *   Builds the message straight into its pooled body and sends it, nothing is built if not connected.
+         *   See the Server::send_built_message_to_client.
+         *
+         *   @param id of the message
+         *   @param bytes the builder is expected to write
+         *   @param called with the Message_writer of the body, it is called on this thread before this returns
+         *   @param the lane of the write queue
+         */
+        template <std::invocable<Message_writer<Id_type>&> Builder_type>
+        void send_built_message(
+            Id_type id, size_t size_hint, Builder_type&& build, Message_priority priority = Message_priority::normal)
         {
-            m_temp_socket = this->create_socket();
-            asio::async_connect(
-                m_temp_socket, endpoints,
-                [this](asio::error_code error, const Protocol::endpoint& endpoint) {
-                    if (!error)
-                    {
-                        m_connection = this->create_connection(std::move(m_temp_socket), 0, Handshake_type::client);
-                    }
-                    else
-                        this->notifications_push_back(
-                            std::format("Error on connection because {}", error.message()), Severity::error);
-                });
+            if (!is_connected())
+                return;
+
+            send_message(this->build_message(id, size_hint, std::forward<Builder_type>(build)), priority);
         }
 
-        // Triggers the on message callback for all the received messages
-        void handle_received_messages(size_t max_messages)
+        /**
+         *   Sends the message so that it replaces the message with the same id and key if that is still waiting
+         *   to be written, see the Connection::send_message. Does nothing if not connected.
+         */
+        void send_conflated_message(
+            uint64_t conflation_key, Message<Id_type> message, Message_priority priority = Message_priority::normal)
         {
-            for (size_t i = 0; i < max_messages && !this->is_in_queue_empty(); ++i)
-            {
-                auto owned_message = this->in_queue_pop_front();
+            if (const Delivery_mode mode = this->get_delivery_mode(message.get_id());
+                mode != Delivery_mode::reliable && send_datagram(message, mode))
+                return;
 
-                if (owned_message.m_message.get_internal_id() == Internal_id::not_internal)
-                    m_on_message.broadcast(std::move(owned_message.m_message));
-                else
-                    handle_internal_message(std::move(owned_message));
-            }
+            send_reliable(std::move(message), {.m_priority = priority, .m_conflation_key = conflation_key});
         }
 
-        void handle_server_data(const Server_data& data)
+        /**
+         *   Sends the message in a logical stream, see the Server::send_message_to_client_stream.
+         *   Does nothing if not connected.
+         */
+        void send_message_to_stream(uint32_t stream_id, Message<Id_type> message)
         {
-            m_remote_id = data.m_client_id;
-            m_has_received_server_data = true;
-            m_on_connected.broadcast();
+            if (const Delivery_mode mode = this->get_delivery_mode(message.get_id());
+                mode != Delivery_mode::reliable && send_datagram(message, mode))
+                return;
+
+            send_reliable(std::move(message), {.m_stream_id = stream_id});
         }
 
-        // Handles the message that is internal to the framework
-        void handle_internal_message(Owned_message<Id_type> owned_message)
+        /**
+         *   Calls the rpc handler of the request id on the server, see the Server::call_client.
+         *   Fails with the disconnected status if not connected.
+         */
+        void call(
+            Message<Id_type> request, std::chrono::milliseconds timeout, Rpc_callback<Id_type> callback,
+            Rpc_completion completion = Rpc_completion::update_thread)
         {
-            Message<Id_type>& message = owned_message.m_message;
+            this->start_rpc_call(get_connection(), std::move(request), timeout, std::move(callback), completion);
+        }
 
-            switch (message.get_internal_id())
-            {
-            case Internal_id::server_accept:
-                handle_server_data(Message_converter<Id_type>::extract_server_accept(message));
-                break;
-            default:
-                break;
-            }
+        /**
+         *   Sends a large body in chunks without having all of it in the memory, the server receives
+         *   it with the m_on_stream_chunk event. Does nothing if not connected. This can be called from any thread.
+         *
+         *   @param the id of the streamed message
+         *   @param source that is read from the asio thread when there is room for the next chunk
+         */
+        void send_stream(Id_type id, Stream_source source)
+        {
+            if (const auto connection = get_connection(); connection && connection->is_connected())
+                connection->send_stream(id, std::move(source));
+        }
+
+        /**
+         *   Sends part of the file as a stream, see the Connection::send_file
+         *
+         *   @return false if not connected or the file could not be sent
+         */
+        [[nodiscard]] bool send_file(
+            Id_type id, const std::filesystem::path& path, uint64_t offset = 0,
+            std::optional<uint64_t> length = std::nullopt)
+        {
+            const auto connection = get_connection();
+            return connection && connection->is_connected() && connection->send_file(id, path, offset, length);
         }
 
-        Protocol::socket m_temp_socket;
-        std::unique_ptr<Connection<Id_type>> m_connection;
+        /**
+         *   Handles the messages of the id with the callable instead of the m_on_message. The handler is found from
+         *   a table indexed by the id and called in the update, so this should be called from the update thread.
+         *   Handlers of the ids dispatched on the io threads should be set before the start, see set_dispatch_policy.
+         *
+         *   @param the message id
+         *   @param callable that takes the message
+         */
+        template <typename Callable_type>
+        void register_handler(Id_type id, Callable_type callable)
+        {
+            m_message_handlers.set_handler(id, std::move(callable));
+        }
 
-        uint32_t m_remote_id = 0;
-        bool m_has_received_server_data = false;
+        /**
+         *   Same as register_handler but the callable takes the struct read from the message, see the
+         *   make_schema_message. Message is dropped with an error notification if the struct can't be read.
+         *
+         *   @param the message id
+         *   @param callable that takes the struct
+         */
+        template <Schema_concept Schema_type, typename Callable_type>
+        void register_schema_handler(Id_type id, Callable_type callable)
+        {
+            m_message_handlers.set_handler(id, [this, callable = std::move(callable)](Message<Id_type> message) {
+                std::optional<Schema_type> data;
+
+                try
+                {
+                    data = read_schema_message<Schema_type>(message);
+                }
+                catch (const std::exception& exception)
+                {
+                    this->notifications_push_back(
+                        std::format("Invalid message from server because {}", exception.what()), Severity::error);
+                    return;
+                }
+
+                std::invoke(callable, *data);
+            });
+        }
+
+        // The messages of the id go to the m_on_message again
+        void unregister_handler(Id_type id)
+        {
+            m_message_handlers.remove_handler(id);
+        }
+
+        // You can only start sending messages to server after this event
+        Delegate<> m_on_connected;
+
+        // Called instead of the m_on_connected when the reconnected client continued its session on the server
+        Delegate<> m_on_session_resumed;
+
+        Delegate<Message<Id_type>> m_on_message;
+
+        // Chunks are handled before the other messages of the same update
+        Delegate<const Stream_chunk<Id_type>&> m_on_stream_chunk;
+
+        /**
+         *   Called with the hello of the server and the capabilities both sides have, before the m_on_connected.
+         *   Servers older than the hello send none, so a feature is used only when its capability is agreed.
+         */
+        Delegate<const Hello_data&, Capability_set> m_on_server_hello;
+
+        /**
+         *   Called with true when the write queue goes over its high watermark and with false when it has drained
+         *   under the low watermarks, see the set_write_queue_limits. This is called from the asio thread.
+         */
+        Delegate<bool> m_on_write_pressure;
+
+        // Called in the update with the new state of the replicated object that was added or changed
+        Delegate<uint32_t, std::span<const char>> m_on_state_changed;
+
+        // Called in the update with the replicated object that the server removed
+        Delegate<uint32_t> m_on_state_removed;
+
+    protected:
+        void add_connection_metrics(Metrics<Id_type>& metrics) const override
+        {
+            if (const auto connection = get_connection(); connection && connection->is_connected())
+            {
+                const Connection_metrics connection_metrics = connection->get_metrics();
+
+                metrics.m_connections = 1;
+                metrics.m_out_queue_messages = connection_metrics.m_out_queue_messages;
+                metrics.m_out_queue_bytes = connection_metrics.m_out_queue_bytes;
+                metrics.m_memory_bytes += connection->get_memory_usage();
+                metrics.m_locks.push_back({"connection_strand", connection_metrics.m_strand_lock});
+            }
+        }
+
+        // The waiting update returns also when the connecting fails or the connection is lost
+        bool should_stop_waiting() override
+        {
+            return User<Id_type>::should_stop_waiting() || !m_is_connection_active;
+        }
+
+    private:
+        void handle_write_pressure([[maybe_unused]] const Client_information& client, bool is_congested) override
+        {
+            m_on_write_pressure.broadcast(is_congested);
+        }
+
+        // Wakes the waiting update so the lost connection is noticed without a message
+        [[nodiscard]] std::shared_ptr<Connection<Id_type>> find_connection(
+            [[maybe_unused]] uint32_t connection_id) const override
+        {
+            return get_connection();
+        }
+
+        void handle_disconnect(uint32_t connection_id) override
+        {
+            // Connection that was left because of a redirect
+            if (connection_id != m_connection_id.load(std::memory_order_relaxed))
+                return;
+
+            if (schedule_reconnect())
+                return;
+
+            m_is_connection_active = false;
+            this->notify_wait();
+        }
+
+        /**
+         *   Starts the timer of the next reconnect attempt
+         *
+         *   @return false if reconnecting is disabled, the connection was not to a host or the attempts ran out
+         */
+        bool schedule_reconnect()
+        {
+            std::optional<Reconnect_settings> settings;
+
+            {
+                std::lock_guard lock(m_session_mutex);
+                m_is_session_ready = false;
+                settings = m_reconnect_settings;
+            }
+
+            // Connection was closed by the disconnect
+            if (!settings || m_reconnect_host.empty() || this->is_asio_thread_stopping())
+                return false;
+
+            const size_t attempt = m_reconnect_attempts.fetch_add(1, std::memory_order_relaxed);
+
+            if (settings->m_max_attempts && attempt >= *settings->m_max_attempts)
+                return false;
+
+            const std::chrono::milliseconds delay = get_reconnect_delay(*settings, attempt);
+            this->push_notification(
+                {.m_code = Notification_code::reconnecting, .m_text = std::format("{} ms", delay.count())});
+
+            const uint32_t connection_id = m_connection_id.load(std::memory_order_relaxed);
+            m_reconnect_timer.expires_after(delay);
+            m_reconnect_timer.async_wait([this, connection_id](asio::error_code error) {
+                if (error || connection_id != m_connection_id.load(std::memory_order_relaxed))
+                    return;
+
+                m_connection_id.fetch_add(1, std::memory_order_relaxed);
+                m_has_received_server_data = false;
+                async_resolve(m_reconnect_host, m_reconnect_port);
+            });
+
+            return true;
+        }
+
+        // Exponential delay of the attempt with the random part taken away
+        [[nodiscard]] std::chrono::milliseconds get_reconnect_delay(const Reconnect_settings& settings, size_t attempt)
+        {
+            const double growth = std::pow(settings.m_multiplier, static_cast<double>(std::min<size_t>(attempt, 64)));
+            const double delay = std::min(
+                static_cast<double>(settings.m_initial_delay.count()) * growth,
+                static_cast<double>(settings.m_max_delay.count()));
+
+            std::uniform_real_distribution<double> random_fraction(0.0, std::clamp(settings.m_jitter, 0.0, 1.0));
+            return std::chrono::milliseconds(static_cast<int64_t>(delay * (1.0 - random_fraction(m_jitter_random))));
+        }
+
+        /**
+         *   Sends the message of the user through the connection. With the resend buffer the message is also kept
+         *   in it, and while the session is not ready it is only kept there and sent when the session starts.
+         */
+        void send_reliable(Message<Id_type> message, Send_options options)
+        {
+            const auto connection = get_connection();
+
+            if (m_resend_capacity.load(std::memory_order_relaxed) == 0)
+            {
+                if (connection && connection->is_connected())
+                    connection->send_message(std::move(message), options);
+
+                return;
+            }
+
+            // Conflation would leave the server with less messages than the client counted
+            options.m_conflation_key = std::nullopt;
+
+            // Lock is held over the send so the messages are queued in the order of their sequences
+            std::lock_guard lock(m_session_mutex);
+            const bool is_sent = m_is_session_ready && connection && connection->is_connected();
+
+            if (!is_sent && !m_unsent_sequence)
+                m_unsent_sequence = m_next_sequence;
+
+            m_resend_buffer.push_back({.m_message = message, .m_options = options});
+            ++m_next_sequence;
+
+            if (m_resend_buffer.size() > m_resend_capacity)
+                drop_oldest_resend();
+
+            if (is_sent)
+                connection->send_message(std::move(message), options);
+        }
+
+        // Forgets the session of the earlier connections, the next server starts a new one
+        void start_new_session()
+        {
+            std::lock_guard lock(m_session_mutex);
+
+            m_session_token = 0;
+            m_is_resuming = false;
+            m_is_session_ready = false;
+            m_resend_buffer.clear();
+            m_first_resend_sequence = 0;
+            m_next_sequence = 0;
+            m_unsent_sequence.reset();
+        }
+
+        /**
+         *   Sends the kept messages from the first one the server has not received, and numbers them from the
+         *   start of the session of the new connection. The session mutex has to be locked.
+         *
+         *   @param sequence of the first message to send again
+         *   @return the amount of messages sent again
+         */
+        size_t resend_from(uint64_t sequence)
+        {
+            while (!m_resend_buffer.empty() && m_first_resend_sequence < sequence)
+                drop_oldest_resend();
+
+            m_first_resend_sequence = 0;
+            m_next_sequence = m_resend_buffer.size();
+            m_unsent_sequence.reset();
+            m_is_session_ready = true;
+
+            if (const auto connection = get_connection(); connection && connection->is_connected())
+                for (const Resend_entry& entry : m_resend_buffer)
+                    connection->send_message(entry.m_message, entry.m_options);
+
+            return m_resend_buffer.size();
+        }
+
+        void drop_oldest_resend()
+        {
+            m_resend_buffer.pop_front();
+            ++m_first_resend_sequence;
+        }
+
+        /**
+         *   Finishes the resume that was started in the client accept, the messages that the server did not get
+         *   are sent again. If the session is gone only the messages sent while reconnecting are sent.
+         */
+        void handle_session_resume(const Session_resume_data& data)
+        {
+            std::unique_lock lock(m_session_mutex);
+
+            if (!m_is_resuming)
+                return;
+
+            m_is_resuming = false;
+
+            const uint64_t unsent_sequence = m_unsent_sequence.value_or(m_next_sequence);
+            const uint64_t first_missing_sequence =
+                data.m_is_resumed ? std::min(data.m_received_messages, m_next_sequence) : unsent_sequence;
+            const uint64_t lost_messages = first_missing_sequence < m_first_resend_sequence
+                                               ? m_first_resend_sequence - first_missing_sequence
+                                               : 0;
+
+            const size_t resent_messages = resend_from(first_missing_sequence);
+            lock.unlock();
+
+            if (!data.m_is_resumed)
+                this->push_notification(
+                    {.m_code = Notification_code::session_lost,
+                     .m_severity = Severity::error,
+                     .m_text = "the server did not have it anymore"});
+            else if (lost_messages != 0)
+                this->push_notification(
+                    {.m_code = Notification_code::session_lost,
+                     .m_severity = Severity::error,
+                     .m_text = std::format("{} messages had left the resend buffer", lost_messages)});
+            else
+                this->push_notification(
+                    {.m_code = Notification_code::session_resumed, .m_text = std::to_string(resent_messages)});
+
+            m_has_received_server_data = true;
+
+            if (data.m_is_resumed)
+                m_on_session_resumed.broadcast();
+            else
+                m_on_connected.broadcast();
+        }
+
+        /**
+         *   Resolves the host without blocking, the host can be a name or an ip
+         *
+         *   @param the host
+         *   @param the port or a service name
+         */
+        void async_resolve(std::string host, std::string port)
+        {
+            const uint32_t connection_id = m_connection_id.load(std::memory_order_relaxed);
+
+            m_resolver.async_resolve(
+                host, port,
+                [this, connection_id](asio::error_code error, Protocol::resolver::results_type endpoints) {
+                    // Connect or redirect that started after this one owns the client now
+                    if (connection_id != m_connection_id.load(std::memory_order_relaxed))
+                        return;
+
+                    if (error)
+                        handle_connect_failed(error);
+                    else
+                        async_connect(endpoints);
+                });
+        }
+
+        void async_connect(const Protocol::resolver::results_type& endpoints)
+        {
+            const uint32_t connection_id = m_connection_id.load(std::memory_order_relaxed);
+
+            if (m_connector)
+                m_connector->cancel();
+
+            m_connector =
+                std::make_shared<Happy_eyeballs>(this->next_connection_executor(), m_connection_attempt_delay);
+            m_connector->start(endpoints, [this, connection_id](asio::error_code error, Protocol::socket socket) {
+                if (connection_id != m_connection_id.load(std::memory_order_relaxed))
+                    return;
+
+                if (!error)
+                {
+                    m_connection.store(
+                        this->create_connection(std::move(socket), connection_id, Handshake_type::client),
+                        std::memory_order_release);
+                }
+                else
+                    handle_connect_failed(error);
+            });
+        }
+
+        void async_race(std::vector<Server_address> candidates)
+        {
+            const uint32_t connection_id = m_connection_id.load(std::memory_order_relaxed);
+
+            if (m_server_race)
+                m_server_race->cancel();
+
+            m_server_race = std::make_shared<Server_race>(this->next_connection_executor(), m_connection_attempt_delay);
+            m_server_race->start(
+                candidates, [this, connection_id, candidates](
+                                asio::error_code error, Protocol::socket socket, size_t index,
+                                std::chrono::microseconds connect_time) {
+                    if (connection_id != m_connection_id.load(std::memory_order_relaxed))
+                        return;
+
+                    if (error)
+                    {
+                        handle_connect_failed(error);
+                        return;
+                    }
+
+                    m_reconnect_host = candidates[index].m_host;
+                    m_reconnect_port = candidates[index].m_port;
+
+                    const Selected_server selected_server = {
+                        .m_address = candidates[index], .m_connect_time = connect_time};
+
+                    {
+                        std::lock_guard lock(m_selection_mutex);
+                        m_selected_server = selected_server;
+                        m_selection_candidates = candidates;
+                        m_selection_expiry = std::chrono::steady_clock::now() + m_selection_cache_duration;
+                    }
+
+                    m_connection.store(
+                        this->create_connection(std::move(socket), connection_id, Handshake_type::client),
+                        std::memory_order_release);
+                });
+        }
+
+        bool connect_same_host(std::string_view path, bool use_shared_memory)
+        {
+            m_reconnect_host.clear();
+            start_new_session();
+
+            try
+            {
+                m_has_received_server_data = false;
+                m_is_connection_active = true;
+                async_connect_local(Local_protocol::endpoint(path), use_shared_memory);
+
+                this->start_asio_thread();
+            }
+            catch (const std::exception& exception)
+            {
+                m_is_connection_active = false;
+                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+                return false;
+            }
+
+            return true;
+        }
+
+        void async_connect_local(const Local_protocol::endpoint& endpoint, bool use_shared_memory)
+        {
+            m_temp_local_socket = Local_protocol::socket(this->next_connection_executor());
+            m_temp_local_socket.async_connect(endpoint, [this, use_shared_memory](asio::error_code error) {
+                if (!error)
+                {
+                    auto socket =
+                        this->create_local_socket_interface(std::move(m_temp_local_socket), use_shared_memory);
+                    m_connection.store(
+                        this->create_connection(std::move(socket), m_connection_id, Handshake_type::client),
+                        std::memory_order_release);
+                }
+                else
+                    handle_connect_failed(error);
+            });
+        }
+
+        void handle_connect_failed(const asio::error_code& error)
+        {
+            this->push_notification(
+                {.m_code = Notification_code::connect_failed, .m_severity = Severity::error, .m_error = error});
+
+            if (schedule_reconnect())
+                return;
+
+            m_is_connection_active = false;
+            this->notify_wait();
+        }
+
+        // Triggers the handler of the id or the on message callback for all the received messages
+        void handle_received_messages(size_t max_messages)
+        {
+            for (Owned_message<Id_type>& owned_message : this->pop_received_batch(max_messages))
+                dispatch_message(owned_message);
+        }
+
+        void handle_io_thread_message(Owned_message<Id_type>& owned_message) override
+        {
+            dispatch_message(owned_message);
+        }
+
+        // Gives the message to the handler of its id or the m_on_message
+        void dispatch_message(Owned_message<Id_type>& owned_message)
+        {
+            const Id_type id = owned_message.m_message.get_id();
+            const auto* handler = m_message_handlers.find(id);
+
+            this->run_handler(id, [&] {
+                if (handler != nullptr)
+                    handler->broadcast(std::move(owned_message.m_message));
+                else
+                    m_on_message.broadcast(std::move(owned_message.m_message));
+            });
+        }
+
+        // Answers the hello of the server, the servers that sent none would not understand the answer
+        void send_client_hello(Connection<Id_type>& connection, bool can_resume_session)
+        {
+            const Hello_data& server_hello = *m_server_hello;
+            Hello_data hello = this->create_hello();
+
+            if (this->is_datagram_channel_enabled())
+                hello.m_capabilities.add(Capability::datagram_channel);
+
+            if (can_resume_session)
+                hello.m_capabilities.add(Capability::session_resume);
+
+            hello.m_capabilities.add(Capability::state_replication);
+
+            const Capability_set agreed_capabilities = hello.m_capabilities.intersect(server_hello.m_capabilities);
+
+            connection.send_message(Message_converter<Id_type>::create_hello(Internal_id::client_hello, hello));
+            connection.set_agreed_capabilities(agreed_capabilities);
+            m_on_server_hello.broadcast(server_hello, agreed_capabilities);
+        }
+
+        void handle_server_data(const Server_data& data)
+        {
+            m_remote_id = data.m_client_id;
+
+            // Agrees to the most compact or checked format that both sides allow
+            const Header_format header_format = std::min(data.m_header_format, this->get_header_format());
+
+            // Compression is used only if the client has the same codec that was offered
+            const Compression_settings& compression = this->get_compression_settings();
+            const bool use_compression =
+                data.m_compression_codec != Compression_codec::none && data.m_compression_codec == compression.m_codec;
+
+            const bool use_stream = use_compression && data.m_compression_mode == Compression_mode::stream &&
+                                    compression.m_mode == Compression_mode::stream &&
+                                    data.m_dictionary_hash == compression.dictionary_hash();
+
+            // Reconnected client continues the session of the earlier connection
+            uint64_t resume_token = 0;
+            bool can_resume_session = false;
+
+            {
+                std::lock_guard lock(m_session_mutex);
+                can_resume_session = m_reconnect_settings.has_value();
+
+                if (m_reconnect_settings)
+                    resume_token = m_session_token;
+
+                m_session_token = data.m_session_token;
+                m_is_resuming = resume_token != 0;
+            }
+
+            m_reconnect_attempts = 0;
+
+            const Client_accept_data client_data = {
+                .m_header_format = header_format,
+                .m_compression_codec = use_compression ? data.m_compression_codec : Compression_codec::none,
+                .m_compression_mode = use_stream ? Compression_mode::stream : Compression_mode::per_message,
+                .m_resume_token = resume_token};
+
+            if (const auto connection = get_connection(); connection && connection->is_connected())
+            {
+                // Hello goes before the accept so the server knows the capabilities when it handles the accept
+                if (m_server_hello)
+                    send_client_hello(*connection, can_resume_session);
+
+                connection->send_message(Message_converter<Id_type>::create_client_accept(client_data));
+                connection->set_write_header_format(client_data.m_header_format);
+                connection->set_write_compression(client_data.m_compression_codec, client_data.m_compression_mode);
+            }
+
+            m_server_hello.reset();
+
+            if (data.m_datagram_port != 0 && this->is_datagram_channel_enabled())
+                open_datagram_channel(data);
+
+            if (data.m_multicast_port != 0 && m_is_multicast_enabled)
+                open_multicast(data);
+
+            // Connection is ready when the server has answered the resume
+            if (resume_token != 0)
+                return;
+
+            {
+                std::lock_guard lock(m_session_mutex);
+                resend_from(m_unsent_sequence.value_or(m_next_sequence));
+            }
+
+            m_has_received_server_data = true;
+            m_on_connected.broadcast();
+        }
+
+        /**
+         *   Opens the datagram channel to the port that the server offered and starts the hello, the unreliable
+         *   messages go through the connection until the server has answered it
+         */
+        void open_datagram_channel(const Server_data& data)
+        {
+            const auto connection = get_connection();
+
+            if (connection == nullptr)
+                return;
+
+            const asio::ip::address address = connection->get_address();
+
+            if (address.is_unspecified())
+                return;
+
+            asio::error_code error;
+
+            if (!m_datagram_channel)
+            {
+                m_datagram_channel.emplace(this->get_executor());
+                m_datagram_channel->m_on_hello.set_callback(this, &Client<Id_type>::handle_datagram_hello);
+                m_datagram_channel->m_on_message.set_callback(this, &Client<Id_type>::handle_datagram_message);
+                m_datagram_channel->m_on_reliable.set_callback(this, &Client<Id_type>::handle_reliable_datagram);
+                m_datagram_channel->m_on_error.set_callback(this, &Client<Id_type>::handle_datagram_error);
+            }
+
+            close_datagram_channel();
+
+            {
+                std::lock_guard lock(m_datagram_mutex);
+                m_datagram_server = Datagram_protocol::endpoint(address, data.m_datagram_port);
+                m_datagram_server_information = Client_information(0, address.to_string());
+                m_datagram_prefix = {.m_token = data.m_datagram_token, .m_connection_id = data.m_client_id};
+            }
+
+            const Datagram_protocol protocol = address.is_v6() ? Datagram_protocol::v6() : Datagram_protocol::v4();
+            error = m_datagram_channel->open(Datagram_protocol::endpoint(protocol, 0));
+
+            if (error)
+            {
+                handle_datagram_error(error);
+                return;
+            }
+
+            m_datagram_channel->start_hello(m_datagram_server, m_datagram_prefix);
+        }
+
+        void close_datagram_channel()
+        {
+            if (!m_datagram_channel)
+                return;
+
+            std::lock_guard lock(m_datagram_mutex);
+            m_is_datagram_channel_up = false;
+            m_datagram_channel->close();
+
+            if (auto session = std::exchange(m_datagram_session, nullptr))
+                session->close();
+        }
+
+        // @return false if the message has to go through the connection
+        [[nodiscard]] bool send_datagram(const Message<Id_type>& message, Delivery_mode mode)
+        {
+            if (!Datagram_channel<Id_type>::fits(message, mode))
+                return false;
+
+            std::unique_lock lock(m_datagram_mutex);
+
+            if (!m_is_datagram_channel_up || !m_datagram_session)
+                return false;
+
+            if (mode != Delivery_mode::unreliable)
+            {
+                const std::shared_ptr<Reliable_datagram_session<Id_type>> session = m_datagram_session;
+                lock.unlock();
+
+                session->send(message, mode == Delivery_mode::ordered_datagram);
+                return true;
+            }
+
+            const Datagram_protocol::endpoint endpoint = m_datagram_server;
+            const Datagram_prefix prefix = m_datagram_prefix;
+            lock.unlock();
+
+            m_datagram_channel->send(endpoint, prefix, message);
+            return true;
+        }
+
+        /**
+         *   Only the server knows the token so the sender address is not checked, a server with many addresses
+         *   can answer from another address than the one the client sent to
+         *
+         *   @return true if the datagram came from the server of the current connection
+         */
+        [[nodiscard]] bool is_from_server(const Datagram_prefix& prefix)
+        {
+            std::lock_guard lock(m_datagram_mutex);
+            return prefix.is_same_peer(m_datagram_prefix);
+        }
+
+        // The session is created with the first datagram of the server so it is not used before the hello is answered
+        [[nodiscard]] std::shared_ptr<Reliable_datagram_session<Id_type>> get_datagram_session()
+        {
+            std::lock_guard lock(m_datagram_mutex);
+
+            if (!m_datagram_session)
+                m_datagram_session = std::make_shared<Reliable_datagram_session<Id_type>>(
+                    *m_datagram_channel, m_datagram_server, m_datagram_prefix);
+
+            return m_datagram_session;
+        }
+
+        void handle_datagram_hello(
+            const Datagram_prefix& prefix, [[maybe_unused]] const Datagram_protocol::endpoint& sender)
+        {
+            if (!is_from_server(prefix))
+                return;
+
+            m_datagram_channel->stop_hello();
+
+            std::lock_guard lock(m_datagram_mutex);
+            m_is_datagram_channel_up = true;
+
+            if (!m_datagram_session)
+                m_datagram_session = std::make_shared<Reliable_datagram_session<Id_type>>(
+                    *m_datagram_channel, m_datagram_server, m_datagram_prefix);
+        }
+
+        void handle_datagram_message(
+            const Datagram_prefix& prefix, [[maybe_unused]] const Datagram_protocol::endpoint& sender,
+            Message<Id_type>& message)
+        {
+            if (!is_from_server(prefix))
+                return;
+
+            Client_information server_information;
+            {
+                std::lock_guard lock(m_datagram_mutex);
+                server_information = m_datagram_server_information;
+            }
+
+            this->receive_datagram_message(message, server_information);
+        }
+
+        void handle_reliable_datagram(
+            const Datagram_prefix& prefix, [[maybe_unused]] const Datagram_protocol::endpoint& sender,
+            const Reliable_header& header, Message<Id_type>* message)
+        {
+            if (!is_from_server(prefix))
+                return;
+
+            // Handlers of the channel run on its strand so the vector is not used at the same time
+            m_delivered_datagrams.clear();
+            get_datagram_session()->receive(header, message, m_delivered_datagrams);
+
+            Client_information server_information;
+            {
+                std::lock_guard lock(m_datagram_mutex);
+                server_information = m_datagram_server_information;
+            }
+
+            for (Message<Id_type>& delivered : m_delivered_datagrams)
+                this->receive_datagram_message(delivered, server_information);
+        }
+
+        void handle_datagram_error(const asio::error_code& error)
+        {
+            this->push_notification(
+                {.m_code = Notification_code::datagram_channel_failed,
+                 .m_severity = Severity::error,
+                 .m_error = error});
+        }
+
+        // Joins the group that the server offered, the server answers with the first sequence of the group
+        void open_multicast(const Server_data& data)
+        {
+            const auto connection = get_connection();
+
+            if (connection == nullptr)
+                return;
+
+            const asio::ip::address_v6 group_v6(data.m_multicast_group);
+            const asio::ip::address group =
+                group_v6.is_v4_mapped() ? asio::ip::address(asio::ip::make_address_v4(asio::ip::v4_mapped, group_v6))
+                                        : asio::ip::address(group_v6);
+
+            if (!m_multicast_receiver)
+            {
+                m_multicast_receiver.emplace(this->get_executor());
+                m_multicast_receiver->m_on_message.set_callback(this, &Client<Id_type>::handle_multicast_message);
+                m_multicast_receiver->m_on_nak.set_callback(this, &Client<Id_type>::handle_multicast_nak);
+                m_multicast_receiver->m_on_lost.set_callback(this, &Client<Id_type>::handle_multicast_lost);
+                m_multicast_receiver->m_on_silent.set_callback(this, &Client<Id_type>::handle_multicast_silent);
+                m_multicast_receiver->m_on_error.set_callback(this, &Client<Id_type>::handle_multicast_error);
+            }
+
+            // Closed first so the strand of the receiver does not read the server information while it is set
+            close_multicast();
+            m_multicast_server_information = Client_information(0, connection->get_address().to_string());
+
+            const asio::error_code error = m_multicast_receiver->open(
+                Datagram_protocol::endpoint(group, data.m_multicast_port), data.m_multicast_token, data.m_client_id);
+
+            if (error)
+            {
+                handle_multicast_error(error);
+                return;
+            }
+
+            connection->send_message(Multicast_message<Id_type>::create_join_request());
+        }
+
+        void close_multicast()
+        {
+            if (m_multicast_receiver)
+                m_multicast_receiver->close();
+        }
+
+        // Called from the update thread with the messages of the server that keep the multicast in order
+        void handle_multicast_control(Message<Id_type>& message)
+        {
+            if (!m_multicast_receiver)
+                return;
+
+            uint32_t first_sequence = 0;
+            uint32_t count = 0;
+
+            switch (message.get_internal_id())
+            {
+            case Internal_id::multicast_join:
+                if (const auto first = Multicast_message<Id_type>::extract_join(message))
+                    if (!m_multicast_receiver->start(*first))
+                        send_multicast_message(Multicast_message<Id_type>::create_leave(*first));
+                break;
+            case Internal_id::multicast_repair:
+                first_sequence = Multicast_message<Id_type>::extract_repair(message);
+                m_multicast_receiver->repair(first_sequence, message);
+                break;
+            case Internal_id::multicast_skip:
+                if (Multicast_message<Id_type>::extract_skip(message, first_sequence, count) ==
+                    Multicast_skip_reason::lost)
+                    handle_multicast_lost(count);
+
+                m_multicast_receiver->skip(first_sequence, count);
+                break;
+            default:
+                break;
+            }
+        }
+
+        void send_multicast_message(Message<Id_type> message)
+        {
+            if (const auto connection = get_connection(); connection && connection->is_connected())
+                connection->send_message(std::move(message));
+        }
+
+        // Called in the order of the sequences from the strand of the receiver or the update thread
+        void handle_multicast_message(Message<Id_type>& message)
+        {
+            this->receive_datagram_message(message, m_multicast_server_information);
+        }
+
+        void handle_multicast_nak(uint32_t first_sequence, uint32_t count)
+        {
+            send_multicast_message(Multicast_message<Id_type>::create_nak(first_sequence, count));
+        }
+
+        void handle_multicast_lost(uint32_t count)
+        {
+            this->push_notification(
+                {.m_code = Notification_code::multicast_messages_lost,
+                 .m_severity = Severity::error,
+                 .m_text = std::to_string(count)});
+        }
+
+        // Group no longer reaches the client, the server sends the rest through the connection
+        void handle_multicast_silent(std::optional<uint32_t> next_sequence)
+        {
+            handle_multicast_error(asio::error::timed_out);
+
+            if (next_sequence)
+                send_multicast_message(Multicast_message<Id_type>::create_leave(*next_sequence));
+        }
+
+        void handle_multicast_error(const asio::error_code& error)
+        {
+            this->push_notification(
+                {.m_code = Notification_code::multicast_failed, .m_severity = Severity::error, .m_error = error});
+        }
+
+        // The connection is set from the asio thread and read from the threads that send messages
+        [[nodiscard]] std::shared_ptr<Connection<Id_type>> get_connection() const
+        {
+            return m_connection.load(std::memory_order_acquire);
+        }
+
+        /**
+         *   Connects to the server that the current server redirected the client to. The asio thread keeps running
+         *   so this works also from a coroutine on it, and the new connection gets a new id so the disconnect of the
+         *   old one is ignored. The redirects are counted from the connect so the servers that redirect to each
+         *   other don't keep the client connecting.
+         */
+        void handle_redirect(const Message<Id_type>& message)
+        {
+            Server_address address;
+
+            try
+            {
+                address = Message_converter<Id_type>::extract_redirect(message);
+            }
+            catch (const std::exception&)
+            {
+                return;
+            }
+
+            if (m_redirect_count >= MAX_REDIRECTS)
+            {
+                this->notifications_push_back(
+                    std::format("Too many redirects, not connecting to {}:{}", address.m_host, address.m_port),
+                    Severity::error);
+                disconnect();
+                return;
+            }
+
+            ++m_redirect_count;
+            this->push_notification(
+                {.m_code = Notification_code::client_redirected,
+                 .m_text = std::format("{}:{}", address.m_host, address.m_port)});
+
+            m_connection_id.fetch_add(1, std::memory_order_relaxed);
+            m_reconnect_host = address.m_host;
+            m_reconnect_port = address.m_port;
+
+            // Session was on the server that redirected, the messages not sent yet go to the new server
+            {
+                std::lock_guard lock(m_session_mutex);
+                m_session_token = 0;
+                m_is_session_ready = false;
+
+                if (!m_unsent_sequence)
+                    m_unsent_sequence = m_next_sequence;
+            }
+
+            if (const auto connection = m_connection.exchange(nullptr))
+                connection->disconnect();
+
+            close_datagram_channel();
+            close_multicast();
+
+            try
+            {
+                m_has_received_server_data = false;
+                m_is_connection_active = true;
+                async_resolve(address.m_host, address.m_port);
+            }
+            catch (const std::exception& exception)
+            {
+                m_is_connection_active = false;
+                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+            }
+        }
+
+        // Handles the message that is internal to the framework
+        void handle_internal_message(Owned_message<Id_type> owned_message) override
+        {
+            Message<Id_type>& message = owned_message.m_message;
+
+            switch (message.get_internal_id())
+            {
+            case Internal_id::server_hello:
+                try
+                {
+                    m_server_hello = Message_converter<Id_type>::extract_hello(message);
+                }
+                catch (const std::exception&)
+                {
+                    m_server_hello.reset();
+                }
+                break;
+            case Internal_id::server_accept:
+                handle_server_data(Message_converter<Id_type>::extract_server_accept(message));
+                break;
+            case Internal_id::client_redirect:
+                handle_redirect(message);
+                break;
+            case Internal_id::session_resume:
+                try
+                {
+                    handle_session_resume(Message_converter<Id_type>::extract_session_resume(message));
+                }
+                catch (const std::exception&)
+                {
+                }
+                break;
+            case Internal_id::server_shutdown:
+                this->push_notification({.m_code = Notification_code::server_shutting_down});
+                break;
+            case Internal_id::replication_update:
+                handle_replication_update(message);
+                break;
+            case Internal_id::stream_chunk:
+                if (auto chunk = Stream_chunk<Id_type>::from_message(std::move(message)))
+                    m_on_stream_chunk.broadcast(chunk.value());
+                break;
+            case Internal_id::multicast_join:
+            case Internal_id::multicast_repair:
+            case Internal_id::multicast_skip:
+                handle_multicast_control(message);
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Applies the update and acknowledges it, so the next update is a delta against it
+        void handle_replication_update(const Message<Id_type>& update)
+        {
+            try
+            {
+                Message<Id_type> acknowledgement =
+                    m_state_replica.apply(update, [this](uint32_t object_id, const std::vector<char>* state) {
+                        if (state != nullptr)
+                            m_on_state_changed.broadcast(object_id, std::span<const char>(*state));
+                        else
+                            m_on_state_removed.broadcast(object_id);
+                    });
+
+                if (const auto connection = get_connection(); connection && connection->is_connected())
+                    connection->send_message(std::move(acknowledgement));
+            }
+            catch (const std::exception&)
+            {
+                // Update against a state this client does not have is dropped, the server sends a full one later
+            }
+        }
+
+        Protocol::resolver m_resolver = this->create_resolver();
+        std::shared_ptr<Happy_eyeballs> m_connector;
+        std::chrono::milliseconds m_connection_attempt_delay = Happy_eyeballs::DEFAULT_ATTEMPT_DELAY;
+        std::shared_ptr<Server_race> m_server_race;
+
+        // Choice of the connect_fastest and the candidates it was made from
+        mutable std::mutex m_selection_mutex;
+        std::optional<Selected_server> m_selected_server;
+        std::vector<Server_address> m_selection_candidates;
+        std::chrono::steady_clock::time_point m_selection_expiry;
+        std::chrono::seconds m_selection_cache_duration = std::chrono::minutes(10);
+        Local_protocol::socket m_temp_local_socket = Local_protocol::socket(this->get_executor());
+        std::atomic<std::shared_ptr<Connection<Id_type>>> m_connection;
+        Message_handlers<Id_type, Message<Id_type>> m_message_handlers;
+
+        uint32_t m_remote_id = 0;
+        bool m_has_received_server_data = false;
+
+        // Hello of the server that is answered with the server accept, nullopt if the server sent none
+        std::optional<Hello_data> m_server_hello;
+
+        // Only used from the update
+        State_replica<Id_type> m_state_replica;
+
+        // Redirects since the connect and the id of the current connection, it changes with every redirect
+        static constexpr size_t MAX_REDIRECTS = 4;
+        size_t m_redirect_count = 0;
+        std::atomic<uint32_t> m_connection_id = 0;
+
+        // Host of the last connect or redirect, empty if the connection can't be made again
+        std::string m_reconnect_host;
+        std::string m_reconnect_port;
+        asio::steady_timer m_reconnect_timer = asio::steady_timer(this->get_executor());
+        std::atomic<size_t> m_reconnect_attempts = 0;
+        std::minstd_rand m_jitter_random = std::minstd_rand(std::random_device()());
+
+        struct Resend_entry
+        {
+            Message<Id_type> m_message;
+            Send_options m_options;
+        };
+
+        /**
+         *   Session of the connection and the sent messages kept for the resume, guarded by the mutex because the
+         *   messages can be sent from any thread. Sequence of a message counts the messages of the user sent in
+         *   the session before it, the server tells the same count of the messages it received.
+         */
+        std::mutex m_session_mutex;
+        std::optional<Reconnect_settings> m_reconnect_settings;
+        std::atomic<size_t> m_resend_capacity = 0;
+        uint64_t m_session_token = 0;
+        bool m_is_resuming = false;
+        bool m_is_session_ready = false;
+        std::deque<Resend_entry> m_resend_buffer;
+        uint64_t m_first_resend_sequence = 0;
+        uint64_t m_next_sequence = 0;
+
+        // First message that was kept without sending it, they are sent when the next session starts
+        std::optional<uint64_t> m_unsent_sequence;
+
+        // Server and the prefix of the current connection are guarded by the mutex, the sends read them
+        std::optional<Datagram_channel<Id_type>> m_datagram_channel;
+        std::mutex m_datagram_mutex;
+        Datagram_protocol::endpoint m_datagram_server;
+        Client_information m_datagram_server_information;
+        Datagram_prefix m_datagram_prefix;
+        std::shared_ptr<Reliable_datagram_session<Id_type>> m_datagram_session;
+        std::vector<Message<Id_type>> m_delivered_datagrams;
+        bool m_is_datagram_channel_up = false;
+
+        // Receiver of the group that the server offered, its server information is set before it is opened
+        std::atomic<bool> m_is_multicast_enabled = true;
+        std::optional<Multicast_receiver<Id_type>> m_multicast_receiver;
+        Client_information m_multicast_server_information;
+
+#ifdef NET_ENABLE_QUIC
+        // Holds the resumption ticket of the server between the connects
+        Quic_settings m_quic_settings;
+        std::shared_ptr<Quic_configuration> m_quic_configuration;
+#endif
+
+        // Set by the connect and cleared from the asio thread when the connecting fails or the connection is lost
+        std::atomic<bool> m_is_connection_active = false;
     };
 } // namespace Net
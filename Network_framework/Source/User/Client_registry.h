@@ -0,0 +1,440 @@
+#pragma once
+
+#include "../Connection/Connection.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Connections of the server clients that can be used from any thread. Clients are divided into shards
+     *   that have their own locks, so the lookups from the sending threads rarely wait for each other and
+     *   adding or removing a client only locks one shard.
+     *
+     *   Each shard is a slot map, the connections are in a dense array so going through all of them reads
+     *   linear memory. Client id tells the shard, the slot and the generation of the slot, so finding a client
+     *   is an index and the id of a removed client does not match the client that reuses its slot.
+     *   The ids of the connected clients are also published to lock-free arrays, so the ids of the disconnected
+     *   clients are rejected with two loads and without taking the lock of the shard. A client is unpublished as
+     *   soon as its connection disconnects and erased later on the update thread, the broadcasts go through the
+     *   for_each_connected that skips it from the published ids without touching its connection.
+     */
+    template <Id_concept Id_type>
+    class Client_registry
+    {
+    public:
+        using Connection_ptr = std::shared_ptr<Connection<Id_type>>;
+
+        Client_registry() = default;
+
+        Client_registry(const Client_registry&) = delete;
+        Client_registry(Client_registry&&) = delete;
+
+        ~Client_registry() = default;
+
+        Client_registry& operator=(const Client_registry&) = delete;
+        Client_registry& operator=(Client_registry&&) = delete;
+
+        /**
+         *   Reserves an id for a new client, the id is never 0. It has to be given to the insert
+         *   or released with the erase.
+         *
+         *   @return the id or nothing if the shard has no free slots
+         */
+        [[nodiscard]] std::optional<uint32_t> reserve()
+        {
+            const uint32_t shard_index = m_next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+            Shard& shard = m_shards[shard_index];
+            std::scoped_lock lock(shard.m_mutex);
+
+            uint32_t slot_index = 0;
+
+            if (!shard.m_free_slots.empty())
+            {
+                slot_index = shard.m_free_slots.back();
+                shard.m_free_slots.pop_back();
+            }
+            else if (shard.m_slots.size() < MAX_SLOTS_PER_SHARD)
+            {
+                slot_index = static_cast<uint32_t>(shard.m_slots.size());
+                shard.m_slots.push_back({});
+            }
+            else
+                return std::nullopt;
+
+            Slot& slot = shard.m_slots[slot_index];
+            slot.m_dense_index = RESERVED;
+
+            return make_id(shard_index, slot_index, slot.m_generation);
+        }
+
+        /**
+         *   Reserves the given id, for example for a client that was handed over from another process so it keeps
+         *   its id. It has to be given to the insert or released with the erase.
+         *
+         *   @return false if the slot of the id is in use
+         */
+        [[nodiscard]] bool reserve(uint32_t client_id)
+        {
+            const uint32_t slot_index = get_slot_index(client_id);
+            Shard& shard = get_shard(client_id);
+            std::scoped_lock lock(shard.m_mutex);
+
+            if (get_generation(client_id) == 0)
+                return false;
+
+            // Slots before the id are created as free slots
+            while (shard.m_slots.size() <= slot_index)
+            {
+                shard.m_free_slots.push_back(static_cast<uint32_t>(shard.m_slots.size()));
+                shard.m_slots.push_back({});
+            }
+
+            const auto free_slot = std::ranges::find(shard.m_free_slots, slot_index);
+
+            if (free_slot == shard.m_free_slots.end())
+                return false;
+
+            shard.m_free_slots.erase(free_slot);
+
+            Slot& slot = shard.m_slots[slot_index];
+            slot.m_generation = get_generation(client_id);
+            slot.m_dense_index = RESERVED;
+
+            return true;
+        }
+
+        // @return false if the id is not reserved, for example it was released before the connection was ready
+        [[nodiscard]] bool insert(uint32_t client_id, Connection_ptr connection)
+        {
+            Shard& shard = get_shard(client_id);
+            std::scoped_lock lock(shard.m_mutex);
+
+            Slot* slot = shard.find_slot(client_id);
+
+            if (slot == nullptr || slot->m_dense_index != RESERVED)
+                return false;
+
+            std::atomic<uint32_t>& live_id = shard.get_live_id(get_slot_index(client_id));
+
+            slot->m_dense_index = static_cast<uint32_t>(shard.m_connections.size());
+            shard.m_connections.push_back(std::move(connection));
+            shard.m_dense_slots.push_back(get_slot_index(client_id));
+            live_id.store(client_id, std::memory_order_release);
+
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         *   Removes the client or releases the reserved id, the slot can then be reused
+         *
+         *   @return the removed connection or nullptr if there was no client with the id
+         */
+        Connection_ptr erase(uint32_t client_id)
+        {
+            Shard& shard = get_shard(client_id);
+            std::scoped_lock lock(shard.m_mutex);
+
+            Slot* slot = shard.find_slot(client_id);
+
+            if (slot == nullptr || slot->m_dense_index == FREE)
+                return nullptr;
+
+            Connection_ptr connection = nullptr;
+
+            if (slot->m_dense_index != RESERVED)
+            {
+                // Last connection is moved to the place of the removed one so the array stays dense
+                const uint32_t dense_index = slot->m_dense_index;
+                connection = std::move(shard.m_connections[dense_index]);
+
+                shard.m_connections[dense_index] = std::move(shard.m_connections.back());
+                shard.m_dense_slots[dense_index] = shard.m_dense_slots.back();
+                shard.m_slots[shard.m_dense_slots[dense_index]].m_dense_index = dense_index;
+
+                shard.m_connections.pop_back();
+                shard.m_dense_slots.pop_back();
+                shard.get_live_id(get_slot_index(client_id)).store(0, std::memory_order_release);
+
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            slot->m_dense_index = FREE;
+            slot->m_generation = slot->m_generation % MAX_GENERATION + 1;
+            shard.m_free_slots.push_back(get_slot_index(client_id));
+
+            return connection;
+        }
+
+        /**
+         *   Unpublishes the id of the client whose connection has disconnected, so the lookups and the
+         *   for_each_connected skip it until it is erased. Takes no lock, so this can be called from any thread
+         *   and even from inside the for_each.
+         */
+        void mark_disconnected(uint32_t client_id) noexcept
+        {
+            const uint32_t slot_index = get_slot_index(client_id);
+            std::atomic<uint32_t>* chunk =
+                get_shard(client_id).m_live_id_chunks[slot_index / LIVE_ID_CHUNK_SIZE].load(std::memory_order_acquire);
+
+            if (chunk == nullptr)
+                return;
+
+            // Slot may already belong to a newer client
+            uint32_t expected = client_id;
+            chunk[slot_index % LIVE_ID_CHUNK_SIZE].compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+        }
+
+        /**
+         *   Checks the id without locking, the client can disconnect right after this returns true
+         *
+         *   @return true if the client of the id is connected
+         */
+        [[nodiscard]] bool contains(uint32_t client_id) const noexcept
+        {
+            const uint32_t slot_index = get_slot_index(client_id);
+            const std::atomic<uint32_t>* chunk =
+                get_shard(client_id).m_live_id_chunks[slot_index / LIVE_ID_CHUNK_SIZE].load(std::memory_order_acquire);
+
+            return chunk != nullptr &&
+                   chunk[slot_index % LIVE_ID_CHUNK_SIZE].load(std::memory_order_acquire) == client_id;
+        }
+
+        // @return the connection or nullptr if there is no client with the id
+        [[nodiscard]] Connection_ptr find(uint32_t client_id) const
+        {
+            // Ids of the disconnected clients don't wait for the lock
+            if (!contains(client_id))
+                return nullptr;
+
+            const Shard& shard = get_shard(client_id);
+            std::shared_lock lock(shard.m_mutex);
+
+            const Slot* slot = shard.find_slot(client_id);
+
+            if (slot == nullptr || slot->m_dense_index == FREE || slot->m_dense_index == RESERVED)
+                return nullptr;
+
+            return shard.m_connections[slot->m_dense_index];
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_size.load(std::memory_order_relaxed);
+        }
+
+        /**
+         *   Calls the callable with every connection. Only one shard is locked at a time so the clients
+         *   added or removed meanwhile may or may not be seen. The callable must not modify the registry.
+         *
+         *   @param callable that takes const Connection_ptr&
+         */
+        template <typename Callable_type>
+        void for_each(Callable_type&& callable) const
+        {
+            for (const Shard& shard : m_shards)
+            {
+                std::shared_lock lock(shard.m_mutex);
+
+                for (const Connection_ptr& connection : shard.m_connections)
+                    callable(connection);
+            }
+        }
+
+        /**
+         *   Calls the callable with every client that has not disconnected, see the for_each. The clients are
+         *   checked from the published ids in the order of the dense array, so the connections of the
+         *   disconnected clients are never read.
+         *
+         *   @param callable that takes the client id and const Connection_ptr&
+         */
+        template <typename Callable_type>
+        void for_each_connected(Callable_type&& callable) const
+        {
+            for (size_t i = 0; i < SHARD_COUNT; ++i)
+                for_each_connected_in_shard(i, callable);
+        }
+
+        /**
+         *   Calls the callable with the connected clients of one shard, so the shards can be gone through on
+         *   different threads, see the for_each_connected
+         *
+         *   @param index of the shard, less than the get_shard_count
+         *   @param callable that takes the client id and const Connection_ptr&
+         */
+        template <typename Callable_type>
+        void for_each_connected_in_shard(size_t shard_index, Callable_type&& callable) const
+        {
+            const Shard& shard = m_shards[shard_index];
+            std::shared_lock lock(shard.m_mutex);
+
+            for (size_t i = 0; i < shard.m_connections.size(); ++i)
+            {
+                // Inserted slots always have their chunk
+                const uint32_t slot_index = shard.m_dense_slots[i];
+                const std::atomic<uint32_t>* chunk =
+                    shard.m_live_id_chunks[slot_index / LIVE_ID_CHUNK_SIZE].load(std::memory_order_relaxed);
+                const uint32_t client_id = chunk[slot_index % LIVE_ID_CHUNK_SIZE].load(std::memory_order_acquire);
+
+                if (client_id != 0)
+                    callable(client_id, shard.m_connections[i]);
+            }
+        }
+
+        [[nodiscard]] static constexpr size_t get_shard_count() noexcept
+        {
+            return SHARD_COUNT;
+        }
+
+        /**
+         *   Presizes the shards so adding the clients does not grow their arrays, the clients are spread evenly
+         *   over the shards
+         *
+         *   @param the amount of clients
+         */
+        void reserve_capacity(size_t client_count)
+        {
+            const size_t shard_capacity =
+                std::min<size_t>((client_count + SHARD_COUNT - 1) / SHARD_COUNT, MAX_SLOTS_PER_SHARD);
+
+            for (Shard& shard : m_shards)
+            {
+                std::scoped_lock lock(shard.m_mutex);
+
+                shard.m_slots.reserve(shard_capacity);
+                shard.m_free_slots.reserve(shard_capacity);
+                shard.m_connections.reserve(shard_capacity);
+                shard.m_dense_slots.reserve(shard_capacity);
+            }
+        }
+
+    private:
+        // Id has the generation in the high bits, then the slot and the shard in the low bits
+        static constexpr uint32_t SHARD_BITS = 4;
+        static constexpr uint32_t SLOT_BITS = 16;
+        static constexpr uint32_t GENERATION_BITS = 32 - SHARD_BITS - SLOT_BITS;
+
+        static constexpr uint32_t SHARD_COUNT = 1 << SHARD_BITS;
+        static constexpr uint32_t MAX_SLOTS_PER_SHARD = 1 << SLOT_BITS;
+        static constexpr uint32_t MAX_GENERATION = (1 << GENERATION_BITS) - 1;
+
+        // Live ids are allocated in chunks as the shard grows, so the small servers don't pay for all the slots
+        static constexpr uint32_t LIVE_ID_CHUNK_SIZE = 1024;
+        static constexpr uint32_t LIVE_ID_CHUNK_COUNT = MAX_SLOTS_PER_SHARD / LIVE_ID_CHUNK_SIZE;
+
+        static constexpr uint32_t FREE = std::numeric_limits<uint32_t>::max();
+        static constexpr uint32_t RESERVED = FREE - 1;
+
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        struct Slot
+        {
+            // Starts from 1 so the ids are never 0
+            uint32_t m_generation = 1;
+            uint32_t m_dense_index = FREE;
+        };
+
+        // Shards are on their own cache lines so the locks of the different shards don't share one
+        struct alignas(CACHE_LINE_SIZE) Shard
+        {
+            Shard() = default;
+
+            Shard(const Shard&) = delete;
+            Shard(Shard&&) = delete;
+
+            ~Shard()
+            {
+                for (std::atomic<std::atomic<uint32_t>*>& chunk : m_live_id_chunks)
+                    delete[] chunk.load(std::memory_order_relaxed);
+            }
+
+            Shard& operator=(const Shard&) = delete;
+            Shard& operator=(Shard&&) = delete;
+
+            // @return the slot if the id has its generation
+            [[nodiscard]] Slot* find_slot(uint32_t client_id) noexcept
+            {
+                const uint32_t slot_index = get_slot_index(client_id);
+
+                if (slot_index >= m_slots.size() || m_slots[slot_index].m_generation != get_generation(client_id))
+                    return nullptr;
+
+                return &m_slots[slot_index];
+            }
+
+            [[nodiscard]] const Slot* find_slot(uint32_t client_id) const noexcept
+            {
+                return const_cast<Shard*>(this)->find_slot(client_id);
+            }
+
+            // @return the published id of the slot, its chunk is created if needed. The lock must be held.
+            [[nodiscard]] std::atomic<uint32_t>& get_live_id(uint32_t slot_index)
+            {
+                std::atomic<std::atomic<uint32_t>*>& chunk = m_live_id_chunks[slot_index / LIVE_ID_CHUNK_SIZE];
+                std::atomic<uint32_t>* live_ids = chunk.load(std::memory_order_relaxed);
+
+                if (live_ids == nullptr)
+                {
+                    live_ids = new std::atomic<uint32_t>[LIVE_ID_CHUNK_SIZE]();
+                    chunk.store(live_ids, std::memory_order_release);
+                }
+
+                return live_ids[slot_index % LIVE_ID_CHUNK_SIZE];
+            }
+
+            mutable std::shared_mutex m_mutex;
+            std::vector<Slot> m_slots;
+            std::vector<uint32_t> m_free_slots;
+
+            // Connections and the slots they belong to in the same order
+            std::vector<Connection_ptr> m_connections;
+            std::vector<uint32_t> m_dense_slots;
+
+            // Id of the connected client in each slot or 0, read without the lock
+            std::array<std::atomic<std::atomic<uint32_t>*>, LIVE_ID_CHUNK_COUNT> m_live_id_chunks = {};
+        };
+
+        [[nodiscard]] static constexpr uint32_t make_id(uint32_t shard, uint32_t slot, uint32_t generation) noexcept
+        {
+            return generation << (SHARD_BITS + SLOT_BITS) | slot << SHARD_BITS | shard;
+        }
+
+        [[nodiscard]] static constexpr uint32_t get_shard_index(uint32_t client_id) noexcept
+        {
+            return client_id & (SHARD_COUNT - 1);
+        }
+
+        [[nodiscard]] static constexpr uint32_t get_slot_index(uint32_t client_id) noexcept
+        {
+            return (client_id >> SHARD_BITS) & (MAX_SLOTS_PER_SHARD - 1);
+        }
+
+        [[nodiscard]] static constexpr uint32_t get_generation(uint32_t client_id) noexcept
+        {
+            return client_id >> (SHARD_BITS + SLOT_BITS);
+        }
+
+        [[nodiscard]] Shard& get_shard(uint32_t client_id) noexcept
+        {
+            return m_shards[get_shard_index(client_id)];
+        }
+
+        [[nodiscard]] const Shard& get_shard(uint32_t client_id) const noexcept
+        {
+            return m_shards[get_shard_index(client_id)];
+        }
+
+        std::array<Shard, SHARD_COUNT> m_shards;
+        std::atomic<uint32_t> m_next_shard = 0;
+        std::atomic<size_t> m_size = 0;
+    };
+} // namespace Net
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "../Utility/Latency_histogram.h"
+#include "Client.h"
+#include "Io_runtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace Net
+{
+    // Messages of one id that the swarm sends, the body sizes are uniform between the min and the max
+    template <Id_concept Id_type>
+    struct Swarm_message_pattern
+    {
+        Id_type m_id{};
+
+        // Share of the sent messages relative to the weights of the other patterns
+        double m_weight = 1.0;
+
+        size_t m_min_size = 0;
+        size_t m_max_size = 0;
+    };
+
+    // How the sends of each client are spaced
+    enum class Swarm_send_timing : uint8_t
+    {
+        // Same interval between every send, the clients start at random phases so they don't send together
+        fixed,
+
+        // Random exponential intervals like independent users, the average rate is the same
+        poisson
+    };
+
+    template <Id_concept Id_type>
+    struct Client_swarm_settings
+    {
+        size_t m_clients = 100;
+
+        // Threads that run the Asio of all the clients
+        size_t m_io_threads = 1;
+
+        // Messages that each client sends in a second, 0 only connects the clients and keeps them idle
+        double m_messages_per_second = 10.0;
+        Swarm_send_timing m_send_timing = Swarm_send_timing::poisson;
+
+        // What the clients send, empty sends nothing
+        std::vector<Swarm_message_pattern<Id_type>> m_messages;
+
+        // Ids the server sends to the clients, their replies are read and dropped
+        std::vector<Id_type> m_reply_ids;
+
+        // Clients that start connecting in a second so the accept backlog of the server is not flooded, 0 connects
+        // them all at once
+        double m_connects_per_second = 0.0;
+        std::chrono::seconds m_connect_timeout = std::chrono::seconds(30);
+
+        // How long the clients send after they have connected
+        std::chrono::seconds m_duration = std::chrono::seconds(10);
+
+        // How long the replies are read after the sending has ended before the clients disconnect
+        std::chrono::seconds m_drain_time = std::chrono::seconds(1);
+
+        // Seed of the send times, the ids and the sizes so the same load can be repeated
+        uint64_t m_seed = 0;
+    };
+
+    struct Client_swarm_results
+    {
+        size_t m_clients = 0;
+        size_t m_failed_clients = 0;
+
+        // Connected clients that had lost their connection by the end
+        size_t m_lost_clients = 0;
+
+        uint64_t m_sent_messages = 0;
+        uint64_t m_sent_bytes = 0;
+        uint64_t m_received_messages = 0;
+
+        // Traffic of all the connected clients, including the internal messages of the framework
+        Traffic_metrics m_traffic;
+
+        std::chrono::nanoseconds m_duration = std::chrono::nanoseconds(0);
+
+        // How late the messages were sent compared to their scheduled time
+        Latency_percentiles m_send_lag;
+
+        // Latest round trip of each connected client that had measured one
+        Latency_percentiles m_round_trip_times;
+    };
+
+    /**
+     *   Drives thousands of clients from a few Asio threads to load test a server. The clients share one
+     *   Io_runtime and the calling thread sends their messages at the scheduled times, so the load needs one
+     *   process instead of one for each client. Each client sends the messages of the patterns with the average
+     *   rate of the settings, and the results have the counters of the whole swarm.
+     *
+     *   Client_swarm<Message_id> swarm({.m_clients = 5000, .m_io_threads = 4, .m_messages = {{Message_id::move}}});
+     *   const auto results = swarm.run([](Client<Message_id>& client) { return client.connect("host", "1234"); });
+     */
+    template <Id_concept Id_type, typename Client_type = Client<Id_type>>
+    class Client_swarm
+    {
+    public:
+        // Called for every client before it connects so the client can be set up, for example its tls verification
+        using Client_setup = std::function<void(Client_type&)>;
+
+        // Starts connecting the client, false if it could not start
+        using Client_connector = std::function<bool(Client_type&)>;
+
+        /**
+         *   Makes the body of a message, the default leaves the bytes zero
+         *
+         *   @param the index of the sending client
+         *   @param the pattern of the message
+         *   @param the chosen size of the body
+         *   @param the message with the id of the pattern, the body has to be pushed to it
+         */
+        using Message_factory =
+            std::function<void(size_t, const Swarm_message_pattern<Id_type>&, size_t, Message<Id_type>&)>;
+
+        // @throws std::invalid_argument if the weights of the patterns are negative or all zero
+        explicit Client_swarm(Client_swarm_settings<Id_type> settings) : m_settings(std::move(settings))
+        {
+            std::vector<double> weights;
+
+            for (const Swarm_message_pattern<Id_type>& pattern : m_settings.m_messages)
+            {
+                if (pattern.m_weight < 0.0)
+                    throw std::invalid_argument("Negative weight of a message pattern");
+
+                weights.push_back(pattern.m_weight);
+            }
+
+            if (!weights.empty() && std::ranges::all_of(weights, [](double weight) { return weight == 0.0; }))
+                throw std::invalid_argument("Every message pattern has zero weight");
+
+            if (!weights.empty())
+                m_pattern_distribution = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+        }
+
+        Client_swarm(const Client_swarm&) = delete;
+        Client_swarm(Client_swarm&&) = delete;
+
+        ~Client_swarm() = default;
+
+        Client_swarm& operator=(const Client_swarm&) = delete;
+        Client_swarm& operator=(Client_swarm&&) = delete;
+
+        void set_client_setup(Client_setup setup)
+        {
+            m_client_setup = std::move(setup);
+        }
+
+        void set_message_factory(Message_factory factory)
+        {
+            m_message_factory = std::move(factory);
+        }
+
+        /**
+         *   Connects the clients, sends for the duration and disconnects them. This blocks until the run is done.
+         *
+         *   @param connects each client
+         */
+        Client_swarm_results run(const Client_connector& connect)
+        {
+            Client_swarm_results results;
+            m_random.seed(m_settings.m_seed);
+
+            connect_clients(connect, results);
+
+            const auto start_time = std::chrono::steady_clock::now();
+            const auto end_time = start_time + m_settings.m_duration;
+            auto next_drain_time = start_time;
+
+            schedule_first_sends(start_time);
+
+            while (!m_send_queue.empty() && m_send_queue.top().m_time < end_time)
+            {
+                const Scheduled_send send = m_send_queue.top();
+                m_send_queue.pop();
+
+                wait_until(send.m_time, next_drain_time, results);
+
+                Client_type& client = *m_clients[send.m_client_index];
+
+                // Lost clients stop sending
+                if (!client.is_connected())
+                    continue;
+
+                m_send_lag.record(std::chrono::steady_clock::now() - send.m_time);
+
+                Message<Id_type> message = make_message(send.m_client_index);
+                results.m_sent_bytes += message.body_size();
+                ++results.m_sent_messages;
+                client.send_message(std::move(message));
+
+                m_send_queue.push({.m_time = send.m_time + next_interval(), .m_client_index = send.m_client_index});
+            }
+
+            wait_until(end_time, next_drain_time, results);
+            results.m_duration = std::chrono::steady_clock::now() - start_time;
+
+            wait_until(std::chrono::steady_clock::now() + m_settings.m_drain_time, next_drain_time, results);
+            collect_results(results);
+            disconnect_clients();
+
+            return results;
+        }
+
+    private:
+        // The replies are read this often so the in queues of the clients don't grow
+        static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(10);
+
+        struct Scheduled_send
+        {
+            std::chrono::steady_clock::time_point m_time;
+            size_t m_client_index = 0;
+
+            // Earliest send on the top of the queue
+            [[nodiscard]] bool operator>(const Scheduled_send& other) const noexcept
+            {
+                return m_time > other.m_time;
+            }
+        };
+
+        void connect_clients(const Client_connector& connect, Client_swarm_results& results)
+        {
+            m_runtime = std::make_shared<Io_runtime>(m_settings.m_io_threads);
+            std::vector<std::unique_ptr<Client_type>> clients;
+
+            const auto connect_start = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < m_settings.m_clients; ++i)
+            {
+                if (m_settings.m_connects_per_second > 0.0)
+                {
+                    const std::chrono::duration<double> delay(
+                        static_cast<double>(i) / m_settings.m_connects_per_second);
+                    std::this_thread::sleep_until(
+                        connect_start + std::chrono::duration_cast<std::chrono::nanoseconds>(delay));
+                }
+
+                auto client = std::make_unique<Client_type>(m_runtime);
+
+                for (const Id_type id : m_settings.m_reply_ids)
+                    client->add_accepted_message(id);
+
+                if (m_client_setup)
+                    m_client_setup(*client);
+
+                if (connect(*client))
+                    clients.push_back(std::move(client));
+            }
+
+            const auto connect_end_time = std::chrono::steady_clock::now() + m_settings.m_connect_timeout;
+
+            while (std::chrono::steady_clock::now() < connect_end_time &&
+                   std::ranges::any_of(clients, [](const auto& client) { return client->is_connecting(); }))
+            {
+                for (const auto& client : clients)
+                    static_cast<void>(client->update_batch());
+
+                std::this_thread::sleep_for(DRAIN_INTERVAL);
+            }
+
+            // Only the connected clients send
+            for (auto& client : clients)
+                if (client->is_connected())
+                    m_clients.push_back(std::move(client));
+
+            results.m_clients = m_settings.m_clients;
+            results.m_failed_clients = m_settings.m_clients - m_clients.size();
+
+            // Clients that failed are destroyed before the runtime that runs them
+            clients.clear();
+        }
+
+        void schedule_first_sends(std::chrono::steady_clock::time_point start_time)
+        {
+            if (m_settings.m_messages_per_second <= 0.0 || m_settings.m_messages.empty())
+                return;
+
+            for (size_t i = 0; i < m_clients.size(); ++i)
+            {
+                // Fixed timing starts at a random phase of the interval, poisson is memoryless from the start
+                const std::chrono::nanoseconds first_interval =
+                    m_settings.m_send_timing == Swarm_send_timing::fixed
+                        ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              get_interval() * std::uniform_real_distribution<double>(0.0, 1.0)(m_random))
+                        : next_interval();
+
+                m_send_queue.push({.m_time = start_time + first_interval, .m_client_index = i});
+            }
+        }
+
+        [[nodiscard]] std::chrono::duration<double> get_interval() const noexcept
+        {
+            return std::chrono::duration<double>(1.0 / m_settings.m_messages_per_second);
+        }
+
+        [[nodiscard]] std::chrono::nanoseconds next_interval()
+        {
+            std::chrono::duration<double> interval = get_interval();
+
+            if (m_settings.m_send_timing == Swarm_send_timing::poisson)
+                interval = std::chrono::duration<double>(
+                    std::exponential_distribution<double>(m_settings.m_messages_per_second)(m_random));
+
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(interval);
+        }
+
+        [[nodiscard]] Message<Id_type> make_message(size_t client_index)
+        {
+            const Swarm_message_pattern<Id_type>& pattern = m_settings.m_messages[m_pattern_distribution(m_random)];
+            const size_t size = std::uniform_int_distribution<size_t>(
+                pattern.m_min_size, std::max(pattern.m_min_size, pattern.m_max_size))(m_random);
+
+            Message<Id_type> message;
+            message.set_id(pattern.m_id);
+
+            if (m_message_factory)
+                m_message_factory(client_index, pattern, size, message);
+            else
+                message.resize_body(size);
+
+            return message;
+        }
+
+        // Reads the replies while waiting
+        void wait_until(
+            std::chrono::steady_clock::time_point time, std::chrono::steady_clock::time_point& next_drain_time,
+            Client_swarm_results& results)
+        {
+            while (std::chrono::steady_clock::now() < time)
+            {
+                if (std::chrono::steady_clock::now() >= next_drain_time)
+                    drain_clients(next_drain_time, results);
+
+                std::this_thread::sleep_until(std::min(time, next_drain_time));
+            }
+
+            if (std::chrono::steady_clock::now() >= next_drain_time)
+                drain_clients(next_drain_time, results);
+        }
+
+        void drain_clients(std::chrono::steady_clock::time_point& next_drain_time, Client_swarm_results& results)
+        {
+            for (const auto& client : m_clients)
+                results.m_received_messages += client->update_batch().size();
+
+            next_drain_time = std::chrono::steady_clock::now() + DRAIN_INTERVAL;
+        }
+
+        void collect_results(Client_swarm_results& results)
+        {
+            Latency_histogram round_trip_times;
+
+            for (const auto& client : m_clients)
+            {
+                if (!client->is_connected())
+                    ++results.m_lost_clients;
+
+                results.m_traffic += client->get_metrics().m_traffic;
+
+                if (const std::optional<std::chrono::microseconds> round_trip_time = client->get_round_trip_time())
+                    round_trip_times.record(*round_trip_time);
+            }
+
+            results.m_send_lag = m_send_lag.get_percentiles();
+            results.m_round_trip_times = round_trip_times.get_percentiles();
+        }
+
+        void disconnect_clients()
+        {
+            for (const auto& client : m_clients)
+                client->disconnect();
+
+            // Clients are destroyed before the runtime that runs them, from this thread that is not one of its
+            m_clients.clear();
+            m_runtime.reset();
+        }
+
+        Client_swarm_settings<Id_type> m_settings;
+        Client_setup m_client_setup;
+        Message_factory m_message_factory;
+
+        std::shared_ptr<Io_runtime> m_runtime;
+        std::vector<std::unique_ptr<Client_type>> m_clients;
+
+        std::priority_queue<Scheduled_send, std::vector<Scheduled_send>, std::greater<>> m_send_queue;
+        std::mt19937_64 m_random;
+        std::discrete_distribution<size_t> m_pattern_distribution;
+
+        Latency_histogram m_send_lag;
+    };
+} // namespace Net
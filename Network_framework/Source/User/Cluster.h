@@ -0,0 +1,317 @@
+#pragma once
+
+#include "../Message/Cluster_message.h"
+#include "../Utility/Rendezvous_hash.h"
+#include "Client.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace Net
+{
+    struct Cluster_settings
+    {
+        // Id of this node that the other nodes route to
+        uint32_t m_node_id = 0;
+
+        // Same on every node of the cluster, links with another key are disconnected
+        uint64_t m_cluster_key = 0;
+
+        // Publishes to a node are sent when their batch reaches this size, the rest are sent in the next update.
+        // Clamped to the Cluster_message::MAX_PUBLISH_BATCH_SIZE.
+        size_t m_max_batch_bytes = 64 * 1024;
+
+        // How often the lost links to the other nodes are connected again
+        std::chrono::milliseconds m_reconnect_interval = std::chrono::seconds(1);
+    };
+
+    /**
+     *   Links of the server to the other nodes of the cluster. Every node connects to the others with its own
+     *   Client, so a link only carries messages from this node and the messages from the other nodes arrive
+     *   through their links to the server of this node. Those are normal clients of the server until they send
+     *   the hello, then they are peers and their routed messages and publishes are accepted.
+     *   Can be used from any thread except the add_node, remove_node and update.
+     */
+    template <Id_concept Id_type>
+    class Cluster
+    {
+    public:
+        Cluster()
+        {
+            m_placement.add_node(m_settings.m_node_id);
+        }
+
+        Cluster(const Cluster&) = delete;
+        Cluster(Cluster&&) = delete;
+
+        ~Cluster() = default;
+
+        Cluster& operator=(const Cluster&) = delete;
+        Cluster& operator=(Cluster&&) = delete;
+
+        // This should be set before any nodes are added
+        void set_settings(const Cluster_settings& settings)
+        {
+            std::unique_lock lock(m_links_mutex);
+
+            m_placement.remove_node(m_settings.m_node_id);
+            m_settings = settings;
+            m_placement.add_node(m_settings.m_node_id);
+        }
+
+        [[nodiscard]] const Cluster_settings& get_settings() const noexcept
+        {
+            return m_settings;
+        }
+
+        /**
+         *   Starts connecting to the server of the other node, the link is connected again whenever it is lost
+         *
+         *   @throws if the host or the port is too long to redirect the clients to, see the Server_address
+         *   @return false if the node is this node or it was already added
+         */
+        bool add_node(uint32_t node_id, std::string host, std::string port)
+        {
+            if (host.size() > Server_address::MAX_HOST_SIZE || port.size() > Server_address::MAX_PORT_SIZE)
+                throw std::length_error("Address of the node is too long");
+
+            if (node_id == m_settings.m_node_id)
+                return false;
+
+            auto link = std::make_unique<Link>();
+            link->m_host = std::move(host);
+            link->m_port = std::move(port);
+            link->m_client.m_on_connected.set_callback([this, link = link.get()]() { on_link_connected(*link); });
+
+            Link& added_link = *link;
+
+            {
+                std::unique_lock lock(m_links_mutex);
+
+                if (!m_links.emplace(node_id, std::move(link)).second)
+                    return false;
+
+                m_placement.add_node(node_id);
+            }
+
+            connect(added_link, std::chrono::steady_clock::now());
+            return true;
+        }
+
+        // Disconnects the link to the node, the messages still in its batch are dropped
+        void remove_node(uint32_t node_id)
+        {
+            std::unique_ptr<Link> removed_link;
+
+            {
+                std::unique_lock lock(m_links_mutex);
+                const auto link = m_links.find(node_id);
+
+                if (link == m_links.end())
+                    return;
+
+                removed_link = std::move(link->second);
+                m_links.erase(link);
+                m_placement.remove_node(node_id);
+            }
+
+            // Client stops its asio thread when it is destroyed, so it is done without the lock
+            removed_link.reset();
+        }
+
+        // @return true if the messages to the node are sent, false while its link is being connected
+        [[nodiscard]] bool is_node_connected(uint32_t node_id) const
+        {
+            std::shared_lock lock(m_links_mutex);
+
+            const auto link = m_links.find(node_id);
+            return link != m_links.end() && link->second->m_is_ready;
+        }
+
+        /**
+         *   Finds the node of the key from all the added nodes and this node, whether their links are connected
+         *   or not, so the nodes that have the same nodes agree on it
+         */
+        [[nodiscard]] std::optional<uint32_t> find_node(uint64_t key) const
+        {
+            std::shared_lock lock(m_links_mutex);
+            return m_placement.find(key);
+        }
+
+        // @return the address of the server of the node or nothing if the node has not been added
+        [[nodiscard]] std::optional<Server_address> get_node_address(uint32_t node_id) const
+        {
+            std::shared_lock lock(m_links_mutex);
+            const auto link = m_links.find(node_id);
+
+            if (link == m_links.end())
+                return std::nullopt;
+
+            return Server_address{.m_host = link->second->m_host, .m_port = link->second->m_port};
+        }
+
+        /**
+         *   Sends the message to the client of the other node
+         *
+         *   @return false if the node is not connected, the message is then dropped
+         */
+        bool send_to_node(uint32_t node_id, uint32_t client_id, Message<Id_type> message)
+        {
+            std::shared_lock lock(m_links_mutex);
+            const auto link = m_links.find(node_id);
+
+            if (link == m_links.end() || !link->second->m_is_ready)
+                return false;
+
+            link->second->m_client.send_message(Cluster_message<Id_type>::create_route(std::move(message), client_id));
+            return true;
+        }
+
+        /**
+         *   Adds the message to the publish batch of every connected node, each node publishes it to its own
+         *   subscribers of the topic. The nodes disconnect the link if the message is not in their accepted limits.
+         */
+        void publish(uint64_t topic, const Message<Id_type>& message)
+        {
+            std::shared_lock lock(m_links_mutex);
+
+            // Batch is sent before the message if it would grow over the max, so only a larger message goes over it
+            const size_t max_batch_bytes =
+                std::min(m_settings.m_max_batch_bytes, Cluster_message<Id_type>::MAX_PUBLISH_BATCH_SIZE);
+
+            for (auto& [node_id, link] : m_links)
+            {
+                if (!link->m_is_ready)
+                    continue;
+
+                std::scoped_lock batch_lock(link->m_batch_mutex);
+
+                if (link->m_batch.body_size() + Cluster_message<Id_type>::get_publish_size(message) > max_batch_bytes)
+                    send_batch(*link);
+
+                Cluster_message<Id_type>::append_publish(link->m_batch, topic, message);
+
+                if (link->m_batch.body_size() >= max_batch_bytes)
+                    send_batch(*link);
+            }
+        }
+
+        /**
+         *   Handles the messages of the links, sends the batches and connects the lost links again.
+         *   This should be called from the update thread of the server.
+         */
+        void update()
+        {
+            std::shared_lock lock(m_links_mutex);
+            const auto now = std::chrono::steady_clock::now();
+
+            for (auto& [node_id, link] : m_links)
+            {
+                link->m_client.update();
+
+                if (link->m_client.is_connected())
+                {
+                    std::scoped_lock batch_lock(link->m_batch_mutex);
+                    send_batch(*link);
+                    continue;
+                }
+
+                link->m_is_ready = false;
+
+                if (!link->m_client.is_connecting() && now - link->m_last_connect >= m_settings.m_reconnect_interval)
+                    connect(*link, now);
+            }
+        }
+
+        /**
+         *   Makes the client a peer if it has the key of the cluster
+         *
+         *   @return false if the key is wrong or the client is already a peer
+         */
+        bool accept_hello(uint32_t client_id, const Cluster_hello& hello)
+        {
+            if (hello.m_cluster_key != m_settings.m_cluster_key || hello.m_node_id == m_settings.m_node_id)
+                return false;
+
+            std::scoped_lock lock(m_peers_mutex);
+            return m_peers.emplace(client_id, hello.m_node_id).second;
+        }
+
+        [[nodiscard]] bool is_peer(uint32_t client_id) const
+        {
+            std::scoped_lock lock(m_peers_mutex);
+            return m_peers.contains(client_id);
+        }
+
+        // Called when the client is removed from the server
+        void remove_peer(uint32_t client_id)
+        {
+            std::scoped_lock lock(m_peers_mutex);
+            m_peers.erase(client_id);
+        }
+
+    private:
+        struct Link
+        {
+            Client<Id_type> m_client;
+            std::string m_host;
+            std::string m_port;
+            std::chrono::steady_clock::time_point m_last_connect;
+
+            // Set when the hello has been sent, nothing else is sent before it
+            std::atomic<bool> m_is_ready = false;
+
+            std::mutex m_batch_mutex;
+            Message<Id_type> m_batch;
+        };
+
+        void connect(Link& link, std::chrono::steady_clock::time_point now)
+        {
+            link.m_is_ready = false;
+            link.m_last_connect = now;
+
+            // Asio thread of the earlier connection has to be stopped before connecting again
+            link.m_client.disconnect();
+            link.m_client.connect(link.m_host, link.m_port);
+        }
+
+        // Called in the update of the link when the server of the node has accepted it
+        void on_link_connected(Link& link)
+        {
+            link.m_client.send_message(Cluster_message<Id_type>::create_hello(
+                {.m_node_id = m_settings.m_node_id, .m_cluster_key = m_settings.m_cluster_key}));
+
+            std::scoped_lock batch_lock(link.m_batch_mutex);
+            link.m_batch = Message<Id_type>();
+            link.m_is_ready = true;
+        }
+
+        // Batch mutex of the link has to be locked
+        void send_batch(Link& link)
+        {
+            if (link.m_batch.body_size() > 0 && link.m_is_ready)
+                link.m_client.send_message(std::exchange(link.m_batch, Message<Id_type>()));
+        }
+
+        Cluster_settings m_settings;
+
+        // Links are not moved so their clients can refer to them, the placement has the same nodes and this node
+        mutable std::shared_mutex m_links_mutex;
+        std::map<uint32_t, std::unique_ptr<Link>> m_links;
+        Rendezvous_hash m_placement;
+
+        // Clients of the server that are the links of the other nodes and their node ids
+        mutable std::mutex m_peers_mutex;
+        std::unordered_map<uint32_t, uint32_t> m_peers;
+    };
+} // namespace Net
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../Message/Message_memory.h"
+#include "../Utility/Common.h"
+#include "../Utility/Thread_affinity.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Threads that run the Asio of many clients, so thousands of clients need only a few threads instead of
+     *   one each. Every thread runs its own io_context and the clients are assigned to them round-robin. Give it
+     *   to the constructor of the client, the clients keep it alive. The last client must not be destroyed from
+     *   a thread of the runtime.
+     */
+    class Io_runtime
+    {
+    public:
+        /**
+         *   Starts the threads
+         *
+         *   @param the amount of threads, atleast one thread is always used
+         *   @param the cpus the threads are pinned to, thread i runs on the cpus[i % size], empty leaves the
+         *          threads unpinned
+         */
+        explicit Io_runtime(size_t thread_count = 1, std::vector<uint32_t> cpus = {})
+            : m_thread_cpus(std::move(cpus))
+        {
+            const size_t context_count = std::max<size_t>(thread_count, 1);
+
+            for (size_t i = 0; i < context_count; ++i)
+            {
+                m_contexts.push_back(std::make_unique<asio::io_context>());
+
+                // Io_context stops when it runs out of work, so the contexts with no clients are kept alive
+                m_work_guards.push_back(asio::make_work_guard(*m_contexts.back()));
+            }
+
+            for (size_t i = 0; i < context_count; ++i)
+                m_thread_handles.emplace_back([this, i] { run_thread(i); });
+        }
+
+        Io_runtime(const Io_runtime&) = delete;
+        Io_runtime(Io_runtime&&) = delete;
+
+        ~Io_runtime()
+        {
+            m_work_guards.clear();
+
+            for (const auto& context : m_contexts)
+                context->stop();
+
+            for (std::thread& thread_handle : m_thread_handles)
+                if (thread_handle.joinable())
+                    thread_handle.join();
+        }
+
+        Io_runtime& operator=(const Io_runtime&) = delete;
+        Io_runtime& operator=(Io_runtime&&) = delete;
+
+        // @return the context for a new client, the clients are spread round-robin over the threads
+        [[nodiscard]] asio::io_context& next_context() noexcept
+        {
+            return *m_contexts[m_next_context_index.fetch_add(1, std::memory_order_relaxed) % m_contexts.size()];
+        }
+
+        [[nodiscard]] size_t get_thread_count() const noexcept
+        {
+            return m_thread_handles.size();
+        }
+
+    private:
+        void run_thread(size_t thread_index)
+        {
+            if (!m_thread_cpus.empty() && pin_current_thread(m_thread_cpus[thread_index % m_thread_cpus.size()]))
+                set_thread_message_memory_resource(&get_numa_node_pool(get_current_numa_node()));
+
+            m_contexts[thread_index]->run();
+        }
+
+        std::vector<uint32_t> m_thread_cpus;
+        std::vector<std::unique_ptr<asio::io_context>> m_contexts;
+        std::vector<asio::executor_work_guard<asio::io_context::executor_type>> m_work_guards;
+        std::vector<std::thread> m_thread_handles;
+        std::atomic<size_t> m_next_context_index = 0;
+    };
+} // namespace Net
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "../Message/Rpc_message.h"
+#include "../Utility/Timer_wheel.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace Net
+{
+    // Where the callback of the rpc call runs
+    enum class Rpc_completion : uint8_t
+    {
+        // In the update, in order with the other messages received from the connection
+        update_thread,
+
+        // Right away on the asio thread that received the response so it has to be thread safe, the failed calls
+        // are completed on the thread that noticed the failure
+        io_thread
+    };
+
+    // Called once with the status of the call and the response, the response is empty if the status is not ok
+    template <Id_concept Id_type>
+    using Rpc_callback = std::function<void(Rpc_status, Message<Id_type>)>;
+
+    /**
+     *   Calls that wait for their responses by the correlation id. Many calls can be outstanding on one connection
+     *   and each of them is completed once, by the response, the deadline or the disconnect, whichever takes it
+     *   from the table first. Can be used from any thread.
+     */
+    template <Id_concept Id_type>
+    class Rpc_calls
+    {
+    public:
+        struct Pending_call
+        {
+            uint32_t m_connection_id = 0;
+            Rpc_callback<Id_type> m_callback;
+            Rpc_completion m_completion = Rpc_completion::update_thread;
+            Timer_wheel::Timer_id m_timer_id = 0;
+        };
+
+        // @return the correlation id of the call, never 0
+        uint64_t add(uint32_t connection_id, Rpc_callback<Id_type> callback, Rpc_completion completion)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const uint64_t correlation_id = m_next_correlation_id++;
+            m_calls.emplace(
+                correlation_id,
+                Pending_call{
+                    .m_connection_id = connection_id, .m_callback = std::move(callback), .m_completion = completion});
+
+            return correlation_id;
+        }
+
+        // @return false if the call was already completed, then the timer is not needed
+        bool set_timer(uint64_t correlation_id, Timer_wheel::Timer_id timer_id)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const auto found_call = m_calls.find(correlation_id);
+
+            if (found_call == m_calls.end())
+                return false;
+
+            found_call->second.m_timer_id = timer_id;
+            return true;
+        }
+
+        // @return where the call is completed or nothing if it was already completed
+        [[nodiscard]] std::optional<Rpc_completion> find_completion(uint64_t correlation_id) const
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const auto found_call = m_calls.find(correlation_id);
+
+            if (found_call == m_calls.end())
+                return std::nullopt;
+
+            return found_call->second.m_completion;
+        }
+
+        // @return the call that the caller now completes or nothing if it was already completed
+        std::optional<Pending_call> take(uint64_t correlation_id)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const auto found_call = m_calls.find(correlation_id);
+
+            if (found_call == m_calls.end())
+                return std::nullopt;
+
+            Pending_call call = std::move(found_call->second);
+            m_calls.erase(found_call);
+
+            return call;
+        }
+
+        // @return the calls that were waiting for the responses from the connection
+        std::vector<Pending_call> take_connection_calls(uint32_t connection_id)
+        {
+            std::vector<Pending_call> calls;
+            std::scoped_lock lock(m_mutex);
+
+            for (auto call = m_calls.begin(); call != m_calls.end();)
+            {
+                if (call->second.m_connection_id == connection_id)
+                {
+                    calls.push_back(std::move(call->second));
+                    call = m_calls.erase(call);
+                }
+                else
+                    ++call;
+            }
+
+            return calls;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            std::scoped_lock lock(m_mutex);
+            return m_calls.size();
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        std::unordered_map<uint64_t, Pending_call> m_calls;
+        uint64_t m_next_correlation_id = 1;
+    };
+} // namespace Net
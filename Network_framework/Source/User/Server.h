@@ -1,28 +1,222 @@
 #pragma once
 
+#include "../Connection/Multicast_channel.h"
+#include "../Events/Message_handlers.h"
+#include "../Message/Response_cache.h"
+#include "../Sockets/Ban_filter.h"
+#include "../Sockets/Handle_channel.h"
+#include "../Sockets/Memory_socket.h"
+#include "../Sockets/Shared_memory_socket.h"
+#include "../Utility/Ip_prefix_set.h"
+#include "../Utility/Linked_mpsc_queue.h"
+#include "../Utility/Offline_queue.h"
+#include "../Utility/Thread_safe_deque.h"
+#include "../Utility/Work_stealing_pool.h"
+#include "Client_registry.h"
+#include "Cluster.h"
+#include "Server_commands.h"
+#include "Spatial_grid.h"
+#include "State_replication.h"
+#include "Topic_registry.h"
 #include "User.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <format>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <variant>
+#include <vector>
 
 namespace Net
 {
+    /**
+     *   Counters of the server acceptors since the server was created, the accept rate is
+     *   the difference of two samples divided by the time between them
+     */
+    struct Accept_counters
+    {
+        // Connections that were given to the update, they can still be denied by the m_on_client_connect
+        uint64_t m_accepted_connections = 0;
+
+        // Connections closed right away because of the max connections or a banned ip
+        uint64_t m_rejected_connections = 0;
+
+        uint64_t m_accept_errors = 0;
+
+        // Accepted connections waiting for the update to handle them
+        size_t m_waiting_connections = 0;
+    };
+
+    /**
+     *   Where the new connections are admitted.
+     *   update_thread creates the connections in the update, so a slow update delays the handshakes.
+     *   io_thread admits them right away on the asio threads with the m_on_client_admission and the update
+     *   only adds the ready clients to the server.
+     */
+    enum class Admission_mode : uint8_t
+    {
+        update_thread,
+        io_thread
+    };
+
+    // Old server that the new one takes over, see the Server::set_hot_restart_path
+    struct Hot_restart_source
+    {
+        // Hot restart path of the old server
+        std::string m_path;
+    };
+
+    // What is done to the clients that hold the most memory when the Memory_budget is passed
+    enum class Memory_policy : uint8_t
+    {
+        // Clients stop reading until the memory is under the low mark, so they don't make more work meanwhile
+        pause_reading,
+
+        // Only the newest queued message of each id is kept, see the Connection::conflate_write_queue
+        conflate,
+
+        // Clients are disconnected
+        disconnect
+    };
+
+    /**
+     *   Memory that the clients of the server may hold together, see the Server::set_memory_budget. The write
+     *   queues, the buffers of the sockets like the tls and the received messages waiting for the update are
+     *   counted. Message that is shared by many clients is counted for each of them.
+     */
+    struct Memory_budget
+    {
+        size_t m_max_bytes = std::numeric_limits<size_t>::max();
+
+        // Heaviest clients are handled until the memory is expected to be under this, nothing uses three
+        // quarters of the max bytes. Held reading continues when the memory is under this.
+        std::optional<size_t> m_low_bytes = std::nullopt;
+
+        Memory_policy m_policy = Memory_policy::conflate;
+    };
+
+    // How the Server::drain lets the clients go
+    struct Drain_settings
+    {
+        // How long the messages queued for a client are written before it is disconnected anyway
+        std::chrono::milliseconds m_flush_timeout = std::chrono::seconds(5);
+
+        // Disconnects are spread evenly over this so the clients don't all reconnect to the other servers at once
+        std::chrono::milliseconds m_disconnect_window = std::chrono::milliseconds(0);
+    };
+
     template <Id_concept Id_type>
     class Server : public User<Id_type>
     {
     public:
         using Optional_seconds = std::optional<std::chrono::seconds>;
 
-        explicit Server(uint16_t port) : m_acceptor(this->create_acceptor(Protocol::endpoint(Protocol::v4(), port)))
+        /**
+         *   Listens the port on every ipv4 address
+         *
+         *   @param the port
+         *   @param should the port be opened with SO_REUSEPORT, so the other servers of this process can listen
+         *          it too and the kernel spreads the new connections between them, see the Sharded_server
+         *   @throws if the port could not be opened or the reuse port is not available on this platform
+         */
+        explicit Server(uint16_t port, bool is_port_shared = false)
+            : Server(std::vector{Protocol::endpoint(Protocol::v4(), port)}, is_port_shared)
+        {
+        }
+
+        /**
+         *   Listens many endpoints, for example one for each network interface. The ipv6 wildcard endpoint
+         *   Protocol::endpoint(Protocol::v6(), port) accepts the ipv4 clients too, unless an ipv4 endpoint of
+         *   the same port is also given. The datagram channel uses the first endpoint.
+         *
+         *   @param the endpoints, atleast one
+         *   @param should the ports be opened with SO_REUSEPORT, see the other constructor
+         *   @throws if there are no endpoints, a port could not be opened or the reuse port is not available
+         */
+        explicit Server(std::vector<Protocol::endpoint> endpoints, bool is_port_shared = false)
+            : m_endpoints(std::move(endpoints)), m_is_port_shared(is_port_shared)
+        {
+            if (m_endpoints.empty())
+                throw std::invalid_argument("Server needs atleast one endpoint");
+
+            for (size_t i = 0; i < m_endpoints.size(); ++i)
+                m_acceptors.push_back(this->create_acceptor(
+                    m_endpoints[i], Protocol::acceptor::max_listen_connections, m_is_port_shared, i,
+                    is_v6_only(m_endpoints[i])));
+        }
+
+        /**
+         *   Takes over the server of the old process that listens the path, see the set_hot_restart_path. The
+         *   listening sockets of the old server are taken here and its connections when this is started. The taken
+         *   acceptors are not opened again, so the settings that change the acceptors don't apply to them.
+         *
+         *   @param the old server
+         *   @throws if the old server could not be reached, it sent no acceptors or the hot restart is not available
+         *           on this platform
+         */
+        explicit Server([[maybe_unused]] const Hot_restart_source& source)
         {
+#ifdef NET_HAS_HOT_RESTART
+            Local_protocol::socket socket(this->get_executor());
+            socket.connect(Local_protocol::endpoint(source.m_path));
+            m_predecessor.emplace(std::move(socket));
+
+            std::vector<char> body;
+            std::vector<Handle_channel::Handle> handles;
+            const Hand_off_record record = receive_hand_off_record(*m_predecessor, body, handles);
+
+            if (record.m_type != Hand_off_type::acceptors || handles.empty())
+            {
+                Handle_channel::close_handles(handles);
+                throw std::runtime_error("Old server sent no acceptors");
+            }
+
+            for (size_t i = 0; i < handles.size(); ++i)
+            {
+                try
+                {
+                    m_acceptors.push_back(
+                        this->create_acceptor(Handle_channel::get_protocol(handles[i]), handles[i], i));
+                }
+                catch (const std::exception&)
+                {
+                    Handle_channel::close_handles(std::span(handles).subspan(i));
+                    throw;
+                }
+            }
+
+            m_are_acceptors_taken = true;
+#else
+            throw std::invalid_argument("Hot restart is not available on this platform");
+#endif
         }
 
         virtual ~Server()
         {
             stop();
+
+#ifdef NET_ENABLE_QUIC
+            // Handler of the listener uses the members, so it is closed before them
+            m_quic_listener.reset();
+#endif
         }
 
         Server(const Server&) = delete;
@@ -34,7 +228,10 @@ namespace Net
         {
             try
             {
-                async_wait_for_connections();
+                open_acceptors();
+                open_datagram_channel();
+                open_multicast();
+                create_command_queues();
                 this->start_asio_thread();
             }
             catch (const std::exception& exception)
@@ -43,14 +240,44 @@ namespace Net
                 return false;
             }
 
-            this->notifications_push_back("Server has been started");
+#ifdef NET_HAS_HOT_RESTART
+            take_handed_off_connections();
+#endif
+
+            this->push_notification({.m_code = Notification_code::server_started});
             return true;
         }
 
         void stop()
         {
             this->stop_asio_thread();
-            this->notifications_push_back("Server has been stopped");
+            wait_for_handlers();
+
+            // Drains that were posted but did not run would leave their queues waiting for a drain forever
+            for (const std::unique_ptr<Command_queue>& queue : m_command_queues)
+                drain_commands(*queue);
+
+            this->push_notification({.m_code = Notification_code::server_stopped});
+
+            // Lets the waiting coroutines see that the server has stopped
+            this->notify_wait();
+        }
+
+        /**
+         *   Stops the server without dropping the queued messages. Accepting stops and every client gets the
+         *   server_shutdown message, then the clients are disconnected one by one over the disconnect window when
+         *   their queued messages have been written. The server is stopped like with the stop when the clients are
+         *   gone or the window and the flush timeout have passed. The update runs meanwhile so the clients that are
+         *   still connected are served, call this from the thread that runs the updates.
+         *
+         *   @param the flush timeout and the disconnect window
+         */
+        void drain(const Drain_settings& settings = {})
+        {
+            if (this->is_asio_thread_running())
+                drain_clients(settings);
+
+            stop();
         }
 
         /**
@@ -58,257 +285,3629 @@ namespace Net
          *
          *   @param The max items handled
          *   @param Should the function wait if there is no items to handle
-         *   @param Optional interval for checking connections. If you don't give this there will be no checking
+         *   @param Optional interval for checking connections. Disconnected clients are removed as soon as they
+         *          disconnect, so this only limits how long the update waits
          */
         void update(
             size_t max_handled_items = SIZE_T_MAX, bool wait = false,
             Optional_seconds check_connections_interval = Optional_seconds()) override
         {
+            NET_TRACE_SCOPE("Server::update");
             User<Id_type>::update(max_handled_items, wait, check_connections_interval);
 
             handle_received_messages(max_handled_items);
             handle_new_connections(max_handled_items);
+            handle_admitted_connections();
+            handle_disconnected_clients();
+            hand_off_to_successor();
+            m_cluster.update();
+            flush_if_tick_corked();
+            this->signal_if_has_something_to_do();
+        }
+
+        /**
+         *   Same as update but the work is limited by a deadline instead of the amount of items, so the handlers
+         *   that take a varying time do not overrun a fixed tick. The messages are taken in batches sized by how
+         *   long the earlier messages took, so one slow handler can pass the deadline but a batch rarely does.
+         *   New connections and notifications get a turn between the batches.
+         *
+         *   @param when the update should return
+         *   @param Optional interval for checking connections. If you don't give this there will be no checking
+         *   @return the work left for the next update
+         */
+        Update_backlog update(
+            std::chrono::steady_clock::time_point deadline,
+            Optional_seconds check_connections_interval = Optional_seconds())
+        {
+            NET_TRACE_SCOPE("Server::update");
+            User<Id_type>::update(0, false, check_connections_interval);
+
+            handle_admitted_connections();
+            handle_disconnected_clients();
+            hand_off_to_successor();
+
+            for (auto now = std::chrono::steady_clock::now(); now < deadline;)
+            {
+                const size_t handled_messages = handle_received_messages(get_deadline_batch_size(deadline - now));
+
+                const auto handled_time = std::chrono::steady_clock::now();
+                update_message_cost(handled_messages, handled_time - now);
+
+                const size_t handled_other_work = handle_new_connections(NEW_CONNECTIONS_PER_TURN) +
+                                                  this->handle_notifications(NOTIFICATIONS_PER_TURN);
+
+                if (handled_messages == 0 && handled_other_work == 0)
+                    break;
+
+                now = std::chrono::steady_clock::now();
+            }
+
+            m_cluster.update();
+            flush_if_tick_corked();
+            this->signal_if_has_something_to_do();
+
+            return {
+                .m_received_messages = this->get_received_backlog(),
+                .m_new_connections = m_new_connections.size(),
+                .m_notifications = this->get_notification_backlog()};
+        }
+
+        /**
+         *   Same as update but the received messages are returned instead of broadcasting them to m_on_message,
+         *   this allows handling the whole batch at once.
+         *
+         *   @param The max items handled
+         *   @param Should the function wait if there is no items to handle
+         *   @param Optional interval for checking connections. If you don't give this there will be no checking
+         *   @return The received messages in order, these stay valid until the next update call
+         */
+        [[nodiscard]] std::span<Owned_message<Id_type>> update_batch(
+            size_t max_handled_items = SIZE_T_MAX, bool wait = false,
+            Optional_seconds check_connections_interval = Optional_seconds())
+        {
+            NET_TRACE_SCOPE("Server::update_batch");
+
+            // Messages of the previous batch were sent after it was returned
+            flush_if_tick_corked();
+            User<Id_type>::update(max_handled_items, wait, check_connections_interval);
+
+            std::span<Owned_message<Id_type>> received_messages = this->pop_received_batch(max_handled_items);
+            handle_new_connections(max_handled_items);
+            handle_admitted_connections();
+            handle_disconnected_clients();
+            hand_off_to_successor();
+            m_cluster.update();
+            this->signal_if_has_something_to_do();
+
+            return received_messages;
+        }
+
+        /**
+         *   Coroutine version of the update_batch, completes when there are received messages instead of polling.
+         *   The new and disconnected clients are handled while waiting. Spawn this on the get_executor to run it on
+         *   the asio thread, this should not be mixed with updates from another thread.
+         *
+         *   @param The max items handled
+         *   @return The received messages in order, these stay valid until the next update call. Empty when the
+         *           server has been stopped
+         */
+        [[nodiscard]] asio::awaitable<std::span<Owned_message<Id_type>>> async_receive(
+            size_t max_handled_items = SIZE_T_MAX)
+        {
+            while (true)
+            {
+                std::span<Owned_message<Id_type>> received_messages = update_batch(max_handled_items);
+
+                if (!received_messages.empty() || this->is_asio_thread_stopping())
+                    co_return received_messages;
+
+                co_await this->async_wait_until_has_something_to_do();
+            }
+        }
+
+        /**
+         *   Checks the id without locking the clients, the ids of the disconnected clients are never reused
+         *   by the later clients so a kept id can be checked at any time
+         *
+         *   @return true if the client is connected, it can disconnect right after this returns
+         */
+        [[nodiscard]] bool is_client_connected(uint32_t client_id) const noexcept
+        {
+            return m_clients.contains(client_id);
         }
 
         // Gets information about spesific client.
         Client_information get_client_information(uint32_t client_id) const
         {
-            auto found_client = m_clients.find(client_id);
+            const auto connection = m_clients.find(client_id);
 
-            if (found_client == m_clients.end())
+            if (connection == nullptr)
                 return {};
 
-            auto& connection_ref = found_client->second.m_connection;
-            Client_information information = { connection_ref->get_id(), connection_ref->get_ip() };
+            return connection->get_client_information();
+        }
+
+        /**
+         *   @param the client
+         *   @return the capabilities that the server and the client both have, empty for the clients that did not
+         *           send a hello because they are older than the hello or have not answered yet
+         */
+        [[nodiscard]] Capability_set get_client_capabilities(uint32_t client_id) const
+        {
+            const auto connection = m_clients.find(client_id);
 
-            return information;
+            return connection != nullptr ? connection->get_agreed_capabilities() : Capability_set();
         }
 
         /*
         *   Sets max allowed connections to server at same time.
         *   This will not disconnect any already connected clients.
         */
-        void set_max_connections(size_t new_max_connections) noexcept
+        /**
+         *   Prepares for the expected amount of clients, so a storm of connections does not pause to grow the
+         *   containers or to wait for the allocator. The client registry and the maps of the clients are
+         *   presized, and the pool of the message bodies gets the blocks that the connections take when they start.
+         *
+         *   @param the expected amount of clients
+         *   @param should the pooled memory be written once, so its pages are mapped at the startup instead of
+         *          during the first minutes of the traffic
+         */
+        void reserve(size_t expected_clients, bool fault_in_memory = false)
         {
-            m_max_connections = new_max_connections;
+            m_clients.reserve_capacity(expected_clients);
+
+            {
+                std::lock_guard lock(m_sessions_mutex);
+                m_session_tokens.reserve(expected_clients);
+            }
+
+            {
+                std::lock_guard lock(m_datagram_mutex);
+                m_datagram_peers.reserve(expected_clients);
+            }
+
+            this->prewarm_connection_memory(expected_clients, fault_in_memory);
         }
 
-        void ban_ip(const std::string& new_banned_ip)
+        void set_max_connections(size_t new_max_connections) noexcept
         {
-            m_banned_ip.insert(new_banned_ip);
+            m_max_connections = new_max_connections;
         }
 
-        void unban_ip(const std::string& new_unbanned_ip)
+        /**
+         *   Limits the memory of all the clients together, the per connection limits of the write queues can't see
+         *   that many clients each under their limit add up to too much. Memory is checked a few times a second
+         *   and when it is over the budget the clients that hold the most are handled with its policy.
+         *
+         *   @param the budget
+         *   @throws if the server is running
+         */
+        void set_memory_budget(const Memory_budget& budget)
         {
-            m_banned_ip.erase(new_unbanned_ip);
+            throw_if_running();
+
+            m_memory_budget = budget;
+
+            if (const std::shared_ptr<Timer_wheel> timer_wheel = this->get_timer_wheel().lock())
+            {
+                timer_wheel->cancel(m_memory_timer);
+                m_memory_timer = 0;
+
+                if (m_memory_budget.m_max_bytes != std::numeric_limits<size_t>::max())
+                    schedule_memory_check();
+            }
         }
 
-        void disconnect_client(uint32_t client_id)
+        // @return the memory that the Memory_budget counts, this can be called from any thread
+        [[nodiscard]] size_t get_memory_usage() const
         {
-            auto found_client = m_clients.find(client_id);
+            size_t memory_bytes = this->get_in_queue_bytes();
+            m_clients.for_each([&memory_bytes](const auto& connection) {
+                memory_bytes += connection->get_memory_usage();
+            });
 
-            if (found_client != m_clients.end())
-                remove_client(found_client);
+            return memory_bytes;
         }
 
-        void send_message_to_client(uint32_t client_id, Message<Id_type> message)
+        /**
+         *   Runs the message handlers and the m_on_message on a work stealing pool instead of the update thread, so
+         *   cpu heavy handlers use every core. The messages of one client are still handled in order, but the
+         *   handlers run at the same time as the update and each other so they have to be thread safe. The update
+         *   does not wait for them, see the wait_for_handlers. This has to be called before starting.
+         *
+         *   @param the amount of pool threads, 0 handles the messages on the update thread
+         *   @throws if the server is running
+         */
+        void set_handler_threads(size_t thread_count)
         {
-            auto found_client = m_clients.find(client_id);
-            if (found_client == m_clients.end())
-                return;
+            if (this->is_asio_thread_running())
+                throw std::logic_error("Handler threads can't be changed while the server is running");
 
-            const auto& connection_ptr = found_client->second.m_connection;
+            m_handler_pool.reset();
 
-            if (connection_ptr->is_connected())
-                connection_ptr->send_message(std::move(message));
-            else
-                remove_client(found_client);
+            if (thread_count > 0)
+                m_handler_pool = std::make_unique<Work_stealing_pool>(thread_count);
         }
 
-        void send_message_to_all_clients(const Message<Id_type>& message, uint32_t ignored_client = 0)
+        // Blocks until the handlers of the messages given to the handler threads have finished
+        void wait_for_handlers()
         {
-            auto client_iterator = m_clients.begin();
-            while (client_iterator != m_clients.end())
-            {
-                const auto& connection = client_iterator->second.m_connection;
-
-                if (connection->is_connected())
-                {
-                    if (connection->get_id() != ignored_client)
-                        connection->send_message(message);
-
-                    ++client_iterator;
-                }
-                else
-                    client_iterator = remove_client(client_iterator);
-            }
+            if (m_handler_pool)
+                m_handler_pool->wait_idle();
         }
 
-        /** T
-         *   This event allows you to disconnect just connected client.
-         *   Note that client is not yet valid during this event so all methods like disconnect does not work on them.
+        /**
+         *   Listens the port with many acceptors that use SO_REUSEPORT, so the kernel spreads the new connections
+         *   between them instead of all of them waiting in one accept queue. Acceptors are divided between the
+         *   io_contexts and the accepted connections stay on the context of their acceptor, so in the
+         *   context_per_thread mode each thread accepts its own connections. Acceptors are opened when the
+         *   server is started, so call this after the set_asio_threads.
+         *
+         *   @param the amount of acceptors, one uses the normal acceptor
+         *   @throws if the server is running or the platform has no SO_REUSEPORT
          */
-        Delegate<const Client_information&, bool&> m_on_client_connect;
-
-        Delegate<const Client_information&> m_on_client_disconnect;
-        Delegate<const Client_information&, Message<Id_type>> m_on_message;
-
-    protected:
-        bool should_stop_waiting() override
+        void set_reuse_port_acceptors(size_t acceptor_count)
         {
-            const bool parent_conditions = User<Id_type>::should_stop_waiting();
+            throw_if_running();
 
-            return parent_conditions || !m_new_connections.empty();
+#ifndef SO_REUSEPORT
+            if (acceptor_count > 1)
+                throw std::invalid_argument("SO_REUSEPORT is not available on this platform");
+#endif
+
+            m_reuse_port_acceptor_count = std::max<size_t>(acceptor_count, 1);
+            m_are_acceptors_outdated = true;
         }
 
-    private:
-        struct Client_data
+        /**
+         *   Sends and receives the connections with the Registered I/O of Windows, see the Rio_socket. Every
+         *   io_context registers the buffers for its connections once when the server starts. Connections over the
+         *   amount use the normal overlapped operations. Port is opened again when the server is started.
+         *
+         *   @param how many connections of each io_context use the RIO, zero turns it off
+         *   @param size of the send and receive buffers of a connection, the largest read or write of it at a time
+         *   @return false if the RIO is not available on this platform
+         *   @throws if the server is running
+         */
+        bool set_registered_io(size_t connection_count, size_t buffer_size)
         {
-            std::unique_ptr<Connection<Id_type>> m_connection = nullptr;
-        };
+            throw_if_running();
+
+            if (!this->set_registered_io_buffers(connection_count, buffer_size))
+                return false;
 
-        // Triggers the on message callback for the every message
-        void handle_received_messages(size_t max_messages)
+            m_are_acceptors_outdated = true;
+            return true;
+        }
+
+        /**
+         *   Sets how many connections the kernel keeps waiting for the accept, the system maximum by default.
+         *   System can limit this, for example the net.core.somaxconn on linux, so it may need raising too.
+         *   Port is opened again when the server is started.
+         *
+         *   @throws if the server is running
+         */
+        void set_listen_backlog(int backlog)
         {
-            for (size_t i = 0; i < max_messages && !this->is_in_queue_empty(); ++i)
-            {
-                Owned_message<Id_type> owned_message = this->in_queue_pop_front();
+            throw_if_running();
 
-                if (owned_message.m_message.get_internal_id() == Internal_id::not_internal)
-                    m_on_message.broadcast(
-                        std::move(owned_message.m_client_information), std::move(owned_message.m_message));
-                else
-                    handle_internal_message(std::move(owned_message));
-            }
+            m_listen_backlog = backlog;
+            m_are_acceptors_outdated = true;
         }
 
-        // Handles messages internal to framework
-        void handle_internal_message(Owned_message<Id_type> message)
+        /**
+         *   Sets how many accepts each acceptor keeps waiting at the same time, so the next connection can be
+         *   accepted while the completion of the earlier one is still running
+         *
+         *   @param the amount of accepts, atleast one
+         *   @throws if the server is running
+         */
+        void set_outstanding_accepts(size_t accept_count)
         {
-            // Currently we have no internal messages in the server so this must be invalid message
-            disconnect_client(message.m_client_information.m_id);
+            throw_if_running();
+
+            m_outstanding_accepts = std::max<size_t>(accept_count, 1);
+            m_are_acceptors_outdated = true;
         }
 
         /**
-         * Handles the new non accepted connections
+         *   Sets where the new connections are admitted, see the Admission_mode. In the io_thread mode the
+         *   settings of the server are read by the asio threads, so they should not be changed after starting.
          *
-         * @param max amount of the new connections handled
+         *   @throws if the server is running
          */
-        void handle_new_connections(size_t max_amount)
+        void set_admission_mode(Admission_mode admission_mode)
         {
-            for (size_t i = 0; i < max_amount && !m_new_connections.empty(); ++i)
-                create_client(m_new_connections.pop_front());
+            throw_if_running();
+            m_admission_mode = admission_mode;
         }
 
-        // Prepares the client for receiving messages
-        void setup_client(std::unique_ptr<Connection<Id_type>> connection, uint32_t unique_id)
+        /**
+         *   Endpoints the acceptors listen, these have the ports the system chose for the port 0. Acceptors are
+         *   opened again when the server is started, so this should not be called while it is starting.
+         */
+        [[nodiscard]] std::vector<Protocol::endpoint> get_local_endpoints() const
         {
-            auto accept_message = Message_converter<Id_type>::create_server_accept({unique_id});
-            connection->send_message(accept_message);
+            std::vector<Protocol::endpoint> endpoints;
+
+            for (const Protocol::acceptor& acceptor : m_acceptors)
+            {
+                asio::error_code error;
+                const Protocol::endpoint endpoint = acceptor.local_endpoint(error);
+
+                if (!error && std::find(endpoints.begin(), endpoints.end(), endpoint) == endpoints.end())
+                    endpoints.push_back(endpoint);
+            }
 
-            Client_data client = {std::move(connection)};
-            m_clients.emplace(unique_id, std::move(client));
+            return endpoints;
         }
 
-        // Adds the new socket as connection
-        void create_client(Protocol::socket socket)
+        [[nodiscard]] Accept_counters get_accept_counters()
         {
-            if (!socket.is_open())
-                return;
+            return {
+                .m_accepted_connections = m_accepted_connections.load(std::memory_order_relaxed),
+                .m_rejected_connections = m_rejected_connections.load(std::memory_order_relaxed),
+                .m_accept_errors = m_accept_errors.load(std::memory_order_relaxed),
+                .m_waiting_connections = m_new_connections.size()};
+        }
 
-            const uint32_t client_id = m_id_counter++;
-            const std::string client_ip = socket.remote_endpoint().address().to_string();
+        /**
+         *   Refuses the new connections from the address or the range of addresses, the connected clients are not
+         *   disconnected
+         *
+         *   @param address or a range like 10.0.0.0/8 or 2001:db8::/32
+         *   @return false if the text is not an address or a range
+         */
+        bool ban_ip(std::string_view banned_ip)
+        {
+            const std::optional<Ip_prefix> prefix = Ip_prefix_set::parse(banned_ip);
 
-            bool client_accepted = true;
-            m_on_client_connect.broadcast(Client_information(client_id, client_ip), client_accepted);
+            if (!prefix)
+                return false;
 
-            if (client_accepted)
-            {
-                auto new_connection = this->create_connection(std::move(socket), client_id, Handshake_type::server);
+            std::unique_lock lock(m_banned_ips_mutex);
 
-                this->notifications_push_back(
-                    std::format("Client with ip {} was accepted and assigned ip {} to it", client_ip, client_id));
+            if (m_banned_ips.insert(*prefix))
+                update_ban_filter();
 
-                setup_client(std::move(new_connection), client_id);
-            }
-            else
-                this->notifications_push_back(std::format("Connection {} denied", client_ip));
+            return true;
         }
 
-        // Primes the Asio thread to wait for the connections in async way
-        void async_wait_for_connections()
+        // @return false if the address or the range was not banned, the ranges inside or around it stay banned
+        bool unban_ip(std::string_view unbanned_ip)
         {
-            m_acceptor.async_accept([this](asio::error_code error, Protocol::socket socket) {
-                if (!error)
-                {
-                    const std::string ip = socket.remote_endpoint().address().to_string();
-                    this->notifications_push_back(std::format("Server new connection: {}", ip));
+            const std::optional<Ip_prefix> prefix = Ip_prefix_set::parse(unbanned_ip);
 
-                    if (m_clients.size() + m_new_connections.size() >= m_max_connections)
-                        this->notifications_push_back("Max connections reached");
+            if (!prefix)
+                return false;
 
-                    else if (m_banned_ip.contains(ip))
-                        this->notifications_push_back(std::format("Client with ip {} is banned", ip));
+            std::unique_lock lock(m_banned_ips_mutex);
 
-                    else
-                    {
-                        m_new_connections.push_back(std::move(socket));
-                        this->notify_wait();
-                    }
-                }
-                else
-                    this->notifications_push_back(
-                        std::format("Server connection error: {}", error.message()), Severity::error);
+            if (!m_banned_ips.erase(*prefix))
+                return false;
 
-                async_wait_for_connections();
-            });
+            update_ban_filter();
+            return true;
         }
 
         /**
-         *   Removes the client from m_client
+         *   Drops the connections from the banned ips in the kernel before the handshake, see the Ban_filter. The
+         *   accept check stays, it takes the connections the filter could not, for example when there are too
+         *   many ranges for it. Port is opened again when the server is started.
          *
-         *   @param The iterator pointing to the client in m_clients
-         *   @return The iterator pointing to the next element after removed client
+         *   @throws if the server is running or the platform has no socket filters
          */
-        template <typename Client_it_type>
-        auto remove_client(Client_it_type client_it)
+        void set_kernel_ban_filter(bool is_enabled)
         {
-            const auto& connection = client_it->second.m_connection;
+            throw_if_running();
 
-            const uint32_t id = connection->get_id();
-            const std::string ip = connection->get_ip().data();
+#ifndef NET_HAS_BAN_FILTER
+            if (is_enabled)
+                throw std::invalid_argument("Socket filters are not available on this platform");
+#endif
 
-            auto next_it = m_clients.erase(client_it);
+            m_has_kernel_ban_filter = is_enabled;
+            m_are_acceptors_outdated = true;
+        }
 
-            this->notifications_push_back(std::format("Client disconnected ip: {} id: {}", ip, id));
+        /**
+         *   Linux only, the kernel keeps the new connection until its first data arrives, so the connections that
+         *   never send are not accepted. Suits the Ssl_server and the protocols where the client speaks first.
+         *   Kernel drops the connection that sends nothing in the timeout, some kernels accept it after all.
+         *   Port is opened again when the server is started.
+         *
+         *   @param the timeout, nullopt accepts right after the tcp handshake
+         *   @throws if the server is running or the platform has no TCP_DEFER_ACCEPT
+         */
+        void set_defer_accept(Optional_seconds timeout)
+        {
+            throw_if_running();
 
-            m_on_client_disconnect.broadcast(Client_information(id, ip));
+#ifndef TCP_DEFER_ACCEPT
+            if (timeout)
+                throw std::invalid_argument("TCP_DEFER_ACCEPT is not available on this platform");
+#endif
 
-            return next_it;
+            m_defer_accept = timeout;
+            m_are_acceptors_outdated = true;
         }
 
-        // Removes all the unconnected clients
-        void check_connections() override
+        /**
+         *   Keeps the session of the disconnected client so the client can continue it when it reconnects, see
+         *   the Client::set_reconnect. The resumed client gets a new id and the m_on_client_resumed tells the id
+         *   it had before, and the client sends again the messages that the server did not receive.
+         *
+         *   @param how long the session is kept after the disconnect, nullopt does not keep the sessions
+         */
+        void set_session_resume(Optional_seconds keep_time)
         {
-            auto clients_iterator = m_clients.begin();
-            while (clients_iterator != m_clients.end())
+            std::lock_guard lock(m_sessions_mutex);
+            m_session_keep_time = keep_time;
+
+            if (!keep_time)
             {
-                const auto& connection = clients_iterator->second.m_connection;
+                m_session_tokens.clear();
+                m_kept_sessions.clear();
+                m_session_expiries.clear();
 
-                if (!connection->is_connected())
-                    clients_iterator = remove_client(clients_iterator);
-                else
-                    ++clients_iterator;
+                if (m_offline_queue)
+                    m_offline_queue->clear();
             }
         }
 
-        std::unordered_map<uint32_t, Client_data> m_clients;
-        Thread_safe_deque<Protocol::socket> m_new_connections;
+        /**
+         *   Keeps the messages sent to a client while its session is kept, in the memory mapped segments of the
+         *   directory, and sends them first when the client resumes the session, see the set_session_resume.
+         *   The messages are sent to the earlier id of the client until the m_on_client_resumed tells the new one.
+         *   Messages sent to all the clients are not kept. Nothing is kept without the settings.
+         *   This should be called before starting.
+         *
+         *   @throws std::system_error if the directory could not be created
+         */
+        void set_offline_queue(std::optional<Offline_queue_settings> settings)
+        {
+            m_offline_queue = settings ? std::make_unique<Offline_queue>(std::move(*settings)) : nullptr;
+        }
 
-        Protocol::acceptor m_acceptor;
-        uint32_t m_id_counter = 1000;
+        // @return the messages kept for the offline clients, all zero if they are not kept
+        [[nodiscard]] Offline_queue_stats get_offline_queue_stats() const
+        {
+            return m_offline_queue ? m_offline_queue->get_stats() : Offline_queue_stats();
+        }
 
-        size_t m_max_connections = std::numeric_limits<size_t>::max();
-        std::unordered_set<std::string> m_banned_ip;
+        /**
+         *   Sets the state of the replicated object, it is sent to the clients in the next replicate_states.
+         *   The state is copied only when it changed.
+         *
+         *   @param the object, the ids are chosen by the user
+         *   @param the bytes of the state, the clients get the same bytes
+         */
+        void set_replicated_state(uint32_t object_id, std::span<const char> state)
+        {
+            std::lock_guard lock(m_replication_mutex);
+            m_state_replicator.set_state(object_id, state);
+        }
+
+        // Removes the replicated object from the clients in the next replicate_states
+        void remove_replicated_state(uint32_t object_id)
+        {
+            std::lock_guard lock(m_replication_mutex);
+            m_state_replicator.remove_state(object_id);
+        }
+
+        /**
+         *   Sends the changes of the replicated states to the clients that agreed on the state replication,
+         *   usually once per tick. Each client gets the delta against the last state it acknowledged, or the full
+         *   states when it has acknowledged none or it is too far behind. The clients that acknowledged the same
+         *   state share one update message.
+         */
+        void replicate_states()
+        {
+            std::lock_guard lock(m_replication_mutex);
+            m_state_replicator.publish();
+
+            m_clients.for_each_connected([this](uint32_t client_id, const auto& connection) {
+                if (!connection->get_agreed_capabilities().has(Capability::state_replication))
+                    return;
+
+                if (Shared_message<Id_type> update = m_state_replicator.create_update(client_id))
+                {
+                    m_state_replicator.add_sent_update(*update);
+                    connection->send_message(std::move(update));
+                }
+            });
+        }
+
+        // @return the sequence, the objects and the bytes of the sent updates of the state replication
+        [[nodiscard]] Replication_stats get_replication_stats() const
+        {
+            std::lock_guard lock(m_replication_mutex);
+            return m_state_replicator.get_stats();
+        }
+
+        /**
+         *   Holds the messages sent to each client until the end of the update, so the messages of a tick leave
+         *   in one write per client instead of a small write each. The update_batch flushes the messages of the
+         *   previous batch when it is called again. Only affects connections created after this call.
+         *
+         *   @param true to cork the clients for the tick
+         */
+        void set_tick_corking(bool is_enabled) noexcept
+        {
+            this->set_tick_corked(is_enabled);
+        }
+
+        /**
+         *   Broadcasts to atleast this many clients are split between the calling thread and the Asio threads,
+         *   each going through its own part of the clients. The broadcast still returns only when every client
+         *   has the message queued. This should be called before the start.
+         *
+         *   @param the amount of clients, 0 splits every broadcast and the max of size_t none
+         */
+        void set_parallel_broadcast_threshold(size_t client_count) noexcept
+        {
+            m_parallel_broadcast_threshold = client_count;
+        }
+
+        // Writes the messages held by the tick corking now, the clients with nothing new to write are skipped
+        void flush_clients()
+        {
+            m_clients.for_each_connected([](uint32_t, const auto& connection) { connection->flush(); });
+        }
+
+        void disconnect_client(uint32_t client_id)
+        {
+            remove_client(client_id);
+        }
+
+        /**
+         *   Hands the commands to an io thread that applies them in one batch, so many threads can drive the server
+         *   without taking the locks of the clients themselves. Each thread has its own queue from the io
+         *   contexts, so the commands of one thread are applied in the order they were submitted, and only the
+         *   submit that finds the queue empty wakes the io thread. Before the start the commands are applied on
+         *   this thread.
+         *
+         *   @param the commands, see the Server_command_batch
+         */
+        void submit_commands(Server_command_batch<Id_type> batch)
+        {
+            if (batch.empty())
+                return;
+
+            if (m_command_queues.empty())
+            {
+                apply_commands(batch.take_commands());
+                return;
+            }
+
+            const size_t thread_hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+            Command_queue& queue = *m_command_queues[thread_hash % m_command_queues.size()];
+
+            if (queue.m_batches.push(batch.take_commands()))
+                asio::post(queue.m_executor, [this, &queue] { drain_commands(queue); });
+        }
+
+        /**
+         *   Sets the client as bulk, for example a client that only syncs data in the background. Bulk clients stop
+         *   reading while the server is overloaded, see the Overload_settings, and read in smaller turns so the
+         *   other clients are not delayed behind their data, see the User::set_bulk_read_budget.
+         *
+         *   @return false if there is no client with the id
+         */
+        bool set_client_bulk(uint32_t client_id, bool is_bulk = true)
+        {
+            const auto connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return false;
+
+            connection->set_bulk(is_bulk);
+            return true;
+        }
+
+        /**
+         *   Opens a connection to this server in memory instead of through the network, see the Memory_socket.
+         *   It is admitted like the accepted connections but it skips the tls, the socket options and the banned
+         *   ips, so the framework can be tested and benchmarked without the network stack. The server has to be
+         *   started first.
+         *
+         *   @param executor that runs the client end, for example the get_executor of the client
+         *   @param bytes buffered in each direction
+         *   @return the client end to give to the Client::connect, nullptr if the max connections is reached
+         */
+        [[nodiscard]] std::unique_ptr<Socket_interface> open_memory_connection(
+            const asio::any_io_executor& client_executor, size_t pipe_capacity = Memory_socket::DEFAULT_PIPE_CAPACITY)
+        {
+            if (!has_room_for_connection())
+                return nullptr;
+
+            auto [server_socket, client_socket] =
+                create_memory_socket_pair(this->next_connection_executor(), client_executor, pipe_capacity);
+            m_accepted_connections.fetch_add(1, std::memory_order_relaxed);
+            add_interface_connection(std::move(server_socket));
+
+            return client_socket;
+        }
+
+        /**
+         *   Accepts the connections also from the unix domain socket at the path, so the processes on the same host
+         *   skip the tcp stack. File left at the path by an earlier run is removed when the server starts. These
+         *   connections have no tls even in the Ssl_server. Windows has the unix domain sockets since Windows 10.
+         *
+         *   @param the path, empty stops listening it
+         *   @throws if the server is running
+         */
+        void set_local_path(std::string path)
+        {
+            throw_if_running();
+
+            m_local_path = std::move(path);
+            m_are_acceptors_outdated = true;
+        }
+
+        /**
+         *   Accepts the shared memory connections from the unix domain socket at the path, see the
+         *   Shared_memory_socket. The data of these skips the kernel, so they suit the peers on the same host that
+         *   send at a high rate. Like the set_local_path they have no tls.
+         *
+         *   @param the path, empty stops listening it. It must differ from the path of the set_local_path
+         *   @param bytes in each direction of every connection
+         *   @throws if the server is running
+         */
+        void set_shared_memory_path(
+            std::string path, size_t ring_capacity = Shared_memory_socket::DEFAULT_RING_CAPACITY)
+        {
+            throw_if_running();
+
+            m_shared_memory_path = std::move(path);
+            m_shared_memory_ring_capacity = ring_capacity;
+            m_are_acceptors_outdated = true;
+        }
+
+#ifdef NET_ENABLE_QUIC
+        /**
+         *   Accepts the quic connections from the udp port too, see the Quic_socket. They are checked against the
+         *   max connections and the banned ips like the tcp connections. Quic always has tls, it uses the
+         *   certificate of the settings even in the plain Server.
+         *
+         *   @param the udp port, zero stops listening it. It must differ from the port of the datagram channel
+         *   @param the settings with the certificate and the private key files
+         *   @throws if the server is running
+         */
+        void set_quic_port(uint16_t port, Quic_settings settings = {})
+        {
+            throw_if_running();
+
+            m_quic_port = port;
+            m_quic_settings = std::move(settings);
+            m_are_acceptors_outdated = true;
+        }
+#endif
+
+        /**
+         *   Receives and sends the datagrams of the datagram channel through the AF_XDP of linux, so they skip
+         *   the network stack of the kernel, see the Xdp_socket. The process needs the CAP_NET_ADMIN and the
+         *   CAP_BPF. If the AF_XDP can't be set up when the server starts the datagram_channel_failed is notified
+         *   and the channel uses only its udp socket.
+         *
+         *   @param the interface and its queues, nullopt uses only the udp socket
+         *   @return false if the AF_XDP is not available on this platform
+         *   @throws if the server is running
+         */
+        bool set_datagram_xdp(std::optional<Xdp_settings> settings)
+        {
+            throw_if_running();
+
+#ifdef NET_HAS_AF_XDP
+            m_datagram_xdp_settings = std::move(settings);
+
+            // Channel is opened again with the settings
+            m_datagram_port = 0;
+            return true;
+#else
+            return !settings;
+#endif
+        }
+
+        /**
+         *   Sends the reliable messages to all clients in one udp multicast datagram instead of a copy through
+         *   every connection, for the deployments where the clients share the local network. Clients that join
+         *   get the messages in order, the missed ones are sent again through their connections and the clients
+         *   that don't hear the group get everything through the connections. Conflated messages and the ones
+         *   that don't fit in a datagram still go through the connections.
+         *
+         *   @param the group, nullopt sends everything through the connections
+         *   @throws if the server is running
+         */
+        void set_multicast(std::optional<Multicast_settings> settings)
+        {
+            throw_if_running();
+            m_multicast_settings = std::move(settings);
+        }
+
+        /**
+         *   Lets a new process take over this server without disconnecting the clients, for example to deploy a new
+         *   build. The new process connects to the path with the Hot_restart_source and the update passes it the
+         *   listening sockets, so no connection is refused, and stops accepting. Then the plain tcp connections
+         *   are passed with their state once their queued messages have been written, and server_handed_off is
+         *   notified. The tls and the other transports are disconnected and their clients reconnect to the new
+         *   process, like all of the clients when the datagram channel or the multicast is used. Messages sent after
+         *   the hand off starts may be lost.
+         *
+         *   @param the path of the unix domain socket, empty stops listening it
+         *   @throws if the server is running or the hot restart is not available on this platform
+         */
+        void set_hot_restart_path(std::string path)
+        {
+            throw_if_running();
+
+#ifdef NET_HAS_HOT_RESTART
+            m_hot_restart_path = std::move(path);
+            m_are_acceptors_outdated = true;
+#else
+            if (!path.empty())
+                throw std::invalid_argument("Hot restart is not available on this platform");
+#endif
+        }
+
+        /**
+         *   Sets the socket options of one client instead of the ones given to the set_socket_options,
+         *   for example to disable the delayed acks of a client that needs low latency
+         */
+        void set_client_socket_options(uint32_t client_id, const Socket_options& options)
+        {
+            if (const auto connection = m_clients.find(client_id))
+                connection->set_socket_options(options);
+        }
+
+        // @return how many messages to the client the overflow policy has dropped or replaced
+        [[nodiscard]] uint64_t get_client_dropped_message_count(uint32_t client_id) const
+        {
+            if (const auto connection = m_clients.find(client_id))
+                return connection->get_dropped_message_count();
+
+            return 0;
+        }
+
+        // @return the counters of the client or nothing if there is no client with the id
+        [[nodiscard]] std::optional<Connection_metrics> get_client_metrics(uint32_t client_id) const
+        {
+            if (const auto connection = m_clients.find(client_id))
+                return connection->get_metrics();
+
+            return std::nullopt;
+        }
+
+        /**
+         *   Fills the output with the state of every connected client for an admin view. The values are read from
+         *   the atomic counters of the connections without stopping the Asio threads, so the values of a
+         *   connection can be from slightly different moments. Only a shard of the clients is locked at a time
+         *   and the ip texts are shared, so reusing the output between the calls keeps this from allocating.
+         *
+         *   @param the snapshots, cleared first
+         */
+        void get_connection_snapshots(std::vector<Connection_snapshot>& output) const
+        {
+            const auto now = std::chrono::steady_clock::now();
+
+            output.clear();
+            output.reserve(m_clients.size());
+
+            m_clients.for_each([&output, now](const auto& connection) {
+                if (connection->is_connected())
+                    output.push_back(connection->get_snapshot(now));
+            });
+        }
+
+        [[nodiscard]] std::vector<Connection_snapshot> get_connection_snapshots() const
+        {
+            std::vector<Connection_snapshot> output;
+            get_connection_snapshots(output);
+            return output;
+        }
+
+        // @return the latest round trip time measured by the heartbeat or nothing if it is not known yet
+        [[nodiscard]] std::optional<std::chrono::microseconds> get_client_round_trip_time(uint32_t client_id) const
+        {
+            if (const auto connection = m_clients.find(client_id))
+                return connection->get_round_trip_time();
+
+            return std::nullopt;
+        }
+
+        /**
+         *   Moves the client to the io_context so its thread runs the client in the context_per_thread mode.
+         *   Client moves when its current read and write have finished, see the Connection::move_to_executor.
+         *
+         *   @param the client
+         *   @param index of the io_context, wraps around the get_context_count
+         *   @return false if the client was not found or its socket cannot be moved
+         */
+        bool move_client_to_context(uint32_t client_id, size_t context_index)
+        {
+            const auto connection = m_clients.find(client_id);
+
+            if (connection == nullptr || !connection->is_connected())
+                return false;
+
+            return connection->move_to_executor(this->make_connection_executor(context_index));
+        }
+
+        /**
+         *   Moves the client to the io_context of the other client, so the messages between clients that talk to
+         *   each other are handled by one thread and the publishes to a group stay mostly on the thread of the group
+         *
+         *   @return false if either client was not found or the socket of the client cannot be moved
+         */
+        bool colocate_clients(uint32_t client_id, uint32_t other_client_id)
+        {
+            const std::optional<size_t> context_index = get_client_context_index(other_client_id);
+
+            if (!context_index.has_value())
+                return false;
+
+            // Client that already runs on the same io_context is not moved
+            if (get_client_context_index(client_id) == context_index)
+                return true;
+
+            return move_client_to_context(client_id, context_index.value());
+        }
+
+        // @return the index of the io_context that runs the client or nothing if there is no client with the id
+        [[nodiscard]] std::optional<size_t> get_client_context_index(uint32_t client_id) const
+        {
+            if (const auto connection = m_clients.find(client_id))
+                return this->find_context_index(connection->get_executor());
+
+            return std::nullopt;
+        }
+
+        /**
+         *   Sending is thread safe so the messages can be sent from any thread. Clients that have disconnected
+         *   are removed and the m_on_client_disconnect is called in the next update.
+         *   The priority selects the lane of the write queue, see the set_priority_settings.
+         */
+        void send_message_to_client(
+            uint32_t client_id, Message<Id_type> message, Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_client(client_id, std::move(message), {.m_priority = priority});
+        }
+
+        // Sends the message without copying its body, the same shared message can be sent to many clients
+        void send_message_to_client(
+            uint32_t client_id, Shared_message<Id_type> message, Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_client(client_id, std::move(message), {.m_priority = priority});
+        }
+
+        // Sends the prepared message, its headers were already encoded when it was created
+        void send_message_to_client(
+            uint32_t client_id, Shared_prepared_message<Id_type> message,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_client(client_id, std::move(message), {.m_priority = priority});
+        }
+
+        /**
+         *   Builds the message straight into its pooled body and sends it to the client, nothing is built if the
+         *   client is not connected. Saves the growing of the body and the building of a message that has nowhere
+         *   to go, see the User::build_message.
+         *
+         *   @param the client
+         *   @param id of the message
+         *   @param bytes the builder is expected to write
+         *   @param called with the Message_writer of the body, it is called on this thread before this returns
+         *   @param the lane of the write queue
+         */
+        template <std::invocable<Message_writer<Id_type>&> Builder_type>
+        void send_built_message_to_client(
+            uint32_t client_id, Id_type id, size_t size_hint, Builder_type&& build,
+            Message_priority priority = Message_priority::normal)
+        {
+            const auto connection_ptr = m_clients.find(client_id);
+
+            if (connection_ptr == nullptr || !connection_ptr->is_connected())
+                return;
+
+            send_outgoing_message_to_client(
+                client_id, this->build_message(id, size_hint, std::forward<Builder_type>(build)),
+                {.m_priority = priority});
+        }
+
+        /**
+         *   Sends the message in a logical stream of the client. Messages of the streams are sent in frames that
+         *   take turns so a large message does not hold back the other streams, and each stream is received in order.
+         *
+         *   @param the client
+         *   @param id of the stream, 0 is the normal lane and a connection has atmost 256 other streams
+         *   @param the message
+         */
+        void send_message_to_client_stream(uint32_t client_id, uint32_t stream_id, Message<Id_type> message)
+        {
+            send_outgoing_message_to_client(client_id, std::move(message), {.m_stream_id = stream_id});
+        }
+
+        /**
+         *   Calls the rpc handler of the request id on the client, see the User::register_rpc_handler.
+         *   Many calls can wait for their responses from the same client at once.
+         *
+         *   @param the client
+         *   @param the request
+         *   @param time to wait for the response before the call fails with the timed_out status
+         *   @param called once with the status and the response
+         *   @param where the callback is called
+         */
+        void call_client(
+            uint32_t client_id, Message<Id_type> request, std::chrono::milliseconds timeout,
+            Rpc_callback<Id_type> callback, Rpc_completion completion = Rpc_completion::update_thread)
+        {
+            this->start_rpc_call(
+                m_clients.find(client_id), std::move(request), timeout, std::move(callback), completion);
+        }
+
+        /**
+         *   Sends a large body in chunks without having all of it in the memory, the client receives
+         *   it with the m_on_stream_chunk event
+         *
+         *   @param the client
+         *   @param the id of the streamed message
+         *   @param source that is read from the asio thread when there is room for the next chunk
+         */
+        void send_stream_to_client(uint32_t client_id, Id_type id, Stream_source source)
+        {
+            const auto connection_ptr = m_clients.find(client_id);
+
+            if (connection_ptr != nullptr && connection_ptr->is_connected())
+                connection_ptr->send_stream(id, std::move(source));
+        }
+
+        /**
+         *   Sends part of the file as a stream, see the Connection::send_file
+         *
+         *   @return false if the client was not found or the file could not be sent
+         */
+        [[nodiscard]] bool send_file_to_client(
+            uint32_t client_id, Id_type id, const std::filesystem::path& path, uint64_t offset = 0,
+            std::optional<uint64_t> length = std::nullopt)
+        {
+            const auto connection_ptr = m_clients.find(client_id);
+
+            if (connection_ptr != nullptr && connection_ptr->is_connected())
+                return connection_ptr->send_file(id, path, offset, length);
+
+            return false;
+        }
+
+        /**
+         *   Sends the received message on as it is, its body is moved to the write queue without copying or
+         *   writing it again. Read it only with the Message_reader or the Schema_view before, because the extract
+         *   functions of the Message consume the body.
+         */
+        void forward_message_to_client(
+            uint32_t client_id, Message<Id_type>&& message, Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_client(client_id, std::move(message), {.m_priority = priority});
+        }
+
+        // Forwards the received message to the clients, it is prepared once without copying its body
+        void forward_message_to_clients(
+            std::span<const uint32_t> client_ids, Message<Id_type>&& message,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_message_to_clients(client_ids, make_prepared_message(std::move(message)), priority);
+        }
+
+        // Prepares the message once and sends it to all of the given clients
+        void send_message_to_clients(
+            std::span<const uint32_t> client_ids, const Message<Id_type>& message,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_message_to_clients(client_ids, make_prepared_message(message), priority);
+        }
+
+        void send_message_to_clients(
+            std::span<const uint32_t> client_ids, Shared_prepared_message<Id_type> message,
+            Message_priority priority = Message_priority::normal)
+        {
+            for (const uint32_t client_id : client_ids)
+                send_outgoing_message_to_client(client_id, message, {.m_priority = priority});
+        }
+
+        // Prepares the message once and shares it between all the clients
+        void send_message_to_all_clients(
+            const Message<Id_type>& message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            NET_ALLOCATION_SCOPE(broadcast);
+            send_message_to_all_clients(make_prepared_message(message), ignored_client, priority);
+        }
+
+        void send_message_to_all_clients(
+            Shared_message<Id_type> message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_all_clients(std::move(message), ignored_client, {.m_priority = priority});
+        }
+
+        void send_message_to_all_clients(
+            Shared_prepared_message<Id_type> message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_all_clients(std::move(message), ignored_client, {.m_priority = priority});
+        }
+
+        /**
+         *   Sends the template to the clients with the fields of each client patched in, the body is shared and
+         *   only the field bytes are stored for each client, see the Message_template
+         *
+         *   @param the clients
+         *   @param the template
+         *   @param called with the client id and its Patched_message, on this thread before this returns
+         *   @param the lane of the write queue
+         */
+        template <std::invocable<uint32_t, Patched_message<Id_type>&> Patch_type>
+        void send_patched_message_to_clients(
+            std::span<const uint32_t> client_ids, const Shared_message_template<Id_type>& message_template,
+            Patch_type&& patch, Message_priority priority = Message_priority::normal)
+        {
+            for (const uint32_t client_id : client_ids)
+            {
+                Patched_message<Id_type> message(message_template);
+                patch(client_id, message);
+                send_outgoing_message_to_client(client_id, std::move(message), {.m_priority = priority});
+            }
+        }
+
+        /**
+         *   Sends the template to every connected client, see the send_patched_message_to_clients.
+         *   The patch callable runs while the shard of the client is locked so it should only set the fields.
+         */
+        template <std::invocable<uint32_t, Patched_message<Id_type>&> Patch_type>
+        void send_patched_message_to_all_clients(
+            const Shared_message_template<Id_type>& message_template, Patch_type&& patch, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            NET_ALLOCATION_SCOPE(broadcast);
+            NET_COUNT_ALLOCATION_MESSAGES(broadcast, 1);
+
+            const Delivery_mode mode = this->get_delivery_mode(message_template->get().get_id());
+
+            m_clients.for_each_connected([&](uint32_t client_id, const auto& connection) {
+                if (client_id == ignored_client)
+                    return;
+
+                Patched_message<Id_type> message(message_template);
+                patch(client_id, message);
+
+                // Datagrams take the whole body
+                if (mode == Delivery_mode::reliable || !send_datagram_to_client(client_id, message.to_message(), mode))
+                    connection->send_message(std::move(message), {.m_priority = priority});
+            });
+        }
+
+        /**
+         *   Sends the message so that it replaces the message with the same id and key if that is still waiting in
+         *   the write queue of the client. Clients that lag behind get only the latest value, for example the
+         *   latest position of the entity that the key tells.
+         */
+        void send_conflated_message_to_client(
+            uint32_t client_id, uint64_t conflation_key, Message<Id_type> message,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_client(
+                client_id, std::move(message), {.m_priority = priority, .m_conflation_key = conflation_key});
+        }
+
+        // Prepares the message once and sends it conflated to all the clients, see send_conflated_message_to_client
+        void send_conflated_message_to_all_clients(
+            uint64_t conflation_key, const Message<Id_type>& message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            send_outgoing_message_to_all_clients(
+                make_prepared_message(message), ignored_client,
+                {.m_priority = priority, .m_conflation_key = conflation_key});
+        }
+
+        /**
+         *   Adds the client to the subscribers of the topic, the client is unsubscribed from all of its topics
+         *   when it is removed. This can be called from any thread.
+         *
+         *   @return false if the client was not found or was already subscribed
+         */
+        bool subscribe(uint32_t client_id, uint64_t topic)
+        {
+            return m_topics.subscribe(topic, client_id);
+        }
+
+        // @return false if the client was not subscribed to the topic
+        bool unsubscribe(uint32_t client_id, uint64_t topic)
+        {
+            return m_topics.unsubscribe(topic, client_id);
+        }
+
+        [[nodiscard]] size_t get_subscriber_count(uint64_t topic) const
+        {
+            return m_topics.get_subscriber_count(topic);
+        }
+
+        /**
+         *   Prepares the message once and queues the shared message to every subscriber of the topic, the
+         *   subscribers are read from their own array so the clients are not looked up
+         */
+        void publish(
+            uint64_t topic, const Message<Id_type>& message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            publish(topic, make_prepared_message(message), ignored_client, priority);
+        }
+
+        void publish(
+            uint64_t topic, Shared_prepared_message<Id_type> message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            const Outgoing_message<Id_type> outgoing_message(std::move(message));
+
+            publish_to_subscribers(topic, outgoing_message, ignored_client, priority);
+            m_cluster.publish(topic, outgoing_message.get());
+        }
+
+        /**
+         *   Sets the id of this node and the key of the cluster, see the Cluster_settings.
+         *   This should be called before the other nodes are added.
+         */
+        void set_cluster_settings(const Cluster_settings& settings)
+        {
+            m_cluster.set_settings(settings);
+        }
+
+        [[nodiscard]] const Cluster_settings& get_cluster_settings() const noexcept
+        {
+            return m_cluster.get_settings();
+        }
+
+        /**
+         *   Connects this server to the server of the other cluster node with a Client, the link is connected again
+         *   whenever it is lost. Every node should add all the other nodes, because a link carries the messages only
+         *   from the node that made it. Links of the other nodes are clients of this server, they get the
+         *   m_on_client_connect and m_on_client_disconnect like the other clients. The links have no tls.
+         *
+         *   @return false if the node is this node or it was already added
+         */
+        bool add_cluster_node(uint32_t node_id, std::string host, std::string port)
+        {
+            return m_cluster.add_node(node_id, std::move(host), std::move(port));
+        }
+
+        void remove_cluster_node(uint32_t node_id)
+        {
+            m_cluster.remove_node(node_id);
+        }
+
+        [[nodiscard]] bool is_cluster_node_connected(uint32_t node_id) const
+        {
+            return m_cluster.is_node_connected(node_id);
+        }
+
+        /**
+         *   Finds the node that the key belongs to with the rendezvous hashing over this node and the added nodes,
+         *   so all the nodes that have the same nodes agree on it and adding or removing a node only moves the keys
+         *   of that node. Placing the clients of the same room on its node keeps their messages off the links.
+         *
+         *   @param the key, for example the id of the room or the user
+         *   @return the node or nothing if the cluster has no nodes
+         */
+        [[nodiscard]] std::optional<uint32_t> find_cluster_node(uint64_t key) const
+        {
+            return m_cluster.find_node(key);
+        }
+
+        // Strings are hashed the same way on every platform
+        [[nodiscard]] std::optional<uint32_t> find_cluster_node(std::string_view key) const
+        {
+            return m_cluster.find_node(Rendezvous_hash::hash_key(key));
+        }
+
+        /**
+         *   Tells the client to connect to the server of the other node instead, the client disconnects and
+         *   connects to the address that this node has for the node
+         *
+         *   @return false if the node has not been added or the client was not found
+         */
+        bool redirect_client(uint32_t client_id, uint32_t node_id)
+        {
+            const std::optional<Server_address> address = m_cluster.get_node_address(node_id);
+            const auto connection = m_clients.find(client_id);
+
+            if (!address.has_value() || connection == nullptr || !connection->is_connected())
+                return false;
+
+            connection->send_message(Message_converter<Id_type>::create_redirect(address.value()));
+            return true;
+        }
+
+        /**
+         *   Redirects the client to the node of the key if it is not this node, see the find_cluster_node
+         *
+         *   @return true if the client was redirected, false if it belongs to this node
+         */
+        bool redirect_client_by_key(uint32_t client_id, uint64_t key)
+        {
+            const std::optional<uint32_t> node_id = find_cluster_node(key);
+
+            return node_id.has_value() && node_id.value() != m_cluster.get_settings().m_node_id &&
+                   redirect_client(client_id, node_id.value());
+        }
+
+        bool redirect_client_by_key(uint32_t client_id, std::string_view key)
+        {
+            return redirect_client_by_key(client_id, Rendezvous_hash::hash_key(key));
+        }
+
+        /**
+         *   Sends the message to the client of any node of the cluster, the node that has the client sends it on.
+         *   The message is dropped if the link to the node is not connected.
+         *
+         *   @param the node of the client, the message is sent straight to the client if this is this node
+         *   @param the id of the client on its node
+         *   @param the message
+         */
+        void send_message_to_node_client(uint32_t node_id, uint32_t client_id, Message<Id_type> message)
+        {
+            if (node_id == m_cluster.get_settings().m_node_id)
+                send_message_to_client(client_id, std::move(message));
+            else
+                m_cluster.send_to_node(node_id, client_id, std::move(message));
+        }
+
+        /**
+         *   Sets the size of the cells of the grid that the publish_near uses, it should be about the usual
+         *   radius. Clients that already have a position are moved to the new cells.
+         */
+        void set_interest_cell_size(float cell_size)
+        {
+            m_spatial_grid.set_cell_size(cell_size);
+        }
+
+        /**
+         *   Sets the position of the client for the publish_near, clients without a position get no messages
+         *   from it. This can be called from any thread and the client is removed from the grid with the client.
+         *
+         *   @return false if the client was not found or the position is not finite
+         */
+        bool set_client_position(uint32_t client_id, Grid_position position)
+        {
+            return m_spatial_grid.set_position(client_id, position);
+        }
+
+        /**
+         *   Prepares the message once and queues it to every client within the radius of the position. Only the
+         *   cells of the grid that the radius covers are gone through.
+         */
+        void publish_near(
+            Grid_position position, float radius, const Message<Id_type>& message, uint32_t ignored_client = 0,
+            Message_priority priority = Message_priority::normal)
+        {
+            publish_near(position, radius, make_prepared_message(message), ignored_client, priority);
+        }
+
+        void publish_near(
+            Grid_position position, float radius, Shared_prepared_message<Id_type> message,
+            uint32_t ignored_client = 0, Message_priority priority = Message_priority::normal)
+        {
+            const Outgoing_message<Id_type> outgoing_message(std::move(message));
+            const Delivery_mode mode = this->get_delivery_mode(outgoing_message.get().get_id());
+
+            m_spatial_grid.for_each_near(
+                position, radius,
+                [this, &outgoing_message, ignored_client, priority, mode](uint32_t id, const auto& connection) {
+                    if (id != ignored_client)
+                        send_shared_message(id, *connection, outgoing_message, mode, priority);
+                });
+        }
+
+        /**
+         *   Handles the messages of the id with the callable instead of the m_on_message. The handler is found from
+         *   a table indexed by the id and called in the update, so this should be called from the update thread.
+         *   Handlers of the ids dispatched on the io threads should be set before the start, see set_dispatch_policy.
+         *
+         *   @param the message id
+         *   @param callable that takes the client information and the message
+         */
+        template <typename Callable_type>
+        void register_handler(Id_type id, Callable_type callable)
+        {
+            m_message_handlers.set_handler(id, std::move(callable));
+        }
+
+        /**
+         *   Same as register_handler but the callable takes the client information and the struct read from the
+         *   message, see the make_schema_message. Client is disconnected if the struct can't be read.
+         *
+         *   @param the message id
+         *   @param callable that takes the client information and the struct
+         */
+        template <Schema_concept Schema_type, typename Callable_type>
+        void register_schema_handler(Id_type id, Callable_type callable)
+        {
+            m_message_handlers.set_handler(
+                id, [this, callable = std::move(callable)](const Client_information& client, Message<Id_type> message) {
+                    std::optional<Schema_type> data;
+
+                    try
+                    {
+                        data = read_schema_message<Schema_type>(message);
+                    }
+                    catch (const std::exception& exception)
+                    {
+                        this->notifications_push_back(
+                            std::format("Invalid message from client {} because {}", client.m_id, exception.what()),
+                            Severity::error);
+                        disconnect_client(client.m_id);
+                        return;
+                    }
+
+                    std::invoke(callable, client, *data);
+                });
+        }
+
+        /**
+         *   Same as register_handler but the callable makes the response to the request, and the response is
+         *   cached by the id and the body of the request. The next equal requests get the cached response without
+         *   calling the callable until it expires or is evicted, see the set_response_cache. The response must
+         *   depend only on the request, not on the client that sent it.
+         *
+         *   @param the id of the request
+         *   @param callable that takes the const Message<Id_type>& request and returns the Message<Id_type> response
+         */
+        template <typename Callable_type>
+        void register_cached_handler(Id_type id, Callable_type callable)
+        {
+            auto handler = [this, id, callable = std::move(callable)](
+                               const Client_information& client, Message<Id_type> request) {
+                const std::span<const char> body(request.body_data(), request.body_size());
+                Shared_prepared_message<Id_type> response = m_response_cache.find(id, body);
+
+                if (response == nullptr)
+                {
+                    response = make_prepared_message(std::invoke(callable, std::as_const(request)));
+                    m_response_cache.insert(id, body, response);
+                }
+
+                send_message_to_client(client.m_id, std::move(response));
+            };
+
+            m_message_handlers.set_handler(id, std::move(handler));
+        }
+
+        // Sets the size and the time to live of the cache of the register_cached_handler, the responses are forgotten
+        void set_response_cache(const Response_cache_settings& settings)
+        {
+            m_response_cache.set_settings(settings);
+        }
+
+        // Forgets the cached responses to the requests of the id, for example when the data they show has changed
+        void invalidate_cached_responses(Id_type id)
+        {
+            m_response_cache.invalidate(id);
+        }
+
+        [[nodiscard]] Response_cache_stats get_response_cache_stats() const
+        {
+            return m_response_cache.get_stats();
+        }
+
+        // The messages of the id go to the m_on_message again
+        void unregister_handler(Id_type id)
+        {
+            m_message_handlers.remove_handler(id);
+        }
+
+        /** T
+         *   This event allows you to disconnect just connected client.
+         *   Note that client is not yet valid during this event so all methods like disconnect does not work on them.
+         */
+        Delegate<const Client_information&, bool&> m_on_client_connect;
+
+        /**
+         *   Decides if the new client is accepted in the io_thread admission mode. This is called from the asio
+         *   threads so the callback has to be thread safe. The m_on_client_connect is still called in the update
+         *   after the client has been added and it can disconnect the client.
+         */
+        Delegate<const Client_information&, bool&> m_on_client_admission;
+
+        Delegate<const Client_information&> m_on_client_disconnect;
+
+        // Called after the m_on_client_connect of the client that continued its session, with the earlier id
+        Delegate<const Client_information&, uint32_t> m_on_client_resumed;
+
+        /**
+         *   Called with the hello of the client and the capabilities both sides have, before the client accept is
+         *   handled. Clients older than the hello send none, so a feature is used only when its capability is agreed.
+         */
+        Delegate<const Client_information&, const Hello_data&, Capability_set> m_on_client_hello;
+
+        Delegate<const Client_information&, Message<Id_type>> m_on_message;
+
+        /**
+         *   Called with true when the write queue of the client goes over its high watermark and with false when
+         *   it has drained under the low watermarks, see the set_write_queue_limits. This is called from the asio
+         *   threads so the callback has to be thread safe.
+         */
+        Delegate<const Client_information&, bool> m_on_client_write_pressure;
+
+        // Chunks are handled before the other messages of the same update
+        Delegate<const Client_information&, const Stream_chunk<Id_type>&> m_on_stream_chunk;
+
+    protected:
+        void add_connection_metrics(Metrics<Id_type>& metrics) const override
+        {
+            Lock_metrics strand_locks;
+
+            m_clients.for_each([&metrics, &strand_locks](const auto& connection) {
+                const Connection_metrics connection_metrics = connection->get_metrics();
+
+                ++metrics.m_connections;
+                metrics.m_out_queue_messages += connection_metrics.m_out_queue_messages;
+                metrics.m_out_queue_bytes += connection_metrics.m_out_queue_bytes;
+                metrics.m_memory_bytes += connection->get_memory_usage();
+                strand_locks += connection_metrics.m_strand_lock;
+            });
+
+            metrics.m_locks.push_back({"connection_strand", strand_locks});
+            metrics.m_locks.push_back({"new_connections", m_new_connections.get_lock_metrics()});
+            metrics.m_locks.push_back({"admitted_connections", m_admitted_connections.get_lock_metrics()});
+            metrics.m_locks.push_back({"disconnected_clients", m_disconnected_clients.get_lock_metrics()});
+        }
+
+        bool should_stop_waiting() override
+        {
+            const bool parent_conditions = User<Id_type>::should_stop_waiting();
+
+            return parent_conditions || !m_new_connections.empty() || !m_admitted_connections.empty() ||
+                   !m_disconnected_clients.empty();
+        }
+
+    private:
+        void send_outgoing_message_to_client(
+            uint32_t client_id, Outgoing_message<Id_type> message, const Send_options& options)
+        {
+            NET_ALLOCATION_SCOPE(send);
+            const Delivery_mode mode = this->get_delivery_mode(message.get().get_id());
+
+            // Datagrams and the offline queue take the whole body
+            if (mode != Delivery_mode::reliable)
+                message.flatten_patch();
+
+            if (mode != Delivery_mode::reliable && send_datagram_to_client(client_id, message.get(), mode))
+                return;
+
+            const auto connection_ptr = m_clients.find(client_id);
+
+            if (connection_ptr != nullptr && connection_ptr->is_connected())
+                connection_ptr->send_message(std::move(message), options);
+            else if (m_offline_queue)
+            {
+                message.flatten_patch();
+                const Message<Id_type>& kept_message = message.get();
+                m_offline_queue->append(
+                    client_id,
+                    {reinterpret_cast<const char*>(kept_message.header_data()), kept_message.header_size()},
+                    {reinterpret_cast<const char*>(kept_message.body_data()), kept_message.body_size()});
+            }
+        }
+
+        // Copies the kept message to a new message with a pooled body
+        [[nodiscard]] static Message<Id_type> make_offline_message(
+            std::span<const char> header, std::span<const char> body)
+        {
+            Message<Id_type> message;
+            std::memcpy(message.header_data(), header.data(), sizeof(Message_header<Id_type>));
+            message.resize_body(body.size());
+
+            if (!body.empty())
+                std::memcpy(message.body_data(), body.data(), body.size());
+
+            return message;
+        }
+
+        // Queues the message to every connected client, the message should be shared so it is not copied for each
+        void send_outgoing_message_to_all_clients(
+            const Outgoing_message<Id_type>& message, uint32_t ignored_client, const Send_options& options)
+        {
+            NET_ALLOCATION_SCOPE(broadcast);
+            NET_COUNT_ALLOCATION_MESSAGES(broadcast, 1);
+
+            const Delivery_mode mode = this->get_delivery_mode(message.get().get_id());
+
+            // Lock keeps the members from joining between the multicast and the connections
+            std::unique_lock multicast_lock(m_multicast_mutex, std::defer_lock);
+            bool is_multicast = false;
+
+            if (m_multicast_sender && mode == Delivery_mode::reliable && !options.m_conflation_key &&
+                Multicast_sender<Id_type>::fits(message.get()))
+            {
+                multicast_lock.lock();
+                is_multicast = !m_multicast_members.empty();
+
+                if (is_multicast)
+                    m_multicast_sender->send(message.get(), ignored_client);
+            }
+
+            // Multicast members are only read while the lock is held by this thread
+            for_each_connected_client([&](uint32_t client_id, const auto& connection) {
+                if (client_id == ignored_client || (is_multicast && m_multicast_members.contains(client_id)))
+                    return;
+
+                if (mode == Delivery_mode::reliable || !send_datagram_to_client(client_id, message.get(), mode))
+                    connection->send_message(message, options);
+            });
+        }
+
+        // Queues the message to the subscribers of the topic on this node
+        void publish_to_subscribers(
+            uint64_t topic, const Outgoing_message<Id_type>& message, uint32_t ignored_client,
+            Message_priority priority)
+        {
+            NET_ALLOCATION_SCOPE(broadcast);
+            NET_COUNT_ALLOCATION_MESSAGES(broadcast, 1);
+
+            const Delivery_mode mode = this->get_delivery_mode(message.get().get_id());
+
+            m_topics.for_each_subscriber(
+                topic, [this, &message, ignored_client, priority, mode](uint32_t id, const auto& connection) {
+                    if (id != ignored_client)
+                        send_shared_message(id, *connection, message, mode, priority);
+                });
+        }
+
+        // Queues the shared message to the client that was found without the registry
+        void send_shared_message(
+            uint32_t client_id, Connection<Id_type>& connection, const Outgoing_message<Id_type>& message,
+            Delivery_mode mode, Message_priority priority)
+        {
+            if (!connection.is_connected())
+                return;
+
+            if (mode == Delivery_mode::reliable || !send_datagram_to_client(client_id, message.get(), mode))
+                connection.send_message(message, {.m_priority = priority});
+        }
+
+        /**
+         *   Sends the message in a datagram of the mode
+         *
+         *   @return false if the message has to go through the connection, because the client has not opened its
+         *   datagram channel or the message does not fit in a datagram
+         */
+        [[nodiscard]] bool send_datagram_to_client(
+            uint32_t client_id, const Message<Id_type>& message, Delivery_mode mode)
+        {
+            if (!m_datagram_channel || !Datagram_channel<Id_type>::fits(message, mode))
+                return false;
+
+            std::unique_lock lock(m_datagram_mutex);
+            const auto peer = m_datagram_peers.find(client_id);
+
+            if (peer == m_datagram_peers.end() || !peer->second.m_session)
+                return false;
+
+            if (mode != Delivery_mode::unreliable)
+            {
+                const std::shared_ptr<Reliable_datagram_session<Id_type>> session = peer->second.m_session;
+                lock.unlock();
+
+                session->send(message, mode == Delivery_mode::ordered_datagram);
+                return true;
+            }
+
+            const Datagram_protocol::endpoint endpoint = peer->second.m_endpoint;
+            const Datagram_prefix prefix = {.m_token = peer->second.m_token, .m_connection_id = client_id};
+            lock.unlock();
+
+            m_datagram_channel->send(endpoint, prefix, message);
+            return true;
+        }
+
+        // Opens the datagram channel on the port of the tcp acceptor or closes it if it has been disabled
+        void open_datagram_channel()
+        {
+            const Protocol::endpoint endpoint = m_acceptors.front().local_endpoint();
+
+            if (this->is_datagram_channel_enabled() && m_datagram_channel && m_datagram_port == endpoint.port())
+                return;
+
+            // Sessions send through the channel so they are closed with it, the clients start new ones
+            {
+                std::lock_guard lock(m_datagram_mutex);
+
+                for (auto& [client_id, peer] : m_datagram_peers)
+                    if (auto session = std::exchange(peer.m_session, nullptr))
+                        session->close();
+            }
+
+            m_datagram_channel.reset();
+
+            if (!this->is_datagram_channel_enabled())
+                return;
+
+            m_datagram_channel.emplace(this->get_executor());
+            m_datagram_channel->m_on_hello.set_callback(this, &Server<Id_type>::handle_datagram_hello);
+            m_datagram_channel->m_on_message.set_callback(this, &Server<Id_type>::handle_datagram_message);
+            m_datagram_channel->m_on_reliable.set_callback(this, &Server<Id_type>::handle_reliable_datagram);
+            m_datagram_channel->m_on_error.set_callback(this, &Server<Id_type>::handle_datagram_error);
+
+            if (const asio::error_code error =
+                    m_datagram_channel->open(Datagram_protocol::endpoint(endpoint.address(), endpoint.port())))
+            {
+                m_datagram_channel.reset();
+                throw std::system_error(error, "Datagram channel");
+            }
+
+#ifdef NET_HAS_AF_XDP
+            if (m_datagram_xdp_settings)
+                if (const asio::error_code error = m_datagram_channel->open_xdp(*m_datagram_xdp_settings))
+                    handle_datagram_error(error);
+#endif
+
+            m_datagram_port = endpoint.port();
+        }
+
+        // Opens the multicast sender again with the settings, the clients join it when they are accepted
+        void open_multicast()
+        {
+            {
+                std::lock_guard lock(m_multicast_mutex);
+                m_multicast_members.clear();
+            }
+
+            m_multicast_sender.reset();
+
+            if (!m_multicast_settings)
+                return;
+
+            m_multicast_token = (static_cast<uint64_t>(m_random_device()) << 32) | m_random_device();
+            m_multicast_sender.emplace(this->get_executor());
+
+            if (const asio::error_code error = m_multicast_sender->open(*m_multicast_settings, m_multicast_token))
+            {
+                m_multicast_sender.reset();
+                throw std::system_error(error, "Multicast");
+            }
+        }
+
+        /**
+         *   Sends the messages of the sequences that the client missed through its connection, the ones that were
+         *   not sent to the client or are no longer kept are skipped
+         */
+        void repair_multicast(Connection<Id_type>& connection, uint32_t client_id, uint32_t first, uint32_t count)
+        {
+            count = static_cast<uint32_t>(std::min<size_t>(count, m_multicast_sender->get_history_size()));
+
+            uint32_t skip_first = 0;
+            uint32_t skip_count = 0;
+            Multicast_skip_reason skip_reason = Multicast_skip_reason::lost;
+
+            const auto send_skip = [&] {
+                if (skip_count != 0)
+                    connection.send_message(
+                        Multicast_message<Id_type>::create_skip(skip_first, skip_count, skip_reason));
+
+                skip_count = 0;
+            };
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const uint32_t sequence = first + i;
+                const auto sent = m_multicast_sender->find(sequence);
+
+                if (sent && sent->m_ignored_client != client_id)
+                {
+                    send_skip();
+                    connection.send_message(Multicast_message<Id_type>::create_repair(sent->m_message, sequence));
+                    continue;
+                }
+
+                const Multicast_skip_reason reason =
+                    sent ? Multicast_skip_reason::ignored : Multicast_skip_reason::lost;
+
+                if (skip_count != 0 && reason != skip_reason)
+                    send_skip();
+
+                if (skip_count == 0)
+                {
+                    skip_first = sequence;
+                    skip_reason = reason;
+                }
+
+                ++skip_count;
+            }
+
+            send_skip();
+        }
+
+        /**
+         *   Handles the join, leave and the repair requests of the client. The members change with the lock of the
+         *   sends, so the client gets every message either through the group or through its connection.
+         */
+        void handle_multicast_message(Owned_message<Id_type>& owned_message)
+        {
+            const uint32_t client_id = owned_message.m_client_information.m_id;
+            Message<Id_type>& message = owned_message.m_message;
+            const auto connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return;
+
+            if (!m_multicast_sender || message.get_internal_id() == Internal_id::multicast_repair ||
+                message.get_internal_id() == Internal_id::multicast_skip)
+            {
+                disconnect_client(client_id);
+                return;
+            }
+
+            if (message.get_internal_id() == Internal_id::multicast_join)
+            {
+                if (Multicast_message<Id_type>::extract_join(message))
+                {
+                    disconnect_client(client_id);
+                    return;
+                }
+
+                std::lock_guard lock(m_multicast_mutex);
+                m_multicast_members.insert(client_id);
+                connection->send_message(
+                    Multicast_message<Id_type>::create_join(m_multicast_sender->get_next_sequence()));
+            }
+            else if (message.get_internal_id() == Internal_id::multicast_leave)
+            {
+                const uint32_t next_sequence = Multicast_message<Id_type>::extract_leave(message);
+
+                std::lock_guard lock(m_multicast_mutex);
+                const uint32_t count = m_multicast_sender->get_next_sequence() - next_sequence;
+
+                // Sequence ahead of the sender is not from this client
+                if (m_multicast_members.erase(client_id) != 0 && count <= UINT32_MAX / 2)
+                    repair_multicast(*connection, client_id, next_sequence, count);
+            }
+            else
+            {
+                uint32_t first_sequence = 0;
+                uint32_t count = 0;
+                Multicast_message<Id_type>::extract_nak(message, first_sequence, count);
+
+                repair_multicast(*connection, client_id, first_sequence, count);
+            }
+        }
+
+        // @return the token of the client, its datagrams are accepted once it has sent the hello
+        [[nodiscard]] uint64_t add_datagram_peer(uint32_t client_id)
+        {
+            std::lock_guard lock(m_datagram_mutex);
+            const uint64_t token = (static_cast<uint64_t>(m_random_device()) << 32) | m_random_device();
+            m_datagram_peers[client_id] = {.m_token = token};
+
+            return token;
+        }
+
+        /**
+         *   Checks the prefix and updates the endpoint of the client, so the client can continue from a new
+         *   address after a nat has changed its port. The session of the client is created with its first datagram.
+         *
+         *   @return the session of the client, nullptr if the datagram is not from a client of this server
+         */
+        [[nodiscard]] std::shared_ptr<Reliable_datagram_session<Id_type>> update_datagram_peer(
+            const Datagram_prefix& prefix, const Datagram_protocol::endpoint& sender)
+        {
+            std::lock_guard lock(m_datagram_mutex);
+            const auto found_peer = m_datagram_peers.find(prefix.m_connection_id);
+
+            if (found_peer == m_datagram_peers.end() || found_peer->second.m_token != prefix.m_token)
+                return nullptr;
+
+            Datagram_peer& peer = found_peer->second;
+
+            if (!peer.m_session)
+                peer.m_session =
+                    std::make_shared<Reliable_datagram_session<Id_type>>(*m_datagram_channel, sender, prefix);
+            else if (peer.m_endpoint != sender)
+                peer.m_session->set_endpoint(sender);
+
+            peer.m_endpoint = sender;
+            return peer.m_session;
+        }
+
+        // Answers the hello so the client starts sending the messages in datagrams
+        void handle_datagram_hello(const Datagram_prefix& prefix, const Datagram_protocol::endpoint& sender)
+        {
+            if (update_datagram_peer(prefix, sender))
+                m_datagram_channel->send_hello(sender, prefix);
+        }
+
+        void handle_datagram_message(
+            const Datagram_prefix& prefix, const Datagram_protocol::endpoint& sender, Message<Id_type>& message)
+        {
+            if (update_datagram_peer(prefix, sender))
+                this->receive_datagram_message(
+                    message, Client_information(prefix.m_connection_id, sender.address().to_string()));
+        }
+
+        void handle_reliable_datagram(
+            const Datagram_prefix& prefix, const Datagram_protocol::endpoint& sender, const Reliable_header& header,
+            Message<Id_type>* message)
+        {
+            const auto session = update_datagram_peer(prefix, sender);
+
+            if (session == nullptr)
+                return;
+
+            // Handlers of the channel run on its strand so the vector is not used at the same time
+            m_delivered_datagrams.clear();
+            session->receive(header, message, m_delivered_datagrams);
+
+            if (m_delivered_datagrams.empty())
+                return;
+
+            // Messages of the datagram share the ip text
+            const Client_information information(prefix.m_connection_id, sender.address().to_string());
+
+            for (Message<Id_type>& delivered : m_delivered_datagrams)
+                this->receive_datagram_message(delivered, information);
+        }
+
+        void handle_datagram_error(const asio::error_code& error)
+        {
+            this->push_notification(
+                {.m_code = Notification_code::datagram_channel_failed,
+                 .m_severity = Severity::error,
+                 .m_error = error});
+        }
+
+        // Connections report when they disconnect so the clients are removed without checking all of them
+        [[nodiscard]] std::shared_ptr<Connection<Id_type>> find_connection(uint32_t client_id) const override
+        {
+            return m_clients.find(client_id);
+        }
+
+        void handle_disconnect(uint32_t client_id) override
+        {
+            // Broadcasts skip the client until the update removes it
+            m_clients.mark_disconnected(client_id);
+            m_disconnected_clients.push_back(client_id);
+            this->notify_wait();
+        }
+
+        void handle_write_pressure(const Client_information& client, bool is_congested) override
+        {
+            m_on_client_write_pressure.broadcast(client, is_congested);
+        }
+
+        // Removes the clients whose connections have disconnected
+        void handle_disconnected_clients()
+        {
+            while (!m_disconnected_clients.empty())
+                remove_client(m_disconnected_clients.pop_front());
+        }
+
+        // Triggers the handler of the id or the on message callback for the every message
+        // @return the amount of messages handled
+        size_t handle_received_messages(size_t max_messages)
+        {
+            const std::span<Owned_message<Id_type>> received_messages = this->pop_received_batch(max_messages);
+
+            for (Owned_message<Id_type>& owned_message : received_messages)
+            {
+                if (m_handler_pool)
+                {
+                    const uint32_t client_id = owned_message.m_client_information.m_id;
+
+                    m_handler_pool->post(
+                        client_id, [this, owned_message = std::make_shared<Owned_message<Id_type>>(
+                                              std::move(owned_message))] { dispatch_message(*owned_message); });
+                }
+                else
+                    dispatch_message(owned_message);
+            }
+
+            return received_messages.size();
+        }
+
+        // Enough messages to use the time left at the measured cost, atleast one
+        [[nodiscard]] size_t get_deadline_batch_size(std::chrono::steady_clock::duration time_left) const noexcept
+        {
+            const auto message_cost = std::max(m_message_cost, std::chrono::nanoseconds(1));
+            const auto batch_size = std::chrono::duration_cast<std::chrono::nanoseconds>(time_left) / message_cost;
+
+            return std::clamp<size_t>(static_cast<size_t>(std::max<int64_t>(batch_size, 0)), 1, MAX_DEADLINE_BATCH);
+        }
+
+        void flush_if_tick_corked()
+        {
+            if (this->is_tick_corked())
+                flush_clients();
+        }
+
+        // Moving average of the time a message takes, the recent batches weigh the most
+        void update_message_cost(size_t handled_messages, std::chrono::steady_clock::duration handled_time) noexcept
+        {
+            if (handled_messages == 0)
+                return;
+
+            const auto batch_cost = std::chrono::duration_cast<std::chrono::nanoseconds>(handled_time) /
+                                    static_cast<int64_t>(handled_messages);
+            m_message_cost = (m_message_cost * 7 + batch_cost) / 8;
+        }
+
+        void handle_io_thread_message(Owned_message<Id_type>& owned_message) override
+        {
+            dispatch_message(owned_message);
+        }
+
+        // Gives the message to the handler of its id or the m_on_message
+        void dispatch_message(Owned_message<Id_type>& owned_message)
+        {
+            const Id_type id = owned_message.m_message.get_id();
+            const auto* handler = m_message_handlers.find(id);
+
+            this->run_handler(id, [&] {
+                if (handler != nullptr)
+                    handler->broadcast(owned_message.m_client_information, std::move(owned_message.m_message));
+                else
+                    m_on_message.broadcast(
+                        std::move(owned_message.m_client_information), std::move(owned_message.m_message));
+            });
+        }
+
+        // Handles messages internal to framework
+        void handle_internal_message(Owned_message<Id_type> owned_message) override
+        {
+            const uint32_t client_id = owned_message.m_client_information.m_id;
+
+            switch (owned_message.m_message.get_internal_id())
+            {
+            case Internal_id::client_accept:
+                handle_client_accept(
+                    client_id, Message_converter<Id_type>::extract_client_accept(owned_message.m_message));
+                break;
+            case Internal_id::client_hello:
+                handle_client_hello(owned_message);
+                break;
+            case Internal_id::stream_chunk:
+                handle_stream_chunk(std::move(owned_message));
+                break;
+            case Internal_id::cluster_hello:
+            case Internal_id::cluster_route:
+            case Internal_id::cluster_publish:
+                handle_cluster_message(owned_message);
+                break;
+            case Internal_id::multicast_join:
+            case Internal_id::multicast_leave:
+            case Internal_id::multicast_nak:
+            case Internal_id::multicast_repair:
+            case Internal_id::multicast_skip:
+                handle_multicast_message(owned_message);
+                break;
+            case Internal_id::replication_ack:
+                handle_replication_ack(owned_message);
+                break;
+            default:
+                // Server does not handle any other internal messages so this must be invalid message
+                disconnect_client(client_id);
+                break;
+            }
+        }
+
+        void handle_replication_ack(const Owned_message<Id_type>& owned_message)
+        {
+            try
+            {
+                const uint64_t sequence = State_replica<Id_type>::read_acknowledgement(owned_message.m_message);
+
+                std::lock_guard lock(m_replication_mutex);
+                m_state_replicator.acknowledge(owned_message.m_client_information.m_id, sequence);
+            }
+            catch (const std::exception&)
+            {
+                disconnect_client(owned_message.m_client_information.m_id);
+            }
+        }
+
+        void handle_stream_chunk(Owned_message<Id_type> owned_message)
+        {
+            const uint32_t client_id = owned_message.m_client_information.m_id;
+            const auto chunk = Stream_chunk<Id_type>::from_message(std::move(owned_message.m_message));
+
+            if (chunk.has_value())
+                m_on_stream_chunk.broadcast(owned_message.m_client_information, chunk.value());
+            else
+                disconnect_client(client_id);
+        }
+
+        /**
+         *   Handles the messages of the other cluster nodes, the client has to send the hello with the key of the
+         *   cluster before anything else. Routed messages and publishes are only sent on, not forwarded again.
+         */
+        void handle_cluster_message(Owned_message<Id_type>& owned_message)
+        {
+            const uint32_t client_id = owned_message.m_client_information.m_id;
+            Message<Id_type>& message = owned_message.m_message;
+
+            try
+            {
+                if (message.get_internal_id() == Internal_id::cluster_hello)
+                {
+                    if (!m_cluster.accept_hello(client_id, Cluster_message<Id_type>::extract_hello(message)))
+                        disconnect_client(client_id);
+                }
+                else if (!m_cluster.is_peer(client_id))
+                    disconnect_client(client_id);
+                else if (message.get_internal_id() == Internal_id::cluster_route)
+                {
+                    const uint32_t target_client = Cluster_message<Id_type>::extract_route(message);
+                    send_message_to_client(target_client, std::move(message));
+                }
+                else
+                    Cluster_message<Id_type>::for_each_publish(
+                        message, [this](uint64_t topic, Message<Id_type>& published) {
+                            if (!this->is_within_accepted_limits(published))
+                                throw std::length_error("Published message is not in the accepted limits");
+
+                            publish_to_subscribers(
+                                topic, Outgoing_message<Id_type>(make_prepared_message(std::move(published))), 0,
+                                Message_priority::normal);
+                        });
+            }
+            catch (const std::exception&)
+            {
+                disconnect_client(client_id);
+            }
+        }
+
+        // Stores the capabilities both sides have, the client sends its hello only after the hello of the server
+        void handle_client_hello(const Owned_message<Id_type>& owned_message)
+        {
+            const uint32_t client_id = owned_message.m_client_information.m_id;
+            const auto connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return;
+
+            try
+            {
+                const Hello_data hello = Message_converter<Id_type>::extract_hello(owned_message.m_message);
+                const Capability_set agreed_capabilities = create_server_hello().m_capabilities.intersect(
+                    hello.m_capabilities);
+
+                connection->set_agreed_capabilities(agreed_capabilities);
+                m_on_client_hello.broadcast(owned_message.m_client_information, hello, agreed_capabilities);
+            }
+            catch (const std::exception&)
+            {
+                disconnect_client(client_id);
+            }
+        }
+
+        // Starts using the header format and the compression that the client agreed to
+        void handle_client_accept(uint32_t client_id, const Client_accept_data& data)
+        {
+            const auto connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return;
+
+            // Client can't agree to anything that was not offered
+            const bool is_format_offered = data.m_header_format <= this->get_header_format();
+            const Compression_settings& compression = this->get_compression_settings();
+            const bool is_compression_offered =
+                data.m_compression_codec == Compression_codec::none ||
+                (data.m_compression_codec == compression.m_codec &&
+                 (data.m_compression_mode == Compression_mode::per_message ||
+                  compression.m_mode == Compression_mode::stream));
+
+            if (!is_format_offered || !is_compression_offered)
+            {
+                remove_client(client_id);
+                return;
+            }
+
+            connection->set_write_header_format(data.m_header_format);
+            connection->set_write_compression(data.m_compression_codec, data.m_compression_mode);
+
+            if (data.m_resume_token != 0)
+                resume_session(*connection, client_id, data.m_resume_token);
+        }
+
+        // Answers the reconnected client with the session it had, the kept session can be resumed only once
+        void resume_session(Connection<Id_type>& connection, uint32_t client_id, uint64_t resume_token)
+        {
+            Session_resume_data data;
+
+            {
+                std::lock_guard lock(m_sessions_mutex);
+                erase_expired_sessions();
+
+                const auto session = m_kept_sessions.find(resume_token);
+
+                if (session != m_kept_sessions.end())
+                {
+                    data = {
+                        .m_is_resumed = true,
+                        .m_previous_client_id = session->second.m_client_id,
+                        .m_received_messages = session->second.m_received_messages};
+                    m_kept_sessions.erase(session);
+                }
+            }
+
+            connection.send_message(Message_converter<Id_type>::create_session_resume(data));
+
+            // Kept messages go before anything the user sends to the new id
+            if (data.m_is_resumed && m_offline_queue)
+            {
+                m_offline_queue->take(
+                    data.m_previous_client_id, [&connection](std::span<const char> header, std::span<const char> body) {
+                        connection.send_message(make_offline_message(header, body));
+                    });
+            }
+
+            if (data.m_is_resumed)
+                m_on_client_resumed.broadcast(
+                    connection.get_client_information(), data.m_previous_client_id);
+        }
+
+        // @return the token the client resumes the session with, 0 if the sessions are not kept
+        [[nodiscard]] uint64_t create_session(uint32_t client_id)
+        {
+            std::lock_guard lock(m_sessions_mutex);
+
+            if (!m_session_keep_time)
+                return 0;
+
+            uint64_t token = 0;
+
+            while (token == 0)
+                token = (static_cast<uint64_t>(m_session_random_device()) << 32) | m_session_random_device();
+
+            m_session_tokens[client_id] = token;
+            return token;
+        }
+
+        // Moves the session of the removed client to the kept sessions until it expires
+        void keep_session(uint32_t client_id, uint64_t received_messages)
+        {
+            std::lock_guard lock(m_sessions_mutex);
+            const auto token = m_session_tokens.find(client_id);
+
+            if (token == m_session_tokens.end())
+                return;
+
+            if (m_session_keep_time)
+            {
+                const auto expiry_time = std::chrono::steady_clock::now() + *m_session_keep_time;
+                m_kept_sessions[token->second] = {
+                    .m_client_id = client_id, .m_received_messages = received_messages, .m_expiry_time = expiry_time};
+                m_session_expiries.emplace_back(expiry_time, token->second);
+
+                if (m_offline_queue)
+                    m_offline_queue->open_client(client_id);
+            }
+
+            m_session_tokens.erase(token);
+            erase_expired_sessions();
+        }
+
+        // Sessions expire in the order they were kept, the sessions mutex has to be locked
+        void erase_expired_sessions()
+        {
+            const auto now = std::chrono::steady_clock::now();
+
+            while (!m_session_expiries.empty() && m_session_expiries.front().first <= now)
+            {
+                const auto session = m_kept_sessions.find(m_session_expiries.front().second);
+
+                // Session may have been resumed already or kept again with a later expiry
+                if (session != m_kept_sessions.end() && session->second.m_expiry_time <= now)
+                {
+                    if (m_offline_queue)
+                        m_offline_queue->close_client(session->second.m_client_id);
+
+                    m_kept_sessions.erase(session);
+                }
+
+                m_session_expiries.pop_front();
+            }
+        }
+
+        /**
+         * Handles the new non accepted connections
+         *
+         * @param max amount of the new connections handled
+         * @return the amount of the new connections handled
+         */
+        size_t handle_new_connections(size_t max_amount)
+        {
+            size_t handled = 0;
+
+            for (; handled < max_amount && !m_new_connections.empty(); ++handled)
+                std::visit(
+                    [this](auto&& socket) { create_client(std::move(socket)); }, m_new_connections.pop_front());
+
+            return handled;
+        }
+
+        // Adds the clients admitted by the asio threads, their connections are already running
+        void handle_admitted_connections()
+        {
+            while (!m_admitted_connections.empty())
+            {
+                std::shared_ptr<Connection<Id_type>> connection = m_admitted_connections.pop_front();
+
+                const uint32_t client_id = connection->get_id();
+                const Client_information information = connection->get_client_information();
+
+                // Client was disconnected by the id before it was added
+                if (!m_clients.insert(client_id, connection))
+                {
+                    connection->disconnect();
+                    continue;
+                }
+
+                bool client_accepted = true;
+                m_on_client_connect.broadcast(information, client_accepted);
+
+                if (!client_accepted)
+                    disconnect_client(client_id);
+            }
+        }
+
+        // Messages can be from the clients that were admitted after the last update so they are added first
+        void before_handling_received_batch() override
+        {
+            handle_admitted_connections();
+        }
+
+        // Sends the settings of the server, the client starts receiving messages after this
+        void send_server_accept(Connection<Id_type>& connection, uint32_t unique_id)
+        {
+            Server_data server_data = {
+                .m_client_id = unique_id,
+                .m_header_format = this->get_header_format(),
+                .m_compression_codec = this->get_compression_settings().m_codec,
+                .m_compression_mode = this->get_compression_settings().m_mode,
+                .m_dictionary_hash = this->get_compression_settings().dictionary_hash()};
+
+            if (m_datagram_channel)
+            {
+                server_data.m_datagram_port = m_datagram_port;
+                server_data.m_datagram_token = add_datagram_peer(unique_id);
+            }
+
+            if (m_multicast_sender)
+            {
+                const asio::ip::address& group = m_multicast_settings->m_group;
+                server_data.m_multicast_group =
+                    (group.is_v4() ? asio::ip::make_address_v6(asio::ip::v4_mapped, group.to_v4()) : group.to_v6())
+                        .to_bytes();
+                server_data.m_multicast_port = m_multicast_settings->m_port;
+                server_data.m_multicast_token = m_multicast_token;
+            }
+
+            server_data.m_session_token = create_session(unique_id);
+
+            // Hello goes first so the client knows it when it answers the accept, the older clients ignore it
+            connection.send_message(
+                Message_converter<Id_type>::create_hello(Internal_id::server_hello, create_server_hello()));
+            connection.send_message(Message_converter<Id_type>::create_server_accept(server_data));
+        }
+
+        [[nodiscard]] Hello_data create_server_hello()
+        {
+            Hello_data hello = this->create_hello();
+
+            if (m_datagram_channel)
+                hello.m_capabilities.add(Capability::datagram_channel);
+
+            hello.m_capabilities.add(Capability::state_replication);
+
+            {
+                std::lock_guard lock(m_sessions_mutex);
+
+                if (m_session_keep_time)
+                    hello.m_capabilities.add(Capability::session_resume);
+            }
+
+            return hello;
+        }
+
+        // Prepares the client for receiving messages
+        void setup_client(std::shared_ptr<Connection<Id_type>> connection, uint32_t unique_id)
+        {
+            send_server_accept(*connection, unique_id);
+            if (!m_clients.insert(unique_id, connection))
+                connection->disconnect();
+        }
+
+        // Adds the new socket as connection
+        void create_client(Protocol::socket socket)
+        {
+            if (!socket.is_open())
+                return;
+
+            asio::error_code error;
+            const Protocol::endpoint endpoint = socket.remote_endpoint(error);
+
+            if (error)
+                return;
+
+            create_client(endpoint, [this, &socket](uint32_t client_id) {
+                return this->create_connection(std::move(socket), client_id, Handshake_type::server);
+            });
+        }
+
+        // Adds the socket of the other transports as connection
+        void create_client(std::unique_ptr<Socket_interface> socket)
+        {
+            create_client(get_remote_endpoint(*socket), [this, &socket](uint32_t client_id) {
+                return this->create_connection(std::move(socket), client_id, Handshake_type::server);
+            });
+        }
+
+        // Quic sockets know the ip of the client, the in-memory and the unix domain sockets are on the same host
+        [[nodiscard]] static Protocol::endpoint get_remote_endpoint(const Socket_interface& socket)
+        {
+            const std::optional<asio::ip::address> address = socket.get_address();
+            return address ? Protocol::endpoint(*address, 0) : SAME_HOST_ENDPOINT;
+        }
+
+        /**
+         *   Reserves the id for the new client and creates its connection if the client is accepted
+         *
+         *   @param the endpoint of the client
+         *   @param creates the connection with the reserved id
+         */
+        template <typename Connection_factory>
+        void create_client(const Protocol::endpoint& endpoint, Connection_factory&& create_new_connection)
+        {
+            NET_ALLOCATION_SCOPE(accept);
+            const std::optional<uint32_t> reserved_id = m_clients.reserve();
+
+            if (!reserved_id.has_value())
+            {
+                this->push_notification(
+                    {.m_code = Notification_code::no_free_client_ids,
+                     .m_severity = Severity::error,
+                     .m_address = endpoint.address()});
+                return;
+            }
+
+            const uint32_t client_id = reserved_id.value();
+
+            bool client_accepted = true;
+            // Ip is formatted only for the callback
+            if (m_on_client_connect.has_been_set())
+                m_on_client_connect.broadcast(
+                    Client_information(client_id, endpoint.address().to_string()), client_accepted);
+
+            if (client_accepted)
+            {
+                auto new_connection = create_new_connection(client_id);
+
+                this->push_notification(
+                    {.m_code = Notification_code::client_accepted,
+                     .m_client_id = client_id,
+                     .m_address = endpoint.address()});
+
+                setup_client(std::move(new_connection), client_id);
+            }
+            else
+            {
+                m_clients.erase(client_id);
+                this->push_notification(
+                    {.m_code = Notification_code::connection_denied, .m_address = endpoint.address()});
+            }
+        }
+
+        /**
+         *   Admits the client on the strand of its socket in the io_thread mode. The reads of the connection
+         *   complete on the same strand, so the connection is queued to the update before any of its messages.
+         */
+        void admit_client(Protocol::socket socket)
+        {
+            asio::error_code error;
+            const Protocol::endpoint endpoint = socket.remote_endpoint(error);
+
+            if (error)
+                return;
+
+            admit_client(endpoint, [this, &socket](uint32_t client_id) {
+                return this->create_connection(std::move(socket), client_id, Handshake_type::server);
+            });
+        }
+
+        void admit_client(std::unique_ptr<Socket_interface> socket)
+        {
+            admit_client(get_remote_endpoint(*socket), [this, &socket](uint32_t client_id) {
+                return this->create_connection(std::move(socket), client_id, Handshake_type::server);
+            });
+        }
+
+        template <typename Connection_factory>
+        void admit_client(const Protocol::endpoint& endpoint, Connection_factory&& create_new_connection)
+        {
+            NET_ALLOCATION_SCOPE(accept);
+            const std::optional<uint32_t> reserved_id = m_clients.reserve();
+
+            if (!reserved_id.has_value())
+            {
+                this->push_notification(
+                    {.m_code = Notification_code::no_free_client_ids,
+                     .m_severity = Severity::error,
+                     .m_address = endpoint.address()});
+                return;
+            }
+
+            const uint32_t client_id = reserved_id.value();
+
+            bool client_accepted = true;
+            // Ip is formatted only for the callback
+            if (m_on_client_admission.has_been_set())
+                m_on_client_admission.broadcast(
+                    Client_information(client_id, endpoint.address().to_string()), client_accepted);
+
+            if (!client_accepted)
+            {
+                m_clients.erase(client_id);
+                this->push_notification(
+                    {.m_code = Notification_code::connection_denied, .m_address = endpoint.address()});
+                return;
+            }
+
+            auto new_connection = create_new_connection(client_id);
+            send_server_accept(*new_connection, client_id);
+
+            m_admitted_connections.push_back(std::move(new_connection));
+            this->notify_wait();
+
+            this->push_notification(
+                {.m_code = Notification_code::client_accepted,
+                 .m_client_id = client_id,
+                 .m_address = endpoint.address()});
+        }
+
+        /**
+         *   Gives the acceptors a filter of the current bans, the acceptors keep the old one if the new filter can
+         *   not be made. The ban mutex has to be locked.
+         */
+        void update_ban_filter()
+        {
+#ifdef NET_HAS_BAN_FILTER
+            if (!m_has_kernel_ban_filter)
+                return;
+
+            const std::optional<Ban_filter> filter = Ban_filter::create(m_banned_ips);
+
+            if (!filter)
+            {
+                this->push_notification(
+                    {.m_severity = Severity::error,
+                     .m_text = "Banned ips need more instructions than the socket filter allows, the filter "
+                               "keeps the earlier bans and the rest are checked after the accept"});
+                return;
+            }
+
+            for (Protocol::acceptor& acceptor : m_acceptors)
+            {
+                asio::error_code error;
+                filter->attach(acceptor, error);
+
+                if (error)
+                    this->push_notification(
+                        {.m_severity = Severity::error,
+                         .m_error = error,
+                         .m_text = std::format("Ban filter could not be attached: {}", error.message())});
+            }
+#endif
+        }
+
+        [[nodiscard]] bool is_banned(const asio::ip::address& address) const
+        {
+            std::shared_lock lock(m_banned_ips_mutex);
+            return m_banned_ips.contains(address);
+        }
+
+        // Ipv6 wildcard would take the ipv4 connections of the port, so it can not listen them if ipv4 does
+        [[nodiscard]] bool is_v6_only(const Protocol::endpoint& endpoint) const
+        {
+            return endpoint.address().is_v6() &&
+                   std::ranges::any_of(m_endpoints, [&endpoint](const Protocol::endpoint& other) {
+                       return other.address().is_v4() && other.port() == endpoint.port();
+                   });
+        }
+
+        /**
+         *   Checks the max connections for the connection that is being accepted
+         *
+         *   @return false if the connection has to be rejected
+         */
+        [[nodiscard]] bool has_room_for_connection()
+        {
+            const size_t connection_count = m_clients.size() + m_new_connections.size() + m_admitted_connections.size();
+
+            if (connection_count < m_max_connections)
+                return true;
+
+            m_rejected_connections.fetch_add(1, std::memory_order_relaxed);
+            this->push_notification({.m_code = Notification_code::max_connections_reached});
+            return false;
+        }
+
+        // Admits or queues the connection of a socket that is not tcp, the caller has checked whether it is allowed
+        void add_interface_connection(std::unique_ptr<Socket_interface> socket)
+        {
+            if (m_admission_mode == Admission_mode::io_thread)
+            {
+                const asio::any_io_executor socket_executor = socket->get_executor();
+
+                asio::dispatch(socket_executor, [this, socket = std::move(socket)]() mutable {
+                    admit_client(std::move(socket));
+                });
+            }
+            else
+            {
+                m_new_connections.push_back(std::move(socket));
+                this->notify_wait();
+            }
+        }
+
+        void throw_if_running() const
+        {
+            if (this->is_asio_thread_running())
+                throw std::logic_error("Accept settings can't be changed while the server is running");
+        }
+
+        /**
+         *   Opens the acceptors again if their settings have changed and starts the accepts. The acceptor of the
+         *   constructor has to be closed before, because every socket listening the port must have SO_REUSEPORT.
+         *   Accepts stay pending when the server is stopped, so they are started only for the new acceptors.
+         */
+        void open_acceptors()
+        {
+            if (m_are_acceptors_outdated)
+            {
+                // Bans update the filters of the acceptors
+                std::unique_lock ban_lock(m_banned_ips_mutex);
+
+                m_is_accepting = false;
+
+                const bool reuse_port = m_reuse_port_acceptor_count > 1 || m_is_port_shared;
+
+                // Acceptors taken from the old server keep listening as they are
+                const size_t acceptor_count =
+                    m_are_acceptors_taken ? 0 : m_endpoints.size() * m_reuse_port_acceptor_count;
+
+                if (!m_are_acceptors_taken)
+                    m_acceptors.clear();
+
+                for (size_t i = 0; i < acceptor_count; ++i)
+                {
+                    const Protocol::endpoint& endpoint = m_endpoints[i / m_reuse_port_acceptor_count];
+                    m_acceptors.push_back(
+                        this->create_acceptor(endpoint, m_listen_backlog, reuse_port, i, is_v6_only(endpoint)));
+
+#ifdef TCP_DEFER_ACCEPT
+                    if (m_defer_accept)
+                        m_acceptors.back().set_option(Integer_socket_option(
+                            IPPROTO_TCP, TCP_DEFER_ACCEPT, static_cast<int>(m_defer_accept->count())));
+#endif
+                }
+
+                update_ban_filter();
+                ban_lock.unlock();
+
+                m_local_acceptor.reset();
+                m_shared_memory_acceptor.reset();
+
+                if (!m_local_path.empty())
+                    open_local_acceptor(m_local_acceptor, m_local_path);
+
+                if (!m_shared_memory_path.empty())
+                    open_local_acceptor(m_shared_memory_acceptor, m_shared_memory_path);
+
+#ifdef NET_HAS_HOT_RESTART
+                m_hot_restart_acceptor.reset();
+
+                if (!m_hot_restart_path.empty())
+                    open_local_acceptor(m_hot_restart_acceptor, m_hot_restart_path);
+#endif
+
+#ifdef NET_ENABLE_QUIC
+                m_quic_listener.reset();
+                m_quic_configuration.reset();
+
+                if (m_quic_port != 0)
+                    open_quic_listener();
+#endif
+
+                m_are_acceptors_outdated = false;
+            }
+
+            if (!m_is_accepting)
+            {
+                for (Protocol::acceptor& acceptor : m_acceptors)
+                    for (size_t i = 0; i < m_outstanding_accepts; ++i)
+                        async_wait_for_connections(acceptor);
+
+                for (size_t i = 0; m_local_acceptor && i < m_outstanding_accepts; ++i)
+                    async_wait_for_local_connections(*m_local_acceptor, false);
+
+                for (size_t i = 0; m_shared_memory_acceptor && i < m_outstanding_accepts; ++i)
+                    async_wait_for_local_connections(*m_shared_memory_acceptor, true);
+
+#ifdef NET_HAS_HOT_RESTART
+                if (m_hot_restart_acceptor)
+                    async_wait_for_successor();
+#endif
+
+                m_is_accepting = true;
+            }
+        }
+
+        void open_local_acceptor(std::optional<Local_protocol::acceptor>& acceptor, const std::string& path)
+        {
+            // Socket file of an earlier run would make the bind fail
+            std::error_code ignored_error;
+            std::filesystem::remove(path, ignored_error);
+
+            acceptor.emplace(this->get_executor(), Local_protocol::endpoint(path));
+        }
+
+#ifdef NET_HAS_HOT_RESTART
+        // Frames of the hot restart, the connection frame has the bytes the old server had read after its record
+        enum class Hand_off_type : uint8_t
+        {
+            acceptors,
+            connection,
+            end
+        };
+
+        struct Hand_off_record
+        {
+            // Old and new process have to be built with the same version of the record
+            static constexpr uint32_t VERSION = 1;
+
+            uint32_t m_version = VERSION;
+            Hand_off_type m_type = Hand_off_type::end;
+            uint32_t m_client_id = 0;
+            Header_format m_write_header_format = Header_format::standard;
+            Compression_codec m_write_compression_codec = Compression_codec::none;
+            uint64_t m_agreed_capabilities = 0;
+            uint64_t m_received_user_messages = 0;
+            uint64_t m_session_token = 0;
+        };
+#endif
+
+        void schedule_memory_check()
+        {
+            if (const std::shared_ptr<Timer_wheel> timer_wheel = this->get_timer_wheel().lock())
+                m_memory_timer = timer_wheel->schedule(MEMORY_CHECK_PERIOD, [this] { check_memory_budget(); });
+        }
+
+        // Runs on the timer wheel, handles the heaviest clients until the memory should be under the low mark
+        void check_memory_budget()
+        {
+            schedule_memory_check();
+
+            std::vector<std::pair<size_t, std::shared_ptr<Connection<Id_type>>>> connections;
+            size_t memory_bytes = this->get_in_queue_bytes();
+
+            // Disconnected clients that the update has not removed yet are not counted again
+            m_clients.for_each([&connections, &memory_bytes](const std::shared_ptr<Connection<Id_type>>& connection) {
+                if (!connection->is_connected())
+                    return;
+
+                const size_t connection_bytes = connection->get_memory_usage();
+                memory_bytes += connection_bytes;
+                connections.emplace_back(connection_bytes, connection);
+            });
+
+            const size_t low_bytes = m_memory_budget.m_low_bytes.value_or(m_memory_budget.m_max_bytes / 4 * 3);
+
+            if (memory_bytes <= low_bytes)
+            {
+                for (const auto& [client_id, held_connection] : m_memory_held_connections)
+                    if (const auto connection = held_connection.lock())
+                        connection->set_reading_held(false);
+
+                m_memory_held_connections.clear();
+            }
+
+            if (memory_bytes <= m_memory_budget.m_max_bytes)
+                return;
+
+            std::ranges::sort(connections, std::ranges::greater(), [](const auto& connection) {
+                return connection.first;
+            });
+
+            for (const auto& [connection_bytes, connection] : connections)
+            {
+                if (memory_bytes <= low_bytes)
+                    break;
+
+                switch (m_memory_budget.m_policy)
+                {
+                case Memory_policy::pause_reading:
+                    if (m_memory_held_connections.emplace(connection->get_id(), connection).second)
+                        connection->set_reading_held(true);
+                    break;
+                case Memory_policy::conflate:
+                    connection->conflate_write_queue();
+                    break;
+                case Memory_policy::disconnect:
+                    connection->disconnect();
+                    break;
+                }
+
+                // Held client keeps its memory but stops adding to it, so it is counted as handled
+                memory_bytes -= std::min(memory_bytes, connection_bytes);
+            }
+        }
+
+        // Disconnects the clients as the drain describes and waits for them to go
+        void drain_clients(const Drain_settings& settings)
+        {
+            for (Protocol::acceptor& acceptor : m_acceptors)
+                asio::post(acceptor.get_executor(), [&acceptor] {
+                    asio::error_code ignored_error;
+                    acceptor.close(ignored_error);
+                });
+
+            // Connections accepted before that become clients so they are drained too
+            handle_new_connections(SIZE_T_MAX);
+            handle_admitted_connections();
+
+            std::vector<std::shared_ptr<Connection<Id_type>>> connections;
+            connections.reserve(m_clients.size());
+            m_clients.for_each([&connections](const std::shared_ptr<Connection<Id_type>>& connection) {
+                connections.push_back(connection);
+            });
+
+            Message<Id_type> shutdown;
+            shutdown.set_internal_id(Internal_id::server_shutdown);
+
+            for (const std::shared_ptr<Connection<Id_type>>& connection : connections)
+                connection->send_message(shutdown);
+
+            const auto start_time = std::chrono::steady_clock::now();
+            const auto deadline = start_time + settings.m_disconnect_window + settings.m_flush_timeout;
+            size_t disconnected_count = 0;
+
+            const auto get_disconnect_time = [&](size_t index) {
+                return start_time + settings.m_disconnect_window * static_cast<int64_t>(index) /
+                                        static_cast<int64_t>(connections.size());
+            };
+
+            for (auto now = start_time; now < deadline; now = std::chrono::steady_clock::now())
+            {
+                for (; disconnected_count < connections.size() && get_disconnect_time(disconnected_count) <= now;
+                     ++disconnected_count)
+                    connections[disconnected_count]->disconnect_after_flush(settings.m_flush_timeout);
+
+                update();
+
+                if (disconnected_count == connections.size() && m_clients.size() == 0)
+                    break;
+
+                this->wait_until_has_something_to_do(
+                    disconnected_count < connections.size() ? get_disconnect_time(disconnected_count) : deadline);
+            }
+        }
+
+        // Passes this server to the new process that connected to the hot restart path, see the set_hot_restart_path
+        void hand_off_to_successor()
+        {
+#ifdef NET_HAS_HOT_RESTART
+            if (!m_has_successor.exchange(false, std::memory_order_acquire))
+                return;
+
+            std::unique_lock successor_lock(m_successor_mutex);
+            Handle_channel channel(std::move(*m_successor));
+            m_successor.reset();
+            successor_lock.unlock();
+
+            std::vector<std::pair<uint32_t, Connection_hand_off>> hand_offs;
+
+            try
+            {
+                // Clients of the datagram channel and the multicast have state that the new process could not continue
+                const bool can_hand_off_connections = !m_datagram_channel && !m_multicast_sender;
+
+                // New process opens the same udp port
+                if (m_datagram_channel)
+                    m_datagram_channel->close();
+
+                if (m_multicast_sender)
+                    m_multicast_sender->close();
+
+                std::vector<Handle_channel::Handle> acceptor_handles;
+
+                for (Protocol::acceptor& acceptor : m_acceptors)
+                    acceptor_handles.push_back(acceptor.native_handle());
+
+                send_hand_off_record(channel, {.m_type = Hand_off_type::acceptors}, {}, acceptor_handles);
+
+                // New process accepts from the same sockets, so this stops accepting without closing them for it
+                for (Protocol::acceptor& acceptor : m_acceptors)
+                    asio::post(acceptor.get_executor(), [&acceptor] {
+                        asio::error_code ignored_error;
+                        acceptor.close(ignored_error);
+                    });
+
+                // Connections accepted before that become clients so they are handed off too
+                handle_new_connections(SIZE_T_MAX);
+                handle_admitted_connections();
+
+                hand_offs = hand_off_clients(can_hand_off_connections);
+
+                for (auto& [client_id, hand_off] : hand_offs)
+                {
+                    uint64_t session_token = 0;
+
+                    {
+                        std::lock_guard lock(m_sessions_mutex);
+
+                        if (const auto token = m_session_tokens.find(client_id); token != m_session_tokens.end())
+                        {
+                            session_token = token->second;
+                            m_session_tokens.erase(token);
+                        }
+                    }
+
+                    const Hand_off_record record = {
+                        .m_type = Hand_off_type::connection,
+                        .m_client_id = client_id,
+                        .m_write_header_format = hand_off.m_write_header_format,
+                        .m_write_compression_codec = hand_off.m_write_compression_codec,
+                        .m_agreed_capabilities = hand_off.m_agreed_capabilities,
+                        .m_received_user_messages = hand_off.m_received_user_messages,
+                        .m_session_token = session_token};
+
+                    send_hand_off_record(channel, record, hand_off.m_unread_bytes, std::span(&hand_off.m_handle, 1));
+                }
+
+                send_hand_off_record(channel, {.m_type = Hand_off_type::end});
+
+                this->push_notification(
+                    {.m_code = Notification_code::server_handed_off, .m_text = std::to_string(hand_offs.size())});
+            }
+            catch (const std::system_error& exception)
+            {
+                this->push_notification(
+                    {.m_code = Notification_code::hot_restart_failed,
+                     .m_severity = Severity::error,
+                     .m_error = exception.code()});
+            }
+
+            // New process has its own copies of the sockets
+            for (const auto& [client_id, hand_off] : hand_offs)
+                Handle_channel::close_handles(std::span(&hand_off.m_handle, 1));
+#endif
+        }
+
+#ifdef NET_HAS_HOT_RESTART
+        // Waits for one new process at a time, the next one can take over only if this server is still running
+        void async_wait_for_successor()
+        {
+            m_hot_restart_acceptor->async_accept([this](asio::error_code error, Local_protocol::socket socket) {
+                if (error == asio::error::operation_aborted)
+                    return;
+
+                if (error)
+                {
+                    this->push_notification(
+                        {.m_code = Notification_code::hot_restart_failed,
+                         .m_severity = Severity::error,
+                         .m_error = error});
+                    async_wait_for_successor();
+                    return;
+                }
+
+                {
+                    std::lock_guard lock(m_successor_mutex);
+                    m_successor.emplace(std::move(socket));
+                }
+
+                m_has_successor.store(true, std::memory_order_release);
+                this->notify_wait();
+            });
+        }
+
+        /**
+         *   Hands off the connections of the clients and waits for them to finish, the clients are removed by their
+         *   disconnects after this
+         *
+         *   @param false disconnects all of the clients instead
+         *   @return the handed off connections of the clients by their ids
+         */
+        [[nodiscard]] std::vector<std::pair<uint32_t, Connection_hand_off>> hand_off_clients(bool can_hand_off)
+        {
+            // Handlers of the connections that finish after the timeout only close their sockets
+            struct Hand_off_results
+            {
+                std::mutex m_mutex;
+                std::condition_variable m_condition;
+                std::vector<std::pair<uint32_t, Connection_hand_off>> m_hand_offs;
+                size_t m_finished_count = 0;
+                bool m_is_abandoned = false;
+            };
+
+            const auto results = std::make_shared<Hand_off_results>();
+            size_t connection_count = 0;
+
+            m_clients.for_each([&](const std::shared_ptr<Connection<Id_type>>& connection) {
+                if (!can_hand_off)
+                {
+                    connection->disconnect();
+                    return;
+                }
+
+                connection->m_on_hand_off.set_callback(
+                    [results, client_id = connection->get_id()](std::optional<Connection_hand_off>& hand_off) {
+                        std::lock_guard lock(results->m_mutex);
+                        ++results->m_finished_count;
+                        results->m_condition.notify_one();
+
+                        if (!hand_off)
+                            return;
+
+                        if (results->m_is_abandoned)
+                            Handle_channel::close_handles(std::span(&hand_off->m_handle, 1));
+                        else
+                            results->m_hand_offs.emplace_back(client_id, std::move(*hand_off));
+                    });
+
+                connection->hand_off();
+                ++connection_count;
+            });
+
+            std::unique_lock lock(results->m_mutex);
+            results->m_condition.wait_for(lock, HAND_OFF_TIMEOUT, [&results, connection_count] {
+                return results->m_finished_count == connection_count;
+            });
+
+            results->m_is_abandoned = true;
+            return std::move(results->m_hand_offs);
+        }
+
+        // Continues the connections the old server handed off, the failures are notified and the rest continue
+        void take_handed_off_connections()
+        {
+            if (!m_predecessor)
+                return;
+
+            try
+            {
+                std::vector<char> unread_bytes;
+                std::vector<Handle_channel::Handle> handles;
+
+                while (true)
+                {
+                    const Hand_off_record record = receive_hand_off_record(*m_predecessor, unread_bytes, handles);
+
+                    if (record.m_type == Hand_off_type::end)
+                        break;
+
+                    if (record.m_type == Hand_off_type::connection && handles.size() == 1)
+                        take_handed_off_connection(record, handles.front(), std::move(unread_bytes));
+                    else
+                        Handle_channel::close_handles(handles);
+                }
+            }
+            catch (const std::system_error& exception)
+            {
+                this->push_notification(
+                    {.m_code = Notification_code::hot_restart_failed,
+                     .m_severity = Severity::error,
+                     .m_error = exception.code()});
+            }
+
+            m_predecessor.reset();
+        }
+
+        /**
+         *   Adds the client of the old server, it keeps its id unless a new client already has it. The connection
+         *   has done its handshake and hello, so the client is not sent the server accept.
+         */
+        void take_handed_off_connection(
+            const Hand_off_record& record, Handle_channel::Handle handle, std::vector<char> unread_bytes)
+        {
+            Protocol::socket socket(this->next_connection_executor());
+            asio::error_code error;
+            socket.assign(Handle_channel::get_protocol(handle), handle, error);
+
+            if (error)
+            {
+                Handle_channel::close_handles(std::span(&handle, 1));
+                return;
+            }
+
+            const Protocol::endpoint endpoint = socket.remote_endpoint(error);
+
+            if (error)
+                return;
+
+            std::optional<uint32_t> client_id = record.m_client_id;
+
+            if (!m_clients.reserve(record.m_client_id))
+                client_id = m_clients.reserve();
+
+            if (!client_id)
+            {
+                this->push_notification(
+                    {.m_code = Notification_code::no_free_client_ids,
+                     .m_severity = Severity::error,
+                     .m_address = endpoint.address()});
+                return;
+            }
+
+            bool client_accepted = true;
+
+            if (m_on_client_connect.has_been_set())
+                m_on_client_connect.broadcast(
+                    Client_information(*client_id, endpoint.address().to_string()), client_accepted);
+
+            if (!client_accepted)
+            {
+                m_clients.erase(*client_id);
+                return;
+            }
+
+            const Connection_hand_off hand_off = {
+                .m_handle = handle,
+                .m_write_header_format = record.m_write_header_format,
+                .m_write_compression_codec = record.m_write_compression_codec,
+                .m_agreed_capabilities = record.m_agreed_capabilities,
+                .m_received_user_messages = record.m_received_user_messages,
+                .m_unread_bytes = std::move(unread_bytes)};
+
+            auto connection = this->create_connection(
+                std::make_unique<Template_socket<Protocol::socket>>(std::move(socket)), *client_id,
+                Handshake_type::server, &hand_off);
+
+            if (!m_clients.insert(*client_id, connection))
+            {
+                connection->disconnect();
+                return;
+            }
+
+            if (record.m_session_token != 0)
+            {
+                std::lock_guard lock(m_sessions_mutex);
+                m_session_tokens[*client_id] = record.m_session_token;
+            }
+        }
+
+        static void send_hand_off_record(
+            Handle_channel& channel, const Hand_off_record& record, std::span<const char> unread_bytes = {},
+            std::span<const Handle_channel::Handle> handles = {})
+        {
+            std::vector<char> body(sizeof(record) + unread_bytes.size());
+            std::memcpy(body.data(), &record, sizeof(record));
+            std::ranges::copy(unread_bytes, body.begin() + sizeof(record));
+
+            channel.send(body, handles);
+        }
+
+        /**
+         *   @param set to the bytes after the record
+         *   @param set to the handles of the record
+         *   @throws std::system_error if the record could not be received or it is from another version
+         */
+        [[nodiscard]] static Hand_off_record receive_hand_off_record(
+            Handle_channel& channel, std::vector<char>& unread_bytes, std::vector<Handle_channel::Handle>& handles)
+        {
+            handles = channel.receive(unread_bytes);
+            Hand_off_record record;
+
+            if (unread_bytes.size() >= sizeof(record))
+                std::memcpy(&record, unread_bytes.data(), sizeof(record));
+
+            if (unread_bytes.size() < sizeof(record) || record.m_version != Hand_off_record::VERSION)
+            {
+                Handle_channel::close_handles(handles);
+                throw std::system_error(asio::error::operation_not_supported, "Hot restart record");
+            }
+
+            unread_bytes.erase(unread_bytes.begin(), unread_bytes.begin() + sizeof(record));
+            return record;
+        }
+#endif
+
+#ifdef NET_ENABLE_QUIC
+        // msquic accepts by itself so the listener runs also while the server is stopped, like the pending accepts
+        void open_quic_listener()
+        {
+            m_quic_configuration = std::make_shared<Quic_configuration>(m_quic_settings, Handshake_type::server);
+            m_quic_listener.emplace(m_quic_configuration);
+            m_quic_listener->m_on_new_connection.set_callback(this, &Server<Id_type>::handle_new_quic_connection);
+            m_quic_listener->start(m_quic_port);
+        }
+
+        // Called from the threads of msquic, the connection is refused if this does not take it
+        void handle_new_quic_connection(HQUIC connection, const Protocol::endpoint& endpoint, bool& is_accepted)
+        {
+            this->push_notification({.m_code = Notification_code::new_connection, .m_address = endpoint.address()});
+
+            if (!has_room_for_connection())
+                return;
+
+            if (is_banned(endpoint.address()))
+            {
+                m_rejected_connections.fetch_add(1, std::memory_order_relaxed);
+                this->push_notification(
+                    {.m_code = Notification_code::banned_ip_rejected, .m_address = endpoint.address()});
+                return;
+            }
+
+            m_accepted_connections.fetch_add(1, std::memory_order_relaxed);
+            is_accepted = true;
+
+            add_interface_connection(std::make_unique<Quic_socket>(
+                this->next_connection_executor(), m_quic_configuration, connection, endpoint));
+        }
+#endif
+
+        // Primes the Asio thread to wait for the connections in async way
+        void async_wait_for_connections(Protocol::acceptor& acceptor)
+        {
+            /**
+             *   New sockets are created on the executor of the connection so the connections get spread over the
+             *   threads. Reuse port acceptors already are spread so the connections stay on their context.
+             */
+            const asio::any_io_executor executor = m_reuse_port_acceptor_count == 1
+                                                       ? this->next_connection_executor()
+                                                       : asio::make_strand(acceptor.get_executor());
+
+#ifdef NET_HAS_RIO
+            // Socket accepted by the Asio would not have the flag of the RIO, so it is accepted here from the acceptor
+            if (this->is_registered_io_enabled())
+            {
+                acceptor.async_wait(Protocol::acceptor::wait_read, [this, &acceptor, executor](asio::error_code error) {
+                    if (error == asio::error::operation_aborted)
+                        return;
+
+                    Protocol::socket socket(executor);
+
+                    if (!error)
+                        acceptor.accept(socket, error);
+
+                    // Other pending waits were woken by the same connection
+                    if (error != asio::error::would_block)
+                        handle_accepted_socket(error, std::move(socket));
+
+                    async_wait_for_connections(acceptor);
+                });
+
+                return;
+            }
+#endif
+
+            acceptor.async_accept(executor, [this, &acceptor](asio::error_code error, Protocol::socket socket) {
+                // Acceptor was closed so it must not be used anymore
+                if (error == asio::error::operation_aborted)
+                    return;
+
+                handle_accepted_socket(error, std::move(socket));
+                async_wait_for_connections(acceptor);
+            });
+        }
+
+        void handle_accepted_socket(asio::error_code error, Protocol::socket socket)
+        {
+            NET_ALLOCATION_SCOPE(accept);
+            NET_COUNT_ALLOCATION_MESSAGES(accept, 1);
+
+            // Peer can leave before the handler runs, the endpoint is not available then
+            const Protocol::endpoint endpoint = error ? Protocol::endpoint() : socket.remote_endpoint(error);
+
+            if (!error)
+            {
+#ifdef NET_HAS_BAN_FILTER
+                // Accepted socket inherits the filter of the acceptor, the peer has already passed it
+                if (m_has_kernel_ban_filter)
+                    Ban_filter::detach(socket);
+#endif
+
+                this->push_notification(
+                    {.m_code = Notification_code::new_connection, .m_address = endpoint.address()});
+
+                const size_t connection_count =
+                    m_clients.size() + m_new_connections.size() + m_admitted_connections.size();
+
+                if (connection_count >= m_max_connections)
+                {
+                    m_rejected_connections.fetch_add(1, std::memory_order_relaxed);
+                    this->push_notification({.m_code = Notification_code::max_connections_reached});
+                }
+                else if (is_banned(endpoint.address()))
+                {
+                    m_rejected_connections.fetch_add(1, std::memory_order_relaxed);
+                    this->push_notification(
+                        {.m_code = Notification_code::banned_ip_rejected, .m_address = endpoint.address()});
+                }
+                else if (this->is_shedding_connections())
+                {
+                    m_rejected_connections.fetch_add(1, std::memory_order_relaxed);
+                    this->push_notification(
+                        {.m_code = Notification_code::overloaded_connection_rejected, .m_address = endpoint.address()});
+                }
+                else
+                {
+                    m_accepted_connections.fetch_add(1, std::memory_order_relaxed);
+
+                    if (m_admission_mode == Admission_mode::io_thread)
+                    {
+                        const asio::any_io_executor socket_executor = socket.get_executor();
+
+                        asio::dispatch(socket_executor, [this, socket = std::move(socket)]() mutable {
+                            admit_client(std::move(socket));
+                        });
+                    }
+                    else
+                    {
+                        m_new_connections.push_back(std::move(socket));
+                        this->notify_wait();
+                    }
+                }
+            }
+            else
+            {
+                m_accept_errors.fetch_add(1, std::memory_order_relaxed);
+                this->push_notification(
+                    {.m_code = Notification_code::accept_failed, .m_severity = Severity::error, .m_error = error});
+            }
+        }
+
+        /**
+         *   Accepts from the unix domain socket, these have no ip so only the max connections is checked
+         *
+         *   @param the acceptor
+         *   @param true if the connections of the acceptor carry the data in the shared memory
+         */
+        void async_wait_for_local_connections(Local_protocol::acceptor& acceptor, bool use_shared_memory)
+        {
+            acceptor.async_accept(
+                this->next_connection_executor(),
+                [this, &acceptor, use_shared_memory](asio::error_code error, Local_protocol::socket socket) {
+                    if (error == asio::error::operation_aborted)
+                        return;
+
+                    if (error)
+                    {
+                        m_accept_errors.fetch_add(1, std::memory_order_relaxed);
+                        this->push_notification(
+                            {.m_code = Notification_code::accept_failed,
+                             .m_severity = Severity::error,
+                             .m_error = error});
+                    }
+                    else
+                    {
+                        this->push_notification(
+                            {.m_code = Notification_code::new_connection,
+                             .m_address = asio::ip::address_v4::loopback()});
+
+                        if (has_room_for_connection())
+                        {
+                            m_accepted_connections.fetch_add(1, std::memory_order_relaxed);
+                            add_interface_connection(this->create_local_socket_interface(
+                                std::move(socket), use_shared_memory, m_shared_memory_ring_capacity));
+                        }
+                    }
+
+                    async_wait_for_local_connections(acceptor, use_shared_memory);
+                });
+        }
+
+        /**
+         *   Removes the client from m_clients, this is called only from the update thread so the
+         *   m_on_client_disconnect is called there
+         *
+         *   @param The id of the client, nothing is done if it was already removed
+         */
+        void remove_client(uint32_t client_id)
+        {
+            const auto connection = m_clients.erase(client_id);
+
+            if (connection == nullptr)
+                return;
+
+            m_topics.unsubscribe_all(client_id);
+            m_spatial_grid.erase(client_id);
+            m_cluster.remove_peer(client_id);
+
+            {
+                std::lock_guard lock(m_multicast_mutex);
+                m_multicast_members.erase(client_id);
+            }
+
+            {
+                std::lock_guard lock(m_replication_mutex);
+                m_state_replicator.remove_client(client_id);
+            }
+
+            if (m_datagram_channel)
+            {
+                std::lock_guard lock(m_datagram_mutex);
+                const auto peer = m_datagram_peers.find(client_id);
+
+                if (peer != m_datagram_peers.end())
+                {
+                    if (peer->second.m_session)
+                        peer->second.m_session->close();
+
+                    m_datagram_peers.erase(peer);
+                }
+            }
+
+            // Closing the socket cancels the pending operations which are the last owners of the connection
+            connection->disconnect();
+            keep_session(client_id, connection->get_metrics().m_user_messages_received);
+
+            this->push_notification(
+                {.m_code = Notification_code::client_disconnected,
+                 .m_client_id = client_id,
+                 .m_address = connection->get_address()});
+
+            m_on_client_disconnect.broadcast(connection->get_client_information());
+        }
+
+        // Commands submitted from the other threads, drained on the strand of the queue
+        struct Command_queue
+        {
+            Linked_mpsc_queue<std::vector<Server_command<Id_type>>> m_batches{get_message_memory_resource()};
+            asio::any_io_executor m_executor;
+
+            // Only the stop drains besides the strand, the shared runtime may still run a posted drain then
+            std::mutex m_drain_mutex;
+        };
+
+        // One queue for each io_context so the commands of the different threads are applied in parallel
+        void create_command_queues()
+        {
+            if (!m_command_queues.empty())
+                return;
+
+            for (size_t i = 0; i < this->get_context_count(); ++i)
+            {
+                m_command_queues.push_back(std::make_unique<Command_queue>());
+                m_command_queues.back()->m_executor = this->make_connection_executor(i);
+            }
+
+            // Calling thread takes a part of every broadcast so one thread less is asked to help
+            for (size_t i = 1; i < this->get_handler_thread_count(); ++i)
+                m_broadcast_executors.push_back(this->make_connection_executor(i));
+        }
+
+        // Shards of one broadcast that the calling thread and the Asio threads take one at a time
+        struct Parallel_broadcast
+        {
+            std::atomic<size_t> m_next_shard = 0;
+
+            // Asio threads that may still be going through a shard
+            std::atomic<size_t> m_helping_threads = 0;
+        };
+
+        /**
+         *   Calls the callable with every connected client, see the Client_registry::for_each_connected. With
+         *   enough clients the Asio threads are asked to help and the shards of the registry are taken one at a
+         *   time by whichever thread is free, so the callable is called from several threads at once. Returns
+         *   when every shard has been gone through, so the messages sent after this are queued after the ones
+         *   sent in it. Asio threads that run their part only after this has returned find no shards left.
+         */
+        template <typename Callable_type>
+        void for_each_connected_client(const Callable_type& callable)
+        {
+            if (m_broadcast_executors.empty() || m_clients.size() < m_parallel_broadcast_threshold ||
+                !this->is_asio_thread_running())
+            {
+                m_clients.for_each_connected(callable);
+                return;
+            }
+
+            constexpr size_t SHARD_COUNT = Client_registry<Id_type>::get_shard_count();
+            const auto broadcast = std::make_shared<Parallel_broadcast>();
+
+            const auto take_shards = [this, &callable](Parallel_broadcast& state) {
+                for (size_t shard = state.m_next_shard.fetch_add(1); shard < SHARD_COUNT;
+                     shard = state.m_next_shard.fetch_add(1))
+                    m_clients.for_each_connected_in_shard(shard, callable);
+            };
+
+            for (const asio::any_io_executor& executor : m_broadcast_executors)
+                asio::post(executor, [broadcast, take_shards] {
+                    // Counted before taking a shard, so the caller that has seen none left waits for the shard
+                    broadcast->m_helping_threads.fetch_add(1);
+
+                    struct Help_guard
+                    {
+                        ~Help_guard()
+                        {
+                            if (m_state.m_helping_threads.fetch_sub(1) == 1)
+                                m_state.m_helping_threads.notify_all();
+                        }
+
+                        Parallel_broadcast& m_state;
+                    } guard{*broadcast};
+
+                    NET_ALLOCATION_SCOPE(broadcast);
+                    take_shards(*broadcast);
+                });
+
+            try
+            {
+                take_shards(*broadcast);
+            }
+            catch (...)
+            {
+                broadcast->m_next_shard.store(SHARD_COUNT);
+                wait_for_broadcast_helpers(*broadcast);
+                throw;
+            }
+
+            wait_for_broadcast_helpers(*broadcast);
+        }
+
+        static void wait_for_broadcast_helpers(Parallel_broadcast& broadcast) noexcept
+        {
+            for (size_t helping = broadcast.m_helping_threads.load(); helping != 0;
+                 helping = broadcast.m_helping_threads.load())
+                broadcast.m_helping_threads.wait(helping);
+        }
+
+        void drain_commands(Command_queue& queue)
+        {
+            std::lock_guard lock(queue.m_drain_mutex);
+
+            while (std::optional<std::vector<Server_command<Id_type>>> commands = queue.m_batches.try_pop())
+                apply_commands(std::move(*commands));
+        }
+
+        void apply_commands(std::vector<Server_command<Id_type>> commands)
+        {
+            for (Server_command<Id_type>& command : commands)
+            {
+                if (auto* send = std::get_if<Send_command<Id_type>>(&command))
+                    send_outgoing_message_to_client(send->m_client_id, std::move(send->m_message), send->m_options);
+                else if (const auto* disconnect = std::get_if<Disconnect_command>(&command))
+                    disconnect_client(disconnect->m_client_id);
+                else
+                    ban_ip(std::get<Ban_ip_command>(command).m_banned_ip);
+            }
+        }
+
+        Client_registry<Id_type> m_clients;
+        Topic_registry<Id_type> m_topics{m_clients};
+        Spatial_grid<Id_type> m_spatial_grid{m_clients};
+        Cluster<Id_type> m_cluster;
+        Message_handlers<Id_type, const Client_information&, Message<Id_type>> m_message_handlers;
+        Response_cache<Id_type> m_response_cache;
+        Thread_safe_deque<uint32_t> m_disconnected_clients;
+        // In-memory and unix domain connections have no remote endpoint, they are shown as the loopback address
+        static inline const Protocol::endpoint SAME_HOST_ENDPOINT =
+            Protocol::endpoint(asio::ip::address_v4::loopback(), 0);
+
+        Thread_safe_deque<std::variant<Protocol::socket, std::unique_ptr<Socket_interface>>> m_new_connections;
+        Thread_safe_deque<std::shared_ptr<Connection<Id_type>>> m_admitted_connections;
+        Admission_mode m_admission_mode = Admission_mode::update_thread;
+
+        // Deadline update takes the messages in batches of at most this and gives the other work a turn between
+        static constexpr size_t MAX_DEADLINE_BATCH = 1024;
+        static constexpr size_t NEW_CONNECTIONS_PER_TURN = 16;
+        static constexpr size_t NOTIFICATIONS_PER_TURN = 64;
+        std::chrono::nanoseconds m_message_cost = std::chrono::microseconds(1);
+
+        const std::vector<Protocol::endpoint> m_endpoints;
+        std::vector<Protocol::acceptor> m_acceptors;
+        std::optional<Local_protocol::acceptor> m_local_acceptor;
+        std::string m_local_path;
+        std::optional<Local_protocol::acceptor> m_shared_memory_acceptor;
+        std::string m_shared_memory_path;
+        size_t m_shared_memory_ring_capacity = Shared_memory_socket::DEFAULT_RING_CAPACITY;
+
+#ifdef NET_HAS_HOT_RESTART
+        // New process that connected to the hot restart path, and the old one while this takes over its connections
+        static constexpr std::chrono::seconds HAND_OFF_TIMEOUT = std::chrono::seconds(10);
+        std::string m_hot_restart_path;
+        std::optional<Local_protocol::acceptor> m_hot_restart_acceptor;
+        std::mutex m_successor_mutex;
+        std::optional<Local_protocol::socket> m_successor;
+        std::atomic<bool> m_has_successor = false;
+        std::optional<Handle_channel> m_predecessor;
+#endif
+        bool m_are_acceptors_taken = false;
+
+#ifdef NET_ENABLE_QUIC
+        uint16_t m_quic_port = 0;
+        Quic_settings m_quic_settings;
+        std::shared_ptr<Quic_configuration> m_quic_configuration;
+        std::optional<Quic_listener> m_quic_listener;
+#endif
+
+        // Clients that were offered the datagram channel, the session is created when they send the first datagram
+        struct Datagram_peer
+        {
+            uint64_t m_token = 0;
+            Datagram_protocol::endpoint m_endpoint = {};
+            std::shared_ptr<Reliable_datagram_session<Id_type>> m_session = nullptr;
+        };
+
+        std::optional<Datagram_channel<Id_type>> m_datagram_channel;
+        uint16_t m_datagram_port = 0;
+#ifdef NET_HAS_AF_XDP
+        std::optional<Xdp_settings> m_datagram_xdp_settings;
+#endif
+        std::mutex m_datagram_mutex;
+        std::unordered_map<uint32_t, Datagram_peer> m_datagram_peers;
+        std::vector<Message<Id_type>> m_delivered_datagrams;
+        std::random_device m_random_device;
+
+        // Members get the messages to all clients from the sender, the mutex is held for the whole send
+        std::optional<Multicast_settings> m_multicast_settings;
+        std::optional<Multicast_sender<Id_type>> m_multicast_sender;
+        uint64_t m_multicast_token = 0;
+        std::mutex m_multicast_mutex;
+        std::unordered_set<uint32_t> m_multicast_members;
+
+        // Sessions of the connected clients by their ids and the sessions of the disconnected ones by the tokens
+        struct Kept_session
+        {
+            uint32_t m_client_id = 0;
+            uint64_t m_received_messages = 0;
+            std::chrono::steady_clock::time_point m_expiry_time;
+        };
+
+        Optional_seconds m_session_keep_time;
+        std::mutex m_sessions_mutex;
+        std::unordered_map<uint32_t, uint64_t> m_session_tokens;
+        std::unordered_map<uint64_t, Kept_session> m_kept_sessions;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, uint64_t>> m_session_expiries;
+        std::random_device m_session_random_device;
+
+        // Null when the messages of the offline clients are not kept
+        std::unique_ptr<Offline_queue> m_offline_queue;
+
+        // Created on the first start, the submit_commands applies the commands on its own thread before it
+        std::vector<std::unique_ptr<Command_queue>> m_command_queues;
+
+        // Created with the command queues, one for each Asio thread except the one the broadcasting thread replaces
+        std::vector<asio::any_io_executor> m_broadcast_executors;
+        size_t m_parallel_broadcast_threshold = 4096;
+
+        mutable std::mutex m_replication_mutex;
+        State_replicator<Id_type> m_state_replicator;
+
+        size_t m_reuse_port_acceptor_count = 1;
+        bool m_is_port_shared = false;
+        int m_listen_backlog = Protocol::acceptor::max_listen_connections;
+        size_t m_outstanding_accepts = 1;
+        bool m_are_acceptors_outdated = false;
+        bool m_is_accepting = false;
+
+        std::atomic<uint64_t> m_accepted_connections = 0;
+        std::atomic<uint64_t> m_rejected_connections = 0;
+        std::atomic<uint64_t> m_accept_errors = 0;
+
+        size_t m_max_connections = std::numeric_limits<size_t>::max();
+
+        // Memory is checked on the timer wheel, the held clients are only used there
+        static constexpr std::chrono::milliseconds MEMORY_CHECK_PERIOD = std::chrono::milliseconds(100);
+        Memory_budget m_memory_budget;
+        Timer_wheel::Timer_id m_memory_timer = 0;
+        std::unordered_map<uint32_t, std::weak_ptr<Connection<Id_type>>> m_memory_held_connections;
+
+        // Ban checks of the accepting threads only read the ranges
+        Ip_prefix_set m_banned_ips;
+        mutable std::shared_mutex m_banned_ips_mutex;
+        bool m_has_kernel_ban_filter = false;
+        Optional_seconds m_defer_accept = std::nullopt;
+
+        // Declared last so its threads are joined before the members the handlers use are destroyed
+        std::unique_ptr<Work_stealing_pool> m_handler_pool;
     };
 } // namespace Net
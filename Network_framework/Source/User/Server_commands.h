@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../Connection/Connection.h"
+#include "../Message/Shared_message.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace Net
+{
+    template <Id_concept Id_type>
+    struct Send_command
+    {
+        uint32_t m_client_id = 0;
+        Outgoing_message<Id_type> m_message;
+        Send_options m_options;
+    };
+
+    struct Disconnect_command
+    {
+        uint32_t m_client_id = 0;
+    };
+
+    struct Ban_ip_command
+    {
+        std::string m_banned_ip;
+    };
+
+    template <Id_concept Id_type>
+    using Server_command = std::variant<Send_command<Id_type>, Disconnect_command, Ban_ip_command>;
+
+    /**
+     *   Operations on the server that a thread collects without any locking and hands over at once with the
+     *   Server::submit_commands. The commands are applied in the order they were added.
+     *
+     *   Server_command_batch<Id_type> batch;
+     *   batch.send_message(client_id, std::move(message));
+     *   batch.disconnect_client(other_client_id);
+     *   server.submit_commands(std::move(batch));
+     */
+    template <Id_concept Id_type>
+    class Server_command_batch
+    {
+    public:
+        void send_message(
+            uint32_t client_id, Message<Id_type> message, Message_priority priority = Message_priority::normal)
+        {
+            m_commands.emplace_back(Send_command<Id_type>{
+                .m_client_id = client_id, .m_message = std::move(message), .m_options = {.m_priority = priority}});
+        }
+
+        // Sends the message without copying its body, the same shared message can be added for many clients
+        void send_message(
+            uint32_t client_id, Shared_message<Id_type> message, Message_priority priority = Message_priority::normal)
+        {
+            m_commands.emplace_back(Send_command<Id_type>{
+                .m_client_id = client_id, .m_message = std::move(message), .m_options = {.m_priority = priority}});
+        }
+
+        // See the Server::send_conflated_message_to_client
+        void send_conflated_message(
+            uint32_t client_id, uint64_t conflation_key, Message<Id_type> message,
+            Message_priority priority = Message_priority::normal)
+        {
+            m_commands.emplace_back(Send_command<Id_type>{
+                .m_client_id = client_id,
+                .m_message = std::move(message),
+                .m_options = {.m_priority = priority, .m_conflation_key = conflation_key}});
+        }
+
+        void disconnect_client(uint32_t client_id)
+        {
+            m_commands.emplace_back(Disconnect_command{.m_client_id = client_id});
+        }
+
+        // See the Server::ban_ip, the text that is not an address or a range is ignored
+        void ban_ip(std::string_view banned_ip)
+        {
+            m_commands.emplace_back(Ban_ip_command{.m_banned_ip = std::string(banned_ip)});
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_commands.empty();
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_commands.size();
+        }
+
+        // @return the commands, the batch is left empty
+        [[nodiscard]] std::vector<Server_command<Id_type>> take_commands() noexcept
+        {
+            return std::exchange(m_commands, {});
+        }
+
+    private:
+        std::vector<Server_command<Id_type>> m_commands;
+    };
+} // namespace Net
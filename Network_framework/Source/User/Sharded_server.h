@@ -0,0 +1,285 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "../Message/Prepared_message.h"
+#include "../Utility/Spsc_queue.h"
+#include "Server.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Servers that share nothing, one for each core. Every shard has its own io_context, acceptor, clients and
+     *   update thread, and all of them listen the same port with SO_REUSEPORT so the kernel spreads the new
+     *   connections between them. Shards talk to each other only through channels that have one producer and
+     *   one consumer, one channel for each pair of shards, so nothing in the path between them takes a lock.
+     *
+     *   Shards are configured through the get_shard before the start. Their callbacks run on the update thread
+     *   of the shard, so a client is only touched by the thread of its shard.
+     */
+    template <Id_concept Id_type>
+    class Sharded_server
+    {
+    public:
+        static constexpr size_t DEFAULT_CHANNEL_CAPACITY = 4096;
+
+        /**
+         *   @param the port every shard listens
+         *   @param the amount of shards, by default one for each core
+         *   @param how many messages the channel from one shard to another holds
+         *   @throws if the port could not be opened or the reuse port is not available on this platform
+         */
+        explicit Sharded_server(
+            uint16_t port, size_t shard_count = std::max(std::thread::hardware_concurrency(), 1u),
+            size_t channel_capacity = DEFAULT_CHANNEL_CAPACITY)
+        {
+            shard_count = std::max<size_t>(shard_count, 1);
+            m_shards.reserve(shard_count);
+
+            for (size_t i = 0; i < shard_count; ++i)
+                m_shards.push_back(std::make_unique<Shard>(port, shard_count, channel_capacity, m_is_stopping));
+        }
+
+        ~Sharded_server()
+        {
+            stop();
+        }
+
+        Sharded_server(const Sharded_server&) = delete;
+        Sharded_server(Sharded_server&&) = delete;
+        Sharded_server& operator=(const Sharded_server&) = delete;
+        Sharded_server& operator=(Sharded_server&&) = delete;
+
+        // Server of the shard, its settings and callbacks should be set before the start
+        [[nodiscard]] Server<Id_type>& get_shard(size_t shard_index)
+        {
+            return *m_shards[shard_index];
+        }
+
+        [[nodiscard]] size_t get_shard_count() const noexcept
+        {
+            return m_shards.size();
+        }
+
+        /**
+         *   Starts the servers and the update threads of the shards
+         *
+         *   @return false if a server could not be started, the shards are stopped then
+         */
+        bool start()
+        {
+            if (!m_update_threads.empty())
+                return true;
+
+            for (const std::unique_ptr<Shard>& shard : m_shards)
+            {
+                if (!shard->start())
+                {
+                    stop();
+                    return false;
+                }
+            }
+
+            m_is_stopping = false;
+
+            for (size_t i = 0; i < m_shards.size(); ++i)
+                m_update_threads.emplace_back([this, i] { update_loop(i); });
+
+            return true;
+        }
+
+        // Stops the update threads and then the servers, the messages still in the channels are dropped
+        void stop()
+        {
+            m_is_stopping = true;
+
+            for (const std::unique_ptr<Shard>& shard : m_shards)
+                shard->wake_up();
+
+            for (std::thread& update_thread : m_update_threads)
+                update_thread.join();
+
+            m_update_threads.clear();
+
+            for (const std::unique_ptr<Shard>& shard : m_shards)
+                shard->stop();
+        }
+
+        /**
+         *   Sends the message to the other shard, it is given to the m_on_shard_message on the update thread of
+         *   that shard. This must be called on the update thread of the sending shard, for example in its callbacks.
+         *
+         *   @return false if the channel to the shard is full, the message is dropped then
+         */
+        bool send_to_shard(size_t from_shard, size_t to_shard, Message<Id_type> message)
+        {
+            return send_mail(from_shard, to_shard, {.m_type = Mail_type::message, .m_message = std::move(message)});
+        }
+
+        /**
+         *   Sends the message to the client of the other shard, see the send_to_shard
+         *
+         *   @return false if the channel to the shard is full, the message is dropped then
+         */
+        bool send_to_client(size_t from_shard, size_t to_shard, uint32_t client_id, Message<Id_type> message)
+        {
+            return send_mail(
+                from_shard, to_shard,
+                {.m_type = Mail_type::client_message, .m_client_id = client_id, .m_message = std::move(message)});
+        }
+
+        /**
+         *   Publishes the message to the subscribers of the topic on every shard. Message is prepared once and the
+         *   other shards get the same prepared message, see the send_to_shard.
+         *
+         *   @return false if the channel to some shard was full, that shard did not get the message
+         */
+        bool publish(size_t from_shard, uint64_t topic, const Message<Id_type>& message)
+        {
+            const Shared_prepared_message<Id_type> prepared_message = make_prepared_message(message);
+            bool is_sent_to_all = true;
+
+            for (size_t i = 0; i < m_shards.size(); ++i)
+            {
+                if (i == from_shard)
+                    m_shards[i]->publish(topic, prepared_message);
+                else
+                    is_sent_to_all &= send_mail(
+                        from_shard, i,
+                        {.m_type = Mail_type::publish, .m_topic = topic, .m_prepared = prepared_message});
+            }
+
+            return is_sent_to_all;
+        }
+
+        /**
+         *   Called on the update thread of the receiving shard with its index, the index of the sending shard and
+         *   the message. Shards call this at the same time so the callback must only touch its own shard.
+         */
+        Delegate<size_t, size_t, Message<Id_type>&> m_on_shard_message;
+
+    private:
+        enum class Mail_type : uint8_t
+        {
+            message,
+            client_message,
+            publish
+        };
+
+        struct Mail
+        {
+            Mail_type m_type = Mail_type::message;
+            uint32_t m_client_id = 0;
+            uint64_t m_topic = 0;
+            Message<Id_type> m_message;
+            Shared_prepared_message<Id_type> m_prepared = nullptr;
+        };
+
+        // Server that also waits for the mail from the other shards in its update
+        class Shard final : public Server<Id_type>
+        {
+        public:
+            Shard(uint16_t port, size_t shard_count, size_t channel_capacity, const std::atomic<bool>& is_stopping)
+                : Server<Id_type>(port, true), m_is_stopping(is_stopping)
+            {
+                m_inboxes.reserve(shard_count);
+
+                for (size_t i = 0; i < shard_count; ++i)
+                    m_inboxes.push_back(std::make_unique<Spsc_queue<Mail>>(channel_capacity));
+            }
+
+            void wake_up()
+            {
+                this->notify_wait();
+            }
+
+            // Channel from the sending shard, its update thread is the only producer
+            [[nodiscard]] Spsc_queue<Mail>& get_inbox(size_t from_shard) noexcept
+            {
+                return *m_inboxes[from_shard];
+            }
+
+            [[nodiscard]] size_t get_inbox_count() const noexcept
+            {
+                return m_inboxes.size();
+            }
+
+        protected:
+            bool should_stop_waiting() override
+            {
+                if (Server<Id_type>::should_stop_waiting() || m_is_stopping.load(std::memory_order_relaxed))
+                    return true;
+
+                return std::ranges::any_of(
+                    m_inboxes, [](const std::unique_ptr<Spsc_queue<Mail>>& inbox) { return !inbox->empty(); });
+            }
+
+        private:
+            std::vector<std::unique_ptr<Spsc_queue<Mail>>> m_inboxes;
+            const std::atomic<bool>& m_is_stopping;
+        };
+
+        bool send_mail(size_t from_shard, size_t to_shard, Mail mail)
+        {
+            Shard& shard = *m_shards[to_shard];
+            const Push_result result = shard.get_inbox(from_shard).try_push(std::move(mail));
+
+            if (result == Push_result::pushed_to_empty)
+                shard.wake_up();
+
+            return result != Push_result::full;
+        }
+
+        void update_loop(size_t shard_index)
+        {
+            Shard& shard = *m_shards[shard_index];
+
+            while (!m_is_stopping.load(std::memory_order_relaxed))
+            {
+                shard.update(SIZE_T_MAX, true);
+                deliver_mail(shard_index);
+            }
+        }
+
+        // Delivers the mail that is in the channels now, the mail that comes meanwhile waits for the next update
+        void deliver_mail(size_t shard_index)
+        {
+            Shard& shard = *m_shards[shard_index];
+
+            for (size_t from_shard = 0; from_shard < shard.get_inbox_count(); ++from_shard)
+            {
+                Spsc_queue<Mail>& inbox = shard.get_inbox(from_shard);
+
+                for (size_t i = 0; i < inbox.capacity(); ++i)
+                {
+                    std::optional<Mail> mail = inbox.try_pop();
+
+                    if (!mail.has_value())
+                        break;
+
+                    switch (mail->m_type)
+                    {
+                    case Mail_type::message:
+                        m_on_shard_message.broadcast(shard_index, from_shard, mail->m_message);
+                        break;
+                    case Mail_type::client_message:
+                        shard.send_message_to_client(mail->m_client_id, std::move(mail->m_message));
+                        break;
+                    case Mail_type::publish:
+                        shard.publish(mail->m_topic, std::move(mail->m_prepared));
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        std::vector<std::thread> m_update_threads;
+        std::atomic<bool> m_is_stopping = false;
+    };
+} // namespace Net
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "Client_registry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Net
+{
+    // Position of a client in the plane of the Spatial_grid
+    struct Grid_position
+    {
+        float m_x = 0.0f;
+        float m_y = 0.0f;
+    };
+
+    /**
+     *   Uniform grid of the client positions so the clients near a point are found by going through only the
+     *   cells that the radius covers. Each cell keeps its clients, positions and connections in dense arrays and
+     *   the place of every client is stored, so moving a client between cells moves the last one of the cell to
+     *   its place. Can be used from any thread.
+     */
+    template <Id_concept Id_type>
+    class Spatial_grid
+    {
+    public:
+        using Connection_ptr = std::shared_ptr<Connection<Id_type>>;
+
+        static constexpr float DEFAULT_CELL_SIZE = 64.0f;
+
+        // @param the clients that can have a position, a client is added only while it is in them
+        explicit Spatial_grid(const Client_registry<Id_type>& clients) : m_clients(clients)
+        {
+        }
+
+        Spatial_grid(const Spatial_grid&) = delete;
+        Spatial_grid(Spatial_grid&&) = delete;
+
+        ~Spatial_grid() = default;
+
+        Spatial_grid& operator=(const Spatial_grid&) = delete;
+        Spatial_grid& operator=(Spatial_grid&&) = delete;
+
+        /**
+         *   Cells should be about the size of the usual query radius, the clients are put in the new cells
+         *
+         *   @param size of a cell, values that are not positive are ignored
+         */
+        void set_cell_size(float cell_size)
+        {
+            if (!(cell_size > 0.0f) || !std::isfinite(cell_size))
+                return;
+
+            std::unique_lock lock(m_mutex);
+
+            m_cell_size = cell_size;
+            std::unordered_map<uint64_t, Cell> old_cells = std::move(m_cells);
+            m_cells.clear();
+
+            for (auto& [cell_key, cell] : old_cells)
+                for (size_t i = 0; i < cell.m_client_ids.size(); ++i)
+                    insert(cell.m_client_ids[i], cell.m_positions[i], std::move(cell.m_connections[i]));
+        }
+
+        /**
+         *   Adds the client to the grid or moves it, the client is looked up only when it is added
+         *
+         *   @return false if the client was not found or the position is not finite
+         */
+        bool set_position(uint32_t client_id, Grid_position position)
+        {
+            if (!std::isfinite(position.m_x) || !std::isfinite(position.m_y))
+                return false;
+
+            std::unique_lock lock(m_mutex);
+
+            const auto found_entry = m_entries.find(client_id);
+
+            if (found_entry != m_entries.end())
+            {
+                const Entry entry = found_entry->second;
+
+                // Client that stays in its cell is only updated
+                if (entry.m_cell_key == get_cell_key(position))
+                {
+                    m_cells[entry.m_cell_key].m_positions[entry.m_index] = position;
+                    return true;
+                }
+
+                insert(client_id, position, erase_from_cell(entry));
+                return true;
+            }
+
+            Connection_ptr connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return false;
+
+            insert(client_id, position, std::move(connection));
+            return true;
+        }
+
+        // Removes the client from the grid, called when the client is removed from the server
+        void erase(uint32_t client_id)
+        {
+            std::unique_lock lock(m_mutex);
+
+            const auto found_entry = m_entries.find(client_id);
+
+            if (found_entry == m_entries.end())
+                return;
+
+            erase_from_cell(found_entry->second);
+            m_entries.erase(client_id);
+        }
+
+        /**
+         *   Calls the callable with every client that is within the radius while the grid is shared locked.
+         *   Goes through all the cells instead when the radius covers more cells than the grid has.
+         *
+         *   @param callable that takes uint32_t client id and const Connection_ptr&, it must not change the grid
+         */
+        template <typename Callable_type>
+        void for_each_near(Grid_position position, float radius, Callable_type&& callable) const
+        {
+            if (!(radius >= 0.0f))
+                return;
+
+            std::shared_lock lock(m_mutex);
+
+            const float radius_squared = radius * radius;
+
+            const auto visit_cell = [&position, radius_squared, &callable](const Cell& cell) {
+                for (size_t i = 0; i < cell.m_client_ids.size(); ++i)
+                {
+                    const float x_distance = cell.m_positions[i].m_x - position.m_x;
+                    const float y_distance = cell.m_positions[i].m_y - position.m_y;
+
+                    if (x_distance * x_distance + y_distance * y_distance <= radius_squared)
+                        callable(cell.m_client_ids[i], cell.m_connections[i]);
+                }
+            };
+
+            const int32_t min_x = get_cell_coordinate(position.m_x - radius);
+            const int32_t max_x = get_cell_coordinate(position.m_x + radius);
+            const int32_t min_y = get_cell_coordinate(position.m_y - radius);
+            const int32_t max_y = get_cell_coordinate(position.m_y + radius);
+
+            const uint64_t covered_cells =
+                static_cast<uint64_t>(int64_t(max_x) - min_x + 1) * static_cast<uint64_t>(int64_t(max_y) - min_y + 1);
+
+            if (covered_cells > m_cells.size())
+            {
+                for (const auto& [cell_key, cell] : m_cells)
+                    visit_cell(cell);
+
+                return;
+            }
+
+            for (int64_t x = min_x; x <= max_x; ++x)
+                for (int64_t y = min_y; y <= max_y; ++y)
+                {
+                    const auto found_cell =
+                        m_cells.find(make_cell_key(static_cast<int32_t>(x), static_cast<int32_t>(y)));
+
+                    if (found_cell != m_cells.end())
+                        visit_cell(found_cell->second);
+                }
+        }
+
+    private:
+        // Clients of the cell in the same order in all the arrays
+        struct Cell
+        {
+            std::vector<uint32_t> m_client_ids;
+            std::vector<Grid_position> m_positions;
+            std::vector<Connection_ptr> m_connections;
+        };
+
+        // Where the client is in the grid
+        struct Entry
+        {
+            uint64_t m_cell_key = 0;
+            uint32_t m_index = 0;
+        };
+
+        // Cell coordinates are limited so the keys of the far away positions are still valid
+        static constexpr float MAX_CELL_COORDINATE = static_cast<float>(1 << 30);
+
+        [[nodiscard]] int32_t get_cell_coordinate(float coordinate) const noexcept
+        {
+            const float cell = std::floor(coordinate / m_cell_size);
+            return static_cast<int32_t>(std::clamp(cell, -MAX_CELL_COORDINATE, MAX_CELL_COORDINATE));
+        }
+
+        [[nodiscard]] static uint64_t make_cell_key(int32_t x, int32_t y) noexcept
+        {
+            return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+        }
+
+        [[nodiscard]] uint64_t get_cell_key(Grid_position position) const noexcept
+        {
+            return make_cell_key(get_cell_coordinate(position.m_x), get_cell_coordinate(position.m_y));
+        }
+
+        void insert(uint32_t client_id, Grid_position position, Connection_ptr connection)
+        {
+            const uint64_t cell_key = get_cell_key(position);
+            Cell& cell = m_cells[cell_key];
+
+            m_entries[client_id] = {.m_cell_key = cell_key, .m_index = static_cast<uint32_t>(cell.m_client_ids.size())};
+            cell.m_client_ids.push_back(client_id);
+            cell.m_positions.push_back(position);
+            cell.m_connections.push_back(std::move(connection));
+        }
+
+        /**
+         *   Removes the client from its cell, the cell is removed after its last client
+         *
+         *   @return the connection of the client
+         */
+        Connection_ptr erase_from_cell(Entry entry)
+        {
+            const auto found_cell = m_cells.find(entry.m_cell_key);
+            Cell& cell = found_cell->second;
+
+            Connection_ptr connection = std::move(cell.m_connections[entry.m_index]);
+
+            // Last client is moved to the place of the removed one so the arrays stay dense
+            if (entry.m_index + 1 < cell.m_client_ids.size())
+            {
+                cell.m_client_ids[entry.m_index] = cell.m_client_ids.back();
+                cell.m_positions[entry.m_index] = cell.m_positions.back();
+                cell.m_connections[entry.m_index] = std::move(cell.m_connections.back());
+                m_entries[cell.m_client_ids[entry.m_index]].m_index = entry.m_index;
+            }
+
+            cell.m_client_ids.pop_back();
+            cell.m_positions.pop_back();
+            cell.m_connections.pop_back();
+
+            if (cell.m_client_ids.empty())
+                m_cells.erase(found_cell);
+
+            return connection;
+        }
+
+        const Client_registry<Id_type>& m_clients;
+
+        mutable std::shared_mutex m_mutex;
+        float m_cell_size = DEFAULT_CELL_SIZE;
+        std::unordered_map<uint64_t, Cell> m_cells;
+        std::unordered_map<uint32_t, Entry> m_entries;
+    };
+} // namespace Net
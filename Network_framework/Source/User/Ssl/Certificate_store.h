@@ -0,0 +1,189 @@
+#pragma once
+
+#include "../../Utility/Common.h"
+#include "Key_provider.h"
+#include <memory>
+#include <mutex>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+#include <vector>
+
+namespace Net
+{
+    // Parsed certificates that are given to the new handshakes
+    class Certificate_set
+    {
+    public:
+        // @throws if some of the pairs could not be parsed or the key does not belong to the certificate
+        explicit Certificate_set(const std::vector<Certificate_key_pair>& pairs)
+        {
+            if (pairs.empty())
+                throw std::invalid_argument("No certificates were given");
+
+            try
+            {
+                for (const Certificate_key_pair& pair : pairs)
+                    m_entries.push_back(parse(pair));
+            }
+            catch (...)
+            {
+                for (const Entry& entry : m_entries)
+                    free_entry(entry);
+
+                throw;
+            }
+        }
+
+        Certificate_set(const Certificate_set&) = delete;
+        Certificate_set(Certificate_set&&) = delete;
+
+        ~Certificate_set()
+        {
+            for (const Entry& entry : m_entries)
+                free_entry(entry);
+        }
+
+        Certificate_set& operator=(const Certificate_set&) = delete;
+        Certificate_set& operator=(Certificate_set&&) = delete;
+
+        // @return false if OpenSSL did not accept the certificates
+        [[nodiscard]] bool use_on(SSL* ssl) const noexcept
+        {
+            for (const Entry& entry : m_entries)
+                if (SSL_use_cert_and_key(ssl, entry.m_certificate, entry.m_private_key, entry.m_chain, 1) != 1)
+                    return false;
+
+            return true;
+        }
+
+    private:
+        struct Entry
+        {
+            X509* m_certificate = nullptr;
+            EVP_PKEY* m_private_key = nullptr;
+            STACK_OF(X509)* m_chain = nullptr;
+        };
+
+        static void free_entry(const Entry& entry) noexcept
+        {
+            X509_free(entry.m_certificate);
+            EVP_PKEY_free(entry.m_private_key);
+            sk_X509_pop_free(entry.m_chain, X509_free);
+        }
+
+        [[nodiscard]] static Entry parse(const Certificate_key_pair& pair)
+        {
+            Entry entry;
+            entry.m_chain = sk_X509_new_null();
+
+            BIO* certificates =
+                BIO_new_mem_buf(pair.m_certificate_chain.data(), static_cast<int>(pair.m_certificate_chain.size()));
+            BIO* private_key =
+                BIO_new_mem_buf(pair.m_private_key.data(), static_cast<int>(pair.m_private_key.size()));
+
+            if (entry.m_chain != nullptr && certificates != nullptr && private_key != nullptr)
+            {
+                // First certificate is the one of the server and the rest are the chain
+                entry.m_certificate = PEM_read_bio_X509(certificates, nullptr, nullptr, nullptr);
+
+                while (X509* chain_certificate = PEM_read_bio_X509(certificates, nullptr, nullptr, nullptr))
+                    sk_X509_push(entry.m_chain, chain_certificate);
+
+                // Key is already decrypted so OpenSSL can't ask a password
+                entry.m_private_key = PEM_read_bio_PrivateKey(private_key, nullptr, nullptr, const_cast<char*>(""));
+            }
+
+            BIO_free(certificates);
+            BIO_free(private_key);
+
+            const bool is_valid = entry.m_certificate != nullptr && entry.m_private_key != nullptr &&
+                                  X509_check_private_key(entry.m_certificate, entry.m_private_key) == 1;
+
+            if (!is_valid)
+            {
+                free_entry(entry);
+                throw std::invalid_argument("Certificate or private key is invalid or they don't belong together");
+            }
+
+            return entry;
+        }
+
+        std::vector<Entry> m_entries;
+    };
+
+    /**
+     *   Certificates of the ssl context that can be replaced while the server is running. New handshakes use the
+     *   newest certificates and the connections made before keep theirs. It is owned by the context so it stays
+     *   alive as long as any connection uses the context.
+     */
+    class Certificate_store
+    {
+    public:
+        Certificate_store(const Certificate_store&) = delete;
+        Certificate_store(Certificate_store&&) = delete;
+
+        ~Certificate_store() = default;
+
+        Certificate_store& operator=(const Certificate_store&) = delete;
+        Certificate_store& operator=(Certificate_store&&) = delete;
+
+        // @return the store of the context, it is created on the first call
+        [[nodiscard]] static Certificate_store& attach(SSL_CTX* context)
+        {
+            auto* store = static_cast<Certificate_store*>(SSL_CTX_get_ex_data(context, ex_data_index()));
+
+            if (store == nullptr)
+            {
+                store = new Certificate_store();
+                SSL_CTX_set_ex_data(context, ex_data_index(), store);
+                SSL_CTX_set_cert_cb(context, &Certificate_store::on_certificate, store);
+            }
+
+            return *store;
+        }
+
+        void set_certificates(std::shared_ptr<const Certificate_set> certificates)
+        {
+            std::scoped_lock lock(m_mutex);
+            m_certificates = std::move(certificates);
+        }
+
+    private:
+        Certificate_store() = default;
+
+        [[nodiscard]] static int ex_data_index()
+        {
+            static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, &free_store);
+            return index;
+        }
+
+        static void free_store(
+            [[maybe_unused]] void* parent, void* store, [[maybe_unused]] CRYPTO_EX_DATA* data,
+            [[maybe_unused]] int index, [[maybe_unused]] long argl, [[maybe_unused]] void* argp)
+        {
+            delete static_cast<Certificate_store*>(store);
+        }
+
+        // Called in every handshake before the certificate is chosen, the context certificates are used if empty
+        static int on_certificate(SSL* ssl, void* argument)
+        {
+            auto* store = static_cast<Certificate_store*>(argument);
+            std::shared_ptr<const Certificate_set> certificates;
+
+            {
+                std::scoped_lock lock(store->m_mutex);
+                certificates = store->m_certificates;
+            }
+
+            if (certificates == nullptr)
+                return 1;
+
+            return certificates->use_on(ssl) ? 1 : 0;
+        }
+
+        std::mutex m_mutex;
+        std::shared_ptr<const Certificate_set> m_certificates = nullptr;
+    };
+} // namespace Net
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Net
+{
+    // Certificate chain and the decrypted private key in .pem format
+    struct Certificate_key_pair
+    {
+        std::string m_certificate_chain;
+        std::string m_private_key;
+    };
+
+    /**
+     *   Gives the certificates of the Ssl_server so they don't have to be files with a password.
+     *   Loading is done on a background thread so it can wait for example a secrets agent without
+     *   blocking the Asio threads or the thread that updates the server.
+     */
+    class Key_provider
+    {
+    public:
+        Key_provider() = default;
+        virtual ~Key_provider() = default;
+
+        Key_provider(const Key_provider&) = delete;
+        Key_provider(Key_provider&&) = delete;
+
+        Key_provider& operator=(const Key_provider&) = delete;
+        Key_provider& operator=(Key_provider&&) = delete;
+
+        /**
+         *   Loads the current certificates, one for each key type the server uses
+         *
+         *   @return the certificates with their keys
+         *   @throws if the certificates could not be loaded, the server keeps the earlier ones
+         */
+        [[nodiscard]] virtual std::vector<Certificate_key_pair> load_certificates() = 0;
+    };
+} // namespace Net
@@ -1,4 +1,7 @@
+#include "../../Sockets/Openssl_socket.h"
+#include "../../Sockets/Tls_session.h"
 #include "../Client.h"
+#include "Tls_profile.h"
 
 
 
@@ -8,9 +11,21 @@ namespace Net
     class Ssl_client : public Client<Id_type>
     {
     public:
-        Ssl_client() noexcept : m_ssl_context(asio::ssl::context_base::sslv23)
+        // @param the shared runtime that runs the Asio, nullptr runs own thread
+        explicit Ssl_client(std::shared_ptr<Io_runtime> runtime = nullptr)
+            : Client<Id_type>(std::move(runtime)), m_ssl_context(asio::ssl::context_base::sslv23),
+              m_session_state(Tls_session_state::attach(m_ssl_context.native_handle()))
         {
             m_ssl_context.set_verify_mode(asio::ssl::context_base::verify_peer);
+            apply_tls_profile(m_ssl_context.native_handle(), Tls_profile(), false);
+            m_session_state.configure_client(m_ssl_context.native_handle(), true);
+        }
+
+        // Handshakes use the ssl context so they are finished before it is destroyed
+        ~Ssl_client() override
+        {
+            this->disconnect();
+            this->wait_for_runtime_handlers();
         }
 
         // Sets ssl verify file
@@ -19,13 +34,96 @@ namespace Net
             m_ssl_context.load_verify_file(path);
         }
 
+        /**
+         *   Sets the tls versions, ciphers and ECDHE groups, the default profile allows tls 1.2 and 1.3.
+         *   This has to be called before connecting.
+         *
+         *   @throws if OpenSSL does not accept some part of the profile
+         */
+        void set_tls_profile(const Tls_profile& profile)
+        {
+            apply_tls_profile(m_ssl_context.native_handle(), profile, false);
+        }
+
+        /**
+         *   Reconnecting to the same server offers the session of the last connection so the handshake can be
+         *   resumed. This is enabled by default and has to be set before connecting.
+         */
+        void set_session_reuse(bool enabled)
+        {
+            m_session_state.configure_client(m_ssl_context.native_handle(), enabled);
+        }
+
+        // Counts the handshakes of all the connections
+        [[nodiscard]] Tls_handshake_counters get_handshake_counters() const noexcept
+        {
+            return m_session_state.get_handshake_counters();
+        }
+
+        /**
+         *   Moves the tls record encryption to the kernel after the handshake. OpenSSL has to be built with
+         *   the ktls support and the kernel has to support the negotiated cipher, otherwise OpenSSL keeps doing it.
+         *   With the kernel tls the send_file is sent without copying the file through the user space.
+         *   Only affects connections created after this call.
+         *
+         *   @return false if the kernel tls is not supported on this platform
+         */
+        bool set_kernel_tls(bool enabled) noexcept
+        {
+#ifdef NET_HAS_KERNEL_TLS
+            m_use_kernel_tls = enabled;
+            return true;
+#else
+            return !enabled;
+#endif
+        }
+
+        /**
+         *   Connections keep no tls buffers while they are idle. OpenSSL works straight on the socket and frees
+         *   its record buffers when they are empty, instead of the asio ssl stream that keeps its own buffers and
+         *   a bio pair of about 70 KB for the whole connection. Costs an allocation of the record buffers for the
+         *   reads and the writes, so this suits many mostly idle connections. Only affects connections created
+         *   after this call.
+         */
+        void set_idle_buffer_release(bool enabled) noexcept
+        {
+            m_release_idle_buffers = enabled;
+        }
+
     private:
         [[nodiscard]] std::unique_ptr<Socket_interface> create_socket_interface(Protocol::socket socket) override
         {
-            return std::make_unique<Template_socket<Ssl_socket>>(Ssl_socket(std::move(socket), m_ssl_context));
+            const std::string server = get_server_address(socket);
+
+            if (m_use_kernel_tls || m_release_idle_buffers)
+            {
+                auto openssl_socket = std::make_unique<Openssl_socket>(
+                    std::move(socket), m_ssl_context, m_use_kernel_tls, std::weak_ptr<Handshake_pool>());
+                m_session_state.prepare_client(openssl_socket->native_handle(), server);
+                return openssl_socket;
+            }
+
+            Ssl_socket ssl_socket(std::move(socket), m_ssl_context);
+            m_session_state.prepare_client(ssl_socket.native_handle(), server);
+            return std::make_unique<Template_socket<Ssl_socket>>(std::move(ssl_socket));
+        }
+
+        // Sessions are only reused with the same server
+        [[nodiscard]] static std::string get_server_address(const Protocol::socket& socket)
+        {
+            asio::error_code error;
+            const Protocol::endpoint endpoint = socket.remote_endpoint(error);
+
+            if (error)
+                return std::string();
+
+            return std::format("{}:{}", endpoint.address().to_string(), endpoint.port());
         }
 
         asio::ssl::context m_ssl_context;
+        Tls_session_state& m_session_state;
+        bool m_use_kernel_tls = false;
+        bool m_release_idle_buffers = false;
     };
 
 } // namespace Net
\ No newline at end of file
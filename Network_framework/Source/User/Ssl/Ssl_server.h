@@ -1,4 +1,9 @@
+#include "../../Sockets/Openssl_socket.h"
+#include "../../Sockets/Tls_session.h"
 #include "../Server.h"
+#include "Certificate_store.h"
+#include "Key_provider.h"
+#include "Tls_profile.h"
 
 namespace Net
 {
@@ -8,49 +13,298 @@ namespace Net
     public:
          using Ssl_socket = asio::ssl::stream<Protocol::socket>;
 
-        Ssl_server(uint16_t port) : Server<Id_type>(port), m_ssl_context(asio::ssl::context::sslv23)
+        Ssl_server(uint16_t port) : Ssl_server(std::vector{Protocol::endpoint(Protocol::v4(), port)})
         {
-            m_ssl_context.set_password_callback(
-                [this](std::size_t size, asio::ssl::context_base::password_purpose purpose) {
-                    return get_password(size, purpose);
-                });
         }
 
+        // Listens many endpoints, see the constructor of the Server
+        explicit Ssl_server(std::vector<Protocol::endpoint> endpoints)
+            : Server<Id_type>(std::move(endpoints)), m_ssl_context(asio::ssl::context::sslv23),
+              m_session_state(Tls_session_state::attach(m_ssl_context.native_handle())),
+              m_certificate_store(Certificate_store::attach(m_ssl_context.native_handle()))
+        {
+            configure_context();
+        }
+
+        /**
+         *   Takes over the server of the old process, see the constructor of the Server. The tls connections of
+         *   the old server are not handed over, their clients connect to this one again.
+         */
+        explicit Ssl_server(const Hot_restart_source& source)
+            : Server<Id_type>(source), m_ssl_context(asio::ssl::context::sslv23),
+              m_session_state(Tls_session_state::attach(m_ssl_context.native_handle())),
+              m_certificate_store(Certificate_store::attach(m_ssl_context.native_handle()))
+        {
+            configure_context();
+        }
+
+        ~Ssl_server() override
+        {
+            if (m_reload_thread.joinable())
+                m_reload_thread.join();
+        }
+
+        Ssl_server(const Ssl_server&) = delete;
+        Ssl_server(Ssl_server&&) = delete;
+        Ssl_server& operator=(const Ssl_server&) = delete;
+        Ssl_server& operator=(Ssl_server&&) = delete;
+
         // Sets ssl certificate chain file
         void set_ssl_certificate_chain_file(const std::string& path)
         {
             m_ssl_context.use_certificate_chain_file(path);
         }
 
-        // Sets ssl private key file in .pem format
+        // Sets the password of the encrypted private key files, this has to be called before loading them
+        void set_ssl_private_key_password(std::string password)
+        {
+            m_private_key_password = std::move(password);
+        }
+
+        // Sets ssl private key file in .pem format, the key can be RSA or ECDSA
         void set_ssl_private_key_file(const std::string& path)
         {
-            m_ssl_context.use_rsa_private_key_file(path, asio::ssl::context::pem);
+            m_ssl_context.use_private_key_file(path, asio::ssl::context::pem);
+        }
+
+        /**
+         *   Adds a certificate with its private key. There can be one RSA and one ECDSA certificate at the same time
+         *   and the ECDSA one is used for the clients that support it because its signatures are much cheaper.
+         *
+         *   @param certificate chain file in .pem format
+         *   @param private key file in .pem format
+         *   @throws if the files could not be loaded or the key does not belong to the certificate
+         */
+        void add_ssl_certificate(const std::string& certificate_chain_path, const std::string& private_key_path)
+        {
+            m_ssl_context.use_certificate_chain_file(certificate_chain_path);
+            m_ssl_context.use_private_key_file(private_key_path, asio::ssl::context::pem);
+
+            if (SSL_CTX_check_private_key(m_ssl_context.native_handle()) != 1)
+                throw std::invalid_argument(
+                    std::format("Private key {} does not belong to {}", private_key_path, certificate_chain_path));
         }
 
-        // Sets ssl tmp dh file
+        // Sets ssl tmp dh file, it is only needed if the profile enables the finite field dh ciphers
         void set_ssl_tmp_dh_file(const std::string& path)
         {
             m_ssl_context.use_tmp_dh_file(path);
         }
 
-    private:
         /**
-         *   Gets ssl password
-         *   todo needs actual way to add passwords to server
+         *   Sets where the certificates are loaded from and starts loading them on a background thread. Loaded
+         *   certificates replace the ones from the files, handshakes fail until there is any certificate.
+         */
+        void set_key_provider(std::shared_ptr<Key_provider> provider)
+        {
+            {
+                std::scoped_lock lock(m_reload_mutex);
+                m_key_provider = std::move(provider);
+            }
+
+            reload_certificates();
+        }
+
+        /**
+         *   Loads the certificates again from the key provider without blocking. New handshakes use the new
+         *   certificates and the established connections keep the old ones. The result is given as a notification.
+         */
+        void reload_certificates()
+        {
+            std::scoped_lock lock(m_reload_mutex);
+
+            if (m_key_provider == nullptr)
+                return;
+
+            // Thread that is still loading loads again after it has finished
+            if (m_is_reloading)
+            {
+                m_is_reload_requested = true;
+                return;
+            }
+
+            if (m_reload_thread.joinable())
+                m_reload_thread.join();
+
+            m_is_reloading = true;
+            m_reload_thread = std::thread([this] { reload_thread(); });
+        }
+
+        /**
+         *   Sets the tls versions, ciphers and ECDHE groups, the default profile allows tls 1.2 and 1.3.
+         *   This has to be called before the server is started.
+         *
+         *   @throws if OpenSSL does not accept some part of the profile
          */
-        [[nodiscard]] std::string get_password(
-            [[maybe_unused]] std::size_t size, [[maybe_unused]] asio::ssl::context_base::password_purpose purpose) const
+        void set_tls_profile(const Tls_profile& profile)
         {
-            return "temp password";
+            apply_tls_profile(m_ssl_context.native_handle(), profile, true);
+        }
+
+        /**
+         *   Sets how the clients can resume their earlier sessions without the full handshake. Sessions are
+         *   resumed with tickets and the server side cache is used for the clients that don't support them.
+         *   This has to be called before the server is started.
+         */
+        void set_session_resumption(const Tls_session_settings& settings)
+        {
+            m_session_state.configure_server(m_ssl_context.native_handle(), settings);
+        }
+
+        // Counts the handshakes of all the connections
+        [[nodiscard]] Tls_handshake_counters get_handshake_counters() const noexcept
+        {
+            return m_session_state.get_handshake_counters();
+        }
+
+        /**
+         *   Moves the tls record encryption to the kernel after the handshake. OpenSSL has to be built with
+         *   the ktls support and the kernel has to support the negotiated cipher, otherwise OpenSSL keeps doing it.
+         *   With the kernel tls the send_file is sent without copying the file through the user space.
+         *   Only affects connections created after this call.
+         *
+         *   @return false if the kernel tls is not supported on this platform
+         */
+        bool set_kernel_tls(bool enabled) noexcept
+        {
+#ifdef NET_HAS_KERNEL_TLS
+            m_use_kernel_tls = enabled;
+            return true;
+#else
+            return !enabled;
+#endif
+        }
+
+        /**
+         *   Connections keep no tls buffers while they are idle. OpenSSL works straight on the socket and frees
+         *   its record buffers when they are empty, instead of the asio ssl stream that keeps its own buffers and
+         *   a bio pair of about 70 KB for the whole connection. Costs an allocation of the record buffers for the
+         *   reads and the writes, so this suits many mostly idle connections. Only affects connections created
+         *   after this call.
+         */
+        void set_idle_buffer_release(bool enabled) noexcept
+        {
+            m_release_idle_buffers = enabled;
+        }
+
+        /**
+         *   Lets the crypto of the handshakes run on an asynchronous provider, for example a hardware
+         *   accelerator, while the asio thread serves other connections. The provider is loaded by the OpenSSL
+         *   config, its operations that would block pause the handshake and the fd of the provider is waited for
+         *   like the socket. Replaces the handshake pool and only affects connections created after this call.
+         *
+         *   @return false if the asynchronous mode is not supported on this platform
+         */
+        bool set_async_crypto(bool enabled) noexcept
+        {
+#ifdef NET_HAS_ASYNC_TLS
+            if (enabled)
+                SSL_CTX_set_mode(m_ssl_context.native_handle(), SSL_MODE_ASYNC);
+            else
+                SSL_CTX_clear_mode(m_ssl_context.native_handle(), SSL_MODE_ASYNC);
+
+            m_use_async_crypto = enabled;
+            return true;
+#else
+            return !enabled;
+#endif
+        }
+
+        /**
+         *   Runs the cpu heavy part of the handshakes on their own threads so a lot of new connections don't slow
+         *   down the established ones. Connections that come when the limit is reached wait for their turn.
+         *   This has to be called before the server is started.
+         *
+         *   @param the amount of handshake threads
+         *   @param how many handshakes can be in progress at the same time
+         */
+        void set_handshake_pool(size_t thread_count, size_t max_concurrent_handshakes)
+        {
+            m_handshake_pool = std::make_shared<Handshake_pool>(thread_count, max_concurrent_handshakes);
+        }
+
+    private:
+        void configure_context()
+        {
+            apply_tls_profile(m_ssl_context.native_handle(), Tls_profile(), true);
+            m_session_state.configure_server(m_ssl_context.native_handle(), Tls_session_settings());
+
+            m_ssl_context.set_password_callback(
+                [this]([[maybe_unused]] std::size_t size,
+                       [[maybe_unused]] asio::ssl::context_base::password_purpose purpose) {
+                    return m_private_key_password;
+                });
+        }
+
+        void reload_thread()
+        {
+            while (true)
+            {
+                std::shared_ptr<Key_provider> provider;
+
+                {
+                    std::scoped_lock lock(m_reload_mutex);
+                    provider = m_key_provider;
+                    m_is_reload_requested = false;
+                }
+
+                load_certificates(*provider);
+
+                std::scoped_lock lock(m_reload_mutex);
+
+                if (!m_is_reload_requested)
+                {
+                    m_is_reloading = false;
+                    return;
+                }
+            }
+        }
+
+        void load_certificates(Key_provider& provider)
+        {
+            try
+            {
+                m_certificate_store.set_certificates(
+                    std::make_shared<const Certificate_set>(provider.load_certificates()));
+
+                this->notifications_push_back("Certificates were loaded");
+            }
+            catch (const std::exception& exception)
+            {
+                this->notifications_push_back(
+                    std::format("Certificates could not be loaded because {}", exception.what()), Severity::error);
+            }
         }
 
         [[nodiscard]] std::unique_ptr<Socket_interface> create_socket_interface(Protocol::socket socket) override
         {
+            // Paused async jobs can't be continued on another thread, so they are not given to the pool
+            if (m_use_async_crypto)
+                return std::make_unique<Openssl_socket>(
+                    std::move(socket), m_ssl_context, m_use_kernel_tls, std::weak_ptr<Handshake_pool>());
+
+            // Only the fd based socket can leave the handshake steps to the pool or release its buffers
+            if (m_use_kernel_tls || m_handshake_pool != nullptr || m_release_idle_buffers)
+                return std::make_unique<Openssl_socket>(
+                    std::move(socket), m_ssl_context, m_use_kernel_tls, m_handshake_pool);
+
             return std::make_unique<Template_socket<Ssl_socket>>(Ssl_socket(std::move(socket), m_ssl_context));
         }
 
         asio::ssl::context m_ssl_context;
+        Tls_session_state& m_session_state;
+        Certificate_store& m_certificate_store;
+        std::string m_private_key_password;
+
+        std::mutex m_reload_mutex;
+        std::shared_ptr<Key_provider> m_key_provider = nullptr;
+        std::thread m_reload_thread;
+        bool m_is_reloading = false;
+        bool m_is_reload_requested = false;
+        std::shared_ptr<Handshake_pool> m_handshake_pool = nullptr;
+        bool m_use_kernel_tls = false;
+        bool m_release_idle_buffers = false;
+        bool m_use_async_crypto = false;
     };
 
 } // namespace Net
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../../Utility/Common.h"
+#include <cstdint>
+#include <format>
+#include <openssl/ssl.h>
+#include <stdexcept>
+#include <string>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__linux__) && defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace Net
+{
+    enum class Tls_version : uint8_t
+    {
+        tls_1_2,
+        tls_1_3
+    };
+
+    /**
+     *   Versions and algorithms the ssl server or client accepts. Key exchange is always done with ECDHE
+     *   so there is no need for the slow finite field dh parameters.
+     */
+    struct Tls_profile
+    {
+        Tls_version m_min_version = Tls_version::tls_1_2;
+        Tls_version m_max_version = Tls_version::tls_1_3;
+
+        // Tls 1.2 ciphers in the OpenSSL cipher list format, empty orders the AEAD ciphers by this cpu
+        std::string m_cipher_list;
+
+        // Tls 1.3 cipher suites separated by colons, empty orders them by this cpu
+        std::string m_cipher_suites;
+
+        // ECDHE groups in the order of preference
+        std::string m_groups = "X25519:P-256:P-384";
+
+        // Only tls 1.3 which always makes the handshake in one round trip
+        [[nodiscard]] static Tls_profile modern()
+        {
+            Tls_profile profile;
+            profile.m_min_version = Tls_version::tls_1_3;
+            return profile;
+        }
+    };
+
+    // @return true if the cpu has instructions for AES so AES-GCM is faster than ChaCha20
+    [[nodiscard]] inline bool has_aes_hardware() noexcept
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int registers[4] = {};
+        __cpuid(registers, 1);
+        return (registers[2] & (1 << 25)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        return __builtin_cpu_supports("aes");
+#elif defined(__linux__) && defined(__aarch64__)
+        return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        // Every 64 bit arm cpu that runs windows or apple systems has the crypto extension
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     *   Sets the profile to the context. Server picks the cipher so it prefers its own order, but if the client
+     *   prefers ChaCha20 it is used because the client probably has no AES instructions.
+     *
+     *   @throws if OpenSSL does not accept some part of the profile
+     */
+    inline void apply_tls_profile(SSL_CTX* context, const Tls_profile& profile, bool is_server)
+    {
+        const auto to_openssl_version = [](Tls_version version) {
+            return version == Tls_version::tls_1_3 ? TLS1_3_VERSION : TLS1_2_VERSION;
+        };
+
+        if (profile.m_min_version > profile.m_max_version)
+            throw std::invalid_argument("Minimum tls version is greater than the maximum");
+
+        const bool prefer_aes = has_aes_hardware();
+
+        // ECDSA certificate is preferred over the RSA one if the server has both
+        const std::string cipher_list =
+            !profile.m_cipher_list.empty() ? profile.m_cipher_list
+            : prefer_aes ? "ECDHE+aECDSA+AESGCM:ECDHE+aECDSA+CHACHA20:ECDHE+AESGCM:ECDHE+CHACHA20"
+                         : "ECDHE+aECDSA+CHACHA20:ECDHE+aECDSA+AESGCM:ECDHE+CHACHA20:ECDHE+AESGCM";
+
+        const std::string cipher_suites =
+            !profile.m_cipher_suites.empty() ? profile.m_cipher_suites
+            : prefer_aes ? "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+                         : "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+
+        if (SSL_CTX_set_min_proto_version(context, to_openssl_version(profile.m_min_version)) != 1 ||
+            SSL_CTX_set_max_proto_version(context, to_openssl_version(profile.m_max_version)) != 1)
+            throw std::invalid_argument("Tls version is not supported");
+
+        if (SSL_CTX_set_cipher_list(context, cipher_list.c_str()) != 1)
+            throw std::invalid_argument(std::format("Invalid tls 1.2 cipher list {}", cipher_list));
+
+        if (SSL_CTX_set_ciphersuites(context, cipher_suites.c_str()) != 1)
+            throw std::invalid_argument(std::format("Invalid tls 1.3 cipher suites {}", cipher_suites));
+
+        if (SSL_CTX_set1_groups_list(context, profile.m_groups.c_str()) != 1)
+            throw std::invalid_argument(std::format("Invalid ECDHE groups {}", profile.m_groups));
+
+        SSL_CTX_set_options(context, SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION);
+
+        if (is_server)
+            SSL_CTX_set_options(context, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA);
+    }
+} // namespace Net
@@ -0,0 +1,545 @@
+#pragma once
+
+#include "../Message/Message.h"
+#include "../Message/Message_reader.h"
+#include "../Message/Message_writer.h"
+#include "../Message/Shared_message.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   States of the replicated objects by the sequence they were set in. Each object keeps only the versions
+     *   where it changed, so the state at a sequence is the last version at or before it. Versions share the
+     *   bytes, a version that did not change is the same pointer.
+     */
+    class Versioned_states
+    {
+    public:
+        // Null state is a removed object
+        using State = std::shared_ptr<const std::vector<char>>;
+
+        // @return the state of the object at the sequence, null if the object did not exist then
+        [[nodiscard]] State find(uint32_t object_id, uint64_t sequence) const
+        {
+            const auto object = m_objects.find(object_id);
+
+            if (object == m_objects.end())
+                return nullptr;
+
+            for (auto version = object->second.rbegin(); version != object->second.rend(); ++version)
+                if (version->m_sequence <= sequence)
+                    return version->m_state;
+
+            return nullptr;
+        }
+
+        [[nodiscard]] State find_latest(uint32_t object_id) const
+        {
+            const auto object = m_objects.find(object_id);
+            return object != m_objects.end() ? object->second.back().m_state : nullptr;
+        }
+
+        // Sets the state from the sequence on, the sequence must not be older than the latest of the object
+        void set(uint32_t object_id, uint64_t sequence, State state)
+        {
+            std::vector<Version>& versions = m_objects[object_id];
+
+            if (!versions.empty() && versions.back().m_sequence == sequence)
+                versions.back().m_state = std::move(state);
+            else
+                versions.push_back({.m_sequence = sequence, .m_state = std::move(state)});
+        }
+
+        // Drops the versions that the lookups at the sequence or later don't need
+        void prune(uint64_t sequence)
+        {
+            for (auto object = m_objects.begin(); object != m_objects.end();)
+            {
+                std::vector<Version>& versions = object->second;
+                const auto first_needed = std::ranges::find_if(versions, [sequence](const Version& version) {
+                    return version.m_sequence > sequence;
+                });
+
+                if (first_needed != versions.begin())
+                    versions.erase(versions.begin(), first_needed - 1);
+
+                // Object that was removed before the sequence is not needed at all
+                if (versions.size() == 1 && versions.front().m_state == nullptr &&
+                    versions.front().m_sequence <= sequence)
+                    object = m_objects.erase(object);
+                else
+                    ++object;
+            }
+        }
+
+        // @param called with the id of every object that has versions
+        template <typename Callable_type>
+        void for_each_object(Callable_type&& callable) const
+        {
+            for (const auto& [object_id, versions] : m_objects)
+                callable(object_id);
+        }
+
+        void clear() noexcept
+        {
+            m_objects.clear();
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_objects.size();
+        }
+
+    private:
+        struct Version
+        {
+            uint64_t m_sequence = 0;
+            State m_state;
+        };
+
+        std::unordered_map<uint32_t, std::vector<Version>> m_objects;
+    };
+
+    /**
+     *   Body of the replication_update. The states of the sequence are written against the baseline, the
+     *   objects that did not change since the baseline are left out and 0 baseline is a full snapshot.
+     *
+     *   varint sequence, varint baseline, entries, end
+     *   entry: uint8 kind, varint object id and
+     *          full:    varint size, bytes
+     *          delta:   varint run count, every run has varint skipped bytes, varint length, bytes
+     *          removed: nothing
+     *
+     *   The runs of the delta replace the bytes of the baseline state that changed, the equal bytes between the
+     *   runs are skipped. The size of a delta is the size of the baseline, a resized state is sent full.
+     */
+    enum class State_entry_kind : uint8_t
+    {
+        end,
+        full,
+        delta,
+        removed
+    };
+
+    struct Replication_stats
+    {
+        uint64_t m_sequence = 0;
+        size_t m_objects = 0;
+
+        // Bytes of the updates sent and the bytes the full snapshots would have taken instead
+        uint64_t m_update_bytes = 0;
+        uint64_t m_snapshot_bytes = 0;
+    };
+
+    /**
+     *   Server side of the replication. The application sets the states of the objects, every publish makes
+     *   them the next sequence and every client gets an update against the last sequence it acknowledged, so
+     *   the update carries only what changed since the client last confirmed. Clients that acknowledged the same
+     *   sequence share the same update. This is not thread safe, the Server calls it from the update thread.
+     */
+    template <Id_concept Id_type>
+    class State_replicator
+    {
+    public:
+        // @param how many sequences a baseline is kept, the clients that are further behind get a full snapshot
+        explicit State_replicator(uint64_t max_baseline_age = 64)
+            : m_max_baseline_age(std::max<uint64_t>(max_baseline_age, 1))
+        {
+        }
+
+        // Sets the state of the object for the next publish, the bytes are copied only if they changed
+        void set_state(uint32_t object_id, std::span<const char> bytes)
+        {
+            const Versioned_states::State latest = m_states.find_latest(object_id);
+
+            if (latest != nullptr && std::ranges::equal(*latest, bytes))
+                return;
+
+            m_states.set(
+                object_id, m_sequence + 1, std::make_shared<const std::vector<char>>(bytes.begin(), bytes.end()));
+        }
+
+        void remove_state(uint32_t object_id)
+        {
+            if (m_states.find_latest(object_id) != nullptr)
+                m_states.set(object_id, m_sequence + 1, nullptr);
+        }
+
+        // @return the state set last, null if there is none
+        [[nodiscard]] const std::vector<char>* get_state(uint32_t object_id) const
+        {
+            return m_states.find_latest(object_id).get();
+        }
+
+        // Makes the states set since the previous publish the next sequence
+        void publish()
+        {
+            ++m_sequence;
+            m_updates.clear();
+
+            // Baselines older than the age are not used so their versions are not needed, the sent sequences
+            // are kept because the clients may still acknowledge them
+            const uint64_t oldest_baseline = m_sequence > m_max_baseline_age ? m_sequence - m_max_baseline_age : 1;
+            uint64_t oldest_used_baseline = m_sequence;
+
+            for (auto& [client_id, client] : m_clients)
+            {
+                while (!client.m_sent.empty() && client.m_sent.front() < oldest_baseline)
+                    client.m_sent.pop_front();
+
+                if (client.m_acknowledged >= oldest_baseline)
+                    oldest_used_baseline = std::min(oldest_used_baseline, client.m_acknowledged);
+
+                if (!client.m_sent.empty())
+                    oldest_used_baseline = std::min(oldest_used_baseline, client.m_sent.front());
+            }
+
+            m_states.prune(oldest_used_baseline);
+        }
+
+        // @return the update of the published sequence for the client, null if nothing changed since its baseline
+        [[nodiscard]] Shared_message<Id_type> create_update(uint32_t client_id)
+        {
+            Client_baseline& client = m_clients[client_id];
+            const uint64_t baseline =
+                m_sequence - client.m_acknowledged <= m_max_baseline_age ? client.m_acknowledged : 0;
+
+            if (baseline == m_sequence)
+                return nullptr;
+
+            auto update = m_updates.find(baseline);
+
+            if (update == m_updates.end())
+                update = m_updates.emplace(baseline, build_update(baseline)).first;
+
+            if (update->second != nullptr)
+                client.m_sent.push_back(m_sequence);
+
+            if (baseline == 0)
+                client.m_snapshot = m_sequence;
+
+            return update->second;
+        }
+
+        // The client has the states of the sequence, later updates to it are written against them
+        void acknowledge(uint32_t client_id, uint64_t sequence)
+        {
+            const auto client = m_clients.find(client_id);
+
+            if (client == m_clients.end() || sequence <= client->second.m_acknowledged ||
+                sequence < client->second.m_snapshot || sequence > m_sequence)
+                return;
+
+            client->second.m_acknowledged = sequence;
+
+            while (!client->second.m_sent.empty() && client->second.m_sent.front() <= sequence)
+                client->second.m_sent.pop_front();
+        }
+
+        void remove_client(uint32_t client_id)
+        {
+            m_clients.erase(client_id);
+        }
+
+        // Counts the update that was sent
+        void add_sent_update(const Message<Id_type>& update) noexcept
+        {
+            m_update_bytes += update.body_size();
+            m_snapshot_bytes += m_snapshot_size;
+        }
+
+        [[nodiscard]] Replication_stats get_stats() const noexcept
+        {
+            return {
+                .m_sequence = m_sequence,
+                .m_objects = m_states.size(),
+                .m_update_bytes = m_update_bytes,
+                .m_snapshot_bytes = m_snapshot_bytes};
+        }
+
+    private:
+        // Equal bytes shorter than this between the changed bytes are sent in the run, a new run costs more
+        static constexpr size_t MIN_RUN_GAP = 3;
+
+        [[nodiscard]] Shared_message<Id_type> build_update(uint64_t baseline)
+        {
+            Message<Id_type> update;
+            update.set_internal_id(Internal_id::replication_update);
+
+            Message_writer<Id_type> writer(update);
+            writer.write_varint(m_sequence);
+            writer.write_varint(baseline);
+
+            bool has_changes = false;
+            m_snapshot_size = 0;
+
+            m_states.for_each_object([&](uint32_t object_id) {
+                const Versioned_states::State state = m_states.find(object_id, m_sequence);
+                const Versioned_states::State baseline_state =
+                    baseline != 0 ? m_states.find(object_id, baseline) : nullptr;
+
+                if (state != nullptr)
+                    m_snapshot_size += state->size();
+
+                if (state == baseline_state)
+                    return;
+
+                if (state == nullptr)
+                {
+                    writer.write(State_entry_kind::removed);
+                    writer.write_varint(object_id);
+                }
+                else if (baseline_state == nullptr || baseline_state->size() != state->size())
+                {
+                    writer.write(State_entry_kind::full);
+                    writer.write_varint(object_id);
+                    writer.write_varint(state->size());
+                    writer.write_buffer(state->data(), state->size());
+                }
+                else if (find_runs(*baseline_state, *state))
+                {
+                    writer.write(State_entry_kind::delta);
+                    writer.write_varint(object_id);
+                    write_runs(writer, *state);
+                }
+                else
+                    return;
+
+                has_changes = true;
+            });
+
+            writer.write(State_entry_kind::end);
+            return has_changes || baseline == 0 ? make_shared_message(std::move(update)) : nullptr;
+        }
+
+        // @return true if the states differ, the runs of the changed bytes are left in the m_runs
+        bool find_runs(const std::vector<char>& baseline_state, const std::vector<char>& state)
+        {
+            m_runs.clear();
+
+            for (size_t i = 0; i < state.size(); ++i)
+            {
+                if (state[i] == baseline_state[i])
+                    continue;
+
+                if (!m_runs.empty() && i - (m_runs.back().first + m_runs.back().second) < MIN_RUN_GAP)
+                    m_runs.back().second = i + 1 - m_runs.back().first;
+                else
+                    m_runs.emplace_back(i, 1);
+            }
+
+            return !m_runs.empty();
+        }
+
+        void write_runs(Message_writer<Id_type>& writer, const std::vector<char>& state)
+        {
+            writer.write_varint(m_runs.size());
+            size_t position = 0;
+
+            for (const auto& [offset, length] : m_runs)
+            {
+                writer.write_varint(offset - position);
+                writer.write_varint(length);
+                writer.write_buffer(state.data() + offset, length);
+                position = offset + length;
+            }
+        }
+
+        uint64_t m_max_baseline_age;
+        Versioned_states m_states;
+
+        // Published sequence, the states set after it are for the next one
+        uint64_t m_sequence = 0;
+
+        struct Client_baseline
+        {
+            uint64_t m_acknowledged = 0;
+
+            // Client drops the older states when it gets a full snapshot, their acknowledgements are ignored
+            uint64_t m_snapshot = 0;
+
+            // Sequences sent after the acknowledged one
+            std::deque<uint64_t> m_sent;
+        };
+
+        std::unordered_map<uint32_t, Client_baseline> m_clients;
+
+        // Updates of the published sequence by their baseline
+        std::map<uint64_t, Shared_message<Id_type>> m_updates;
+
+        std::vector<std::pair<size_t, size_t>> m_runs;
+        uint64_t m_snapshot_size = 0;
+        uint64_t m_update_bytes = 0;
+        uint64_t m_snapshot_bytes = 0;
+    };
+
+    /**
+     *   Client side of the replication. Keeps the states of the sequences that the server may still write its
+     *   updates against, the ones from the baseline of the latest update on.
+     */
+    template <Id_concept Id_type>
+    class State_replica
+    {
+    public:
+        /**
+         *   Applies the update and tells which objects changed
+         *
+         *   @param the replication_update
+         *   @param called with the object id and the state after the update for every changed object, the state is
+         *          null if the object was removed
+         *   @throws if the update is invalid or it is not written against a state this has, nothing is changed then
+         *   @return the acknowledgement that is sent to the server
+         */
+        template <typename Callable_type>
+        Message<Id_type> apply(const Message<Id_type>& update, Callable_type&& on_change)
+        {
+            Message_reader<Id_type> reader(update);
+            const auto sequence = reader.template read_varint<uint64_t>();
+            const auto baseline = reader.template read_varint<uint64_t>();
+
+            // Full snapshot starts again, also after a connection to another server
+            if (baseline != 0 && (baseline < m_oldest_sequence || baseline > m_sequence || sequence <= m_sequence))
+                throw std::invalid_argument("Update is not against a known state");
+
+            std::vector<std::pair<uint32_t, Versioned_states::State>> states = read_entries(reader, baseline);
+            std::unordered_set<uint32_t> changed_objects;
+
+            for (const auto& [object_id, state] : states)
+                changed_objects.insert(object_id);
+
+            // Objects the update left out are as they were at the baseline
+            if (baseline == 0)
+            {
+                m_states.for_each_object([&](uint32_t object_id) {
+                    if (m_states.find_latest(object_id) != nullptr && changed_objects.insert(object_id).second)
+                        states.emplace_back(object_id, nullptr);
+                });
+
+                m_states.clear();
+                m_changed_objects.clear();
+            }
+            else
+            {
+                for (const auto& [changed_sequence, object_ids] : m_changed_objects)
+                    for (const uint32_t object_id : object_ids)
+                        if (changed_sequence > baseline && changed_objects.insert(object_id).second)
+                            states.emplace_back(object_id, m_states.find(object_id, baseline));
+            }
+
+            std::vector<uint32_t>& object_ids = m_changed_objects[sequence];
+
+            for (auto& [object_id, state] : states)
+            {
+                m_states.set(object_id, sequence, state);
+                object_ids.push_back(object_id);
+                on_change(object_id, state.get());
+            }
+
+            // Server writes the next updates against this baseline or a later one
+            m_states.prune(baseline);
+            std::erase_if(m_changed_objects, [baseline](const auto& entry) { return entry.first <= baseline; });
+
+            m_oldest_sequence = baseline != 0 ? baseline : sequence;
+            m_sequence = sequence;
+
+            Message<Id_type> acknowledgement;
+            acknowledgement.set_internal_id(Internal_id::replication_ack);
+            Message_writer<Id_type>(acknowledgement).write_varint(sequence);
+            return acknowledgement;
+        }
+
+        // @return the latest state of the object, null if there is none
+        [[nodiscard]] const std::vector<char>* get_state(uint32_t object_id) const
+        {
+            return m_states.find_latest(object_id).get();
+        }
+
+        // @throws if the acknowledgement is invalid
+        [[nodiscard]] static uint64_t read_acknowledgement(const Message<Id_type>& acknowledgement)
+        {
+            Message_reader<Id_type> reader(acknowledgement);
+            return reader.template read_varint<uint64_t>();
+        }
+
+    private:
+        [[nodiscard]] std::vector<std::pair<uint32_t, Versioned_states::State>> read_entries(
+            Message_reader<Id_type>& reader, uint64_t baseline) const
+        {
+            std::vector<std::pair<uint32_t, Versioned_states::State>> states;
+
+            for (auto kind = reader.template read<State_entry_kind>(); kind != State_entry_kind::end;
+                 kind = reader.template read<State_entry_kind>())
+            {
+                const uint32_t object_id = reader.template read_varint<uint32_t>();
+
+                if (kind == State_entry_kind::removed)
+                {
+                    states.emplace_back(object_id, nullptr);
+                    continue;
+                }
+
+                std::vector<char> state;
+
+                if (kind == State_entry_kind::full)
+                {
+                    state.resize(reader.template read_varint<size_t>());
+                    reader.read_to_buffer(state.data(), state.size());
+                }
+                else if (kind == State_entry_kind::delta)
+                    state = read_delta(reader, baseline != 0 ? m_states.find(object_id, baseline) : nullptr);
+                else
+                    throw std::invalid_argument("Unknown state entry");
+
+                states.emplace_back(object_id, std::make_shared<const std::vector<char>>(std::move(state)));
+            }
+
+            return states;
+        }
+
+        [[nodiscard]] static std::vector<char> read_delta(
+            Message_reader<Id_type>& reader, const Versioned_states::State& baseline_state)
+        {
+            if (baseline_state == nullptr)
+                throw std::invalid_argument("Delta of an unknown state");
+
+            std::vector<char> state = *baseline_state;
+            const auto run_count = reader.template read_varint<size_t>();
+            size_t position = 0;
+
+            for (size_t i = 0; i < run_count; ++i)
+            {
+                const auto skipped = reader.template read_varint<size_t>();
+                const auto length = reader.template read_varint<size_t>();
+
+                if (skipped > state.size() - position || length > state.size() - position - skipped)
+                    throw std::length_error("Delta run is outside the state");
+
+                position += skipped;
+                reader.read_to_buffer(state.data() + position, length);
+                position += length;
+            }
+
+            return state;
+        }
+
+        Versioned_states m_states;
+
+        // Objects that changed in each sequence after the baseline, they are set back if the next update is
+        // written against an older sequence and leaves them out
+        std::map<uint64_t, std::vector<uint32_t>> m_changed_objects;
+
+        uint64_t m_sequence = 0;
+        uint64_t m_oldest_sequence = 0;
+    };
+} // namespace Net
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "Client_registry.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Subscribers of the server topics that can be used from any thread. The connections of a topic are in
+     *   a dense array so publishing goes through linear memory without looking up the clients, and the index
+     *   of each subscriber lets it be removed by moving the last one to its place.
+     */
+    template <Id_concept Id_type>
+    class Topic_registry
+    {
+    public:
+        using Connection_ptr = std::shared_ptr<Connection<Id_type>>;
+
+        // @param the clients that can subscribe, a client is subscribed only while it is in them
+        explicit Topic_registry(const Client_registry<Id_type>& clients) : m_clients(clients)
+        {
+        }
+
+        Topic_registry(const Topic_registry&) = delete;
+        Topic_registry(Topic_registry&&) = delete;
+
+        ~Topic_registry() = default;
+
+        Topic_registry& operator=(const Topic_registry&) = delete;
+        Topic_registry& operator=(Topic_registry&&) = delete;
+
+        /**
+         *   The client is looked up while the topics are locked, so a client that is removed meanwhile is either
+         *   not subscribed or its subscriptions are removed by the unsubscribe_all after it
+         *
+         *   @return false if the client was not found or was already subscribed
+         */
+        bool subscribe(uint64_t topic, uint32_t client_id)
+        {
+            std::unique_lock lock(m_mutex);
+
+            Connection_ptr connection = m_clients.find(client_id);
+
+            if (connection == nullptr)
+                return false;
+
+            Topic& subscribers = m_topics[topic];
+            const uint32_t index = static_cast<uint32_t>(subscribers.m_client_ids.size());
+
+            if (!subscribers.m_indices.emplace(client_id, index).second)
+                return false;
+
+            subscribers.m_client_ids.push_back(client_id);
+            subscribers.m_connections.push_back(std::move(connection));
+            m_client_topics[client_id].push_back(topic);
+
+            return true;
+        }
+
+        // @return false if the client was not subscribed to the topic
+        bool unsubscribe(uint64_t topic, uint32_t client_id)
+        {
+            std::unique_lock lock(m_mutex);
+
+            if (!erase_subscriber(topic, client_id))
+                return false;
+
+            const auto client_topics = m_client_topics.find(client_id);
+            std::erase(client_topics->second, topic);
+
+            if (client_topics->second.empty())
+                m_client_topics.erase(client_topics);
+
+            return true;
+        }
+
+        // Removes the client from all of its topics, called when the client is removed from the server
+        void unsubscribe_all(uint32_t client_id)
+        {
+            std::unique_lock lock(m_mutex);
+
+            const auto client_topics = m_client_topics.find(client_id);
+
+            if (client_topics == m_client_topics.end())
+                return;
+
+            for (const uint64_t topic : client_topics->second)
+                erase_subscriber(topic, client_id);
+
+            m_client_topics.erase(client_topics);
+        }
+
+        [[nodiscard]] size_t get_subscriber_count(uint64_t topic) const
+        {
+            std::shared_lock lock(m_mutex);
+
+            const auto subscribers = m_topics.find(topic);
+            return subscribers != m_topics.end() ? subscribers->second.m_connections.size() : 0;
+        }
+
+        /**
+         *   Calls the callable with every subscriber of the topic while the topics are shared locked.
+         *   The callable must not subscribe or unsubscribe.
+         *
+         *   @param callable that takes uint32_t client id and const Connection_ptr&
+         */
+        template <typename Callable_type>
+        void for_each_subscriber(uint64_t topic, Callable_type&& callable) const
+        {
+            std::shared_lock lock(m_mutex);
+
+            const auto subscribers = m_topics.find(topic);
+
+            if (subscribers == m_topics.end())
+                return;
+
+            const Topic& found_topic = subscribers->second;
+
+            for (size_t i = 0; i < found_topic.m_connections.size(); ++i)
+                callable(found_topic.m_client_ids[i], found_topic.m_connections[i]);
+        }
+
+    private:
+        // Subscribers in the same order in both arrays and the index of each client in them
+        struct Topic
+        {
+            std::vector<uint32_t> m_client_ids;
+            std::vector<Connection_ptr> m_connections;
+            std::unordered_map<uint32_t, uint32_t> m_indices;
+        };
+
+        // @return false if the client was not subscribed, the topic is removed after its last subscriber
+        bool erase_subscriber(uint64_t topic, uint32_t client_id)
+        {
+            const auto found_topic = m_topics.find(topic);
+
+            if (found_topic == m_topics.end())
+                return false;
+
+            Topic& subscribers = found_topic->second;
+            const auto found_index = subscribers.m_indices.find(client_id);
+
+            if (found_index == subscribers.m_indices.end())
+                return false;
+
+            // Last subscriber is moved to the place of the removed one so the arrays stay dense
+            const uint32_t index = found_index->second;
+            subscribers.m_indices.erase(found_index);
+
+            if (index + 1 < subscribers.m_client_ids.size())
+            {
+                subscribers.m_client_ids[index] = subscribers.m_client_ids.back();
+                subscribers.m_connections[index] = std::move(subscribers.m_connections.back());
+                subscribers.m_indices[subscribers.m_client_ids[index]] = index;
+            }
+
+            subscribers.m_client_ids.pop_back();
+            subscribers.m_connections.pop_back();
+
+            if (subscribers.m_client_ids.empty())
+                m_topics.erase(found_topic);
+
+            return true;
+        }
+
+        const Client_registry<Id_type>& m_clients;
+
+        mutable std::shared_mutex m_mutex;
+        std::unordered_map<uint64_t, Topic> m_topics;
+
+        // Topics of each client so its subscriptions can be removed with it
+        std::unordered_map<uint32_t, std::vector<uint64_t>> m_client_topics;
+    };
+} // namespace Net
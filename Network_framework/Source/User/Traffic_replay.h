@@ -0,0 +1,310 @@
+#pragma once
+
+#include "../Utility/Latency_histogram.h"
+#include "../Utility/Traffic_capture.h"
+#include "Client.h"
+#include "Io_runtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Net
+{
+    struct Traffic_replay_settings
+    {
+        // Directory of the segments written by the Traffic_capture
+        std::filesystem::path m_directory;
+
+        // 1 keeps the original timing, 2 replays twice as fast and 0 sends as fast as possible
+        double m_speed = 1.0;
+
+        // Threads that run the Asio of all the replaying clients
+        size_t m_io_threads = 1;
+
+        std::chrono::seconds m_connect_timeout = std::chrono::seconds(30);
+
+        // How long the replies are read after the last message before the clients disconnect
+        std::chrono::seconds m_drain_time = std::chrono::seconds(1);
+    };
+
+    struct Traffic_replay_results
+    {
+        size_t m_clients = 0;
+        size_t m_failed_clients = 0;
+        uint64_t m_sent_messages = 0;
+        uint64_t m_sent_bytes = 0;
+        uint64_t m_received_messages = 0;
+
+        // Internal messages, the messages of other header sizes and the messages of the failed clients
+        uint64_t m_skipped_frames = 0;
+
+        // Original time between the first and the last replayed message and how long the replay took
+        std::chrono::nanoseconds m_captured_duration = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds m_replay_duration = std::chrono::nanoseconds(0);
+
+        // How late the messages were sent compared to the scaled capture time, empty when the speed is 0
+        Latency_percentiles m_send_lag;
+    };
+
+    /**
+     *   Replays the received messages of a traffic capture against a server, each captured client by its own
+     *   client so the load has the mix and the timing of the real traffic. The ids the server sent in the capture
+     *   are accepted by the clients and their replies are read and dropped.
+     *   Only the user messages are replayed, the framework makes its own pings, streams and fragments.
+     *   The segments are read twice, first to find the clients and the ids and then to replay.
+     *
+     *   Traffic_replay<Id_type> replay({.m_directory = "capture", .m_speed = 2.0});
+     *   const auto results = replay.run([](Client<Id_type>& client) { return client.connect("host", "1234"); });
+     */
+    template <Id_concept Id_type, typename Client_type = Client<Id_type>>
+    class Traffic_replay
+    {
+    public:
+        // Called for every client before it connects so the client can be set up, for example its tls verification
+        using Client_setup = std::function<void(Client_type&)>;
+
+        // Starts connecting the client, false if it could not start
+        using Client_connector = std::function<bool(Client_type&)>;
+
+        explicit Traffic_replay(Traffic_replay_settings settings) : m_settings(std::move(settings))
+        {
+        }
+
+        Traffic_replay(const Traffic_replay&) = delete;
+        Traffic_replay(Traffic_replay&&) = delete;
+
+        ~Traffic_replay() = default;
+
+        Traffic_replay& operator=(const Traffic_replay&) = delete;
+        Traffic_replay& operator=(Traffic_replay&&) = delete;
+
+        void set_client_setup(Client_setup setup)
+        {
+            m_client_setup = std::move(setup);
+        }
+
+        /**
+         *   Connects a client for every client in the capture, replays their messages and disconnects them.
+         *   This blocks until the replay is done.
+         *
+         *   @param connects each client
+         *   @throws std::system_error if the directory or a segment could not be read
+         */
+        Traffic_replay_results run(const Client_connector& connect)
+        {
+            Traffic_replay_results results;
+            const std::vector<std::filesystem::path> segments = Traffic_capture::find_segments(m_settings.m_directory);
+
+            scan_segments(segments);
+            connect_clients(connect, results);
+
+            const auto replay_start = std::chrono::steady_clock::now();
+            auto next_drain_time = replay_start;
+            std::optional<int64_t> first_frame_time;
+            int64_t last_frame_time = 0;
+
+            for (const std::filesystem::path& segment : segments)
+            {
+                Traffic_capture::read_segment(
+                    segment, [&](const Captured_frame_header& frame, std::span<const char> header,
+                                 std::span<const char> body) {
+                        Client_type* client = find_replayed_client(frame, header);
+
+                        if (client == nullptr)
+                        {
+                            ++results.m_skipped_frames;
+                            return;
+                        }
+
+                        if (!first_frame_time)
+                            first_frame_time = frame.m_time;
+
+                        last_frame_time = frame.m_time;
+
+                        if (m_settings.m_speed > 0.0)
+                        {
+                            const auto send_time =
+                                replay_start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::duration<double, std::nano>(
+                                                       static_cast<double>(frame.m_time - *first_frame_time) /
+                                                       m_settings.m_speed));
+
+                            wait_until(send_time, next_drain_time, results);
+                            m_send_lag.record(std::chrono::steady_clock::now() - send_time);
+                        }
+                        else if (std::chrono::steady_clock::now() >= next_drain_time)
+                            drain_clients(next_drain_time, results);
+
+                        client->send_message(make_message(header, body));
+                        ++results.m_sent_messages;
+                        results.m_sent_bytes += header.size() + body.size();
+                    });
+            }
+
+            results.m_replay_duration = std::chrono::steady_clock::now() - replay_start;
+            results.m_captured_duration =
+                std::chrono::nanoseconds(first_frame_time ? last_frame_time - *first_frame_time : 0);
+
+            wait_until(std::chrono::steady_clock::now() + m_settings.m_drain_time, next_drain_time, results);
+            disconnect_clients();
+
+            results.m_send_lag = m_send_lag.get_percentiles();
+            return results;
+        }
+
+    private:
+        // The replies are read this often so the in queues of the clients don't grow
+        static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(10);
+
+        // Finds the clients that sent user messages and the ids the server sent
+        void scan_segments(const std::vector<std::filesystem::path>& segments)
+        {
+            for (const std::filesystem::path& segment : segments)
+            {
+                Traffic_capture::read_segment(
+                    segment,
+                    [this](const Captured_frame_header& frame, std::span<const char> header, std::span<const char>) {
+                        const std::optional<Message_header<Id_type>> message_header =
+                            read_captured_user_header<Id_type>(header);
+
+                        if (!message_header)
+                            return;
+
+                        if (frame.m_direction == Capture_direction::received)
+                            m_clients.try_emplace(frame.m_client_id, nullptr);
+                        else
+                            m_reply_ids.insert(message_header->m_id);
+                    });
+            }
+        }
+
+        void connect_clients(const Client_connector& connect, Traffic_replay_results& results)
+        {
+            m_runtime = std::make_shared<Io_runtime>(m_settings.m_io_threads);
+
+            for (auto& [client_id, client] : m_clients)
+            {
+                client = std::make_unique<Client_type>(m_runtime);
+
+                for (const Id_type id : m_reply_ids)
+                    client->add_accepted_message(id);
+
+                if (m_client_setup)
+                    m_client_setup(*client);
+
+                if (!connect(*client))
+                    client.reset();
+            }
+
+            const auto connect_end_time = std::chrono::steady_clock::now() + m_settings.m_connect_timeout;
+
+            while (std::chrono::steady_clock::now() < connect_end_time &&
+                   std::ranges::any_of(m_clients, [](const auto& entry) {
+                       return entry.second != nullptr && entry.second->is_connecting();
+                   }))
+            {
+                for (auto& [client_id, client] : m_clients)
+                    if (client != nullptr)
+                        static_cast<void>(client->update_batch());
+
+                std::this_thread::sleep_for(DRAIN_INTERVAL);
+            }
+
+            results.m_clients = m_clients.size();
+
+            // Messages of the clients that did not connect are skipped
+            for (auto& [client_id, client] : m_clients)
+            {
+                if (client != nullptr && !client->is_connected())
+                    client.reset();
+
+                if (client == nullptr)
+                    ++results.m_failed_clients;
+            }
+        }
+
+        // Reads the replies while waiting
+        void wait_until(
+            std::chrono::steady_clock::time_point time, std::chrono::steady_clock::time_point& next_drain_time,
+            Traffic_replay_results& results)
+        {
+            while (std::chrono::steady_clock::now() < time)
+            {
+                if (std::chrono::steady_clock::now() >= next_drain_time)
+                    drain_clients(next_drain_time, results);
+
+                std::this_thread::sleep_until(std::min(time, next_drain_time));
+            }
+
+            if (std::chrono::steady_clock::now() >= next_drain_time)
+                drain_clients(next_drain_time, results);
+        }
+
+        void drain_clients(std::chrono::steady_clock::time_point& next_drain_time, Traffic_replay_results& results)
+        {
+            for (auto& [client_id, client] : m_clients)
+                if (client != nullptr)
+                    results.m_received_messages += client->update_batch().size();
+
+            next_drain_time = std::chrono::steady_clock::now() + DRAIN_INTERVAL;
+        }
+
+        void disconnect_clients()
+        {
+            for (auto& [client_id, client] : m_clients)
+                if (client != nullptr)
+                    client->disconnect();
+
+            // Clients are destroyed before the runtime that runs them, from this thread that is not one of its
+            m_clients.clear();
+            m_runtime.reset();
+        }
+
+        // @return the connected client of the received user message or null if the frame is not replayed
+        [[nodiscard]] Client_type* find_replayed_client(
+            const Captured_frame_header& frame, std::span<const char> header)
+        {
+            if (frame.m_direction != Capture_direction::received || !read_captured_user_header<Id_type>(header))
+                return nullptr;
+
+            const auto client = m_clients.find(frame.m_client_id);
+            return client != m_clients.end() ? client->second.get() : nullptr;
+        }
+
+        [[nodiscard]] static Message<Id_type> make_message(std::span<const char> header, std::span<const char> body)
+        {
+            Message_header<Id_type> message_header;
+            std::memcpy(&message_header, header.data(), sizeof(message_header));
+
+            Message<Id_type> message;
+            message.set_id(message_header.m_id);
+            message.resize_body(body.size());
+
+            if (!body.empty())
+                std::memcpy(message.body_data(), body.data(), body.size());
+
+            return message;
+        }
+
+        Traffic_replay_settings m_settings;
+        Client_setup m_client_setup;
+
+        std::shared_ptr<Io_runtime> m_runtime;
+
+        // Captured client id to its replaying client, null if it did not connect
+        std::unordered_map<uint32_t, std::unique_ptr<Client_type>> m_clients;
+        std::unordered_set<Id_type> m_reply_ids;
+
+        Latency_histogram m_send_lag;
+    };
+} // namespace Net
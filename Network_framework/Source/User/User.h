@@ -1,19 +1,127 @@
 #pragma once
 
 #include "../Connection/Connection.h"
+#include "../Connection/Datagram_channel.h"
+#include "../Connection/Reliable_datagram_session.h"
+#include "../Events/Message_handlers.h"
 #include "../Message/Message_converter.h"
+#include "../Message/Message_reader.h"
+#include "../Message/Message_recycler.h"
+#include "../Message/Message_schema.h"
+#include "../Message/Message_writer.h"
 #include "../Message/Owned_message.h"
+#include "../Message/Schema_view.h"
+#include "../Message/Stream_chunk.h"
+#include "../Sockets/Aead_socket.h"
+#include "../Sockets/Quic_socket.h"
+#include "../Sockets/Shared_memory_socket.h"
 #include "../Sockets/Socket.h"
 #include "../Events/Delegate.h"
+#include "../Utility/Allocation_tracker.h"
+#include "../Utility/Latency_histogram.h"
+#include "../Utility/Metrics.h"
+#include "../Utility/Metrics_exporter.h"
+#include "../Utility/Mpsc_queue.h"
+#include "../Utility/Notification.h"
+#include "../Utility/Notification_sink.h"
+#include "../Utility/Open_metrics.h"
 #include "../Utility/Thread_safe_deque.h"
+#include "../Utility/Trace.h"
+#include "../Utility/Traffic_capture.h"
+#include "../Utility/Wakeup_event.h"
 #include "Asio_base.h"
+#include "Rpc_calls.h"
+#include "asio/experimental/concurrent_channel.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <concepts>
+#include <deque>
+#include <format>
+#include <functional>
+#include <memory>
 #include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace Net
 {
+    /**
+     *   Order in which the received messages are handled. Messages from one connection are always
+     *   handled in the order they were received.
+     *   global_fifo handles all the messages in the order they arrived from any connection.
+     *   fair_per_client takes turns between the connections so one busy connection can't take the whole update.
+     */
+    enum class Delivery_order : uint8_t
+    {
+        global_fifo,
+        fair_per_client
+    };
+
+    /**
+     *   Limits for the fair_per_client delivery order.
+     *   Every turn a client gets m_quantum_bytes more to spend on its messages and one batch
+     *   handles at most m_max_messages_per_client messages from the same client.
+     */
+    struct Fair_delivery_limits
+    {
+        size_t m_quantum_bytes = 4096;
+        size_t m_max_messages_per_client = std::numeric_limits<size_t>::max();
+    };
+
+    /**
+     *   Limits of the received messages waiting for the update. Connection that finds the in queue full stops
+     *   reading until the update has drained the queue to half of the limits, so the tcp slows the peer down
+     *   instead of the memory growing. The amount of messages is also limited by the capacity of the queue.
+     */
+    struct In_queue_limits
+    {
+        size_t m_max_messages = std::numeric_limits<size_t>::max();
+        size_t m_max_bytes = std::numeric_limits<size_t>::max();
+    };
+
+    /**
+     *   When the user counts as overloaded and what it sheds then. Overload is checked a few times a second from
+     *   the lag of the Asio threads, see the get_io_lag, and from the received messages waiting for the update.
+     *   It ends when both are under the half of their limits, so the shedding does not flap at the limit.
+     */
+    struct Overload_settings
+    {
+        // Lag that counts as overloaded, nothing ignores the lag
+        std::optional<std::chrono::milliseconds> m_max_io_lag = std::nullopt;
+
+        // Received messages waiting for the update that count as overloaded, nothing ignores the in queue
+        std::optional<size_t> m_max_in_queue_messages = std::nullopt;
+
+        // Server rejects the new connections
+        bool m_reject_connections = true;
+
+        // Connections that were set as bulk stop reading until the overload ends, see the Server::set_client_bulk
+        bool m_pause_bulk_connections = true;
+
+        // Received messages of the ids that have the m_is_sheddable in their limits are dropped
+        bool m_drop_sheddable_messages = true;
+    };
+
+    // Work that the update left for the next one because its deadline came
+    struct Update_backlog
+    {
+        size_t m_received_messages = 0;
+        size_t m_new_connections = 0;
+        size_t m_notifications = 0;
+
+        [[nodiscard]] bool is_empty() const noexcept
+        {
+            return m_received_messages == 0 && m_new_connections == 0 && m_notifications == 0;
+        }
+    };
+
     // Base class for the server and the client
     template <Id_concept Id_type>
     class User : public Asio_base
@@ -21,111 +129,1287 @@ namespace Net
     public:
         using Seconds = std::chrono::seconds;
         using Optional_seconds = std::optional<Seconds>;
-        using Accepted_messages_container = std::unordered_map<Id_type, Message_limits>;
+        using Accepted_messages_container = Accepted_messages<Id_type>;
+
+        // @param the shared runtime that runs the Asio, nullptr runs own threads
+        explicit User(std::shared_ptr<Io_runtime> runtime = nullptr) : Asio_base(std::move(runtime))
+        {
+            m_accepted_messages = std::make_shared<Accepted_messages_container>();
+        }
+
+        virtual ~User() = default;
+
+        User(const User&) = delete;
+        User(User&&) = delete;
+        User& operator=(const User&) = delete;
+        User& operator=(User&&) = delete;
+
+        /**
+         *   Add message id that gets accepted. By default, all messages id's are not accepted
+         *   and if you receive an unaccepted message, you get disconnected.
+         *   This also allows you to put size limits on the messages.
+         *
+         *   @param the type to be accepted
+         *   @param the min message size
+         *   @param the max message size
+         */
+        void add_accepted_message(Id_type type, uint32_t min = 0, uint32_t max = std::numeric_limits<uint32_t>::max())
+        {
+            const Message_limits limits = {.m_min = min, .m_max = max};
+            m_accepted_messages->emplace(type, limits);
+        }
+
+        /**
+         *   Accepts the message id with the size limits taken from the schema of the struct.
+         *   Messages must be created with the make_schema_message.
+         *
+         *   @param the type to be accepted
+         */
+        template <Schema_concept Schema_type>
+        void add_accepted_message(Id_type type)
+        {
+            constexpr Schema_sizes sizes = schema_sizes<Schema_type, Id_type>();
+            constexpr size_t max_size = std::min<size_t>(
+                std::numeric_limits<uint32_t>::max(),
+                std::numeric_limits<typename Message_header<Id_type>::Size_type>::max());
+
+            add_accepted_message(
+                type, static_cast<uint32_t>(std::min(sizes.m_min, max_size)),
+                static_cast<uint32_t>(std::min(sizes.m_max, max_size)));
+        }
+
+        /**
+         *   Limits how fast each peer may send the messages of the id, in addition to the limit of the whole peer
+         *   set with the set_rate_limit. Only affects connections created after this call.
+         *
+         *   @param the accepted type
+         *   @param the limit
+         *   @throws if the type has not been accepted
+         */
+        void set_message_rate_limit(Id_type type, const Rate_limit& limit)
+        {
+            Message_limits* limits = m_accepted_messages->find(type);
+
+            if (limits == nullptr)
+                throw std::invalid_argument("Rate limit can only be set to an accepted message");
+
+            limits->m_rate_limit = limit;
+        }
+
+        /**
+         *   Limits the strings of the received messages of the id. The framework does not know where the strings
+         *   are in the body, so they are checked when read with the limits from the get_string_limits, for example
+         *   Message_reader reader(message, server.get_string_limits(message.get_id())).
+         *   This should be set before the start because it is read from the asio threads without locking.
+         *
+         *   @param the accepted type
+         *   @param the limits
+         *   @throws if the type has not been accepted
+         */
+        void set_string_limits(Id_type type, const String_limits& string_limits)
+        {
+            Message_limits* limits = m_accepted_messages->find(type);
+
+            if (limits == nullptr)
+                throw std::invalid_argument("String limits can only be set to an accepted message");
+
+            limits->m_string_limits = string_limits;
+        }
+
+        // @return the string limits of the id or no limits if the id has not been accepted
+        [[nodiscard]] String_limits get_string_limits(Id_type type) const noexcept
+        {
+            const Message_limits* limits = m_accepted_messages->find(type);
+            return limits != nullptr ? limits->m_string_limits : String_limits();
+        }
+
+        /**
+         *   Sets where the received messages of the id are handled. The io_thread messages skip the in queue and
+         *   go to the handler registered for the id, or the m_on_message if there is none, on the asio thread that
+         *   received them so they don't wait for the next update.
+         *   Their handlers run at the same time as the update and each other so they have to be thread safe, the
+         *   messages of one connection are still handled in order. This and the handlers should be set before the
+         *   start because they are read from the asio threads without locking.
+         *
+         *   @param the accepted type
+         *   @param the policy
+         *   @throws if the type has not been accepted
+         */
+        void set_dispatch_policy(Id_type type, Dispatch_policy policy)
+        {
+            Message_limits* limits = m_accepted_messages->find(type);
+
+            if (limits == nullptr)
+                throw std::invalid_argument("Dispatch policy can only be set to an accepted message");
+
+            limits->m_dispatch_policy = policy;
+
+            if (policy == Dispatch_policy::io_thread)
+                m_has_io_thread_dispatch = true;
+        }
+
+        /**
+         *   Answers the rpc calls of the id with the callable. It is called in the update, or on the asio thread
+         *   if the dispatch policy of the id is io_thread, and the response it writes is sent back when it returns.
+         *   The response has the id of the request unless the handler changes it, and the caller has to accept
+         *   its id. Calls of the ids without a handler are answered with the no_handler status.
+         *   This should be set before the start because it is read from the asio threads without locking.
+         *
+         *   @param the id of the requests
+         *   @param callable that takes const Client_information& of the caller, Message<Id_type>& request and
+         *          Message<Id_type>& response
+         */
+        template <typename Callable_type>
+        void register_rpc_handler(Id_type id, Callable_type callable)
+        {
+            m_rpc_handlers.set_handler(id, std::move(callable));
+        }
+
+        // @return the calls that are waiting for their responses
+        [[nodiscard]] size_t get_pending_call_count() const
+        {
+            return m_rpc_calls.size();
+        }
+
+        /**
+         *   Limits how fast each peer may send messages. The limits are checked before the bodies are allocated
+         *   and the policy is used for the messages that go over this limit or the limits of their ids.
+         *   Pings and the messages of the connection setup are not limited.
+         *   Only affects connections created after this call.
+         *
+         *   @param the limit of all the messages from one peer
+         *   @param what is done to the messages over the limits
+         */
+        void set_rate_limit(
+            const Rate_limit& limit, Rate_limit_policy policy = Rate_limit_policy::pause_reading) noexcept
+        {
+            m_rate_limit = limit;
+            m_rate_limit_policy = policy;
+        }
+
+        /**
+         *   Holds the messages of each connection for a moment when they are sent fast, so the request and
+         *   response traffic is written in fuller batches under load without delaying it when idle, see the
+         *   Adaptive_batching. The write batch limits have to allow more than one message for this to help.
+         *   Explicit flushes and the tick corking write the held messages right away.
+         *   Only affects connections created after this call.
+         *
+         *   @param the longest hold and the bytes that are written without waiting, nullopt writes right away
+         */
+        void set_adaptive_batching(std::optional<Adaptive_batching> batching) noexcept
+        {
+            m_adaptive_batching = batching;
+        }
+
+        /**
+         *   Sets how many queued messages each connection may write with one gather write.
+         *   Only affects connections created after this call.
+         *
+         *   @param the max messages and bytes written at once
+         */
+        void set_write_batch_limits(Write_batch_limits limits) noexcept
+        {
+            // Batch with no room would never take a message
+            m_write_batch_limits = {
+                .m_max_messages = std::max<size_t>(limits.m_max_messages, 1),
+                .m_max_bytes = std::max<size_t>(limits.m_max_bytes, 1)};
+        }
+
+        /**
+         *   Sets how much the write queue of each connection may hold and what is done to the messages that don't
+         *   fit, see the Write_queue_limits. This keeps the memory bounded when the peer reads slower than it is
+         *   sent to. Only affects connections created after this call.
+         */
+        void set_write_queue_limits(Write_queue_limits limits) noexcept
+        {
+            m_write_queue_limits = limits;
+        }
+
+        /**
+         *   Sets how the lanes of the write queue take turns, see the Priority_settings. Messages are sent to the
+         *   lanes with the Message_priority, so a large bulk message does not delay the realtime messages sent
+         *   after it. Only affects connections created after this call.
+         */
+        void set_priority_settings(const Priority_settings& settings) noexcept
+        {
+            m_priority_settings = settings;
+        }
+
+        /**
+         *   Selects how the connections read messages. Only affects connections created after this call.
+         *
+         *   @param the read mode
+         *   @param initial size of the receive buffer in buffered mode
+         */
+        void set_read_mode(
+            Read_mode read_mode, size_t receive_buffer_size = Connection<Id_type>::DEFAULT_RECEIVE_BUFFER_SIZE) noexcept
+        {
+            m_read_mode = read_mode;
+            m_receive_buffer_size = receive_buffer_size;
+        }
+
+        /**
+         *   Sets the bytes the bulk connections read at a time in the buffered read modes, see the
+         *   Connection::set_bulk_read_budget. Only affects connections created after this call.
+         */
+        void set_bulk_read_budget(size_t bytes) noexcept
+        {
+            m_bulk_read_budget = bytes;
+        }
+
+        /**
+         *   Rejects the received messages with larger bodies, including the internal ones, before anything is
+         *   allocated for them. A peer that receives to the Fixed_message sets this to its capacity so every
+         *   message fits. Only affects connections created after this call.
+         */
+        void set_max_message_size(size_t max_message_size) noexcept
+        {
+            m_max_message_size = max_message_size;
+        }
+
+        /**
+         *   Rejects the received replication updates with larger bodies, a full snapshot of the replicated states
+         *   has to fit in it. Only the client receives them. Only affects connections created after this call.
+         */
+        void set_max_replication_update_size(size_t max_size) noexcept
+        {
+            m_max_replication_update_size = max_size;
+        }
+
+        /**
+         *   Lets the received messages refer to the receive buffer of the buffered read modes instead of copying
+         *   their bodies, see the Connection::set_zero_copy_receive. Only affects connections created after this call.
+         */
+        void set_zero_copy_receive(bool is_enabled) noexcept
+        {
+            m_is_zero_copy_receive = is_enabled;
+        }
+
+        /**
+         *   Sets the header format this user is willing to use. Compact headers are only used
+         *   if both the server and the client allow them, this is agreed when the client connects.
+         *   Checked format adds the crc32c of every frame to the compact header and falls back to compact
+         *   if the other side allows only that, it is meant for plain links because the tls already detects
+         *   corrupted records. Only affects connections created after this call.
+         */
+        void set_header_format(Header_format header_format) noexcept
+        {
+            m_header_format = header_format;
+        }
+
+        /**
+         *   Sets the codec this user is willing to use for compressing the message bodies. Compression is only
+         *   used if the server and the client have the same codec, this is agreed when the client connects.
+         *   Stream mode is used only if both have it and the same dictionary, otherwise the messages are
+         *   compressed one by one. The dictionary can be loaded with the load_compression_dictionary.
+         *   Only affects connections created after this call.
+         *
+         *   @throws if the codec was not enabled at build time
+         */
+        void set_compression(const Compression_settings& settings)
+        {
+            if (!Compression::is_available(settings.m_codec))
+                throw std::invalid_argument("Compression codec is not available in this build");
+
+            m_compression_settings = settings;
+        }
+
+        /**
+         *   Sends the messages of the id as the xor against the previous message of the id on the connection
+         *   before compressing them, so the repetitive messages like the scoreboards compress to the bytes that
+         *   changed. Used only with the per message compression that both sides agreed and for the bodies of
+         *   atleast the m_min_size of the compression settings, the stream compression already refers to the
+         *   earlier messages. Both sides keep the previous body of each of these ids for every connection.
+         *   Only affects connections created after this call.
+         *
+         *   @param the type to be delta encoded
+         */
+        void add_delta_encoded_message(Id_type type)
+        {
+            auto delta_encoded_messages = m_delta_encoded_messages != nullptr
+                                              ? std::make_shared<std::unordered_set<Id_type>>(*m_delta_encoded_messages)
+                                              : std::make_shared<std::unordered_set<Id_type>>();
+
+            delta_encoded_messages->insert(type);
+            m_delta_encoded_messages = std::move(delta_encoded_messages);
+        }
+
+        /**
+         *   Reads the bodies of the id straight to the memory the sink gives, see the Body_sink. Used only in the
+         *   exact read mode, the sink is called from the asio threads. Only affects connections created after this
+         *   call.
+         *
+         *   @param the type whose bodies are read to the sink
+         *   @param the sink, an empty one removes the sink of the id
+         */
+        void set_body_sink(Id_type type, Body_sink<Id_type> sink)
+        {
+            auto body_sinks = m_body_sinks != nullptr
+                                  ? std::make_shared<std::unordered_map<Id_type, Body_sink<Id_type>>>(*m_body_sinks)
+                                  : std::make_shared<std::unordered_map<Id_type, Body_sink<Id_type>>>();
+
+            if (sink)
+                body_sinks->insert_or_assign(type, std::move(sink));
+            else
+                body_sinks->erase(type);
+
+            m_body_sinks = body_sinks->empty() ? nullptr : std::move(body_sinks);
+        }
+
+        /**
+         *   Sets the options of the tcp sockets, see the Socket_options. Options are set right after the socket
+         *   has been accepted or connected so they are in use already in the handshake.
+         *   Only affects connections created after this call.
+         */
+        void set_socket_options(const Socket_options& options) noexcept
+        {
+            m_socket_options = options;
+        }
+
+        /**
+         *   Encrypts the tcp connections with the pre shared key instead of the tls, see the Aead_socket. This is
+         *   meant for the links between the trusted hosts and both sides need the same settings. The Ssl_server
+         *   and the Ssl_client use the tls instead and the unix domain sockets are not encrypted.
+         *   Only affects connections created after this call.
+         *
+         *   @throws if the key is shorter than the Aead_settings::MIN_KEY_SIZE
+         */
+        void set_pre_shared_key_encryption(Aead_settings settings)
+        {
+            if (settings.m_pre_shared_key.size() < Aead_settings::MIN_KEY_SIZE)
+                throw std::invalid_argument(
+                    std::format("Pre shared key has to be atleast {} bytes", Aead_settings::MIN_KEY_SIZE));
+
+            m_aead_settings = std::make_shared<const Aead_settings>(std::move(settings));
+        }
+
+        /**
+         *   Sets the pings and the idle timeouts of the connections, see the Heartbeat_settings.
+         *   Both sides answer the pings so only one of them has to send them.
+         *   Only affects connections created after this call.
+         */
+        void set_heartbeat(const Heartbeat_settings& settings) noexcept
+        {
+            m_heartbeat_settings = settings;
+        }
+
+        /**
+         *   Sets how much the received messages may take while waiting for the update, see the In_queue_limits.
+         *   This should be called before starting.
+         */
+        void set_in_queue_limits(In_queue_limits limits) noexcept
+        {
+            m_in_queue_limits = limits;
+        }
+
+        /**
+         *   Sets when this counts as overloaded and what is shed then, see the Overload_settings
+         *
+         *   @throws if the Asio threads are running
+         */
+        void set_overload_settings(const Overload_settings& settings)
+        {
+            if (is_asio_thread_running())
+                throw std::logic_error("Overload settings can't be changed while running");
+
+            m_overload_settings = settings;
+
+            if (const std::shared_ptr<Timer_wheel> timer_wheel = get_timer_wheel().lock())
+            {
+                timer_wheel->cancel(m_overload_timer);
+                m_overload_timer = 0;
+
+                if (m_overload_settings.m_max_io_lag || m_overload_settings.m_max_in_queue_messages)
+                    schedule_overload_check();
+            }
+        }
+
+        // @return true if the Overload_settings count this as overloaded, this can be called from any thread
+        [[nodiscard]] bool is_overloaded() const noexcept
+        {
+            return m_is_overloaded.load(std::memory_order_relaxed);
+        }
+
+        /**
+         *   Sets the order in which the received messages are handled, see the Delivery_order
+         *
+         *   @param the order
+         *   @param the limits used by the fair_per_client order
+         */
+        void set_delivery_order(Delivery_order delivery_order, Fair_delivery_limits limits = {}) noexcept
+        {
+            m_delivery_order = delivery_order;
+            m_fair_delivery_limits = limits;
+        }
+
+        /**
+         *   Adds the udp channel next to the tcp connections for the unreliable messages, see the Datagram_channel.
+         *   The server opens it on the port of the tcp acceptor and tells its clients about it in the server accept,
+         *   the client uses it only if this is also enabled on the client. This should be called before starting.
+         */
+        void set_datagram_channel(bool is_enabled) noexcept
+        {
+            m_is_datagram_channel_enabled = is_enabled;
+        }
+
+        /**
+         *   Sets how the messages of the id are sent. Unreliable messages go in datagrams when the datagram channel
+         *   of the peer is up, so they can be lost or come in a different order but a lost packet does not hold back
+         *   the later ones. The reliable and ordered datagrams are sent again until they are acked, see the
+         *   Reliable_datagram_session, so over a lossy link they wait less for the retransmissions than the tcp.
+         *   All of them go through the tcp connection until the channel is up or when they don't fit in one
+         *   datagram, and those are not ordered with the datagrams. Both sides need the id accepted as usual.
+         *   This should be called before starting because the modes are read from the sending threads without
+         *   locking.
+         *
+         *   @param the message id
+         *   @param the mode
+         */
+        void set_delivery_mode(Id_type id, Delivery_mode mode)
+        {
+            if (mode == Delivery_mode::reliable)
+                m_delivery_modes.erase(id);
+            else
+                m_delivery_modes[id] = mode;
+        }
+
+        /**
+         *   Handle everything received through internet
+         *
+         *   @param the max items handled
+         *   @param should the function wait if there is no items to handle
+         *   @param optional interval for checking connections. If you don't give this there will be no checking
+         */
+        virtual void update(
+            size_t max_handled_items = SIZE_T_MAX, bool wait = false,
+            Optional_seconds check_connections_interval = Optional_seconds())
+        {
+            NET_TRACE_SCOPE("User::update");
+
+            // Cleared before anything is handled so the work that comes during the update signals it again
+            m_wakeup_event.reset();
+
+            if (check_connections_interval.has_value())
+                handle_check_connections_delay(wait, check_connections_interval.value());
+            else if (wait)
+                wait_until_has_something_to_do();
+
+            handle_notifications(max_handled_items);
+        }
+
+        /**
+         *   Handle that the application can wait on together with its own sources instead of waiting in the update.
+         *   It is an eventfd on linux and an event object on windows, it becomes readable or signaled when the update
+         *   has something to do and the update clears it. Call the update without waiting when it is ready.
+         */
+        [[nodiscard]] Wakeup_event::Native_handle get_wakeup_handle() const noexcept
+        {
+            return m_wakeup_event.native_handle();
+        }
+
+        /**
+         *   Notifications under the severity are dropped before they are created, so for example only the errors
+         *   are reported when this is set to error. This should be called before starting.
+         */
+        void set_notification_severity(Severity min_severity) noexcept
+        {
+            m_min_notification_severity = min_severity;
+        }
+
+        /**
+         *   Counters of all the connections since this was created with the current queue depths, the ids and
+         *   disconnect reasons are counted too. This can be called from any thread.
+         */
+        [[nodiscard]] Metrics<Id_type> get_metrics() const
+        {
+            Metrics<Id_type> metrics;
+            m_metrics_counters->add_to(metrics);
+
+            metrics.m_in_queue_messages = m_in_queue.size();
+            metrics.m_in_queue_bytes = m_in_queue_bytes.load(std::memory_order_relaxed);
+            metrics.m_memory_bytes = metrics.m_in_queue_bytes;
+            metrics.m_io_lag = get_io_lag();
+            metrics.m_is_overloaded = is_overloaded();
+            metrics.m_shed_messages = m_shed_messages.load(std::memory_order_relaxed);
+            metrics.m_locks.push_back({"paused_connections", m_paused_connections.get_lock_metrics()});
+            metrics.m_locks.push_back({"failed_rpc_calls", m_failed_rpc_calls.get_lock_metrics()});
+            add_connection_metrics(metrics);
+
+            if (m_handler_profile)
+                metrics.m_handler_times = m_handler_profile->get_metrics();
+
+            return metrics;
+        }
+
+        /**
+         *   Times one in the sample interval of the handler calls and sums them by the id of the message into
+         *   the m_handler_times of the metrics, so a slow update can be traced to the handlers that take the time.
+         *   A sampled call costs two reads of the time stamp counter. This should be called before starting.
+         *
+         *   @param one in this many handler calls is timed, 0 turns the profiling off
+         */
+        void set_handler_profiling(uint32_t sample_interval)
+        {
+            m_handler_profile = sample_interval > 0 ? std::make_shared<Handler_profile<Id_type>>(sample_interval)
+                                                    : nullptr;
+        }
+
+        /**
+         *   Times how long the received messages wait until the update takes them and how long the sent messages
+         *   wait until they have been written to the socket. Nothing is timed when this is off.
+         *   This should be called before starting.
+         */
+        void set_latency_tracking(bool is_enabled)
+        {
+            m_latency_histograms = is_enabled ? std::make_shared<Latency_histograms>() : nullptr;
+        }
+
+        // @return the receive to dispatch latencies, all zero if the latency tracking is off
+        [[nodiscard]] Latency_percentiles get_receive_latency() const noexcept
+        {
+            return m_latency_histograms ? m_latency_histograms->m_receive_to_dispatch.get_percentiles()
+                                        : Latency_percentiles();
+        }
+
+        // @return the send to wire latencies, all zero if the latency tracking is off
+        [[nodiscard]] Latency_percentiles get_send_latency() const noexcept
+        {
+            return m_latency_histograms ? m_latency_histograms->m_send_to_wire.get_percentiles()
+                                        : Latency_percentiles();
+        }
+
+        /**
+         *   @return the latencies from the kernel receiving the messages to the update taking them, all zero if the
+         *           latency tracking is off or the sockets don't stamp, see the Socket_options::m_receive_timestamps
+         */
+        [[nodiscard]] Latency_percentiles get_wire_latency() const noexcept
+        {
+            return m_latency_histograms ? m_latency_histograms->m_wire_to_dispatch.get_percentiles()
+                                        : Latency_percentiles();
+        }
+
+        /**
+         *   Writes the notifications to a file or the syslog on a background thread as they happen, without the
+         *   update. Notifications under the set_notification_severity are not written either. Nothing is written
+         *   without the settings. This should be called before starting.
+         *
+         *   @throws std::system_error if the file could not be opened
+         */
+        void set_notification_sink(std::optional<Notification_sink_settings> settings)
+        {
+            m_notification_sink = settings ? std::make_shared<Notification_sink>(std::move(*settings)) : nullptr;
+        }
+
+        // @return the counts of the notification sink, all zero if there is none
+        [[nodiscard]] Notification_sink_stats get_notification_sink_stats() const noexcept
+        {
+            return m_notification_sink ? m_notification_sink->get_stats() : Notification_sink_stats();
+        }
+
+        /**
+         *   Captures the received and the sent messages of all the connections to the segments of the directory
+         *   so the traffic can be replayed, see the Traffic_capture::read_segment. Nothing is captured without
+         *   the settings. This should be called before starting.
+         *
+         *   @throws std::system_error if the directory or the first segment could not be created
+         */
+        void set_traffic_capture(std::optional<Traffic_capture_settings> settings)
+        {
+            m_traffic_capture = settings ? std::make_shared<Traffic_capture>(std::move(*settings)) : nullptr;
+        }
+
+        // @return the counts of the capture, all zero if nothing is captured
+        [[nodiscard]] Traffic_capture_stats get_traffic_capture_stats() const noexcept
+        {
+            return m_traffic_capture ? m_traffic_capture->get_stats() : Traffic_capture_stats();
+        }
+
+        /**
+         *   Queues the messages as if the connections had received them, without any socket, so the handlers and
+         *   the update can be measured on their own, see the Capture_feed. The messages go through the in queue
+         *   and its limits like the received ones. This can be called from any thread.
+         *
+         *   @param the messages, the queued ones from the start are moved from
+         *   @return the amount of messages queued
+         */
+        size_t inject_received_messages(std::span<Owned_message<Id_type>> messages)
+        {
+            return messages.empty() ? 0 : in_queue_push_batch(messages);
+        }
+
+        /**
+         *   Serves the metrics and the latencies in the OpenMetrics text format on GET /metrics of the port, so
+         *   Prometheus can scrape them. The endpoint runs on the asio threads, so it serves once they are started.
+         *
+         *   @param the port of the endpoint
+         *   @param the prefix of the metric names
+         *   @return false if the exporter is already running or the port could not be opened
+         */
+        bool start_metrics_exporter(uint16_t port, std::string prefix = "net")
+        {
+            if (m_metrics_exporter)
+                return false;
+
+            try
+            {
+                auto metrics_writer = [this, prefix = std::move(prefix)] {
+                    return to_open_metrics(
+                        get_metrics(), get_receive_latency(), get_send_latency(), get_wire_latency(), prefix);
+                };
+
+                m_metrics_exporter = std::make_shared<Metrics_exporter>(
+                    this->create_acceptor(Protocol::endpoint(Protocol::v4(), port)), std::move(metrics_writer));
+            }
+            catch (const std::exception& exception)
+            {
+                notifications_push_back(std::format("Metrics exporter error: {}", exception.what()), Severity::error);
+                return false;
+            }
+
+            m_metrics_exporter->start();
+            return true;
+        }
+
+        void stop_metrics_exporter()
+        {
+            if (m_metrics_exporter)
+                std::exchange(m_metrics_exporter, nullptr)->stop();
+        }
+
+        Delegate<std::string_view, Severity> m_on_notification;
+
+        // Same notifications without formatting them, the code tells what happened
+        Delegate<const Notification&> m_on_structured_notification;
+
+        /**
+         *   Message for sending that reuses the body of a recycled message, so replying to a received message does
+         *   not allocate. The received messages are recycled when the next batch is popped, and the messages given
+         *   to the recycle_message. Both work per thread, so acquire on the thread that runs the updates.
+         *
+         *   @param id of the message
+         *   @return an empty message with the id
+         */
+        [[nodiscard]] static Message<Id_type> acquire_message(Id_type id)
+        {
+            return Net::acquire_message(id);
+        }
+
+        // Gives the message to the free list of the calling thread, see the acquire_message
+        static void recycle_message(Message<Id_type>&& message) noexcept
+        {
+            Net::recycle_message(std::move(message));
+        }
+
+    protected:
+        /**
+         *   Builds the message straight into its body. The body is a recycled one if there is one, see the
+         *   acquire_message, and it is reserved once for the size hint so the writes do not grow it.
+         *
+         *   @param id of the message
+         *   @param bytes the builder is expected to write, more can be written but then the body grows
+         *   @param called with the Message_writer of the body
+         */
+        template <std::invocable<Message_writer<Id_type>&> Builder_type>
+        [[nodiscard]] static Message<Id_type> build_message(Id_type id, size_t size_hint, Builder_type&& build)
+        {
+            Message<Id_type> message = Net::acquire_message(id);
+            message.reserve(size_hint);
+
+            Message_writer<Id_type> writer(message);
+            std::invoke(std::forward<Builder_type>(build), writer);
+
+            return message;
+        }
+
+        /**
+         *   Hello with the capabilities and the parameters from the settings that both the server and the client
+         *   have, they add their own capabilities to it
+         */
+        [[nodiscard]] Hello_data create_hello() const
+        {
+            Hello_data hello;
+
+            if (m_header_format != Header_format::standard)
+                hello.m_capabilities.add(Capability::compact_header);
+
+            if (m_header_format == Header_format::checked)
+                hello.m_capabilities.add(Capability::checked_header);
+
+            if (m_compression_settings.m_codec != Compression_codec::none)
+                hello.m_capabilities.add(Capability::compression);
+
+            if (m_compression_settings.m_codec != Compression_codec::none &&
+                m_compression_settings.m_mode == Compression_mode::stream)
+                hello.m_capabilities.add(Capability::stream_compression);
+
+            if (m_heartbeat_settings.has_heartbeat())
+                hello.m_capabilities.add(Capability::heartbeat);
+
+            // Every peer of this version decodes the delta encoded messages and the bundles, the sender chooses them
+            hello.m_capabilities.add(Capability::delta_encoding);
+            hello.m_capabilities.add(Capability::message_bundle);
+
+            if (m_heartbeat_settings.m_ping_interval)
+                hello.set_parameter(
+                    Hello_parameter::ping_interval, static_cast<uint64_t>(m_heartbeat_settings.m_ping_interval->count()));
+
+            if (m_heartbeat_settings.m_read_timeout)
+                hello.set_parameter(
+                    Hello_parameter::read_timeout, static_cast<uint64_t>(m_heartbeat_settings.m_read_timeout->count()));
+
+            hello.set_parameter(Hello_parameter::write_batch_messages, m_write_batch_limits.m_max_messages);
+            hello.set_parameter(Hello_parameter::write_batch_bytes, m_write_batch_limits.m_max_bytes);
+
+            return hello;
+        }
+
+        [[nodiscard]] Header_format get_header_format() const noexcept
+        {
+            return m_header_format;
+        }
+
+        [[nodiscard]] const Compression_settings& get_compression_settings() const noexcept
+        {
+            return m_compression_settings;
+        }
+
+        bool is_in_queue_empty()
+        {
+            return m_in_queue.empty();
+        }
+
+        /**
+         * Pops the oldest message, this should only be called from the update thread
+         *
+         * @return message from in queue or nothing if the queue is empty
+         */
+        [[nodiscard]] std::optional<Owned_message<Id_type>> in_queue_pop_front()
+        {
+            NET_ALLOCATION_SCOPE(dispatch);
+            std::optional<Owned_message<Id_type>> message = m_in_queue.try_pop();
+
+            if (message.has_value())
+            {
+                NET_COUNT_ALLOCATION_MESSAGES(dispatch, 1);
+                m_in_queue_bytes.fetch_sub(received_size(message.value()), std::memory_order_relaxed);
+                record_receive_latency(std::span(&message.value(), 1));
+            }
+
+            resume_paused_connections();
+            return message;
+        }
+
+        /**
+         *   Pops up to max messages from the in queue at once and handles the internal messages.
+         *   This should only be called from the update thread.
+         *
+         *   @param the max amount of messages popped
+         *   @return the received messages in order, these stay valid until the next call
+         */
+        [[nodiscard]] std::span<Owned_message<Id_type>> pop_received_batch(size_t max_messages)
+        {
+            NET_ALLOCATION_SCOPE(dispatch);
+
+            // Bodies of the previous batch are reused by the messages the handlers send, see the acquire_message
+            for (Owned_message<Id_type>& owned_message : m_received_batch)
+                Net::recycle_message(std::move(owned_message.m_message));
+
+            m_received_batch.clear();
+
+            if (m_delivery_order == Delivery_order::fair_per_client)
+                pop_fair_batch(max_messages);
+            else
+            {
+                m_in_queue.try_pop_batch(m_received_batch, max_messages);
+
+                size_t popped_bytes = 0;
+
+                for (const Owned_message<Id_type>& owned_message : m_received_batch)
+                    popped_bytes += received_size(owned_message);
+
+                m_in_queue_bytes.fetch_sub(popped_bytes, std::memory_order_relaxed);
+            }
+
+            NET_COUNT_ALLOCATION_MESSAGES(dispatch, m_received_batch.size());
+            record_receive_latency(m_received_batch);
+            resume_paused_connections();
+            before_handling_received_batch();
+            complete_failed_rpc_calls();
+
+            auto is_internal = [](const Owned_message<Id_type>& owned_message) {
+                return owned_message.m_message.get_internal_id() != Internal_id::not_internal;
+            };
+
+            if (std::ranges::any_of(m_received_batch, is_internal))
+            {
+                for (Owned_message<Id_type>& owned_message : m_received_batch)
+                {
+                    if (!is_internal(owned_message))
+                        continue;
+
+                    const Internal_id internal_id = owned_message.m_message.get_internal_id();
+
+                    if (internal_id == Internal_id::rpc_request)
+                        handle_rpc_request(owned_message);
+                    else if (internal_id == Internal_id::rpc_response)
+                        handle_rpc_response(owned_message);
+                    else
+                        handle_internal_message(std::move(owned_message));
+
+                    // Rpc handling clears the internal id, it is set back so the message is erased from the batch
+                    owned_message.m_message.set_internal_id(internal_id);
+                }
+
+                // Moved from messages keep their header so they are still recognized
+                std::erase_if(m_received_batch, is_internal);
+            }
+
+            return m_received_batch;
+        }
+
+        // Wakes the update thread if it is waiting
+        void notify_wait()
+        {
+            // Taking the lock makes sure the waiting thread is either before its check or already waiting
+            {
+                std::scoped_lock lock(m_wait_mutex);
+            }
+
+            m_wait_condition.notify_one();
+            m_wakeup_event.signal();
+
+            // Signal stays in the channel if no coroutine is waiting, so the next wait returns right away
+            m_work_signal.try_send(asio::error_code(), true);
+        }
+
+        // Same as the wait_until_has_something_to_do but waits atmost until the time
+        void wait_until_has_something_to_do(std::chrono::steady_clock::time_point wake_time)
+        {
+            std::unique_lock lock(m_wait_mutex);
+            m_wait_condition.wait_until(lock, wake_time, [this] { return should_stop_waiting(); });
+        }
+
+        // Calls the handler of the message of the id, it is timed if the handler profiling samples it
+        template <typename Callable_type>
+        void run_handler(Id_type id, Callable_type&& callable)
+        {
+            if (IS_METRICS_ENABLED && m_handler_profile)
+                m_handler_profile->run(id, std::forward<Callable_type>(callable));
+            else
+                callable();
+        }
+
+        /**
+         *   Coroutine version of the wait, waits until the notify_wait is called if there is nothing to do.
+         *   This can return without anything to do so the caller checks its conditions again.
+         *   Coroutine is resumed on its own executor.
+         */
+        [[nodiscard]] asio::awaitable<void> async_wait_until_has_something_to_do()
+        {
+            if (!should_stop_waiting())
+                co_await m_work_signal.async_receive(asio::use_awaitable);
+        }
+
+        // Keeps the wakeup handle signaled when the update leaves work for the next one, called at its end
+        /**
+         *   Broadcasts the queued notifications
+         *
+         *   @param the max amount of notifications handled
+         *   @return the amount of notifications handled
+         */
+        size_t handle_notifications(size_t max_notifications)
+        {
+            size_t handled = 0;
+
+            for (; handled < max_notifications; ++handled)
+            {
+                std::optional<Notification> notification = m_notifications.try_pop();
+
+                if (!notification.has_value())
+                    break;
+
+                // Text is formatted only for the callback that takes it
+                if (m_on_notification.has_been_set())
+                    m_on_notification.broadcast(notification->to_string(), notification->m_severity);
+
+                m_on_structured_notification.broadcast(notification.value());
+            }
+
+            return handled;
+        }
+
+        /**
+         *   Fills the pool of the message bodies with the blocks that the connections take when they start, a
+         *   chunk of the write queue each and the receive buffer in the buffered read mode. Only the pool of the
+         *   calling thread is filled, the pools of the NUMA nodes fill up on their own threads.
+         *
+         *   @param the amount of connections
+         *   @param should the blocks be written once so their pages are mapped now
+         */
+        void prewarm_connection_memory(size_t connection_count, bool fault_in)
+        {
+            auto* pool = dynamic_cast<Size_class_pool*>(get_message_memory_resource());
+
+            if (pool == nullptr)
+                return;
+
+            pool->prewarm(Chunked_queue<Owned_message<Id_type>>::CHUNK_BYTES, connection_count, fault_in);
+
+            if (m_read_mode == Read_mode::buffered)
+                pool->prewarm(m_receive_buffer_size, connection_count, fault_in);
+        }
+
+        // @return the amount of received messages that the update has not handled yet
+        [[nodiscard]] size_t get_received_backlog() const noexcept
+        {
+            return m_in_queue.size() + m_pending_message_count;
+        }
+
+        // @return the bytes of the received messages waiting in the in queue
+        [[nodiscard]] size_t get_in_queue_bytes() const noexcept
+        {
+            return m_in_queue_bytes.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] size_t get_notification_backlog() const noexcept
+        {
+            return m_notifications.size();
+        }
+
+        void signal_if_has_something_to_do()
+        {
+            if (should_stop_waiting())
+                m_wakeup_event.signal();
+        }
+
+        /**
+         *   Thread safe push back to queue. Message is always taken when the queue is empty, so a message larger
+         *   than the limits does not get stuck.
+         *
+         *   @param the message which is moved from only if it was queued
+         *   @return false if the queue is over its limits
+         */
+        bool in_queue_push_back(Owned_message<Id_type>& message)
+        {
+            const size_t message_bytes = received_size(message);
+            const size_t max_messages = std::min(m_in_queue_limits.m_max_messages, m_in_queue.capacity());
+
+            // Producers check the limits at the same time so the queue can go over them by a few messages
+            if (!m_in_queue.empty() &&
+                (m_in_queue.size() >= max_messages ||
+                 m_in_queue_bytes.load(std::memory_order_relaxed) + message_bytes > m_in_queue_limits.m_max_bytes))
+                return false;
+
+            m_in_queue_bytes.fetch_add(message_bytes, std::memory_order_relaxed);
+            const Push_result result = m_in_queue.try_push(std::move(message));
+
+            if (result == Push_result::full)
+            {
+                m_in_queue_bytes.fetch_sub(message_bytes, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (result == Push_result::pushed_to_empty)
+                notify_wait();
+
+            return true;
+        }
+
+        /**
+         *   Thread safe push of many messages with one reservation in the queue, see the in_queue_push_back.
+         *   The limits are checked once for the whole run.
+         *
+         *   @param the messages, the queued ones from the start are moved from
+         *   @return the amount of messages queued
+         */
+        size_t in_queue_push_batch(std::span<Owned_message<Id_type>> messages)
+        {
+            const size_t max_messages = std::min(m_in_queue_limits.m_max_messages, m_in_queue.capacity());
+            const size_t queued_messages = m_in_queue.size();
+            const size_t queued_bytes = m_in_queue_bytes.load(std::memory_order_relaxed);
+
+            size_t count = 0;
+            size_t batch_bytes = 0;
+
+            for (; count < messages.size(); ++count)
+            {
+                const size_t message_bytes = received_size(messages[count]);
+                const bool is_always_taken = queued_messages == 0 && count == 0;
+
+                if (!is_always_taken && (queued_messages + count >= max_messages ||
+                                         queued_bytes + batch_bytes + message_bytes > m_in_queue_limits.m_max_bytes))
+                    break;
+
+                batch_bytes += message_bytes;
+            }
+
+            if (count == 0)
+                return 0;
+
+            m_in_queue_bytes.fetch_add(batch_bytes, std::memory_order_relaxed);
+
+            Push_result result = Push_result::full;
+            const size_t pushed_count = m_in_queue.try_push_batch(messages.first(count), result);
+
+            // Bytes of the messages that did not fit in the queue are given back
+            if (pushed_count < count)
+            {
+                size_t unpushed_bytes = 0;
+
+                for (size_t i = pushed_count; i < count; ++i)
+                    unpushed_bytes += received_size(messages[i]);
+
+                m_in_queue_bytes.fetch_sub(unpushed_bytes, std::memory_order_relaxed);
+            }
+
+            if (result == Push_result::pushed_to_empty)
+                notify_wait();
+
+            return pushed_count;
+        }
+
+        // @return false if the notifications of the severity are dropped, so they don't need to be created
+        [[nodiscard]] bool is_notified(Severity severity) const noexcept
+        {
+            const bool has_callback = m_on_notification.has_been_set() || m_on_structured_notification.has_been_set();
+            return IS_NOTIFICATIONS_ENABLED && has_callback && severity >= m_min_notification_severity;
+        }
+
+        // Thread safe push back to queue, notification is dropped if the queue is full
+        void push_notification(Notification notification)
+        {
+            if constexpr (!IS_NOTIFICATIONS_ENABLED)
+                return;
+
+            m_metrics_counters->add_notification(notification.m_severity);
+
+            if (m_notification_sink && notification.m_severity >= m_min_notification_severity)
+                m_notification_sink->push(notification);
+
+            if (!is_notified(notification.m_severity))
+                return;
+
+            if (m_notifications.try_push(std::move(notification)) == Push_result::pushed_to_empty)
+                notify_wait();
+        }
 
-        User()
+        // Pushes the rare notification that is only a text
+        void notifications_push_back(std::string message, Severity severity = Severity::notification)
         {
-            m_accepted_messages = std::make_shared<Accepted_messages_container>();
+            push_notification({.m_severity = severity, .m_text = std::move(message)});
         }
 
-        virtual ~User() = default;
+        [[nodiscard]] virtual bool should_stop_waiting()
+        {
+            const bool has_messages = !m_in_queue.empty() || m_pending_message_count > 0;
+            const bool has_notifications = !m_notifications.empty();
 
-        User(const User&) = delete;
-        User(User&&) = delete;
-        User& operator=(const User&) = delete;
-        User& operator=(User&&) = delete;
+            return has_messages || has_notifications || !m_paused_connections.empty() || !m_failed_rpc_calls.empty();
+        }
 
-        /**
-         *   Add message id that gets accepted. By default, all messages id's are not accepted
-         *   and if you receive an unaccepted message, you get disconnected.
-         *   This also allows you to put size limits on the messages.
-         *
-         *   @param the type to be accepted
-         *   @param the min message size
-         *   @param the max message size
-         */
-        void add_accepted_message(Id_type type, uint32_t min = 0, uint32_t max = std::numeric_limits<uint32_t>::max())
+        // Event when received new message from the connection, the connection pauses if the message is not queued
+        void on_message_received(Owned_message<Id_type>& message, bool& is_queued)
         {
-            const Message_limits limits = {.m_min = min, .m_max = max};
-            m_accepted_messages->emplace(type, limits);
+            is_queued = handle_unqueued_message(message) || in_queue_push_back(message);
         }
 
         /**
-         *   Handle everything received through internet
-         *
-         *   @param the max items handled
-         *   @param should the function wait if there is no items to handle
-         *   @param optional interval for checking connections. If you don't give this there will be no checking
+         *   Event when the connection received many messages from one read. The runs of the messages that go to
+         *   the in queue are pushed at once, the connection pauses at the first message that is not taken.
          */
-        virtual void update(
-            size_t max_handled_items = SIZE_T_MAX, bool wait = false,
-            Optional_seconds check_connections_interval = Optional_seconds())
+        void on_messages_received(std::span<Owned_message<Id_type>> messages, size_t& taken_count)
         {
-            if (check_connections_interval.has_value())
-                handle_check_connections_delay(wait, check_connections_interval.value());
-            else if (wait)
-                wait_until_has_something_to_do();
+            size_t run_begin = 0;
 
-            for (size_t i = 0; i < max_handled_items && !m_notifications.empty(); ++i)
+            for (size_t i = 0; i < messages.size(); ++i)
             {
-                const Notification notification = m_notifications.pop_front();
-                m_on_notification.broadcast(notification.m_message, notification.m_severity);
+                if (!is_handled_unqueued(messages[i].m_message))
+                    continue;
+
+                const size_t queued_count = in_queue_push_batch(messages.subspan(run_begin, i - run_begin));
+
+                if (queued_count < i - run_begin)
+                {
+                    taken_count = run_begin + queued_count;
+                    return;
+                }
+
+                // Overload can end between the checks, then the message starts the next run
+                run_begin = handle_unqueued_message(messages[i]) ? i + 1 : i;
             }
+
+            taken_count = run_begin + in_queue_push_batch(messages.subspan(run_begin));
         }
 
-        Delegate<std::string_view, Severity> m_on_notification;
+        // @return true if the message is handled or dropped on the Asio thread instead of going to the in queue
+        [[nodiscard]] bool is_handled_unqueued(const Message<Id_type>& message) const
+        {
+            // Other responses go through the in queue so they are handled in order with the other messages
+            return is_dispatched_on_io_thread(message) ||
+                   (message.get_internal_id() == Internal_id::rpc_response &&
+                    m_rpc_calls.find_completion(Rpc_message<Id_type>::read_correlation_id(message)) ==
+                        Rpc_completion::io_thread) ||
+                   is_shed(message);
+        }
 
-    protected:
-        bool is_in_queue_empty()
+        // @return false if the message goes to the in queue
+        bool handle_unqueued_message(Owned_message<Id_type>& message)
         {
-            return m_in_queue.empty();
+            if (is_dispatched_on_io_thread(message.m_message))
+            {
+                if (message.m_message.get_internal_id() == Internal_id::rpc_request)
+                    handle_rpc_request(message);
+                else
+                    handle_io_thread_message(message);
+
+                return true;
+            }
+
+            if (message.m_message.get_internal_id() == Internal_id::rpc_response &&
+                m_rpc_calls.find_completion(Rpc_message<Id_type>::read_correlation_id(message.m_message)) ==
+                    Rpc_completion::io_thread)
+            {
+                handle_rpc_response(message);
+                return true;
+            }
+
+            if (is_shed(message.m_message))
+            {
+                m_shed_messages.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            return false;
         }
 
-        /**
-         * Thread safe pop_front
-         *
-         * @return message from in queue
-         */
-        [[nodiscard]] Owned_message<Id_type> in_queue_pop_front()
+        // @return true if the message is dropped because of the overload
+        [[nodiscard]] bool is_shed(const Message<Id_type>& message) const noexcept
         {
-            return m_in_queue.pop_back();
+            if (!is_overloaded() || !m_overload_settings.m_drop_sheddable_messages ||
+                message.get_internal_id() != Internal_id::not_internal)
+                return false;
+
+            const Message_limits* limits = m_accepted_messages->find(message.get_id());
+            return limits != nullptr && limits->m_is_sheddable;
         }
 
-        void notify_wait() noexcept
+        [[nodiscard]] bool is_datagram_channel_enabled() const noexcept
         {
-            m_wait_condition.notify_one();
+            return m_is_datagram_channel_enabled;
         }
 
-        // Thread safe push back to queue
-        void in_queue_push_back(Owned_message<Id_type> message)
+        // New connections are corked until the flush, see the Server::set_tick_corking
+        void set_tick_corked(bool is_corked) noexcept
         {
-            m_in_queue.push_back(std::move(message));
-            notify_wait();
+            m_is_tick_corked = is_corked;
         }
 
-        // Thread safe push back to queue
-        void notifications_push_back(std::string message, Severity severity = Severity::notification)
+        [[nodiscard]] bool is_tick_corked() const noexcept
+        {
+            return m_is_tick_corked;
+        }
+
+        [[nodiscard]] Delivery_mode get_delivery_mode(Id_type id) const noexcept
+        {
+            if (m_delivery_modes.empty())
+                return Delivery_mode::reliable;
+
+            const auto mode = m_delivery_modes.find(id);
+            return mode != m_delivery_modes.end() ? mode->second : Delivery_mode::reliable;
+        }
+
+        // @return true if the id of the message is accepted and its body size is in the limits of the id
+        [[nodiscard]] bool is_within_accepted_limits(const Message<Id_type>& message) const noexcept
+        {
+            const Message_limits* limits = m_accepted_messages->find(message.get_id());
+            return limits != nullptr && message.body_size() >= limits->m_min && message.body_size() <= limits->m_max;
+        }
+
+        /**
+         *   Gives the message received from the datagram channel to the same handling as the messages of the
+         *   connections. It is dropped if its id is not accepted, its size is not in the limits or the in queue is
+         *   full, because the datagrams can be lost anyway. This is called from the strand of the channel.
+         */
+        void receive_datagram_message(Message<Id_type>& message, Client_information sender)
         {
-            if (!m_on_notification.has_been_set())
+            if (!is_within_accepted_limits(message))
                 return;
 
-            Notification notification = {.m_message = message, .m_severity = severity};
-            m_notifications.push_back(std::move(notification));
-            notify_wait();
+            Owned_message<Id_type> owned_message(std::move(message), std::move(sender));
+            bool is_queued = false;
+            on_message_received(owned_message, is_queued);
         }
 
-        [[nodiscard]] virtual bool should_stop_waiting()
+        [[nodiscard]] bool is_dispatched_on_io_thread(const Message<Id_type>& message) const noexcept
         {
-            const bool has_messages = !m_in_queue.empty();
-            const bool has_notifications = !m_notifications.empty();
+            const Internal_id internal_id = message.get_internal_id();
+
+            if (!m_has_io_thread_dispatch ||
+                (internal_id != Internal_id::not_internal && internal_id != Internal_id::rpc_request))
+                return false;
 
-            return has_messages || has_notifications;
+            const Message_limits* limits = m_accepted_messages->find(message.get_id());
+            return limits != nullptr && limits->m_dispatch_policy == Dispatch_policy::io_thread;
         }
 
-        // Event when received new message from the connection
-        void on_message_received(Owned_message<Id_type> message)
+        // @return true if the new connections are rejected because of the overload
+        [[nodiscard]] bool is_shedding_connections() const noexcept
+        {
+            return is_overloaded() && m_overload_settings.m_reject_connections;
+        }
+
+        // Called from the strand of the connection when it stopped reading because the in queue was full
+        void on_connection_read_paused(std::weak_ptr<Connection<Id_type>> connection)
+        {
+            m_paused_connections.push_back(std::move(connection));
+            notify_wait();
+        }
+
+        /**
+         *   Sends the request as an rpc call to the connection. Many calls can wait for their responses on the same
+         *   connection at once. The callback is called once, with the response or with the failure when the
+         *   deadline passes or the connection is lost first.
+         *
+         *   @param connection to call, nullptr fails the call with the disconnected status
+         *   @param message that the rpc handler of its id on the peer answers
+         *   @param time to wait for the response
+         *   @param called with the status and the response
+         *   @param where the callback is called
+         */
+        void start_rpc_call(
+            const std::shared_ptr<Connection<Id_type>>& connection, Message<Id_type> request,
+            std::chrono::milliseconds timeout, Rpc_callback<Id_type> callback, Rpc_completion completion)
         {
-            in_queue_push_back(std::move(message));
+            if (connection == nullptr)
+            {
+                fail_rpc_call(
+                    {.m_callback = std::move(callback), .m_completion = completion}, Rpc_status::disconnected);
+                return;
+            }
+
+            const uint64_t correlation_id = m_rpc_calls.add(connection->get_id(), std::move(callback), completion);
+
+            // Call added after the disconnect has already taken the calls of the connection is failed here
+            if (!connection->is_connected())
+            {
+                if (auto call = m_rpc_calls.take(correlation_id))
+                    fail_rpc_call(std::move(*call), Rpc_status::disconnected);
+
+                return;
+            }
+
+            if (const auto timer_wheel = get_timer_wheel().lock())
+            {
+                const Timer_wheel::Timer_id timer_id = timer_wheel->schedule(timeout, [this, correlation_id]() {
+                    if (auto call = m_rpc_calls.take(correlation_id))
+                        fail_rpc_call(std::move(*call), Rpc_status::timed_out);
+                });
+
+                if (!m_rpc_calls.set_timer(correlation_id, timer_id))
+                    timer_wheel->cancel(timer_id);
+            }
+
+            connection->send_message(Rpc_message<Id_type>::create_request(std::move(request), correlation_id));
         }
 
         /**
@@ -134,42 +1418,185 @@ namespace Net
          *   @param socket to use
          *   @param if for rhe connection
          *   @param should we use client or server type of handshake
-         *   @return unique_ptr to the connection object
+         *   @param state of the connection that another process handed over with the socket, see the
+         *          Connection::continue_hand_off
+         *   @return shared_ptr to the connection object
          */
-        [[nodiscard]] std::unique_ptr<Connection<Id_type>> create_connection(
-            std::unique_ptr<Socket_interface> socket, uint32_t connection_id, Handshake_type handshake_type)
+        [[nodiscard]] std::shared_ptr<Connection<Id_type>> create_connection(
+            std::unique_ptr<Socket_interface> socket, uint32_t connection_id, Handshake_type handshake_type,
+            const Connection_hand_off* hand_off = nullptr)
         {
-            std::unique_ptr new_connection = std::make_unique<Connection<Id_type>>(std::move(socket), connection_id);
+            auto new_connection = std::make_shared<Connection<Id_type>>(std::move(socket), connection_id);
 
             // Setups the callbacks
             new_connection->m_on_message.set_callback(this, &User<Id_type>::on_message_received);
-            new_connection->m_on_notification.set_callback(this, &User<Id_type>::notifications_push_back);
+            new_connection->m_on_messages.set_callback(this, &User<Id_type>::on_messages_received);
+            new_connection->m_on_read_paused.set_callback(this, &User<Id_type>::on_connection_read_paused);
+            new_connection->m_on_notification.set_callback(this, &User<Id_type>::push_notification);
+            new_connection->m_on_disconnect.set_callback(this, &User<Id_type>::on_connection_disconnect);
+            new_connection->m_on_write_pressure.set_callback(this, &User<Id_type>::handle_write_pressure);
 
             // Gives shared pointer of the accepted messages to the connection
             new_connection->set_accepted_messages(m_accepted_messages);
+            new_connection->set_metrics_counters(m_metrics_counters);
+            new_connection->set_latency_histograms(m_latency_histograms);
+            new_connection->set_traffic_capture(m_traffic_capture);
+            new_connection->set_write_batch_limits(m_write_batch_limits);
+            new_connection->set_adaptive_batching(m_adaptive_batching);
+            new_connection->set_zero_copy_threshold(m_socket_options.m_zero_copy_threshold);
+            new_connection->set_write_queue_limits(m_write_queue_limits);
+            new_connection->set_priority_settings(m_priority_settings);
+            new_connection->set_rate_limit(m_rate_limit, m_rate_limit_policy);
+            new_connection->set_read_mode(m_read_mode, m_receive_buffer_size);
+            new_connection->set_bulk_read_budget(m_bulk_read_budget);
+            new_connection->set_zero_copy_receive(m_is_zero_copy_receive);
+            new_connection->set_max_message_size(m_max_message_size);
+            new_connection->set_max_replication_update_size(m_max_replication_update_size);
+            new_connection->set_header_format(m_header_format);
+            new_connection->set_compression_settings(m_compression_settings);
+            new_connection->set_delta_encoded_messages(m_delta_encoded_messages);
+            new_connection->set_body_sinks(m_body_sinks);
+            new_connection->set_heartbeat(m_heartbeat_settings, get_timer_wheel());
+            new_connection->set_bulk_pause_flag(m_is_bulk_paused);
+
+            if (m_is_tick_corked)
+                new_connection->cork();
+
+            if (hand_off != nullptr)
+                new_connection->continue_hand_off(*hand_off);
 
             new_connection->start(handshake_type);
 
             return new_connection;
         }
 
-        [[nodiscard]] std::unique_ptr<Connection<Id_type>> create_connection(
+        [[nodiscard]] std::shared_ptr<Connection<Id_type>> create_connection(
             Protocol::socket socket, uint32_t connection_id, Handshake_type handshake_type)
         {
+            const std::string failed_options = apply_socket_options(socket, m_socket_options);
+
+            if (!failed_options.empty())
+            {
+                asio::error_code address_error;
+
+                push_notification(
+                    {.m_code = Notification_code::socket_options_failed,
+                     .m_severity = Severity::error,
+                     .m_client_id = connection_id,
+                     .m_address = socket.remote_endpoint(address_error).address(),
+                     .m_text = failed_options});
+            }
+
             std::unique_ptr<Socket_interface> socket_interface = create_socket_interface(std::move(socket));
             return create_connection(std::move(socket_interface), connection_id, handshake_type);
         }
 
+        /**
+         *   Unix domain sockets have no tls in any user because the peer is on the same host
+         *
+         *   @param connected socket
+         *   @param true to carry the data in the shared memory, the socket is then used only for the setup
+         *   @param bytes in each direction of the shared memory, the server side decides it for both sides
+         */
+        [[nodiscard]] std::unique_ptr<Socket_interface> create_local_socket_interface(
+            Local_protocol::socket socket, bool use_shared_memory = false,
+            size_t ring_capacity = Shared_memory_socket::DEFAULT_RING_CAPACITY)
+        {
+            const std::string failed_options = apply_socket_options(socket, m_socket_options);
+
+            if (!failed_options.empty())
+                push_notification(
+                    {.m_code = Notification_code::socket_options_failed,
+                     .m_severity = Severity::error,
+                     .m_address = asio::ip::address_v4::loopback(),
+                     .m_text = failed_options});
+
+            if (use_shared_memory)
+                return std::make_unique<Shared_memory_socket>(std::move(socket), ring_capacity);
+
+            return std::make_unique<Template_socket<Local_protocol::socket>>(std::move(socket));
+        }
+
     private:
-        struct Notification
+        void schedule_overload_check()
         {
-            std::string m_message = "";
-            Severity m_severity = Severity::notification;
-        };
+            if (const std::shared_ptr<Timer_wheel> timer_wheel = get_timer_wheel().lock())
+                m_overload_timer = timer_wheel->schedule(OVERLOAD_CHECK_PERIOD, [this] { check_overload(); });
+        }
+
+        // Runs on the timer wheel, the overload starts at the limits and ends under the half of them
+        void check_overload()
+        {
+            const std::chrono::microseconds io_lag = get_io_lag();
+            const size_t in_queue_messages = m_in_queue.size();
+            const bool was_overloaded = is_overloaded();
+
+            const auto get_limit = [was_overloaded](auto limit) {
+                return was_overloaded ? limit / 2 : limit;
+            };
+
+            const bool is_lagging =
+                m_overload_settings.m_max_io_lag && io_lag >= get_limit(*m_overload_settings.m_max_io_lag);
+            const bool is_queue_full = m_overload_settings.m_max_in_queue_messages &&
+                                       in_queue_messages >= get_limit(*m_overload_settings.m_max_in_queue_messages);
+            const bool is_overloaded = is_lagging || is_queue_full;
+
+            if (is_overloaded != was_overloaded)
+            {
+                m_is_overloaded.store(is_overloaded, std::memory_order_relaxed);
+                m_is_bulk_paused->store(
+                    is_overloaded && m_overload_settings.m_pause_bulk_connections, std::memory_order_relaxed);
+
+                push_notification(
+                    {.m_code = is_overloaded ? Notification_code::overloaded : Notification_code::overload_ended,
+                     .m_severity = is_overloaded ? Severity::error : Severity::notification,
+                     .m_text = std::format("{} us", io_lag.count())});
+
+                // Paused bulk connections are resumed by the update
+                notify_wait();
+            }
+
+            schedule_overload_check();
+        }
+
+        [[nodiscard]] static size_t received_size(const Owned_message<Id_type>& owned_message) noexcept
+        {
+            return owned_message.m_message.header_size() + owned_message.m_message.body_size();
+        }
+
+        /**
+         *   Lets the paused connections read again when the in queue has drained to half of its limits.
+         *   This should only be called from the update thread.
+         */
+        void resume_paused_connections()
+        {
+            // Bulk connections would pause again right away
+            if (m_paused_connections.empty() || m_is_bulk_paused->load(std::memory_order_relaxed))
+                return;
+
+            const size_t max_messages = std::min(m_in_queue_limits.m_max_messages, m_in_queue.capacity());
+
+            if (m_in_queue.size() > max_messages / 2 ||
+                m_in_queue_bytes.load(std::memory_order_relaxed) > m_in_queue_limits.m_max_bytes / 2)
+                return;
+
+            while (!m_paused_connections.empty())
+                if (const std::shared_ptr<Connection<Id_type>> connection = m_paused_connections.pop_front().lock())
+                    connection->resume_reading();
+        }
 
         // Creates spesific socket interface for connection
         [[nodiscard]] virtual std::unique_ptr<Socket_interface> create_socket_interface(Protocol::socket socket)
         {
+            if (m_aead_settings != nullptr)
+                return std::make_unique<Aead_socket>(std::move(socket), m_aead_settings);
+
+#ifdef NET_HAS_RIO
+            // Socket stays with the caller if it can't use the RIO
+            if (std::unique_ptr<Rio_socket> rio_socket = Rio_socket::create(socket))
+                return rio_socket;
+#endif
+
             return std::make_unique<Template_socket<Protocol::socket>>(std::move(socket));
         }
 
@@ -221,17 +1648,303 @@ namespace Net
 
         virtual void check_connections(){};
 
+        // Called from the strand of the connection when it has disconnected
+        virtual void handle_disconnect(uint32_t connection_id){};
+
+        // Called from the strand of the connection when its write queue becomes congested or writable again
+        virtual void handle_write_pressure(const Client_information& connection, bool is_congested){};
+
+        /**
+         *   Moves the received messages to the queue of their sender and then takes turns between the senders
+         *   with deficit round robin. Every turn gives the sender m_quantum_bytes more to spend and it gets messages
+         *   as long as they fit, so the senders get equal share of bytes no matter how big their messages are.
+         *   Only limited amount is kept waiting so the in queue still fills up when the messages
+         *   are not handled fast enough.
+         *
+         *   @param the max amount of messages taken to the batch
+         */
+        void pop_fair_batch(size_t max_messages)
+        {
+            while (m_pending_message_count < MAX_PENDING_MESSAGES)
+            {
+                std::optional<Owned_message<Id_type>> popped_message = m_in_queue.try_pop();
+
+                if (!popped_message.has_value())
+                    break;
+
+                m_in_queue_bytes.fetch_sub(received_size(popped_message.value()), std::memory_order_relaxed);
+
+                const uint32_t client_id = popped_message->m_client_information.m_id;
+                Pending_client& client = m_pending_messages[client_id];
+
+                if (client.m_messages.empty())
+                    m_pending_clients.push_back(client_id);
+
+                client.m_messages.push_back(std::move(popped_message.value()));
+                ++m_pending_message_count;
+            }
+
+            const size_t quantum = std::max<size_t>(m_fair_delivery_limits.m_quantum_bytes, 1);
+            const size_t client_budget = m_fair_delivery_limits.m_max_messages_per_client;
+
+            // Clients that used their budget wait for the next batch
+            std::vector<uint32_t> out_of_budget_clients;
+
+            for (auto& [client_id, client] : m_pending_messages)
+                client.m_handled_in_batch = 0;
+
+            while (m_received_batch.size() < max_messages && !m_pending_clients.empty())
+            {
+                const uint32_t client_id = m_pending_clients.front();
+                m_pending_clients.pop_front();
+
+                auto found_client = m_pending_messages.find(client_id);
+                Pending_client& client = found_client->second;
+                client.m_deficit += quantum;
+
+                while (!client.m_messages.empty() && m_received_batch.size() < max_messages &&
+                       client.m_handled_in_batch < client_budget)
+                {
+                    const Message<Id_type>& message = client.m_messages.front().m_message;
+                    const size_t message_size = message.header_size() + message.body_size();
+
+                    if (message_size > client.m_deficit)
+                        break;
+
+                    client.m_deficit -= message_size;
+                    m_received_batch.push_back(std::move(client.m_messages.front()));
+                    client.m_messages.pop_front();
+                    ++client.m_handled_in_batch;
+                    --m_pending_message_count;
+                }
+
+                // Idle clients don't save their deficit for later
+                if (client.m_messages.empty())
+                    m_pending_messages.erase(found_client);
+                else if (client.m_handled_in_batch >= client_budget)
+                    out_of_budget_clients.push_back(client_id);
+                else
+                    m_pending_clients.push_back(client_id);
+            }
+
+            for (const uint32_t client_id : out_of_budget_clients)
+                m_pending_clients.push_back(client_id);
+        }
+
+        void record_receive_latency(std::span<const Owned_message<Id_type>> messages) noexcept
+        {
+            if (!IS_METRICS_ENABLED || !m_latency_histograms || messages.empty())
+                return;
+
+            const auto dispatch_time = std::chrono::steady_clock::now();
+            const auto dispatch_wall_time = std::chrono::system_clock::now();
+
+            for (const Owned_message<Id_type>& owned_message : messages)
+            {
+                m_latency_histograms->m_receive_to_dispatch.record(dispatch_time - owned_message.m_received_time);
+
+                if (owned_message.m_wire_time != std::chrono::system_clock::time_point())
+                    m_latency_histograms->m_wire_to_dispatch.record(dispatch_wall_time - owned_message.m_wire_time);
+            }
+        }
+
+        // Adds the connection count, the write queues and the strand locks of the current connections to the metrics
+        virtual void add_connection_metrics(Metrics<Id_type>& metrics) const {};
+
+        // Handles the messages that are internal to the framework
+        virtual void handle_internal_message(Owned_message<Id_type> owned_message){};
+
+        // Handles the message of an io_thread dispatched id, this is called from the asio threads
+        virtual void handle_io_thread_message(Owned_message<Id_type>& owned_message){};
+
+        // Called after the received batch is popped and before any of it is handled
+        virtual void before_handling_received_batch(){};
+
+        // @return the connection that the rpc responses to the connection id are sent to or nullptr
+        [[nodiscard]] virtual std::shared_ptr<Connection<Id_type>> find_connection(uint32_t connection_id) const
+        {
+            return nullptr;
+        }
+
+        // Called from the strand of the connection when it has disconnected, fails the calls waiting for it
+        void on_connection_disconnect(uint32_t connection_id)
+        {
+            for (auto& call : m_rpc_calls.take_connection_calls(connection_id))
+                fail_rpc_call(std::move(call), Rpc_status::disconnected);
+
+            handle_disconnect(connection_id);
+        }
+
+        /**
+         *   Completes the call that did not get its response. The io_thread calls are completed right away and
+         *   the others are queued to the next update.
+         */
+        void fail_rpc_call(typename Rpc_calls<Id_type>::Pending_call call, Rpc_status status)
+        {
+            if (call.m_timer_id != 0)
+                if (const auto timer_wheel = get_timer_wheel().lock())
+                    timer_wheel->cancel(call.m_timer_id);
+
+            if (call.m_completion == Rpc_completion::io_thread)
+            {
+                call.m_callback(status, Message<Id_type>());
+                return;
+            }
+
+            m_failed_rpc_calls.push_back({std::move(call.m_callback), status});
+            notify_wait();
+        }
+
+        // Calls the callbacks of the failed calls, this should only be called from the update thread
+        void complete_failed_rpc_calls()
+        {
+            while (!m_failed_rpc_calls.empty())
+            {
+                auto [callback, status] = m_failed_rpc_calls.pop_front();
+                callback(status, Message<Id_type>());
+            }
+        }
+
+        // Response to the call that was already completed by its deadline is dropped
+        void handle_rpc_response(Owned_message<Id_type>& owned_message)
+        {
+            uint64_t correlation_id = 0;
+            const Rpc_status status = Rpc_message<Id_type>::extract_response(owned_message.m_message, correlation_id);
+
+            auto call = m_rpc_calls.take(correlation_id);
+
+            if (!call)
+                return;
+
+            if (call->m_timer_id != 0)
+                if (const auto timer_wheel = get_timer_wheel().lock())
+                    timer_wheel->cancel(call->m_timer_id);
+
+            if (status != Rpc_status::ok)
+                owned_message.m_message = Message<Id_type>();
+
+            call->m_callback(status, std::move(owned_message.m_message));
+        }
+
+        // Runs the rpc handler of the request and sends its response back to the caller
+        void handle_rpc_request(Owned_message<Id_type>& owned_message)
+        {
+            const uint64_t correlation_id = Rpc_message<Id_type>::extract_request(owned_message.m_message);
+
+            Message<Id_type> response;
+            response.set_id(owned_message.m_message.get_id());
+            Rpc_status status = Rpc_status::ok;
+
+            if (const auto* handler = m_rpc_handlers.find(owned_message.m_message.get_id()))
+                handler->broadcast(owned_message.m_client_information, owned_message.m_message, response);
+            else
+                status = Rpc_status::no_handler;
+
+            if (const auto connection = find_connection(owned_message.m_client_information.m_id))
+                connection->send_message(
+                    Rpc_message<Id_type>::create_response(std::move(response), correlation_id, status));
+        }
+
         std::condition_variable m_wait_condition;
         std::mutex m_wait_mutex;
+        Wakeup_event m_wakeup_event;
+
+        // Wakes the coroutines waiting for work, the bool is not used because asio can't make a channel of error only
+        asio::experimental::concurrent_channel<void(asio::error_code, bool)> m_work_signal{this->get_executor(), 1};
         std::chrono::steady_clock::time_point m_last_connection_check;
 
         // Accepted message types
         std::shared_ptr<Accepted_messages_container> m_accepted_messages;
+        bool m_has_io_thread_dispatch = false;
+
+        // Rpc calls waiting for their responses, the handlers of the received calls and the failed calls that are
+        // completed in the next update
+        Rpc_calls<Id_type> m_rpc_calls;
+        Message_handlers<Id_type, const Client_information&, Message<Id_type>&, Message<Id_type>&> m_rpc_handlers;
+        Thread_safe_deque<std::pair<Rpc_callback<Id_type>, Rpc_status>> m_failed_rpc_calls;
+
+        bool m_is_datagram_channel_enabled = false;
+        std::unordered_map<Id_type, Delivery_mode> m_delivery_modes;
 
-        // Received messages from the conenctions
-        Thread_safe_deque<Owned_message<Id_type>> m_in_queue;
+        Write_batch_limits m_write_batch_limits;
+        std::optional<Adaptive_batching> m_adaptive_batching;
+        Write_queue_limits m_write_queue_limits;
+        bool m_is_tick_corked = false;
+        Priority_settings m_priority_settings;
+        Rate_limit m_rate_limit;
+        Rate_limit_policy m_rate_limit_policy = Rate_limit_policy::pause_reading;
+        Read_mode m_read_mode = Read_mode::exact;
+        size_t m_receive_buffer_size = Connection<Id_type>::DEFAULT_RECEIVE_BUFFER_SIZE;
+        size_t m_bulk_read_budget = Connection<Id_type>::DEFAULT_BULK_READ_BUDGET;
+        bool m_is_zero_copy_receive = false;
+        size_t m_max_message_size = std::numeric_limits<size_t>::max();
+        size_t m_max_replication_update_size = Connection<Id_type>::DEFAULT_MAX_REPLICATION_UPDATE_SIZE;
+        Header_format m_header_format = Header_format::standard;
+        Socket_options m_socket_options;
+        std::shared_ptr<const Aead_settings> m_aead_settings = nullptr;
+        Heartbeat_settings m_heartbeat_settings;
+        Compression_settings m_compression_settings;
+
+        // Copied when an id is added so the connections created earlier keep their own set
+        std::shared_ptr<const std::unordered_set<Id_type>> m_delta_encoded_messages;
+        std::shared_ptr<const std::unordered_map<Id_type, Body_sink<Id_type>>> m_body_sinks;
+
+        static constexpr size_t IN_QUEUE_CAPACITY = 16 * 1024;
+        static constexpr size_t NOTIFICATION_QUEUE_CAPACITY = 1024;
+
+        // Received messages from the conenctions, their total size and the connections waiting for room
+        Mpsc_queue<Owned_message<Id_type>> m_in_queue{IN_QUEUE_CAPACITY};
+        std::atomic<size_t> m_in_queue_bytes = 0;
+        In_queue_limits m_in_queue_limits;
+        Thread_safe_deque<std::weak_ptr<Connection<Id_type>>> m_paused_connections;
+
+        // Messages popped by the last pop_received_batch, reused so the batches don't allocate
+        std::vector<Owned_message<Id_type>> m_received_batch;
+
+        Delivery_order m_delivery_order = Delivery_order::global_fifo;
+
+        // Messages waiting for their turn in the fair_per_client order
+        static constexpr size_t MAX_PENDING_MESSAGES = IN_QUEUE_CAPACITY;
+        struct Pending_client
+        {
+            std::deque<Owned_message<Id_type>> m_messages;
+            size_t m_deficit = 0;
+            size_t m_handled_in_batch = 0;
+        };
+
+        Fair_delivery_limits m_fair_delivery_limits;
+        std::unordered_map<uint32_t, Pending_client> m_pending_messages;
+        std::deque<uint32_t> m_pending_clients;
+        size_t m_pending_message_count = 0;
 
         // the notification to be handled
-        Thread_safe_deque<Notification> m_notifications;
+        Mpsc_queue<Notification> m_notifications{NOTIFICATION_QUEUE_CAPACITY};
+        Severity m_min_notification_severity = Severity::notification;
+
+        // Shared with the connections so their counters outlive this if they are still running
+        std::shared_ptr<Metrics_counters<Id_type>> m_metrics_counters = std::make_shared<Metrics_counters<Id_type>>();
+
+        // Null when the latency tracking is off, shared with the connections like the counters
+        std::shared_ptr<Latency_histograms> m_latency_histograms;
+
+        // Null when the traffic is not captured
+        std::shared_ptr<Traffic_capture> m_traffic_capture;
+
+        // Null when the notifications are only given to the callbacks
+        std::shared_ptr<Notification_sink> m_notification_sink;
+
+        // Null when the handlers are not profiled
+        std::shared_ptr<Handler_profile<Id_type>> m_handler_profile;
+
+        // Keeps itself alive while it runs on the asio threads
+        std::shared_ptr<Metrics_exporter> m_metrics_exporter;
+
+        // Overload is checked on the timer wheel, the connections share the flag that pauses the bulk ones
+        static constexpr std::chrono::milliseconds OVERLOAD_CHECK_PERIOD = std::chrono::milliseconds(100);
+        Overload_settings m_overload_settings;
+        Timer_wheel::Timer_id m_overload_timer = 0;
+        std::atomic<bool> m_is_overloaded = false;
+        std::shared_ptr<std::atomic<bool>> m_is_bulk_paused = std::make_shared<std::atomic<bool>>(false);
+        std::atomic<uint64_t> m_shed_messages = 0;
     };
 }; // namespace Net
@@ -0,0 +1,248 @@
+#pragma once
+
+/**
+ *   Heap allocations of the framework by the stage that made them. They are counted only when
+ *   NET_TRACK_ALLOCATIONS is defined, otherwise the macros expand to nothing. Each stage also counts the messages
+ *   it handled so the allocations per message show whether the receive and the send paths allocate.
+ *
+ *   NET_ALLOCATION_SCOPE(stage)                  counts the allocations of the rest of the scope to the stage
+ *   NET_COUNT_ALLOCATION_MESSAGES(stage, count)  adds the handled messages of the stage
+ *   NET_DEFINE_ALLOCATION_HOOKS()                replaces the global operator new and delete so the allocations
+ *                                                are seen, this has to be in exactly one source file of the program
+ *
+ *   The stages are the names of the Allocation_stage, for example NET_ALLOCATION_SCOPE(read). Accept and
+ *   handshake count each connection as one message. Allocations outside the scopes are counted to none.
+ */
+
+#ifdef NET_TRACK_ALLOCATIONS
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <string_view>
+
+namespace Net
+{
+    enum class Allocation_stage : uint8_t
+    {
+        none,
+        accept,
+        handshake,
+        read,
+        dispatch,
+        send,
+        broadcast
+    };
+
+    inline constexpr size_t ALLOCATION_STAGE_COUNT = static_cast<size_t>(Allocation_stage::broadcast) + 1;
+
+    [[nodiscard]] constexpr std::string_view get_stage_name(Allocation_stage stage) noexcept
+    {
+        switch (stage)
+        {
+        case Allocation_stage::none:
+            return "none";
+        case Allocation_stage::accept:
+            return "accept";
+        case Allocation_stage::handshake:
+            return "handshake";
+        case Allocation_stage::read:
+            return "read";
+        case Allocation_stage::dispatch:
+            return "dispatch";
+        case Allocation_stage::send:
+            return "send";
+        case Allocation_stage::broadcast:
+            return "broadcast";
+        }
+
+        return "unknown";
+    }
+
+    struct Allocation_stats
+    {
+        // @return the allocations per message or all the allocations if no messages were counted
+        [[nodiscard]] double get_allocations_per_message() const noexcept
+        {
+            return m_messages != 0 ? static_cast<double>(m_allocations) / static_cast<double>(m_messages)
+                                   : static_cast<double>(m_allocations);
+        }
+
+        uint64_t m_allocations = 0;
+        uint64_t m_bytes = 0;
+        uint64_t m_messages = 0;
+    };
+
+    // Stages are on their own cache lines so the threads of the different stages don't share one
+    struct alignas(64) Allocation_counters
+    {
+        std::atomic<uint64_t> m_allocations = 0;
+        std::atomic<uint64_t> m_bytes = 0;
+        std::atomic<uint64_t> m_messages = 0;
+    };
+
+    /**
+     *   Counters of the stages. The stage is a thread local that the scopes set, so the allocations of the asio
+     *   threads and the update thread are told apart without locks.
+     */
+    class Allocation_tracker
+    {
+    public:
+        // Called by the hooks for every allocation
+        static void on_allocation(size_t bytes) noexcept
+        {
+            Allocation_counters& counters = s_counters[static_cast<size_t>(s_stage)];
+            counters.m_allocations.fetch_add(1, std::memory_order_relaxed);
+            counters.m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        static void add_messages(Allocation_stage stage, uint64_t messages) noexcept
+        {
+            s_counters[static_cast<size_t>(stage)].m_messages.fetch_add(messages, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] static Allocation_stats get_stats(Allocation_stage stage) noexcept
+        {
+            const Allocation_counters& counters = s_counters[static_cast<size_t>(stage)];
+
+            return {
+                .m_allocations = counters.m_allocations.load(std::memory_order_relaxed),
+                .m_bytes = counters.m_bytes.load(std::memory_order_relaxed),
+                .m_messages = counters.m_messages.load(std::memory_order_relaxed)};
+        }
+
+        // Starts the counting again, for example after the warm up that fills the pools
+        static void reset() noexcept
+        {
+            for (Allocation_counters& counters : s_counters)
+            {
+                counters.m_allocations.store(0, std::memory_order_relaxed);
+                counters.m_bytes.store(0, std::memory_order_relaxed);
+                counters.m_messages.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Writes a line of every stage with its allocations, bytes, messages and allocations per message
+        static void write_report(std::ostream& stream)
+        {
+            for (size_t i = 0; i < ALLOCATION_STAGE_COUNT; ++i)
+            {
+                const auto stage = static_cast<Allocation_stage>(i);
+                const Allocation_stats stats = get_stats(stage);
+
+                stream << get_stage_name(stage) << ": " << stats.m_allocations << " allocations, " << stats.m_bytes
+                       << " bytes, " << stats.m_messages << " messages, " << stats.get_allocations_per_message()
+                       << " per message\n";
+            }
+        }
+
+    private:
+        friend class Allocation_scope;
+
+        static inline std::array<Allocation_counters, ALLOCATION_STAGE_COUNT> s_counters = {};
+        static inline thread_local Allocation_stage s_stage = Allocation_stage::none;
+    };
+
+    // Sets the stage of the thread and restores the earlier one when it goes out of scope
+    class Allocation_scope
+    {
+    public:
+        explicit Allocation_scope(Allocation_stage stage) noexcept : m_previous_stage(Allocation_tracker::s_stage)
+        {
+            Allocation_tracker::s_stage = stage;
+        }
+
+        Allocation_scope(const Allocation_scope&) = delete;
+        Allocation_scope(Allocation_scope&&) = delete;
+
+        ~Allocation_scope()
+        {
+            Allocation_tracker::s_stage = m_previous_stage;
+        }
+
+        Allocation_scope& operator=(const Allocation_scope&) = delete;
+        Allocation_scope& operator=(Allocation_scope&&) = delete;
+
+    private:
+        Allocation_stage m_previous_stage;
+    };
+
+    // Aligned allocations go through the functions of the platform, the other operators forward to these
+    [[nodiscard]] inline void* allocate_tracked(size_t size, size_t alignment)
+    {
+        Allocation_tracker::on_allocation(size);
+        size = size == 0 ? 1 : size;
+
+#ifdef _WIN32
+        void* pointer = alignment <= alignof(std::max_align_t) ? std::malloc(size) : _aligned_malloc(size, alignment);
+#else
+        void* pointer = alignment <= alignof(std::max_align_t)
+                            ? std::malloc(size)
+                            : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+
+        return pointer;
+    }
+
+    inline void free_tracked(void* pointer, size_t alignment) noexcept
+    {
+#ifdef _WIN32
+        if (alignment > alignof(std::max_align_t))
+        {
+            _aligned_free(pointer);
+            return;
+        }
+#endif
+        static_cast<void>(alignment);
+        std::free(pointer);
+    }
+} // namespace Net
+
+#define NET_ALLOCATION_CONCAT_INNER(first, second) first##second
+#define NET_ALLOCATION_CONCAT(first, second) NET_ALLOCATION_CONCAT_INNER(first, second)
+
+#define NET_ALLOCATION_SCOPE(stage)                                                                                  \
+    const Net::Allocation_scope NET_ALLOCATION_CONCAT(net_allocation_scope_, __LINE__)(Net::Allocation_stage::stage)
+#define NET_COUNT_ALLOCATION_MESSAGES(stage, count)                                                                  \
+    Net::Allocation_tracker::add_messages(Net::Allocation_stage::stage, count)
+
+// Array and nothrow operators of the standard library call these, so they are counted too
+#define NET_DEFINE_ALLOCATION_HOOKS()                                                                                \
+    void* operator new(std::size_t size)                                                                             \
+    {                                                                                                                \
+        return Net::allocate_tracked(size, alignof(std::max_align_t));                                              \
+    }                                                                                                                \
+    void* operator new(std::size_t size, std::align_val_t alignment)                                                \
+    {                                                                                                                \
+        return Net::allocate_tracked(size, static_cast<std::size_t>(alignment));                                    \
+    }                                                                                                                \
+    void operator delete(void* pointer) noexcept                                                                     \
+    {                                                                                                                \
+        Net::free_tracked(pointer, alignof(std::max_align_t));                                                       \
+    }                                                                                                                \
+    void operator delete(void* pointer, std::align_val_t alignment) noexcept                                        \
+    {                                                                                                                \
+        Net::free_tracked(pointer, static_cast<std::size_t>(alignment));                                            \
+    }                                                                                                                \
+    void operator delete(void* pointer, std::size_t) noexcept                                                        \
+    {                                                                                                                \
+        Net::free_tracked(pointer, alignof(std::max_align_t));                                                       \
+    }                                                                                                                \
+    void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept                           \
+    {                                                                                                                \
+        Net::free_tracked(pointer, static_cast<std::size_t>(alignment));                                            \
+    }
+
+#else
+
+#define NET_ALLOCATION_SCOPE(stage) static_cast<void>(0)
+#define NET_COUNT_ALLOCATION_MESSAGES(stage, count) static_cast<void>(0)
+#define NET_DEFINE_ALLOCATION_HOOKS()
+
+#endif
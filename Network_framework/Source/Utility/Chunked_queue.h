@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace Net
+{
+    /**
+     *   Queue of items in linked chunks that are allocated from the memory resource only while they hold items,
+     *   so an empty queue owns no memory unlike the std::deque which allocates when it is constructed.
+     *   Items keep their places when items are pushed to the back or popped from the front, like in the deque.
+     *   Erasing from the middle moves the items after the erased one.
+     */
+    template <typename T>
+    class Chunked_queue
+    {
+        struct Chunk;
+
+    public:
+        // Chunk fits in the 512 byte block of the Size_class_pool
+        static constexpr size_t CHUNK_BYTES = 512;
+        static constexpr size_t CHUNK_CAPACITY = std::max<size_t>((CHUNK_BYTES - 4 * sizeof(void*)) / sizeof(T), 1);
+
+        template <bool Is_const>
+        class Basic_iterator
+        {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = std::conditional_t<Is_const, const T*, T*>;
+            using reference = std::conditional_t<Is_const, const T&, T&>;
+
+            Basic_iterator() = default;
+
+            Basic_iterator(Chunk* chunk, size_t index) noexcept : m_chunk(chunk), m_index(index)
+            {
+            }
+
+            // Iterator converts to the const iterator
+            operator Basic_iterator<true>() const noexcept
+                requires(!Is_const)
+            {
+                return {m_chunk, m_index};
+            }
+
+            [[nodiscard]] reference operator*() const noexcept
+            {
+                return *m_chunk->at(m_index);
+            }
+
+            [[nodiscard]] pointer operator->() const noexcept
+            {
+                return m_chunk->at(m_index);
+            }
+
+            Basic_iterator& operator++() noexcept
+            {
+                if (++m_index == m_chunk->m_end && m_chunk->m_next != nullptr)
+                {
+                    m_chunk = m_chunk->m_next;
+                    m_index = m_chunk->m_begin;
+                }
+
+                return *this;
+            }
+
+            Basic_iterator operator++(int) noexcept
+            {
+                Basic_iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            Basic_iterator& operator--() noexcept
+            {
+                if (m_index == m_chunk->m_begin)
+                {
+                    m_chunk = m_chunk->m_previous;
+                    m_index = m_chunk->m_end;
+                }
+
+                --m_index;
+                return *this;
+            }
+
+            Basic_iterator operator--(int) noexcept
+            {
+                Basic_iterator next = *this;
+                --*this;
+                return next;
+            }
+
+            [[nodiscard]] bool operator==(const Basic_iterator&) const noexcept = default;
+
+        private:
+            friend class Chunked_queue;
+
+            Chunk* m_chunk = nullptr;
+            size_t m_index = 0;
+        };
+
+        using iterator = Basic_iterator<false>;
+        using const_iterator = Basic_iterator<true>;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        explicit Chunked_queue(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+            : m_resource(resource)
+        {
+        }
+
+        Chunked_queue(const Chunked_queue&) = delete;
+
+        Chunked_queue(Chunked_queue&& other) noexcept
+            : m_resource(other.m_resource), m_head(std::exchange(other.m_head, nullptr)),
+              m_tail(std::exchange(other.m_tail, nullptr)), m_size(std::exchange(other.m_size, 0))
+        {
+        }
+
+        ~Chunked_queue()
+        {
+            clear();
+        }
+
+        Chunked_queue& operator=(const Chunked_queue&) = delete;
+
+        // Queue is moved with its memory resource so the chunks can always be taken over
+        Chunked_queue& operator=(Chunked_queue&& other) noexcept
+        {
+            if (this != &other)
+            {
+                clear();
+                m_resource = other.m_resource;
+                m_head = std::exchange(other.m_head, nullptr);
+                m_tail = std::exchange(other.m_tail, nullptr);
+                m_size = std::exchange(other.m_size, 0);
+            }
+
+            return *this;
+        }
+
+        void push_back(T&& item)
+        {
+            emplace_back(std::move(item));
+        }
+
+        template <typename... Argument_types>
+        T& emplace_back(Argument_types&&... arguments)
+        {
+            if (m_tail == nullptr || m_tail->m_end == CHUNK_CAPACITY)
+                append_chunk();
+
+            T* item = new (m_tail->at(m_tail->m_end)) T(std::forward<Argument_types>(arguments)...);
+            ++m_tail->m_end;
+            ++m_size;
+
+            return *item;
+        }
+
+        // Queue must not be empty
+        void pop_front() noexcept
+        {
+            std::destroy_at(m_head->at(m_head->m_begin));
+            ++m_head->m_begin;
+            --m_size;
+
+            if (m_head->m_begin == m_head->m_end)
+                free_head();
+        }
+
+        /**
+         *   Moves the items after the erased one a place forward
+         *
+         *   @return iterator to the item that took the place of the erased one
+         */
+        iterator erase(const_iterator position)
+        {
+            iterator current(position.m_chunk, position.m_index);
+            iterator next = current;
+            ++next;
+
+            while (next != end())
+            {
+                *current = std::move(*next);
+                current = next;
+                ++next;
+            }
+
+            const bool is_last = position.m_chunk == m_tail && position.m_index + 1 == m_tail->m_end;
+            pop_back();
+
+            return is_last ? end() : iterator(position.m_chunk, position.m_index);
+        }
+
+        void clear() noexcept
+        {
+            while (!empty())
+                pop_front();
+        }
+
+        [[nodiscard]] T& front() noexcept
+        {
+            return *m_head->at(m_head->m_begin);
+        }
+
+        [[nodiscard]] const T& front() const noexcept
+        {
+            return *m_head->at(m_head->m_begin);
+        }
+
+        [[nodiscard]] T& back() noexcept
+        {
+            return *m_tail->at(m_tail->m_end - 1);
+        }
+
+        [[nodiscard]] const T& back() const noexcept
+        {
+            return *m_tail->at(m_tail->m_end - 1);
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        [[nodiscard]] iterator begin() noexcept
+        {
+            return m_head != nullptr ? iterator(m_head, m_head->m_begin) : iterator();
+        }
+
+        [[nodiscard]] iterator end() noexcept
+        {
+            return m_tail != nullptr ? iterator(m_tail, m_tail->m_end) : iterator();
+        }
+
+        [[nodiscard]] const_iterator begin() const noexcept
+        {
+            return m_head != nullptr ? const_iterator(m_head, m_head->m_begin) : const_iterator();
+        }
+
+        [[nodiscard]] const_iterator end() const noexcept
+        {
+            return m_tail != nullptr ? const_iterator(m_tail, m_tail->m_end) : const_iterator();
+        }
+
+        [[nodiscard]] reverse_iterator rbegin() noexcept
+        {
+            return reverse_iterator(end());
+        }
+
+        [[nodiscard]] reverse_iterator rend() noexcept
+        {
+            return reverse_iterator(begin());
+        }
+
+        [[nodiscard]] const_reverse_iterator rbegin() const noexcept
+        {
+            return const_reverse_iterator(end());
+        }
+
+        [[nodiscard]] const_reverse_iterator rend() const noexcept
+        {
+            return const_reverse_iterator(begin());
+        }
+
+    private:
+        // Items are between begin and end, only the first and the last chunk can be partly used
+        struct Chunk
+        {
+            [[nodiscard]] T* at(size_t index) noexcept
+            {
+                return std::launder(reinterpret_cast<T*>(m_storage + index * sizeof(T)));
+            }
+
+            Chunk* m_previous = nullptr;
+            Chunk* m_next = nullptr;
+            size_t m_begin = 0;
+            size_t m_end = 0;
+            alignas(T) std::byte m_storage[CHUNK_CAPACITY * sizeof(T)];
+        };
+
+        void append_chunk()
+        {
+            Chunk* chunk = new (m_resource->allocate(sizeof(Chunk), alignof(Chunk))) Chunk();
+            chunk->m_previous = m_tail;
+
+            if (m_tail != nullptr)
+                m_tail->m_next = chunk;
+            else
+                m_head = chunk;
+
+            m_tail = chunk;
+        }
+
+        void free_head() noexcept
+        {
+            Chunk* chunk = std::exchange(m_head, m_head->m_next);
+
+            if (m_head != nullptr)
+                m_head->m_previous = nullptr;
+            else
+                m_tail = nullptr;
+
+            free_chunk(chunk);
+        }
+
+        void pop_back() noexcept
+        {
+            --m_tail->m_end;
+            std::destroy_at(m_tail->at(m_tail->m_end));
+            --m_size;
+
+            if (m_tail->m_begin == m_tail->m_end)
+            {
+                Chunk* chunk = std::exchange(m_tail, m_tail->m_previous);
+
+                if (m_tail != nullptr)
+                    m_tail->m_next = nullptr;
+                else
+                    m_head = nullptr;
+
+                free_chunk(chunk);
+            }
+        }
+
+        void free_chunk(Chunk* chunk) noexcept
+        {
+            std::destroy_at(chunk);
+            m_resource->deallocate(chunk, sizeof(Chunk), alignof(Chunk));
+        }
+
+        std::pmr::memory_resource* m_resource;
+        Chunk* m_head = nullptr;
+        Chunk* m_tail = nullptr;
+        size_t m_size = 0;
+    };
+} // namespace Net
@@ -2,20 +2,53 @@
 
 #include <compare>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <string_view>
 
 namespace Net
 {
+    /**
+     *   Sender of a message. The ip text is shared with the connection, so copying this for every message
+     *   costs a reference count instead of an allocation.
+     */
     struct Client_information
     {
         Client_information() = default;
-        Client_information(uint32_t client_id, std::string_view client_ip) : m_id(client_id), m_ip(client_ip)
+
+        // Shares the ip text of the connection
+        Client_information(uint32_t client_id, std::shared_ptr<const std::string> client_ip) noexcept
+            : m_id(client_id), m_ip(std::move(client_ip))
+        {
+        }
+
+        // Copies the ip text, for the senders that have no connection
+        Client_information(uint32_t client_id, std::string_view client_ip)
+            : m_id(client_id), m_ip(std::make_shared<const std::string>(client_ip))
+        {
+        }
+
+        [[nodiscard]] std::string_view get_ip() const noexcept
         {
+            return m_ip ? std::string_view(*m_ip) : std::string_view("0.0.0.0");
         }
 
-        auto operator<=>(const Client_information&) const = default;
+        [[nodiscard]] bool operator==(const Client_information& other) const noexcept
+        {
+            return m_id == other.m_id && get_ip() == other.get_ip();
+        }
+
+        [[nodiscard]] std::strong_ordering operator<=>(const Client_information& other) const noexcept
+        {
+            if (const auto order = m_id <=> other.m_id; order != 0)
+                return order;
+
+            return get_ip() <=> other.get_ip();
+        }
 
         uint32_t m_id = 0;
-        std::string m_ip = "0.0.0.0";
+
+    private:
+        std::shared_ptr<const std::string> m_ip;
     };
 } // namespace Net
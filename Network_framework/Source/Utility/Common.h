@@ -5,6 +5,15 @@
 #define ASIO_STANDALONE
 #define ASIO_NO_DEPRECATED
 
+/**
+ *   Defining NET_ENABLE_IO_URING makes the sockets on Linux use io_uring instead of epoll, which needs the liburing
+ *   and a kernel with io_uring. Asio chooses its backend when it is compiled so this applies to the whole program.
+ */
+#if defined(NET_ENABLE_IO_URING) && defined(__linux__)
+#define ASIO_HAS_IO_URING
+#define ASIO_DISABLE_EPOLL
+#endif
+
 // Specifying Windows version for Asio
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
@@ -20,10 +29,40 @@ namespace Net
 {
     static constexpr size_t SIZE_T_MAX = std::numeric_limits<size_t>::max();
 
+#ifdef ASIO_HAS_IO_URING_AS_DEFAULT
+    static constexpr bool IS_IO_URING_ENABLED = true;
+#else
+    static constexpr bool IS_IO_URING_ENABLED = false;
+#endif
+
+    /**
+     *   Layers that a build can compile out when it never reads them. Defining NET_DISABLE_NOTIFICATIONS drops the
+     *   notifications before they are made, and NET_DISABLE_METRICS drops the traffic counters and the latency
+     *   timing of the connections. The checks of the disabled layers are constants, so the paths of the messages
+     *   have no branches left for them.
+     */
+#ifdef NET_DISABLE_NOTIFICATIONS
+    static constexpr bool IS_NOTIFICATIONS_ENABLED = false;
+#else
+    static constexpr bool IS_NOTIFICATIONS_ENABLED = true;
+#endif
+
+#ifdef NET_DISABLE_METRICS
+    static constexpr bool IS_METRICS_ENABLED = false;
+#else
+    static constexpr bool IS_METRICS_ENABLED = true;
+#endif
+
     // The Asio types that we currently use in this framework
     using Protocol = asio::ip::tcp;
     using Ssl_socket = asio::ssl::stream<Protocol::socket>;
- 
+
+    // Unix domain sockets for the processes on the same host, Windows has them since Windows 10
+    using Local_protocol = asio::local::stream_protocol;
+
+    // Datagrams of the unreliable messages, see the Datagram_channel
+    using Datagram_protocol = asio::ip::udp;
+
 
     // Notification severities
     enum class Severity : uint8_t
@@ -31,4 +70,7 @@ namespace Net
         notification,
         error
     };
+
+    // Keep in sync with the last severity
+    static constexpr size_t SEVERITY_COUNT = static_cast<size_t>(Severity::error) + 1;
 } // namespace Net
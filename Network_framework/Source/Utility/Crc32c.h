@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if (defined(__SSE4_2__) || (defined(_MSC_VER) && defined(__AVX__))) && (defined(__x86_64__) || defined(_M_X64))
+#include <nmmintrin.h>
+#define NET_HAS_SSE42_CRC32C
+#elif defined(__ARM_FEATURE_CRC32) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_acle.h>
+#define NET_HAS_ARM_CRC32C
+#endif
+
+namespace Net
+{
+    /**
+     *   Castagnoli crc used to detect corrupted frames. Uses the crc instructions of SSE4.2 or ARMv8 when the
+     *   compiler targets them and a lookup table otherwise, both give the same result.
+     */
+    class Crc32c
+    {
+    public:
+        Crc32c() = delete;
+
+        /**
+         *   Continues the crc of the earlier data so extending the crc of a with b gives the crc of a followed by b
+         *
+         *   @param the crc of the earlier data, 0 for the first part
+         *   @param the data
+         *   @return the crc of the earlier data and the data
+         */
+        [[nodiscard]] static uint32_t extend(uint32_t crc, std::span<const char> data) noexcept
+        {
+            const char* bytes = data.data();
+            size_t size = data.size();
+
+            crc = ~crc;
+
+#if defined(NET_HAS_SSE42_CRC32C) || defined(NET_HAS_ARM_CRC32C)
+            for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), bytes += sizeof(uint64_t))
+            {
+                uint64_t word = 0;
+                std::memcpy(&word, bytes, sizeof(word));
+                crc = extend_word(crc, word);
+            }
+#endif
+
+            for (; size > 0; --size, ++bytes)
+                crc = extend_byte(crc, static_cast<uint8_t>(*bytes));
+
+            return ~crc;
+        }
+
+    private:
+#if defined(NET_HAS_SSE42_CRC32C)
+        [[nodiscard]] static uint32_t extend_word(uint32_t crc, uint64_t word) noexcept
+        {
+            return static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+        }
+
+        [[nodiscard]] static uint32_t extend_byte(uint32_t crc, uint8_t byte) noexcept
+        {
+            return _mm_crc32_u8(crc, byte);
+        }
+#elif defined(NET_HAS_ARM_CRC32C)
+        [[nodiscard]] static uint32_t extend_word(uint32_t crc, uint64_t word) noexcept
+        {
+            return __crc32cd(crc, word);
+        }
+
+        [[nodiscard]] static uint32_t extend_byte(uint32_t crc, uint8_t byte) noexcept
+        {
+            return __crc32cb(crc, byte);
+        }
+#else
+        // Reversed Castagnoli polynomial
+        static constexpr uint32_t POLYNOMIAL = 0x82F63B78;
+
+        static constexpr std::array<uint32_t, 256> TABLE = [] {
+            std::array<uint32_t, 256> table = {};
+
+            for (uint32_t i = 0; i < table.size(); ++i)
+            {
+                uint32_t value = i;
+
+                for (int bit = 0; bit < 8; ++bit)
+                    value = (value & 1) != 0 ? (value >> 1) ^ POLYNOMIAL : value >> 1;
+
+                table[i] = value;
+            }
+
+            return table;
+        }();
+
+        [[nodiscard]] static uint32_t extend_byte(uint32_t crc, uint8_t byte) noexcept
+        {
+            return TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+        }
+#endif
+    };
+} // namespace Net
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Common.h"
+#include <coroutine>
+#include <cstddef>
+
+namespace Net
+{
+    /**
+     *   Return type of a coroutine that starts right away and frees itself when it finishes, nothing waits for it.
+     *   The frames are allocated with the recycling allocator of asio so the coroutines started on the asio threads
+     *   reuse the memory of the earlier ones instead of allocating.
+     */
+    class Detached_coroutine
+    {
+    public:
+        // Name is required by the coroutines
+        struct promise_type
+        {
+            [[nodiscard]] Detached_coroutine get_return_object() const noexcept
+            {
+                return {};
+            }
+
+            [[nodiscard]] std::suspend_never initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            [[nodiscard]] std::suspend_never final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            void return_void() const noexcept
+            {
+            }
+
+            // Exception goes to whoever started or resumed the coroutine
+            void unhandled_exception() const
+            {
+                throw;
+            }
+
+            [[nodiscard]] static void* operator new(size_t size)
+            {
+                return asio::recycling_allocator<std::byte>().allocate(size);
+            }
+
+            static void operator delete(void* frame, size_t size) noexcept
+            {
+                asio::recycling_allocator<std::byte>().deallocate(static_cast<std::byte*>(frame), size);
+            }
+        };
+    };
+} // namespace Net
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+
+namespace Net
+{
+    // Types that have byte order, these are converted to little endian when sent
+    template <typename T>
+    concept Byte_order_concept = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+    /**
+     *   Converts between the native and the little endian byte order.
+     *   On little endian hosts this does nothing and on others it compiles to a byte swap instruction.
+     */
+    template <Byte_order_concept T>
+    [[nodiscard]] constexpr T to_little_endian(T value) noexcept
+    {
+        if constexpr (std::endian::native == std::endian::little || sizeof(T) == 1)
+            return value;
+        else
+        {
+            using Bits_type = std::conditional_t<
+                sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+
+            static_assert(sizeof(T) == sizeof(Bits_type), "Type has no fixed width");
+            return std::bit_cast<T>(std::byteswap(std::bit_cast<Bits_type>(value)));
+        }
+    }
+
+    // Byte swap is its own inverse so this is the same as to_little_endian
+    template <Byte_order_concept T>
+    [[nodiscard]] constexpr T from_little_endian(T value) noexcept
+    {
+        return to_little_endian(value);
+    }
+} // namespace Net
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <new>
+
+namespace Net
+{
+    /**
+     *   Memory for the completion handler of one operation at a time so the steady reads and writes of a socket
+     *   don't allocate, see the handler allocation example of asio. Handler that does not fit or comes while the
+     *   memory is in use is allocated normally. The operations using the memory must run on the same strand.
+     */
+    class Handler_memory
+    {
+    public:
+        // Fits the state of the composed reads and writes of asio
+        static constexpr size_t SIZE = 1024;
+
+        Handler_memory() = default;
+
+        Handler_memory(const Handler_memory&) = delete;
+        Handler_memory(Handler_memory&&) = delete;
+        Handler_memory& operator=(const Handler_memory&) = delete;
+        Handler_memory& operator=(Handler_memory&&) = delete;
+
+        [[nodiscard]] void* allocate(size_t size)
+        {
+            if (!m_is_in_use && size <= m_storage.size())
+            {
+                m_is_in_use = true;
+                return m_storage.data();
+            }
+
+            return ::operator new(size);
+        }
+
+        void deallocate(void* pointer) noexcept
+        {
+            if (pointer == m_storage.data())
+                m_is_in_use = false;
+            else
+                ::operator delete(pointer);
+        }
+
+    private:
+        alignas(std::max_align_t) std::array<std::byte, SIZE> m_storage = {};
+        bool m_is_in_use = false;
+    };
+
+    // Allocator that is associated with the completion handlers so asio allocates their state from the memory
+    template <typename T>
+    class Handler_allocator
+    {
+    public:
+        using value_type = T;
+
+        explicit Handler_allocator(Handler_memory& memory) noexcept : m_memory(&memory)
+        {
+        }
+
+        template <typename Other_type>
+        Handler_allocator(const Handler_allocator<Other_type>& other) noexcept : m_memory(other.m_memory)
+        {
+        }
+
+        template <typename Other_type>
+        [[nodiscard]] bool operator==(const Handler_allocator<Other_type>& other) const noexcept
+        {
+            return m_memory == other.m_memory;
+        }
+
+        [[nodiscard]] T* allocate(size_t count)
+        {
+            return static_cast<T*>(m_memory->allocate(sizeof(T) * count));
+        }
+
+        void deallocate(T* pointer, [[maybe_unused]] size_t count) noexcept
+        {
+            m_memory->deallocate(pointer);
+        }
+
+    private:
+        template <typename Other_type>
+        friend class Handler_allocator;
+
+        Handler_memory* m_memory;
+    };
+} // namespace Net
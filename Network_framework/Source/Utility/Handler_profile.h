@@ -0,0 +1,196 @@
+#pragma once
+
+#include "../Message/Message_header.h"
+#include "Latency_histogram.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define NET_HAS_TSC
+#endif
+
+namespace Net
+{
+    // Sampled execution times of the handlers of one id
+    template <Id_concept Id_type>
+    struct Handler_metrics
+    {
+        Id_type m_id;
+
+        // Timed handler calls, about one in the sample interval of all the calls
+        uint64_t m_samples = 0;
+
+        // Time of the timed calls multiplied by the sample interval, so it estimates the time of all the calls
+        std::chrono::nanoseconds m_estimated_total_time = std::chrono::nanoseconds(0);
+
+        // Durations of the timed calls
+        Latency_percentiles m_durations;
+    };
+
+    /**
+     *   Times one in the sample interval of the handler calls of every id, so a slow update can be traced to
+     *   the messages whose handlers take the time. Calls are timed with the time stamp counter of the cpu where
+     *   it has one, the ticks are turned to nanoseconds only when the profile is read by comparing them to the
+     *   steady clock since the profile was created. Every id has its own histogram in an open addressing table,
+     *   the ids that don't fit are not timed. The table takes about 500 KB so it exists only while profiling.
+     */
+    template <Id_concept Id_type>
+    class Handler_profile
+    {
+    public:
+        // @param one in this many handler calls is timed, atleast 1
+        explicit Handler_profile(uint32_t sample_interval) noexcept
+            : m_sample_interval(std::max<uint32_t>(sample_interval, 1)), m_start_ticks(read_ticks()),
+              m_start_time(std::chrono::steady_clock::now())
+        {
+        }
+
+        /**
+         *   Calls the handler and times it if this call is sampled
+         *
+         *   @param the id of the handled message
+         *   @param the handler call
+         */
+        template <typename Callable_type>
+        void run(Id_type id, Callable_type&& callable)
+        {
+            // Counted per thread so the handler pool threads don't share a counter
+            thread_local uint32_t calls_until_sample = 0;
+
+            if (calls_until_sample != 0)
+            {
+                --calls_until_sample;
+                callable();
+                return;
+            }
+
+            calls_until_sample = m_sample_interval - 1;
+            const uint64_t start_ticks = read_ticks();
+            callable();
+            record(id, read_ticks() - start_ticks);
+        }
+
+        // @return the timed ids in no particular order
+        [[nodiscard]] std::vector<Handler_metrics<Id_type>> get_metrics() const
+        {
+            const double nanoseconds_per_tick = get_nanoseconds_per_tick();
+            std::vector<Handler_metrics<Id_type>> output;
+
+            auto to_nanoseconds = [nanoseconds_per_tick](std::chrono::nanoseconds ticks) {
+                return std::chrono::nanoseconds(
+                    static_cast<int64_t>(static_cast<double>(ticks.count()) * nanoseconds_per_tick));
+            };
+
+            for (const Id_slot& slot : m_slots)
+            {
+                const uint64_t key = slot.m_key.load(std::memory_order_acquire);
+
+                if (key == EMPTY_KEY)
+                    continue;
+
+                // Histogram holds ticks, its buckets scale with the conversion
+                Latency_percentiles durations = slot.m_ticks.get_percentiles();
+                durations.m_p50 = to_nanoseconds(durations.m_p50);
+                durations.m_p99 = to_nanoseconds(durations.m_p99);
+                durations.m_p999 = to_nanoseconds(durations.m_p999);
+                durations.m_max = to_nanoseconds(durations.m_max);
+
+                const auto total_ticks = slot.m_total_ticks.load(std::memory_order_relaxed) * m_sample_interval;
+
+                output.push_back(
+                    {.m_id = static_cast<Id_type>(static_cast<Underlying_type>(key - 1)),
+                     .m_samples = durations.m_count,
+                     .m_estimated_total_time = to_nanoseconds(std::chrono::nanoseconds(total_ticks)),
+                     .m_durations = durations});
+            }
+
+            return output;
+        }
+
+        [[nodiscard]] uint32_t get_sample_interval() const noexcept
+        {
+            return m_sample_interval;
+        }
+
+    private:
+        using Underlying_type = std::make_unsigned_t<std::underlying_type_t<Id_type>>;
+
+        static constexpr size_t ID_SLOT_COUNT = 64;
+        static constexpr uint64_t EMPTY_KEY = 0;
+
+        struct Id_slot
+        {
+            // Id plus one so the empty slot can be told apart
+            std::atomic<uint64_t> m_key = EMPTY_KEY;
+            std::atomic<uint64_t> m_total_ticks = 0;
+            Latency_histogram m_ticks;
+        };
+
+        [[nodiscard]] static uint64_t read_ticks() noexcept
+        {
+#ifdef NET_HAS_TSC
+            return __rdtsc();
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+#endif
+        }
+
+        // Rate of the ticks measured against the steady clock since the profile was created
+        [[nodiscard]] double get_nanoseconds_per_tick() const noexcept
+        {
+#ifdef NET_HAS_TSC
+            const uint64_t ticks = read_ticks() - m_start_ticks;
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_start_time);
+
+            if (ticks == 0)
+                return 1.0;
+
+            return static_cast<double>(elapsed.count()) / static_cast<double>(ticks);
+#else
+            return 1.0;
+#endif
+        }
+
+        void record(Id_type id, uint64_t ticks) noexcept
+        {
+            const uint64_t key = static_cast<uint64_t>(static_cast<Underlying_type>(id)) + 1;
+            size_t index = std::hash<uint64_t>()(key) % ID_SLOT_COUNT;
+
+            for (size_t probes = 0; probes < ID_SLOT_COUNT; ++probes, index = (index + 1) % ID_SLOT_COUNT)
+            {
+                Id_slot& slot = m_slots[index];
+                uint64_t slot_key = slot.m_key.load(std::memory_order_acquire);
+
+                if (slot_key == EMPTY_KEY &&
+                    slot.m_key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel))
+                    slot_key = key;
+
+                if (slot_key != key)
+                    continue;
+
+                slot.m_total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+                slot.m_ticks.record(std::chrono::nanoseconds(static_cast<int64_t>(ticks)));
+                return;
+            }
+        }
+
+        uint32_t m_sample_interval;
+        uint64_t m_start_ticks;
+        std::chrono::steady_clock::time_point m_start_time;
+        std::array<Id_slot, ID_SLOT_COUNT> m_slots = {};
+    };
+} // namespace Net
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+
+namespace Net
+{
+    // How often a lock was taken, how often it was held by another thread then and how long those waits took
+    struct Lock_metrics
+    {
+        Lock_metrics& operator+=(const Lock_metrics& other) noexcept
+        {
+            m_acquisitions += other.m_acquisitions;
+            m_contended += other.m_contended;
+            m_wait_time += other.m_wait_time;
+            return *this;
+        }
+
+        uint64_t m_acquisitions = 0;
+        uint64_t m_contended = 0;
+        std::chrono::nanoseconds m_wait_time = std::chrono::nanoseconds(0);
+    };
+
+    struct Named_lock_metrics
+    {
+        std::string_view m_name;
+        Lock_metrics m_metrics;
+    };
+
+    /**
+     *   Mutex that counts its contention. The lock is tried first and only the failed try reads the clock, so the
+     *   uncontended lock costs the same as a std::mutex. The counters are only written while the mutex is held,
+     *   so they are atomics only for the readers and the writes don't need read modify write.
+     */
+    class Instrumented_mutex
+    {
+    public:
+        Instrumented_mutex() noexcept = default;
+
+        Instrumented_mutex(const Instrumented_mutex&) = delete;
+        Instrumented_mutex(Instrumented_mutex&&) = delete;
+
+        ~Instrumented_mutex() = default;
+
+        Instrumented_mutex& operator=(const Instrumented_mutex&) = delete;
+        Instrumented_mutex& operator=(Instrumented_mutex&&) = delete;
+
+        void lock()
+        {
+            if (m_mutex.try_lock())
+            {
+                increase(m_acquisitions, 1);
+                return;
+            }
+
+            const auto wait_start = std::chrono::steady_clock::now();
+            m_mutex.lock();
+            const auto wait_time = std::chrono::steady_clock::now() - wait_start;
+
+            increase(m_acquisitions, 1);
+            increase(m_contended, 1);
+            increase(m_wait_time, static_cast<uint64_t>(
+                                      std::chrono::duration_cast<std::chrono::nanoseconds>(wait_time).count()));
+        }
+
+        [[nodiscard]] bool try_lock()
+        {
+            if (!m_mutex.try_lock())
+                return false;
+
+            increase(m_acquisitions, 1);
+            return true;
+        }
+
+        void unlock()
+        {
+            m_mutex.unlock();
+        }
+
+        // @return the counters since the mutex was created, this can be called from any thread
+        [[nodiscard]] Lock_metrics get_metrics() const noexcept
+        {
+            return {
+                .m_acquisitions = m_acquisitions.load(std::memory_order_relaxed),
+                .m_contended = m_contended.load(std::memory_order_relaxed),
+                .m_wait_time = std::chrono::nanoseconds(m_wait_time.load(std::memory_order_relaxed))};
+        }
+
+    private:
+        // Only the holder of the mutex writes
+        static void increase(std::atomic<uint64_t>& counter, uint64_t amount) noexcept
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        std::mutex m_mutex;
+        std::atomic<uint64_t> m_acquisitions = 0;
+        std::atomic<uint64_t> m_contended = 0;
+        std::atomic<uint64_t> m_wait_time = 0;
+    };
+} // namespace Net
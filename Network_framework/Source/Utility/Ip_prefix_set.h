@@ -0,0 +1,317 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Net
+{
+    // Range of addresses that start with the first length bits of the address
+    struct Ip_prefix
+    {
+        asio::ip::address m_address;
+        uint8_t m_length = 0;
+    };
+
+    /**
+     *   Set of the ipv4 and ipv6 address ranges in a binary trie of the address bits, so checking an address takes
+     *   at most one step for each bit of it no matter how many ranges there are. Ipv4 addresses mapped to ipv6 are
+     *   handled as ipv4 addresses. This is not thread safe.
+     */
+    class Ip_prefix_set
+    {
+    public:
+        /**
+         *   @param address or a range like 10.0.0.0/8 or 2001:db8::/32, address without the length is a range
+         *          of that one address
+         *   @return nullopt if the text is not an address or the length is longer than the address
+         */
+        [[nodiscard]] static std::optional<Ip_prefix> parse(std::string_view text)
+        {
+            const size_t slash = text.find('/');
+
+            asio::error_code error;
+            const asio::ip::address address = asio::ip::make_address(std::string(text.substr(0, slash)), error);
+
+            if (error)
+                return std::nullopt;
+
+            if (slash == std::string_view::npos)
+                return Ip_prefix{.m_address = address, .m_length = get_bit_count(address)};
+
+            const std::string_view length_text = text.substr(slash + 1);
+            unsigned length = 0;
+            const auto [end, parse_error] =
+                std::from_chars(length_text.data(), length_text.data() + length_text.size(), length);
+
+            if (parse_error != std::errc() || end != length_text.data() + length_text.size() ||
+                length > get_bit_count(address))
+                return std::nullopt;
+
+            return Ip_prefix{.m_address = address, .m_length = static_cast<uint8_t>(length)};
+        }
+
+        // @return false if the range was already in the set or its length is longer than the address
+        bool insert(const Ip_prefix& prefix)
+        {
+            const std::optional<Bits> bits = to_bits(prefix);
+
+            if (!bits)
+                return false;
+
+            uint32_t node = bits->m_root;
+
+            for (uint8_t i = 0; i < bits->m_length; ++i)
+            {
+                const bool bit = bits->get_bit(i);
+
+                if (m_nodes[node].m_children[bit] == NO_NODE)
+                {
+                    const uint32_t child = allocate_node();
+                    m_nodes[node].m_children[bit] = child;
+                }
+
+                node = m_nodes[node].m_children[bit];
+            }
+
+            if (m_nodes[node].m_is_prefix)
+                return false;
+
+            m_nodes[node].m_is_prefix = true;
+            ++m_size;
+
+            return true;
+        }
+
+        // @return false if the range was not in the set, the ranges inside or around it are not erased
+        bool erase(const Ip_prefix& prefix)
+        {
+            const std::optional<Bits> bits = to_bits(prefix);
+
+            if (!bits)
+                return false;
+
+            std::array<uint32_t, MAX_BIT_COUNT + 1> path = {bits->m_root};
+
+            for (uint8_t i = 0; i < bits->m_length; ++i)
+            {
+                path[i + 1] = m_nodes[path[i]].m_children[bits->get_bit(i)];
+
+                if (path[i + 1] == NO_NODE)
+                    return false;
+            }
+
+            if (!m_nodes[path[bits->m_length]].m_is_prefix)
+                return false;
+
+            m_nodes[path[bits->m_length]].m_is_prefix = false;
+            --m_size;
+
+            // Nodes that lead to no range anymore are freed from the end of the path
+            for (uint8_t i = bits->m_length; i > 0; --i)
+            {
+                const Node& node = m_nodes[path[i]];
+
+                if (node.m_is_prefix || node.m_children[0] != NO_NODE || node.m_children[1] != NO_NODE)
+                    break;
+
+                m_nodes[path[i - 1]].m_children[bits->get_bit(i - 1)] = NO_NODE;
+                m_free_nodes.push_back(path[i]);
+            }
+
+            return true;
+        }
+
+        // @return true if the address is inside any of the ranges
+        [[nodiscard]] bool contains(const asio::ip::address& address) const noexcept
+        {
+            const std::optional<Bits> bits =
+                to_bits(Ip_prefix{.m_address = address, .m_length = get_bit_count(address)});
+            uint32_t node = bits->m_root;
+
+            for (uint8_t i = 0; !m_nodes[node].m_is_prefix; ++i)
+            {
+                if (i == bits->m_length)
+                    return false;
+
+                node = m_nodes[node].m_children[bits->get_bit(i)];
+
+                if (node == NO_NODE)
+                    return false;
+            }
+
+            return true;
+        }
+
+        /**
+         *   Calls the function with every range of the set, the ipv4 ranges first
+         *
+         *   @param function that takes the const Ip_prefix&
+         */
+        template <typename Function>
+        void for_each(Function&& function) const
+        {
+            Bits bits;
+            visit(IPV4_ROOT, bits, function);
+
+            bits = {.m_root = IPV6_ROOT};
+            visit(IPV6_ROOT, bits, function);
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        void clear() noexcept
+        {
+            m_nodes.resize(2);
+            m_nodes[IPV4_ROOT] = {};
+            m_nodes[IPV6_ROOT] = {};
+            m_free_nodes.clear();
+            m_size = 0;
+        }
+
+    private:
+        static constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+        static constexpr uint32_t IPV4_ROOT = 0;
+        static constexpr uint32_t IPV6_ROOT = 1;
+        static constexpr uint8_t MAX_BIT_COUNT = 128;
+
+        // Child 0 continues the ranges where the next bit is 0 and child 1 the ones where it is 1
+        struct Node
+        {
+            std::array<uint32_t, 2> m_children = {NO_NODE, NO_NODE};
+            bool m_is_prefix = false;
+        };
+
+        // Bytes of the address in network order and the bits of them that are in the range
+        struct Bits
+        {
+            [[nodiscard]] bool get_bit(uint8_t index) const noexcept
+            {
+                return ((m_bytes[index / 8] >> (7 - index % 8)) & 1) != 0;
+            }
+
+            std::array<uint8_t, 16> m_bytes = {};
+            uint8_t m_length = 0;
+            uint32_t m_root = IPV4_ROOT;
+        };
+
+        [[nodiscard]] static uint8_t get_bit_count(const asio::ip::address& address) noexcept
+        {
+            return address.is_v4() ? 32 : 128;
+        }
+
+        // @return nullopt if the length is longer than the address
+        [[nodiscard]] static std::optional<Bits> to_bits(const Ip_prefix& prefix) noexcept
+        {
+            if (prefix.m_length > get_bit_count(prefix.m_address))
+                return std::nullopt;
+
+            Bits bits;
+            bits.m_length = prefix.m_length;
+
+            if (prefix.m_address.is_v4())
+            {
+                const auto bytes = prefix.m_address.to_v4().to_bytes();
+                std::copy(bytes.begin(), bytes.end(), bits.m_bytes.begin());
+                return bits;
+            }
+
+            const asio::ip::address_v6 address = prefix.m_address.to_v6();
+            const auto bytes = address.to_bytes();
+
+            // Mapped range that covers more than the ipv4 part also covers addresses that are not ipv4
+            if (address.is_v4_mapped() && prefix.m_length >= 96)
+            {
+                std::copy(bytes.begin() + 12, bytes.end(), bits.m_bytes.begin());
+                bits.m_length = static_cast<uint8_t>(prefix.m_length - 96);
+                return bits;
+            }
+
+            std::copy(bytes.begin(), bytes.end(), bits.m_bytes.begin());
+            bits.m_root = IPV6_ROOT;
+
+            return bits;
+        }
+
+        // Walks the nodes below the node in depth first order, the bits hold the path to the node
+        template <typename Function>
+        void visit(uint32_t node, Bits& bits, Function& function) const
+        {
+            if (m_nodes[node].m_is_prefix)
+                function(to_prefix(bits));
+
+            if (bits.m_length == (bits.m_root == IPV4_ROOT ? 32 : MAX_BIT_COUNT))
+                return;
+
+            for (const bool bit : {false, true})
+            {
+                const uint32_t child = m_nodes[node].m_children[bit];
+
+                if (child == NO_NODE)
+                    continue;
+
+                const uint8_t index = bits.m_length;
+                const uint8_t mask = static_cast<uint8_t>(0x80 >> (index % 8));
+                bits.m_bytes[index / 8] = static_cast<uint8_t>(bit ? bits.m_bytes[index / 8] | mask
+                                                                   : bits.m_bytes[index / 8] & ~mask);
+                ++bits.m_length;
+
+                visit(child, bits, function);
+
+                --bits.m_length;
+            }
+        }
+
+        [[nodiscard]] static Ip_prefix to_prefix(const Bits& bits) noexcept
+        {
+            // Bits after the length are left from the earlier paths, so they are cleared
+            std::array<uint8_t, 16> bytes = {};
+
+            for (uint8_t i = 0; i < bits.m_length; ++i)
+                if (bits.get_bit(i))
+                    bytes[i / 8] |= static_cast<uint8_t>(0x80 >> (i % 8));
+
+            if (bits.m_root == IPV4_ROOT)
+                return Ip_prefix{
+                    .m_address = asio::ip::address_v4({bytes[0], bytes[1], bytes[2], bytes[3]}),
+                    .m_length = bits.m_length};
+
+            return Ip_prefix{.m_address = asio::ip::address_v6(bytes), .m_length = bits.m_length};
+        }
+
+        [[nodiscard]] uint32_t allocate_node()
+        {
+            if (m_free_nodes.empty())
+            {
+                m_nodes.emplace_back();
+                return static_cast<uint32_t>(m_nodes.size() - 1);
+            }
+
+            const uint32_t node = m_free_nodes.back();
+            m_free_nodes.pop_back();
+            m_nodes[node] = {};
+
+            return node;
+        }
+
+        // Nodes are kept in one vector and point to each other with indexes, the roots are the first two
+        std::vector<Node> m_nodes = std::vector<Node>(2);
+        std::vector<uint32_t> m_free_nodes;
+        size_t m_size = 0;
+    };
+} // namespace Net
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace Net
+{
+    /**
+     *   Measures how late the io_context runs its handlers. A timer is waited again and again and the lag is how
+     *   much later than its expiry its handler ran, so the thread that is busy with other handlers shows up as a
+     *   growing lag. The timer that has expired but not yet run counts as lagging too, so a thread that is stuck
+     *   in one long handler is seen before the handler returns.
+     */
+    class Lag_monitor
+    {
+    public:
+        /**
+         *   @param executor of the io_context that is measured
+         *   @param how often the lag is sampled
+         */
+        explicit Lag_monitor(
+            asio::any_io_executor executor, std::chrono::milliseconds period = std::chrono::milliseconds(50))
+            : m_timer(std::move(executor)), m_period(std::max(period, std::chrono::milliseconds(1)))
+        {
+        }
+
+        Lag_monitor(const Lag_monitor&) = delete;
+        Lag_monitor(Lag_monitor&&) = delete;
+
+        ~Lag_monitor() = default;
+
+        Lag_monitor& operator=(const Lag_monitor&) = delete;
+        Lag_monitor& operator=(Lag_monitor&&) = delete;
+
+        // Starts sampling, this has to be called from the executor of the monitor or before it runs
+        void start()
+        {
+            wait_next_sample();
+        }
+
+        // Stops sampling and forgets the lag
+        void stop()
+        {
+            m_timer.cancel();
+            m_expiry.store(NOT_WAITING, std::memory_order_relaxed);
+            m_lag.store(0, std::memory_order_relaxed);
+        }
+
+        // @return the lag of the last sample or of the pending one if it is later, this is thread safe
+        [[nodiscard]] std::chrono::microseconds get_lag() const noexcept
+        {
+            const int64_t expiry = m_expiry.load(std::memory_order_relaxed);
+            const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+            const int64_t pending_lag = expiry != NOT_WAITING && now > expiry ? now - expiry : 0;
+
+            return std::max(
+                std::chrono::microseconds(m_lag.load(std::memory_order_relaxed)),
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::duration(pending_lag)));
+        }
+
+    private:
+        static constexpr int64_t NOT_WAITING = std::numeric_limits<int64_t>::max();
+
+        void wait_next_sample()
+        {
+            m_timer.expires_after(m_period);
+            m_expiry.store(m_timer.expiry().time_since_epoch().count(), std::memory_order_relaxed);
+
+            m_timer.async_wait([this](asio::error_code error) {
+                // Monitor may be gone when the cancelled wait completes
+                if (error)
+                    return;
+
+                const auto lag = std::chrono::steady_clock::now() - m_timer.expiry();
+                m_lag.store(
+                    std::chrono::duration_cast<std::chrono::microseconds>(lag).count(), std::memory_order_relaxed);
+
+                wait_next_sample();
+            });
+        }
+
+        asio::steady_timer m_timer;
+        std::chrono::milliseconds m_period;
+
+        // Expiry of the pending sample in the ticks of the steady clock and the last lag in microseconds
+        std::atomic<int64_t> m_expiry = NOT_WAITING;
+        std::atomic<int64_t> m_lag = 0;
+    };
+} // namespace Net
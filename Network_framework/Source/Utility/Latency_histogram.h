@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace Net
+{
+    struct Latency_percentiles
+    {
+        uint64_t m_count = 0;
+        std::chrono::nanoseconds m_p50 = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds m_p99 = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds m_p999 = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds m_max = std::chrono::nanoseconds(0);
+    };
+
+    /**
+     *   Log-linear histogram of durations like the HDR histogram. Every power of two is split in 16 linear buckets
+     *   so the percentiles are within 1/16 of the real value for any duration, and recording is one relaxed
+     *   increment without locks or allocations.
+     */
+    class Latency_histogram
+    {
+    public:
+        void record(std::chrono::nanoseconds duration) noexcept
+        {
+            const uint64_t value = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+            m_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         *   @param the quantile between 0 and 1, for example 0.99 for the p99
+         *   @return the upper bound of the bucket of the quantile, 0 if nothing has been recorded
+         */
+        [[nodiscard]] std::chrono::nanoseconds get_percentile(double quantile) const noexcept
+        {
+            return get_percentile(quantile, get_count());
+        }
+
+        [[nodiscard]] Latency_percentiles get_percentiles() const noexcept
+        {
+            const uint64_t count = get_count();
+
+            return {
+                .m_count = count,
+                .m_p50 = get_percentile(0.5, count),
+                .m_p99 = get_percentile(0.99, count),
+                .m_p999 = get_percentile(0.999, count),
+                .m_max = get_percentile(1.0, count)};
+        }
+
+        [[nodiscard]] uint64_t get_count() const noexcept
+        {
+            uint64_t count = 0;
+
+            for (const std::atomic<uint64_t>& bucket : m_buckets)
+                count += bucket.load(std::memory_order_relaxed);
+
+            return count;
+        }
+
+    private:
+        static constexpr unsigned SUB_BUCKET_BITS = 4;
+        static constexpr uint64_t SUB_BUCKET_COUNT = uint64_t(1) << SUB_BUCKET_BITS;
+
+        // Values under the sub bucket count have their own buckets, then each power of two has the sub buckets
+        static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+        [[nodiscard]] static size_t bucket_index(uint64_t value) noexcept
+        {
+            if (value < SUB_BUCKET_COUNT)
+                return static_cast<size_t>(value);
+
+            const unsigned shift = static_cast<unsigned>(std::bit_width(value)) - 1 - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKET_COUNT + ((value >> shift) & (SUB_BUCKET_COUNT - 1));
+        }
+
+        // @return the largest value that goes to the bucket
+        [[nodiscard]] static uint64_t bucket_upper_bound(size_t index) noexcept
+        {
+            if (index < SUB_BUCKET_COUNT)
+                return index;
+
+            const unsigned shift = static_cast<unsigned>(index / SUB_BUCKET_COUNT) - 1;
+            const uint64_t lower_bound = (SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+
+            return lower_bound + ((uint64_t(1) << shift) - 1);
+        }
+
+        [[nodiscard]] std::chrono::nanoseconds get_percentile(double quantile, uint64_t count) const noexcept
+        {
+            if (count == 0)
+                return std::chrono::nanoseconds(0);
+
+            const uint64_t target = std::max<uint64_t>(
+                static_cast<uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(count))), 1);
+            uint64_t seen = 0;
+
+            for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            {
+                seen += m_buckets[i].load(std::memory_order_relaxed);
+
+                if (seen >= target)
+                    return std::chrono::nanoseconds(static_cast<int64_t>(bucket_upper_bound(i)));
+            }
+
+            // Buckets were recorded while they were summed
+            return std::chrono::nanoseconds(static_cast<int64_t>(bucket_upper_bound(BUCKET_COUNT - 1)));
+        }
+
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> m_buckets = {};
+    };
+
+    /**
+     *   Time the received messages wait in the in queue until the update takes them and the time the sent
+     *   messages wait in the write queue until they have been written to the socket. Wire to dispatch is the
+     *   time from the stamp of the kernel to the update, only the messages of the stamping sockets have it.
+     */
+    struct Latency_histograms
+    {
+        Latency_histogram m_receive_to_dispatch;
+        Latency_histogram m_send_to_wire;
+        Latency_histogram m_wire_to_dispatch;
+    };
+} // namespace Net
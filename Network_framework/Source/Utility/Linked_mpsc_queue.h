@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+
+namespace Net
+{
+    /**
+     *   Unbounded lock-free queue for many producers and one consumer. Items are kept in linked nodes that are
+     *   allocated from the memory resource, so an empty queue owns no memory. Producers push to a stack with one
+     *   compare exchange and the consumer takes the whole stack at once and reverses it to the order of the pushes.
+     */
+    template <typename T>
+    class Linked_mpsc_queue
+    {
+    public:
+        explicit Linked_mpsc_queue(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+            : m_resource(resource)
+        {
+        }
+
+        Linked_mpsc_queue(const Linked_mpsc_queue&) = delete;
+        Linked_mpsc_queue(Linked_mpsc_queue&&) = delete;
+
+        ~Linked_mpsc_queue()
+        {
+            free_nodes(m_popped);
+            free_nodes(m_pushed.load(std::memory_order_acquire));
+        }
+
+        Linked_mpsc_queue& operator=(const Linked_mpsc_queue&) = delete;
+        Linked_mpsc_queue& operator=(Linked_mpsc_queue&&) = delete;
+
+        /**
+         *   Thread safe push that can be called by any amount of producers
+         *
+         *   @param the item
+         *   @return true if nothing was pushed since the consumer last took the pushed items, then the consumer has
+         *           to be told about the new item
+         */
+        bool push(T&& item)
+        {
+            Node* node = new (m_resource->allocate(sizeof(Node), alignof(Node))) Node{.m_item = std::move(item)};
+            Node* head = m_pushed.load(std::memory_order_relaxed);
+
+            do
+                node->m_next = head;
+            while (!m_pushed.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+            return head == nullptr;
+        }
+
+        // Only the consumer can pop, the items of one producer come out in the order it pushed them
+        [[nodiscard]] std::optional<T> try_pop()
+        {
+            if (m_popped == nullptr)
+                m_popped = reverse(m_pushed.exchange(nullptr, std::memory_order_acquire));
+
+            if (m_popped == nullptr)
+                return std::nullopt;
+
+            Node* node = std::exchange(m_popped, m_popped->m_next);
+            std::optional<T> item(std::move(node->m_item));
+            free_node(node);
+
+            return item;
+        }
+
+    private:
+        struct Node
+        {
+            T m_item;
+            Node* m_next = nullptr;
+        };
+
+        [[nodiscard]] static Node* reverse(Node* nodes) noexcept
+        {
+            Node* reversed = nullptr;
+
+            while (nodes != nullptr)
+                reversed = std::exchange(nodes, std::exchange(nodes->m_next, reversed));
+
+            return reversed;
+        }
+
+        void free_node(Node* node) noexcept
+        {
+            std::destroy_at(node);
+            m_resource->deallocate(node, sizeof(Node), alignof(Node));
+        }
+
+        void free_nodes(Node* nodes) noexcept
+        {
+            while (nodes != nullptr)
+                free_node(std::exchange(nodes, nodes->m_next));
+        }
+
+        std::pmr::memory_resource* const m_resource;
+
+        // Producers push to the head of this stack, the consumer owns the popped list in the order of the pushes
+        std::atomic<Node*> m_pushed = nullptr;
+        Node* m_popped = nullptr;
+    };
+} // namespace Net
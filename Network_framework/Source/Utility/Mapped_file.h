@@ -0,0 +1,252 @@
+#pragma once
+
+#include "Common.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Net
+{
+    /**
+     *   File that is mapped whole while it is written, the bytes are appended to the mapping and the file is
+     *   truncated to the written bytes when it is closed. Writing to the mapping costs a copy without system
+     *   calls and the kernel writes the pages back to the file. An existing file can also be mapped only for
+     *   reading, then all of its bytes count as appended and nothing can be appended.
+     */
+    class Mapped_file
+    {
+    public:
+        Mapped_file() = default;
+
+        Mapped_file(const Mapped_file&) = delete;
+        Mapped_file(Mapped_file&&) = delete;
+
+        ~Mapped_file()
+        {
+            close();
+        }
+
+        Mapped_file& operator=(const Mapped_file&) = delete;
+        Mapped_file& operator=(Mapped_file&&) = delete;
+
+        // Creates the file or truncates the existing one to the size and maps it
+        [[nodiscard]] std::error_code open(const std::filesystem::path& path, size_t size)
+        {
+#ifdef _WIN32
+            m_file = ::CreateFileW(
+                path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+            if (m_file == INVALID_HANDLE_VALUE)
+                return last_error();
+
+            const auto size_value = static_cast<uint64_t>(size);
+            m_mapping = ::CreateFileMappingW(
+                m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size_value >> 32),
+                static_cast<DWORD>(size_value), nullptr);
+
+            if (m_mapping == nullptr)
+                return fail_open();
+
+            m_data = static_cast<char*>(::MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size));
+
+            if (m_data == nullptr)
+                return fail_open();
+#else
+            m_file = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+
+            if (m_file < 0)
+                return last_error();
+
+            if (::ftruncate(m_file, static_cast<off_t>(size)) != 0)
+                return fail_open();
+
+            void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+
+            if (data == MAP_FAILED)
+                return fail_open();
+
+            m_data = static_cast<char*>(data);
+#endif
+            m_size = size;
+            m_used = 0;
+            m_is_read_only = false;
+            return {};
+        }
+
+        // Maps the whole existing file for reading, an empty file can not be mapped
+        [[nodiscard]] std::error_code open_read_only(const std::filesystem::path& path)
+        {
+#ifdef _WIN32
+            m_file = ::CreateFileW(
+                path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+            if (m_file == INVALID_HANDLE_VALUE)
+                return last_error();
+
+            LARGE_INTEGER file_size = {};
+
+            if (!::GetFileSizeEx(m_file, &file_size))
+                return fail_open();
+
+            const auto size = static_cast<size_t>(file_size.QuadPart);
+
+            if (size == 0)
+                return fail_open(std::make_error_code(std::errc::invalid_argument));
+
+            m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+            if (m_mapping == nullptr)
+                return fail_open();
+
+            m_data = static_cast<char*>(::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, size));
+
+            if (m_data == nullptr)
+                return fail_open();
+#else
+            m_file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (m_file < 0)
+                return last_error();
+
+            struct stat file_status = {};
+
+            if (::fstat(m_file, &file_status) != 0)
+                return fail_open();
+
+            const auto size = static_cast<size_t>(file_status.st_size);
+
+            if (size == 0)
+                return fail_open(std::make_error_code(std::errc::invalid_argument));
+
+            void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_file, 0);
+
+            if (data == MAP_FAILED)
+                return fail_open();
+
+            // Readers go through the file once from the start, so the kernel can read ahead
+            ::madvise(data, size, MADV_SEQUENTIAL);
+            m_data = static_cast<char*>(data);
+#endif
+            m_size = size;
+            m_used = size;
+            m_is_read_only = true;
+            return {};
+        }
+
+        // @return false if the bytes don't fit
+        bool append(std::span<const char> bytes) noexcept
+        {
+            if (bytes.size() > m_size - m_used)
+                return false;
+
+            std::memcpy(m_data + m_used, bytes.data(), bytes.size());
+            m_used += bytes.size();
+            return true;
+        }
+
+        // @return the appended bytes at the offset, the offset and the size must be within the appended bytes
+        [[nodiscard]] std::span<const char> read(size_t offset, size_t size) const noexcept
+        {
+            return {m_data + offset, size};
+        }
+
+        [[nodiscard]] size_t get_used_bytes() const noexcept
+        {
+            return m_used;
+        }
+
+        [[nodiscard]] size_t get_free_bytes() const noexcept
+        {
+            return m_size - m_used;
+        }
+
+        [[nodiscard]] bool is_open() const noexcept
+        {
+            return m_data != nullptr;
+        }
+
+        void close() noexcept
+        {
+            if (m_data == nullptr)
+                return;
+#ifdef _WIN32
+            ::UnmapViewOfFile(m_data);
+            ::CloseHandle(m_mapping);
+
+            LARGE_INTEGER end = {};
+            end.QuadPart = static_cast<LONGLONG>(m_used);
+
+            if (!m_is_read_only && ::SetFilePointerEx(m_file, end, nullptr, FILE_BEGIN))
+                ::SetEndOfFile(m_file);
+
+            ::CloseHandle(m_file);
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            ::munmap(m_data, m_size);
+
+            if (!m_is_read_only)
+                static_cast<void>(::ftruncate(m_file, static_cast<off_t>(m_used)));
+
+            ::close(m_file);
+            m_file = -1;
+#endif
+            m_data = nullptr;
+        }
+
+    private:
+        [[nodiscard]] static std::error_code last_error() noexcept
+        {
+#ifdef _WIN32
+            return std::error_code(static_cast<int>(::GetLastError()), std::system_category());
+#else
+            return std::error_code(errno, std::system_category());
+#endif
+        }
+
+        // Closes what was opened and returns the error of the step that failed
+        [[nodiscard]] std::error_code fail_open() noexcept
+        {
+            return fail_open(last_error());
+        }
+
+        [[nodiscard]] std::error_code fail_open(std::error_code error) noexcept
+        {
+#ifdef _WIN32
+            if (m_mapping != nullptr)
+                ::CloseHandle(m_mapping);
+
+            ::CloseHandle(m_file);
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            ::close(m_file);
+            m_file = -1;
+#endif
+            return error;
+        }
+
+#ifdef _WIN32
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+        HANDLE m_mapping = nullptr;
+#else
+        int m_file = -1;
+#endif
+        char* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_used = 0;
+        bool m_is_read_only = false;
+    };
+} // namespace Net
@@ -0,0 +1,434 @@
+#pragma once
+
+#include "../Message/Message_header.h"
+#include "../Sockets/Tcp_info.h"
+#include "Client_information.h"
+#include "Handler_profile.h"
+#include "Instrumented_mutex.h"
+#include "Notification.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    // Messages and their bytes with the headers, heartbeats are not counted
+    struct Traffic_metrics
+    {
+        Traffic_metrics& operator+=(const Traffic_metrics& other) noexcept
+        {
+            m_messages_received += other.m_messages_received;
+            m_bytes_received += other.m_bytes_received;
+            m_messages_sent += other.m_messages_sent;
+            m_bytes_sent += other.m_bytes_sent;
+            return *this;
+        }
+
+        uint64_t m_messages_received = 0;
+        uint64_t m_bytes_received = 0;
+        uint64_t m_messages_sent = 0;
+        uint64_t m_bytes_sent = 0;
+    };
+
+    struct Connection_metrics
+    {
+        Traffic_metrics m_traffic;
+
+        // Messages waiting in the lanes of the write queue
+        size_t m_out_queue_messages = 0;
+        size_t m_out_queue_bytes = 0;
+
+        // Dropped or replaced by the overflow policy
+        uint64_t m_dropped_messages = 0;
+
+        // Received messages of the user, the internal messages of the framework are not counted
+        uint64_t m_user_messages_received = 0;
+
+        // Nothing until the handshake has finished
+        std::optional<std::chrono::microseconds> m_handshake_duration = std::nullopt;
+
+        // Latest sample of the kernel, nothing if it is not sampled, see the Heartbeat_settings::m_tcp_info_interval
+        std::optional<Tcp_info> m_tcp_info = std::nullopt;
+
+        // Lock that the threads sending to the connection take to find its strand
+        Lock_metrics m_strand_lock;
+    };
+
+    // State of one connection when the Server::get_connection_snapshots was called
+    struct Connection_snapshot
+    {
+        Client_information m_client;
+        std::chrono::system_clock::time_point m_connect_time;
+
+        /**
+         *   Time of the first snapshot that saw the latest sent or received messages, so it is as exact as the
+         *   interval of the snapshots. Connection time until any messages are seen.
+         */
+        std::chrono::steady_clock::time_point m_last_activity;
+
+        // Latest round trip time measured by the heartbeat, nothing if it is not known yet
+        std::optional<std::chrono::microseconds> m_round_trip_time = std::nullopt;
+
+        Connection_metrics m_metrics;
+    };
+
+    // Metrics of all the connections of the server or the client since it was created
+    template <Id_concept Id_type>
+    struct Metrics
+    {
+        Traffic_metrics m_traffic;
+
+        size_t m_connections = 0;
+
+        // Received messages waiting for the update
+        size_t m_in_queue_messages = 0;
+        size_t m_in_queue_bytes = 0;
+
+        // Sum of the write queues of the current connections
+        size_t m_out_queue_messages = 0;
+        size_t m_out_queue_bytes = 0;
+
+        // Memory of the write queues, the in queue and the buffers of the sockets, see the Memory_budget
+        size_t m_memory_bytes = 0;
+
+        // Average handshake is the duration divided by the handshakes
+        uint64_t m_handshakes = 0;
+        std::chrono::microseconds m_handshake_duration = std::chrono::microseconds(0);
+
+        // Disconnects indexed by the Notification_code of the reason, disconnected means closed by this side
+        std::array<uint64_t, NOTIFICATION_CODE_COUNT> m_disconnects = {};
+
+        // Notifications indexed by the Severity, also the ones under the notification severity are counted
+        std::array<uint64_t, SEVERITY_COUNT> m_notifications = {};
+
+        // Largest lag of the Asio threads, see the Lag_monitor
+        std::chrono::microseconds m_io_lag = std::chrono::microseconds(0);
+        bool m_is_overloaded = false;
+
+        // Received messages dropped because of the overload
+        uint64_t m_shed_messages = 0;
+
+        /**
+         *   Locks that the framework still takes, connection_strand sums the strand locks of the current
+         *   connections. The in queue, the notifications and the write queues are lock free and are not here.
+         */
+        std::vector<Named_lock_metrics> m_locks;
+
+        // Received messages of the ids that have been received, in no particular order
+        std::vector<std::pair<Id_type, uint64_t>> m_received_messages_by_id;
+
+        // Sampled handler times of the ids, empty unless the handler profiling is on
+        std::vector<Handler_metrics<Id_type>> m_handler_times;
+    };
+
+    /**
+     *   Counters of one connection. They are written only on the strand of the connection, so the increments are
+     *   plain relaxed stores without a locked instruction and the other threads can read them at any time.
+     */
+    class Connection_counters
+    {
+    public:
+        void add_received(size_t bytes) noexcept
+        {
+            increase(m_messages_received, 1);
+            increase(m_bytes_received, bytes);
+        }
+
+        void add_sent(size_t messages, size_t bytes) noexcept
+        {
+            increase(m_messages_sent, messages);
+            increase(m_bytes_sent, bytes);
+        }
+
+        // More than one when the connection continues the count of the process it was handed over from
+        void add_received_user_message(uint64_t messages = 1) noexcept
+        {
+            increase(m_user_messages_received, messages);
+        }
+
+        void set_out_queue(size_t messages, size_t bytes) noexcept
+        {
+            m_out_queue_messages.store(messages, std::memory_order_relaxed);
+            m_out_queue_bytes.store(bytes, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] size_t get_out_queue_bytes() const noexcept
+        {
+            return m_out_queue_bytes.load(std::memory_order_relaxed);
+        }
+
+        // Sets the connection time to now
+        void set_connect_time() noexcept
+        {
+            const auto now = std::chrono::system_clock::now();
+            const auto steady_now = std::chrono::steady_clock::now();
+
+            m_connect_time.store(
+                std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count(),
+                std::memory_order_relaxed);
+            m_last_activity.store(steady_now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::chrono::system_clock::time_point get_connect_time() const noexcept
+        {
+            const std::chrono::microseconds connect_time(m_connect_time.load(std::memory_order_relaxed));
+            return std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(connect_time));
+        }
+
+        /**
+         *   The reader notices the new messages by comparing the counts to the ones it saw the last time, so the
+         *   connection never reads the clock for this
+         *
+         *   @param the time of the reading
+         *   @return the time of the first reading that saw the latest messages
+         */
+        [[nodiscard]] std::chrono::steady_clock::time_point get_last_activity(
+            std::chrono::steady_clock::time_point now) const noexcept
+        {
+            const uint64_t messages = m_messages_received.load(std::memory_order_relaxed) +
+                                      m_messages_sent.load(std::memory_order_relaxed);
+
+            if (m_seen_messages.exchange(messages, std::memory_order_relaxed) != messages)
+                m_last_activity.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+
+            return std::chrono::steady_clock::time_point(
+                std::chrono::steady_clock::duration(m_last_activity.load(std::memory_order_relaxed)));
+        }
+
+        void set_handshake_duration(std::chrono::microseconds duration) noexcept
+        {
+            m_handshake_duration.store(duration.count(), std::memory_order_relaxed);
+        }
+
+        void set_tcp_info(const Tcp_info& info) noexcept
+        {
+            m_tcp_congestion_window_bytes.store(info.m_congestion_window_bytes, std::memory_order_relaxed);
+            m_tcp_unacked_bytes.store(info.m_unacked_bytes, std::memory_order_relaxed);
+            m_tcp_retransmitted_segments.store(info.m_retransmitted_segments, std::memory_order_relaxed);
+            m_tcp_round_trip_time.store(info.m_round_trip_time.count(), std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] Connection_metrics get(uint64_t dropped_messages) const noexcept
+        {
+            const int64_t handshake_duration = m_handshake_duration.load(std::memory_order_relaxed);
+            const int64_t tcp_round_trip_time = m_tcp_round_trip_time.load(std::memory_order_relaxed);
+
+            return {
+                .m_traffic =
+                    {.m_messages_received = m_messages_received.load(std::memory_order_relaxed),
+                     .m_bytes_received = m_bytes_received.load(std::memory_order_relaxed),
+                     .m_messages_sent = m_messages_sent.load(std::memory_order_relaxed),
+                     .m_bytes_sent = m_bytes_sent.load(std::memory_order_relaxed)},
+                .m_out_queue_messages = m_out_queue_messages.load(std::memory_order_relaxed),
+                .m_out_queue_bytes = m_out_queue_bytes.load(std::memory_order_relaxed),
+                .m_dropped_messages = dropped_messages,
+                .m_user_messages_received = m_user_messages_received.load(std::memory_order_relaxed),
+                .m_handshake_duration = handshake_duration >= 0
+                                            ? std::optional(std::chrono::microseconds(handshake_duration))
+                                            : std::nullopt,
+                .m_tcp_info = tcp_round_trip_time >= 0
+                                  ? std::optional(Tcp_info{
+                                        .m_round_trip_time = std::chrono::microseconds(tcp_round_trip_time),
+                                        .m_congestion_window_bytes =
+                                            m_tcp_congestion_window_bytes.load(std::memory_order_relaxed),
+                                        .m_unacked_bytes = m_tcp_unacked_bytes.load(std::memory_order_relaxed),
+                                        .m_retransmitted_segments =
+                                            m_tcp_retransmitted_segments.load(std::memory_order_relaxed)})
+                                  : std::nullopt,
+                // Connection fills this from its strand mutex, the counters don't see the lock
+                .m_strand_lock = {}};
+        }
+
+    private:
+        static void increase(std::atomic<uint64_t>& counter, uint64_t amount) noexcept
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> m_messages_received = 0;
+        std::atomic<uint64_t> m_bytes_received = 0;
+        std::atomic<uint64_t> m_messages_sent = 0;
+        std::atomic<uint64_t> m_bytes_sent = 0;
+        std::atomic<uint64_t> m_user_messages_received = 0;
+        std::atomic<size_t> m_out_queue_messages = 0;
+        std::atomic<size_t> m_out_queue_bytes = 0;
+        std::atomic<int64_t> m_handshake_duration = -1;
+
+        // Microseconds of the system clock and the ticks of the steady clock
+        std::atomic<int64_t> m_connect_time = 0;
+        mutable std::atomic<int64_t> m_last_activity = 0;
+        mutable std::atomic<uint64_t> m_seen_messages = 0;
+
+        // Fields of the sample are read one by one so they may be from two samples, negative time until sampled
+        std::atomic<int64_t> m_tcp_round_trip_time = -1;
+        std::atomic<uint64_t> m_tcp_congestion_window_bytes = 0;
+        std::atomic<uint64_t> m_tcp_unacked_bytes = 0;
+        std::atomic<uint64_t> m_tcp_retransmitted_segments = 0;
+    };
+
+    /**
+     *   Counters of all the connections of a user. Every thread counts to its own shard so the asio threads don't
+     *   write to the same cache lines, the shards are summed only when the metrics are read.
+     *   Ids are counted in a small open addressing table of every shard, the ids that don't fit are only
+     *   counted in the totals.
+     */
+    template <Id_concept Id_type>
+    class Metrics_counters
+    {
+    public:
+        // @param id of the message or nothing if the message is internal to the framework
+        void add_received(size_t bytes, std::optional<Id_type> id) noexcept
+        {
+            Shard& shard = get_shard();
+            shard.m_messages_received.fetch_add(1, std::memory_order_relaxed);
+            shard.m_bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+
+            if (!id.has_value())
+                return;
+
+            if (Id_slot* slot = find_slot(shard, id.value()))
+                slot->m_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void add_sent(size_t messages, size_t bytes) noexcept
+        {
+            Shard& shard = get_shard();
+            shard.m_messages_sent.fetch_add(messages, std::memory_order_relaxed);
+            shard.m_bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        void add_handshake(std::chrono::microseconds duration) noexcept
+        {
+            Shard& shard = get_shard();
+            shard.m_handshakes.fetch_add(1, std::memory_order_relaxed);
+            shard.m_handshake_microseconds.fetch_add(duration.count(), std::memory_order_relaxed);
+        }
+
+        void add_disconnect(Notification_code reason) noexcept
+        {
+            get_shard().m_disconnects[static_cast<size_t>(reason)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void add_notification(Severity severity) noexcept
+        {
+            get_shard().m_notifications[static_cast<size_t>(severity)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Adds the sums of the shards to the counters of the metrics
+        void add_to(Metrics<Id_type>& metrics) const
+        {
+            for (const Shard& shard : m_shards)
+            {
+                metrics.m_traffic += {
+                    .m_messages_received = shard.m_messages_received.load(std::memory_order_relaxed),
+                    .m_bytes_received = shard.m_bytes_received.load(std::memory_order_relaxed),
+                    .m_messages_sent = shard.m_messages_sent.load(std::memory_order_relaxed),
+                    .m_bytes_sent = shard.m_bytes_sent.load(std::memory_order_relaxed)};
+
+                metrics.m_handshakes += shard.m_handshakes.load(std::memory_order_relaxed);
+                metrics.m_handshake_duration +=
+                    std::chrono::microseconds(shard.m_handshake_microseconds.load(std::memory_order_relaxed));
+
+                for (size_t i = 0; i < NOTIFICATION_CODE_COUNT; ++i)
+                    metrics.m_disconnects[i] += shard.m_disconnects[i].load(std::memory_order_relaxed);
+
+                for (size_t i = 0; i < SEVERITY_COUNT; ++i)
+                    metrics.m_notifications[i] += shard.m_notifications[i].load(std::memory_order_relaxed);
+
+                for (const Id_slot& slot : shard.m_ids)
+                    if (const uint64_t key = slot.m_key.load(std::memory_order_acquire); key != EMPTY_KEY)
+                        add_id_count(metrics, to_id(key), slot.m_count.load(std::memory_order_relaxed));
+            }
+        }
+
+    private:
+        using Underlying_type = std::make_unsigned_t<std::underlying_type_t<Id_type>>;
+
+        static constexpr size_t SHARD_COUNT = 8;
+        static constexpr size_t ID_SLOT_COUNT = 256;
+        static constexpr uint64_t EMPTY_KEY = 0;
+
+        struct Id_slot
+        {
+            std::atomic<uint64_t> m_key = EMPTY_KEY;
+            std::atomic<uint64_t> m_count = 0;
+        };
+
+        // Aligned so the shards of different threads don't share cache lines
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> m_messages_received = 0;
+            std::atomic<uint64_t> m_bytes_received = 0;
+            std::atomic<uint64_t> m_messages_sent = 0;
+            std::atomic<uint64_t> m_bytes_sent = 0;
+            std::atomic<uint64_t> m_handshakes = 0;
+            std::atomic<uint64_t> m_handshake_microseconds = 0;
+            std::array<std::atomic<uint64_t>, NOTIFICATION_CODE_COUNT> m_disconnects = {};
+            std::array<std::atomic<uint64_t>, SEVERITY_COUNT> m_notifications = {};
+            std::array<Id_slot, ID_SLOT_COUNT> m_ids = {};
+        };
+
+        // Key is the id plus one so the empty slot can be told apart
+        [[nodiscard]] static uint64_t to_key(Id_type id) noexcept
+        {
+            return static_cast<uint64_t>(static_cast<Underlying_type>(id)) + 1;
+        }
+
+        [[nodiscard]] static Id_type to_id(uint64_t key) noexcept
+        {
+            return static_cast<Id_type>(static_cast<Underlying_type>(key - 1));
+        }
+
+        static void add_id_count(Metrics<Id_type>& metrics, Id_type id, uint64_t count)
+        {
+            for (auto& [counted_id, counted] : metrics.m_received_messages_by_id)
+            {
+                if (counted_id == id)
+                {
+                    counted += count;
+                    return;
+                }
+            }
+
+            metrics.m_received_messages_by_id.emplace_back(id, count);
+        }
+
+        // @return the slot of the id or nullptr if the table is full
+        [[nodiscard]] static Id_slot* find_slot(Shard& shard, Id_type id) noexcept
+        {
+            const uint64_t key = to_key(id);
+            size_t index = std::hash<uint64_t>()(key) % ID_SLOT_COUNT;
+
+            for (size_t probe = 0; probe < ID_SLOT_COUNT; ++probe, index = (index + 1) % ID_SLOT_COUNT)
+            {
+                Id_slot& slot = shard.m_ids[index];
+                uint64_t slot_key = slot.m_key.load(std::memory_order_acquire);
+
+                // Slots are never freed so the id stays in the slot that was claimed first
+                if (slot_key == EMPTY_KEY && slot.m_key.compare_exchange_strong(slot_key, key))
+                    return &slot;
+
+                if (slot_key == key)
+                    return &slot;
+            }
+
+            return nullptr;
+        }
+
+        [[nodiscard]] Shard& get_shard() noexcept
+        {
+            static thread_local const size_t shard_index = std::hash<std::thread::id>()(std::this_thread::get_id());
+            return m_shards[shard_index % SHARD_COUNT];
+        }
+
+        std::array<Shard, SHARD_COUNT> m_shards = {};
+    };
+} // namespace Net
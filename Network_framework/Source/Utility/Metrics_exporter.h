@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Common.h"
+#include "asio/experimental/awaitable_operators.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Net
+{
+    /**
+     *   Minimal HTTP endpoint that serves the metrics text on GET /metrics for Prometheus to scrape.
+     *   It runs on the io_context of the acceptor, every request gets a new text and the connection is closed
+     *   after the response. Requests that don't arrive in time or are too large are dropped.
+     */
+    class Metrics_exporter : public std::enable_shared_from_this<Metrics_exporter>
+    {
+    public:
+        // Called on the asio thread for every scrape, it must be thread safe
+        using Metrics_writer = std::function<std::string()>;
+
+        Metrics_exporter(Protocol::acceptor acceptor, Metrics_writer metrics_writer)
+            : m_acceptor(std::move(acceptor)), m_metrics_writer(std::move(metrics_writer))
+        {
+        }
+
+        // Starts accepting the scrapes, they are served once the io_context runs
+        void start()
+        {
+            asio::co_spawn(
+                m_acceptor.get_executor(), [self = shared_from_this()] { return self->accept_loop(); },
+                asio::detached);
+        }
+
+        // Closes the acceptor on its executor, the scrapes that are being served still finish
+        void stop()
+        {
+            asio::post(m_acceptor.get_executor(), [self = shared_from_this()] {
+                asio::error_code error;
+                self->m_acceptor.close(error);
+            });
+        }
+
+    private:
+        static constexpr size_t MAX_REQUEST_SIZE = 8 * 1024;
+        static constexpr std::chrono::seconds REQUEST_TIMEOUT = std::chrono::seconds(5);
+
+        asio::awaitable<void> accept_loop()
+        {
+            while (m_acceptor.is_open())
+            {
+                asio::error_code error;
+                Protocol::socket socket =
+                    co_await m_acceptor.async_accept(asio::redirect_error(asio::use_awaitable, error));
+
+                if (error == asio::error::operation_aborted)
+                    co_return;
+
+                if (error)
+                    continue;
+
+                const auto executor = socket.get_executor();
+                asio::co_spawn(
+                    executor, [self = shared_from_this(), socket = std::move(socket)]() mutable {
+                        return self->serve(std::move(socket));
+                    },
+                    asio::detached);
+            }
+        }
+
+        asio::awaitable<void> serve(Protocol::socket socket)
+        {
+            using namespace asio::experimental::awaitable_operators;
+
+            std::string request;
+            asio::error_code error;
+            asio::steady_timer timer(socket.get_executor(), REQUEST_TIMEOUT);
+
+            // Timer cancels the read of a scraper that never finishes its request
+            const auto result = co_await (
+                asio::async_read_until(
+                    socket, asio::dynamic_buffer(request, MAX_REQUEST_SIZE), "\r\n\r\n",
+                    asio::redirect_error(asio::use_awaitable, error)) ||
+                timer.async_wait(asio::use_awaitable));
+
+            if (result.index() != 0 || error)
+                co_return;
+
+            const std::string response = is_metrics_request(request) ? create_response("200 OK", m_metrics_writer())
+                                                                      : create_response("404 Not Found", "");
+
+            co_await asio::async_write(
+                socket, asio::buffer(response), asio::redirect_error(asio::use_awaitable, error));
+            socket.shutdown(Protocol::socket::shutdown_both, error);
+        }
+
+        [[nodiscard]] static bool is_metrics_request(std::string_view request) noexcept
+        {
+            constexpr std::string_view metrics_path = "GET /metrics";
+
+            if (!request.starts_with(metrics_path))
+                return false;
+
+            const char next_char = request[metrics_path.size()];
+            return next_char == ' ' || next_char == '?';
+        }
+
+        [[nodiscard]] static std::string create_response(std::string_view status, std::string_view body)
+        {
+            std::string response = "HTTP/1.1 ";
+            response += status;
+            response += "\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8";
+            response += "\r\nContent-Length: " + std::to_string(body.size());
+            response += "\r\nConnection: close\r\n\r\n";
+            response += body;
+
+            return response;
+        }
+
+        Protocol::acceptor m_acceptor;
+        Metrics_writer m_metrics_writer;
+    };
+} // namespace Net
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace Net
+{
+    enum class Push_result : uint8_t
+    {
+        full,
+        pushed,
+
+        // The queue was empty before this push so the consumer might be waiting for it
+        pushed_to_empty
+    };
+
+    /**
+     *   Bounded lock-free queue for many producers and one consumer.
+     *   Every slot has a sequence number that tells if it is free for the producers or ready for the consumer
+     *   so pushing costs one compare exchange and popping takes no atomic read-modify-write on the slots.
+     */
+    template <typename T>
+    class Mpsc_queue
+    {
+    public:
+        // @param the capacity which is rounded up to power of two
+        explicit Mpsc_queue(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_capacity - 1),
+              m_slots(std::make_unique<Slot[]>(m_capacity))
+        {
+            for (size_t i = 0; i < m_capacity; ++i)
+                m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+        }
+
+        Mpsc_queue(const Mpsc_queue&) = delete;
+        Mpsc_queue(Mpsc_queue&&) = delete;
+
+        ~Mpsc_queue()
+        {
+            while (try_pop().has_value())
+            {
+            }
+        }
+
+        Mpsc_queue& operator=(const Mpsc_queue&) = delete;
+        Mpsc_queue& operator=(Mpsc_queue&&) = delete;
+
+        /**
+         *   Thread safe push that can be called by any amount of producers
+         *
+         *   @param the item which is moved from only if the push succeeds
+         *   @return full if there was no room for the item
+         */
+        Push_result try_push(T&& item)
+        {
+            size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+            Slot* slot = nullptr;
+
+            while (true)
+            {
+                slot = &m_slots[position & m_mask];
+                const size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (difference == 0)
+                {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                    return Push_result::full;
+                else
+                    position = m_enqueue_position.load(std::memory_order_relaxed);
+            }
+
+            new (slot->m_storage) T(std::move(item));
+            slot->m_sequence.store(position + 1, std::memory_order_release);
+
+            return m_size.fetch_add(1) == 0 ? Push_result::pushed_to_empty : Push_result::pushed;
+        }
+
+        /**
+         *   Thread safe push of many items with one reservation, so a producer with a batch pays the contended
+         *   compare exchange and counter update once instead of for each item. Items are queued in order and
+         *   stay together, fewer are pushed if there is no room for all of them.
+         *
+         *   @param the items, the pushed ones from the start are moved from
+         *   @param set to pushed_to_empty if the queue was empty before the push and to full if nothing was pushed
+         *   @return the amount of pushed items
+         */
+        size_t try_push_batch(std::span<T> items, Push_result& result)
+        {
+            size_t count = std::min(items.size(), m_capacity);
+            size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+            result = Push_result::full;
+
+            while (count > 0)
+            {
+                // Consumer frees the slots in order, so the whole run is free when its last slot is
+                const size_t last_position = position + count - 1;
+                const size_t sequence = m_slots[last_position & m_mask].m_sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(last_position);
+
+                if (difference == 0)
+                {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + count, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                    count /= 2;
+                else
+                    position = m_enqueue_position.load(std::memory_order_relaxed);
+            }
+
+            if (count == 0)
+                return 0;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                Slot& slot = m_slots[(position + i) & m_mask];
+                new (slot.m_storage) T(std::move(items[i]));
+                slot.m_sequence.store(position + i + 1, std::memory_order_release);
+            }
+
+            result = m_size.fetch_add(count) == 0 ? Push_result::pushed_to_empty : Push_result::pushed;
+            return count;
+        }
+
+        // This should only be called by the consumer
+        [[nodiscard]] std::optional<T> try_pop()
+        {
+            Slot& slot = m_slots[m_dequeue_position & m_mask];
+            const size_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+
+            // Slot has not been written yet
+            if (sequence != m_dequeue_position + 1)
+                return std::nullopt;
+
+            T* item = std::launder(reinterpret_cast<T*>(slot.m_storage));
+            std::optional<T> output(std::move(*item));
+            item->~T();
+
+            slot.m_sequence.store(m_dequeue_position + m_capacity, std::memory_order_release);
+            ++m_dequeue_position;
+            m_size.fetch_sub(1);
+
+            return output;
+        }
+
+        /**
+         *   Pops many items at the end of the output with one update to the shared counter.
+         *   This should only be called by the consumer.
+         *
+         *   @param the container where the items are appended
+         *   @param the max amount of items popped, at most the capacity is popped so this always ends
+         *   @return the amount of popped items
+         */
+        size_t try_pop_batch(std::vector<T>& output, size_t max_items)
+        {
+            const size_t limit = std::min(max_items, m_capacity);
+            size_t popped = 0;
+
+            while (popped < limit)
+            {
+                Slot& slot = m_slots[m_dequeue_position & m_mask];
+
+                if (slot.m_sequence.load(std::memory_order_acquire) != m_dequeue_position + 1)
+                    break;
+
+                T* item = std::launder(reinterpret_cast<T*>(slot.m_storage));
+                output.push_back(std::move(*item));
+                item->~T();
+
+                slot.m_sequence.store(m_dequeue_position + m_capacity, std::memory_order_release);
+                ++m_dequeue_position;
+                ++popped;
+            }
+
+            if (popped > 0)
+                m_size.fetch_sub(popped);
+
+            return popped;
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return size() == 0;
+        }
+
+        // Consumer can pop before the producer has counted the push so the counter can briefly go below zero
+        [[nodiscard]] size_t size() const noexcept
+        {
+            const size_t size = m_size.load();
+            return size > m_capacity ? 0 : size;
+        }
+
+        [[nodiscard]] size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> m_sequence = 0;
+            alignas(T) std::byte m_storage[sizeof(T)];
+        };
+
+        // Keeps the producer and the consumer positions on different cache lines
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        const size_t m_capacity;
+        const size_t m_mask;
+        std::unique_ptr<Slot[]> m_slots;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_position = 0;
+        alignas(CACHE_LINE_SIZE) size_t m_dequeue_position = 0;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_size = 0;
+    };
+} // namespace Net
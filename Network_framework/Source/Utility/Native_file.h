@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Net
+{
+    /**
+     *   Read only file that is read with the native handle. The handle can be given to the sendfile or
+     *   TransmitFile and the reads take the offset so the file can be shared without a seek position.
+     */
+    class Native_file
+    {
+    public:
+#ifdef _WIN32
+        using Native_handle = HANDLE;
+#else
+        using Native_handle = int;
+#endif
+
+        // @return nullptr if the file could not be opened
+        [[nodiscard]] static std::shared_ptr<const Native_file> open(const std::filesystem::path& path)
+        {
+#ifdef _WIN32
+            const HANDLE handle = ::CreateFileW(
+                path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                nullptr);
+
+            LARGE_INTEGER size = {};
+
+            if (handle == INVALID_HANDLE_VALUE)
+                return nullptr;
+
+            if (!::GetFileSizeEx(handle, &size))
+            {
+                ::CloseHandle(handle);
+                return nullptr;
+            }
+
+            return std::shared_ptr<const Native_file>(new Native_file(handle, static_cast<uint64_t>(size.QuadPart)));
+#else
+            const int handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat status = {};
+
+            if (handle < 0)
+                return nullptr;
+
+            if (::fstat(handle, &status) != 0 || !S_ISREG(status.st_mode))
+            {
+                ::close(handle);
+                return nullptr;
+            }
+
+            return std::shared_ptr<const Native_file>(new Native_file(handle, static_cast<uint64_t>(status.st_size)));
+#endif
+        }
+
+        Native_file(const Native_file&) = delete;
+        Native_file(Native_file&&) = delete;
+
+        ~Native_file()
+        {
+#ifdef _WIN32
+            ::CloseHandle(m_handle);
+#else
+            ::close(m_handle);
+#endif
+        }
+
+        Native_file& operator=(const Native_file&) = delete;
+        Native_file& operator=(Native_file&&) = delete;
+
+        /**
+         *   @param where the reading starts
+         *   @param where the data is read
+         *   @return number of bytes read, 0 at the end of the file or on error
+         */
+        [[nodiscard]] size_t read(uint64_t offset, std::span<char> output) const noexcept
+        {
+            // Reads are limited so the size fits in the types of both platforms
+            const size_t size = std::min(output.size(), MAX_READ_SIZE);
+
+#ifdef _WIN32
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+            DWORD bytes_read = 0;
+
+            if (!::ReadFile(m_handle, output.data(), static_cast<DWORD>(size), &bytes_read, &overlapped))
+                return 0;
+
+            return bytes_read;
+#else
+            ssize_t bytes_read = 0;
+
+            do
+                bytes_read = ::pread(m_handle, output.data(), size, static_cast<off_t>(offset));
+            while (bytes_read < 0 && errno == EINTR);
+
+            return bytes_read > 0 ? static_cast<size_t>(bytes_read) : 0;
+#endif
+        }
+
+        // Size of the file when it was opened
+        [[nodiscard]] uint64_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        [[nodiscard]] Native_handle native_handle() const noexcept
+        {
+            return m_handle;
+        }
+
+    private:
+        static constexpr size_t MAX_READ_SIZE = 1 << 30;
+
+        Native_file(Native_handle handle, uint64_t size) noexcept : m_handle(handle), m_size(size)
+        {
+        }
+
+        const Native_handle m_handle;
+        const uint64_t m_size;
+    };
+} // namespace Net
@@ -0,0 +1,317 @@
+#pragma once
+
+#include "Common.h"
+#include <cstdint>
+#include <format>
+#include <string>
+#include <string_view>
+
+namespace Net
+{
+    // What happened, the other fields of the notification that are used depend on this
+    enum class Notification_code : uint8_t
+    {
+        // Rare notification that has only the m_text
+        text,
+
+        server_started,
+        server_stopped,
+        accept_failed,
+        new_connection,
+        max_connections_reached,
+        banned_ip_rejected,
+        no_free_client_ids,
+        connection_denied,
+        client_accepted,
+        client_disconnected,
+        connect_failed,
+
+        handshake_succeeded,
+        handshake_failed,
+        handshake_timeout,
+        header_validation_failed,
+        read_header_failed,
+        read_body_failed,
+        read_failed,
+        read_timeout,
+        checksum_mismatch,
+        rate_limit_exceeded,
+        invalid_compressed_message,
+        invalid_stream_chunk,
+        invalid_message_fragment,
+        invalid_message_bundle,
+        write_queue_full,
+        write_failed,
+        write_timeout,
+        file_ended_early,
+
+        // Connection was closed by this side, this is not notified
+        disconnected,
+
+        // Names of the options that could not be set are in the m_text
+        socket_options_failed,
+
+        datagram_channel_failed,
+
+        // Server redirected the client, the address is in the m_text
+        client_redirected,
+
+        // Connection could not be moved to another io_context and stays on its thread
+        connection_move_failed,
+
+        // Client connects again after the delay in the m_text
+        reconnecting,
+
+        // Server continued the session, the m_text has how many messages were sent again
+        session_resumed,
+
+        // Session could not be continued, the m_text has the reason
+        session_lost,
+
+        multicast_failed,
+
+        // Server no longer had the multicast messages that the client missed, the m_text has how many
+        multicast_messages_lost,
+
+        // Server passed its acceptors and connections to the new process, the m_text has how many connections
+        server_handed_off,
+
+        // Passing the server to the new process or taking it over failed
+        hot_restart_failed,
+
+        // Server told the client that it is shutting down, the client is disconnected soon
+        server_shutting_down,
+
+        // User became overloaded or recovered, see the Overload_settings. The m_text has the lag of the Asio threads
+        overloaded,
+        overload_ended,
+
+        // New connection was rejected because the server was overloaded
+        overloaded_connection_rejected
+    };
+
+    // Keep in sync with the last code
+    static constexpr size_t NOTIFICATION_CODE_COUNT =
+        static_cast<size_t>(Notification_code::overloaded_connection_rejected) + 1;
+
+    // @return the name of the code as it is written in the code, for example for the labels of the metrics
+    [[nodiscard]] constexpr std::string_view get_code_name(Notification_code code) noexcept
+    {
+        switch (code)
+        {
+        case Notification_code::text:
+            return "text";
+        case Notification_code::server_started:
+            return "server_started";
+        case Notification_code::server_stopped:
+            return "server_stopped";
+        case Notification_code::accept_failed:
+            return "accept_failed";
+        case Notification_code::new_connection:
+            return "new_connection";
+        case Notification_code::max_connections_reached:
+            return "max_connections_reached";
+        case Notification_code::banned_ip_rejected:
+            return "banned_ip_rejected";
+        case Notification_code::no_free_client_ids:
+            return "no_free_client_ids";
+        case Notification_code::connection_denied:
+            return "connection_denied";
+        case Notification_code::client_accepted:
+            return "client_accepted";
+        case Notification_code::client_disconnected:
+            return "client_disconnected";
+        case Notification_code::connect_failed:
+            return "connect_failed";
+        case Notification_code::handshake_succeeded:
+            return "handshake_succeeded";
+        case Notification_code::handshake_failed:
+            return "handshake_failed";
+        case Notification_code::handshake_timeout:
+            return "handshake_timeout";
+        case Notification_code::header_validation_failed:
+            return "header_validation_failed";
+        case Notification_code::read_header_failed:
+            return "read_header_failed";
+        case Notification_code::read_body_failed:
+            return "read_body_failed";
+        case Notification_code::read_failed:
+            return "read_failed";
+        case Notification_code::read_timeout:
+            return "read_timeout";
+        case Notification_code::checksum_mismatch:
+            return "checksum_mismatch";
+        case Notification_code::rate_limit_exceeded:
+            return "rate_limit_exceeded";
+        case Notification_code::invalid_compressed_message:
+            return "invalid_compressed_message";
+        case Notification_code::invalid_stream_chunk:
+            return "invalid_stream_chunk";
+        case Notification_code::invalid_message_fragment:
+            return "invalid_message_fragment";
+        case Notification_code::invalid_message_bundle:
+            return "invalid_message_bundle";
+        case Notification_code::write_queue_full:
+            return "write_queue_full";
+        case Notification_code::write_failed:
+            return "write_failed";
+        case Notification_code::write_timeout:
+            return "write_timeout";
+        case Notification_code::file_ended_early:
+            return "file_ended_early";
+        case Notification_code::disconnected:
+            return "disconnected";
+        case Notification_code::socket_options_failed:
+            return "socket_options_failed";
+        case Notification_code::datagram_channel_failed:
+            return "datagram_channel_failed";
+        case Notification_code::client_redirected:
+            return "client_redirected";
+        case Notification_code::connection_move_failed:
+            return "connection_move_failed";
+        case Notification_code::reconnecting:
+            return "reconnecting";
+        case Notification_code::session_resumed:
+            return "session_resumed";
+        case Notification_code::session_lost:
+            return "session_lost";
+        case Notification_code::multicast_failed:
+            return "multicast_failed";
+        case Notification_code::multicast_messages_lost:
+            return "multicast_messages_lost";
+        case Notification_code::server_handed_off:
+            return "server_handed_off";
+        case Notification_code::hot_restart_failed:
+            return "hot_restart_failed";
+        case Notification_code::server_shutting_down:
+            return "server_shutting_down";
+        case Notification_code::overloaded:
+            return "overloaded";
+        case Notification_code::overload_ended:
+            return "overload_ended";
+        case Notification_code::overloaded_connection_rejected:
+            return "overloaded_connection_rejected";
+        }
+
+        return "unknown";
+    }
+
+    /**
+     *   Notification of the framework. Everything except the rare texts is stored without allocating and
+     *   the text is formatted only when the application asks for it.
+     */
+    struct Notification
+    {
+        [[nodiscard]] std::string to_string() const
+        {
+            switch (m_code)
+            {
+            case Notification_code::text:
+                return m_text;
+            case Notification_code::server_started:
+                return "Server has been started";
+            case Notification_code::server_stopped:
+                return "Server has been stopped";
+            case Notification_code::accept_failed:
+                return std::format("Server connection error: {}", m_error.message());
+            case Notification_code::new_connection:
+                return std::format("Server new connection: {}", m_address.to_string());
+            case Notification_code::max_connections_reached:
+                return "Max connections reached";
+            case Notification_code::banned_ip_rejected:
+                return std::format("Client with ip {} is banned", m_address.to_string());
+            case Notification_code::no_free_client_ids:
+                return std::format("No free client ids for {}", m_address.to_string());
+            case Notification_code::connection_denied:
+                return std::format("Connection {} denied", m_address.to_string());
+            case Notification_code::client_accepted:
+                return std::format(
+                    "Client with ip {} was accepted and assigned id {} to it", m_address.to_string(), m_client_id);
+            case Notification_code::client_disconnected:
+                return std::format("Client disconnected ip: {} id: {}", m_address.to_string(), m_client_id);
+            case Notification_code::connect_failed:
+                return std::format("Error on connection because {}", m_error.message());
+            case Notification_code::handshake_succeeded:
+                return std::format("Succesfull handshake with {}", m_address.to_string());
+            case Notification_code::handshake_failed:
+                return std::format("Error on handshake because {}", m_error.message());
+            case Notification_code::handshake_timeout:
+                return "Handshake did not finish before the handshake timeout";
+            case Notification_code::header_validation_failed:
+                return "Header validation failed";
+            case Notification_code::read_header_failed:
+                return std::format("Read header failed because {}", m_error.message());
+            case Notification_code::read_body_failed:
+                return std::format("Read body failed because {}", m_error.message());
+            case Notification_code::read_failed:
+                return std::format("Read failed because {}", m_error.message());
+            case Notification_code::read_timeout:
+                return "Nothing was received before the read timeout";
+            case Notification_code::checksum_mismatch:
+                return "Frame checksum did not match";
+            case Notification_code::rate_limit_exceeded:
+                return "Rate limit was exceeded";
+            case Notification_code::invalid_compressed_message:
+                return "Invalid compressed message";
+            case Notification_code::invalid_stream_chunk:
+                return "Invalid stream chunk";
+            case Notification_code::invalid_message_fragment:
+                return "Invalid message fragment";
+            case Notification_code::invalid_message_bundle:
+                return "Invalid message bundle";
+            case Notification_code::write_queue_full:
+                return "Write queue is full";
+            case Notification_code::write_failed:
+                return std::format("Write failed because {}", m_error.message());
+            case Notification_code::write_timeout:
+                return "Write did not finish before the write timeout";
+            case Notification_code::file_ended_early:
+                return "File ended before all of it was sent";
+            case Notification_code::disconnected:
+                return "Connection was closed";
+            case Notification_code::socket_options_failed:
+                return std::format("Could not set socket options {}", m_text);
+            case Notification_code::datagram_channel_failed:
+                return std::format("Datagram channel failed because {}", m_error.message());
+            case Notification_code::client_redirected:
+                return std::format("Server redirected the client to {}", m_text);
+            case Notification_code::connection_move_failed:
+                return std::format("Connection could not be moved to another thread because {}", m_error.message());
+            case Notification_code::reconnecting:
+                return std::format("Reconnecting in {}", m_text);
+            case Notification_code::session_resumed:
+                return std::format("Session was resumed and {} messages were sent again", m_text);
+            case Notification_code::session_lost:
+                return std::format("Session could not be resumed because {}", m_text);
+            case Notification_code::multicast_failed:
+                return std::format("Multicast failed because {}", m_error.message());
+            case Notification_code::multicast_messages_lost:
+                return std::format("{} multicast messages were lost", m_text);
+            case Notification_code::server_handed_off:
+                return std::format("Server was handed to the new process with {} connections", m_text);
+            case Notification_code::hot_restart_failed:
+                return std::format("Hot restart failed because {}", m_error.message());
+            case Notification_code::server_shutting_down:
+                return "Server is shutting down";
+            case Notification_code::overloaded:
+                return std::format("Overloaded with the lag of {}", m_text);
+            case Notification_code::overload_ended:
+                return std::format("Overload ended with the lag of {}", m_text);
+            case Notification_code::overloaded_connection_rejected:
+                return std::format("Connection of {} rejected because of the overload", m_address.to_string());
+            }
+
+            return m_text;
+        }
+
+        Notification_code m_code = Notification_code::text;
+        Severity m_severity = Severity::notification;
+
+        // Connection or client the notification is about, 0 if it is not about one
+        uint32_t m_client_id = 0;
+        asio::ip::address m_address = {};
+        asio::error_code m_error = {};
+
+        std::string m_text = "";
+    };
+} // namespace Net
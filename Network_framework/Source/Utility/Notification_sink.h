@@ -0,0 +1,257 @@
+#pragma once
+
+#include "Common.h"
+#include "Mpsc_queue.h"
+#include "Notification.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <syslog.h>
+#define NET_HAS_SYSLOG
+#endif
+
+namespace Net
+{
+    struct Notification_sink_settings
+    {
+        // Notifications are appended to this file, it is created if it does not exist
+        std::filesystem::path m_file_path;
+
+        // Writes to the syslog instead of the file, only on the platforms that have it
+        bool m_use_syslog = false;
+
+        // Notifications waiting for the writer, the ones over this are dropped so the io threads never wait
+        size_t m_queue_capacity = 4096;
+
+        // How often the writer takes the waiting notifications
+        std::chrono::milliseconds m_write_interval = std::chrono::milliseconds(100);
+
+        // Notifications of one code written in one window, the rest are counted and summed up when it ends
+        size_t m_max_per_code = 10;
+        std::chrono::milliseconds m_window = std::chrono::seconds(1);
+    };
+
+    struct Notification_sink_stats
+    {
+        uint64_t m_written = 0;
+
+        // Over the limit of their code in the window
+        uint64_t m_suppressed = 0;
+
+        // Queue was full
+        uint64_t m_dropped = 0;
+    };
+
+    /**
+     *   Writes the notifications to a file or the syslog on its own thread, so a storm of connections doesn't
+     *   stall the update with the writes. The connections queue the notifications to a bounded lock-free queue
+     *   and the writer formats them and writes each batch with one flush. Repeats of a code over the limit of the
+     *   window are only counted, and one line tells how many were left out when the window ends.
+     */
+    class Notification_sink
+    {
+    public:
+        /**
+         *   Opens the file and starts the writer
+         *
+         *   @throws std::system_error if the file could not be opened
+         */
+        explicit Notification_sink(Notification_sink_settings settings)
+            : m_settings(std::move(settings)), m_queue(m_settings.m_queue_capacity)
+        {
+#ifdef NET_HAS_SYSLOG
+            if (m_settings.m_use_syslog)
+                ::openlog("Net", LOG_PID | LOG_NDELAY, LOG_USER);
+            else
+#endif
+                m_file = std::fopen(m_settings.m_file_path.string().c_str(), "a");
+
+            if (m_file == nullptr && !is_using_syslog())
+                throw std::system_error(std::make_error_code(std::errc::io_error), "Notification sink file");
+
+            m_writer = std::thread([this] { write_loop(); });
+        }
+
+        Notification_sink(const Notification_sink&) = delete;
+        Notification_sink(Notification_sink&&) = delete;
+
+        // Writes the waiting notifications and closes the file
+        ~Notification_sink()
+        {
+            m_is_stopping.store(true, std::memory_order_relaxed);
+            m_writer.join();
+
+            if (m_file != nullptr)
+                std::fclose(m_file);
+
+#ifdef NET_HAS_SYSLOG
+            if (m_settings.m_use_syslog)
+                ::closelog();
+#endif
+        }
+
+        Notification_sink& operator=(const Notification_sink&) = delete;
+        Notification_sink& operator=(Notification_sink&&) = delete;
+
+        /**
+         *   Queues the notification for the writer, this can be called from any thread and it does not wait
+         *
+         *   @return false if the notification was dropped because the queue was full
+         */
+        bool push(const Notification& notification)
+        {
+            Entry entry = {.m_notification = notification, .m_time = std::chrono::system_clock::now()};
+
+            if (m_queue.try_push(std::move(entry)) == Push_result::full)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            return true;
+        }
+
+        [[nodiscard]] Notification_sink_stats get_stats() const noexcept
+        {
+            return {
+                .m_written = m_written.load(std::memory_order_relaxed),
+                .m_suppressed = m_suppressed.load(std::memory_order_relaxed),
+                .m_dropped = m_dropped.load(std::memory_order_relaxed)};
+        }
+
+    private:
+        struct Entry
+        {
+            Notification m_notification;
+            std::chrono::system_clock::time_point m_time;
+        };
+
+        // Notifications of one code in the current window
+        struct Code_window
+        {
+            std::chrono::system_clock::time_point m_start;
+            size_t m_written = 0;
+            uint64_t m_suppressed = 0;
+        };
+
+        [[nodiscard]] bool is_using_syslog() const noexcept
+        {
+#ifdef NET_HAS_SYSLOG
+            return m_settings.m_use_syslog;
+#else
+            return false;
+#endif
+        }
+
+        // Waits a write interval between the writes, the producers don't signal so they never take a lock
+        void write_loop()
+        {
+            while (!m_is_stopping.load(std::memory_order_relaxed))
+            {
+                write_notifications();
+                std::this_thread::sleep_for(m_settings.m_write_interval);
+            }
+
+            write_notifications();
+            end_windows(std::nullopt);
+            flush();
+        }
+
+        void write_notifications()
+        {
+            const auto now = std::chrono::system_clock::now();
+            end_windows(now);
+
+            while (std::optional<Entry> entry = m_queue.try_pop())
+            {
+                Code_window& window = m_windows[static_cast<size_t>(entry->m_notification.m_code)];
+
+                if (window.m_written == 0 && window.m_suppressed == 0)
+                    window.m_start = entry->m_time;
+
+                if (window.m_written >= m_settings.m_max_per_code)
+                {
+                    ++window.m_suppressed;
+                    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                ++window.m_written;
+                write_line(entry->m_time, entry->m_notification.m_severity, entry->m_notification.to_string());
+            }
+
+            flush();
+        }
+
+        // Ends the windows that have passed by the time and writes how many of their notifications were left out
+        void end_windows(std::optional<std::chrono::system_clock::time_point> now)
+        {
+            for (size_t i = 0; i < NOTIFICATION_CODE_COUNT; ++i)
+            {
+                Code_window& window = m_windows[i];
+
+                const bool is_empty = window.m_written == 0 && window.m_suppressed == 0;
+
+                if (is_empty || (now && *now - window.m_start < m_settings.m_window))
+                    continue;
+
+                if (window.m_suppressed > 0)
+                    write_line(
+                        now.value_or(std::chrono::system_clock::now()), Severity::notification,
+                        std::format(
+                            "{} more {} notifications were left out", window.m_suppressed,
+                            get_code_name(static_cast<Notification_code>(i))));
+
+                window = Code_window();
+            }
+        }
+
+        void write_line(std::chrono::system_clock::time_point time, Severity severity, const std::string& text)
+        {
+            m_written.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef NET_HAS_SYSLOG
+            if (m_settings.m_use_syslog)
+            {
+                ::syslog(severity == Severity::error ? LOG_ERR : LOG_NOTICE, "%s", text.c_str());
+                return;
+            }
+#endif
+            const std::string line = std::format(
+                "{:%Y-%m-%d %H:%M:%S} {} {}\n", std::chrono::floor<std::chrono::milliseconds>(time),
+                severity == Severity::error ? "error" : "notification", text);
+
+            std::fwrite(line.data(), 1, line.size(), m_file);
+        }
+
+        void flush()
+        {
+            if (m_file != nullptr)
+                std::fflush(m_file);
+        }
+
+        Notification_sink_settings m_settings;
+        Mpsc_queue<Entry> m_queue;
+
+        // Only used by the writer thread after the constructor
+        std::FILE* m_file = nullptr;
+        std::array<Code_window, NOTIFICATION_CODE_COUNT> m_windows = {};
+
+        std::atomic<uint64_t> m_written = 0;
+        std::atomic<uint64_t> m_suppressed = 0;
+        std::atomic<uint64_t> m_dropped = 0;
+
+        std::atomic<bool> m_is_stopping = false;
+        std::thread m_writer;
+    };
+} // namespace Net
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "Mapped_file.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+namespace Net
+{
+    struct Offline_queue_settings
+    {
+        // Segments are written to this directory, it is created if it does not exist
+        std::filesystem::path m_directory;
+
+        // Each segment is mapped whole, the message that does not fit starts the next segment
+        size_t m_segment_size = 64 * 1024 * 1024;
+
+        // Messages of one client over this are dropped, so a client that stays away does not fill the disk
+        size_t m_max_client_bytes = 16 * 1024 * 1024;
+
+        // Messages of all the clients together
+        uint64_t m_max_bytes = 4ull * 1024 * 1024 * 1024;
+    };
+
+    struct Offline_queue_stats
+    {
+        size_t m_clients = 0;
+        uint64_t m_messages = 0;
+        uint64_t m_bytes = 0;
+        uint64_t m_dropped_messages = 0;
+        size_t m_segments = 0;
+    };
+
+    /**
+     *   Keeps the messages sent to the clients while they are offline in memory mapped segment files, so the
+     *   memory does not grow with them. The segments are shared by all the clients and appended to in order,
+     *   each client has only the index of where its messages are. A segment is deleted when all of its
+     *   messages have been taken or dropped. The segments are scratch files for this process, they are not
+     *   flushed and the ones left in the directory by an earlier process are deleted.
+     */
+    class Offline_queue
+    {
+    public:
+        /**
+         *   @throws std::system_error if the directory could not be created
+         */
+        explicit Offline_queue(Offline_queue_settings settings) : m_settings(std::move(settings))
+        {
+            m_settings.m_segment_size = std::max<size_t>(m_settings.m_segment_size, 64 * 1024);
+            std::filesystem::create_directories(m_settings.m_directory);
+
+            for (const std::filesystem::directory_entry& entry :
+                 std::filesystem::directory_iterator(m_settings.m_directory))
+            {
+                const std::string name = entry.path().filename().string();
+
+                if (entry.is_regular_file() && name.starts_with("offline_") && name.ends_with(".bin"))
+                    std::filesystem::remove(entry.path());
+            }
+        }
+
+        Offline_queue(const Offline_queue&) = delete;
+        Offline_queue(Offline_queue&&) = delete;
+
+        ~Offline_queue()
+        {
+            clear();
+        }
+
+        Offline_queue& operator=(const Offline_queue&) = delete;
+        Offline_queue& operator=(Offline_queue&&) = delete;
+
+        // Starts keeping the messages of the client, until they are taken or the client is closed
+        void open_client(uint32_t client_id)
+        {
+            std::lock_guard lock(m_mutex);
+            m_clients.try_emplace(client_id);
+        }
+
+        // Drops the messages of the client and stops keeping them
+        void close_client(uint32_t client_id)
+        {
+            std::lock_guard lock(m_mutex);
+            const auto client = m_clients.find(client_id);
+
+            if (client == m_clients.end())
+                return;
+
+            for (const Record& record : client->second.m_records)
+                release(record);
+
+            m_clients.erase(client);
+        }
+
+        // Drops the messages of all the clients
+        void clear()
+        {
+            std::lock_guard lock(m_mutex);
+
+            for (const auto& [client_id, client] : m_clients)
+                for (const Record& record : client.m_records)
+                    release(record);
+
+            m_clients.clear();
+            m_current_segment.reset();
+
+            while (!m_segments.empty())
+                remove_segment(m_segments.begin());
+        }
+
+        /**
+         *   Keeps the message for the client, this can be called from any thread
+         *
+         *   @return false if the client is not kept, its messages or the queue are full or the segment could
+         *           not be opened
+         */
+        bool append(uint32_t client_id, std::span<const char> header, std::span<const char> body)
+        {
+            std::lock_guard lock(m_mutex);
+            const auto client = m_clients.find(client_id);
+
+            if (client == m_clients.end())
+                return false;
+
+            const size_t size = header.size() + body.size();
+
+            if (client->second.m_bytes + size > m_settings.m_max_client_bytes ||
+                m_bytes + size > m_settings.m_max_bytes || size > m_settings.m_segment_size)
+            {
+                ++m_dropped_messages;
+                return false;
+            }
+
+            Segment* segment = get_segment_with_space(size);
+
+            if (segment == nullptr)
+            {
+                ++m_dropped_messages;
+                return false;
+            }
+
+            const Record record = {
+                .m_segment = *m_current_segment,
+                .m_offset = segment->m_file->get_used_bytes(),
+                .m_header_size = static_cast<uint32_t>(header.size()),
+                .m_body_size = static_cast<uint32_t>(body.size())};
+
+            segment->m_file->append(header);
+            segment->m_file->append(body);
+            ++segment->m_records;
+
+            client->second.m_records.push_back(record);
+            client->second.m_bytes += size;
+            m_bytes += size;
+            ++m_messages;
+            return true;
+        }
+
+        /**
+         *   Takes the messages of the client in the order they were appended and stops keeping them
+         *
+         *   @param called with the std::span<const char> header and body of each message, the spans are valid
+         *          only during the call
+         *   @return the amount of messages
+         */
+        template <typename Callable_type>
+        size_t take(uint32_t client_id, Callable_type&& callable)
+        {
+            std::lock_guard lock(m_mutex);
+            const auto client = m_clients.find(client_id);
+
+            if (client == m_clients.end())
+                return 0;
+
+            for (const Record& record : client->second.m_records)
+            {
+                const Mapped_file& file = *m_segments.at(record.m_segment).m_file;
+
+                callable(
+                    file.read(record.m_offset, record.m_header_size),
+                    file.read(record.m_offset + record.m_header_size, record.m_body_size));
+
+                release(record);
+            }
+
+            const size_t messages = client->second.m_records.size();
+            m_clients.erase(client);
+            return messages;
+        }
+
+        [[nodiscard]] Offline_queue_stats get_stats() const
+        {
+            std::lock_guard lock(m_mutex);
+
+            return {
+                .m_clients = m_clients.size(),
+                .m_messages = m_messages,
+                .m_bytes = m_bytes,
+                .m_dropped_messages = m_dropped_messages,
+                .m_segments = m_segments.size()};
+        }
+
+    private:
+        struct Record
+        {
+            uint64_t m_segment = 0;
+            uint64_t m_offset = 0;
+            uint32_t m_header_size = 0;
+            uint32_t m_body_size = 0;
+        };
+
+        struct Client_queue
+        {
+            std::deque<Record> m_records;
+            size_t m_bytes = 0;
+        };
+
+        struct Segment
+        {
+            std::unique_ptr<Mapped_file> m_file;
+
+            // Messages in the segment that have not been taken or dropped
+            size_t m_records = 0;
+        };
+
+        // @return the segment that is appended to, the next one is opened if the message does not fit
+        Segment* get_segment_with_space(size_t size)
+        {
+            if (m_current_segment)
+            {
+                Segment& segment = m_segments.at(*m_current_segment);
+
+                if (segment.m_file->get_free_bytes() >= size)
+                    return &segment;
+
+                const uint64_t full_segment = *std::exchange(m_current_segment, std::nullopt);
+
+                if (segment.m_records == 0)
+                    remove_segment(m_segments.find(full_segment));
+            }
+
+            auto file = std::make_unique<Mapped_file>();
+
+            if (file->open(get_segment_path(m_next_segment_index), m_settings.m_segment_size))
+                return nullptr;
+
+            m_current_segment = m_next_segment_index++;
+            return &m_segments.emplace(*m_current_segment, Segment{.m_file = std::move(file)}).first->second;
+        }
+
+        // The bytes of the segment are kept until all its messages are released
+        void release(const Record& record)
+        {
+            m_bytes -= static_cast<size_t>(record.m_header_size) + record.m_body_size;
+            --m_messages;
+
+            const auto segment = m_segments.find(record.m_segment);
+
+            // Segment that is appended to is kept even when it is empty
+            if (--segment->second.m_records == 0 && record.m_segment != m_current_segment)
+                remove_segment(segment);
+        }
+
+        void remove_segment(std::map<uint64_t, Segment>::iterator segment)
+        {
+            segment->second.m_file->close();
+
+            std::error_code ignored_error;
+            std::filesystem::remove(get_segment_path(segment->first), ignored_error);
+            m_segments.erase(segment);
+        }
+
+        [[nodiscard]] std::filesystem::path get_segment_path(uint64_t index) const
+        {
+            return m_settings.m_directory / std::format("offline_{:06}.bin", index);
+        }
+
+        Offline_queue_settings m_settings;
+        mutable std::mutex m_mutex;
+
+        std::unordered_map<uint32_t, Client_queue> m_clients;
+        std::map<uint64_t, Segment> m_segments;
+        std::optional<uint64_t> m_current_segment;
+        uint64_t m_next_segment_index = 0;
+
+        uint64_t m_messages = 0;
+        uint64_t m_bytes = 0;
+        uint64_t m_dropped_messages = 0;
+    };
+} // namespace Net
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "Latency_histogram.h"
+#include "Metrics.h"
+#include "Notification.h"
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Writes the metrics in the OpenMetrics text format that Prometheus scrapes.
+     *   Ids of the received messages are labeled with their number, the disconnects with the name of the reason
+     *   and the notifications with their severity.
+     *
+     *   @param the metrics
+     *   @param the receive to dispatch latencies
+     *   @param the send to wire latencies
+     *   @param the wire to dispatch latencies of the stamped messages
+     *   @param the prefix of the metric names
+     *   @return the text ending with the # EOF line
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] std::string to_open_metrics(
+        const Metrics<Id_type>& metrics, const Latency_percentiles& receive_latency,
+        const Latency_percentiles& send_latency, const Latency_percentiles& wire_latency,
+        std::string_view prefix = "net")
+    {
+        std::string text;
+        auto out = std::back_inserter(text);
+
+        auto write_family = [&](std::string_view name, std::string_view type, std::string_view help) {
+            std::format_to(out, "# TYPE {}_{} {}\n# HELP {}_{} {}\n", prefix, name, type, prefix, name, help);
+        };
+
+        auto write_counter = [&](std::string_view name, std::string_view help, uint64_t value) {
+            write_family(name, "counter", help);
+            std::format_to(out, "{}_{}_total {}\n", prefix, name, value);
+        };
+
+        auto write_gauge = [&](std::string_view name, std::string_view help, uint64_t value) {
+            write_family(name, "gauge", help);
+            std::format_to(out, "{}_{} {}\n", prefix, name, value);
+        };
+
+        auto to_seconds = [](auto duration) {
+            return std::chrono::duration<double>(duration).count();
+        };
+
+        auto write_latency = [&](std::string_view name, std::string_view help, const Latency_percentiles& latency) {
+            write_family(name, "summary", help);
+            std::format_to(out, "{}_{}{{quantile=\"0.5\"}} {}\n", prefix, name, to_seconds(latency.m_p50));
+            std::format_to(out, "{}_{}{{quantile=\"0.99\"}} {}\n", prefix, name, to_seconds(latency.m_p99));
+            std::format_to(out, "{}_{}{{quantile=\"0.999\"}} {}\n", prefix, name, to_seconds(latency.m_p999));
+            std::format_to(out, "{}_{}{{quantile=\"1\"}} {}\n", prefix, name, to_seconds(latency.m_max));
+            std::format_to(out, "{}_{}_count {}\n", prefix, name, latency.m_count);
+        };
+
+        const Traffic_metrics& traffic = metrics.m_traffic;
+        write_counter("messages_received", "Received messages.", traffic.m_messages_received);
+        write_counter("received_bytes", "Received bytes with the headers.", traffic.m_bytes_received);
+        write_counter("messages_sent", "Sent messages.", traffic.m_messages_sent);
+        write_counter("sent_bytes", "Sent bytes with the headers.", traffic.m_bytes_sent);
+
+        write_gauge("connections", "Current connections.", metrics.m_connections);
+        write_gauge("in_queue_messages", "Received messages waiting for the update.", metrics.m_in_queue_messages);
+        write_gauge("in_queue_bytes", "Received bytes waiting for the update.", metrics.m_in_queue_bytes);
+        write_gauge("out_queue_messages", "Messages waiting in the write queues.", metrics.m_out_queue_messages);
+        write_gauge("out_queue_bytes", "Bytes waiting in the write queues.", metrics.m_out_queue_bytes);
+        write_gauge("memory_bytes", "Bytes of the queues and the socket buffers.", metrics.m_memory_bytes);
+
+        write_family("io_lag_seconds", "gauge", "Largest lag of the Asio threads.");
+        std::format_to(out, "{}_io_lag_seconds {}\n", prefix, to_seconds(metrics.m_io_lag));
+        write_gauge("overloaded", "1 if the overload settings count this as overloaded.", metrics.m_is_overloaded);
+        write_counter("shed_messages", "Received messages dropped because of the overload.", metrics.m_shed_messages);
+
+        write_counter("handshakes", "Finished handshakes.", metrics.m_handshakes);
+        write_family("handshake_duration_seconds", "counter", "Time spent in the finished handshakes.");
+        std::format_to(
+            out, "{}_handshake_duration_seconds_total {}\n", prefix, to_seconds(metrics.m_handshake_duration));
+
+        write_family("received_messages_by_id", "counter", "Received messages of each id.");
+
+        for (const auto& [id, count] : metrics.m_received_messages_by_id)
+        {
+            // Promoted so the char sized ids are written as numbers
+            const auto id_value = +static_cast<std::underlying_type_t<Id_type>>(id);
+            std::format_to(out, "{}_received_messages_by_id_total{{id=\"{}\"}} {}\n", prefix, id_value, count);
+        }
+
+        write_family("disconnects", "counter", "Disconnects by the reason, disconnected means closed by this side.");
+
+        for (size_t i = 0; i < NOTIFICATION_CODE_COUNT; ++i)
+        {
+            if (metrics.m_disconnects[i] == 0)
+                continue;
+
+            const std::string_view reason = get_code_name(static_cast<Notification_code>(i));
+            std::format_to(out, "{}_disconnects_total{{reason=\"{}\"}} {}\n", prefix, reason, metrics.m_disconnects[i]);
+        }
+
+        write_family("notifications", "counter", "Notifications by the severity.");
+
+        for (size_t i = 0; i < SEVERITY_COUNT; ++i)
+        {
+            const std::string_view severity = static_cast<Severity>(i) == Severity::error ? "error" : "notification";
+            std::format_to(
+                out, "{}_notifications_total{{severity=\"{}\"}} {}\n", prefix, severity, metrics.m_notifications[i]);
+        }
+
+        write_family("lock_acquisitions", "counter", "Times the lock was taken.");
+
+        for (const auto& [name, lock] : metrics.m_locks)
+            std::format_to(out, "{}_lock_acquisitions_total{{lock=\"{}\"}} {}\n", prefix, name, lock.m_acquisitions);
+
+        write_family("lock_contentions", "counter", "Times the lock was held by another thread.");
+
+        for (const auto& [name, lock] : metrics.m_locks)
+            std::format_to(out, "{}_lock_contentions_total{{lock=\"{}\"}} {}\n", prefix, name, lock.m_contended);
+
+        write_family("lock_wait_seconds", "counter", "Time spent waiting for the lock.");
+
+        for (const auto& [name, lock] : metrics.m_locks)
+            std::format_to(
+                out, "{}_lock_wait_seconds_total{{lock=\"{}\"}} {}\n", prefix, name, to_seconds(lock.m_wait_time));
+
+        write_family("handler_seconds", "summary", "Sampled execution time of the handlers of each id.");
+
+        for (const Handler_metrics<Id_type>& handler : metrics.m_handler_times)
+        {
+            const auto id_value = +static_cast<std::underlying_type_t<Id_type>>(handler.m_id);
+            const Latency_percentiles& durations = handler.m_durations;
+
+            std::format_to(
+                out, "{}_handler_seconds{{id=\"{}\",quantile=\"0.5\"}} {}\n", prefix, id_value,
+                to_seconds(durations.m_p50));
+            std::format_to(
+                out, "{}_handler_seconds{{id=\"{}\",quantile=\"0.99\"}} {}\n", prefix, id_value,
+                to_seconds(durations.m_p99));
+            std::format_to(
+                out, "{}_handler_seconds{{id=\"{}\",quantile=\"1\"}} {}\n", prefix, id_value,
+                to_seconds(durations.m_max));
+            std::format_to(out, "{}_handler_seconds_count{{id=\"{}\"}} {}\n", prefix, id_value, handler.m_samples);
+        }
+
+        write_family(
+            "handler_estimated_seconds", "counter", "Sampled handler time scaled to all the calls of each id.");
+
+        for (const Handler_metrics<Id_type>& handler : metrics.m_handler_times)
+        {
+            const auto id_value = +static_cast<std::underlying_type_t<Id_type>>(handler.m_id);
+            std::format_to(
+                out, "{}_handler_estimated_seconds_total{{id=\"{}\"}} {}\n", prefix, id_value,
+                to_seconds(handler.m_estimated_total_time));
+        }
+
+        write_latency("receive_latency_seconds", "Time the received messages waited for the update.", receive_latency);
+        write_latency("send_latency_seconds", "Time the sent messages waited to be written.", send_latency);
+        write_latency(
+            "wire_latency_seconds", "Time from the kernel receiving the messages to the update.", wire_latency);
+
+        text += "# EOF\n";
+        return text;
+    }
+} // namespace Net
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Places the keys on the nodes with the rendezvous hashing. Every node gets a score from the hash of the key
+     *   and its id and the key goes to the node with the highest score, so adding or removing a node only moves
+     *   the keys that the node wins or had. The scores depend only on the key and the nodes, so the servers that
+     *   have the same nodes agree on the placement without talking to each other.
+     */
+    class Rendezvous_hash
+    {
+    public:
+        /**
+         *   Adds the node or changes its weight
+         *
+         *   @param the id of the node
+         *   @param node with twice the weight gets about twice the keys, values that are not positive are ignored
+         */
+        void add_node(uint32_t node_id, double weight = 1.0)
+        {
+            if (!(weight > 0.0) || !std::isfinite(weight))
+                return;
+
+            const auto node = find_node(node_id);
+
+            if (node != m_nodes.end())
+                node->m_weight = weight;
+            else
+                m_nodes.push_back({.m_id = node_id, .m_weight = weight});
+        }
+
+        void remove_node(uint32_t node_id)
+        {
+            const auto node = find_node(node_id);
+
+            if (node != m_nodes.end())
+                m_nodes.erase(node);
+        }
+
+        [[nodiscard]] bool contains(uint32_t node_id) const
+        {
+            return std::ranges::any_of(m_nodes, [node_id](const Node& node) { return node.m_id == node_id; });
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_nodes.size();
+        }
+
+        // @return the node of the key or nothing if there are no nodes
+        [[nodiscard]] std::optional<uint32_t> find(uint64_t key) const noexcept
+        {
+            std::optional<uint32_t> best_node;
+            double best_score = -std::numeric_limits<double>::infinity();
+
+            for (const Node& node : m_nodes)
+            {
+                const double score = get_score(key, node);
+
+                // Ties go to the smaller id so the order of adding the nodes does not matter
+                if (score > best_score || (score == best_score && node.m_id < *best_node))
+                {
+                    best_score = score;
+                    best_node = node.m_id;
+                }
+            }
+
+            return best_node;
+        }
+
+        // Strings are hashed with the FNV-1a, it is the same on every platform unlike the std::hash
+        [[nodiscard]] std::optional<uint32_t> find(std::string_view key) const noexcept
+        {
+            return find(hash_key(key));
+        }
+
+        [[nodiscard]] static uint64_t hash_key(std::string_view key) noexcept
+        {
+            uint64_t hash = 0xCBF29CE484222325;
+
+            for (const char byte : key)
+            {
+                hash ^= static_cast<uint8_t>(byte);
+                hash *= 0x100000001B3;
+            }
+
+            return hash;
+        }
+
+    private:
+        struct Node
+        {
+            uint32_t m_id = 0;
+            double m_weight = 1.0;
+        };
+
+        [[nodiscard]] std::vector<Node>::iterator find_node(uint32_t node_id)
+        {
+            return std::ranges::find(m_nodes, node_id, &Node::m_id);
+        }
+
+        // Finalizer of the splitmix64, every bit of the input affects every bit of the output
+        [[nodiscard]] static uint64_t mix(uint64_t value) noexcept
+        {
+            value ^= value >> 30;
+            value *= 0xBF58476D1CE4E5B9;
+            value ^= value >> 27;
+            value *= 0x94D049BB133111EB;
+            value ^= value >> 31;
+            return value;
+        }
+
+        /**
+         *   Weighted score -weight / ln(u) where u is the hash as a number between 0 and 1, so the chance
+         *   of a node to win is its share of the total weight
+         */
+        [[nodiscard]] static double get_score(uint64_t key, const Node& node) noexcept
+        {
+            const uint64_t hash = mix(key ^ mix(node.m_id + 0x9E3779B97F4A7C15));
+
+            // Top 53 bits fit the double exactly, the half keeps the value above 0 and below 1
+            const double unit = (static_cast<double>(hash >> 11) + 0.5) / static_cast<double>(uint64_t(1) << 53);
+            return -node.m_weight / std::log(unit);
+        }
+
+        std::vector<Node> m_nodes;
+    };
+} // namespace Net
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Net
+{
+    // Address that the client connects to, for example when the server redirects it to another node
+    struct Server_address
+    {
+        // Longest host and port that a redirect carries, a dns name is atmost 253 characters
+        static constexpr size_t MAX_HOST_SIZE = 255;
+        static constexpr size_t MAX_PORT_SIZE = 32;
+
+        std::string m_host;
+        std::string m_port;
+
+        bool operator==(const Server_address&) const = default;
+    };
+} // namespace Net
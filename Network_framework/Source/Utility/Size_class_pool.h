@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Memory resource that keeps freed blocks in power of two size classes and gives them back on the next
+     *   allocation of the same class. Blocks can be allocated and freed from any thread.
+     *   Allocations larger than MAX_BLOCK_SIZE go straight to the upstream resource.
+     */
+    class Size_class_pool : public std::pmr::memory_resource
+    {
+    public:
+        static constexpr size_t MIN_BLOCK_SIZE = 64;
+        static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+        /**
+         *   @param the max amount of free blocks kept for each size class, rest are returned to the upstream
+         *   @param the resource where the blocks are allocated from
+         */
+        explicit Size_class_pool(
+            size_t max_cached_blocks = 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+            : m_max_cached_blocks(max_cached_blocks), m_upstream(upstream)
+        {
+            // Reserving up front so returning a block never allocates
+            for (Bucket& bucket : m_buckets)
+            {
+                bucket.m_max_blocks = m_max_cached_blocks;
+                bucket.m_free_blocks.reserve(m_max_cached_blocks);
+            }
+        }
+
+        Size_class_pool(const Size_class_pool&) = delete;
+        Size_class_pool(Size_class_pool&&) = delete;
+
+        ~Size_class_pool() override
+        {
+            for (size_t i = 0; i < BUCKET_COUNT; ++i)
+                for (void* block : m_buckets[i].m_free_blocks)
+                    m_upstream->deallocate(block, block_size(i), BLOCK_ALIGNMENT);
+        }
+
+        Size_class_pool& operator=(const Size_class_pool&) = delete;
+        Size_class_pool& operator=(Size_class_pool&&) = delete;
+
+        /**
+         *   Fills the size class with free blocks so a burst of allocations does not reach the upstream. The
+         *   class keeps atleast this many free blocks from now on.
+         *
+         *   @param the size of the allocations, nothing is done for the sizes over the MAX_BLOCK_SIZE
+         *   @param how many free blocks the class should have
+         *   @param should the blocks be written once, so their pages are mapped now instead of on the first use
+         */
+        void prewarm(size_t bytes, size_t block_count, bool fault_in)
+        {
+            if (!is_pooled(bytes, BLOCK_ALIGNMENT))
+                return;
+
+            const size_t index = bucket_index(bytes);
+            Bucket& bucket = m_buckets[index];
+            std::scoped_lock lock(bucket.m_mutex);
+
+            bucket.m_max_blocks = std::max(bucket.m_max_blocks, block_count);
+            bucket.m_free_blocks.reserve(bucket.m_max_blocks);
+
+            while (bucket.m_free_blocks.size() < block_count)
+            {
+                void* block = m_upstream->allocate(block_size(index), BLOCK_ALIGNMENT);
+
+                if (fault_in)
+                    std::memset(block, 0, block_size(index));
+
+                bucket.m_free_blocks.push_back(block);
+            }
+        }
+
+    private:
+        static constexpr size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+        static constexpr size_t BUCKET_COUNT = std::bit_width(MAX_BLOCK_SIZE) - std::bit_width(MIN_BLOCK_SIZE) + 1;
+
+        struct Bucket
+        {
+            std::mutex m_mutex;
+            std::vector<void*> m_free_blocks;
+            size_t m_max_blocks = 0;
+        };
+
+        [[nodiscard]] static bool is_pooled(size_t bytes, size_t alignment) noexcept
+        {
+            return bytes <= MAX_BLOCK_SIZE && alignment <= BLOCK_ALIGNMENT;
+        }
+
+        [[nodiscard]] static size_t bucket_index(size_t bytes) noexcept
+        {
+            const size_t size = std::bit_ceil(std::max(bytes, MIN_BLOCK_SIZE));
+            return std::bit_width(size) - std::bit_width(MIN_BLOCK_SIZE);
+        }
+
+        [[nodiscard]] static size_t block_size(size_t index) noexcept
+        {
+            return MIN_BLOCK_SIZE << index;
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            if (!is_pooled(bytes, alignment))
+                return m_upstream->allocate(bytes, alignment);
+
+            const size_t index = bucket_index(bytes);
+            Bucket& bucket = m_buckets[index];
+
+            {
+                std::scoped_lock lock(bucket.m_mutex);
+
+                if (!bucket.m_free_blocks.empty())
+                {
+                    void* block = bucket.m_free_blocks.back();
+                    bucket.m_free_blocks.pop_back();
+                    return block;
+                }
+            }
+
+            return m_upstream->allocate(block_size(index), BLOCK_ALIGNMENT);
+        }
+
+        void do_deallocate(void* block, size_t bytes, size_t alignment) override
+        {
+            if (!is_pooled(bytes, alignment))
+            {
+                m_upstream->deallocate(block, bytes, alignment);
+                return;
+            }
+
+            const size_t index = bucket_index(bytes);
+            Bucket& bucket = m_buckets[index];
+
+            {
+                std::scoped_lock lock(bucket.m_mutex);
+
+                if (bucket.m_free_blocks.size() < bucket.m_max_blocks)
+                {
+                    bucket.m_free_blocks.push_back(block);
+                    return;
+                }
+            }
+
+            m_upstream->deallocate(block, block_size(index), BLOCK_ALIGNMENT);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        const size_t m_max_cached_blocks;
+        std::pmr::memory_resource* m_upstream;
+        std::array<Bucket, BUCKET_COUNT> m_buckets;
+    };
+} // namespace Net
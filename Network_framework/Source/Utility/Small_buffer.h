@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+
+namespace Net
+{
+    /**
+     *   Byte buffer that stores up to Inline_capacity bytes inside the object and only allocates from
+     *   the memory resource when it grows larger than that. It can also borrow bytes that another owner keeps
+     *   alive, those are copied to the own memory of the buffer only when it grows.
+     */
+    template <size_t Inline_capacity>
+    class Small_buffer
+    {
+    public:
+        explicit Small_buffer(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+            : m_resource(resource)
+        {
+        }
+
+        // Copy uses the same memory resource as the copied buffer
+        Small_buffer(const Small_buffer& other) : m_resource(other.m_resource)
+        {
+            assign(other.data(), other.size());
+        }
+
+        Small_buffer(Small_buffer&& other) noexcept : m_resource(other.m_resource)
+        {
+            take(other);
+        }
+
+        ~Small_buffer()
+        {
+            release();
+        }
+
+        Small_buffer& operator=(const Small_buffer& other)
+        {
+            if (this != &other)
+                assign(other.data(), other.size());
+
+            return *this;
+        }
+
+        // The buffer is moved with its memory resource so the allocation can always be taken over
+        Small_buffer& operator=(Small_buffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                m_resource = other.m_resource;
+                take(other);
+            }
+
+            return *this;
+        }
+
+        [[nodiscard]] bool operator==(const Small_buffer& other) const noexcept
+        {
+            return m_size == other.m_size && (m_size == 0 || std::memcmp(m_data, other.m_data, m_size) == 0);
+        }
+
+        [[nodiscard]] char* data() noexcept
+        {
+            return m_data;
+        }
+
+        [[nodiscard]] const char* data() const noexcept
+        {
+            return m_data;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        [[nodiscard]] size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+        [[nodiscard]] std::pmr::memory_resource* get_resource() const noexcept
+        {
+            return m_resource;
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        [[nodiscard]] bool is_inline() const noexcept
+        {
+            return m_data == m_inline.data();
+        }
+
+        [[nodiscard]] bool is_borrowed() const noexcept
+        {
+            return m_owner != nullptr;
+        }
+
+        // Keeps the capacity so the buffer can be reused without allocating, borrowed bytes are given back
+        void clear() noexcept
+        {
+            m_size = 0;
+
+            if (is_borrowed())
+                release();
+        }
+
+        /**
+         *   Refers to the bytes instead of copying them. The bytes can be changed in place because no other buffer
+         *   refers to them, they are released with the owner when the buffer grows, is cleared or destroyed.
+         *
+         *   @param keeps the bytes alive
+         *   @param the borrowed bytes
+         *   @param amount of the borrowed bytes
+         */
+        void borrow(std::shared_ptr<const void> owner, char* data, size_t size) noexcept
+        {
+            release();
+            m_owner = std::move(owner);
+            m_data = data;
+            m_size = size;
+            m_capacity = size;
+        }
+
+        // New bytes are set to zero
+        void resize(size_t new_size)
+        {
+            if (new_size > m_capacity)
+                grow(std::max(new_size, m_capacity * 2));
+
+            if (new_size > m_size)
+                std::memset(m_data + m_size, 0, new_size - m_size);
+
+            m_size = new_size;
+        }
+
+        // Copies the bytes to the end without zeroing them first
+        void append(const void* source, size_t size)
+        {
+            if (size == 0)
+                return;
+
+            if (m_size + size > m_capacity)
+                grow(std::max(m_size + size, m_capacity * 2));
+
+            std::memcpy(m_data + m_size, source, size);
+            m_size += size;
+        }
+
+        void reserve(size_t new_capacity)
+        {
+            if (new_capacity > m_capacity)
+                grow(new_capacity);
+        }
+
+    private:
+        static constexpr size_t HEAP_ALIGNMENT = alignof(std::max_align_t);
+
+        void assign(const char* source, size_t size)
+        {
+            if (size > m_capacity)
+                grow(size);
+
+            if (size > 0)
+                std::memcpy(m_data, source, size);
+
+            m_size = size;
+        }
+
+        void grow(size_t new_capacity)
+        {
+            char* new_data = static_cast<char*>(m_resource->allocate(new_capacity, HEAP_ALIGNMENT));
+
+            if (m_size > 0)
+                std::memcpy(new_data, m_data, m_size);
+
+            release();
+            m_data = new_data;
+            m_capacity = new_capacity;
+        }
+
+        void release() noexcept
+        {
+            if (is_borrowed())
+                m_owner.reset();
+            else if (!is_inline())
+                m_resource->deallocate(m_data, m_capacity, HEAP_ALIGNMENT);
+
+            m_data = m_inline.data();
+            m_capacity = Inline_capacity;
+        }
+
+        // Takes the content of the other buffer and leaves it empty, m_resource has to be already set to its resource
+        void take(Small_buffer& other) noexcept
+        {
+            if (other.is_inline())
+            {
+                if (other.m_size > 0)
+                    std::memcpy(m_data, other.m_data, other.m_size);
+            }
+            else
+            {
+                m_owner = std::move(other.m_owner);
+                m_data = other.m_data;
+                m_capacity = other.m_capacity;
+
+                other.m_data = other.m_inline.data();
+                other.m_capacity = Inline_capacity;
+            }
+
+            m_size = other.m_size;
+            other.m_size = 0;
+        }
+
+        std::pmr::memory_resource* m_resource;
+
+        // Keeps the borrowed bytes alive, the bytes are not deallocated from the m_resource when this is set
+        std::shared_ptr<const void> m_owner;
+
+        // Left uninitialized because only the first m_size bytes are ever read
+        alignas(std::max_align_t) std::array<char, Inline_capacity> m_inline;
+        char* m_data = m_inline.data();
+        size_t m_size = 0;
+        size_t m_capacity = Inline_capacity;
+    };
+} // namespace Net
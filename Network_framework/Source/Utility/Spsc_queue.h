@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Mpsc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+
+namespace Net
+{
+    /**
+     *   Bounded lock-free queue for one producer and one consumer.
+     *   Each position is written only by its own side and each side keeps a copy of the position of the other
+     *   side, so a push or a pop reads the cache line of the other side only when the copy says full or empty.
+     */
+    template <typename T>
+    class Spsc_queue
+    {
+    public:
+        // @param the capacity which is rounded up to power of two
+        explicit Spsc_queue(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_capacity - 1),
+              m_slots(std::make_unique<Slot[]>(m_capacity))
+        {
+        }
+
+        Spsc_queue(const Spsc_queue&) = delete;
+        Spsc_queue(Spsc_queue&&) = delete;
+
+        ~Spsc_queue()
+        {
+            while (try_pop().has_value())
+            {
+            }
+        }
+
+        Spsc_queue& operator=(const Spsc_queue&) = delete;
+        Spsc_queue& operator=(Spsc_queue&&) = delete;
+
+        /**
+         *   This should only be called by the producer
+         *
+         *   @param the item which is moved from only if the push succeeds
+         *   @return full if there was no room for the item
+         */
+        Push_result try_push(T&& item)
+        {
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail - m_cached_head == m_capacity)
+            {
+                m_cached_head = m_head.load(std::memory_order_acquire);
+
+                if (tail - m_cached_head == m_capacity)
+                    return Push_result::full;
+            }
+
+            new (m_slots[tail & m_mask].m_storage) T(std::move(item));
+
+            // Sequentially consistent with the empty of the consumer, so either the consumer sees the item before
+            // it waits or this sees that the consumer had taken everything and may be waiting
+            m_tail.store(tail + 1, std::memory_order_seq_cst);
+            m_cached_head = m_head.load(std::memory_order_seq_cst);
+
+            return m_cached_head == tail ? Push_result::pushed_to_empty : Push_result::pushed;
+        }
+
+        // This should only be called by the consumer
+        [[nodiscard]] std::optional<T> try_pop()
+        {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+
+            if (head == m_cached_tail)
+            {
+                m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+                if (head == m_cached_tail)
+                    return std::nullopt;
+            }
+
+            T* item = std::launder(reinterpret_cast<T*>(m_slots[head & m_mask].m_storage));
+            std::optional<T> output(std::move(*item));
+            item->~T();
+
+            m_head.store(head + 1, std::memory_order_seq_cst);
+            return output;
+        }
+
+        // This should only be called by the consumer
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_seq_cst);
+        }
+
+        [[nodiscard]] size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+    private:
+        struct Slot
+        {
+            alignas(T) std::byte m_storage[sizeof(T)];
+        };
+
+        // Keeps the producer and the consumer positions on different cache lines
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        const size_t m_capacity;
+        const size_t m_mask;
+        std::unique_ptr<Slot[]> m_slots;
+
+        // Written by the producer
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail = 0;
+        size_t m_cached_head = 0;
+
+        // Written by the consumer
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head = 0;
+        size_t m_cached_tail = 0;
+    };
+} // namespace Net
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Common.h"
+#include <cstdint>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Net
+{
+    /**
+     *   Pins the calling thread to the cpu so the scheduler never moves it to another core
+     *
+     *   @param index of the logical cpu
+     *   @return false if the cpu is not available for this process or the platform does not support pinning
+     */
+    inline bool pin_current_thread(uint32_t cpu) noexcept
+    {
+#if defined(_WIN32)
+        // Windows numbers the cpus inside groups of at most 64
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = static_cast<WORD>(cpu / 64);
+        affinity.Mask = KAFFINITY(1) << (cpu % 64);
+
+        return ::SetThreadGroupAffinity(::GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+        if (cpu >= CPU_SETSIZE)
+            return false;
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        return ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+        static_cast<void>(cpu);
+        return false;
+#endif
+    }
+
+    // @return the NUMA node of the cpu that runs the calling thread, 0 if it is not known
+    [[nodiscard]] inline uint32_t get_current_numa_node() noexcept
+    {
+#if defined(_WIN32)
+        PROCESSOR_NUMBER processor = {};
+        ::GetCurrentProcessorNumberEx(&processor);
+
+        USHORT node = 0;
+        return ::GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+#elif defined(__linux__) && defined(SYS_getcpu)
+        unsigned cpu = 0;
+        unsigned node = 0;
+        return ::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? node : 0;
+#else
+        return 0;
+#endif
+    }
+} // namespace Net
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Memory resource owned by one thread, so the owner allocates and frees its blocks without any locking or
+     *   atomics. Blocks freed on the other threads, like the bodies of the messages received on an Asio thread
+     *   and handled on the update thread, are collected to a batch on the freeing thread and the batch is pushed
+     *   to the lock-free remote list of the owner with one atomic operation. The owner takes the whole remote
+     *   list when its own free blocks run out. A freeing thread holds atmost one batch, so a few blocks can
+     *   wait in it until that thread frees again, calls the flush_remote_frees or exits.
+     *
+     *   Pools are never destroyed so the blocks freed after their thread has exited still have a pool to return
+     *   to, the pool of an exited thread is taken over by the next new thread. Allocations larger than the
+     *   MAX_BLOCK_SIZE go straight to the upstream resource.
+     */
+    class Thread_local_pool : public std::pmr::memory_resource
+    {
+    public:
+        static constexpr size_t MIN_BLOCK_SIZE = 64;
+        static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+        // Blocks of the same owner that a freeing thread collects before pushing them to the owner
+        static constexpr size_t REMOTE_BATCH_SIZE = 32;
+
+        Thread_local_pool(const Thread_local_pool&) = delete;
+        Thread_local_pool(Thread_local_pool&&) = delete;
+        Thread_local_pool& operator=(const Thread_local_pool&) = delete;
+        Thread_local_pool& operator=(Thread_local_pool&&) = delete;
+
+        /**
+         *   @param the resource where the blocks are allocated from, only used if the thread had no pool yet
+         *   @param the max amount of free blocks kept for each size class, rest are returned to the upstream
+         *   @return the pool of the calling thread
+         */
+        [[nodiscard]] static Thread_local_pool& get_for_thread(
+            std::pmr::memory_resource* upstream = std::pmr::new_delete_resource(), size_t max_cached_blocks = 1024)
+        {
+            Owner_handle& handle = get_owner_handle();
+
+            if (handle.m_pool == nullptr)
+                handle.m_pool = adopt_pool(upstream, max_cached_blocks);
+
+            return *handle.m_pool;
+        }
+
+        // Pushes the blocks that the calling thread has collected for the other pools, for threads about to idle
+        static void flush_remote_frees() noexcept
+        {
+            get_remote_batch().flush();
+        }
+
+    private:
+        static constexpr size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+        static constexpr size_t BUCKET_COUNT = std::bit_width(MAX_BLOCK_SIZE) - std::bit_width(MIN_BLOCK_SIZE) + 1;
+
+        // Written over the freed block
+        struct Free_block
+        {
+            Free_block* m_next = nullptr;
+            size_t m_bucket = 0;
+        };
+
+        static_assert(sizeof(Free_block) <= MIN_BLOCK_SIZE);
+
+        struct Bucket
+        {
+            Free_block* m_head = nullptr;
+            size_t m_count = 0;
+        };
+
+        // Blocks that the thread has freed for another pool
+        struct Remote_batch
+        {
+            ~Remote_batch()
+            {
+                flush();
+            }
+
+            void flush() noexcept
+            {
+                if (m_head == nullptr)
+                    return;
+
+                Free_block* head = m_pool->m_remote_frees.load(std::memory_order_relaxed);
+
+                do
+                    m_tail->m_next = head;
+                while (!m_pool->m_remote_frees.compare_exchange_weak(
+                    head, m_head, std::memory_order_release, std::memory_order_relaxed));
+
+                m_head = nullptr;
+                m_tail = nullptr;
+                m_count = 0;
+            }
+
+            Thread_local_pool* m_pool = nullptr;
+            Free_block* m_head = nullptr;
+            Free_block* m_tail = nullptr;
+            size_t m_count = 0;
+        };
+
+        // Gives the pool to the next new thread when its owner exits
+        struct Owner_handle
+        {
+            ~Owner_handle()
+            {
+                if (m_pool == nullptr)
+                    return;
+
+                get_remote_batch().flush();
+
+                std::scoped_lock lock(get_orphan_mutex());
+                get_orphan_pools().push_back(m_pool);
+            }
+
+            Thread_local_pool* m_pool = nullptr;
+        };
+
+        Thread_local_pool(std::pmr::memory_resource* upstream, size_t max_cached_blocks) noexcept
+            : m_upstream(upstream), m_max_cached_blocks(max_cached_blocks)
+        {
+        }
+
+        [[nodiscard]] static Owner_handle& get_owner_handle() noexcept
+        {
+            static thread_local Owner_handle handle;
+            return handle;
+        }
+
+        [[nodiscard]] static Remote_batch& get_remote_batch() noexcept
+        {
+            static thread_local Remote_batch batch;
+            return batch;
+        }
+
+        [[nodiscard]] static std::mutex& get_orphan_mutex() noexcept
+        {
+            static std::mutex* const mutex = new std::mutex();
+            return *mutex;
+        }
+
+        [[nodiscard]] static std::vector<Thread_local_pool*>& get_orphan_pools() noexcept
+        {
+            static std::vector<Thread_local_pool*>* const pools = new std::vector<Thread_local_pool*>();
+            return *pools;
+        }
+
+        [[nodiscard]] static Thread_local_pool* adopt_pool(
+            std::pmr::memory_resource* upstream, size_t max_cached_blocks)
+        {
+            {
+                std::scoped_lock lock(get_orphan_mutex());
+                std::vector<Thread_local_pool*>& orphans = get_orphan_pools();
+
+                if (!orphans.empty())
+                {
+                    Thread_local_pool* pool = orphans.back();
+                    orphans.pop_back();
+                    return pool;
+                }
+            }
+
+            return new Thread_local_pool(upstream, max_cached_blocks);
+        }
+
+        [[nodiscard]] static bool is_pooled(size_t bytes, size_t alignment) noexcept
+        {
+            return bytes <= MAX_BLOCK_SIZE && alignment <= BLOCK_ALIGNMENT;
+        }
+
+        [[nodiscard]] static size_t bucket_index(size_t bytes) noexcept
+        {
+            const size_t size = std::bit_ceil(std::max(bytes, MIN_BLOCK_SIZE));
+            return std::bit_width(size) - std::bit_width(MIN_BLOCK_SIZE);
+        }
+
+        [[nodiscard]] static size_t block_size(size_t index) noexcept
+        {
+            return MIN_BLOCK_SIZE << index;
+        }
+
+        [[nodiscard]] bool is_owner() const noexcept
+        {
+            return get_owner_handle().m_pool == this;
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            if (!is_pooled(bytes, alignment))
+                return m_upstream->allocate(bytes, alignment);
+
+            const size_t index = bucket_index(bytes);
+
+            // Another thread can grow a body that was moved to it, its block is pooled when it comes back
+            if (!is_owner())
+                return m_upstream->allocate(block_size(index), BLOCK_ALIGNMENT);
+
+            Bucket& bucket = m_buckets[index];
+
+            if (bucket.m_head == nullptr)
+                take_remote_frees();
+
+            if (Free_block* block = bucket.m_head)
+            {
+                bucket.m_head = block->m_next;
+                --bucket.m_count;
+                return block;
+            }
+
+            return m_upstream->allocate(block_size(index), BLOCK_ALIGNMENT);
+        }
+
+        void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+        {
+            if (!is_pooled(bytes, alignment))
+            {
+                m_upstream->deallocate(pointer, bytes, alignment);
+                return;
+            }
+
+            const size_t index = bucket_index(bytes);
+            Free_block* block = ::new (pointer) Free_block{.m_next = nullptr, .m_bucket = index};
+
+            if (is_owner())
+            {
+                push_free(block);
+                return;
+            }
+
+            Remote_batch& batch = get_remote_batch();
+
+            if (batch.m_pool != this)
+            {
+                batch.flush();
+                batch.m_pool = this;
+            }
+
+            block->m_next = batch.m_head;
+            batch.m_head = block;
+
+            if (batch.m_tail == nullptr)
+                batch.m_tail = block;
+
+            if (++batch.m_count >= REMOTE_BATCH_SIZE)
+                batch.flush();
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        // Moves the blocks that the other threads have returned to the buckets
+        void take_remote_frees() noexcept
+        {
+            Free_block* block = m_remote_frees.exchange(nullptr, std::memory_order_acquire);
+
+            while (block != nullptr)
+                push_free(std::exchange(block, block->m_next));
+        }
+
+        void push_free(Free_block* block) noexcept
+        {
+            Bucket& bucket = m_buckets[block->m_bucket];
+
+            if (bucket.m_count >= m_max_cached_blocks)
+            {
+                m_upstream->deallocate(block, block_size(block->m_bucket), BLOCK_ALIGNMENT);
+                return;
+            }
+
+            block->m_next = bucket.m_head;
+            bucket.m_head = block;
+            ++bucket.m_count;
+        }
+
+        std::pmr::memory_resource* const m_upstream;
+        const size_t m_max_cached_blocks;
+
+        // Only used by the owner
+        std::array<Bucket, BUCKET_COUNT> m_buckets = {};
+
+        // Own cache line so the freeing threads don't bounce the buckets of the owner
+        alignas(64) std::atomic<Free_block*> m_remote_frees = nullptr;
+    };
+} // namespace Net
@@ -1,10 +1,16 @@
 #pragma once
 
+#include "Instrumented_mutex.h"
+#include <atomic>
 #include <deque>
 #include <mutex>
 
 namespace Net
 {
+    /**
+     *   Deque that locks for every operation, except the empty and size that read the size kept beside the deque.
+     *   The lock counts its contention, see the get_lock_metrics.
+     */
     template <typename T>
     class Thread_safe_deque
     {
@@ -35,19 +41,20 @@ namespace Net
         void push_front(T item)
         {
             std::scoped_lock lock(m_mutex);
-            return m_queue.push_front(std::move(item));
+            m_queue.push_front(std::move(item));
+            update_size();
         }
 
         void push_back(T item)
         {
             std::scoped_lock lock(m_mutex);
-            return m_queue.push_back(std::move(item));
+            m_queue.push_back(std::move(item));
+            update_size();
         }
 
-        [[nodiscard]] bool empty()
+        [[nodiscard]] bool empty() const noexcept
         {
-            std::scoped_lock lock(m_mutex);
-            return m_queue.empty();
+            return size() == 0;
         }
 
         template <typename... Argtypes>
@@ -55,18 +62,19 @@ namespace Net
         {
             std::scoped_lock lock(m_mutex);
             m_queue.erase(args...);
+            update_size();
         }
 
-        [[nodiscard]] size_t size()
+        [[nodiscard]] size_t size() const noexcept
         {
-            std::scoped_lock lock(m_mutex);
-            return m_queue.size();
+            return m_size.load(std::memory_order_acquire);
         }
 
         void clear()
         {
             std::scoped_lock lock(m_mutex);
-            return m_queue.clear();
+            m_queue.clear();
+            update_size();
         }
 
         T pop_front()
@@ -74,6 +82,7 @@ namespace Net
             std::scoped_lock lock(m_mutex);
             auto temp = std::move(m_queue.front());
             m_queue.pop_front();
+            update_size();
             return temp;
         }
 
@@ -82,11 +91,25 @@ namespace Net
             std::scoped_lock lock(m_mutex);
             auto temp = std::move(m_queue.back());
             m_queue.pop_back();
+            update_size();
             return temp;
         }
 
+        // @return how often the lock was taken and waited, this can be called from any thread
+        [[nodiscard]] Lock_metrics get_lock_metrics() const noexcept
+        {
+            return m_mutex.get_metrics();
+        }
+
     private:
-        std::mutex m_mutex;
+        // Called with the lock after every change so the size is never newer than the deque
+        void update_size() noexcept
+        {
+            m_size.store(m_queue.size(), std::memory_order_release);
+        }
+
+        Instrumented_mutex m_mutex;
         std::deque<T> m_queue;
+        std::atomic<size_t> m_size = 0;
     };
 } // namespace Net
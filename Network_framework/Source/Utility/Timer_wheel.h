@@ -0,0 +1,206 @@
+#pragma once
+
+#include "Common.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Hierarchical hashed timer wheel that runs many timers with one asio timer. Time is divided into ticks.
+     *   The first level has a slot for each of the next ticks and every higher level has slots that are as long
+     *   as the whole level below it. Timers move down a level when their slot comes up, so scheduling and
+     *   cancelling do not depend on how many timers there are and a tick only touches the timers of its slot.
+     *   Timers expire at most one tick late.
+     *   Callbacks run on the executor of the wheel so they should only post the real work where it belongs.
+     */
+    class Timer_wheel
+    {
+    public:
+        using Timer_id = uint64_t;
+        using Duration = std::chrono::steady_clock::duration;
+
+        /**
+         *   @param executor that runs the ticks
+         *   @param length of one tick
+         */
+        explicit Timer_wheel(
+            asio::any_io_executor executor, std::chrono::milliseconds tick = std::chrono::milliseconds(100))
+            : m_timer(std::move(executor)), m_tick(std::max(tick, std::chrono::milliseconds(1)))
+        {
+        }
+
+        Timer_wheel(const Timer_wheel&) = delete;
+        Timer_wheel(Timer_wheel&&) = delete;
+
+        ~Timer_wheel() = default;
+
+        Timer_wheel& operator=(const Timer_wheel&) = delete;
+        Timer_wheel& operator=(Timer_wheel&&) = delete;
+
+        // Starts ticking, this has to be called from the executor of the wheel or before it runs
+        void start()
+        {
+            m_next_tick_time = std::chrono::steady_clock::now() + m_tick;
+            wait_next_tick();
+        }
+
+        // Stops ticking, the timers are kept and continue after the next start
+        void stop()
+        {
+            m_timer.cancel();
+        }
+
+        /**
+         *   Calls the callback after the delay, this is thread safe
+         *
+         *   @return id for cancelling the timer, never 0
+         */
+        Timer_id schedule(Duration delay, std::function<void()> callback)
+        {
+            // Rounded up so the timer never expires early
+            const uint64_t ticks = std::max<uint64_t>((delay + m_tick - Duration(1)) / m_tick, 1);
+
+            std::scoped_lock lock(m_mutex);
+
+            const Timer_id timer_id = m_next_timer_id++;
+            insert(timer_id, Timer{.m_expiry_tick = m_current_tick + ticks, .m_callback = std::move(callback)});
+
+            return timer_id;
+        }
+
+        // Cancels the timer that has not yet expired, this is thread safe
+        void cancel(Timer_id timer_id)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            const auto found_slot = m_timer_slots.find(timer_id);
+
+            if (found_slot == m_timer_slots.end())
+                return;
+
+            m_slots[found_slot->second].erase(timer_id);
+            m_timer_slots.erase(found_slot);
+        }
+
+    private:
+        struct Timer
+        {
+            uint64_t m_expiry_tick = 0;
+            std::function<void()> m_callback;
+        };
+
+        using Slot = std::unordered_map<Timer_id, Timer>;
+
+        // Each level has 64 slots, so four levels cover about 19 days with the default tick
+        static constexpr uint32_t SLOT_BITS = 6;
+        static constexpr uint32_t LEVEL_COUNT = 4;
+        static constexpr uint64_t SLOTS_PER_LEVEL = uint64_t(1) << SLOT_BITS;
+        static constexpr uint64_t MAX_TICKS = uint64_t(1) << (SLOT_BITS * LEVEL_COUNT);
+
+        // @return index in the m_slots of the slot where the timer that expires on the tick is kept now
+        [[nodiscard]] size_t find_slot_index(uint64_t expiry_tick) const noexcept
+        {
+            // Timers longer than the wheel wait in the furthest slot of the top level and are placed again there
+            const uint64_t ticks_left = std::min(expiry_tick - std::min(expiry_tick, m_current_tick), MAX_TICKS - 1);
+            const uint64_t placed_tick = m_current_tick + ticks_left;
+
+            uint32_t level = 0;
+
+            while (ticks_left >= uint64_t(1) << (SLOT_BITS * (level + 1)))
+                ++level;
+
+            const uint64_t slot = (placed_tick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+            return static_cast<size_t>(level * SLOTS_PER_LEVEL + slot);
+        }
+
+        void insert(Timer_id timer_id, Timer timer)
+        {
+            const size_t slot_index = find_slot_index(timer.m_expiry_tick);
+
+            m_slots[slot_index].emplace(timer_id, std::move(timer));
+            m_timer_slots.insert_or_assign(timer_id, slot_index);
+        }
+
+        void wait_next_tick()
+        {
+            m_timer.expires_at(m_next_tick_time);
+            m_timer.async_wait([this](const asio::error_code& error) {
+                if (error)
+                    return;
+
+                // Ticks that were missed because the executor was busy are run now so no timer is skipped
+                const auto now = std::chrono::steady_clock::now();
+
+                while (m_next_tick_time <= now)
+                {
+                    run_tick();
+                    m_next_tick_time += m_tick;
+                }
+
+                wait_next_tick();
+            });
+        }
+
+        // Moves the timers of the higher level slots that begin on this tick down to the lower levels
+        void cascade()
+        {
+            for (uint32_t level = 1; level < LEVEL_COUNT; ++level)
+            {
+                if ((m_current_tick & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)
+                    return;
+
+                const uint64_t slot = (m_current_tick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+                Slot timers = std::exchange(m_slots[level * SLOTS_PER_LEVEL + slot], Slot());
+
+                for (auto& [timer_id, timer] : timers)
+                    insert(timer_id, std::move(timer));
+            }
+        }
+
+        // Runs the timers of the next tick, the callbacks are called without the lock so they can schedule
+        void run_tick()
+        {
+            {
+                std::scoped_lock lock(m_mutex);
+                ++m_current_tick;
+                cascade();
+
+                // Every timer in the first level slot of the tick expires on it
+                Slot& slot = m_slots[m_current_tick & (SLOTS_PER_LEVEL - 1)];
+
+                for (auto& [timer_id, timer] : slot)
+                {
+                    m_expired_callbacks.push_back(std::move(timer.m_callback));
+                    m_timer_slots.erase(timer_id);
+                }
+
+                slot.clear();
+            }
+
+            for (std::function<void()>& callback : m_expired_callbacks)
+                callback();
+
+            m_expired_callbacks.clear();
+        }
+
+        asio::steady_timer m_timer;
+        const Duration m_tick;
+        std::chrono::steady_clock::time_point m_next_tick_time;
+
+        std::mutex m_mutex;
+        uint64_t m_current_tick = 0;
+        Timer_id m_next_timer_id = 1;
+        std::array<Slot, LEVEL_COUNT * SLOTS_PER_LEVEL> m_slots;
+        std::unordered_map<Timer_id, size_t> m_timer_slots;
+
+        // Only used by the ticks, kept here so the memory is reused
+        std::vector<std::function<void()>> m_expired_callbacks;
+    };
+} // namespace Net
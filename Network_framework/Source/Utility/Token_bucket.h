@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace Net
+{
+    /**
+     *   Bucket that refills tokens at a steady rate up to its burst, an operation may happen when it can take its
+     *   cost from the bucket. The clock is read only when the bucket runs short, so the steady traffic under the
+     *   rate does not check the time for every operation. Bucket with no rate allows everything.
+     */
+    class Token_bucket
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Token_bucket() = default;
+
+        /**
+         *   Starts with a full bucket
+         *
+         *   @param the tokens added per second, 0 allows everything
+         *   @param the max amount of tokens, one second of the rate if not positive
+         */
+        Token_bucket(double rate_per_second, double burst)
+            : m_rate(std::max(rate_per_second, 0.0)), m_burst(burst > 0 ? burst : m_rate), m_tokens(m_burst),
+              m_last_refill(Clock::now())
+        {
+        }
+
+        [[nodiscard]] bool is_limited() const noexcept
+        {
+            return m_rate > 0;
+        }
+
+        /**
+         *   Costs larger than the burst are taken as the whole burst so they can pass when the bucket is full
+         *
+         *   @return how long until the bucket has the tokens for the cost, zero if it has them now
+         */
+        [[nodiscard]] Clock::duration wait_time(double cost)
+        {
+            if (!is_limited())
+                return Clock::duration::zero();
+
+            cost = std::min(cost, m_burst);
+
+            if (m_tokens >= cost)
+                return Clock::duration::zero();
+
+            refill();
+
+            if (m_tokens >= cost)
+                return Clock::duration::zero();
+
+            return std::chrono::ceil<Clock::duration>(std::chrono::duration<double>((cost - m_tokens) / m_rate));
+        }
+
+        // Takes the cost, this should be called only after the wait_time has returned zero for it
+        void take(double cost) noexcept
+        {
+            if (is_limited())
+                m_tokens -= std::min(cost, m_burst);
+        }
+
+    private:
+        void refill()
+        {
+            const Clock::time_point now = Clock::now();
+            const std::chrono::duration<double> elapsed = now - m_last_refill;
+
+            m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+            m_last_refill = now;
+        }
+
+        double m_rate = 0;
+        double m_burst = 0;
+        double m_tokens = 0;
+        Clock::time_point m_last_refill;
+    };
+} // namespace Net
@@ -0,0 +1,203 @@
+#pragma once
+
+/**
+ *   Trace points of the framework. They are compiled in only when NET_ENABLE_TRACING is defined, otherwise the
+ *   macros expand to nothing. Every thread records to its own ring buffer without locks and the last events of
+ *   all the threads can be dumped in the Chrome trace format that chrome://tracing and Perfetto open.
+ *
+ *   NET_TRACE_SCOPE(name)            traces the rest of the scope on this thread
+ *   NET_TRACE_BEGIN(name, id)        starts an async span of the connection id that can end on another thread
+ *   NET_TRACE_END(name, id)          ends the async span
+ *   NET_TRACE_INSTANT(name, id)      marks a moment on this thread
+ *
+ *   The names must be string literals.
+ */
+
+#ifdef NET_ENABLE_TRACING
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace Net
+{
+    // Phases of the Chrome trace events
+    enum class Trace_phase : char
+    {
+        scope_begin = 'B',
+        scope_end = 'E',
+        async_begin = 'b',
+        async_end = 'e',
+        instant = 'i'
+    };
+
+    /**
+     *   Ring buffer of one thread. Only the owner thread writes, the slots are atomics so the dump can read them
+     *   while they are written, an event that is overwritten during the dump can be mixed from two events.
+     */
+    class Trace_ring
+    {
+    public:
+        explicit Trace_ring(uint32_t thread_index) noexcept : m_thread_index(thread_index)
+        {
+        }
+
+        void record(const char* name, Trace_phase phase, uint32_t id) noexcept
+        {
+            const uint64_t index = m_next_index.load(std::memory_order_relaxed);
+            Slot& slot = m_slots[index % CAPACITY];
+
+            slot.m_name.store(name, std::memory_order_relaxed);
+            slot.m_phase.store(phase, std::memory_order_relaxed);
+            slot.m_id.store(id, std::memory_order_relaxed);
+            slot.m_timestamp.store(now_in_nanoseconds(), std::memory_order_relaxed);
+
+            m_next_index.store(index + 1, std::memory_order_release);
+        }
+
+        // Writes the events that are still in the ring as json objects separated by commas
+        void write_events(std::ostream& stream, bool& is_first) const
+        {
+            const uint64_t end_index = m_next_index.load(std::memory_order_acquire);
+            const uint64_t begin_index = end_index > CAPACITY ? end_index - CAPACITY : 0;
+
+            for (uint64_t index = begin_index; index < end_index; ++index)
+            {
+                const Slot& slot = m_slots[index % CAPACITY];
+                const Trace_phase phase = slot.m_phase.load(std::memory_order_relaxed);
+                const uint64_t timestamp = slot.m_timestamp.load(std::memory_order_relaxed);
+
+                stream << (is_first ? "" : ",\n") << "{\"name\":\"" << slot.m_name.load(std::memory_order_relaxed)
+                       << "\",\"cat\":\"net\",\"ph\":\"" << static_cast<char>(phase) << "\",\"ts\":"
+                       << timestamp / 1000 << '.' << timestamp % 1000 / 100 << timestamp % 100 / 10 << timestamp % 10
+                       << ",\"pid\":1,\"tid\":" << m_thread_index;
+
+                const uint32_t id = slot.m_id.load(std::memory_order_relaxed);
+
+                // Async spans are matched by their id, the other events show it as an argument
+                if (phase == Trace_phase::async_begin || phase == Trace_phase::async_end)
+                    stream << ",\"id\":" << id;
+                else if (phase == Trace_phase::instant)
+                    stream << ",\"s\":\"t\",\"args\":{\"id\":" << id << '}';
+
+                stream << '}';
+                is_first = false;
+            }
+        }
+
+    private:
+        static constexpr size_t CAPACITY = 16384;
+
+        struct Slot
+        {
+            std::atomic<const char*> m_name = "";
+            std::atomic<Trace_phase> m_phase = Trace_phase::instant;
+            std::atomic<uint32_t> m_id = 0;
+            std::atomic<uint64_t> m_timestamp = 0;
+        };
+
+        [[nodiscard]] static uint64_t now_in_nanoseconds() noexcept
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+        }
+
+        std::array<Slot, CAPACITY> m_slots = {};
+        std::atomic<uint64_t> m_next_index = 0;
+        uint32_t m_thread_index = 0;
+    };
+
+    // Rings of all the threads that have traced, they are kept after the threads exit so they can be dumped
+    class Tracer
+    {
+    public:
+        // @return the ring of the calling thread, it is created on the first call of the thread
+        [[nodiscard]] static Trace_ring& get_thread_ring()
+        {
+            static thread_local Trace_ring& ring = get_instance().create_ring();
+            return ring;
+        }
+
+        /**
+         *   Writes the last events of every thread as a Chrome trace json. This can be called while the threads
+         *   trace, but the dump is cleanest when the traced code is idle.
+         */
+        static void write_chrome_trace(std::ostream& stream)
+        {
+            Tracer& tracer = get_instance();
+            std::scoped_lock lock(tracer.m_mutex);
+
+            bool is_first = true;
+            stream << "{\"traceEvents\":[\n";
+
+            for (const std::unique_ptr<Trace_ring>& ring : tracer.m_rings)
+                ring->write_events(stream, is_first);
+
+            stream << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        }
+
+    private:
+        [[nodiscard]] static Tracer& get_instance()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        [[nodiscard]] Trace_ring& create_ring()
+        {
+            std::scoped_lock lock(m_mutex);
+            m_rings.push_back(std::make_unique<Trace_ring>(static_cast<uint32_t>(m_rings.size() + 1)));
+            return *m_rings.back();
+        }
+
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<Trace_ring>> m_rings;
+    };
+
+    // Records the scope begin and the end when it goes out of scope
+    class Trace_scope
+    {
+    public:
+        explicit Trace_scope(const char* name) noexcept : m_name(name)
+        {
+            Tracer::get_thread_ring().record(m_name, Trace_phase::scope_begin, 0);
+        }
+
+        Trace_scope(const Trace_scope&) = delete;
+        Trace_scope(Trace_scope&&) = delete;
+
+        ~Trace_scope()
+        {
+            Tracer::get_thread_ring().record(m_name, Trace_phase::scope_end, 0);
+        }
+
+        Trace_scope& operator=(const Trace_scope&) = delete;
+        Trace_scope& operator=(Trace_scope&&) = delete;
+
+    private:
+        const char* m_name;
+    };
+} // namespace Net
+
+#define NET_TRACE_CONCAT_INNER(first, second) first##second
+#define NET_TRACE_CONCAT(first, second) NET_TRACE_CONCAT_INNER(first, second)
+
+#define NET_TRACE_SCOPE(name) const Net::Trace_scope NET_TRACE_CONCAT(net_trace_scope_, __LINE__)(name)
+#define NET_TRACE_BEGIN(name, id) Net::Tracer::get_thread_ring().record(name, Net::Trace_phase::async_begin, id)
+#define NET_TRACE_END(name, id) Net::Tracer::get_thread_ring().record(name, Net::Trace_phase::async_end, id)
+#define NET_TRACE_INSTANT(name, id) Net::Tracer::get_thread_ring().record(name, Net::Trace_phase::instant, id)
+
+#else
+
+#define NET_TRACE_SCOPE(name) static_cast<void>(0)
+#define NET_TRACE_BEGIN(name, id) static_cast<void>(0)
+#define NET_TRACE_END(name, id) static_cast<void>(0)
+#define NET_TRACE_INSTANT(name, id) static_cast<void>(0)
+
+#endif
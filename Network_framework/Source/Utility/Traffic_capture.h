@@ -0,0 +1,366 @@
+#pragma once
+
+#include "../Message/Message_header.h"
+#include "../Message/Message_memory.h"
+#include "Common.h"
+#include "Mapped_file.h"
+#include "Mpsc_queue.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    enum class Capture_direction : uint8_t
+    {
+        received,
+        sent
+    };
+
+    struct Traffic_capture_settings
+    {
+        // Segments are written to this directory, it is created if it does not exist
+        std::filesystem::path m_directory;
+
+        // Each segment is mapped whole, the frame that does not fit starts the next segment
+        size_t m_segment_size = 64 * 1024 * 1024;
+
+        // Frames waiting for the writer, the frames over this are dropped so the io threads never wait
+        size_t m_queue_capacity = 64 * 1024;
+
+        // Oldest segments are deleted so there are atmost this many, nothing is deleted without this
+        std::optional<size_t> m_max_segments = std::nullopt;
+
+        // How often the writer takes the waiting frames
+        std::chrono::milliseconds m_write_interval = std::chrono::milliseconds(10);
+    };
+
+    struct Traffic_capture_stats
+    {
+        uint64_t m_captured_frames = 0;
+
+        // Dropped because the queue was full, the frame was larger than a segment or a segment could not be opened
+        uint64_t m_dropped_frames = 0;
+
+        uint64_t m_written_bytes = 0;
+        uint64_t m_segments = 0;
+    };
+
+    /**
+     *   Header of a frame in the segment, it is followed by the header and the body of the message. The rest of
+     *   the segment after the last frame is zeros, so a zero time ends the frames of a segment that was not closed.
+     */
+    struct Captured_frame_header
+    {
+        // Nanoseconds of the system clock
+        int64_t m_time = 0;
+        uint32_t m_client_id = 0;
+        Capture_direction m_direction = Capture_direction::received;
+        std::array<uint8_t, 3> m_reserved = {};
+        uint32_t m_header_size = 0;
+        uint32_t m_body_size = 0;
+    };
+
+    /**
+     *   @param the captured header of the message
+     *   @return the header if the frame is a user message of this id type, the others are not replayed
+     */
+    template <Id_concept Id_type>
+    [[nodiscard]] std::optional<Message_header<Id_type>> read_captured_user_header(
+        std::span<const char> header) noexcept
+    {
+        if (header.size() != sizeof(Message_header<Id_type>))
+            return std::nullopt;
+
+        Message_header<Id_type> message_header;
+        std::memcpy(&message_header, header.data(), sizeof(message_header));
+
+        if (!message_header.is_validation_key_correct() || message_header.m_internal_id != Internal_id::not_internal)
+            return std::nullopt;
+
+        return message_header;
+    }
+
+    /**
+     *   Captures the received and the sent messages to the segment files of the directory, so the exact traffic can
+     *   be replayed. Io threads copy the frame to a bounded queue and a writer thread copies the frames to the
+     *   memory mapped segment, so capturing costs the io thread one copy and never waits for the disk.
+     *   Segments are named capture_000000.bin and onwards and start with the SEGMENT_MAGIC.
+     */
+    class Traffic_capture
+    {
+    public:
+        static constexpr std::array<char, 8> SEGMENT_MAGIC = {'N', 'E', 'T', 'C', 'A', 'P', '0', '1'};
+
+        /**
+         *   Opens the first segment and starts the writer
+         *
+         *   @throws std::system_error if the directory or the first segment could not be created
+         */
+        explicit Traffic_capture(Traffic_capture_settings settings)
+            : m_settings(std::move(settings)), m_queue(m_settings.m_queue_capacity)
+        {
+            m_settings.m_segment_size = std::max<size_t>(m_settings.m_segment_size, 64 * 1024);
+            std::filesystem::create_directories(m_settings.m_directory);
+
+            if (const std::error_code error = open_next_segment())
+                throw std::system_error(error, "Traffic capture segment");
+
+            m_writer = std::thread([this] { write_loop(); });
+        }
+
+        Traffic_capture(const Traffic_capture&) = delete;
+        Traffic_capture(Traffic_capture&&) = delete;
+
+        // Writes the waiting frames and closes the segment
+        ~Traffic_capture()
+        {
+            m_is_stopping.store(true, std::memory_order_relaxed);
+            m_writer.join();
+        }
+
+        Traffic_capture& operator=(const Traffic_capture&) = delete;
+        Traffic_capture& operator=(Traffic_capture&&) = delete;
+
+        /**
+         *   Queues the frame for the writer, this can be called from any thread and it does not wait
+         *
+         *   @return false if the frame was dropped because the queue was full
+         */
+        bool capture(
+            Capture_direction direction, uint32_t client_id, std::span<const char> header, std::span<const char> body)
+        {
+            Frame frame = {
+                .m_header =
+                    {.m_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch())
+                                   .count(),
+                     .m_client_id = client_id,
+                     .m_direction = direction,
+                     .m_header_size = static_cast<uint32_t>(header.size()),
+                     .m_body_size = static_cast<uint32_t>(body.size())},
+                .m_bytes = std::pmr::vector<char>(get_message_memory_resource())};
+
+            frame.m_bytes.reserve(header.size() + body.size());
+            frame.m_bytes.insert(frame.m_bytes.end(), header.begin(), header.end());
+            frame.m_bytes.insert(frame.m_bytes.end(), body.begin(), body.end());
+
+            if (m_queue.try_push(std::move(frame)) == Push_result::full)
+            {
+                m_dropped_frames.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            return true;
+        }
+
+        [[nodiscard]] Traffic_capture_stats get_stats() const noexcept
+        {
+            return {
+                .m_captured_frames = m_captured_frames.load(std::memory_order_relaxed),
+                .m_dropped_frames = m_dropped_frames.load(std::memory_order_relaxed),
+                .m_written_bytes = m_written_bytes.load(std::memory_order_relaxed),
+                .m_segments = m_segment_count.load(std::memory_order_relaxed)};
+        }
+
+        // @return the path of the segment of the index
+        [[nodiscard]] std::filesystem::path get_segment_path(uint64_t index) const
+        {
+            return m_settings.m_directory / std::format("capture_{:06}.bin", index);
+        }
+
+        /**
+         *   @param the directory the segments were written to
+         *   @return the segments of the directory in the order they were written
+         *   @throws std::filesystem::filesystem_error if the directory could not be read
+         */
+        [[nodiscard]] static std::vector<std::filesystem::path> find_segments(const std::filesystem::path& directory)
+        {
+            std::vector<std::filesystem::path> segments;
+
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory))
+            {
+                const std::string name = entry.path().filename().string();
+
+                if (entry.is_regular_file() && name.starts_with("capture_") && name.ends_with(".bin"))
+                    segments.push_back(entry.path());
+            }
+
+            std::ranges::sort(segments);
+            return segments;
+        }
+
+        /**
+         *   Maps the segment for reading, see the read_frame
+         *
+         *   @throws std::system_error if the file could not be mapped or it is not a segment
+         */
+        static void open_segment(const std::filesystem::path& path, Mapped_file& segment)
+        {
+            if (const std::error_code error = segment.open_read_only(path))
+                throw std::system_error(error, "Traffic capture segment");
+
+            if (segment.get_used_bytes() < SEGMENT_MAGIC.size() ||
+                !std::ranges::equal(segment.read(0, SEGMENT_MAGIC.size()), SEGMENT_MAGIC))
+            {
+                segment.close();
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Traffic capture segment");
+            }
+        }
+
+        /**
+         *   Reads the frame at the offset of the mapped segment, the header and the body view the mapping
+         *
+         *   @param the segment opened with the open_segment
+         *   @param the offset of the frame, SEGMENT_MAGIC.size() for the first frame, moved past the read frame
+         *   @param where the frame header is copied
+         *   @param where the views of the header and the body of the message are written
+         *   @return false if the segment has no more whole frames
+         */
+        static bool read_frame(
+            const Mapped_file& segment, size_t& offset, Captured_frame_header& frame, std::span<const char>& header,
+            std::span<const char>& body) noexcept
+        {
+            const size_t size = segment.get_used_bytes();
+
+            if (size - offset < sizeof(frame))
+                return false;
+
+            std::memcpy(&frame, segment.read(offset, sizeof(frame)).data(), sizeof(frame));
+            const size_t bytes = static_cast<size_t>(frame.m_header_size) + frame.m_body_size;
+
+            if (frame.m_time == 0 || size - offset - sizeof(frame) < bytes)
+                return false;
+
+            header = segment.read(offset + sizeof(frame), frame.m_header_size);
+            body = segment.read(offset + sizeof(frame) + frame.m_header_size, frame.m_body_size);
+            offset += sizeof(frame) + bytes;
+            return true;
+        }
+
+        /**
+         *   Reads the frames of a segment, for example to replay them. The segment is mapped so the frames are
+         *   given to the callable without copying them.
+         *
+         *   @param the path of the segment
+         *   @param callable that takes const Captured_frame_header&, std::span<const char> header and body, the
+         *   views are valid only during the call
+         *   @throws std::system_error if the file could not be read or it is not a segment
+         */
+        template <typename Callable_type>
+        static void read_segment(const std::filesystem::path& path, Callable_type&& callable)
+        {
+            Mapped_file segment;
+            open_segment(path, segment);
+
+            size_t offset = SEGMENT_MAGIC.size();
+            Captured_frame_header frame;
+            std::span<const char> header;
+            std::span<const char> body;
+
+            while (read_frame(segment, offset, frame, header, body))
+                callable(std::as_const(frame), header, body);
+        }
+
+    private:
+        struct Frame
+        {
+            Captured_frame_header m_header;
+            std::pmr::vector<char> m_bytes;
+        };
+
+        // Waits a write interval between the writes, the producers don't signal so they never take a lock
+        void write_loop()
+        {
+            while (!m_is_stopping.load(std::memory_order_relaxed))
+            {
+                write_frames();
+                std::this_thread::sleep_for(m_settings.m_write_interval);
+            }
+
+            write_frames();
+            m_segment.close();
+        }
+
+        void write_frames()
+        {
+            while (std::optional<Frame> frame = m_queue.try_pop())
+                write_frame(*frame);
+        }
+
+        void write_frame(const Frame& frame)
+        {
+            const size_t frame_size = sizeof(Captured_frame_header) + frame.m_bytes.size();
+
+            if (frame_size > m_settings.m_segment_size - SEGMENT_MAGIC.size())
+            {
+                m_dropped_frames.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            if ((!m_segment.is_open() || m_segment.get_free_bytes() < frame_size) && open_next_segment())
+            {
+                m_dropped_frames.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            m_segment.append(std::span(reinterpret_cast<const char*>(&frame.m_header), sizeof(frame.m_header)));
+            m_segment.append(frame.m_bytes);
+
+            m_captured_frames.fetch_add(1, std::memory_order_relaxed);
+            m_written_bytes.fetch_add(frame_size, std::memory_order_relaxed);
+        }
+
+        // @return the error if the segment could not be opened, the frames are dropped until one is
+        std::error_code open_next_segment()
+        {
+            m_segment.close();
+
+            if (const std::error_code error =
+                    m_segment.open(get_segment_path(m_next_segment_index), m_settings.m_segment_size))
+                return error;
+
+            m_segment.append(SEGMENT_MAGIC);
+            ++m_next_segment_index;
+            m_segment_count.fetch_add(1, std::memory_order_relaxed);
+
+            // Deleting the segment that is still open elsewhere may fail, it is then left for the user
+            if (m_settings.m_max_segments && m_next_segment_index > *m_settings.m_max_segments)
+            {
+                std::error_code ignored_error;
+                std::filesystem::remove(
+                    get_segment_path(m_next_segment_index - *m_settings.m_max_segments - 1), ignored_error);
+            }
+
+            return {};
+        }
+
+        Traffic_capture_settings m_settings;
+        Mpsc_queue<Frame> m_queue;
+
+        // Only used by the writer thread after the constructor
+        Mapped_file m_segment;
+        uint64_t m_next_segment_index = 0;
+
+        std::atomic<uint64_t> m_captured_frames = 0;
+        std::atomic<uint64_t> m_dropped_frames = 0;
+        std::atomic<uint64_t> m_written_bytes = 0;
+        std::atomic<uint64_t> m_segment_count = 0;
+
+        std::atomic<bool> m_is_stopping = false;
+        std::thread m_writer;
+    };
+} // namespace Net
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NET_HAS_SSE2_UTF8
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define NET_HAS_NEON_UTF8
+#endif
+
+namespace Net
+{
+    namespace Utf8_detail
+    {
+        // @return the index of the first byte from the position that is not ascii, or the size if there is none
+        [[nodiscard]] inline size_t skip_ascii(const unsigned char* bytes, size_t position, size_t size) noexcept
+        {
+#if defined(NET_HAS_SSE2_UTF8)
+            for (; size - position >= 16; position += 16)
+            {
+                const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + position));
+
+                if (const int mask = _mm_movemask_epi8(block); mask != 0)
+                    return position + static_cast<size_t>(std::countr_zero(static_cast<uint32_t>(mask)));
+            }
+#elif defined(NET_HAS_NEON_UTF8)
+            for (; size - position >= 16; position += 16)
+            {
+                if (vmaxvq_u8(vld1q_u8(bytes + position)) >= 0x80)
+                    break;
+            }
+#endif
+            constexpr uint64_t HIGH_BITS = 0x8080808080808080;
+
+            for (; size - position >= 8; position += 8)
+            {
+                uint64_t word = 0;
+                std::memcpy(&word, bytes + position, sizeof(word));
+
+                if ((word & HIGH_BITS) == 0)
+                    continue;
+
+                if constexpr (std::endian::native == std::endian::little)
+                    return position + static_cast<size_t>(std::countr_zero(word & HIGH_BITS)) / 8;
+                else
+                    break;
+            }
+
+            while (position < size && bytes[position] < 0x80)
+                ++position;
+
+            return position;
+        }
+    } // namespace Utf8_detail
+
+    /**
+     *   Checks that the text is valid UTF-8, the overlong encodings, the surrogates and the code points over
+     *   U+10FFFF are rejected. Runs of ascii are skipped 16 bytes at a time with SSE2 or NEON when the compiler
+     *   targets them and 8 bytes at a time otherwise, so mostly ascii text is checked at near memcpy speed.
+     *
+     *   @param the text
+     *   @return true if the text is valid UTF-8
+     */
+    [[nodiscard]] inline bool is_valid_utf8(std::string_view text) noexcept
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(text.data());
+        const size_t size = text.size();
+        size_t position = 0;
+
+        while ((position = Utf8_detail::skip_ascii(bytes, position, size)) < size)
+        {
+            const unsigned char lead = bytes[position];
+            size_t length = 0;
+            uint32_t code_point = 0;
+            uint32_t min_code_point = 0;
+
+            if ((lead & 0xE0) == 0xC0)
+            {
+                length = 2;
+                code_point = lead & 0x1F;
+                min_code_point = 0x80;
+            }
+            else if ((lead & 0xF0) == 0xE0)
+            {
+                length = 3;
+                code_point = lead & 0x0F;
+                min_code_point = 0x800;
+            }
+            else if ((lead & 0xF8) == 0xF0)
+            {
+                length = 4;
+                code_point = lead & 0x07;
+                min_code_point = 0x10000;
+            }
+            else
+                return false;
+
+            if (size - position < length)
+                return false;
+
+            for (size_t i = 1; i < length; ++i)
+            {
+                const unsigned char continuation = bytes[position + i];
+
+                if ((continuation & 0xC0) != 0x80)
+                    return false;
+
+                code_point = (code_point << 6) | (continuation & 0x3F);
+            }
+
+            if (code_point < min_code_point || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
+                return false;
+
+            position += length;
+        }
+
+        return true;
+    }
+} // namespace Net
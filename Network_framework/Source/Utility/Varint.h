@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace Net
+{
+    // LEB128 varint of 64 bit value takes at most this many bytes
+    static constexpr size_t MAX_VARINT_SIZE = 10;
+
+    // Maps signed values to unsigned so the small negative values also get short varints
+    [[nodiscard]] constexpr uint64_t zigzag_encode(int64_t value) noexcept
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    [[nodiscard]] constexpr int64_t zigzag_decode(uint64_t value) noexcept
+    {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    // @return the amount of bytes that the varint of the value takes
+    [[nodiscard]] constexpr size_t varint_size(uint64_t value) noexcept
+    {
+        size_t size = 1;
+
+        for (; value >= 0x80; value >>= 7)
+            ++size;
+
+        return size;
+    }
+
+    /**
+     *   Writes the value as LEB128 varint, seven bits in each byte and the highest bit tells if more bytes follow
+     *
+     *   @param buffer with atleast MAX_VARINT_SIZE bytes
+     *   @return number of bytes written
+     */
+    inline size_t encode_varint(uint64_t value, char* output) noexcept
+    {
+        size_t size = 0;
+
+        while (value >= 0x80)
+        {
+            output[size++] = static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+
+        output[size++] = static_cast<char>(value);
+        return size;
+    }
+
+    /**
+     *   @param the encoded bytes
+     *   @param where the value is decoded
+     *   @return number of bytes read or 0 if the input ended or the varint is longer than 64 bits
+     */
+    inline size_t decode_varint(std::span<const char> input, uint64_t& value) noexcept
+    {
+        value = 0;
+
+        for (size_t i = 0; i < input.size() && i < MAX_VARINT_SIZE; ++i)
+        {
+            const auto byte = static_cast<uint8_t>(input[i]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << (i * 7);
+
+            if ((byte & 0x80) == 0)
+            {
+                // Tenth byte can only hold the highest bit
+                if (i == MAX_VARINT_SIZE - 1 && byte > 1)
+                    return 0;
+
+                return i + 1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     *   Writes the varint with its bytes reversed, so it is decoded from its end like the data that the Message
+     *   extracts from the end of the body
+     *
+     *   @param buffer with atleast MAX_VARINT_SIZE bytes
+     *   @return number of bytes written
+     */
+    inline size_t encode_reversed_varint(uint64_t value, char* output) noexcept
+    {
+        const size_t size = encode_varint(value, output);
+        std::reverse(output, output + size);
+        return size;
+    }
+
+    /**
+     *   @param the bytes that end with the reversed varint
+     *   @param where the value is decoded
+     *   @return number of bytes read from the end or 0 if the input ended or the varint is longer than 64 bits
+     */
+    inline size_t decode_reversed_varint(std::span<const char> input, uint64_t& value) noexcept
+    {
+        value = 0;
+
+        for (size_t i = 0; i < input.size() && i < MAX_VARINT_SIZE; ++i)
+        {
+            const auto byte = static_cast<uint8_t>(input[input.size() - 1 - i]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << (i * 7);
+
+            if ((byte & 0x80) == 0)
+            {
+                if (i == MAX_VARINT_SIZE - 1 && byte > 1)
+                    return 0;
+
+                return i + 1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     *   Decodes many varints in a row. Eight bytes are checked at once and if none of them continues
+     *   to the next byte they are all single byte values which are copied without the byte by byte loop.
+     *
+     *   @param the encoded bytes
+     *   @param where the values are decoded, all of it is filled
+     *   @param number of bytes read
+     *   @return false if the input ended or had invalid varint
+     */
+    [[nodiscard]] inline bool decode_varints(
+        std::span<const char> input, std::span<uint64_t> output, size_t& bytes_read) noexcept
+    {
+        constexpr uint64_t CONTINUATION_BITS = 0x8080808080808080;
+
+        size_t position = 0;
+        size_t decoded = 0;
+
+        while (decoded < output.size())
+        {
+            if (output.size() - decoded >= 8 && input.size() - position >= 8)
+            {
+                uint64_t word = 0;
+                std::memcpy(&word, input.data() + position, sizeof(word));
+
+                if ((word & CONTINUATION_BITS) == 0)
+                {
+                    for (size_t i = 0; i < 8; ++i)
+                        output[decoded + i] = static_cast<uint8_t>(input[position + i]);
+
+                    decoded += 8;
+                    position += 8;
+                    continue;
+                }
+            }
+
+            const size_t size = decode_varint(input.subspan(position), output[decoded]);
+
+            if (size == 0)
+                return false;
+
+            ++decoded;
+            position += size;
+        }
+
+        bytes_read = position;
+        return true;
+    }
+} // namespace Net
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace Net
+{
+    /**
+     *   Event that the application can wait on with its own sources, an eventfd on linux, a pipe on the other posix
+     *   systems and a manual reset event on windows. The handle becomes readable or signaled when the event is
+     *   signaled and stays so until the reset. Signaling an event that is already signaled does not make a system
+     *   call, so the signals between two resets cost one write.
+     */
+    class Wakeup_event
+    {
+    public:
+#ifdef _WIN32
+        using Native_handle = HANDLE;
+#else
+        using Native_handle = int;
+#endif
+
+        // @throws if the event could not be created
+        Wakeup_event()
+        {
+#if defined(_WIN32)
+            m_read_handle = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+            if (m_read_handle == nullptr)
+                throw std::runtime_error("Could not create the wakeup event");
+
+            m_write_handle = m_read_handle;
+#elif defined(__linux__)
+            m_read_handle = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (m_read_handle < 0)
+                throw std::runtime_error("Could not create the wakeup event");
+
+            m_write_handle = m_read_handle;
+#else
+            int handles[2] = {};
+
+            if (::pipe(handles) != 0)
+                throw std::runtime_error("Could not create the wakeup event");
+
+            for (const int handle : handles)
+            {
+                ::fcntl(handle, F_SETFL, ::fcntl(handle, F_GETFL) | O_NONBLOCK);
+                ::fcntl(handle, F_SETFD, FD_CLOEXEC);
+            }
+
+            m_read_handle = handles[0];
+            m_write_handle = handles[1];
+#endif
+        }
+
+        Wakeup_event(const Wakeup_event&) = delete;
+        Wakeup_event(Wakeup_event&&) = delete;
+
+        ~Wakeup_event()
+        {
+#ifdef _WIN32
+            ::CloseHandle(m_read_handle);
+#else
+            ::close(m_read_handle);
+
+            if (m_write_handle != m_read_handle)
+                ::close(m_write_handle);
+#endif
+        }
+
+        Wakeup_event& operator=(const Wakeup_event&) = delete;
+        Wakeup_event& operator=(Wakeup_event&&) = delete;
+
+        // This can be called from any thread
+        void signal() noexcept
+        {
+            if (m_is_signaled.exchange(true))
+                return;
+
+#ifdef _WIN32
+            ::SetEvent(m_write_handle);
+#else
+            // Full pipe or counter is already readable so the failed write can be ignored
+            const uint64_t value = 1;
+            ssize_t result = 0;
+
+            do
+                result = ::write(m_write_handle, &value, write_size());
+            while (result < 0 && errno == EINTR);
+#endif
+        }
+
+        /**
+         *   Clears the event, this is called before checking what the signals were about so no signal is lost.
+         *   Flag is cleared after the handle, so a signal in between only skips its write and the caller still sees
+         *   what it was about.
+         */
+        void reset() noexcept
+        {
+            if (!m_is_signaled.load())
+                return;
+
+#ifdef _WIN32
+            ::ResetEvent(m_write_handle);
+#else
+            uint64_t buffer[8] = {};
+            ssize_t result = 0;
+
+            do
+                result = ::read(m_read_handle, buffer, sizeof(buffer));
+            while (result > 0 || (result < 0 && errno == EINTR));
+#endif
+
+            m_is_signaled.store(false);
+        }
+
+        [[nodiscard]] Native_handle native_handle() const noexcept
+        {
+            return m_read_handle;
+        }
+
+    private:
+#ifndef _WIN32
+        // Eventfd is written with the whole counter, the pipe with one byte
+        [[nodiscard]] size_t write_size() const noexcept
+        {
+            return m_write_handle == m_read_handle ? sizeof(uint64_t) : 1;
+        }
+#endif
+
+        Native_handle m_read_handle = {};
+        Native_handle m_write_handle = {};
+        std::atomic<bool> m_is_signaled = false;
+    };
+} // namespace Net
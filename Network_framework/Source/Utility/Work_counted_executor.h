@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace Net
+{
+    /**
+     *   Counter of the pending work of one user of a shared io_context. Asio asks the executor of an operation
+     *   to track the work while the operation is pending, so the counter tells when every operation and handler
+     *   of the user has finished even though the threads of the context keep running.
+     */
+    class Work_counter
+    {
+    public:
+        void add() noexcept
+        {
+            m_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void remove() noexcept
+        {
+            if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                m_count.notify_all();
+        }
+
+        // Blocks until there is no pending work, this can't be called from a handler of the counted work
+        void wait_until_idle() const noexcept
+        {
+            size_t count = m_count.load(std::memory_order_acquire);
+
+            while (count != 0)
+            {
+                m_count.wait(count, std::memory_order_acquire);
+                count = m_count.load(std::memory_order_acquire);
+            }
+        }
+
+        [[nodiscard]] size_t get_count() const noexcept
+        {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<size_t> m_count = 0;
+    };
+
+    /**
+     *   Executor that forwards to the inner executor and counts the copies of it that track work in the
+     *   Work_counter. Strands and the io objects made on it count their pending operations like the io_context
+     *   counts its own work, the inner executor tells if a copy tracks work.
+     */
+    template <typename Inner_executor>
+    class Work_counted_executor
+    {
+        template <typename Property>
+        using Required_executor =
+            std::decay_t<decltype(asio::require(std::declval<const Inner_executor&>(), std::declval<Property>()))>;
+
+        template <typename Property>
+        using Preferred_executor =
+            std::decay_t<decltype(asio::prefer(std::declval<const Inner_executor&>(), std::declval<Property>()))>;
+
+    public:
+        Work_counted_executor(Inner_executor inner, std::shared_ptr<Work_counter> counter)
+            : m_inner(std::move(inner)), m_counter(std::move(counter)),
+              m_is_tracked(
+                  asio::query(m_inner, asio::execution::outstanding_work) ==
+                  asio::execution::outstanding_work.tracked)
+        {
+            add_work();
+        }
+
+        Work_counted_executor(const Work_counted_executor& other) noexcept
+            : m_inner(other.m_inner), m_counter(other.m_counter), m_is_tracked(other.m_is_tracked)
+        {
+            add_work();
+        }
+
+        Work_counted_executor(Work_counted_executor&& other) noexcept
+            : m_inner(std::move(other.m_inner)), m_counter(std::move(other.m_counter)),
+              m_is_tracked(std::exchange(other.m_is_tracked, false))
+        {
+        }
+
+        ~Work_counted_executor()
+        {
+            remove_work();
+        }
+
+        Work_counted_executor& operator=(const Work_counted_executor& other) noexcept
+        {
+            if (this != &other)
+            {
+                remove_work();
+                m_inner = other.m_inner;
+                m_counter = other.m_counter;
+                m_is_tracked = other.m_is_tracked;
+                add_work();
+            }
+
+            return *this;
+        }
+
+        Work_counted_executor& operator=(Work_counted_executor&& other) noexcept
+        {
+            if (this != &other)
+            {
+                remove_work();
+                m_inner = std::move(other.m_inner);
+                m_counter = std::move(other.m_counter);
+                m_is_tracked = std::exchange(other.m_is_tracked, false);
+            }
+
+            return *this;
+        }
+
+        template <typename Function>
+        void execute(Function&& function) const
+        {
+            asio::execution::execute(m_inner, std::forward<Function>(function));
+        }
+
+        template <typename Property>
+        [[nodiscard]] auto query(const Property& property) const
+            -> decltype(asio::query(std::declval<const Inner_executor&>(), property))
+        {
+            return asio::query(m_inner, property);
+        }
+
+        template <typename Property>
+        [[nodiscard]] auto require(const Property& property) const
+            -> Work_counted_executor<Required_executor<Property>>
+        {
+            return {asio::require(m_inner, property), m_counter};
+        }
+
+        template <typename Property>
+        [[nodiscard]] auto prefer(const Property& property) const
+            -> Work_counted_executor<Preferred_executor<Property>>
+        {
+            return {asio::prefer(m_inner, property), m_counter};
+        }
+
+        [[nodiscard]] friend bool operator==(
+            const Work_counted_executor& left, const Work_counted_executor& right) noexcept
+        {
+            return left.m_inner == right.m_inner && left.m_counter == right.m_counter;
+        }
+
+        [[nodiscard]] friend bool operator!=(
+            const Work_counted_executor& left, const Work_counted_executor& right) noexcept
+        {
+            return !(left == right);
+        }
+
+    private:
+        template <typename>
+        friend class Work_counted_executor;
+
+        void add_work() noexcept
+        {
+            if (m_is_tracked && m_counter)
+                m_counter->add();
+        }
+
+        void remove_work() noexcept
+        {
+            if (m_is_tracked && m_counter)
+                m_counter->remove();
+        }
+
+        Inner_executor m_inner;
+        std::shared_ptr<Work_counter> m_counter;
+        bool m_is_tracked = false;
+    };
+} // namespace Net
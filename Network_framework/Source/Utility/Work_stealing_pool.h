@@ -0,0 +1,274 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Thread pool where every thread has its own task queue, so the threads don't fight over one lock. A thread
+     *   runs the tasks of its own queue in order and when the queue is empty it steals the oldest task of the other
+     *   threads. Tasks posted with a key run one at a time in the order they were posted, tasks of different keys
+     *   run in parallel.
+     */
+    class Work_stealing_pool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        /**
+         *   @param the amount of threads, atleast one thread is always used
+         *   @param how many ordered lanes each thread has, keys that hash to the same lane run one after another
+         */
+        explicit Work_stealing_pool(size_t thread_count, size_t lanes_per_thread = 64)
+        {
+            thread_count = std::max<size_t>(thread_count, 1);
+            const size_t lane_count = std::bit_ceil(std::max<size_t>(thread_count * lanes_per_thread, 1));
+
+            m_lane_mask = lane_count - 1;
+            m_lanes = std::make_unique<Lane[]>(lane_count);
+
+            for (size_t i = 0; i < thread_count; ++i)
+                m_workers.push_back(std::make_unique<Worker>());
+
+            for (size_t i = 0; i < thread_count; ++i)
+                m_threads.emplace_back([this, i] { worker_thread(i); });
+        }
+
+        Work_stealing_pool(const Work_stealing_pool&) = delete;
+        Work_stealing_pool(Work_stealing_pool&&) = delete;
+
+        // Threads run the queued tasks before they stop, so this waits until the queues are drained
+        ~Work_stealing_pool()
+        {
+            {
+                std::scoped_lock lock(m_sleep_mutex);
+                m_is_stopping = true;
+            }
+
+            m_wakeup.notify_all();
+
+            for (std::thread& thread : m_threads)
+                thread.join();
+        }
+
+        Work_stealing_pool& operator=(const Work_stealing_pool&) = delete;
+        Work_stealing_pool& operator=(Work_stealing_pool&&) = delete;
+
+        // Runs the task on some thread, the task posted from a pool thread goes to the queue of that thread
+        void post(Task task)
+        {
+            ++m_unfinished_tasks;
+
+            push_task([this, task = std::move(task)] {
+                task();
+                finish_task();
+            });
+        }
+
+        // Runs the task after the earlier tasks of the key have finished
+        void post(uint64_t key, Task task)
+        {
+            ++m_unfinished_tasks;
+
+            Lane& lane = m_lanes[mix_key(key) & m_lane_mask];
+            std::scoped_lock lock(lane.m_mutex);
+            lane.m_tasks.push_back(std::move(task));
+
+            // Only one thread drains the lane at a time which keeps the tasks of the key in order
+            if (!lane.m_is_scheduled)
+            {
+                lane.m_is_scheduled = true;
+                push_task([this, &lane] { drain_lane(lane); });
+            }
+        }
+
+        // Blocks until every posted task has finished, this must not be called from a pool thread
+        void wait_idle()
+        {
+            std::unique_lock lock(m_sleep_mutex);
+            m_idle.wait(lock, [this] { return m_unfinished_tasks.load() == 0; });
+        }
+
+        [[nodiscard]] size_t get_thread_count() const noexcept
+        {
+            return m_threads.size();
+        }
+
+    private:
+        // Lane runs this many tasks and then goes to the back of the queue so the other tasks of its thread can run
+        static constexpr size_t LANE_BATCH_SIZE = 32;
+
+        struct Worker
+        {
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+        };
+
+        struct Lane
+        {
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+            bool m_is_scheduled = false;
+        };
+
+        // Consecutive client ids would otherwise fill neighbouring lanes only
+        [[nodiscard]] static uint64_t mix_key(uint64_t key) noexcept
+        {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return key;
+        }
+
+        struct Current_worker
+        {
+            const Work_stealing_pool* m_pool = nullptr;
+            size_t m_index = 0;
+        };
+
+        [[nodiscard]] static Current_worker& current_worker() noexcept
+        {
+            static thread_local Current_worker worker;
+            return worker;
+        }
+
+        void push_task(Task task)
+        {
+            const Current_worker& current = current_worker();
+            const size_t index = current.m_pool == this
+                                     ? current.m_index
+                                     : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+            {
+                std::scoped_lock lock(m_workers[index]->m_mutex);
+                m_workers[index]->m_tasks.push_back(std::move(task));
+            }
+
+            m_queued_tasks.fetch_add(1);
+
+            // Sleeping threads are woken only when someone may be waiting, the lock orders this with their check
+            if (m_sleeping_workers.load() > 0)
+            {
+                std::scoped_lock lock(m_sleep_mutex);
+                m_wakeup.notify_one();
+            }
+        }
+
+        [[nodiscard]] std::optional<Task> pop_task(size_t index)
+        {
+            {
+                Worker& own_worker = *m_workers[index];
+                std::scoped_lock lock(own_worker.m_mutex);
+
+                if (!own_worker.m_tasks.empty())
+                {
+                    Task task = std::move(own_worker.m_tasks.front());
+                    own_worker.m_tasks.pop_front();
+                    return task;
+                }
+            }
+
+            for (size_t i = 1; i < m_workers.size(); ++i)
+            {
+                Worker& victim = *m_workers[(index + i) % m_workers.size()];
+                std::scoped_lock lock(victim.m_mutex);
+
+                if (!victim.m_tasks.empty())
+                {
+                    Task task = std::move(victim.m_tasks.front());
+                    victim.m_tasks.pop_front();
+                    return task;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        void drain_lane(Lane& lane)
+        {
+            for (size_t i = 0; i < LANE_BATCH_SIZE; ++i)
+            {
+                Task task;
+
+                {
+                    std::scoped_lock lock(lane.m_mutex);
+
+                    if (lane.m_tasks.empty())
+                    {
+                        lane.m_is_scheduled = false;
+                        return;
+                    }
+
+                    task = std::move(lane.m_tasks.front());
+                    lane.m_tasks.pop_front();
+                }
+
+                task();
+                finish_task();
+            }
+
+            // Lane stays scheduled, so its next tasks still can't overtake the ones that ran
+            push_task([this, &lane] { drain_lane(lane); });
+        }
+
+        void finish_task()
+        {
+            if (m_unfinished_tasks.fetch_sub(1) == 1)
+            {
+                std::scoped_lock lock(m_sleep_mutex);
+                m_idle.notify_all();
+            }
+        }
+
+        void worker_thread(size_t index)
+        {
+            current_worker() = {.m_pool = this, .m_index = index};
+
+            while (true)
+            {
+                if (std::optional<Task> task = pop_task(index))
+                {
+                    m_queued_tasks.fetch_sub(1);
+                    (*task)();
+                    continue;
+                }
+
+                std::unique_lock lock(m_sleep_mutex);
+                m_sleeping_workers.fetch_add(1);
+                m_wakeup.wait(lock, [this] { return m_is_stopping || m_queued_tasks.load() > 0; });
+                m_sleeping_workers.fetch_sub(1);
+
+                if (m_is_stopping)
+                    return;
+            }
+        }
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::unique_ptr<Lane[]> m_lanes;
+        size_t m_lane_mask = 0;
+        std::atomic<size_t> m_next_worker = 0;
+
+        std::atomic<size_t> m_queued_tasks = 0;
+        std::atomic<size_t> m_unfinished_tasks = 0;
+        std::atomic<size_t> m_sleeping_workers = 0;
+
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_wakeup;
+        std::condition_variable m_idle;
+        bool m_is_stopping = false;
+
+        std::vector<std::thread> m_threads;
+    };
+} // namespace Net
@@ -0,0 +1,357 @@
+#include "Message/Message.h"
+#include "Message/Owned_message.h"
+#include "Utility/Thread_safe_deque.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ *   Microbenchmarks of the message serialization and the queues. The runner works like the Google Benchmark:
+ *   every benchmark loops over the state and the iterations are doubled until the run is long enough.
+ *
+ *   Network_microbenchmark [filter]
+ *   runs only the benchmarks whose name contains the filter.
+ */
+enum class Message_id : uint8_t
+{
+    benchmark
+};
+
+using Benchmark_message = Net::Message<Message_id>;
+
+// Pointer that the compiler can't see through, so the values given to it are not optimized away
+const volatile char* volatile benchmark_sink = nullptr;
+
+template <typename T>
+void do_not_optimize(const T& value)
+{
+    benchmark_sink = &reinterpret_cast<const volatile char&>(value);
+}
+
+// Iterations of one run, the benchmark loops over it with for (auto _ : state)
+class Benchmark_state
+{
+public:
+    struct Iterator
+    {
+        uint64_t m_remaining = 0;
+
+        [[nodiscard]] bool operator!=(const Iterator& other) const noexcept
+        {
+            return m_remaining != other.m_remaining;
+        }
+
+        Iterator& operator++() noexcept
+        {
+            --m_remaining;
+            return *this;
+        }
+
+        [[nodiscard]] int operator*() const noexcept
+        {
+            return 0;
+        }
+    };
+
+    Benchmark_state(uint64_t iterations, int64_t argument) noexcept : m_iterations(iterations), m_argument(argument)
+    {
+    }
+
+    [[nodiscard]] Iterator begin() noexcept
+    {
+        m_start_time = std::chrono::steady_clock::now();
+        return {m_iterations};
+    }
+
+    [[nodiscard]] Iterator end() noexcept
+    {
+        return {0};
+    }
+
+    [[nodiscard]] uint64_t iterations() const noexcept
+    {
+        return m_iterations;
+    }
+
+    // Argument of the registered benchmark, for example the size of the message
+    [[nodiscard]] int64_t argument() const noexcept
+    {
+        return m_argument;
+    }
+
+    // Bytes handled by one iteration, reported as throughput
+    void set_bytes_per_iteration(uint64_t bytes) noexcept
+    {
+        m_bytes_per_iteration = bytes;
+    }
+
+    [[nodiscard]] uint64_t get_bytes_per_iteration() const noexcept
+    {
+        return m_bytes_per_iteration;
+    }
+
+    [[nodiscard]] std::chrono::steady_clock::time_point get_start_time() const noexcept
+    {
+        return m_start_time;
+    }
+
+private:
+    uint64_t m_iterations = 0;
+    int64_t m_argument = 0;
+    uint64_t m_bytes_per_iteration = 0;
+    std::chrono::steady_clock::time_point m_start_time;
+};
+
+struct Benchmark
+{
+    std::string m_name;
+    std::function<void(Benchmark_state&)> m_function;
+    int64_t m_argument = 0;
+};
+
+std::vector<Benchmark>& get_benchmarks()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+void register_benchmark(std::string name, std::function<void(Benchmark_state&)> function, int64_t argument = 0)
+{
+    get_benchmarks().push_back({std::move(name), std::move(function), argument});
+}
+
+void run_benchmark(const Benchmark& benchmark)
+{
+    constexpr auto min_run_time = std::chrono::milliseconds(500);
+    constexpr uint64_t max_iterations = 1'000'000'000;
+
+    for (uint64_t iterations = 1;; iterations *= 2)
+    {
+        Benchmark_state state(iterations, benchmark.m_argument);
+        benchmark.m_function(state);
+        const auto run_time = std::chrono::steady_clock::now() - state.get_start_time();
+
+        if (run_time < min_run_time && iterations < max_iterations)
+            continue;
+
+        const double nanoseconds = std::chrono::duration<double, std::nano>(run_time).count() / iterations;
+        std::cout << std::format("{:<48} {:>12.1f} ns {:>12}", benchmark.m_name, nanoseconds, iterations);
+
+        if (state.get_bytes_per_iteration() > 0)
+            std::cout << std::format(" {:>10.1f} MB/s", state.get_bytes_per_iteration() / nanoseconds * 1000);
+
+        std::cout << "\n";
+        return;
+    }
+}
+
+void push_extract_scalar(Benchmark_state& state)
+{
+    Benchmark_message message;
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        message.push_back(state.iterations());
+        do_not_optimize(message.extract<uint64_t>());
+    }
+}
+
+void push_extract_scalars(Benchmark_state& state)
+{
+    const auto count = static_cast<uint64_t>(state.argument());
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Benchmark_message message;
+
+        for (uint64_t i = 0; i < count; ++i)
+            message.push_back(i);
+
+        for (uint64_t i = 0; i < count; ++i)
+            do_not_optimize(message.extract<uint64_t>());
+    }
+
+    state.set_bytes_per_iteration(count * sizeof(uint64_t));
+}
+
+void push_extract_string(Benchmark_state& state)
+{
+    const std::string text(static_cast<size_t>(state.argument()), 'x');
+    Benchmark_message message;
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        message.push_back(text);
+        do_not_optimize(message.extract<std::string>());
+    }
+
+    state.set_bytes_per_iteration(text.size());
+}
+
+// Grows the message to the size in small pushes like a writer does
+void push_buffer_growth(Benchmark_state& state)
+{
+    const size_t size = static_cast<size_t>(state.argument());
+    const std::array<char, 64> chunk = {};
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Benchmark_message message;
+
+        for (size_t pushed = 0; pushed < size; pushed += chunk.size())
+            message.push_back_buffer(chunk.data(), chunk.size());
+
+        do_not_optimize(message);
+    }
+
+    state.set_bytes_per_iteration(size);
+}
+
+void push_buffer_reserved(Benchmark_state& state)
+{
+    const size_t size = static_cast<size_t>(state.argument());
+    const std::array<char, 64> chunk = {};
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Benchmark_message message;
+        message.reserve(size);
+
+        for (size_t pushed = 0; pushed < size; pushed += chunk.size())
+            message.push_back_buffer(chunk.data(), chunk.size());
+
+        do_not_optimize(message);
+    }
+
+    state.set_bytes_per_iteration(size);
+}
+
+[[nodiscard]] Benchmark_message create_message(size_t body_size)
+{
+    Benchmark_message message;
+    message.set_id(Message_id::benchmark);
+    message.resize_body(body_size);
+    return message;
+}
+
+void message_copy(Benchmark_state& state)
+{
+    const Benchmark_message message = create_message(static_cast<size_t>(state.argument()));
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Benchmark_message copy = message;
+        do_not_optimize(copy);
+    }
+
+    state.set_bytes_per_iteration(message.body_size());
+}
+
+void message_move(Benchmark_state& state)
+{
+    Benchmark_message message = create_message(static_cast<size_t>(state.argument()));
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Benchmark_message moved = std::move(message);
+        do_not_optimize(moved);
+        message = std::move(moved);
+    }
+}
+
+void owned_message_construction(Benchmark_state& state)
+{
+    Benchmark_message message = create_message(static_cast<size_t>(state.argument()));
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        Net::Owned_message<Message_id> owned_message(std::move(message), Net::Client_information(1, "127.0.0.1"));
+        do_not_optimize(owned_message);
+        message = std::move(owned_message.m_message);
+    }
+}
+
+// Every thread pushes and then pops, so a pop never finds the deque empty
+void thread_safe_deque_contention(Benchmark_state& state)
+{
+    const auto background_threads = static_cast<size_t>(state.argument());
+    Net::Thread_safe_deque<uint64_t> deque;
+    std::atomic<bool> stop_flag = false;
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < background_threads; ++i)
+    {
+        threads.emplace_back([&deque, &stop_flag] {
+            for (uint64_t value = 0; !stop_flag.load(std::memory_order_relaxed); ++value)
+            {
+                deque.push_back(value);
+                do_not_optimize(deque.pop_front());
+            }
+        });
+    }
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        deque.push_back(state.iterations());
+        do_not_optimize(deque.pop_front());
+    }
+
+    stop_flag = true;
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void register_benchmarks()
+{
+    register_benchmark("Message push_back/extract uint64", push_extract_scalar);
+
+    for (const int64_t count : {16, 256})
+        register_benchmark(std::format("Message push_back/extract {} uint64", count), push_extract_scalars, count);
+
+    for (const int64_t size : {16, 256, 4096})
+        register_benchmark(std::format("Message push_back/extract string {}", size), push_extract_string, size);
+
+    for (const int64_t size : {1024, 65536})
+    {
+        register_benchmark(std::format("Message push_back_buffer growth {}", size), push_buffer_growth, size);
+        register_benchmark(std::format("Message push_back_buffer reserved {}", size), push_buffer_reserved, size);
+    }
+
+    for (const int64_t size : {0, 64, 1024, 65536})
+    {
+        register_benchmark(std::format("Message copy {}", size), message_copy, size);
+        register_benchmark(std::format("Message move {}", size), message_move, size);
+    }
+
+    for (const int64_t size : {0, 1024})
+        register_benchmark(std::format("Owned_message construction {}", size), owned_message_construction, size);
+
+    const auto hardware_threads = static_cast<int64_t>(std::max(std::thread::hardware_concurrency(), 2u));
+
+    for (const int64_t threads : {int64_t(0), int64_t(1), hardware_threads - 1})
+        register_benchmark(
+            std::format("Thread_safe_deque push/pop {} other threads", threads), thread_safe_deque_contention, threads);
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string_view filter = argc > 1 ? argv[1] : "";
+    register_benchmarks();
+
+    std::cout << std::format("{:<48} {:>15} {:>12}\n", "Benchmark", "Time", "Iterations");
+
+    for (const Benchmark& benchmark : get_benchmarks())
+        if (benchmark.m_name.find(filter) != std::string::npos)
+            run_benchmark(benchmark);
+}
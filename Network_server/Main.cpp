@@ -30,55 +30,54 @@ void server_notification(std::string_view notification, [[maybe_unused]] Net::Se
 }
 
 // Setups name for the client and sends back accepted string
-void on_set_name(uint32_t client_id, Net::Message<Message_id> message)
+void on_set_name(const Net::Client_information& client, Net::Message<Message_id> message)
 {
-    const std::string name = message.extract<std::string>();
-    names[client_id] = name;
+    Net::Message_reader reader(message);
+    const std::string name = reader.read<std::string>();
+    names[client.m_id] = name;
 
-    const std::string respond = "Name accepted";
-    Net::Message<Message_id> net_message;
-    net_message.set_id(Message_id::server_message);
-    net_message << respond;
+    // Reuses the body of an already handled message
+    Net::Message<Message_id> net_message = server.acquire_message(Message_id::server_message);
+    Net::Message_writer writer(net_message);
+    writer << "Name accepted";
 
-    server.send_message_to_client(client_id, net_message);
+    server.send_message_to_client(client.m_id, std::move(net_message));
 
-    std::cout << "Set name " << name << " for client " << client_id << "\n";
+    std::cout << "Set name " << name << " for client " << client.m_id << "\n";
 }
 
 // Handles received chat messages
-void on_chat_message(uint32_t client_id, Net::Message<Message_id> message)
+void on_chat_message(const Net::Client_information& client, Net::Message<Message_id> message)
 {
-    const auto found_name = names.find(client_id);
+    const auto found_name = names.find(client.m_id);
+
+    // The chat message is only viewed in the received message so it is not copied
+    Net::Message_reader reader(message, server.get_string_limits(Message_id::client_message));
+    std::string_view chat_message;
+
+    // Client that sends too long or malformed text is disconnected
+    try
+    {
+        chat_message = reader.read_string_view();
+    }
+    catch (const std::exception&)
+    {
+        server.disconnect_client(client.m_id);
+        return;
+    }
 
-    const std::string chat_message = message.extract<std::string>();
     const std::string formated_message = std::format("[{}] {}", found_name->second, chat_message);
 
     Net::Message<Message_id> net_message;
     net_message.set_id(Message_id::server_message);
-    net_message << formated_message;
+    Net::Message_writer writer(net_message);
+    writer << formated_message;
 
     server.send_message_to_all_clients(net_message);
 
     std::cout << formated_message << "\n";
 }
 
-// Event when message is received from the client
-void server_on_message(Net::Client_information client, Net::Message<Message_id> message)
-{
-    switch (message.get_id())
-    {
-    case Message_id::client_set_name:
-        on_set_name(client.m_id, std::move(message));
-        break;
-    case Message_id::client_message:
-        on_chat_message(client.m_id, std::move(message));
-        break;
-    default:
-        server.disconnect_client(client.m_id);
-        break;
-    }
-}
-
 int main()
 {
     try
@@ -86,14 +85,19 @@ int main()
         // Setups accepted messages and callbacks
         server.add_accepted_message(Message_id::client_set_name);
         server.add_accepted_message(Message_id::client_message);
+        server.set_string_limits(Message_id::client_message, {.m_max_size = 1024, .m_is_utf8 = true});
 
         server.m_on_notification.set_callback(server_notification);
-        server.m_on_message.set_callback(server_on_message);
+        server.register_handler(Message_id::client_set_name, on_set_name);
+        server.register_handler(Message_id::client_message, on_chat_message);
 
         // setup ssl stuff
         server.set_ssl_certificate_chain_file("server.crt");
         server.set_ssl_private_key_file("server.key");
-        server.set_ssl_tmp_dh_file("dh512.pem");
+        server.set_tls_profile(Net::Tls_profile::modern());
+
+        // Keeps the sessions of the disconnected clients so they can continue them
+        server.set_session_resume(std::chrono::seconds(60));
 
         // Starts the server
         server.start();